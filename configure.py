@@ -221,8 +221,9 @@ parser.add_option('--with-python', metavar='EXE',
                   help='use EXE as the Python interpreter',
                   default=os.path.basename(sys.executable))
 parser.add_option('--force-pselect', action='store_true',
-                  help='ppoll() is used by default where available, '
-                       'but some platforms may need to use pselect instead',)
+                  help='epoll (on Linux) or ppoll() is used by default where '
+                       'available, but some platforms may need to use '
+                       'pselect instead',)
 (options, args) = parser.parse_args()
 if args:
     print('ERROR: extra unparsed command-line arguments:', args)
@@ -324,8 +325,7 @@ if platform.is_msvc():
               # We never have strings or arrays larger than 2**31.
               '/wd4267',
               '/DNOMINMAX', '/D_CRT_SECURE_NO_WARNINGS',
-              '/D_HAS_EXCEPTIONS=0',
-              '/DNINJA_PYTHON="%s"' % options.with_python]
+              '/D_HAS_EXCEPTIONS=0']
     if platform.msvc_needs_fs():
         cflags.append('/FS')
     ldflags = ['/DEBUG', '/libpath:$builddir']
@@ -339,8 +339,7 @@ else:
               '-Wno-unused-parameter',
               '-fno-rtti',
               '-fno-exceptions',
-              '-fvisibility=hidden', '-pipe',
-              '-DNINJA_PYTHON="%s"' % options.with_python]
+              '-fvisibility=hidden', '-pipe']
     if options.debug:
         cflags += ['-D_GLIBCXX_DEBUG', '-D_GLIBCXX_DEBUG_PEDANTIC']
         cflags.remove('-fno-rtti')  # Needed for above pedanticness.
@@ -365,6 +364,9 @@ else:
         # printf formats for int64_t, uint64_t; large file support
         cflags.append('-D__STDC_FORMAT_MACROS')
         cflags.append('-D_LARGE_FILES')
+    # std::thread, used by the parallel stat pass.
+    cflags.append('-pthread')
+    ldflags.append('-pthread')
 
 
 libs = []
@@ -388,6 +390,8 @@ else:
 
 if platform.supports_ppoll() and not options.force_pselect:
     cflags.append('-DUSE_PPOLL')
+if platform.is_linux() and not options.force_pselect:
+    cflags.append('-DUSE_EPOLL')
 if platform.supports_ninja_browse():
     cflags.append('-DNINJA_HAVE_BROWSE')
 
@@ -398,7 +402,7 @@ def shell_escape(str):
     """Escape str such that it's interpreted as a single argument by
     the shell."""
 
-    # This isn't complete, but it's just enough to make NINJA_PYTHON work.
+    # This isn't complete, but it's just enough for the flags we pass.
     if platform.is_windows():
       return str
     if '"' in str:
@@ -458,16 +462,7 @@ n.newline()
 objs = []
 
 if platform.supports_ninja_browse():
-    n.comment('browse_py.h is used to inline browse.py.')
-    n.rule('inline',
-           command='"%s"' % src('inline.sh') + ' $varname < $in > $out',
-           description='INLINE $out')
-    n.build(built('browse_py.h'), 'inline', src('browse.py'),
-            implicit=src('inline.sh'),
-            variables=[('varname', 'kBrowsePy')])
-    n.newline()
-
-    objs += cxx('browse', order_only=built('browse_py.h'))
+    objs += cxx('browse')
     n.newline()
 
 n.comment('the depfile parser and ninja lexers are generated using re2c.')
@@ -493,10 +488,15 @@ n.comment('Core source files all build into ninja library.')
 cxxvariables = []
 if platform.is_msvc():
     cxxvariables = [('pdb', 'ninja.pdb')]
-for name in ['build',
+for name in ['action_cache',
+             'arena',
+             'build',
+             'build_dir_lock',
              'build_log',
+             'build_session',
              'clean',
              'clparser',
+             'daemon',
              'debug_flags',
              'depfile_parser',
              'deps_log',
@@ -505,20 +505,38 @@ for name in ['build',
              'dyndep_parser',
              'edit_distance',
              'eval_env',
+             'explain_log',
              'graph',
+             'graph_snapshot',
              'graphviz',
+             'hash_log',
+             'jobserver',
              'lexer',
              'line_printer',
+             'log_writer',
+             'manifest_cache',
              'manifest_parser',
+             'manifest_stats',
+             'mapped_file',
+             'memory_stats',
              'metrics',
+             'metrics_server',
+             'output_dedup',
+             'parallel',
              'parser',
+             'reformat',
+             'remote_cache',
+             'shard',
              'state',
              'string_piece_util',
+             'terminal_writer',
+             'trace',
              'util',
              'version']:
     objs += cxx(name, variables=cxxvariables)
 if platform.is_windows():
     for name in ['subprocess-win32',
+                 'jobserver-win32',
                  'includes_normalize-win32',
                  'msvc_helper-win32',
                  'msvc_helper_main-win32']:
@@ -528,6 +546,10 @@ if platform.is_windows():
     objs += cc('getopt')
 else:
     objs += cxx('subprocess-posix')
+    objs += cxx('jobserver-posix')
+    objs += cxx('daemon-posix')
+    objs += cxx('metrics_server-posix')
+    objs += cxx('remote_cache-posix')
 if platform.is_aix():
     objs += cc('getopt')
 if platform.is_msvc():
@@ -565,28 +587,54 @@ objs = []
 if platform.is_msvc():
     cxxvariables = [('pdb', 'ninja_test.pdb')]
 
-for name in ['build_log_test',
+for name in ['action_cache_test',
+             'arena_test',
+             'build_log_test',
+             'build_session_test',
              'build_test',
              'clean_test',
              'clparser_test',
+             'daemon_test',
              'depfile_parser_test',
              'deps_log_test',
              'dyndep_parser_test',
              'disk_interface_test',
              'edit_distance_test',
+             'eval_env_test',
+             'explain_log_test',
              'graph_test',
+             'graph_snapshot_test',
+             'graphviz_test',
+             'hash_log_test',
+             'hash_map_test',
+             'jobserver_test',
              'lexer_test',
+             'log_writer_test',
+             'manifest_cache_test',
              'manifest_parser_test',
+             'manifest_stats_test',
+             'memory_stats_test',
+             'metrics_server_test',
+             'metrics_test',
              'ninja_test',
+             'output_dedup_test',
+             'parallel_test',
+             'reformat_test',
+             'remote_cache_test',
+             'shard_test',
              'state_test',
              'string_piece_util_test',
              'subprocess_test',
+             'terminal_writer_test',
              'test',
+             'trace_test',
              'util_test']:
     objs += cxx(name, variables=cxxvariables)
 if platform.is_windows():
     for name in ['includes_normalize_test', 'msvc_helper_test']:
         objs += cxx(name, variables=cxxvariables)
+if platform.supports_ninja_browse():
+    objs += cxx('browse_test', variables=cxxvariables)
 
 ninja_test = n.build(binary('ninja_test'), 'link', objs, implicit=ninja_lib,
                      variables=[('libs', libs)])
@@ -602,11 +650,16 @@ if platform.is_aix() and '-maix64' not in ldflags:
     libs.append('-Wl,-bmaxdata:0x80000000')
 
 for name in ['build_log_perftest',
+             'build_perftest',
              'canon_perftest',
              'depfile_parser_perftest',
+             'deps_log_perftest',
+             'graph_scan_perftest',
              'hash_collision_bench',
              'manifest_parser_perftest',
-             'clparser_perftest']:
+             'scheduler_perftest',
+             'clparser_perftest',
+             'strip_ansi_perftest']:
   if platform.is_msvc():
     cxxvariables = [('pdb', name + '.pdb')]
   objs = cxx(name, variables=cxxvariables)
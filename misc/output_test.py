@@ -108,6 +108,23 @@ red
         self.assertEqual(run('', flags='-t recompact'), '')
         self.assertEqual(run('', flags='-t restat'), '')
 
+    def test_tool_dirty(self):
+        manifest = '''rule touch
+  command = touch $out
+rule cat
+  command = cat $in > $out
+
+build a b: touch
+build c: cat a
+build all: phony c
+'''
+        self.assertEqual(run(manifest, flags='-t dirty', pipe=True),
+                         'a\nb\nc\n')
+        self.assertEqual(run(manifest, flags='-t dirty -e all', pipe=True),
+                         'touch a b\ncat c\n')
+        self.assertEqual(run(manifest, flags='-t dirty -r cat', pipe=True),
+                         'c\n')
+
     def test_status(self):
         self.assertEqual(run(''), 'ninja: no work to do.\n')
 
@@ -0,0 +1,643 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "action_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <map>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>  // FICLONE
+#endif
+#endif
+
+#include "graph.h"
+#include "hash_log.h"
+#include "metrics.h"
+#include "parallel.h"
+#include "remote_cache.h"
+#include "state.h"
+
+using namespace std;
+
+namespace {
+
+const char kManifestSignature[] = "# ninja cache v1\n";
+const size_t kManifestSignatureSize = sizeof(kManifestSignature) - 1;
+const char kManifestSuffix[] = ".manifest";
+const char kBlobSignature[] = "# ninja cache blob v1\n";
+const size_t kBlobSignatureSize = sizeof(kBlobSignature) - 1;
+
+/// Uploads wait on the network rather than the CPU.
+const int kUploadThreads = 4;
+
+/// After this many failed requests, the remote cache is down as far as
+/// this process is concerned.
+const int64_t kMaxRemoteErrors = 10;
+
+void PutU64(uint64_t value, string* out) {
+  out->append((const char*)&value, sizeof(value));
+}
+
+void PutString(const string& str, string* out) {
+  PutU64(str.size(), out);
+  out->append(str);
+}
+
+/// Reads back what PutU64() and PutString() wrote.
+struct ManifestReader {
+  ManifestReader(const string& data) : pos_(data.data()),
+                                       end_(data.data() + data.size()) {}
+
+  bool GetU64(uint64_t* value) {
+    if ((size_t)(end_ - pos_) < sizeof(*value))
+      return false;
+    memcpy(value, pos_, sizeof(*value));
+    pos_ += sizeof(*value);
+    return true;
+  }
+
+  bool GetString(string* str) {
+    uint64_t size;
+    if (!GetU64(&size) || (uint64_t)(end_ - pos_) < size)
+      return false;
+    str->assign(pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  bool Skip(size_t size) {
+    if ((size_t)(end_ - pos_) < size)
+      return false;
+    pos_ += size;
+    return true;
+  }
+
+ private:
+  const char* pos_;
+  const char* end_;
+};
+
+/// The digest of the contents of |path|, like HashLog::ContentDigest().
+bool Digest(const string& path, DiskInterface* disk_interface,
+            HashLog* hash_log, uint64_t* digest, string* err) {
+  TimeStamp mtime = disk_interface->Stat(path, err);
+  if (mtime == -1)
+    return false;
+  if (hash_log) {
+    *digest = hash_log->ContentDigest(path, mtime, disk_interface);
+    return true;
+  }
+  string contents, read_err;
+  *digest = (uint64_t)mtime;
+  if (mtime > 0 && disk_interface->ReadFile(path, &contents, &read_err) ==
+                       DiskInterface::Okay)
+    *digest = Hash64(contents.data(), contents.size());
+  return true;
+}
+
+/// Replace |to| with a copy of |from|, sharing its blocks where the file
+/// system can.
+bool CopyFileContents(const string& from, const string& to, string* err) {
+#ifdef _WIN32
+  if (!CopyFileA(from.c_str(), to.c_str(), FALSE)) {
+    *err = "CopyFile failed";
+    return false;
+  }
+  return true;
+#else
+  int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(in, &st) < 0) {
+    *err = strerror(errno);
+    close(in);
+    return false;
+  }
+  unlink(to.c_str());
+  int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 st.st_mode & 0777);
+  if (out < 0) {
+    *err = strerror(errno);
+    close(in);
+    return false;
+  }
+  bool ok = true;
+#ifdef FICLONE
+  if (ioctl(out, FICLONE, in) == 0) {
+    close(in);
+    return close(out) == 0;
+  }
+#endif
+  char buf[64 << 10];
+  for (;;) {
+    ssize_t len = read(in, buf, sizeof(buf));
+    if (len == 0)
+      break;
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      ok = false;
+      break;
+    }
+    for (ssize_t done = 0; done < len; ) {
+      ssize_t written = write(out, buf + done, len - done);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        ok = false;
+        break;
+      }
+      done += written;
+    }
+    if (!ok)
+      break;
+  }
+  if (!ok)
+    *err = strerror(errno);
+  close(in);
+  if (close(out) < 0 && ok) {
+    *err = strerror(errno);
+    ok = false;
+  }
+  return ok;
+#endif
+}
+
+/// Move |from| over |to|.
+bool RenameFile(const string& from, const string& to, string* err) {
+#ifdef _WIN32
+  if (!MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+    *err = "MoveFileEx failed";
+    return false;
+  }
+#else
+  if (rename(from.c_str(), to.c_str()) < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+#endif
+  return true;
+}
+
+/// A file of the cache, for Trim().
+struct CacheFile {
+  string path;
+  int64_t size;
+  time_t mtime;
+};
+
+/// Add the files in |dir| to |files|.
+void ListFiles(const string& dir, vector<CacheFile>* files) {
+#ifdef _WIN32
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE)
+    return;
+  do {
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+      continue;
+    CacheFile file;
+    file.path = dir + "/" + data.cFileName;
+    file.size = ((int64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    struct stat st;
+    file.mtime = stat(file.path.c_str(), &st) == 0 ? st.st_mtime : 0;
+    files->push_back(file);
+  } while (FindNextFileA(find, &data));
+  FindClose(find);
+#else
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return;
+  while (struct dirent* ent = readdir(d)) {
+    if (ent->d_name[0] == '.')
+      continue;
+    CacheFile file;
+    file.path = dir + "/" + ent->d_name;
+    struct stat st;
+    if (stat(file.path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+      continue;
+    file.size = st.st_size;
+    file.mtime = st.st_mtime;
+    files->push_back(file);
+  }
+  closedir(d);
+#endif
+}
+
+/// The subdirectories of |dir|.
+void ListDirs(const string& dir, vector<string>* dirs) {
+#ifdef _WIN32
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE)
+    return;
+  do {
+    if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+        data.cFileName[0] != '.')
+      dirs->push_back(dir + "/" + data.cFileName);
+  } while (FindNextFileA(find, &data));
+  FindClose(find);
+#else
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return;
+  while (struct dirent* ent = readdir(d)) {
+    if (ent->d_name[0] == '.')
+      continue;
+    string path = dir + "/" + ent->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+      dirs->push_back(path);
+  }
+  closedir(d);
+#endif
+}
+
+string Hex(uint64_t value) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  string hex(16, '0');
+  for (int i = 15; i >= 0; --i, value >>= 4)
+    hex[i] = kHexDigits[value & 0xf];
+  return hex;
+}
+
+/// The suffix of the temporary files an entry is written to before they
+/// move into place.
+string TempSuffix() {
+  char suffix[32];
+#ifdef _WIN32
+  snprintf(suffix, sizeof(suffix), ".tmp%lu", GetCurrentProcessId());
+#else
+  snprintf(suffix, sizeof(suffix), ".tmp%d", (int)getpid());
+#endif
+  return suffix;
+}
+
+}  // anonymous namespace
+
+ActionCache::ActionCache(const string& dir, int64_t max_size)
+    : dir_(dir), max_size_(max_size), stored_(false), remote_(NULL),
+      errors_reported_(0) {}
+
+ActionCache::~ActionCache() {
+  if (uploads_)
+    uploads_->Wait();
+}
+
+// static
+bool ActionCache::IsCacheable(const Edge* edge) {
+  if (edge->is_phony() || edge->outputs_.empty() || edge->dyndep_ ||
+      edge->pool() == &State::kConsolePool || edge->streams_output() ||
+      !edge->GetBindingBool(kSymbolCache) ||
+      edge->GetBindingBool(kSymbolGenerator))
+    return false;
+  // Without "deps", the deps in a depfile are only read at the next scan.
+  return !edge->GetBinding(kSymbolDeps).empty() ||
+         edge->GetUnescapedDepfile().empty();
+}
+
+string ActionCache::EntryPath(uint64_t hash) const {
+  string hex = Hex(hash);
+  return dir_ + "/" + hex.substr(0, 2) + "/" + hex;
+}
+
+bool ActionCache::ComputeKey(const Edge* edge, DiskInterface* disk_interface,
+                             HashLog* hash_log, Key* key, string* err) {
+  METRIC_RECORD("action cache key");
+  key->command = edge->EvaluateCommand(true);
+  vector<uint64_t> parts;
+  parts.push_back(Hash64(key->command.data(), key->command.size()));
+  for (vector<Node*>::const_iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o)
+    parts.push_back(Hash64((*o)->path().data(), (*o)->path().size()));
+
+  // The deps loaded by the scan are checked by Restore(), so leave them out
+  // of the key, like a first build would.
+  size_t declared = edge->inputs_.size() - edge->order_only_deps_ -
+                    edge->loaded_deps_;
+  key->inputs.clear();
+  key->inputs.reserve(declared);
+  for (size_t i = 0; i < declared; ++i) {
+    const string& path = edge->inputs_[i]->path();
+    uint64_t digest;
+    if (!Digest(path, disk_interface, hash_log, &digest, err))
+      return false;
+    key->inputs.push_back(make_pair(path, digest));
+    parts.push_back(Hash64(path.data(), path.size()));
+    parts.push_back(digest);
+  }
+  key->hash = Hash64(parts.data(), parts.size() * sizeof(parts[0]));
+  return true;
+}
+
+bool ActionCache::Restore(const Edge* edge, const Key& key,
+                          DiskInterface* disk_interface, HashLog* hash_log,
+                          vector<Dep>* deps, string* output) {
+  METRIC_RECORD("action cache restore");
+  string base = EntryPath(key.hash);
+  string manifest_path = base + kManifestSuffix;
+  string manifest, err;
+  if (::ReadFile(manifest_path, &manifest, &err) < 0)
+    return false;
+  if (manifest.compare(0, kManifestSignatureSize, kManifestSignature) != 0)
+    return false;
+
+  // Anything not matching the key exactly is a collision; treat it as a
+  // miss, which the edge's run then replaces.
+  ManifestReader reader(manifest);
+  reader.Skip(kManifestSignatureSize);
+  string command;
+  uint64_t count;
+  if (!reader.GetString(&command) || command != key.command ||
+      !reader.GetU64(&count) || count != key.inputs.size())
+    return false;
+  for (size_t i = 0; i < count; ++i) {
+    string path;
+    uint64_t digest;
+    if (!reader.GetString(&path) || !reader.GetU64(&digest) ||
+        path != key.inputs[i].first || digest != key.inputs[i].second)
+      return false;
+  }
+
+  // The deps must have the contents they had.
+  deps->clear();
+  if (!reader.GetU64(&count))
+    return false;
+  for (size_t i = 0; i < count; ++i) {
+    Dep dep;
+    uint64_t recorded, digest;
+    if (!reader.GetString(&dep.path) || !reader.GetU64(&dep.slash_bits) ||
+        !reader.GetU64(&recorded) ||
+        !Digest(dep.path, disk_interface, hash_log, &digest, &err) ||
+        digest != recorded)
+      return false;
+    deps->push_back(dep);
+  }
+
+  if (!reader.GetU64(&count) || count != edge->outputs_.size())
+    return false;
+  for (size_t i = 0; i < count; ++i) {
+    string path;
+    if (!reader.GetString(&path) || path != edge->outputs_[i]->path())
+      return false;
+  }
+  if (!reader.GetString(output))
+    return false;
+
+  for (size_t i = 0; i < edge->outputs_.size(); ++i) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d", (int)i);
+    if (!CopyFileContents(base + suffix, edge->outputs_[i]->path(), &err))
+      return false;
+  }
+
+  // Mark the entry as recently used.
+  utime(manifest_path.c_str(), NULL);
+  return true;
+}
+
+bool ActionCache::Store(const Edge* edge, const Key& key,
+                        const vector<Node*>& deps, const string& output,
+                        DiskInterface* disk_interface, HashLog* hash_log,
+                        string* err) {
+  METRIC_RECORD("action cache store");
+  string base = EntryPath(key.hash);
+  if (!disk_interface_.MakeDirs(base)) {
+    *err = "creating " + base + ": " + strerror(errno);
+    return false;
+  }
+
+  string manifest(kManifestSignature, kManifestSignatureSize);
+  PutString(key.command, &manifest);
+  PutU64(key.inputs.size(), &manifest);
+  for (size_t i = 0; i < key.inputs.size(); ++i) {
+    PutString(key.inputs[i].first, &manifest);
+    PutU64(key.inputs[i].second, &manifest);
+  }
+  PutU64(deps.size(), &manifest);
+  for (vector<Node*>::const_iterator d = deps.begin(); d != deps.end(); ++d) {
+    uint64_t digest;
+    if (!Digest((*d)->path(), disk_interface, hash_log, &digest, err))
+      return false;
+    PutString((*d)->path(), &manifest);
+    PutU64((*d)->slash_bits(), &manifest);
+    PutU64(digest, &manifest);
+  }
+  PutU64(edge->outputs_.size(), &manifest);
+  for (vector<Node*>::const_iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o)
+    PutString((*o)->path(), &manifest);
+  PutString(output, &manifest);
+
+  // Write the outputs first and the manifest last, each to a temporary
+  // file moved into place, so that other builds never see half an entry.
+  char suffix[32];
+  string temp_path = base + TempSuffix();
+  for (size_t i = 0; i < edge->outputs_.size(); ++i) {
+    snprintf(suffix, sizeof(suffix), ".%d", (int)i);
+    if (!CopyFileContents(edge->outputs_[i]->path(), temp_path, err) ||
+        !RenameFile(temp_path, base + suffix, err)) {
+      unlink(temp_path.c_str());
+      return false;
+    }
+  }
+  if (!disk_interface_.WriteFile(temp_path, manifest) ||
+      !RenameFile(temp_path, base + kManifestSuffix, err)) {
+    if (err->empty())
+      *err = "writing " + temp_path;
+    unlink(temp_path.c_str());
+    return false;
+  }
+  stored_ = true;
+
+  if (remote_ && remote_->errors() < kMaxRemoteErrors) {
+    if (!uploads_)
+      uploads_.reset(new TaskGroup(kUploadThreads));
+    uint64_t hash = key.hash;
+    uploads_->Add([this, hash]() {
+      // Failures are counted by remote_, for Trim() to warn about.
+      string blob, upload_err;
+      if (PackEntry(hash, &blob, &upload_err))
+        remote_->Put(Hex(hash), blob, &upload_err);
+    });
+  }
+  return true;
+}
+
+bool ActionCache::Fetch(const Key& key) {
+  if (remote_->errors() >= kMaxRemoteErrors)
+    return false;
+  string blob, err;
+  if (remote_->Get(Hex(key.hash), &blob, &err) != RemoteCache::Okay)
+    return false;
+  // A blob that doesn't unpack is as good as missing.
+  return UnpackEntry(key.hash, blob, &err);
+}
+
+bool ActionCache::PackEntry(uint64_t hash, string* blob, string* err) const {
+  string base = EntryPath(hash);
+  string manifest;
+  if (::ReadFile(base + kManifestSuffix, &manifest, err) < 0)
+    return false;
+  // The outputs, with their permissions, so that executables stay so.
+  string outputs;
+  uint64_t count = 0;
+  for (;; ++count) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d", (int)count);
+    struct stat st;
+    string contents, read_err;
+    if (stat((base + suffix).c_str(), &st) < 0 ||
+        ::ReadFile(base + suffix, &contents, &read_err) < 0)
+      break;
+    PutU64(st.st_mode & 0777, &outputs);
+    PutString(contents, &outputs);
+  }
+
+  blob->assign(kBlobSignature, kBlobSignatureSize);
+  PutString(manifest, blob);
+  PutU64(count, blob);
+  blob->append(outputs);
+  return true;
+}
+
+bool ActionCache::UnpackEntry(uint64_t hash, const string& blob,
+                              string* err) {
+  ManifestReader reader(blob);
+  string manifest;
+  uint64_t count;
+  if (blob.compare(0, kBlobSignatureSize, kBlobSignature) != 0 ||
+      !reader.Skip(kBlobSignatureSize) || !reader.GetString(&manifest) ||
+      !reader.GetU64(&count)) {
+    *err = "malformed cache blob";
+    return false;
+  }
+
+  string base = EntryPath(hash);
+  if (!disk_interface_.MakeDirs(base)) {
+    *err = "creating " + base + ": " + strerror(errno);
+    return false;
+  }
+  // As in Store(), the manifest goes last.  The temporary file is this
+  // entry's alone, so other threads unpacking other entries don't mind.
+  string temp_path = base + TempSuffix();
+  string contents;
+  for (uint64_t i = 0; i <= count; ++i) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d", (int)i);
+    uint64_t mode = 0644;
+    if (i < count && (!reader.GetU64(&mode) || !reader.GetString(&contents))) {
+      *err = "malformed cache blob";
+      return false;
+    }
+    if (i == count)
+      contents.swap(manifest);
+    string path = base + (i < count ? suffix : kManifestSuffix);
+    if (!disk_interface_.WriteFile(temp_path, contents) ||
+#ifndef _WIN32
+        chmod(temp_path.c_str(), (mode_t)(mode & 0777)) < 0 ||
+#endif
+        !RenameFile(temp_path, path, err)) {
+      if (err->empty())
+        *err = "writing " + temp_path;
+      unlink(temp_path.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+void ActionCache::Trim() {
+  if (uploads_)
+    uploads_->Wait();
+  if (remote_ && remote_->errors() > errors_reported_) {
+    Warning("%d requests to the remote cache failed; the last one: %s",
+            (int)(remote_->errors() - errors_reported_),
+            remote_->last_error().c_str());
+    errors_reported_ = remote_->errors();
+  }
+
+  if (!stored_)
+    return;
+  METRIC_RECORD("action cache trim");
+  stored_ = false;
+
+  // Group the files by entry; an entry was last used when its manifest was
+  // last touched.
+  struct Entry {
+    Entry() : size(0), last_used(0) {}
+    vector<string> files;
+    int64_t size;
+    time_t last_used;
+  };
+  map<string, Entry> entries;
+  int64_t total_size = 0;
+  vector<string> dirs;
+  ListDirs(dir_, &dirs);
+  for (vector<string>::iterator d = dirs.begin(); d != dirs.end(); ++d) {
+    vector<CacheFile> files;
+    ListFiles(*d, &files);
+    for (vector<CacheFile>::iterator f = files.begin(); f != files.end();
+         ++f) {
+      size_t slash = f->path.rfind('/');
+      Entry& entry = entries[f->path.substr(0, f->path.find('.', slash))];
+      entry.files.push_back(f->path);
+      entry.size += f->size;
+      entry.last_used = max(entry.last_used, f->mtime);
+      total_size += f->size;
+    }
+  }
+  if (total_size <= max_size_)
+    return;
+
+  vector<pair<time_t, Entry*> > by_age;
+  for (map<string, Entry>::iterator i = entries.begin(); i != entries.end();
+       ++i)
+    by_age.push_back(make_pair(i->second.last_used, &i->second));
+  sort(by_age.begin(), by_age.end());
+  const int64_t target_size = max_size_ / 10 * 9;
+  for (size_t i = 0; i < by_age.size() && total_size > target_size; ++i) {
+    Entry* entry = by_age[i].second;
+    // Remove the manifest first, so that the entry is gone as a whole.
+    sort(entry->files.begin(), entry->files.end(),
+         [](const string& a, const string& b) {
+           bool a_manifest = a.find(kManifestSuffix) != string::npos;
+           bool b_manifest = b.find(kManifestSuffix) != string::npos;
+           return a_manifest > b_manifest;
+         });
+    for (size_t f = 0; f < entry->files.size(); ++f)
+      unlink(entry->files[f].c_str());
+    total_size -= entry->size;
+  }
+}
@@ -0,0 +1,135 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_ACTION_CACHE_H_
+#define NINJA_ACTION_CACHE_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "disk_interface.h"
+#include "util.h"  // int64_t
+
+struct Edge;
+struct HashLog;
+struct Node;
+struct RemoteCache;
+struct TaskGroup;
+
+/// ActionCache keeps the outputs of edges with "cache = 1" in a directory
+/// shared between builds (--cache-dir), so that an edge run before with the
+/// same command and inputs gets its outputs copied back instead of running.
+///
+/// An entry is found by the command and the contents of the inputs declared
+/// in the manifest; the deps the command reported are checked next, as they
+/// typically depend on those contents.  Each entry is a manifest file next
+/// to a copy of every output.  The least recently used entries are evicted
+/// once the cache outgrows its size budget.
+///
+/// The entries may be shared between machines through a RemoteCache too:
+/// stored entries are uploaded in the background, and entries missing here
+/// can be fetched from it before Restore() looks again.
+///
+/// The cache works on the real file system, whatever the DiskInterface used
+/// for the build.
+struct ActionCache {
+  ActionCache(const std::string& dir, int64_t max_size);
+  /// Waits for the uploads still running.
+  ~ActionCache();
+
+  void set_remote(RemoteCache* remote) { remote_ = remote; }
+  RemoteCache* remote() const { return remote_; }
+
+  /// Whether the outputs of |edge| may come from the cache: it must opt in,
+  /// not be a generator or use the console, and its inputs must be known
+  /// before it runs. Edges with dyndep, or a depfile without "deps", are
+  /// left out.
+  static bool IsCacheable(const Edge* edge);
+
+  /// What an entry is found by.
+  struct Key {
+    Key() : hash(0) {}
+    uint64_t hash;
+    std::string command;
+    /// The declared inputs, with the digests of their contents.
+    std::vector<std::pair<std::string, uint64_t> > inputs;
+  };
+
+  /// Compute the key of |edge|, stat'ing its inputs.  Digests come from
+  /// |hash_log| if given.
+  bool ComputeKey(const Edge* edge, DiskInterface* disk_interface,
+                  HashLog* hash_log, Key* key, std::string* err);
+
+  /// A dep the command reported, to be recorded again along with the
+  /// restored outputs.
+  struct Dep {
+    std::string path;
+    uint64_t slash_bits;
+  };
+
+  /// Copy the outputs of |edge| stored under |key| back, if its deps still
+  /// have the contents they had.  Fills in the deps and the output of the
+  /// command.
+  /// @return false if there's no such entry.
+  bool Restore(const Edge* edge, const Key& key,
+               DiskInterface* disk_interface, HashLog* hash_log,
+               std::vector<Dep>* deps, std::string* output);
+
+  /// Download the entry of |key| from the remote cache into this one, for
+  /// Restore() to find.  Safe to call from any thread.
+  /// @return false if the remote cache doesn't have it, or on error.
+  bool Fetch(const Key& key);
+
+  /// Store the outputs of |edge|, which just ran with |key|, along with
+  /// its |deps| and |output|, and start uploading them to the remote cache.
+  bool Store(const Edge* edge, const Key& key, const std::vector<Node*>& deps,
+             const std::string& output, DiskInterface* disk_interface,
+             HashLog* hash_log, std::string* err);
+
+  /// Evict the least recently used entries if the cache grew over its
+  /// budget, down to 90% of it.  Only looks if something was stored.
+  /// Waits for the uploads first, and warns if requests to the remote
+  /// cache failed.
+  void Trim();
+
+  /// The path of entry |hash|, without extension.
+  std::string EntryPath(uint64_t hash) const;
+
+  /// Pack the files of entry |hash| into |blob|, as the remote cache
+  /// keeps them.
+  bool PackEntry(uint64_t hash, std::string* blob, std::string* err) const;
+
+  /// Write the files packed into |blob| by PackEntry() as entry |hash|.
+  /// Safe to call from any thread.
+  bool UnpackEntry(uint64_t hash, const std::string& blob, std::string* err);
+
+ private:
+  std::string dir_;
+  int64_t max_size_;
+  bool stored_;
+  RealDiskInterface disk_interface_;
+  RemoteCache* remote_;
+  /// Uploads to remote_, started by Store().
+  std::unique_ptr<TaskGroup> uploads_;
+  /// The failed requests Trim() warned about.
+  int64_t errors_reported_;
+
+  // Unimplemented copy ctor and operator= ensure we don't wait twice.
+  ActionCache(const ActionCache& other);     // DO NOT IMPLEMENT
+  void operator=(const ActionCache& other);  // DO NOT IMPLEMENT
+};
+
+#endif  // NINJA_ACTION_CACHE_H_
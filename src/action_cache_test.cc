@@ -0,0 +1,169 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "action_cache.h"
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include "graph.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+struct ActionCacheTest : public StateTestWithBuiltinRules {
+  ActionCacheTest() : cache_("cache", 1 << 20), edge_(NULL) {}
+
+  virtual void SetUp() {
+    temp_dir_.CreateAndEnter("ActionCacheTest");
+    ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n"
+"  command = cc $in -o $out\n"
+"  deps = gcc\n"
+"  depfile = $out.d\n"
+"  cache = 1\n"
+"build out.o: cc in.c\n"));
+    edge_ = GetNode("out.o")->in_edge();
+  }
+  virtual void TearDown() {
+    temp_dir_.Cleanup();
+  }
+
+  ActionCache::Key Key() {
+    ActionCache::Key key;
+    string err;
+    EXPECT_TRUE(cache_.ComputeKey(edge_, &disk_, NULL, &key, &err));
+    EXPECT_EQ("", err);
+    return key;
+  }
+
+  string Contents(const string& path) {
+    string contents, err;
+    disk_.ReadFile(path, &contents, &err);
+    return contents;
+  }
+
+  ScopedTempDir temp_dir_;
+  RealDiskInterface disk_;
+  ActionCache cache_;
+  Edge* edge_;
+};
+
+TEST_F(ActionCacheTest, IsCacheable) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule depfile_only\n"
+"  command = cc\n"
+"  depfile = $out.d\n"
+"  cache = 1\n"
+"rule console\n"
+"  command = cc\n"
+"  pool = console\n"
+"  cache = 1\n"
+"rule stream\n"
+"  command = cc\n"
+"  stream_output = 1\n"
+"  cache = 1\n"
+"build a: cat in.c\n"
+"build b: depfile_only in.c\n"
+"build c: console in.c\n"
+"build d: stream in.c\n"));
+  EXPECT_TRUE(ActionCache::IsCacheable(edge_));
+  EXPECT_FALSE(ActionCache::IsCacheable(GetNode("a")->in_edge()));
+  EXPECT_FALSE(ActionCache::IsCacheable(GetNode("b")->in_edge()));
+  EXPECT_FALSE(ActionCache::IsCacheable(GetNode("c")->in_edge()));
+  EXPECT_FALSE(ActionCache::IsCacheable(GetNode("d")->in_edge()));
+}
+
+TEST_F(ActionCacheTest, StoreRestore) {
+  disk_.WriteFile("in.c", "int main;");
+  disk_.WriteFile("in.h", "extern int main;");
+  string err;
+  ActionCache::Key key = Key();
+  vector<ActionCache::Dep> deps;
+  string output;
+  EXPECT_FALSE(cache_.Restore(edge_, key, &disk_, NULL, &deps, &output));
+
+  disk_.WriteFile("out.o", "object");
+  vector<Node*> deps_nodes;
+  deps_nodes.push_back(state_.GetNode("in.h", 0));
+  EXPECT_TRUE(cache_.Store(edge_, key, deps_nodes, "warning", &disk_, NULL,
+                           &err));
+  ASSERT_EQ("", err);
+
+  disk_.RemoveFile("out.o");
+  EXPECT_TRUE(cache_.Restore(edge_, Key(), &disk_, NULL, &deps, &output));
+  EXPECT_EQ("object", Contents("out.o"));
+  EXPECT_EQ("warning", output);
+  ASSERT_EQ(1u, deps.size());
+  EXPECT_EQ("in.h", deps[0].path);
+
+  // A dep with other contents misses.
+  disk_.WriteFile("in.h", "extern int other;");
+  EXPECT_FALSE(cache_.Restore(edge_, Key(), &disk_, NULL, &deps, &output));
+  disk_.WriteFile("in.h", "extern int main;");
+  EXPECT_TRUE(cache_.Restore(edge_, Key(), &disk_, NULL, &deps, &output));
+
+  // So does a declared input, which changes the key.
+  disk_.WriteFile("in.c", "int other;");
+  EXPECT_NE(key.hash, Key().hash);
+  EXPECT_FALSE(cache_.Restore(edge_, Key(), &disk_, NULL, &deps, &output));
+}
+
+TEST_F(ActionCacheTest, KeyLeavesOutLoadedDeps) {
+  disk_.WriteFile("in.c", "int main;");
+  ActionCache::Key key = Key();
+
+  // Deps loaded by the scan sit at the end of the implicit inputs.
+  edge_->inputs_.push_back(state_.GetNode("in.h", 0));
+  edge_->implicit_deps_++;
+  edge_->loaded_deps_++;
+  EXPECT_EQ(key.hash, Key().hash);
+}
+
+TEST_F(ActionCacheTest, Trim) {
+  ActionCache cache("cache", 400);
+  disk_.WriteFile("in.c", "1");
+  disk_.WriteFile("out.o", string(150, 'a'));
+  string err;
+  ActionCache::Key old_key = Key();
+  EXPECT_TRUE(cache.Store(edge_, old_key, vector<Node*>(), "", &disk_, NULL,
+                          &err));
+  // Nothing is evicted while under budget.
+  cache.Trim();
+  EXPECT_NE(0, disk_.Stat(cache.EntryPath(old_key.hash) + ".0", &err));
+
+  // Make the first entry older than the second.
+  string manifest = cache.EntryPath(old_key.hash) + ".manifest";
+  string output = cache.EntryPath(old_key.hash) + ".0";
+  ASSERT_EQ(0, utime(manifest.c_str(), NULL));
+  struct utimbuf old_times = { 1, 1 };
+  ASSERT_EQ(0, utime(manifest.c_str(), &old_times));
+  ASSERT_EQ(0, utime(output.c_str(), &old_times));
+
+  disk_.WriteFile("in.c", "2");
+  ActionCache::Key new_key = Key();
+  EXPECT_TRUE(cache.Store(edge_, new_key, vector<Node*>(), "", &disk_, NULL,
+                          &err));
+  cache.Trim();
+  EXPECT_EQ(0, disk_.Stat(manifest, &err));
+  EXPECT_EQ(0, disk_.Stat(output, &err));
+  EXPECT_NE(0, disk_.Stat(cache.EntryPath(new_key.hash) + ".0", &err));
+}
+
+}  // anonymous namespace
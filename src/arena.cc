@@ -0,0 +1,57 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arena.h"
+
+#include <stdlib.h>
+
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// The size of the blocks the small allocations are carved from.
+const size_t kBlockSize = 64 * 1024;
+
+}  // namespace
+
+Arena::~Arena() {
+  for (vector<char*>::iterator i = blocks_.begin(); i != blocks_.end(); ++i)
+    free(*i);
+}
+
+void* Arena::AllocateSlow(size_t size, size_t alignment) {
+  // malloc() aligns blocks for any type, so only the padding of an
+  // over-aligned allocation needs room.
+  size_t needed = size + (alignment > sizeof(void*) * 2 ? alignment : 0);
+  if (needed > kBlockSize / 4) {
+    // A large allocation gets a block of its own, keeping the current one.
+    char* block = static_cast<char*>(malloc(needed));
+    if (!block)
+      Fatal("out of memory");
+    blocks_.push_back(block);
+    capacity_ += needed;
+    return block + (-reinterpret_cast<size_t>(block) & (alignment - 1));
+  }
+
+  char* block = static_cast<char*>(malloc(kBlockSize));
+  if (!block)
+    Fatal("out of memory");
+  blocks_.push_back(block);
+  capacity_ += kBlockSize;
+  next_ = block;
+  end_ = block + kBlockSize;
+  return Allocate(size, alignment);
+}
@@ -0,0 +1,56 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_ARENA_H_
+#define NINJA_ARENA_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+/// Arena hands out memory carved from large blocks, which are only freed
+/// all at once when the Arena is destroyed.  Objects allocated together
+/// end up next to each other, and allocating is a pointer bump.
+///
+/// The Arena doesn't run destructors; its owner must do so for the objects
+/// that need it.
+struct Arena {
+  Arena() : next_(NULL), end_(NULL), capacity_(0) {}
+  ~Arena();
+
+  /// Return |size| bytes aligned on |alignment|, a power of two.
+  void* Allocate(size_t size, size_t alignment) {
+    char* p = next_ + (-reinterpret_cast<size_t>(next_) & (alignment - 1));
+    if (static_cast<size_t>(end_ - p) < size || !next_)
+      return AllocateSlow(size, alignment);
+    next_ = p + size;
+    return p;
+  }
+
+  /// The number of bytes in the blocks allocated so far.
+  size_t capacity() const { return capacity_; }
+
+ private:
+  void* AllocateSlow(size_t size, size_t alignment);
+
+  char* next_;
+  char* end_;
+  size_t capacity_;
+  std::vector<char*> blocks_;
+
+  Arena(const Arena& other);          // DO NOT IMPLEMENT
+  void operator=(const Arena& other); // DO NOT IMPLEMENT
+};
+
+#endif  // NINJA_ARENA_H_
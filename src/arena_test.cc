@@ -0,0 +1,46 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arena.h"
+
+#include <string.h>
+
+#include "test.h"
+
+TEST(Arena, Alignment) {
+  Arena arena;
+  for (size_t i = 1; i < 100; ++i) {
+    char* c = static_cast<char*>(arena.Allocate(1, 1));
+    *c = 'x';
+    size_t alignment = (size_t)1 << (i % 7);
+    void* p = arena.Allocate(i, alignment);
+    EXPECT_EQ(0u, (reinterpret_cast<size_t>(p) & (alignment - 1)));
+    memset(p, 0, i);
+  }
+}
+
+TEST(Arena, Contiguous) {
+  Arena arena;
+  char* a = static_cast<char*>(arena.Allocate(16, 8));
+  char* b = static_cast<char*>(arena.Allocate(16, 8));
+  EXPECT_EQ(a + 16, b);
+  size_t capacity = arena.capacity();
+
+  // A large allocation doesn't waste the rest of the current block.
+  char* large = static_cast<char*>(arena.Allocate(1 << 20, 8));
+  memset(large, 0, 1 << 20);
+  char* c = static_cast<char*>(arena.Allocate(16, 8));
+  EXPECT_EQ(b + 16, c);
+  EXPECT_EQ(capacity + (1 << 20), arena.capacity());
+}
@@ -14,67 +14,391 @@
 
 #include "browse.h"
 
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
 #include <unistd.h>
+
+#include <algorithm>
+#include <set>
 #include <vector>
 
-#include "build/browse_py.h"
+#include "deps_log.h"
+#include "graph.h"
+#include "trace.h"
+#include "util.h"
 
 using namespace std;
 
-void RunBrowsePython(State* state, const char* ninja_command,
-                     const char* input_file, int argc, char* argv[]) {
-  // Fork off a Python process and have it run our code via its stdin.
-  // (Actually the Python process becomes the parent.)
-  int pipefd[2];
-  if (pipe(pipefd) < 0) {
-    perror("ninja: pipe");
-    return;
+namespace {
+
+const char kPageStyle[] =
+"<!DOCTYPE html>\n"
+"<style>\n"
+"body {\n"
+"    font-family: sans;\n"
+"    font-size: 0.8em;\n"
+"    margin: 4ex;\n"
+"}\n"
+"h1 {\n"
+"    font-weight: normal;\n"
+"    font-size: 140%;\n"
+"    text-align: center;\n"
+"    margin: 0;\n"
+"}\n"
+"h2 {\n"
+"    font-weight: normal;\n"
+"    font-size: 120%;\n"
+"}\n"
+"tt {\n"
+"    font-family: WebKitHack, monospace;\n"
+"    white-space: nowrap;\n"
+"}\n"
+".filelist {\n"
+"  -webkit-columns: auto 2;\n"
+"}\n"
+"</style>\n";
+
+/// Largest request accepted from a client.
+const size_t kMaxRequestSize = 64 << 10;
+
+/// How long a client may take to send its request.
+const int kRequestTimeoutSeconds = 5;
+
+string HtmlEscape(const string& text) {
+  string result;
+  for (string::const_iterator c = text.begin(); c != text.end(); ++c) {
+    switch (*c) {
+    case '&': result += "&amp;"; break;
+    case '<': result += "&lt;"; break;
+    case '>': result += "&gt;"; break;
+    case '"': result += "&quot;"; break;
+    case '\'': result += "&#x27;"; break;
+    default: result += *c;
+    }
+  }
+  return result;
+}
+
+/// Escape |text| for the query string of a URL.
+string UrlEscape(const string& text) {
+  static const char kHex[] = "0123456789ABCDEF";
+  string result;
+  for (string::const_iterator c = text.begin(); c != text.end(); ++c) {
+    unsigned char ch = *c;
+    if (isalnum(ch) || strchr("-._~/+:,@^=", ch)) {
+      result += ch;
+    } else {
+      result += '%';
+      result += kHex[ch >> 4];
+      result += kHex[ch & 15];
+    }
+  }
+  return result;
+}
+
+/// Decode the %XX escapes of |text|.
+string UrlUnescape(const string& text) {
+  string result;
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == '%' && i + 2 < text.size() && isxdigit(text[i + 1]) &&
+        isxdigit(text[i + 2])) {
+      result += (char)strtol(text.substr(i + 1, 2).c_str(), NULL, 16);
+      i += 2;
+    } else {
+      result += text[i];
+    }
+  }
+  return result;
+}
+
+/// An input of the edge building a node, and its kind: NULL for an explicit
+/// input, else "implicit", "order-only", or "dep" for one only the deps log
+/// knows about.
+typedef pair<string, const char*> Input;
+
+vector<Input> CollectInputs(Node* node, DepsLog* deps_log) {
+  vector<Input> inputs;
+  Edge* edge = node->in_edge();
+  if (!edge)
+    return inputs;
+  set<Node*> listed;
+  for (int i = 0; i < (int)edge->inputs_.size(); ++i) {
+    const char* type = NULL;
+    if (edge->is_implicit(i))
+      type = "implicit";
+    else if (edge->is_order_only(i))
+      type = "order-only";
+    inputs.push_back(Input(edge->inputs_[i]->path(), type));
+    listed.insert(edge->inputs_[i]);
+  }
+  if (DepsLog::Deps* deps = deps_log ? deps_log->GetDeps(node) : NULL) {
+    for (int i = 0; i < deps->node_count; ++i) {
+      if (listed.insert(deps->nodes[i]).second)
+        inputs.push_back(Input(deps->nodes[i]->path(), "dep"));
+    }
+  }
+  sort(inputs.begin(), inputs.end());
+  return inputs;
+}
+
+/// The union of the outputs of the edges using |node|.
+vector<string> CollectOutputs(Node* node) {
+  set<string> outputs;
+  for (vector<Edge*>::const_iterator e = node->out_edges().begin();
+       e != node->out_edges().end(); ++e) {
+    for (vector<Node*>::iterator o = (*e)->outputs_.begin();
+         o != (*e)->outputs_.end(); ++o)
+      outputs.insert((*o)->path());
+  }
+  return vector<string>(outputs.begin(), outputs.end());
+}
+
+const char* StatusText(int status) {
+  switch (status) {
+  case 200: return "OK";
+  case 302: return "Found";
+  case 404: return "Not Found";
+  default: return "Method Not Allowed";
+  }
+}
+
+bool SendAll(int fd, const string& data) {
+  const char* p = data.data();
+  size_t size = data.size();
+  while (size > 0) {
+    ssize_t len = write(fd, p, size);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      return false;
+    p += len;
+    size -= len;
+  }
+  return true;
+}
+
+/// Read the request on |fd| up to the end of its headers, and return the
+/// path it GETs, or "" if it's not a GET.
+string ReadRequestPath(int fd) {
+  timeval timeout = { kRequestTimeoutSeconds, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  string request;
+  char buf[4096];
+  while (request.find("\r\n\r\n") == string::npos &&
+         request.find("\n\n") == string::npos &&
+         request.size() < kMaxRequestSize) {
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    request.append(buf, len);
   }
+  if (request.compare(0, 4, "GET ") != 0)
+    return "";
+  return request.substr(4, request.find_first_of(" \r\n", 4) - 4);
+}
 
+/// Open |url| in a web browser, without waiting for it.
+void OpenBrowser(const string& url) {
+#ifdef __APPLE__
+  const char* opener = "open";
+#else
+  const char* opener = "xdg-open";
+#endif
   pid_t pid = fork();
-  if (pid < 0) {
-    perror("ninja: fork");
+  if (pid != 0)
+    return;
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd >= 0) {
+    dup2(null_fd, 1);
+    dup2(null_fd, 2);
+  }
+  execlp(opener, opener, url.c_str(), (char*)NULL);
+  _exit(1);
+}
+
+}  // anonymous namespace
+
+void BrowseServer::Get(const string& path, Response* response) {
+  if (path == "/") {
+    response->status = 302;
+    response->headers = "Location: ?" + UrlEscape(initial_target_) + "\r\n";
+    return;
+  }
+  size_t query = path.find('?');
+  string page = path.substr(0, query);
+  if (query == string::npos || (page != "/" && page != "/json")) {
+    response->status = 404;
+    return;
+  }
+  TargetPage(UrlUnescape(path.substr(query + 1)), page == "/json", response);
+}
+
+void BrowseServer::TargetPage(const string& target, bool json,
+                              Response* response) {
+  string err;
+  Node* node = lookup_(target, &err);
+  string& body = response->body;
+  if (json) {
+    response->headers = "Content-Type: application/json\r\n";
+    if (!node) {
+      response->status = 404;
+      body = "{\"error\":";
+      Tracer::AppendJSONString(err, &body);
+      body += "}\n";
+      return;
+    }
+    body = "{\"target\":";
+    Tracer::AppendJSONString(node->path(), &body);
+    body += ",\"rule\":";
+    if (Edge* edge = node->in_edge())
+      Tracer::AppendJSONString(edge->rule().name(), &body);
+    else
+      body += "null";
+    body += ",\"inputs\":[";
+    vector<Input> inputs = CollectInputs(node, deps_log_);
+    for (vector<Input>::iterator i = inputs.begin(); i != inputs.end(); ++i) {
+      body += i == inputs.begin() ? "{\"path\":" : ",{\"path\":";
+      Tracer::AppendJSONString(i->first, &body);
+      body += ",\"type\":";
+      if (i->second)
+        Tracer::AppendJSONString(i->second, &body);
+      else
+        body += "null";
+      body += "}";
+    }
+    body += "],\"outputs\":[";
+    vector<string> outputs = CollectOutputs(node);
+    for (vector<string>::iterator o = outputs.begin(); o != outputs.end();
+         ++o) {
+      if (o != outputs.begin())
+        body += ",";
+      Tracer::AppendJSONString(*o, &body);
+    }
+    body += "]}\n";
+    return;
+  }
+
+  response->headers = "Content-Type: text/html; charset=utf-8\r\n";
+  body = kPageStyle;
+  if (!node) {
+    response->status = 404;
+    body += "<h1><tt>" + HtmlEscape(err) + "</tt></h1>\n";
     return;
   }
+  body += "<h1><tt>" + HtmlEscape(node->path()) + "</tt></h1>\n";
+
+  vector<Input> inputs = CollectInputs(node, deps_log_);
+  if (!inputs.empty()) {
+    body += "<h2>target is built using rule <tt>" +
+            HtmlEscape(node->in_edge()->rule().name()) + "</tt> of</h2>\n";
+    body += "<div class=filelist>\n";
+    for (vector<Input>::iterator i = inputs.begin(); i != inputs.end(); ++i) {
+      body += "<tt><a href=\"?" + HtmlEscape(UrlEscape(i->first)) + "\">" +
+              HtmlEscape(i->first) + "</a>";
+      if (i->second)
+        body += string(" (") + i->second + ")";
+      body += "</tt><br>\n";
+    }
+    body += "</div>\n";
+  }
+
+  vector<string> outputs = CollectOutputs(node);
+  if (!outputs.empty()) {
+    body += "<h2>dependent edges build:</h2>\n";
+    body += "<div class=filelist>\n";
+    for (vector<string>::iterator o = outputs.begin(); o != outputs.end();
+         ++o) {
+      body += "<tt><a href=\"?" + HtmlEscape(UrlEscape(*o)) + "\">" +
+              HtmlEscape(*o) + "</a></tt><br>\n";
+    }
+    body += "</div>\n";
+  }
+}
+
+int BrowseServer::Run(const string& hostname, int port, bool open_browser) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* addresses;
+  string service = to_string(port);
+  int ret = getaddrinfo(hostname.empty() ? NULL : hostname.c_str(),
+                        service.c_str(), &hints, &addresses);
+  if (ret != 0) {
+    Error("%s: %s", hostname.c_str(), gai_strerror(ret));
+    return 1;
+  }
+  int listen_fd = -1;
+  string err;
+  for (addrinfo* a = addresses; a && listen_fd < 0; a = a->ai_next) {
+    listen_fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (listen_fd < 0)
+      continue;
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(listen_fd, a->ai_addr, a->ai_addrlen) < 0 ||
+        listen(listen_fd, 16) < 0) {
+      err = strerror(errno);
+      close(listen_fd);
+      listen_fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (listen_fd < 0) {
+    Error("can't serve on %s:%d: %s", hostname.c_str(), port, err.c_str());
+    return 1;
+  }
+  SetCloseOnExec(listen_fd);
+
+  // Clients going away mustn't stop us; browsers we started are reaped.
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGCHLD, SIG_IGN);
+
+  string shown_host = hostname;
+  if (shown_host.empty()) {
+    char name[256];
+    shown_host = gethostname(name, sizeof(name)) == 0 ? name : "localhost";
+  }
+  printf("Web server running on %s:%d, ctl-C to abort...\n",
+         shown_host.c_str(), port);
+  fflush(stdout);
+  if (open_browser)
+    OpenBrowser("http://" + shown_host + ":" + to_string(port));
 
-  if (pid > 0) {  // Parent.
-    close(pipefd[1]);
-    do {
-      if (dup2(pipefd[0], 0) < 0) {
-        perror("ninja: dup2");
-        break;
-      }
-
-      std::vector<const char *> command;
-      command.push_back(NINJA_PYTHON);
-      command.push_back("-");
-      command.push_back("--ninja-command");
-      command.push_back(ninja_command);
-      command.push_back("-f");
-      command.push_back(input_file);
-      for (int i = 0; i < argc; i++) {
-          command.push_back(argv[i]);
-      }
-      command.push_back(NULL);
-      execvp(command[0], (char**)&command[0]);
-      if (errno == ENOENT) {
-        printf("ninja: %s is required for the browse tool\n", NINJA_PYTHON);
-      } else {
-        perror("ninja: execvp");
-      }
-    } while (false);
-    _exit(1);
-  } else {  // Child.
-    close(pipefd[0]);
-
-    // Write the script file into the stdin of the Python process.
-    ssize_t len = write(pipefd[1], kBrowsePy, sizeof(kBrowsePy));
-    if (len < (ssize_t)sizeof(kBrowsePy))
-      perror("ninja: write");
-    close(pipefd[1]);
-    exit(0);
+  for (;;) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      Error("accept: %s", strerror(errno));
+      close(listen_fd);
+      return 1;
+    }
+    SetCloseOnExec(fd);
+    Response response;
+    string path = ReadRequestPath(fd);
+    if (path.empty())
+      response.status = 405;
+    else
+      Get(path, &response);
+    char head[128];
+    snprintf(head, sizeof(head), "HTTP/1.0 %d %s\r\n", response.status,
+             StatusText(response.status));
+    SendAll(fd, head + response.headers + "Content-Length: " +
+                    to_string(response.body.size()) + "\r\n"
+                    "Connection: close\r\n\r\n" + response.body);
+    close(fd);
   }
 }
@@ -15,14 +15,58 @@
 #ifndef NINJA_BROWSE_H_
 #define NINJA_BROWSE_H_
 
-struct State;
-
-/// Run in "browse" mode, which execs a Python webserver.
-/// \a ninja_command is the command used to invoke ninja.
-/// \a args are the number of arguments to be passed to the Python script.
-/// \a argv are arguments to be passed to the Python script.
-/// This function does not return if it runs successfully.
-void RunBrowsePython(State* state, const char* ninja_command,
-                     const char* input_file, int argc, char* argv[]);
+#include <functional>
+#include <string>
+
+struct DepsLog;
+struct Node;
+
+/// The web server of "ninja -t browse", which shows the dependency graph
+/// of the loaded State, one node per page.
+///
+/// Ideally we'd allow you to navigate to a build edge or a build node, with
+/// appropriate views for each.  But there's no way to *name* a build edge
+/// so we can only display nodes.
+///
+/// A node has at most one input edge, whose inputs (and the deps the deps
+/// log recorded for it) the page lists.  The node can have multiple
+/// dependent output edges; rather than attempting to display those, they
+/// are summarized by taking the union of all their outputs.
+struct BrowseServer {
+  /// Finds the node a target names, as "ninja -t query" does, or fills
+  /// its argument with an error.
+  typedef std::function<Node*(const std::string&, std::string*)> Lookup;
+
+  BrowseServer(const Lookup& lookup, DepsLog* deps_log,
+               const std::string& initial_target)
+      : lookup_(lookup), deps_log_(deps_log),
+        initial_target_(initial_target) {}
+
+  struct Response {
+    Response() : status(200) {}
+    int status;
+    /// The headers past the status line, each ending in "\r\n".
+    std::string headers;
+    std::string body;
+  };
+
+  /// Answer a GET of |path| (which includes the query string):
+  ///   /            redirects to the page of the initial target,
+  ///   /?TARGET     is the HTML page of TARGET,
+  ///   /json?TARGET is the same as JSON, for scripts.
+  void Get(const std::string& path, Response* response);
+
+  /// Serve HTTP on |hostname|:|port| until interrupted, optionally opening
+  /// the first page in a web browser.  Returns the exit code.
+  int Run(const std::string& hostname, int port, bool open_browser);
+
+ private:
+  /// Fill |response| with the page of |target|, as HTML or JSON.
+  void TargetPage(const std::string& target, bool json, Response* response);
+
+  Lookup lookup_;
+  DepsLog* deps_log_;
+  std::string initial_target_;
+};
 
 #endif  // NINJA_BROWSE_H_
@@ -0,0 +1,118 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "browse.h"
+
+#include "deps_log.h"
+#include "graph.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+struct BrowseTest : public StateTestWithBuiltinRules {
+  BrowseTest()
+      : server_([this](const string& target, string* err) {
+          Node* node = state_.LookupNode(target);
+          if (!node)
+            *err = "unknown target '" + target + "'";
+          return node;
+        }, &deps_log_, "out") {}
+
+  virtual void SetUp() {
+    ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat in.c | in.h || gen\n"
+"build final a&b: cat out\n"));
+    temp_dir_.CreateAndEnter("BrowseTest");
+    string err;
+    ASSERT_TRUE(deps_log_.OpenForWrite(".ninja_deps", &err));
+    vector<Node*> deps;
+    deps.push_back(state_.GetNode("in.h", 0));
+    deps.push_back(state_.GetNode("dep.h", 0));
+    deps_log_.RecordDeps(state_.GetNode("out", 0), 1, deps);
+  }
+
+  virtual void TearDown() {
+    deps_log_.Close();
+    temp_dir_.Cleanup();
+  }
+
+  ScopedTempDir temp_dir_;
+  DepsLog deps_log_;
+  BrowseServer server_;
+};
+
+TEST_F(BrowseTest, Redirect) {
+  BrowseServer::Response response;
+  server_.Get("/", &response);
+  EXPECT_EQ(302, response.status);
+  EXPECT_EQ("Location: ?out\r\n", response.headers);
+
+  server_.Get("/other", &response);
+  EXPECT_EQ(404, response.status);
+}
+
+TEST_F(BrowseTest, Html) {
+  BrowseServer::Response response;
+  server_.Get("/?out", &response);
+  EXPECT_EQ(200, response.status);
+  const string& body = response.body;
+  EXPECT_NE(string::npos, body.find("<h1><tt>out</tt></h1>"));
+  EXPECT_NE(string::npos, body.find("rule <tt>cat</tt>"));
+  EXPECT_NE(string::npos, body.find("<a href=\"?in.c\">in.c</a></tt>"));
+  EXPECT_NE(string::npos,
+            body.find("<a href=\"?in.h\">in.h</a> (implicit)</tt>"));
+  EXPECT_NE(string::npos,
+            body.find("<a href=\"?gen\">gen</a> (order-only)</tt>"));
+  EXPECT_NE(string::npos, body.find("<a href=\"?dep.h\">dep.h</a> (dep)"));
+  // Listed once, as the manifest names it.
+  EXPECT_EQ(body.find("?in.h"), body.rfind("?in.h"));
+  EXPECT_NE(string::npos, body.find("<a href=\"?a%26b\">a&amp;b</a>"));
+
+  // Links come back unescaped.
+  server_.Get("/?a%26b", &response);
+  EXPECT_EQ(200, response.status);
+  EXPECT_NE(string::npos, response.body.find("<h1><tt>a&amp;b</tt></h1>"));
+
+  server_.Get("/?missing", &response);
+  EXPECT_EQ(404, response.status);
+  EXPECT_NE(string::npos,
+            response.body.find("<tt>unknown target &#x27;missing&#x27;</tt>"));
+}
+
+TEST_F(BrowseTest, Json) {
+  BrowseServer::Response response;
+  server_.Get("/json?out", &response);
+  EXPECT_EQ(200, response.status);
+  EXPECT_EQ("Content-Type: application/json\r\n", response.headers);
+  EXPECT_EQ("{\"target\":\"out\",\"rule\":\"cat\",\"inputs\":["
+            "{\"path\":\"dep.h\",\"type\":\"dep\"},"
+            "{\"path\":\"gen\",\"type\":\"order-only\"},"
+            "{\"path\":\"in.c\",\"type\":null},"
+            "{\"path\":\"in.h\",\"type\":\"implicit\"}],"
+            "\"outputs\":[\"a&b\",\"final\"]}\n",
+            response.body);
+
+  server_.Get("/json?in.c", &response);
+  EXPECT_EQ("{\"target\":\"in.c\",\"rule\":null,\"inputs\":[],"
+            "\"outputs\":[\"out\"]}\n",
+            response.body);
+
+  server_.Get("/json?missing", &response);
+  EXPECT_EQ(404, response.status);
+  EXPECT_EQ("{\"error\":\"unknown target 'missing'\"}\n", response.body);
+}
+
+}  // namespace
@@ -18,7 +18,15 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #ifdef _WIN32
 #include <fcntl.h>
@@ -29,6 +37,7 @@
 #include <sys/termios.h>
 #endif
 
+#include "build_dir_lock.h"
 #include "build_log.h"
 #include "clparser.h"
 #include "debug_flags.h"
@@ -36,14 +45,24 @@
 #include "deps_log.h"
 #include "disk_interface.h"
 #include "graph.h"
+#include "hash_log.h"
+#include "jobserver.h"
+#include "memory_stats.h"
+#include "metrics_server.h"
+#include "parallel.h"
+#include "remote_cache.h"
 #include "state.h"
 #include "subprocess.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace std;
 
 namespace {
 
+/// How often Builder::PublishMetrics() publishes while commands run.
+const int64_t kMetricsPublishMillis = 100;
+
 /// A CommandRunner that doesn't actually run the commands.
 struct DryRunCommandRunner : public CommandRunner {
   virtual ~DryRunCommandRunner() {}
@@ -52,6 +71,7 @@ struct DryRunCommandRunner : public CommandRunner {
   virtual bool CanRunMore() const;
   virtual bool StartCommand(Edge* edge);
   virtual bool WaitForCommand(Result* result, std::function<void()> update_func);
+  virtual bool TakeFinishedCommand(Result* result);
 
  private:
   queue<Edge*> finished_;
@@ -76,30 +96,46 @@ bool DryRunCommandRunner::WaitForCommand(Result* result, std::function<void()> u
    return true;
 }
 
+bool DryRunCommandRunner::TakeFinishedCommand(Result* result) {
+  // The commands finish as they start.
+  return WaitForCommand(result, [] {});
+}
+
 }  // namespace
 
 BuildStatus::BuildStatus(const BuildConfig& config)
-    : prev_running_edge_count_(0), config_(config), start_time_millis_(GetTimeMillis()), started_edges_(0),
-      finished_edges_(0), total_edges_(0), progress_status_format_(NULL),
-      current_rate_(config.parallelism) {
+    : prev_running_edge_count_(0), last_frame_millis_(0), config_(config), start_time_millis_(GetTimeMillis()), started_edges_(0),
+      finished_edges_(0), total_edges_(0), remaining_millis_(-1),
+      critical_path_millis_(-1), parallelism_(config.parallelism),
+      output_bytes_(0), progress_status_format_(NULL), current_rate_(config.parallelism) {
   // Don't do anything fancy in verbose mode.
   if (config_.verbosity != BuildConfig::NORMAL)
     printer_.set_smart_terminal(false);
 
   progress_status_format_ = getenv("NINJA_STATUS");
-  if (!progress_status_format_)
-    progress_status_format_ = "[%s/%t] ";
+  if (!progress_status_format_) {
+    progress_status_format_ =
+        config.max_parallelism > 0 ? "[%s/%t -j%j] " : "[%s/%t] ";
+  }
 }
 
 void BuildStatus::PlanHasTotalEdges(int total) {
   total_edges_ = total;
 }
 
+void BuildStatus::PlanHasRemainingWork(int64_t total_millis,
+                                       int64_t critical_path_millis) {
+  remaining_millis_ = total_millis;
+  critical_path_millis_ = critical_path_millis;
+}
+
 void BuildStatus::BuildEdgeStarted(const Edge* edge) {
   assert(running_edges_.find(edge) == running_edges_.end());
   int start_time = (int)(GetTimeMillis() - start_time_millis_);
   running_edges_.insert(make_pair(edge, start_time));
   ++started_edges_;
+  if (g_tracer)
+    TraceEdgeStarted(edge);
 
   if (edge->use_console() || printer_.is_smart_terminal() ||
       config_.verbosity == BuildConfig::VERBOSE)
@@ -109,9 +145,56 @@ void BuildStatus::BuildEdgeStarted(const Edge* edge) {
     printer_.SetConsoleLocked(true);
 }
 
+void BuildStatus::BuildCommandReaped(const Edge* edge, bool success) {
+  if (g_tracer)
+    TraceEdgeFinished(edge, success);
+}
+
+void BuildStatus::TraceEdgeStarted(const Edge* edge) {
+  TracedEdge traced;
+  traced.slot = 0;
+  while (traced.slot < (int)busy_trace_slots_.size() &&
+         busy_trace_slots_[traced.slot])
+    ++traced.slot;
+  if (traced.slot == (int)busy_trace_slots_.size()) {
+    busy_trace_slots_.push_back(false);
+    char name[32];
+    snprintf(name, sizeof(name), "job slot %d", traced.slot);
+    g_tracer->NameTrack(Tracer::kFirstJobTrack + traced.slot, name);
+  }
+  busy_trace_slots_[traced.slot] = true;
+  traced.start = g_tracer->Now();
+  traced_edges_.insert(make_pair(edge, traced));
+}
+
+void BuildStatus::TraceEdgeFinished(const Edge* edge, bool success) {
+  map<const Edge*, TracedEdge>::iterator i = traced_edges_.find(edge);
+  if (i == traced_edges_.end())
+    return;
+  TracedEdge traced = i->second;
+  traced_edges_.erase(i);
+  busy_trace_slots_[traced.slot] = false;
+
+  string name = edge->GetBinding(kSymbolDescription);
+  if (name.empty())
+    name = edge->outputs_.empty() ? edge->rule().name()
+                                  : edge->outputs_[0]->path();
+  string args = "{\"pool\":";
+  Tracer::AppendJSONString(edge->pool()->name(), &args);
+  args += ",\"rule\":";
+  Tracer::AppendJSONString(edge->rule().name(), &args);
+  char buf[48];
+  snprintf(buf, sizeof(buf), ",\"slot\":%d,\"success\":%s}", traced.slot,
+           success ? "true" : "false");
+  args += buf;
+  g_tracer->AddSlice(name, "edge", Tracer::kFirstJobTrack + traced.slot,
+                     traced.start, g_tracer->Now(), args);
+}
+
 void BuildStatus::BuildEdgeFinished(Edge* edge,
                                     bool success,
                                     const string& output,
+                                    FILE* overflow,
                                     int* start_time,
                                     int* end_time) {
   int64_t now = GetTimeMillis();
@@ -123,6 +206,13 @@ void BuildStatus::BuildEdgeFinished(Edge* edge,
   *end_time = (int)(now - start_time_millis_);
   running_edges_.erase(i);
 
+  output_bytes_ += output.size();
+  if (overflow) {
+    fseek(overflow, 0, SEEK_END);
+    output_bytes_ += ftell(overflow);
+    rewind(overflow);
+  }
+
   if (edge->use_console())
     printer_.SetConsoleLocked(false);
 
@@ -146,43 +236,101 @@ void BuildStatus::BuildEdgeFinished(Edge* edge,
 #endif
   }
 
-  if (!output.empty()) {
-    // ninja sets stdout and stderr of subprocesses to a pipe, to be able to
-    // check if the output is empty. Some compilers, e.g. clang, check
-    // isatty(stderr) to decide if they should print colored output.
-    // To make it possible to use colored output with ninja, subprocesses should
-    // be run with a flag that forces them to always print color escape codes.
-    // To make sure these escape codes don't show up in a file if ninja's output
-    // is piped to a file, ninja strips ansi escape codes again if it's not
-    // writing to a |smart_terminal_|.
-    // (Launching subprocesses in pseudo ttys doesn't work because there are
-    // only a few hundred available on some systems, and ninja can launch
-    // thousands of parallel compile commands.)
-    string final_output;
-    if (!printer_.supports_color())
-      final_output = StripAnsiEscapeCodes(output);
-    else
-      final_output = output;
+  if (!overflow) {
+    PrintOutput(ShownOutput(edge, output), true);
+    return;
+  }
+
+  // Stream the rest in whole lines, so that no escape code is split.
+  string pending = output;
+  bool first = true;
+  char buf[64 << 10];
+  size_t len;
+  do {
+    len = fread(buf, 1, sizeof(buf), overflow);
+    pending.append(buf, len);
+    size_t end = pending.rfind('\n');
+    if (len > 0 && end == string::npos && pending.size() < sizeof(buf))
+      continue;
+    end = len == 0 || end == string::npos ? pending.size() : end + 1;
+    if (end > 0) {
+      PrintOutput(ShownOutput(edge, pending.substr(0, end)), first);
+      first = false;
+      pending.erase(0, end);
+    }
+  } while (len > 0);
+}
+
+void BuildStatus::BuildEdgeOutput(const Edge* edge, const string& lines) {
+  output_bytes_ += lines.size();
+  if (config_.verbosity == BuildConfig::QUIET)
+    return;
+  PrintOutput(ShownOutput(edge, lines), true);
+}
+
+string BuildStatus::ShownOutput(const Edge* edge, const string& output) {
+  if (!config_.dedup_output)
+    return PrefixOutput(edge, output);
+  return PrefixOutput(edge, deduper_.Filter(output));
+}
+
+string BuildStatus::PrefixOutput(const Edge* edge, const string& output) const {
+  if (output.empty() || !edge->streams_output())
+    return output;
+  string prefix = "[" + edge->outputs_[0]->path() + "] ";
+  string result;
+  size_t start = 0;
+  while (start < output.size()) {
+    size_t end = output.find('\n', start);
+    end = end == string::npos ? output.size() : end + 1;
+    result += prefix;
+    result.append(output, start, end - start);
+    start = end;
+  }
+  return result;
+}
+
+void BuildStatus::PrintOutput(const string& output, bool first) {
+  if (output.empty())
+  return;
+
+  // ninja sets stdout and stderr of subprocesses to a pipe, to be able to
+  // check if the output is empty. Some compilers, e.g. clang, check
+  // isatty(stderr) to decide if they should print colored output.
+  // To make it possible to use colored output with ninja, subprocesses should
+  // be run with a flag that forces them to always print color escape codes.
+  // To make sure these escape codes don't show up in a file if ninja's output
+  // is piped to a file, ninja strips ansi escape codes again if it's not
+  // writing to a |smart_terminal_|.
+  // (Launching subprocesses in pseudo ttys doesn't work because there are
+  // only a few hundred available on some systems, and ninja can launch
+  // thousands of parallel compile commands.)
+  string stripped;
+  const string& final_output = printer_.supports_color()
+                                   ? output
+                                   : StripAnsiEscapeCodes(output, &stripped);
 
 #ifdef _WIN32
-    // Fix extra CR being added on Windows, writing out CR CR LF (#773)
-    _setmode(_fileno(stdout), _O_BINARY);  // Begin Windows extra CR fix
+  // Fix extra CR being added on Windows, writing out CR CR LF (#773)
+  _setmode(_fileno(stdout), _O_BINARY);  // Begin Windows extra CR fix
 #endif
 
-    if (LinePrinter::GetStatusPrintMode() == e_status_print_mode::scrolling) {
-      // Remove any status lines from the display otherwise the
-      // subprocess output will get put over top of it and it
-      // will look bad.
-      ClearScrollingOutput();
-      printer_.PrintWithoutNewLine(final_output);
-    } else {
-      printer_.PrintOnNewLine(final_output);
-    }
+  if (!first) {
+    printer_.PrintWithoutNewLine(final_output);
+  } else if (LinePrinter::GetStatusPrintMode() ==
+             e_status_print_mode::scrolling) {
+    // Remove any status lines from the display otherwise the
+    // subprocess output will get put over top of it and it
+    // will look bad.
+    ClearScrollingOutput();
+    printer_.PrintWithoutNewLine(final_output);
+  } else {
+    printer_.PrintOnNewLine(final_output);
+  }
 
 #ifdef _WIN32
-    _setmode(_fileno(stdout), _O_TEXT);  // End Windows extra CR fix
+  _setmode(_fileno(stdout), _O_TEXT);  // End Windows extra CR fix
 #endif
-  }
 }
 
 void BuildStatus::BuildLoadDyndeps() {
@@ -199,6 +347,37 @@ void BuildStatus::BuildLoadDyndeps() {
     printer_.PrintOnNewLine("");
 }
 
+void BuildStatus::WriteMetrics(MetricsPage* page) const {
+  page->Family("ninja_edges_total", "gauge",
+               "Commands the build runs in all, as far as known.");
+  page->Sample((int64_t)total_edges_);
+  page->Family("ninja_edges_started_total", "counter", "Commands started.");
+  page->Sample((int64_t)started_edges_);
+  page->Family("ninja_edges_finished_total", "counter", "Commands finished.");
+  page->Sample((int64_t)finished_edges_);
+  page->Family("ninja_edges_running", "gauge", "Commands running.");
+  page->Sample((int64_t)running_edges_.size());
+  page->Family("ninja_parallelism", "gauge",
+               "Commands that may run at once.");
+  page->Sample((int64_t)parallelism_);
+
+  overall_rate_.UpdateRate(finished_edges_);
+  current_rate_.UpdateRate(finished_edges_);
+  page->Family("ninja_overall_rate", "gauge",
+               "Commands finished per second since the build started.");
+  page->Sample(overall_rate_.rate());
+  page->Family("ninja_current_rate", "gauge",
+               "Commands finished per second, over the last -j commands.");
+  page->Sample(current_rate_.rate());
+  page->Family("ninja_elapsed_seconds", "gauge",
+               "Seconds since the build started.");
+  page->Sample(overall_rate_.Elapsed());
+
+  page->Family("ninja_output_bytes_total", "counter",
+               "Bytes of output the commands wrote.");
+  page->Sample(output_bytes_);
+}
+
 void BuildStatus::BuildStarted() {
   overall_rate_.Restart();
   current_rate_.Restart();
@@ -208,7 +387,35 @@ void BuildStatus::BuildFinished() {
   if (LinePrinter::GetStatusPrintMode() == e_status_print_mode::scrolling)
     ClearScrollingOutput();
   printer_.SetConsoleLocked(false);
+  PrintRepeats();
   printer_.PrintWithoutNewLine("");
+  printer_.Flush();
+}
+
+void BuildStatus::PrintRepeats() {
+  vector<OutputDeduper::Repeat> repeats = deduper_.Repeats();
+  if (repeats.empty() || config_.verbosity == BuildConfig::QUIET)
+    return;
+  int count = 0;
+  for (vector<OutputDeduper::Repeat>::iterator i = repeats.begin();
+       i != repeats.end(); ++i)
+    count += i->count;
+  char buf[128];
+  snprintf(buf, sizeof(buf),
+           "ninja: left out %d repeats of %d diagnostics (%lld bytes):\n",
+           count, (int)repeats.size(), (long long)deduper_.left_out_bytes());
+  string summary = buf;
+  const size_t kListed = 10;
+  for (size_t i = 0; i < repeats.size() && i < kListed; ++i) {
+    snprintf(buf, sizeof(buf), "%6d  ", repeats[i].count);
+    summary += buf + repeats[i].first_line + "\n";
+  }
+  if (repeats.size() > kListed) {
+    snprintf(buf, sizeof(buf), "        and %d more\n",
+             (int)(repeats.size() - kListed));
+    summary += buf;
+  }
+  printer_.PrintOnNewLine(summary);
 }
 
 string BuildStatus::FormatProgressStatus(
@@ -287,6 +494,12 @@ string BuildStatus::FormatProgressStatus(
         out += buf;
         break;
 
+        // Commands run at once.
+      case 'j':
+        snprintf(buf, sizeof(buf), "%d", parallelism_);
+        out += buf;
+        break;
+
       case 'e': {
         double elapsed = overall_rate_.Elapsed();
         snprintf(buf, sizeof(buf), "%.3f", elapsed);
@@ -294,6 +507,29 @@ string BuildStatus::FormatProgressStatus(
         break;
       }
 
+        // Estimated time left: the work left spread over the jobs, but no
+        // less than the longest chain of it.
+      case 'E':
+        if (remaining_millis_ < 0) {
+          out += '?';
+        } else {
+          int64_t millis = remaining_millis_ / max(parallelism_, 1);
+          snprintf(buf, sizeof(buf), "%.1f",
+                   max(millis, critical_path_millis_) / 1e3);
+          out += buf;
+        }
+        break;
+
+        // Time the critical path left is expected to take.
+      case 'C':
+        if (critical_path_millis_ < 0) {
+          out += '?';
+        } else {
+          snprintf(buf, sizeof(buf), "%.1f", critical_path_millis_ / 1e3);
+          out += buf;
+        }
+        break;
+
       default:
         Fatal("unknown placeholder '%%%c' in $NINJA_STATUS", *s);
         return "";
@@ -306,17 +542,37 @@ string BuildStatus::FormatProgressStatus(
   return out;
 }
 
+namespace {
+
+/// The minimum time between two frames of the scrolling status, so that
+/// edges finishing in quick succession don't spend their time redrawing.
+const int64_t kMinScrollingFrameMillis = 1000 / 30;
+
+/// Append the sequence erasing |lines| lines and returning to the first.
 // Note that in this function we use \n to move the cursor down
 // instead of the "move cursor down" escape sequence (which is
 // "\x1B[B") because the latter doesn't work when we are on the
 // last line of the console.
+void AppendClearLines(size_t lines, string* frame) {
+  for (size_t i = 0; i < lines; ++i)
+    frame->append("\x1B[K\n");  // Clear to end of line then new line
+  for (size_t i = 0; i < lines; ++i)
+    frame->append("\x1B[A");  // cursor up.
+}
+
+}  // namespace
+
 void BuildStatus::ClearScrollingOutput(int const lines) {
-  printf("\x1B[?25l");  // hide cursor.
-  for( size_t i = 0; i < lines; ++i )
-    printer_.PrintWithoutNewLine("\x1B[K\n");  // Clear to end of line then new line
-  for( size_t i = 0; i < lines; ++i )
-    printer_.PrintWithoutNewLine("\x1B[A");  // cursor up.
-  printf("\x1B[?25h");  // show cursor.
+  string frame = "\x1B[?25l";  // hide cursor.
+  AppendClearLines(lines, &frame);
+  frame.append("\x1B[?25h");  // show cursor.
+  WriteFrame(frame);
+  // Whatever comes next, the status has to be drawn again.
+  last_frame_.clear();
+}
+
+void BuildStatus::WriteFrame(const string& frame) {
+  printer_.PrintWithoutNewLine(frame);
   fflush(stdout);
 }
 
@@ -326,13 +582,9 @@ void BuildStatus::ClearScrollingOutput() {
   ClearScrollingOutput(lines);
 }
 
-// Note that in this function we use \n to move the cursor down
-// instead of the "move cursor down" escape sequence (which is
-// "\x1B[B") because the latter doesn't work when we are on the
-// last line of the console.
+// The whole frame is composed into one string, so that it is written at
+// once, and not written at all if it is the same as the one on screen.
 void BuildStatus::PrintStatusScrolling() {
-  printer_.PrintWithoutNewLine("\x1B[?25l");  // hide cursor.
-
   // If we are running a single executable and it is running in
   // the "console" pool then that likely means we are running our
   // final target binary, e.g. a unit test binary or some other
@@ -357,74 +609,95 @@ void BuildStatus::PrintStatusScrolling() {
       prev_running_edge_count_ = 1;
       return;
   }
+  DrawScrollingStatus(GetTimeMillis());
+}
+
+void BuildStatus::DrawScrollingStatus(int64_t now_millis) {
+  // A frame that is on screen stays there for a little while.  One that
+  // was cleared is redrawn right away.
+  if (!last_frame_.empty() &&
+      now_millis - last_frame_millis_ < kMinScrollingFrameMillis)
+    return;
+
+  string frame = "\x1B[?25l";  // hide cursor.
 
   float percent = float( started_edges_ )/total_edges_;
   percent = (percent > 1.0) ? 1.0 : percent;
   int screen_columns = LinePrinter::TerminalColumns( /*def=*/80 );
   int progress_columns = int( percent*screen_columns );
-  printer_.PrintWithoutNewLine("\u001b[38;5;244m");
+  frame.append("\u001b[38;5;244m");
   for (int i = 0; i < screen_columns; ++i) {
     if( i == 0 )
-      printer_.PrintWithoutNewLine("[");
+      frame.push_back('[');
     else if( i < progress_columns && i < screen_columns-1 )
-      printer_.PrintWithoutNewLine("=");
-      // printer_.PrintWithoutNewLine("=");
+      frame.push_back('=');
     else if( i == progress_columns && i < screen_columns-1 )
-      printer_.PrintWithoutNewLine(">");
+      frame.push_back('>');
     else if( i < screen_columns-1 )
-      printer_.PrintWithoutNewLine(" ");
+      frame.push_back(' ');
     else if( i == screen_columns-1 )
-      printer_.PrintWithoutNewLine("]");
+      frame.push_back(']');
   }
-  printer_.PrintWithoutNewLine("\r[ ");
-  printer_.PrintWithoutNewLine("\033[0m"); // normal
-  printer_.PrintWithoutNewLine("\033[1m"); // bold
-  printer_.PrintWithoutNewLine( std::to_string( int( percent*100.0 ) ) );
-  printer_.PrintWithoutNewLine("%\033[0m: \r"); // normal
-  printer_.PrintWithoutNewLine("\n");
+  frame.append("\r[ ");
+  frame.append("\033[0m"); // normal
+  frame.append("\033[1m"); // bold
+  frame.append( std::to_string( int( percent*100.0 ) ) );
+  frame.append("%\033[0m: \r"); // normal
+  frame.append("\n");
 
-  int now = (int)(GetTimeMillis()-start_time_millis_);
+  int now = (int)(now_millis-start_time_millis_);
 
   for( auto const& p : running_edges_ ) {
     Edge const* edge = p.first;
     int time_start = p.second;
 
     bool force_full_command = config_.verbosity == BuildConfig::VERBOSE;
-    string to_print = edge->GetBinding("description");
+    string to_print = edge->GetBinding(kSymbolDescription);
     if (force_full_command)
-      to_print = edge->GetBinding("command");
+      to_print = edge->GetBinding(kSymbolCommand);
     if( !to_print.empty() ) {
       // This will print the numerical status, e.g. [34/120] on each line.
       // to_print = FormatProgressStatus(progress_status_format_, kEdgeStarted) + to_print;
-      printer_.Print(to_print,
-                     force_full_command ? LinePrinter::FULL : LinePrinter::ELIDE);
       int delta_secs = (now-time_start)/1000;
       std::string running_time = std::string(" (") + std::to_string(delta_secs) + "s)";
-      printer_.PrintWithoutNewLine("\u001b[38;5;244m");
-      printer_.PrintWithoutNewLine(running_time);
-      printer_.PrintWithoutNewLine("\033[0m"); // normal
+      to_print = LinePrinter::Reformat(to_print);
+      if (!force_full_command) {
+        // Leave room for the running time, to avoid wrapping.
+        int width = screen_columns - int(running_time.size());
+        to_print = ElideMiddle(to_print, width > 0 ? width : 0);
+      }
+      frame.push_back('\r');
+      frame.append(to_print);
+      frame.append("\u001b[38;5;244m");
+      frame.append(running_time);
+      frame.append("\033[0m"); // normal
     }
-    printer_.PrintWithoutNewLine("\x1B[K");  // Clear to end of line.
-    printer_.PrintWithoutNewLine("\n");
+    frame.append("\x1B[K");  // Clear to end of line.
+    frame.append("\n");
   }
 
   // Check if we need to clear out the additional lines from the
   // last status that had more lines.
-  if (prev_running_edge_count_ > running_edges_.size()) {
+  if (prev_running_edge_count_ > (int)running_edges_.size()) {
     int const lines = prev_running_edge_count_ - running_edges_.size();
-    ClearScrollingOutput( lines );
+    AppendClearLines(lines, &frame);
   }
 
   // Move cursor back up to the top.
   for( size_t i = 0; i < running_edges_.size(); ++i )
-    printer_.PrintWithoutNewLine("\r\x1B[A");
+    frame.append("\r\x1B[A");
 
   // One for the progress bar.
-  printer_.PrintWithoutNewLine("\r\x1B[A");
+  frame.append("\r\x1B[A");
 
   prev_running_edge_count_ = running_edges_.size();
-  printer_.PrintWithoutNewLine("\x1B[?25h");  // show cursor.
-  fflush(stdout);
+  frame.append("\x1B[?25h");  // show cursor.
+
+  if (frame == last_frame_)
+    return;
+  last_frame_.swap(frame);
+  last_frame_millis_ = now_millis;
+  WriteFrame(last_frame_);
 }
 
 void BuildStatus::PrintStatus(const Edge* edge, EdgeStatus status) {
@@ -437,9 +710,9 @@ void BuildStatus::PrintStatus(const Edge* edge, EdgeStatus status) {
 
   bool force_full_command = config_.verbosity == BuildConfig::VERBOSE;
 
-  string to_print = edge->GetBinding("description");
+  string to_print = edge->GetBinding(kSymbolDescription);
   if (force_full_command)
-    to_print = edge->GetBinding("command");
+    to_print = edge->GetBinding(kSymbolCommand);
   if (to_print.empty())
       return;
 
@@ -451,18 +724,33 @@ void BuildStatus::PrintStatus(const Edge* edge, EdgeStatus status) {
 
 Plan::Plan(Builder* builder)
   : builder_(builder)
+  , build_log_(NULL)
   , command_edges_(0)
   , wanted_edges_(0)
+  , remaining_duration_(0)
 {}
 
 void Plan::Reset() {
   command_edges_ = 0;
   wanted_edges_ = 0;
+  remaining_duration_ = 0;
+  durations_.clear();
+  scheduled_weights_.clear();
   ready_.clear();
   want_.clear();
+  want_edges_.clear();
+  ready_inputs_.clear();
+  clean_inputs_.clear();
 }
 
 bool Plan::AddTarget(const Node* target, string* err) {
+  // The graph may have been scanned again since the last build.
+  ready_inputs_.clear();
+  clean_inputs_.clear();
+  return AddSubTarget(target, NULL, err, NULL);
+}
+
+bool Plan::AddScannedTarget(const Node* target, string* err) {
   return AddSubTarget(target, NULL, err, NULL);
 }
 
@@ -485,9 +773,14 @@ bool Plan::AddSubTarget(const Node* node, const Node* dependent, string* err,
 
   // If an entry in want_ does not already exist for edge, create an entry which
   // maps to kWantNothing, indicating that we do not want to build this entry itself.
-  pair<map<Edge*, Want>::iterator, bool> want_ins =
-    want_.insert(make_pair(edge, kWantNothing));
-  Want& want = want_ins.first->second;
+  if (edge->id_ >= want_.size())
+    want_.resize(edge->id_ + 1, kNotInPlan);
+  Want& want = want_[edge->id_];
+  bool inserted = want == kNotInPlan;
+  if (inserted) {
+    want = kWantNothing;
+    want_edges_.push_back(edge);
+  }
 
   if (dyndep_walk && want == kWantToFinish)
     return false;  // Don't need to do anything with already-scheduled edge.
@@ -497,14 +790,14 @@ bool Plan::AddSubTarget(const Node* node, const Node* dependent, string* err,
   if (node->dirty() && want == kWantNothing) {
     want = kWantToStart;
     EdgeWanted(edge);
-    if (!dyndep_walk && edge->AllInputsReady())
-      ScheduleWork(want_ins.first);
+    if (!dyndep_walk && InputsReady(edge))
+      ScheduleWork(edge);
   }
 
   if (dyndep_walk)
     dyndep_walk->insert(edge);
 
-  if (!want_ins.second)
+  if (!inserted)
     return true;  // We've already processed the inputs.
 
   for (vector<Node*>::iterator i = edge->inputs_.begin();
@@ -522,41 +815,165 @@ void Plan::EdgeWanted(const Edge* edge) {
     ++command_edges_;
 }
 
+void Plan::UpcomingEdges(size_t count, vector<Edge*>* edges) const {
+  const vector<Edge*>& ready = ready_.edges();
+  size_t begin = edges->size();
+  edges->resize(begin + min(count, ready.size()));
+  partial_sort_copy(ready.begin(), ready.end(), edges->begin() + begin,
+                    edges->end(), EdgePriorityCmp());
+}
+
 Edge* Plan::FindWork() {
   if (ready_.empty())
     return NULL;
-  EdgeSet::iterator e = ready_.begin();
-  Edge* edge = *e;
-  ready_.erase(e);
-  return edge;
+  return ready_.pop();
+}
+
+namespace {
+
+/// Return how long |edge| is expected to run, in milliseconds, from the
+/// durations of its previous runs, or -1 if |build_log| has no record of
+/// them.
+int64_t ExpectedEdgeDuration(BuildLog* build_log, const Edge* edge) {
+  if (!build_log || edge->outputs_.empty())
+    return -1;
+  BuildLog::LogEntry* entry =
+      build_log->LookupByOutput(edge->outputs_[0]->path());
+  if (!entry)
+    return -1;
+  return entry->ExpectedDuration();
+}
+
+}  // namespace
+
+void Plan::PrepareQueue(BuildLog* build_log) {
+  build_log_ = build_log;
+  ComputeCriticalPath();
+}
+
+void Plan::ComputeCriticalPath() {
+  METRIC_RECORD("ComputeCriticalPath");
+  TRACE_RECORD("ComputeCriticalPath");
+
+  // Edges we have no timing information for are assumed to take as long as
+  // the average edge we do know about.
+  int64_t total_duration = 0;
+  int known_durations = 0;
+  for (vector<Edge*>::iterator e = want_edges_.begin();
+       e != want_edges_.end(); ++e) {
+    if (!FindWant(*e))
+      continue;
+    (*e)->set_critical_path_weight(-1);
+    int64_t duration = ExpectedEdgeDuration(build_log_, *e);
+    if (duration >= 0) {
+      total_duration += duration;
+      ++known_durations;
+    }
+  }
+  int64_t default_duration = 1;
+  if (known_durations && total_duration / known_durations > 1)
+    default_duration = total_duration / known_durations;
+
+  // The weights of ready edges are about to change, so take them out of the
+  // queue while recomputing and put them back in afterwards.
+  vector<Edge*> ready(ready_.edges());
+  ready_.clear();
+  set<Pool*> pools;
+  durations_.assign(want_.size(), 0);
+  for (vector<Edge*>::iterator e = want_edges_.begin();
+       e != want_edges_.end(); ++e) {
+    if (Want* want = FindWant(*e)) {
+      ComputeEdgeCriticalPath(*e, *want, default_duration);
+      if ((*e)->pool()->ShouldDelayEdge())
+        pools.insert((*e)->pool());
+    }
+  }
+
+  // Total up the work left with the new durations.
+  remaining_duration_ = 0;
+  scheduled_weights_.clear();
+  for (vector<Edge*>::iterator e = want_edges_.begin();
+       e != want_edges_.end(); ++e) {
+    Want* want = FindWant(*e);
+    if (!want || *want == kWantNothing)
+      continue;
+    remaining_duration_ += durations_[(*e)->id_];
+    if (*want == kWantToFinish)
+      scheduled_weights_.insert((*e)->critical_path_weight());
+  }
+  for (vector<Edge*>::iterator e = ready.begin(); e != ready.end(); ++e)
+    ready_.push(*e);
+  // The pools order the edges they delay by priority, too.
+  for (set<Pool*>::iterator p = pools.begin(); p != pools.end(); ++p)
+    (*p)->ReorderDelayedEdges();
+}
+
+int64_t Plan::ComputeEdgeCriticalPath(Edge* edge, Want want,
+                                      int64_t default_duration) {
+  if (edge->critical_path_weight() >= 0)
+    return edge->critical_path_weight();
+
+  // The weight of an edge is its own duration plus the weight of the
+  // heaviest wanted edge that consumes one of its outputs.  Its priority
+  // is the highest of its own and theirs.
+  int64_t dependents_weight = 0;
+  int priority = edge->priority();
+  for (vector<Node*>::iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o) {
+    for (vector<Edge*>::const_iterator oe = (*o)->out_edges().begin();
+         oe != (*o)->out_edges().end(); ++oe) {
+      Want* want_e = FindWant(*oe);
+      if (!want_e)
+        continue;
+      int64_t weight = ComputeEdgeCriticalPath(*oe, *want_e, default_duration);
+      if (weight > dependents_weight)
+        dependents_weight = weight;
+      if ((*oe)->critical_path_priority() > priority)
+        priority = (*oe)->critical_path_priority();
+    }
+  }
+
+  int64_t duration = 0;
+  if (want != kWantNothing && !edge->is_phony()) {
+    duration = ExpectedEdgeDuration(build_log_, edge);
+    if (duration < 0)
+      duration = default_duration;
+  }
+  durations_[edge->id_] = duration;
+  edge->critical_path_priority_ = priority;
+  edge->set_critical_path_weight(duration + dependents_weight);
+  return edge->critical_path_weight();
 }
 
-void Plan::ScheduleWork(map<Edge*, Want>::iterator want_e) {
-  if (want_e->second == kWantToFinish) {
+void Plan::ScheduleWork(Edge* edge) {
+  Want* want_e = FindWant(edge);
+  if (*want_e == kWantToFinish) {
     // This edge has already been scheduled.  We can get here again if an edge
     // and one of its dependencies share an order-only input, or if a node
     // duplicates an out edge (see https://github.com/ninja-build/ninja/pull/519).
     // Avoid scheduling the work again.
     return;
   }
-  assert(want_e->second == kWantToStart);
-  want_e->second = kWantToFinish;
+  assert(*want_e == kWantToStart);
+  *want_e = kWantToFinish;
+  // Edges scheduled before the weights are computed are counted then.
+  if (edge->critical_path_weight() >= 0)
+    scheduled_weights_.insert(edge->critical_path_weight());
 
-  Edge* edge = want_e->first;
   Pool* pool = edge->pool();
   if (pool->ShouldDelayEdge()) {
     pool->DelayEdge(edge);
     pool->RetrieveReadyEdges(&ready_);
   } else {
     pool->EdgeScheduled(*edge);
-    ready_.insert(edge);
+    ready_.push(edge);
   }
 }
 
 bool Plan::EdgeFinished(Edge* edge, EdgeResult result, string* err) {
-  map<Edge*, Want>::iterator e = want_.find(edge);
-  assert(e != want_.end());
-  bool directly_wanted = e->second != kWantNothing;
+  Want* e = FindWant(edge);
+  assert(e);
+  bool directly_wanted = *e != kWantNothing;
 
   // See if this job frees up any delayed jobs.
   if (directly_wanted)
@@ -567,9 +984,11 @@ bool Plan::EdgeFinished(Edge* edge, EdgeResult result, string* err) {
   if (result != kEdgeSucceeded)
     return true;
 
-  if (directly_wanted)
+  if (directly_wanted) {
     --wanted_edges_;
-  want_.erase(e);
+    RemoveRemainingWork(edge, *e);
+  }
+  *e = kNotInPlan;
   edge->outputs_ready_ = true;
 
   // Check off any nodes we were waiting for with this edge.
@@ -582,33 +1001,32 @@ bool Plan::EdgeFinished(Edge* edge, EdgeResult result, string* err) {
 }
 
 bool Plan::NodeFinished(Node* node, string* err) {
-  // If this node provides dyndep info, load it now.
+  // If this node provides dyndep info, the Builder loads it next, along
+  // with the others ready by then.  This will also update the build plan
+  // and schedule any new work that is ready.
   if (node->dyndep_pending()) {
     assert(builder_ && "dyndep requires Plan to have a Builder");
-    // Load the now-clean dyndep file.  This will also update the
-    // build plan and schedule any new work that is ready.
-    return builder_->LoadDyndeps(node, err);
+    ready_dyndeps_.push_back(node);
+    return true;
   }
 
   // See if we we want any edges from this node.
   for (vector<Edge*>::const_iterator oe = node->out_edges().begin();
        oe != node->out_edges().end(); ++oe) {
-    map<Edge*, Want>::iterator want_e = want_.find(*oe);
-    if (want_e == want_.end())
+    if (!FindWant(*oe))
       continue;
 
     // See if the edge is now ready.
-    if (!EdgeMaybeReady(want_e, err))
+    if (!EdgeMaybeReady(*oe, err))
       return false;
   }
   return true;
 }
 
-bool Plan::EdgeMaybeReady(map<Edge*, Want>::iterator want_e, string* err) {
-  Edge* edge = want_e->first;
-  if (edge->AllInputsReady()) {
-    if (want_e->second != kWantNothing) {
-      ScheduleWork(want_e);
+bool Plan::EdgeMaybeReady(Edge* edge, string* err) {
+  if (InputsReady(edge)) {
+    if (*FindWant(edge) != kWantNothing) {
+      ScheduleWork(edge);
     } else {
       // We do not need to build this edge, but we might need to build one of
       // its dependents.
@@ -620,33 +1038,35 @@ bool Plan::EdgeMaybeReady(map<Edge*, Want>::iterator want_e, string* err) {
 }
 
 bool Plan::CleanNode(DependencyScan* scan, Node* node, string* err) {
+  // The nodes cleaned whose dependents are left to check, kept here rather
+  // than recursing, as a generated header may have thousands of them.
+  vector<Node*> cleaned(1, node);
   node->set_dirty(false);
 
-  for (vector<Edge*>::const_iterator oe = node->out_edges().begin();
-       oe != node->out_edges().end(); ++oe) {
-    // Don't process edges that we don't actually want.
-    map<Edge*, Want>::iterator want_e = want_.find(*oe);
-    if (want_e == want_.end() || want_e->second == kWantNothing)
-      continue;
+  while (!cleaned.empty()) {
+    Node* n = cleaned.back();
+    cleaned.pop_back();
 
-    // Don't attempt to clean an edge if it failed to load deps.
-    if ((*oe)->deps_missing_)
-      continue;
+    for (vector<Edge*>::const_iterator oe = n->out_edges().begin();
+         oe != n->out_edges().end(); ++oe) {
+      // Don't process edges that we don't actually want.
+      Want* want_e = FindWant(*oe);
+      if (!want_e || *want_e == kWantNothing)
+        continue;
+
+      // Don't attempt to clean an edge if it failed to load deps.
+      if ((*oe)->deps_missing_)
+        continue;
+
+      // If all non-order-only inputs for this edge are now clean,
+      // we might have changed the dirty state of the outputs.
+      if (!InputsClean(*oe))
+        continue;
 
-    // If all non-order-only inputs for this edge are now clean,
-    // we might have changed the dirty state of the outputs.
-    vector<Node*>::iterator
-        begin = (*oe)->inputs_.begin(),
-        end = (*oe)->inputs_.end() - (*oe)->order_only_deps_;
-#if __cplusplus < 201703L
-#define MEM_FN mem_fun
-#else
-#define MEM_FN mem_fn  // mem_fun was removed in C++17.
-#endif
-    if (find_if(begin, end, MEM_FN(&Node::dirty)) == end) {
       // Recompute most_recent_input.
       Node* most_recent_input = NULL;
-      for (vector<Node*>::iterator i = begin; i != end; ++i) {
+      for (vector<Node*>::iterator i = (*oe)->inputs_.begin();
+           i != (*oe)->inputs_.end() - (*oe)->order_only_deps_; ++i) {
         if (!most_recent_input || (*i)->mtime() > most_recent_input->mtime())
           most_recent_input = *i;
       }
@@ -662,11 +1082,12 @@ bool Plan::CleanNode(DependencyScan* scan, Node* node, string* err) {
       if (!outputs_dirty) {
         for (vector<Node*>::iterator o = (*oe)->outputs_.begin();
              o != (*oe)->outputs_.end(); ++o) {
-          if (!CleanNode(scan, *o, err))
-            return false;
+          (*o)->set_dirty(false);
+          cleaned.push_back(*o);
         }
 
-        want_e->second = kWantNothing;
+        RemoveRemainingWork(*oe, *want_e);
+        *want_e = kWantNothing;
         --wanted_edges_;
         if (!(*oe)->is_phony())
           --command_edges_;
@@ -676,11 +1097,53 @@ bool Plan::CleanNode(DependencyScan* scan, Node* node, string* err) {
   return true;
 }
 
-bool Plan::DyndepsLoaded(DependencyScan* scan, const Node* node,
-                         const DyndepFile& ddf, string* err) {
+int64_t Plan::critical_path_remaining() const {
+  return scheduled_weights_.empty() ? 0 : *scheduled_weights_.rbegin();
+}
+
+void Plan::RemoveRemainingWork(const Edge* edge, Want want) {
+  if (edge->id_ < durations_.size())
+    remaining_duration_ -= durations_[edge->id_];
+  if (want == kWantToFinish) {
+    multiset<int64_t>::iterator i =
+        scheduled_weights_.find(edge->critical_path_weight());
+    if (i != scheduled_weights_.end())
+      scheduled_weights_.erase(i);
+  }
+}
+
+bool Plan::InputsReady(const Edge* edge) {
+  if (edge->id_ >= ready_inputs_.size())
+    ready_inputs_.resize(edge->id_ + 1, 0);
+  size_t& ready = ready_inputs_[edge->id_];
+  while (ready < edge->inputs_.size()) {
+    Edge* in_edge = edge->inputs_[ready]->in_edge();
+    if (in_edge && !in_edge->outputs_ready())
+      return false;
+    ++ready;
+  }
+  return true;
+}
+
+bool Plan::InputsClean(const Edge* edge) {
+  if (edge->id_ >= clean_inputs_.size())
+    clean_inputs_.resize(edge->id_ + 1, 0);
+  size_t& clean = clean_inputs_[edge->id_];
+  size_t end = edge->inputs_.size() - edge->order_only_deps_;
+  while (clean < end && !edge->inputs_[clean]->dirty())
+    ++clean;
+  return clean == end;
+}
+
+bool Plan::DyndepsLoaded(DependencyScan* scan, const vector<Node*>& nodes,
+                         const vector<DyndepFile>& ddfs, string* err) {
+  // The edges may have new inputs, and nodes may be dirty again.
+  ready_inputs_.clear();
+  clean_inputs_.clear();
+
   // Recompute the dirty state of all our direct and indirect dependents now
   // that our dyndep information has been loaded.
-  if (!RefreshDyndepDependents(scan, node, err))
+  if (!RefreshDyndepDependents(scan, nodes, err))
     return false;
 
   // We loaded dyndep information for those out_edges of the dyndep node that
@@ -690,22 +1153,25 @@ bool Plan::DyndepsLoaded(DependencyScan* scan, const Node* node,
 
   // Find edges in the the build plan for which we have new dyndep info.
   std::vector<DyndepFile::const_iterator> dyndep_roots;
-  for (DyndepFile::const_iterator oe = ddf.begin(); oe != ddf.end(); ++oe) {
-    Edge* edge = oe->first;
-
-    // If the edge outputs are ready we do not need to consider it here.
-    if (edge->outputs_ready())
-      continue;
-
-    map<Edge*, Want>::iterator want_e = want_.find(edge);
+  for (vector<DyndepFile>::const_iterator ddf = ddfs.begin();
+       ddf != ddfs.end(); ++ddf) {
+    for (DyndepFile::const_iterator oe = ddf->begin(); oe != ddf->end();
+         ++oe) {
+      Edge* edge = oe->first;
+
+      // If the edge outputs are ready we do not need to consider it here.
+      if (edge->outputs_ready())
+        continue;
 
-    // If the edge has not been encountered before then nothing already in the
-    // plan depends on it so we do not need to consider the edge yet either.
-    if (want_e == want_.end())
-      continue;
+      // If the edge has not been encountered before then nothing already in
+      // the plan depends on it so we do not need to consider the edge yet
+      // either.
+      if (!FindWant(edge))
+        continue;
 
-    // This edge is already in the plan so queue it for the walk.
-    dyndep_roots.push_back(oe);
+      // This edge is already in the plan so queue it for the walk.
+      dyndep_roots.push_back(oe);
+    }
   }
 
   // Walk dyndep-discovered portion of the graph to add it to the build plan.
@@ -721,35 +1187,40 @@ bool Plan::DyndepsLoaded(DependencyScan* scan, const Node* node,
     }
   }
 
-  // Add out edges from this node that are in the plan (just as
+  // Add out edges from these nodes that are in the plan (just as
   // Plan::NodeFinished would have without taking the dyndep code path).
-  for (vector<Edge*>::const_iterator oe = node->out_edges().begin();
-       oe != node->out_edges().end(); ++oe) {
-    map<Edge*, Want>::iterator want_e = want_.find(*oe);
-    if (want_e == want_.end())
-      continue;
-    dyndep_walk.insert(want_e->first);
+  for (vector<Node*>::const_iterator n = nodes.begin(); n != nodes.end();
+       ++n) {
+    for (vector<Edge*>::const_iterator oe = (*n)->out_edges().begin();
+         oe != (*n)->out_edges().end(); ++oe) {
+      if (!FindWant(*oe))
+        continue;
+      dyndep_walk.insert(*oe);
+    }
   }
 
   // See if any encountered edges are now ready.
   for (set<Edge*>::iterator wi = dyndep_walk.begin();
        wi != dyndep_walk.end(); ++wi) {
-    map<Edge*, Want>::iterator want_e = want_.find(*wi);
-    if (want_e == want_.end())
+    if (!FindWant(*wi))
       continue;
-    if (!EdgeMaybeReady(want_e, err))
+    if (!EdgeMaybeReady(*wi, err))
       return false;
   }
 
+  // The dyndep information may have changed the critical path.
+  ComputeCriticalPath();
+
   return true;
 }
 
-bool Plan::RefreshDyndepDependents(DependencyScan* scan, const Node* node,
-                                   string* err) {
+bool Plan::RefreshDyndepDependents(DependencyScan* scan,
+                                   const vector<Node*>& nodes, string* err) {
   // Collect the transitive closure of dependents and mark their edges
   // as not yet visited by RecomputeDirty.
   set<Node*> dependents;
-  UnmarkDependents(node, &dependents);
+  for (vector<Node*>::const_iterator n = nodes.begin(); n != nodes.end(); ++n)
+    UnmarkDependents(*n, &dependents);
 
   // Update the dirty state of all dependents and check if their edges
   // have become wanted.
@@ -768,10 +1239,10 @@ bool Plan::RefreshDyndepDependents(DependencyScan* scan, const Node* node,
     // information an output is now known to be dirty, so we want the edge.
     Edge* edge = n->in_edge();
     assert(edge && !edge->outputs_ready());
-    map<Edge*, Want>::iterator want_e = want_.find(edge);
-    assert(want_e != want_.end());
-    if (want_e->second == kWantNothing) {
-      want_e->second = kWantToStart;
+    Want* want_e = FindWant(edge);
+    assert(want_e);
+    if (*want_e == kWantNothing) {
+      *want_e = kWantToStart;
       EdgeWanted(edge);
     }
   }
@@ -783,8 +1254,7 @@ void Plan::UnmarkDependents(const Node* node, set<Node*>* dependents) {
        oe != node->out_edges().end(); ++oe) {
     Edge* edge = *oe;
 
-    map<Edge*, Want>::iterator want_e = want_.find(edge);
-    if (want_e == want_.end())
+    if (!FindWant(edge))
       continue;
 
     if (edge->mark_ != Edge::VisitNone) {
@@ -799,27 +1269,132 @@ void Plan::UnmarkDependents(const Node* node, set<Node*>* dependents) {
 }
 
 void Plan::Dump() const {
-  printf("pending: %d\n", (int)want_.size());
-  for (map<Edge*, Want>::const_iterator e = want_.begin(); e != want_.end(); ++e) {
-    if (e->second != kWantNothing)
+  vector<Edge*> pending;
+  for (vector<Edge*>::const_iterator e = want_edges_.begin();
+       e != want_edges_.end(); ++e) {
+    if (want_[(*e)->id_] != kNotInPlan)
+      pending.push_back(*e);
+  }
+  printf("pending: %d\n", (int)pending.size());
+  for (vector<Edge*>::iterator e = pending.begin(); e != pending.end(); ++e) {
+    if (want_[(*e)->id_] != kWantNothing)
       printf("want ");
-    e->first->Dump();
+    (*e)->Dump();
   }
   printf("ready: %d\n", (int)ready_.size());
 }
 
+ParallelismTuner::ParallelismTuner(int min_parallelism, int max_parallelism,
+                                   int initial)
+    : min_parallelism_(min_parallelism), max_parallelism_(max_parallelism),
+      parallelism_(max(min_parallelism, min(initial, max_parallelism))),
+      has_sample_(false) {}
+
+bool ParallelismTuner::Sample(const CpuTimes& times, int running) {
+  // Idle for more than this share of the time, the machine can take more
+  // jobs; below the other, it has too many.
+  const double kMinSpare = 0.15;
+  const double kMaxSpare = 0.03;
+
+  bool first = !has_sample_;
+  CpuTimes last = last_;
+  last_ = times;
+  has_sample_ = true;
+  if (first || times.total <= last.total)
+    return false;
+  double spare = (double)(times.idle - last.idle) / (times.total - last.total);
+  if (spare > kMinSpare && running >= parallelism_ &&
+      parallelism_ < max_parallelism_) {
+    ++parallelism_;
+    return true;
+  }
+  if (spare < kMaxSpare && parallelism_ > min_parallelism_)
+    --parallelism_;
+  return false;
+}
+
+namespace {
+
+/// The share of time, in percent, with all tasks stalled on memory from
+/// which the system is considered to be swapping.
+const double kMaxMemoryStall = 10.0;
+
+/// How much of the output of each command is kept in memory; the rest goes
+/// to a temporary file.
+const size_t kMaxBufferedOutput = 1 << 20;
+
+/// Whether less than |min_available| bytes of memory are available, or the
+/// system is already swapping.
+bool IsMemoryLow(int64_t min_available) {
+  int64_t available = GetAvailableMemory();
+  if (available >= 0 && available < min_available)
+    return true;
+  return GetMemoryPressure() >= kMaxMemoryStall;
+}
+
+}  // namespace
+
 struct RealCommandRunner : public CommandRunner {
-  explicit RealCommandRunner(const BuildConfig& config) : config_(config) {}
-  virtual ~RealCommandRunner() {}
+  explicit RealCommandRunner(const BuildConfig& config)
+      : config_(config), woken_(false), last_tune_millis_(0),
+        next_numa_node_(0) {
+    subprocs_.direct_spawn_ = config.direct_spawn;
+    if (config.numa_placement)
+      numa_nodes_ = GetNumaNodeCpus();
+    if (config.max_parallelism > 0) {
+      tuner_.reset(new ParallelismTuner(config.min_parallelism,
+                                        config.max_parallelism,
+                                        config.parallelism));
+    }
+  }
+  virtual ~RealCommandRunner() { ReleaseTokens(); }
   virtual bool CanRunMore() const;
+  virtual bool CanRunEdge(const Edge* edge) const;
   virtual bool StartCommand(Edge* edge);
   virtual bool WaitForCommand(Result* result, std::function<void()> update_func);
+  virtual bool TakeFinishedCommand(Result* result);
+  virtual bool PollCommands();
+  virtual void Wake();
   virtual vector<Edge*> GetActiveEdges();
   virtual void Abort();
+  virtual int GetParallelism() const;
+  virtual void TakeStreamedOutput(vector<pair<Edge*, string> >* output);
+
+  /// Whether |edge| runs through BuildConfig::remote_exec.
+  bool RunsRemotely(const Edge* edge) const;
+  bool CanRunLocally() const;
+  bool CanRunRemotely() const;
+
+  /// Give back the jobserver tokens not needed by the running commands.
+  void ReleaseTokens();
+
+  /// The number of local commands running or finished but not reaped.
+  int LocalCommandCount() const;
+
+  /// Sample the CPU times for |tuner_| if it's time to.
+  /// @return true if more commands may run now.
+  bool Tune();
+
+  /// Fill |result| from the finished |subproc|, and delete it.
+  void Reap(Subprocess* subproc, Result* result);
 
   const BuildConfig& config_;
   SubprocessSet subprocs_;
   map<const Subprocess*, Edge*> subproc_to_edge_;
+  /// The running commands that run remotely; they don't count against
+  /// the local limits, nor take jobserver tokens.
+  set<const Subprocess*> remote_subprocs_;
+  /// The running commands that stream their output.
+  set<Subprocess*> streamed_subprocs_;
+  /// Set by Wake(), cleared once WaitForCommand() returned for it.
+  std::atomic<bool> woken_;
+  /// Tunes the local parallelism, if BuildConfig::max_parallelism is set.
+  unique_ptr<ParallelismTuner> tuner_;
+  int64_t last_tune_millis_;
+  /// The CPUs of each NUMA node, if BuildConfig::numa_placement is set,
+  /// and the node the next local command runs on.
+  vector<vector<int> > numa_nodes_;
+  size_t next_numa_node_;
 };
 
 vector<Edge*> RealCommandRunner::GetActiveEdges() {
@@ -832,22 +1407,106 @@ vector<Edge*> RealCommandRunner::GetActiveEdges() {
 
 void RealCommandRunner::Abort() {
   subprocs_.Clear();
+  remote_subprocs_.clear();
+  streamed_subprocs_.clear();
+  ReleaseTokens();
+}
+
+void RealCommandRunner::ReleaseTokens() {
+  Jobserver* jobserver = config_.jobserver;
+  if (!jobserver)
+    return;
+  // The first command runs on our implicit token.
+  int needed = LocalCommandCount();
+  if (needed > 0)
+    --needed;
+  while (jobserver->acquired() > needed)
+    jobserver->Release();
+}
+
+int RealCommandRunner::LocalCommandCount() const {
+  return (int)(subprocs_.running_.size() + subprocs_.finished_.size() -
+               remote_subprocs_.size());
+}
+
+int RealCommandRunner::GetParallelism() const {
+  return tuner_ ? tuner_->parallelism() : config_.parallelism;
+}
+
+bool RealCommandRunner::Tune() {
+  const int64_t kTuneIntervalMillis = 1000;
+  if (!tuner_)
+    return false;
+  int64_t now = GetTimeMillis();
+  if (now - last_tune_millis_ < kTuneIntervalMillis)
+    return false;
+  last_tune_millis_ = now;
+  CpuTimes times;
+  return GetCpuTimes(&times) && tuner_->Sample(times, LocalCommandCount());
 }
 
 bool RealCommandRunner::CanRunMore() const {
-  size_t subproc_number =
-      subprocs_.running_.size() + subprocs_.finished_.size();
-  return (int)subproc_number < config_.parallelism
-    && ((subprocs_.running_.empty() || config_.max_load_average <= 0.0f)
-        || GetLoadAverage() < config_.max_load_average);
+  return CanRunLocally() || CanRunRemotely();
+}
+
+bool RealCommandRunner::CanRunEdge(const Edge* edge) const {
+  return RunsRemotely(edge) ? CanRunRemotely() : CanRunLocally();
+}
+
+bool RealCommandRunner::RunsRemotely(const Edge* edge) const {
+  return !config_.remote_exec.empty() && !edge->use_console() &&
+         edge->GetBindingBool(kSymbolRemote);
+}
+
+bool RealCommandRunner::CanRunRemotely() const {
+  return !config_.remote_exec.empty() &&
+         (int)remote_subprocs_.size() < config_.remote_parallelism;
+}
+
+bool RealCommandRunner::CanRunLocally() const {
+  size_t subproc_number = LocalCommandCount();
+  if (!((int)subproc_number < GetParallelism()
+        && ((subproc_number == 0 || config_.max_load_average <= 0.0f)
+            || GetLoadAverage() < config_.max_load_average)))
+    return false;
+  if (subproc_number > 0 && config_.min_available_memory > 0 &&
+      IsMemoryLow(config_.min_available_memory))
+    return false;
+
+  // Running one more command needs one more token than the commands already
+  // running hold.  Tokens that become available while we wait for commands
+  // are only noticed once one of them finishes.
+  Jobserver* jobserver = config_.jobserver;
+  if (!jobserver || subproc_number == 0 ||
+      jobserver->acquired() >= (int)subproc_number)
+    return true;
+  return jobserver->TryAcquire();
 }
 
 bool RealCommandRunner::StartCommand(Edge* edge) {
   string command = edge->EvaluateCommand();
-  Subprocess* subproc = subprocs_.Add(command, edge->use_console());
+  bool remote = RunsRemotely(edge);
+  if (remote)
+    command = config_.remote_exec + " " + command;
+  // deps=msvc filters the includes out of the whole output.
+  subprocs_.output_limit_ =
+      edge->GetBinding(kSymbolDeps) == "msvc" ? 0 : kMaxBufferedOutput;
+  subprocs_.cpus_ = edge->pool()->cpus();
+  if (subprocs_.cpus_.empty() && !remote && !numa_nodes_.empty()) {
+    subprocs_.cpus_ = numa_nodes_[next_numa_node_];
+    next_numa_node_ = (next_numa_node_ + 1) % numa_nodes_.size();
+  }
+  subprocs_.cgroup_ = remote ? string() : config_.cgroup;
+  subprocs_.cgroup_settings_ = edge->pool()->cgroup();
+  Subprocess* subproc = subprocs_.Add(command, edge->use_console(),
+                                      edge->GetDepfileFd());
   if (!subproc)
     return false;
   subproc_to_edge_.insert(make_pair(subproc, edge));
+  if (remote)
+    remote_subprocs_.insert(subproc);
+  if (edge->streams_output())
+    streamed_subprocs_.insert(subproc);
 
   return true;
 }
@@ -855,70 +1514,581 @@ bool RealCommandRunner::StartCommand(Edge* edge) {
 bool RealCommandRunner::WaitForCommand(Result* result, std::function<void()> update_func) {
   Subprocess* subproc;
   while ((subproc = subprocs_.NextFinished()) == NULL) {
+    if (woken_.exchange(false) || Tune()) {
+      result->edge = NULL;
+      return true;
+    }
     update_func();
     bool interrupted = subprocs_.DoWork();
     if (interrupted)
       return false;
   }
+  Reap(subproc, result);
+  return true;
+}
+
+bool RealCommandRunner::TakeFinishedCommand(Result* result) {
+  Subprocess* subproc = subprocs_.NextFinished();
+  if (!subproc)
+    return false;
+  Reap(subproc, result);
+  return true;
+}
 
+bool RealCommandRunner::PollCommands() {
+  // A pending wakeup makes DoWork() take what's there and return.
+  subprocs_.Wake();
+  return !subprocs_.DoWork();
+}
+
+void RealCommandRunner::Reap(Subprocess* subproc, Result* result) {
   result->status = subproc->Finish();
-  result->output = subproc->GetOutput();
+  if (g_memory_stats) {
+    // The output of a command is all in memory once it finished, so take
+    // the measure then.
+    int64_t bytes = sizeof(Subprocess) +
+                    MemoryStats::HeapBytes(subproc->GetOutput());
+    for (vector<Subprocess*>::iterator i = subprocs_.running_.begin();
+         i != subprocs_.running_.end(); ++i)
+      bytes += sizeof(Subprocess) + MemoryStats::HeapBytes((*i)->GetOutput());
+    g_memory_stats->Peak("Subprocess buffers", subprocs_.running_.size() + 1,
+                         bytes);
+  }
+  subproc->TakeOutput(&result->output, &result->overflow);
+  subproc->TakeDepfile(&result->depfile_content);
+  result->usage = subproc->usage();
 
   map<const Subprocess*, Edge*>::iterator e = subproc_to_edge_.find(subproc);
   result->edge = e->second;
   subproc_to_edge_.erase(e);
+  remote_subprocs_.erase(subproc);
+  streamed_subprocs_.erase(subproc);
 
   delete subproc;
-  return true;
+  ReleaseTokens();
 }
 
-Builder::Builder(State* state, const BuildConfig& config,
-                 BuildLog* build_log, DepsLog* deps_log,
-                 DiskInterface* disk_interface)
-    : state_(state), config_(config),
-      plan_(this), disk_interface_(disk_interface),
-      scan_(state, build_log, deps_log, disk_interface,
-            &config_.depfile_parser_options) {
-  status_ = new BuildStatus(config);
+void RealCommandRunner::TakeStreamedOutput(
+    vector<pair<Edge*, string> >* output) {
+  string lines;
+  for (set<Subprocess*>::iterator i = streamed_subprocs_.begin();
+       i != streamed_subprocs_.end(); ++i) {
+    if ((*i)->TakeLines(&lines))
+      output->push_back(make_pair(subproc_to_edge_[*i], lines));
+  }
 }
 
-Builder::~Builder() {
-  Cleanup();
+void RealCommandRunner::Wake() {
+  woken_ = true;
+  subprocs_.Wake();
 }
 
-void Builder::Cleanup() {
-  if (command_runner_.get()) {
-    vector<Edge*> active_edges = command_runner_->GetActiveEdges();
-    command_runner_->Abort();
-
-    for (vector<Edge*>::iterator e = active_edges.begin();
-         e != active_edges.end(); ++e) {
-      string depfile = (*e)->GetUnescapedDepfile();
-      for (vector<Node*>::iterator o = (*e)->outputs_.begin();
-           o != (*e)->outputs_.end(); ++o) {
-        // Only delete this output if it was actually modified.  This is
-        // important for things like the generator where we don't want to
-        // delete the manifest file if we can avoid it.  But if the rule
-        // uses a depfile, always delete.  (Consider the case where we
-        // need to rebuild an output because of a modified header file
-        // mentioned in a depfile, and the command touches its depfile
-        // but is interrupted before it touches its output file.)
-        string err;
-        TimeStamp new_mtime = disk_interface_->Stat((*o)->path(), &err);
-        if (new_mtime == -1)  // Log and ignore Stat() errors.
-          Error("%s", err.c_str());
-        if (!depfile.empty() || (*o)->mtime() != new_mtime)
-          disk_interface_->RemoveFile((*o)->path());
-      }
-      if (!depfile.empty())
-        disk_interface_->RemoveFile(depfile);
+/// A finished command, along with the deps it reported and the mtimes of
+/// its outputs.  The deps are read, the outputs stat'ed and the files left
+/// over removed without touching the State, so that this can happen on any
+/// thread.
+struct Builder::ReadDepsJob {
+  /// Stat the outputs of the command once it succeeded if |stat_outputs|.
+  ReadDepsJob(CommandRunner::Result* command_result, bool stat_outputs)
+      : depfile_in_memory(false), stat_outputs(stat_outputs),
+        depfile_removed(false), rspfile_removed(false), ok(true) {
+    result.edge = command_result->edge;
+    result.status = command_result->status;
+    result.output.swap(command_result->output);
+    result.overflow.swap(command_result->overflow);
+    result.depfile_content.swap(command_result->depfile_content);
+    result.usage = command_result->usage;
+    result.restored = command_result->restored;
+    deps_type = result.edge->GetBinding(kSymbolDeps);
+    if (!deps_type.empty()) {
+      deps_prefix = result.edge->GetBinding(kSymbolMsvcDepsPrefix);
+      depfile_in_memory = result.edge->GetDepfileFd() > 0;
+      if (!depfile_in_memory)
+        depfile = result.edge->GetUnescapedDepfile();
+    }
+    if (result.success()) {
+      outputs = result.edge->outputs_;
+      if (!g_keep_rsp && !result.edge->GetBindingBool(kSymbolRspfileKeep))
+        rspfile = result.edge->GetUnescapedRspfile();
     }
   }
-}
 
-Node* Builder::AddTarget(const string& name, string* err) {
-  Node* node = state_->LookupNode(name);
-  if (!node) {
+  /// Whether Run() has anything to do with the file system.
+  bool HasDiskWork() const {
+    return !deps_type.empty() || (result.success() && stat_outputs);
+  }
+
+  /// Read the deps, filtering them out of the output for deps=msvc.  Then,
+  /// if the command succeeded, stat its outputs and remove its depfile and
+  /// rspfile, as far as |disk_interface| lets that happen on any thread;
+  /// FinishCommand() does what's left.
+  void Run(DiskInterface* disk_interface, const DepfileParserOptions& options) {
+    TRACE_RECORD("deps read");
+    ok = Read(disk_interface, options);
+    if (!ok || !result.success())
+      return;
+
+    if (stat_outputs && disk_interface->IsStatThreadSafe()) {
+      output_mtimes.reserve(outputs.size());
+      for (vector<Node*>::iterator o = outputs.begin(); o != outputs.end();
+           ++o) {
+        TimeStamp mtime = disk_interface->Stat((*o)->path(), &stat_err);
+        if (mtime == -1) {
+          output_mtimes.clear();
+          return;
+        }
+        output_mtimes.push_back(mtime);
+      }
+    }
+
+    if (disk_interface->IsRemoveThreadSafe()) {
+      if (deps_type == "gcc" && !depfile_in_memory && !content.empty() &&
+          !g_keep_depfile) {
+        if (disk_interface->RemoveFile(depfile) < 0) {
+          ok = false;
+          err = string("deleting depfile: ") + strerror(errno) + string("\n");
+          return;
+        }
+        depfile_removed = true;
+      }
+      if (!rspfile.empty()) {
+        disk_interface->RemoveFile(rspfile);
+        rspfile_removed = true;
+      }
+    }
+  }
+
+  /// Take the deps from the action cache, which restored the outputs.
+  void Restore(vector<ActionCache::Dep>* deps) {
+    restored_deps.swap(*deps);
+    for (size_t i = 0; i < restored_deps.size(); ++i) {
+      paths.push_back(restored_deps[i].path);
+      slash_bits.push_back(restored_deps[i].slash_bits);
+    }
+  }
+
+  CommandRunner::Result result;
+  string deps_type;
+  string deps_prefix;
+  string depfile;
+  /// Whether the command wrote its depfile to its "depfile_fd", which
+  /// leaves nothing on disk.
+  bool depfile_in_memory;
+
+  /// The outputs of the command, if it succeeded, and their mtimes in the
+  /// same order if Run() stat'ed them.  If it failed to, |stat_err| says
+  /// why.
+  vector<Node*> outputs;
+  bool stat_outputs;
+  vector<TimeStamp> output_mtimes;
+  string stat_err;
+  /// The rspfile to remove once the command succeeded, if it isn't kept.
+  string rspfile;
+  bool depfile_removed;
+  bool rspfile_removed;
+
+  /// Whether the deps could be read; if not, |err| says why.
+  bool ok;
+  string err;
+  /// The depfile contents, which the deps=gcc |paths| point into.
+  string content;
+  /// The deps=msvc includes, which |paths| point into.
+  set<string> includes;
+  vector<StringPiece> paths;
+  vector<uint64_t> slash_bits;
+  /// The deps from the action cache, which |paths| point into.
+  vector<ActionCache::Dep> restored_deps;
+
+ private:
+  bool Read(DiskInterface* disk_interface, const DepfileParserOptions& options);
+};
+
+bool Builder::ReadDepsJob::Read(DiskInterface* disk_interface,
+                                const DepfileParserOptions& options) {
+  if (deps_type.empty()) {
+    return true;
+  } else if (deps_type == "msvc") {
+    CLParser parser;
+    string output;
+    if (!parser.Parse(result.output, deps_prefix, &output, &err))
+      return false;
+    result.output = output;
+    includes.swap(parser.includes_);
+    paths.reserve(includes.size());
+    for (set<string>::iterator i = includes.begin(); i != includes.end(); ++i) {
+      // ~0 is assuming that with MSVC-parsed headers, it's ok to always make
+      // all backslashes (as some of the slashes will certainly be backslashes
+      // anyway). This could be fixed if necessary with some additional
+      // complexity in IncludesNormalize::Relativize.
+      paths.push_back(*i);
+      slash_bits.push_back(~0u);
+    }
+  } else if (deps_type == "gcc") {
+    if (depfile_in_memory) {
+      content.swap(result.depfile_content);
+    } else if (depfile.empty()) {
+      err = "edge with deps=gcc but no depfile makes no sense";
+      return false;
+    } else {
+      // Read depfile content.  Treat a missing depfile as empty.
+      switch (disk_interface->ReadFile(depfile, &content, &err)) {
+      case DiskInterface::Okay:
+        break;
+      case DiskInterface::NotFound:
+        err.clear();
+        break;
+      case DiskInterface::OtherError:
+        return false;
+      }
+    }
+    if (content.empty())
+      return true;
+
+    DepfileParser deps(options);
+    if (!deps.Parse(&content, &err))
+      return false;
+
+    // XXX check depfile matches expected output.
+    paths.reserve(deps.ins_.size());
+    slash_bits.reserve(deps.ins_.size());
+    for (vector<StringPiece>::iterator i = deps.ins_.begin();
+         i != deps.ins_.end(); ++i) {
+      uint64_t bits;
+      if (!CanonicalizePath(const_cast<char*>(i->str_), &i->len_, &bits,
+                            &err))
+        return false;
+      paths.push_back(*i);
+      slash_bits.push_back(bits);
+    }
+  } else {
+    Fatal("unknown deps type '%s'", deps_type.c_str());
+  }
+  return true;
+}
+
+/// Reads the deps of finished commands and stats their outputs on a few
+/// worker threads, so that the main loop keeps starting commands meanwhile.
+/// Wakes the command runner each time a job is done.
+struct Builder::DepsReader {
+  DepsReader(DiskInterface* disk_interface,
+             const DepfileParserOptions& options, CommandRunner* runner)
+      : disk_interface_(disk_interface), options_(options), runner_(runner),
+        pending_(0), tasks_(kThreads) {}
+
+  ~DepsReader() {
+    tasks_.Wait();
+    for (deque<ReadDepsJob*>::iterator i = done_.begin(); i != done_.end();
+         ++i)
+      delete *i;
+  }
+
+  /// Read the deps of |job|, which the DepsReader owns until Next()
+  /// returns it.
+  void Add(ReadDepsJob* job) {
+    ++pending_;
+    tasks_.Add([this, job]() {
+      job->Run(disk_interface_, options_);
+      {
+        lock_guard<mutex> lock(mutex_);
+        done_.push_back(job);
+      }
+      done_changed_.notify_one();
+      runner_->Wake();
+    });
+  }
+
+  /// Return a job whose deps were read, waiting for one if |wait|, or NULL.
+  ReadDepsJob* Next(bool wait) {
+    unique_lock<mutex> lock(mutex_);
+    if (wait) {
+      assert(pending_ > 0);
+      done_changed_.wait(lock, [this]() { return !done_.empty(); });
+    }
+    if (done_.empty())
+      return NULL;
+    ReadDepsJob* job = done_.front();
+    done_.pop_front();
+    --pending_;
+    return job;
+  }
+
+  /// The number of jobs added but not returned by Next() yet.
+  int pending() const { return pending_; }
+
+ private:
+  /// Reading deps is quick next to running the commands that wrote them,
+  /// but stats and unlinks may wait long on a network file system; a few
+  /// threads keep up with the largest -j.
+  static const int kThreads = 4;
+
+  DiskInterface* disk_interface_;
+  const DepfileParserOptions& options_;
+  CommandRunner* runner_;
+  /// Only used by the main thread.
+  int pending_;
+
+  mutex mutex_;
+  condition_variable done_changed_;
+  deque<ReadDepsJob*> done_;
+  /// Last, so that it is destroyed (and its threads joined) first.
+  TaskGroup tasks_;
+};
+
+/// Fetches the entries the action cache misses from its remote cache on a
+/// few worker threads, so that the main loop keeps starting commands
+/// meanwhile.  Wakes the command runner each time a fetch is done.
+struct Builder::CacheFetcher {
+  struct Job {
+    Edge* edge;
+    ActionCache::Key key;
+    /// Whether the entry is now in the action cache.
+    bool fetched;
+    /// How long the fetch took.
+    int64_t micros;
+  };
+
+  CacheFetcher(ActionCache* cache, CommandRunner* runner)
+      : cache_(cache), runner_(runner), tasks_(kThreads) {}
+
+  ~CacheFetcher() {
+    tasks_.Wait();
+    for (deque<Job*>::iterator i = done_.begin(); i != done_.end(); ++i)
+      delete *i;
+  }
+
+  /// Fetch the entry of |key| for |edge|.  Takes the contents of |key|.
+  void Add(Edge* edge, ActionCache::Key* key) {
+    Job* job = new Job;
+    job->edge = edge;
+    swap(job->key, *key);
+    tasks_.Add([this, job]() {
+      int64_t start = GetTimeMicros();
+      job->fetched = cache_->Fetch(job->key);
+      job->micros = GetTimeMicros() - start;
+      {
+        lock_guard<mutex> lock(mutex_);
+        done_.push_back(job);
+      }
+      runner_->Wake();
+    });
+  }
+
+  /// Return a job whose fetch is done, or NULL.
+  Job* Next() {
+    lock_guard<mutex> lock(mutex_);
+    if (done_.empty())
+      return NULL;
+    Job* job = done_.front();
+    done_.pop_front();
+    return job;
+  }
+
+ private:
+  /// The fetches mostly wait on the network; enough of them to keep up
+  /// with the commands the cache saves running.
+  static const int kThreads = 8;
+
+  ActionCache* cache_;
+  CommandRunner* runner_;
+
+  mutex mutex_;
+  deque<Job*> done_;
+  /// Last, so that it is destroyed (and its threads joined) first.
+  TaskGroup tasks_;
+};
+
+/// Wakes the command runner every so often while edges wait for other
+/// processes sharing the build directory, so that the main loop tries to
+/// lock them again; nothing tells when another process lets go of one.
+struct Builder::LockPoller {
+  explicit LockPoller(CommandRunner* runner)
+      : runner_(runner), stopping_(false),
+        thread_(&LockPoller::Run, this) {}
+
+  ~LockPoller() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    stop_.notify_one();
+    thread_.join();
+  }
+
+ private:
+  void Run() {
+    // Short next to the commands waited for, long next to a lock attempt.
+    const chrono::milliseconds kPollPeriod(50);
+    unique_lock<mutex> lock(mutex_);
+    while (!stop_.wait_for(lock, kPollPeriod,
+                           [this]() { return stopping_; }))
+      runner_->Wake();
+  }
+
+  CommandRunner* runner_;
+  mutex mutex_;
+  condition_variable stop_;
+  bool stopping_;
+  /// Last, so that it starts once the rest is set.
+  thread thread_;
+};
+
+struct Builder::Prefetcher {
+  Prefetcher(const DiskInterface* disk_interface, int64_t budget)
+      : disk_interface_(disk_interface), budget_(budget), held_bytes_(0),
+        current_(NULL), current_started_(false), stopping_(false),
+        thread_(&Prefetcher::Run, this) {}
+
+  ~Prefetcher() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cond_.notify_one();
+    thread_.join();
+  }
+
+  /// Read the files |paths| of |edge| ahead, once the budget allows.
+  void Add(const Edge* edge, vector<string>* paths) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      queue_.push_back(Job());
+      queue_.back().edge = edge;
+      queue_.back().paths.swap(*paths);
+    }
+    cond_.notify_one();
+  }
+
+  /// |edge| started: its files no longer count against the budget, or
+  /// aren't read ahead any more.
+  void Started(const Edge* edge) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      map<const Edge*, int64_t>::iterator held = held_.find(edge);
+      if (held != held_.end()) {
+        held_bytes_ -= held->second;
+        held_.erase(held);
+      } else if (edge == current_) {
+        current_started_ = true;
+      } else {
+        for (deque<Job>::iterator i = queue_.begin(); i != queue_.end(); ++i) {
+          if (i->edge == edge) {
+            queue_.erase(i);
+            break;
+          }
+        }
+      }
+    }
+    cond_.notify_one();
+  }
+
+ private:
+  struct Job {
+    const Edge* edge;
+    vector<string> paths;
+  };
+
+  void Run() {
+    unique_lock<mutex> lock(mutex_);
+    for (;;) {
+      cond_.wait(lock, [this]() {
+        return stopping_ || (!queue_.empty() && held_bytes_ < budget_);
+      });
+      if (stopping_)
+        return;
+      Job job;
+      swap(job, queue_.front());
+      queue_.pop_front();
+      current_ = job.edge;
+      current_started_ = false;
+      lock.unlock();
+
+      // The last edge may take the bytes past the budget; the next waits.
+      int64_t bytes = 0;
+      for (vector<string>::iterator p = job.paths.begin();
+           p != job.paths.end(); ++p) {
+        int64_t size = disk_interface_->Prefetch(*p);
+        if (size > 0)
+          bytes += size;
+      }
+
+      lock.lock();
+      if (!current_started_ && bytes > 0) {
+        held_[current_] = bytes;
+        held_bytes_ += bytes;
+      }
+      current_ = NULL;
+    }
+  }
+
+  const DiskInterface* disk_interface_;
+  const int64_t budget_;
+  mutex mutex_;
+  condition_variable cond_;
+  deque<Job> queue_;
+  /// The bytes read ahead for each edge not started yet, and their sum.
+  map<const Edge*, int64_t> held_;
+  int64_t held_bytes_;
+  /// The edge whose files are being read ahead, and whether it started
+  /// meanwhile.
+  const Edge* current_;
+  bool current_started_;
+  bool stopping_;
+  /// Last, so that it starts once the rest is set.
+  thread thread_;
+};
+
+Builder::Builder(State* state, const BuildConfig& config,
+                 BuildLog* build_log, DepsLog* deps_log,
+                 DiskInterface* disk_interface)
+    : state_(state), config_(config),
+      plan_(this), disk_interface_(disk_interface),
+      scan_(state, build_log, deps_log, disk_interface,
+            &config_.depfile_parser_options),
+      build_dir_lock_(NULL), metrics_published_millis_(0),
+      own_status_(new BuildStatus(config)) {
+  status_ = own_status_.get();
+  scan_.set_lazy_depfiles(config.lazy_depfiles);
+}
+
+Builder::~Builder() {
+  Cleanup();
+}
+
+void Builder::Cleanup() {
+  if (command_runner_.get()) {
+    vector<Edge*> active_edges = command_runner_->GetActiveEdges();
+    command_runner_->Abort();
+
+    for (vector<Edge*>::iterator e = active_edges.begin();
+         e != active_edges.end(); ++e) {
+      string depfile = (*e)->GetUnescapedDepfile();
+      for (vector<Node*>::iterator o = (*e)->outputs_.begin();
+           o != (*e)->outputs_.end(); ++o) {
+        // Only delete this output if it was actually modified.  This is
+        // important for things like the generator where we don't want to
+        // delete the manifest file if we can avoid it.  But if the rule
+        // uses a depfile, always delete.  (Consider the case where we
+        // need to rebuild an output because of a modified header file
+        // mentioned in a depfile, and the command touches its depfile
+        // but is interrupted before it touches its output file.)
+        string err;
+        TimeStamp new_mtime = disk_interface_->Stat((*o)->path(), &err);
+        if (new_mtime == -1)  // Log and ignore Stat() errors.
+          Error("%s", err.c_str());
+        if (!depfile.empty() || (*o)->mtime() != new_mtime)
+          disk_interface_->RemoveFile((*o)->path());
+      }
+      if (!depfile.empty())
+        disk_interface_->RemoveFile(depfile);
+      if (build_dir_lock_)
+        build_dir_lock_->UnlockEdge(*e);
+    }
+  }
+}
+
+Node* Builder::AddTarget(const string& name, string* err) {
+  Node* node = state_->LookupNode(name);
+  if (!node) {
     *err = "unknown target: '" + name + "'";
     return NULL;
   }
@@ -939,17 +2109,92 @@ bool Builder::AddTarget(Node* target, string* err) {
   if (!plan_.AddTarget(target, err))
     return false;
 
+  return LoadReadyDyndeps(err);
+}
+
+void Builder::AddTargetToScan(Node* target) {
+  scan_targets_.push_back(target);
+}
+
+bool Builder::ScanNextEdge(string* err) {
+  for (;;) {
+    if (scan_stack_.empty())
+      scan_stack_.push_back(make_pair(scan_targets_.front(), 0));
+    pair<Node*, size_t>& top = scan_stack_.back();
+    Edge* edge = top.first->in_edge();
+
+    // Go down to the inputs first, so that RecomputeDirty() has one edge
+    // to scan at a time: the inputs of its inputs are scanned already.
+    if (edge && edge->mark_ == Edge::VisitNone &&
+        top.second < edge->inputs_.size()) {
+      Node* input = edge->inputs_[top.second++];
+      Edge* in_edge = input->in_edge();
+      if (in_edge && in_edge->mark_ == Edge::VisitNone) {
+        if (in_edge->id_ >= scan_visited_.size())
+          scan_visited_.resize(in_edge->id_ + 1, false);
+        // An edge visited but not scanned is on the walk, in a cycle that
+        // RecomputeDirty() reports.
+        if (!scan_visited_[in_edge->id_]) {
+          scan_visited_[in_edge->id_] = true;
+          scan_stack_.push_back(make_pair(input, 0));
+        }
+      }
+      continue;
+    }
+
+    Node* node = top.first;
+    scan_stack_.pop_back();
+    if (scan_stack_.empty())
+      scan_targets_.pop_front();
+    if (!scan_.RecomputeDirty(node, err))
+      return false;
+    // As with AddTarget(), a target up to date is no error.
+    if (!plan_.AddScannedTarget(node, err) && !err->empty())
+      return false;
+    return true;
+  }
+}
+
+bool Builder::ScanSlice(string* err) {
+  METRIC_RECORD("scan slice");
+  // Long enough for many edges, short next to the commands waiting to be
+  // reaped meanwhile.
+  const int64_t kScanSliceMillis = 10;
+  int64_t end = GetTimeMillis() + kScanSliceMillis;
+  do {
+    if (!ScanNextEdge(err))
+      return false;
+  } while (!scan_targets_.empty() && GetTimeMillis() < end &&
+           !(plan_.has_ready_edges() && command_runner_->CanRunMore()));
+
+  status_->PlanHasTotalEdges(plan_.command_edge_count());
+  if (scan_targets_.empty()) {
+    // The whole plan is known; order the edges left by critical path.
+    plan_.PrepareQueue(scan_.build_log());
+    status_->PlanHasRemainingWork(plan_.remaining_duration(),
+                                  plan_.critical_path_remaining());
+  }
   return true;
 }
 
+void Builder::StatTargets(const vector<Node*>& targets) {
+  scan_.StatReachableNodes(targets);
+}
+
 bool Builder::AlreadyUpToDate() const {
-  return !plan_.more_to_do();
+  return !plan_.more_to_do() && scan_targets_.empty();
 }
 
 bool Builder::Build(string* err) {
   assert(!AlreadyUpToDate());
 
+  plan_.PrepareQueue(scan_.build_log());
   status_->PlanHasTotalEdges(plan_.command_edge_count());
+  status_->PlanHasRemainingWork(plan_.remaining_duration(),
+                                plan_.critical_path_remaining());
+  existing_dirs_.clear();
+  prefetched_edges_.clear();
+  prefetched_nodes_.clear();
   int pending_commands = 0;
   int failures_allowed = config_.failures_allowed;
 
@@ -960,20 +2205,174 @@ bool Builder::Build(string* err) {
     else
       command_runner_.reset(new RealCommandRunner(config_));
   }
+  if (!deps_reader_ && CanReadDepsAsync()) {
+    deps_reader_.reset(new DepsReader(disk_interface_,
+                                      config_.depfile_parser_options,
+                                      command_runner_.get()));
+  }
+  if (!cache_fetcher_ && config_.action_cache &&
+      config_.action_cache->remote() && !config_.dry_run) {
+    cache_fetcher_.reset(new CacheFetcher(config_.action_cache,
+                                          command_runner_.get()));
+  }
+  if (!prefetcher_ && config_.prefetch_budget > 0 && !config_.dry_run)
+    prefetcher_.reset(new Prefetcher(disk_interface_, config_.prefetch_budget));
+
+  // Finish a command with the deps read for it, or fail the build.
+  auto finish_command = [&](ReadDepsJob* job) {
+    bool finished = FinishCommand(job, err);
+    UnlockEdge(job->result.edge);
+    if (!finished) {
+      Cleanup();
+      status_->BuildFinished();
+      return false;
+    }
+    if (!job->result.success()) {
+      if (config_.fail_fast) {
+        // Don't wait out the commands still running for a build that
+        // failed already.
+        Cleanup();
+        PublishMetrics(true);
+        status_->BuildFinished();
+        *err = "subcommand failed";
+        return false;
+      }
+      if (failures_allowed)
+        failures_allowed--;
+    }
+    PublishMetrics(false);
+    return true;
+  };
 
   // We are about to start the build process.
   status_->BuildStarted();
+  PublishMetrics(true);
 
   // This main loop runs the entire build process.
   // It is structured like this:
-  // First, we attempt to start as many commands as allowed by the
+  // First, we finish the commands whose deps were read meanwhile, as that
+  // may let more commands start.
+  // Next, we attempt to start as many commands as allowed by the
   // command runner.
-  // Second, we attempt to wait for / reap the next finished command.
-  while (plan_.more_to_do()) {
+  // Then, we attempt to wait for / reap the next finished command, along
+  // with the others that finished meanwhile, and hand their deps to the
+  // deps reader if there is one.
+  while (plan_.more_to_do() || plan_.has_ready_dyndeps() ||
+         !scan_targets_.empty()) {
+    // Finish the edges whose outputs were restored from the action cache.
+    if (!restored_jobs_.empty()) {
+      unique_ptr<ReadDepsJob> job(move(restored_jobs_.front()));
+      restored_jobs_.pop_front();
+      --pending_commands;
+      status_->BuildCommandReaped(job->result.edge, true);
+      if (!finish_command(job.get()))
+        return false;
+      continue;
+    }
+
+    // Start the edges other processes ran once they let go of them, when
+    // the runner takes more.
+    if (!locked_edges_.empty() && failures_allowed &&
+        command_runner_->CanRunMore()) {
+      Edge* edge = NULL;
+      for (vector<Edge*>::iterator i = locked_edges_.begin();
+           i != locked_edges_.end(); ++i) {
+        if (command_runner_->CanRunEdge(*i) &&
+            build_dir_lock_->TryLockEdge(*i)) {
+          edge = *i;
+          locked_edges_.erase(i);
+          break;
+        }
+      }
+      if (locked_edges_.empty())
+        lock_poller_.reset();
+      if (edge) {
+        if (!StartLockedEdge(edge, err)) {
+          Cleanup();
+          status_->BuildFinished();
+          return false;
+        }
+        continue;
+      }
+    }
+
+    // Restore the outputs the remote cache had, or leave the edges it
+    // missed to run their commands.
+    if (cache_fetcher_) {
+      if (CacheFetcher::Job* fetched = cache_fetcher_->Next()) {
+        unique_ptr<CacheFetcher::Job> job(fetched);
+        if (job->fetched && RestoreFromCache(job->edge, job->key)) {
+          if (g_metrics) {
+            static Metric* metric = g_metrics->NewMetric("remote cache hit");
+            metric->Add(job->micros);
+          }
+        } else {
+          if (g_metrics) {
+            static Metric* metric = g_metrics->NewMetric("remote cache miss");
+            metric->Add(job->micros);
+          }
+          swap(cache_keys_[job->edge], job->key);
+          fetch_missed_.push_back(job->edge);
+        }
+        continue;
+      }
+    }
+
+    if (deps_reader_) {
+      if (ReadDepsJob* job = deps_reader_->Next(false)) {
+        unique_ptr<ReadDepsJob> owner(job);
+        if (!finish_command(job))
+          return false;
+        continue;
+      }
+    }
+
+    // Load the dyndep files the commands finished so far produced, which
+    // may let more commands start.
+    if (plan_.has_ready_dyndeps()) {
+      if (!LoadReadyDyndeps(err)) {
+        Cleanup();
+        status_->BuildFinished();
+        return false;
+      }
+      continue;
+    }
+
     // See if we can start any more commands.
     if (failures_allowed && command_runner_->CanRunMore()) {
-      if (Edge* edge = plan_.FindWork()) {
-        if (edge->GetBindingBool("generator")) {
+      // The edges the remote cache missed started already; only their
+      // commands are left to start.
+      if (!fetch_missed_.empty() &&
+          command_runner_->CanRunEdge(fetch_missed_.front())) {
+        Edge* edge = fetch_missed_.front();
+        fetch_missed_.pop_front();
+        if (!command_runner_->StartCommand(edge)) {
+          err->assign("command '" + edge->EvaluateCommand() + "' failed.");
+          Cleanup();
+          status_->BuildFinished();
+          return false;
+        }
+        continue;
+      }
+
+      // Edges held back earlier go first, if the runner takes them now.
+      Edge* edge = NULL;
+      for (vector<Edge*>::iterator i = held_edges_.begin();
+           i != held_edges_.end(); ++i) {
+        if (command_runner_->CanRunEdge(*i)) {
+          edge = *i;
+          held_edges_.erase(i);
+          break;
+        }
+      }
+      if (!edge)
+        edge = plan_.FindWork();
+      if (edge && !edge->is_phony() && !command_runner_->CanRunEdge(edge)) {
+        held_edges_.push_back(edge);
+        continue;
+      }
+      if (edge) {
+        if (edge->GetBindingBool(kSymbolGenerator)) {
           scan_.build_log()->Close();
         }
 
@@ -998,40 +2397,120 @@ bool Builder::Build(string* err) {
       }
     }
 
-    auto update_scrolling_status = [this]{
+    // No more commands start for now; read ahead the inputs of those
+    // that will next.
+    if (prefetcher_)
+      PrefetchUpcoming();
+
+    auto update_status = [this]{
+      vector<pair<Edge*, string> > streamed;
+      command_runner_->TakeStreamedOutput(&streamed);
+      for (vector<pair<Edge*, string> >::iterator i = streamed.begin();
+           i != streamed.end(); ++i)
+        this->status_->BuildEdgeOutput(i->first, i->second);
       if (LinePrinter::GetStatusPrintMode() == e_status_print_mode::scrolling) {
         this->status_->PrintStatusScrolling();
       }
+      this->PublishMetrics(false);
     };
 
-    // See if we can reap any finished commands.
-    if (pending_commands) {
-      CommandRunner::Result result;
-      if (!command_runner_->WaitForCommand(&result, update_scrolling_status) ||
-          result.status == ExitInterrupted) {
+    // The commands of the edges the remote cache missed won't start once
+    // too many failed.
+    if (!failures_allowed && !fetch_missed_.empty()) {
+      pending_commands -= (int)fetch_missed_.size();
+      fetch_missed_.clear();
+      continue;
+    }
+    if (!failures_allowed && !locked_edges_.empty()) {
+      pending_commands -= (int)locked_edges_.size();
+      locked_edges_.clear();
+      lock_poller_.reset();
+      continue;
+    }
+    // Nor does the scan go on.
+    if (!failures_allowed && !scan_targets_.empty()) {
+      scan_targets_.clear();
+      scan_stack_.clear();
+      continue;
+    }
+
+    // Scan more of the targets of AddTargetToScan(), if any are left,
+    // only looking for the commands that finished meanwhile.
+    bool scanned = false;
+    if (!scan_targets_.empty()) {
+      if (!ScanSlice(err)) {
         Cleanup();
         status_->BuildFinished();
-        *err = "interrupted by user";
         return false;
       }
+      scanned = true;
+    }
 
-      --pending_commands;
-      if (!FinishCommand(&result, err)) {
-        Cleanup();
-        status_->BuildFinished();
-        return false;
+    // See if we can reap any finished commands.
+    if (pending_commands) {
+      CommandRunner::Result result;
+      bool interrupted;
+      if (scanned) {
+        update_status();
+        interrupted = !command_runner_->PollCommands();
+        if (!interrupted)
+          command_runner_->TakeFinishedCommand(&result);
+      } else {
+        interrupted = !command_runner_->WaitForCommand(&result,
+                                                       update_status);
+        status_->SetParallelism(command_runner_->GetParallelism());
       }
 
-      if (!result.success()) {
-        if (failures_allowed)
-          failures_allowed--;
+      // Woken up by the deps reader, or more commands may run.
+      if (!interrupted && !result.edge)
+        continue;
+
+      // When many commands finish at once, finish them all before starting
+      // more, so that the edges they make ready compete for the free slots
+      // by priority.
+      for (;;) {
+        if (interrupted || result.status == ExitInterrupted) {
+          Cleanup();
+          status_->BuildFinished();
+          *err = "interrupted by user";
+          return false;
+        }
+
+        --pending_commands;
+        status_->BuildCommandReaped(result.edge, result.success());
+        unique_ptr<ReadDepsJob> job(
+            new ReadDepsJob(&result, !config_.dry_run));
+        if (deps_reader_ && job->HasDiskWork()) {
+          deps_reader_->Add(job.release());
+        } else {
+          job->Run(disk_interface_, config_.depfile_parser_options);
+          if (!finish_command(job.get()))
+            return false;
+        }
+
+        result = CommandRunner::Result();
+        if (!pending_commands || !command_runner_->TakeFinishedCommand(&result))
+          break;
       }
 
       // We made some progress; start the main loop over.
       continue;
     }
 
+    // The scan goes on rather than wait for the deps being read.
+    if (scanned)
+      continue;
+
+    // Nothing else to do but wait for the deps being read.
+    if (deps_reader_ && deps_reader_->pending() > 0) {
+      unique_ptr<ReadDepsJob> job(deps_reader_->Next(true));
+      if (!finish_command(job.get()))
+        return false;
+      continue;
+    }
+
     // If we get here, we cannot make any more progress.
+    PublishMetrics(true);
     status_->BuildFinished();
     if (failures_allowed == 0) {
       if (config_.failures_allowed > 1)
@@ -1046,22 +2525,105 @@ bool Builder::Build(string* err) {
     return false;
   }
 
+  PublishMetrics(true);
   status_->BuildFinished();
   return true;
 }
 
+void Builder::PublishMetrics(bool force) {
+  MetricsServer* server = config_.metrics_server;
+  if (!server)
+    return;
+  int64_t now = GetTimeMillis();
+  if (!force && now - metrics_published_millis_ < kMetricsPublishMillis)
+    return;
+  metrics_published_millis_ = now;
+
+  MetricsPage page;
+  status_->WriteMetrics(&page);
+  page.Family("ninja_pool_current_use", "gauge",
+              "Weight of the commands scheduled in each pool.");
+  // The default pool, named "", has no limit to keep track of.
+  for (map<string, Pool*>::const_iterator p = state_->pools_.begin();
+       p != state_->pools_.end(); ++p) {
+    if (!p->first.empty())
+      page.Sample("pool", p->first, (int64_t)p->second->current_use());
+  }
+  page.Family("ninja_pool_depth", "gauge",
+              "Depth of each pool, 0 if unlimited.");
+  for (map<string, Pool*>::const_iterator p = state_->pools_.begin();
+       p != state_->pools_.end(); ++p) {
+    if (!p->first.empty())
+      page.Sample("pool", p->first, (int64_t)p->second->depth());
+  }
+
+  if (RemoteCache* remote =
+          config_.action_cache ? config_.action_cache->remote() : NULL) {
+    page.Family("ninja_remote_cache_requests_total", "counter",
+                "Requests to the remote cache, by how they went.");
+    page.Sample("result", "hit", remote->hits());
+    page.Sample("result", "miss", remote->misses());
+    page.Sample("result", "upload", remote->uploads());
+    page.Sample("result", "error", remote->errors());
+  }
+
+  // The timers of -d stats.
+  if (g_metrics) {
+    const vector<Metric*>& metrics = g_metrics->metrics();
+    page.Family("ninja_metric_calls_total", "counter",
+                "Times a code path timed by -d stats ran.");
+    for (vector<Metric*>::const_iterator m = metrics.begin();
+         m != metrics.end(); ++m)
+      page.Sample("name", (*m)->name, (int64_t)(*m)->count);
+    page.Family("ninja_metric_seconds_total", "counter",
+                "Seconds spent on a code path timed by -d stats.");
+    for (vector<Metric*>::const_iterator m = metrics.begin();
+         m != metrics.end(); ++m)
+      page.Sample("name", (*m)->name, (*m)->sum / 1e6);
+  }
+  server->Publish(page);
+}
+
 bool Builder::StartEdge(Edge* edge, string* err) {
   METRIC_RECORD("StartEdge");
   if (edge->is_phony())
     return true;
 
+  status_->PlanHasRemainingWork(plan_.remaining_duration(),
+                                plan_.critical_path_remaining());
   status_->BuildEdgeStarted(edge);
+  if (prefetcher_)
+    prefetcher_->Started(edge);
+
+  // The command, depfile and rspfile are needed until the edge finished.
+  edge->KeepEvaluatedBindings();
+
+  if (edge->GetDepfileFd() == 0) {
+    *err = "invalid depfile_fd '" + edge->GetBinding(kSymbolDepfileFd) +
+           "' for '" + edge->outputs_[0]->path() + "'";
+    return false;
+  }
+
+  // Only one of the processes sharing the build directory runs an edge at
+  // a time; wait for another running this one.
+  if (build_dir_lock_ && !config_.dry_run) {
+    if (!build_dir_lock_->TryLockEdge(edge)) {
+      locked_edges_.push_back(edge);
+      if (!lock_poller_)
+        lock_poller_.reset(new LockPoller(command_runner_.get()));
+      return true;
+    }
+    return StartLockedEdge(edge, err);
+  }
+  return RunEdge(edge, err);
+}
 
+bool Builder::RunEdge(Edge* edge, string* err) {
   // Create directories necessary for outputs.
   // XXX: this will block; do we care?
   for (vector<Node*>::iterator o = edge->outputs_.begin();
        o != edge->outputs_.end(); ++o) {
-    if (!disk_interface_->MakeDirs((*o)->path()))
+    if (!disk_interface_->MakeDirs((*o)->path(), &existing_dirs_))
       return false;
   }
 
@@ -1069,9 +2631,44 @@ bool Builder::StartEdge(Edge* edge, string* err) {
   // XXX: this may also block; do we care?
   string rspfile = edge->GetUnescapedRspfile();
   if (!rspfile.empty()) {
-    string content = edge->GetBinding("rspfile_content");
-    if (!disk_interface_->WriteFile(rspfile, content))
+    // A response file that is kept is only written when its content changes.
+    const string& content = edge->kept_rspfile_content();
+    if (g_keep_rsp || edge->GetBindingBool(kSymbolRspfileKeep)) {
+      if (!disk_interface_->UpdateFile(rspfile, content))
+        return false;
+    } else if (!disk_interface_->WriteFile(rspfile, content)) {
+      return false;
+    }
+  }
+
+  // Digest the inputs before the command runs, so that changes made to
+  // them meanwhile have it run again next time.
+  if (scan_.hash_log() && !config_.dry_run &&
+      edge->GetBindingBool(kSymbolHashInputs)) {
+    uint64_t digest;
+    if (!scan_.hash_log()->InputsDigest(edge, disk_interface_, true, &digest,
+                                        err))
       return false;
+    inputs_digests_[edge] = digest;
+  }
+
+  // Restore the outputs from the action cache if it has them, or remember
+  // the key to store them under once the command ran.
+  if (config_.action_cache && !config_.dry_run &&
+      ActionCache::IsCacheable(edge)) {
+    ActionCache::Key key;
+    string key_err;
+    if (config_.action_cache->ComputeKey(edge, disk_interface_,
+                                         scan_.hash_log(), &key, &key_err)) {
+      if (RestoreFromCache(edge, key))
+        return true;
+      // Look in the remote cache before running the command.
+      if (cache_fetcher_) {
+        cache_fetcher_->Add(edge, &key);
+        return true;
+      }
+      swap(cache_keys_[edge], key);
+    }
   }
 
   // start command computing and run it
@@ -1083,9 +2680,133 @@ bool Builder::StartEdge(Edge* edge, string* err) {
   return true;
 }
 
-bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
+bool Builder::StartLockedEdge(Edge* edge, string* err) {
+  // Another process may have run the edge since the scan found it dirty;
+  // look again, with what it recorded and the files as they are now.
+  if ((scan_.build_log() && !scan_.build_log()->CatchUp(err)) ||
+      (scan_.deps_log() && !scan_.deps_log()->CatchUp(err)))
+    return false;
+  Node* most_recent_input = NULL;
+  for (vector<Node*>::iterator i = edge->inputs_.begin();
+       i != edge->inputs_.end() - edge->order_only_deps_; ++i) {
+    if (!(*i)->Stat(disk_interface_, err))
+      return false;
+    if (!most_recent_input || (*i)->mtime() > most_recent_input->mtime())
+      most_recent_input = *i;
+  }
+  for (vector<Node*>::iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o) {
+    if (!(*o)->Stat(disk_interface_, err))
+      return false;
+  }
+  bool dirty = false;
+  if (!scan_.RecomputeOutputsDirty(edge, most_recent_input, &dirty, err))
+    return false;
+
+  // The deps it read must be in the log too, or the next build would miss
+  // them.
+  vector<ActionCache::Dep> deps;
+  if (!dirty && !edge->GetBinding(kSymbolDeps).empty()) {
+    Node* output = edge->outputs_[0];
+    DepsLog::Deps* recorded =
+        scan_.deps_log() ? scan_.deps_log()->GetDeps(output) : NULL;
+    if (recorded && recorded->mtime == output->mtime()) {
+      for (int i = 0; i < recorded->node_count; ++i) {
+        ActionCache::Dep dep = { recorded->nodes[i]->path(),
+                                 recorded->nodes[i]->slash_bits() };
+        deps.push_back(dep);
+      }
+    } else {
+      dirty = true;
+    }
+  }
+  if (dirty)
+    return RunEdge(edge, err);
+
+  CommandRunner::Result result;
+  result.edge = edge;
+  result.status = ExitSuccess;
+  result.restored = true;
+  unique_ptr<ReadDepsJob> job(new ReadDepsJob(&result, true));
+  job->Restore(&deps);
+  restored_jobs_.push_back(move(job));
+  return true;
+}
+
+void Builder::UnlockEdge(Edge* edge) {
+  if (!build_dir_lock_ || config_.dry_run)
+    return;
+  // The others look for the edge in the build log once they have it.
+  if (scan_.build_log())
+    scan_.build_log()->Flush();
+  build_dir_lock_->UnlockEdge(edge);
+}
+
+bool Builder::RestoreFromCache(Edge* edge, const ActionCache::Key& key) {
+  CommandRunner::Result result;
+  vector<ActionCache::Dep> deps;
+  if (!config_.action_cache->Restore(edge, key, disk_interface_,
+                                     scan_.hash_log(), &deps,
+                                     &result.output))
+    return false;
+  result.edge = edge;
+  result.status = ExitSuccess;
+  result.restored = true;
+  unique_ptr<ReadDepsJob> job(new ReadDepsJob(&result, true));
+  job->Restore(&deps);
+  restored_jobs_.push_back(move(job));
+  return true;
+}
+
+bool Builder::CanReadDepsAsync() const {
+  // Metrics aren't synchronized.
+  return disk_interface_->IsReadThreadSafe() && !g_metrics;
+}
+
+void Builder::PrefetchUpcoming() {
+  // The held edges start before those of the plan.
+  vector<Edge*> edges(held_edges_);
+  plan_.UpcomingEdges(2 * max(config_.parallelism, 1), &edges);
+  for (vector<Edge*>::iterator e = edges.begin(); e != edges.end(); ++e) {
+    Edge* edge = *e;
+    if (edge->is_phony())
+      continue;
+    if (edge->id_ >= prefetched_edges_.size())
+      prefetched_edges_.resize(edge->id_ + 1);
+    if (prefetched_edges_[edge->id_])
+      continue;
+    prefetched_edges_[edge->id_] = true;
+    // The inputs include the headers the deps log recorded.  Order-only
+    // ones are rarely read.
+    vector<string> paths;
+    for (size_t i = 0; i < edge->inputs_.size(); ++i) {
+      Node* input = edge->inputs_[i];
+      if (edge->is_order_only(i) || !input->exists() ||
+          !prefetched_nodes_.insert(input).second)
+        continue;
+      paths.push_back(input->path());
+    }
+    if (!paths.empty())
+      prefetcher_->Add(edge, &paths);
+  }
+}
+
+bool Builder::FinishCommand(CommandRunner::Result* command_result,
+                            string* err) {
+  ReadDepsJob job(command_result, !config_.dry_run);
+  job.Run(disk_interface_, config_.depfile_parser_options);
+  bool ok = FinishCommand(&job, err);
+  command_result->status = job.result.status;
+  command_result->output.swap(job.result.output);
+  command_result->overflow.swap(job.result.overflow);
+  return ok;
+}
+
+bool Builder::FinishCommand(ReadDepsJob* job, string* err) {
   METRIC_RECORD("FinishCommand");
+  TRACE_RECORD("FinishCommand");
 
+  CommandRunner::Result* result = &job->result;
   Edge* edge = result->edge;
 
   // First try to extract dependencies from the result, if any.
@@ -1094,12 +2815,10 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
   // extraction itself can fail, which makes the command fail from a
   // build perspective.
   vector<Node*> deps_nodes;
-  string deps_type = edge->GetBinding("deps");
-  const string deps_prefix = edge->GetBinding("msvc_deps_prefix");
+  const string& deps_type = job->deps_type;
   if (!deps_type.empty()) {
     string extract_err;
-    if (!ExtractDeps(result, deps_type, deps_prefix, &deps_nodes,
-                     &extract_err) &&
+    if (!ExtractDeps(job, &deps_nodes, &extract_err) &&
         result->success()) {
       if (!result->output.empty())
         result->output.append("\n");
@@ -1109,32 +2828,66 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
   }
 
   int start_time, end_time;
+  status_->PlanHasRemainingWork(plan_.remaining_duration(),
+                                plan_.critical_path_remaining());
   status_->BuildEdgeFinished(edge, result->success(), result->output,
-                             &start_time, &end_time);
+                             result->overflow.get(), &start_time, &end_time);
+
+  ActionCache::Key cache_key;
+  bool has_cache_key = false;
+  map<const Edge*, ActionCache::Key>::iterator key = cache_keys_.find(edge);
+  if (key != cache_keys_.end()) {
+    swap(cache_key, key->second);
+    has_cache_key = true;
+    cache_keys_.erase(key);
+  }
+
+  uint64_t inputs_digest = 0;
+  bool has_inputs_digest = false;
+  map<const Edge*, uint64_t>::iterator digest = inputs_digests_.find(edge);
+  if (digest != inputs_digests_.end()) {
+    inputs_digest = digest->second;
+    has_inputs_digest = true;
+    inputs_digests_.erase(digest);
+  }
 
   // The rest of this function only applies to successful commands.
   if (!result->success()) {
+    edge->ReleaseEvaluatedBindings();
     return plan_.EdgeFinished(edge, Plan::kEdgeFailed, err);
   }
 
-  // Restat the edge outputs
-  TimeStamp output_mtime = 0;
-  bool restat = edge->GetBindingBool("restat");
-  if (!config_.dry_run) {
-    bool node_cleaned = false;
-
+  // Restat the edge outputs, unless the job did already.
+  if (!job->stat_err.empty()) {
+    *err = job->stat_err;
+    return false;
+  }
+  vector<TimeStamp>& output_mtimes = job->output_mtimes;
+  if (!config_.dry_run && output_mtimes.empty()) {
     for (vector<Node*>::iterator o = edge->outputs_.begin();
          o != edge->outputs_.end(); ++o) {
       TimeStamp new_mtime = disk_interface_->Stat((*o)->path(), err);
       if (new_mtime == -1)
         return false;
+      output_mtimes.push_back(new_mtime);
+    }
+  }
+
+  TimeStamp output_mtime = 0;
+  bool restat = edge->GetBindingBool(kSymbolRestat);
+  if (!config_.dry_run) {
+    bool node_cleaned = false;
+
+    for (size_t i = 0; i < edge->outputs_.size(); ++i) {
+      Node* o = edge->outputs_[i];
+      TimeStamp new_mtime = output_mtimes[i];
       if (new_mtime > output_mtime)
         output_mtime = new_mtime;
-      if ((*o)->mtime() == new_mtime && restat) {
+      if (o->mtime() == new_mtime && restat) {
         // The rule command did not change the output.  Propagate the clean
         // state through the build graph.
         // Note that this also applies to nonexistent outputs (mtime == 0).
-        if (!plan_.CleanNode(&scan_, *o, err))
+        if (!plan_.CleanNode(&scan_, o, err))
           return false;
         node_cleaned = true;
       }
@@ -1174,112 +2927,97 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
     return false;
 
   // Delete any left over response file.
-  string rspfile = edge->GetUnescapedRspfile();
-  if (!rspfile.empty() && !g_keep_rsp)
-    disk_interface_->RemoveFile(rspfile);
+  if (!job->rspfile.empty() && !job->rspfile_removed)
+    disk_interface_->RemoveFile(job->rspfile);
 
   if (scan_.build_log()) {
     if (!scan_.build_log()->RecordCommand(edge, start_time, end_time,
-                                          output_mtime)) {
+                                          output_mtime, result->usage,
+                                          result->restored)) {
       *err = string("Error writing to build log: ") + strerror(errno);
       return false;
     }
   }
 
+  // The output too long to keep in memory is not worth caching either.
+  if (has_cache_key && !result->overflow) {
+    string cache_err;
+    if (!config_.action_cache->Store(edge, cache_key, deps_nodes,
+                                     result->output, disk_interface_,
+                                     scan_.hash_log(), &cache_err)) {
+      Warning("caching %s: %s", edge->outputs_[0]->path().c_str(),
+              cache_err.c_str());
+    }
+  }
+
+  if (has_inputs_digest) {
+    if (!scan_.hash_log()->RecordInputsDigest(edge, inputs_digest)) {
+      *err = string("Error writing to hash log: ") + strerror(errno);
+      return false;
+    }
+  }
+
   if (!deps_type.empty() && !config_.dry_run) {
     assert(!edge->outputs_.empty() && "should have been rejected by parser");
-    for (std::vector<Node*>::const_iterator o = edge->outputs_.begin();
-         o != edge->outputs_.end(); ++o) {
-      TimeStamp deps_mtime = disk_interface_->Stat((*o)->path(), err);
-      if (deps_mtime == -1)
-        return false;
-      if (!scan_.deps_log()->RecordDeps(*o, deps_mtime, deps_nodes)) {
+    for (size_t i = 0; i < edge->outputs_.size(); ++i) {
+      if (!scan_.deps_log()->RecordDeps(edge->outputs_[i], output_mtimes[i],
+                                        deps_nodes)) {
         *err = std::string("Error writing to deps log: ") + strerror(errno);
         return false;
       }
     }
   }
+  edge->ReleaseEvaluatedBindings();
   return true;
 }
 
-bool Builder::ExtractDeps(CommandRunner::Result* result,
-                          const string& deps_type,
-                          const string& deps_prefix,
-                          vector<Node*>* deps_nodes,
+bool Builder::ExtractDeps(ReadDepsJob* job, vector<Node*>* deps_nodes,
                           string* err) {
-  if (deps_type == "msvc") {
-    CLParser parser;
-    string output;
-    if (!parser.Parse(result->output, deps_prefix, &output, err))
-      return false;
-    result->output = output;
-    for (set<string>::iterator i = parser.includes_.begin();
-         i != parser.includes_.end(); ++i) {
-      // ~0 is assuming that with MSVC-parsed headers, it's ok to always make
-      // all backslashes (as some of the slashes will certainly be backslashes
-      // anyway). This could be fixed if necessary with some additional
-      // complexity in IncludesNormalize::Relativize.
-      deps_nodes->push_back(state_->GetNode(*i, ~0u));
-    }
-  } else if (deps_type == "gcc") {
-    string depfile = result->edge->GetUnescapedDepfile();
-    if (depfile.empty()) {
-      *err = string("edge with deps=gcc but no depfile makes no sense");
-      return false;
-    }
+  if (!job->ok) {
+    *err = job->err;
+    return false;
+  }
 
-    // Read depfile content.  Treat a missing depfile as empty.
-    string content;
-    switch (disk_interface_->ReadFile(depfile, &content, err)) {
-    case DiskInterface::Okay:
-      break;
-    case DiskInterface::NotFound:
-      err->clear();
-      break;
-    case DiskInterface::OtherError:
-      return false;
-    }
-    if (content.empty())
-      return true;
+  deps_nodes->reserve(job->paths.size());
+  for (size_t i = 0; i < job->paths.size(); ++i)
+    deps_nodes->push_back(state_->GetNode(job->paths[i], job->slash_bits[i]));
 
-    DepfileParser deps(config_.depfile_parser_options);
-    if (!deps.Parse(&content, err))
+  if (job->deps_type == "gcc" && !job->depfile_in_memory &&
+      !job->content.empty() && !g_keep_depfile && !job->depfile_removed) {
+    if (disk_interface_->RemoveFile(job->depfile) < 0) {
+      *err = string("deleting depfile: ") + strerror(errno) + string("\n");
       return false;
-
-    // XXX check depfile matches expected output.
-    deps_nodes->reserve(deps.ins_.size());
-    for (vector<StringPiece>::iterator i = deps.ins_.begin();
-         i != deps.ins_.end(); ++i) {
-      uint64_t slash_bits;
-      if (!CanonicalizePath(const_cast<char*>(i->str_), &i->len_, &slash_bits,
-                            err))
-        return false;
-      deps_nodes->push_back(state_->GetNode(*i, slash_bits));
-    }
-
-    if (!g_keep_depfile) {
-      if (disk_interface_->RemoveFile(depfile) < 0) {
-        *err = string("deleting depfile: ") + strerror(errno) + string("\n");
-        return false;
-      }
     }
-  } else {
-    Fatal("unknown deps type '%s'", deps_type.c_str());
   }
-
   return true;
 }
 
-bool Builder::LoadDyndeps(Node* node, string* err) {
+bool Builder::LoadReadyDyndeps(string* err) {
+  vector<Node*> nodes = plan_.TakeReadyDyndeps();
+  // The scan may have loaded some meanwhile.
+  vector<Node*>::iterator end = remove_if(nodes.begin(), nodes.end(),
+      [](Node* node) { return !node->dyndep_pending(); });
+  nodes.erase(end, nodes.end());
+  if (nodes.empty())
+    return true;
+
   status_->BuildLoadDyndeps();
 
-  // Load the dyndep information provided by this node.
-  DyndepFile ddf;
-  if (!scan_.LoadDyndeps(node, &ddf, err))
+  // Load the dyndep information provided by these nodes.
+  vector<DyndepFile> ddfs;
+  vector<string> errs;
+  if (!scan_.LoadDyndeps(nodes, &ddfs, &errs)) {
+    for (size_t i = 0; i < errs.size(); ++i) {
+      if (!errs[i].empty()) {
+        *err = errs[i];
+        break;
+      }
+    }
     return false;
+  }
 
   // Update the build plan to account for dyndep modifications to the graph.
-  if (!plan_.DyndepsLoaded(&scan_, node, ddf, err))
+  if (!plan_.DyndepsLoaded(&scan_, nodes, ddfs, err))
     return false;
 
   // New command edges may have been added to the plan.
@@ -16,25 +16,35 @@
 #define NINJA_BUILD_H_
 
 #include <cstdio>
+#include <deque>
 #include <map>
 #include <memory>
 #include <queue>
+#include <set>
 #include <string>
+#include <unordered_set>
 #include <vector>
 #include <functional>
 
+#include "action_cache.h"
 #include "depfile_parser.h"
 #include "graph.h"  // XXX needed for DependencyScan; should rearrange.
 #include "exit_status.h"
 #include "line_printer.h"
 #include "metrics.h"
+#include "output_dedup.h"
+#include "resource_usage.h"
 #include "util.h"  // int64_t
 
+struct BuildDirLock;
 struct BuildLog;
 struct BuildStatus;
 struct Builder;
 struct DiskInterface;
 struct Edge;
+struct Jobserver;
+struct MetricsPage;
+struct MetricsServer;
 struct Node;
 struct State;
 
@@ -48,6 +58,10 @@ struct Plan {
   /// fill in |err| with an error message if there's a problem.
   bool AddTarget(const Node* target, std::string* err);
 
+  /// AddTarget() during a build, for a |target| the scan just reached: the
+  /// edges already in the plan were scanned before and keep their inputs.
+  bool AddScannedTarget(const Node* target, std::string* err);
+
   // Pop a ready edge off the queue of edges to build.
   // Returns NULL if there's no work to do.
   Edge* FindWork();
@@ -55,6 +69,13 @@ struct Plan {
   /// Returns true if there's more work to be done.
   bool more_to_do() const { return wanted_edges_ > 0 && command_edges_ > 0; }
 
+  /// Whether FindWork() has an edge to hand out.
+  bool has_ready_edges() const { return !ready_.empty(); }
+
+  /// Append the first |count| edges FindWork() would hand out, at most, to
+  /// |edges|, in that order.
+  void UpcomingEdges(size_t count, std::vector<Edge*>* edges) const;
+
   /// Dumps the current state of the plan.
   void Dump() const;
 
@@ -65,10 +86,18 @@ struct Plan {
 
   /// Mark an edge as done building (whether it succeeded or failed).
   /// If any of the edge's outputs are dyndep bindings of their dependents,
-  /// this loads dynamic dependencies from the nodes' paths.
-  /// Returns 'false' if loading dyndep info fails and 'true' otherwise.
+  /// the nodes join the ready_dyndeps() for the Builder to load.
+  /// Returns 'false' on error and 'true' otherwise.
   bool EdgeFinished(Edge* edge, EdgeResult result, std::string* err);
 
+  /// The dyndep files finished since TakeReadyDyndeps() was last called.
+  bool has_ready_dyndeps() const { return !ready_dyndeps_.empty(); }
+  std::vector<Node*> TakeReadyDyndeps() {
+    std::vector<Node*> nodes;
+    nodes.swap(ready_dyndeps_);
+    return nodes;
+  }
+
   /// Clean the given node during the build.
   /// Return false on error.
   bool CleanNode(DependencyScan* scan, Node* node, std::string* err);
@@ -76,28 +105,47 @@ struct Plan {
   /// Number of edges with commands to run.
   int command_edge_count() const { return command_edges_; }
 
+  /// The milliseconds the commands left to run are expected to take in
+  /// all, counting the running ones in full.  Known after PrepareQueue().
+  int64_t remaining_duration() const { return remaining_duration_; }
+  /// The milliseconds the longest chain of edges left to finish is
+  /// expected to take: the heaviest critical path weight of the edges
+  /// scheduled, as any edge not scheduled yet waits on one of those.
+  int64_t critical_path_remaining() const;
+
+  /// Compute the critical path weight of every wanted edge so that
+  /// FindWork() hands out the edges on the longest remaining chain first.
+  /// Edge durations are taken from |build_log| when it has a record of
+  /// them (it may be NULL).  Call after all targets have been added.
+  void PrepareQueue(BuildLog* build_log);
+
   /// Reset state.  Clears want and ready sets.
   void Reset();
 
   /// Update the build plan to account for modifications made to the graph
-  /// by information loaded from a dyndep file.
-  bool DyndepsLoaded(DependencyScan* scan, const Node* node,
-                     const DyndepFile& ddf, std::string* err);
+  /// by information loaded from the dyndep files |nodes|, into |ddfs|.
+  bool DyndepsLoaded(DependencyScan* scan, const std::vector<Node*>& nodes,
+                     const std::vector<DyndepFile>& ddfs, std::string* err);
 private:
-  bool RefreshDyndepDependents(DependencyScan* scan, const Node* node, std::string* err);
+  bool RefreshDyndepDependents(DependencyScan* scan,
+                               const std::vector<Node*>& nodes,
+                               std::string* err);
+  void ComputeCriticalPath();
   void UnmarkDependents(const Node* node, std::set<Node*>* dependents);
   bool AddSubTarget(const Node* node, const Node* dependent, std::string* err,
                     std::set<Edge*>* dyndep_walk);
 
   /// Update plan with knowledge that the given node is up to date.
-  /// If the node is a dyndep binding on any of its dependents, this
-  /// loads dynamic dependencies from the node's path.
-  /// Returns 'false' if loading dyndep info fails and 'true' otherwise.
+  /// If the node is a dyndep binding on any of its dependents, it joins
+  /// ready_dyndeps_ instead.
+  /// Returns 'false' on error and 'true' otherwise.
   bool NodeFinished(Node* node, std::string* err);
 
   /// Enumerate possible steps we want for an edge.
   enum Want
   {
+    /// The edge is not in the plan: we want neither it nor its dependents.
+    kNotInPlan,
     /// We do not want to build the edge, but we might want to build one of
     /// its dependents.
     kWantNothing,
@@ -109,28 +157,72 @@ private:
   };
 
   void EdgeWanted(const Edge* edge);
-  bool EdgeMaybeReady(std::map<Edge*, Want>::iterator want_e, std::string* err);
+  /// Whether the in-edges of all the inputs of |edge| are done, like
+  /// Edge::AllInputsReady(), checking only the inputs not found ready
+  /// already.
+  bool InputsReady(const Edge* edge);
+  /// Whether all the non-order-only inputs of |edge| are clean, checking
+  /// only those not found clean already.
+  bool InputsClean(const Edge* edge);
+  int64_t ComputeEdgeCriticalPath(Edge* edge, Want want,
+                                  int64_t default_duration);
+  /// Take |edge|, which we wanted as |want|, out of the work left.
+  void RemoveRemainingWork(const Edge* edge, Want want);
+  bool EdgeMaybeReady(Edge* edge, std::string* err);
 
   /// Submits a ready edge as a candidate for execution.
   /// The edge may be delayed from running, for example if it's a member of a
   /// currently-full pool.
-  void ScheduleWork(std::map<Edge*, Want>::iterator want_e);
+  void ScheduleWork(Edge* edge);
 
-  /// Keep track of which edges we want to build in this plan.  If this map does
-  /// not contain an entry for an edge, we do not want to build the entry or its
-  /// dependents.  If it does contain an entry, the enumeration indicates what
-  /// we want for the edge.
-  std::map<Edge*, Want> want_;
+  /// Return what we want for |edge|, or NULL if it's not in the plan.
+  Want* FindWant(const Edge* edge) {
+    if (edge->id_ >= want_.size() || want_[edge->id_] == kNotInPlan)
+      return NULL;
+    return &want_[edge->id_];
+  }
 
-  EdgeSet ready_;
+  /// Keep track of which edges we want to build in this plan, indexed by
+  /// Edge::id_.  The enumeration indicates what we want for the edge;
+  /// edges past the end are not in the plan.
+  std::vector<Want> want_;
+  /// The edges added to want_, some of which may be gone from the plan
+  /// since.
+  std::vector<Edge*> want_edges_;
+
+  /// How many of the leading inputs of each edge, indexed by Edge::id_,
+  /// InputsReady() found ready, so that an edge with many inputs isn't
+  /// checked from its first input as each of them gets done.
+  std::vector<size_t> ready_inputs_;
+  /// How many of the leading non-order-only inputs of each edge, indexed
+  /// by Edge::id_, InputsClean() found clean.
+  /// During a build, inputs only get ready and clean, except when dyndep
+  /// files are loaded, which resets both, as does adding a target.
+  std::vector<size_t> clean_inputs_;
+
+  EdgePriorityQueue ready_;
+
+  /// Finished dyndep files, not loaded yet.
+  std::vector<Node*> ready_dyndeps_;
 
   Builder* builder_;
 
+  /// Build log used to estimate edge durations, or NULL.
+  BuildLog* build_log_;
+
   /// Total number of edges that have commands (not phony).
   int command_edges_;
 
   /// Total remaining number of wanted edges.
   int wanted_edges_;
+
+  /// The expected duration of each wanted edge, indexed by Edge::id_, as
+  /// of the last ComputeCriticalPath().
+  std::vector<int64_t> durations_;
+  /// The sum of durations_ over the edges we want to build still.
+  int64_t remaining_duration_;
+  /// The critical path weights of the scheduled edges not finished yet.
+  std::multiset<int64_t> scheduled_weights_;
 };
 
 /// CommandRunner is an interface that wraps running the build
@@ -139,27 +231,89 @@ private:
 struct CommandRunner {
   virtual ~CommandRunner() {}
   virtual bool CanRunMore() const = 0;
+  /// Whether |edge| may start now, once CanRunMore() said some command may.
+  /// Runners with a separate limit for some commands refuse the others
+  /// when theirs is reached.
+  virtual bool CanRunEdge(const Edge* edge) const { return true; }
   virtual bool StartCommand(Edge* edge) = 0;
 
   /// The result of waiting for a command.
   struct Result {
-    Result() : edge(NULL) {}
+    Result() : edge(NULL), status(ExitSuccess), restored(false) {}
     Edge* edge;
     ExitStatus status;
     std::string output;
+    /// The output past what |output| holds, if it was too long to keep in
+    /// memory.
+    std::shared_ptr<FILE> overflow;
+    /// What the command wrote to its "depfile_fd", if the edge has one.
+    std::string depfile_content;
+    ResourceUsage usage;
+    /// Whether the outputs came from the action cache, not the command.
+    bool restored;
     bool success() const { return status == ExitSuccess; }
   };
   /// Wait for a command to complete, or return false if interrupted.
+  /// Returns true with a NULL result->edge if Wake() was called meanwhile.
   virtual bool WaitForCommand(Result* result, std::function<void()> update_func) = 0;
+  /// Take a command that finished already, without waiting for one.
+  /// @return false if none has.
+  virtual bool TakeFinishedCommand(Result* result) { return false; }
+  /// Look for the commands that finished since the last WaitForCommand(),
+  /// for TakeFinishedCommand() to take, without waiting for any.
+  /// @return false if interrupted.
+  virtual bool PollCommands() { return true; }
+  /// Make the WaitForCommand() in progress, or the next one, return early.
+  /// Safe to call from any thread.
+  virtual void Wake() {}
 
   virtual std::vector<Edge*> GetActiveEdges() { return std::vector<Edge*>(); }
   virtual void Abort() {}
+
+  /// Append the whole lines the running commands that stream their output
+  /// (see Edge::streams_output()) wrote since the last call to |output|.
+  /// The rest comes in Result::output.
+  virtual void TakeStreamedOutput(
+      std::vector<std::pair<Edge*, std::string> >* output) {}
+
+  /// How many commands may run at once now, or 0 if the runner has no
+  /// limit of its own.
+  virtual int GetParallelism() const { return 0; }
+};
+
+/// Adjusts how many commands run at once, between two bounds, to the CPU
+/// time the machine leaves idle: up while it idles with every job taken,
+/// down once it's saturated.  Time waiting for I/O counts as idle, so that
+/// phases bound by I/O get more jobs.
+struct ParallelismTuner {
+  ParallelismTuner(int min_parallelism, int max_parallelism, int initial);
+
+  /// Take in the CPU times of the machine, sampled while |running| commands
+  /// ran.  The first sample is only compared with the next ones.
+  /// @return true if parallelism() went up.
+  bool Sample(const CpuTimes& times, int running);
+
+  int parallelism() const { return parallelism_; }
+
+ private:
+  int min_parallelism_;
+  int max_parallelism_;
+  int parallelism_;
+  bool has_sample_;
+  CpuTimes last_;
 };
 
 /// Options (e.g. verbosity, parallelism) passed to a build.
 struct BuildConfig {
   BuildConfig() : verbosity(NORMAL), dry_run(false), parallelism(1),
-                  failures_allowed(1), max_load_average(-0.0f) {}
+                  min_parallelism(0), max_parallelism(0), failures_allowed(1), max_load_average(-0.0f),
+                  min_available_memory(0),
+                  jobserver(NULL), direct_spawn(false), action_cache(NULL),
+                  remote_parallelism(0), metrics_server(NULL),
+                  lazy_depfiles(false), fail_fast(false),
+                  numa_placement(false), shared_build_dir(false),
+                  stream_scan(false), prefetch_budget(0),
+                  dedup_output(false) {}
 
   enum Verbosity {
     NORMAL,
@@ -169,11 +323,64 @@ struct BuildConfig {
   Verbosity verbosity;
   bool dry_run;
   int parallelism;
+  /// If max_parallelism is set, the local commands start from |parallelism|
+  /// at once, and a ParallelismTuner moves that between min_parallelism and
+  /// max_parallelism.
+  int min_parallelism;
+  int max_parallelism;
   int failures_allowed;
   /// The maximum load average we must not exceed. A negative value
   /// means that we do not have any limit.
   double max_load_average;
+  /// The memory, in bytes, below which we must not start new commands
+  /// (while some already run), or 0 for no limit.  Commands are also held
+  /// back while the system reports tasks stalling on memory.
+  int64_t min_available_memory;
   DepfileParserOptions depfile_parser_options;
+  /// If set, each command beyond the first needs a token from this
+  /// GNU make compatible jobserver, in addition to the limits above.
+  Jobserver* jobserver;
+  /// Spawn commands that need no shell directly, not through /bin/sh.
+  bool direct_spawn;
+  /// If set, the outputs of edges with "cache = 1" are restored from this
+  /// cache instead of running them where it can, and stored there when
+  /// they do run.
+  ActionCache* action_cache;
+  /// If not empty, the commands of edges with "remote = 1" run prefixed
+  /// with this, as "remote_exec command", which is meant to run them
+  /// elsewhere (a remote execution client).  They're limited by
+  /// |remote_parallelism| instead of |parallelism| and the load average.
+  std::string remote_exec;
+  int remote_parallelism;
+  /// If set, the progress of the build is published there as it goes.
+  MetricsServer* metrics_server;
+  /// See DependencyScan::set_lazy_depfiles().
+  bool lazy_depfiles;
+  /// On the first failed command, abort the commands still running (and
+  /// remove their outputs) and stop, instead of waiting for them.
+  /// |failures_allowed| doesn't apply then.
+  bool fail_fast;
+  /// Pin the local commands to the CPUs of one NUMA node each, taking the
+  /// nodes in turn, unless their pool sets "cpus".
+  bool numa_placement;
+  /// If not empty, a cgroup v2 directory where each local command runs in
+  /// a cgroup of its own, with the settings of its pool's "cgroup", and
+  /// has its usage measured.
+  std::string cgroup;
+  /// Let other ninja processes with this set build in the build directory
+  /// at the same time; see BuildDirLock.
+  bool shared_build_dir;
+  /// Scan the targets as the build goes, starting the commands of the
+  /// edges found dirty before the rest is scanned; see
+  /// Builder::AddTargetToScan().
+  bool stream_scan;
+  /// If not 0, the inputs of the ready edges that will start next are read
+  /// ahead into the cache of the operating system, on another thread, as
+  /// long as those of the edges not started yet take fewer bytes than this.
+  int64_t prefetch_budget;
+  /// Print the diagnostics the commands repeat only once, and the others
+  /// as references to them; see OutputDeduper.
+  bool dedup_output;
 };
 
 /// Builder wraps the build process: starting commands, updating status.
@@ -192,6 +399,16 @@ struct Builder {
   /// @return false on error.
   bool AddTarget(Node* target, std::string* err);
 
+  /// Add a target for Build() to scan as it goes: the edges below it join
+  /// the plan, and may start, as soon as they and their inputs are
+  /// scanned, while the rest of the graph still is.  Errors scanning it
+  /// fail the build.
+  void AddTargetToScan(Node* target);
+
+  /// Stat everything the given targets depend on ahead of adding them.
+  /// See DependencyScan::StatReachableNodes().
+  void StatTargets(const std::vector<Node*>& targets);
+
   /// Returns true if the build targets are already up to date.
   bool AlreadyUpToDate() const;
 
@@ -210,8 +427,26 @@ struct Builder {
     scan_.set_build_log(log);
   }
 
-  /// Load the dyndep information provided by the given node.
-  bool LoadDyndeps(Node* node, std::string* err);
+  /// Consult |log| for the edges with "hash_inputs", and record the
+  /// digests of their inputs there once they have run.
+  void SetHashLog(HashLog* log) {
+    scan_.set_hash_log(log);
+  }
+
+  /// Share the build directory with the other processes holding |lock|:
+  /// an edge one of them runs waits for it, then runs only if still dirty.
+  void SetBuildDirLock(BuildDirLock* lock) { build_dir_lock_ = lock; }
+
+  /// Report the progress of the build to |status|, which the caller keeps,
+  /// instead of printing it.
+  void SetStatus(BuildStatus* status) { status_ = status; }
+
+  /// Load the dyndep files the plan has ready, together.
+  bool LoadReadyDyndeps(std::string* err);
+
+  /// Publish the progress of the build to config_.metrics_server, if set,
+  /// at most every kMetricsPublishMillis unless |force|.
+  void PublishMetrics(bool force);
 
   State* state_;
   const BuildConfig& config_;
@@ -224,12 +459,100 @@ struct Builder {
   BuildStatus* status_;
 
  private:
-  bool ExtractDeps(CommandRunner::Result* result, const std::string& deps_type,
-                   const std::string& deps_prefix,
-                   std::vector<Node*>* deps_nodes, std::string* err);
+  struct CacheFetcher;
+  struct DepsReader;
+  struct LockPoller;
+  struct Prefetcher;
+  struct ReadDepsJob;
+
+  /// Start the command of |edge|, or restore its outputs from the action
+  /// cache; the rest of StartEdge().
+  bool RunEdge(Edge* edge, std::string* err);
+
+  /// Start |edge|, whose slot of |build_dir_lock_| this process holds,
+  /// unless another process ran it since the scan; it's then left for
+  /// Build() to finish as if restored from the action cache.
+  bool StartLockedEdge(Edge* edge, std::string* err);
+
+  /// Let the other processes sharing the build directory at |edge|, once
+  /// what it recorded is in the logs.
+  void UnlockEdge(Edge* edge);
+
+  /// Whether the deps of finished commands can be read by a DepsReader.
+  bool CanReadDepsAsync() const;
+
+  /// Hand the inputs of the edges that will start next to |prefetcher_|.
+  void PrefetchUpcoming();
+
+  /// Scan the next edge below the targets of AddTargetToScan() whose
+  /// inputs' edges were scanned already, and add it to the plan.
+  bool ScanNextEdge(std::string* err);
+
+  /// ScanNextEdge() for a slice of time, or until an edge it added is
+  /// ready for the runner to start.
+  bool ScanSlice(std::string* err);
+
+  /// Restore the outputs of |edge| from the action cache entry of |key|,
+  /// and leave the edge for Build() to finish.
+  /// @return false if the entry isn't there or no longer applies.
+  bool RestoreFromCache(Edge* edge, const ActionCache::Key& key);
+
+  /// Finish |job|'s command with the deps read for it.
+  bool FinishCommand(ReadDepsJob* job, std::string* err);
+
+  /// Turn the deps read for |job| into Nodes, and remove its depfile.
+  bool ExtractDeps(ReadDepsJob* job, std::vector<Node*>* deps_nodes,
+                   std::string* err);
 
   DiskInterface* disk_interface_;
   DependencyScan scan_;
+  /// The digests of the inputs of the running "hash_inputs" edges, taken
+  /// when they started.
+  std::map<const Edge*, uint64_t> inputs_digests_;
+  /// The action cache keys of the running cacheable edges.
+  std::map<const Edge*, ActionCache::Key> cache_keys_;
+  /// Ready edges the command runner couldn't take yet, as their kind of
+  /// command was at its limit; in the order they came out of the plan.
+  std::vector<Edge*> held_edges_;
+  /// The directories known to exist, so that StartEdge() stats each output
+  /// directory and its parents once per build at most.
+  std::unordered_set<std::string> existing_dirs_;
+  /// The edges whose outputs StartEdge() restored from the action cache,
+  /// left for Build() to finish.
+  std::deque<std::unique_ptr<ReadDepsJob> > restored_jobs_;
+  /// Reads deps on worker threads while Build() runs, if CanReadDepsAsync().
+  std::unique_ptr<DepsReader> deps_reader_;
+  /// Fetches the entries the action cache misses from its remote cache, if
+  /// it has one.
+  std::unique_ptr<CacheFetcher> cache_fetcher_;
+  /// The edges the remote cache missed too, left for Build() to start the
+  /// commands of.
+  std::deque<Edge*> fetch_missed_;
+  /// If set, other processes build in the same directory.
+  BuildDirLock* build_dir_lock_;
+  /// The edges StartEdge() found another process running, left for Build()
+  /// to start once it lets go of them.
+  std::vector<Edge*> locked_edges_;
+  /// Wakes Build() to try them again, while there are any.
+  std::unique_ptr<LockPoller> lock_poller_;
+  /// Reads ahead the inputs of the edges about to start, if
+  /// config_.prefetch_budget is set.
+  std::unique_ptr<Prefetcher> prefetcher_;
+  /// The edges, indexed by Edge::id_, and the nodes PrefetchUpcoming()
+  /// handed to it already.
+  std::vector<bool> prefetched_edges_;
+  std::unordered_set<const Node*> prefetched_nodes_;
+  /// The targets AddTargetToScan() left for Build() to scan, and the walk
+  /// through the graph below the first of them: the nodes whose inputs it
+  /// visits, each with the index of the next one.
+  std::deque<Node*> scan_targets_;
+  std::vector<std::pair<Node*, size_t> > scan_stack_;
+  /// Whether the walk went to each edge, indexed by Edge::id_.
+  std::vector<bool> scan_visited_;
+  /// When PublishMetrics() last published.
+  int64_t metrics_published_millis_;
+  /// The status printing the progress, unless SetStatus() replaced it.
+  std::unique_ptr<BuildStatus> own_status_;
 
   // Unimplemented copy ctor and operator= ensure we don't copy the auto_ptr.
   Builder(const Builder &other);        // DO NOT IMPLEMENT
@@ -237,15 +560,33 @@ struct Builder {
 };
 
 /// Tracks the status of a build: completion fraction, printing updates.
+/// Programs embedding ninja may override the notifications the Builder
+/// sends, to report the progress their own way.
 struct BuildStatus {
   explicit BuildStatus(const BuildConfig& config);
-  void PlanHasTotalEdges(int total);
-  void BuildEdgeStarted(const Edge* edge);
-  void BuildEdgeFinished(Edge* edge, bool success, const std::string& output,
-                         int* start_time, int* end_time);
-  void BuildLoadDyndeps();
-  void BuildStarted();
-  void BuildFinished();
+  virtual ~BuildStatus() {}
+  virtual void PlanHasTotalEdges(int total);
+  /// The commands left are expected to take |total_millis| in all, and
+  /// the longest chain of them |critical_path_millis|.
+  virtual void PlanHasRemainingWork(int64_t total_millis,
+                                    int64_t critical_path_millis);
+  virtual void BuildEdgeStarted(const Edge* edge);
+  /// The command of |edge| exited; BuildEdgeFinished() follows once its
+  /// deps are read.
+  virtual void BuildCommandReaped(const Edge* edge, bool success);
+  /// The command of |edge|, still running, wrote the whole |lines|.
+  virtual void BuildEdgeOutput(const Edge* edge, const std::string& lines);
+  /// |output| continues in |overflow| if that's not NULL.
+  virtual void BuildEdgeFinished(Edge* edge, bool success,
+                                 const std::string& output, FILE* overflow,
+                                 int* start_time, int* end_time);
+  virtual void BuildLoadDyndeps();
+  virtual void BuildStarted();
+  virtual void BuildFinished();
+  /// The command runner now runs up to |parallelism| commands at once.
+  void SetParallelism(int parallelism) { parallelism_ = parallelism; }
+  /// Add the edge counts, rates and output volume so far to |page|.
+  void WriteMetrics(MetricsPage* page) const;
 
   enum EdgeStatus {
     kEdgeStarted,
@@ -260,13 +601,39 @@ struct BuildStatus {
   std::string FormatProgressStatus(const char* progress_status_format,
                                    EdgeStatus status) const;
 
-  void PrintStatusScrolling();
+  virtual void PrintStatusScrolling();
+  /// Draw the scrolling status as it is at |now_millis|, unless it is the
+  /// frame on screen already, or one was drawn less than a frame's time
+  /// before; the next call draws it then.
+  void DrawScrollingStatus(int64_t now_millis);
+  /// Write |frame|, a frame of the scrolling status or the sequence
+  /// clearing it, to the terminal.
+  virtual void WriteFrame(const std::string& frame);
   void ClearScrollingOutput();
   void ClearScrollingOutput(int lines);
+  /// Print the output of a command, or a piece of it after the first.
+  void PrintOutput(const std::string& output, bool first);
+  /// Print how often each block of output left out was repeated, if any
+  /// was.
+  void PrintRepeats();
  private:
   void PrintStatus(const Edge* edge, EdgeStatus status);
+  /// Prefix the lines in |output| of |edge|, if it streams its output, so
+  /// that they can be told from those of the other commands.
+  std::string PrefixOutput(const Edge* edge, const std::string& output) const;
+  /// What to print of |output| of |edge|: prefixed, with the blocks
+  /// printed before left out if config_.dedup_output is set.
+  std::string ShownOutput(const Edge* edge, const std::string& output);
+  /// Record an edge in the -d trace profile.
+  void TraceEdgeStarted(const Edge* edge);
+  void TraceEdgeFinished(const Edge* edge, bool success);
   int prev_running_edge_count_;
 
+  /// The scrolling status on screen, empty if it was cleared, and when it
+  /// was drawn.
+  std::string last_frame_;
+  int64_t last_frame_millis_;
+
   const BuildConfig& config_;
 
   /// Time the build started.
@@ -274,10 +641,32 @@ struct BuildStatus {
 
   int started_edges_, finished_edges_, total_edges_;
 
+  /// The work left, from PlanHasRemainingWork(), for %E and %C; -1 before
+  /// the plan said.
+  int64_t remaining_millis_, critical_path_millis_;
+
+  /// The number of commands run at once, for %j.
+  int parallelism_;
+
+  /// The bytes of output the commands wrote.
+  int64_t output_bytes_;
+
+  /// Leaves out the repeated output, if config_.dedup_output is set.
+  OutputDeduper deduper_;
+
   /// Map of running edge to time the edge started running.
   typedef std::map<const Edge*, int> RunningEdgeMap;
   RunningEdgeMap running_edges_;
 
+  /// The job slot each running edge is shown in by -d trace, and when it
+  /// started.  Slots are reused lowest first, like the jobs they stand for.
+  struct TracedEdge {
+    int slot;
+    int64_t start;
+  };
+  std::map<const Edge*, TracedEdge> traced_edges_;
+  std::vector<bool> busy_trace_slots_;
+
   /// Prints progress output.
   LinePrinter printer_;
 
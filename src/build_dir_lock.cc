@@ -0,0 +1,200 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "build_dir_lock.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "build_log.h"
+#include "graph.h"
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// The byte all the processes share, then the first of the slots; the
+/// bytes between are those of the logs.
+const uint64_t kDirectoryByte = 0;
+const uint64_t kFirstSlotByte = 16;
+/// Edges of different outputs only wait for each other if they share a
+/// slot, which is rare with this many.  Locks past the end of a file are
+/// fine, so the file stays empty.
+const uint64_t kSlotCount = 1 << 20;
+
+}  // anonymous namespace
+
+#ifdef _WIN32
+BuildDirLock::BuildDirLock()
+    : handle_(INVALID_HANDLE_VALUE), exclusive_(false) {}
+
+BuildDirLock::~BuildDirLock() {
+  if (handle_ != INVALID_HANDLE_VALUE)
+    CloseHandle(handle_);
+}
+
+bool BuildDirLock::is_open() const {
+  return handle_ != INVALID_HANDLE_VALUE;
+}
+
+bool BuildDirLock::Open(const string& path, string* err) {
+  handle_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle_ == INVALID_HANDLE_VALUE) {
+    *err = "opening " + path + ": " + GetLastErrorString();
+    return false;
+  }
+  exclusive_ = LockByte(kDirectoryByte, true, false);
+  if (!exclusive_ && !LockByte(kDirectoryByte, false, true)) {
+    *err = "locking " + path + ": " + GetLastErrorString();
+    return false;
+  }
+  return true;
+}
+
+void BuildDirLock::Share() {
+  if (!exclusive_)
+    return;
+  // A shared lock may overlap an exclusive one of the same handle; the
+  // first unlock then takes the exclusive one away.
+  LockByte(kDirectoryByte, false, false);
+  UnlockByte(kDirectoryByte);
+  exclusive_ = false;
+}
+
+bool BuildDirLock::LockByte(uint64_t offset, bool exclusive, bool wait) {
+  OVERLAPPED overlapped;
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.Offset = (DWORD)offset;
+  overlapped.OffsetHigh = (DWORD)(offset >> 32);
+  DWORD flags = (exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0) |
+                (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+  if (!LockFileEx(handle_, flags, 0, 1, 0, &overlapped)) {
+    errno = GetLastError() == ERROR_LOCK_VIOLATION ? EAGAIN : EIO;
+    return false;
+  }
+  return true;
+}
+
+void BuildDirLock::UnlockByte(uint64_t offset) {
+  OVERLAPPED overlapped;
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.Offset = (DWORD)offset;
+  overlapped.OffsetHigh = (DWORD)(offset >> 32);
+  UnlockFileEx(handle_, 0, 1, 0, &overlapped);
+}
+#else
+BuildDirLock::BuildDirLock() : fd_(-1), exclusive_(false) {}
+
+BuildDirLock::~BuildDirLock() {
+  // Closing the file lets go of all the locks of the process on it.
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool BuildDirLock::is_open() const {
+  return fd_ >= 0;
+}
+
+bool BuildDirLock::Open(const string& path, string* err) {
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd_ < 0) {
+    *err = "opening " + path + ": " + strerror(errno);
+    return false;
+  }
+  SetCloseOnExec(fd_);
+  exclusive_ = LockByte(kDirectoryByte, true, false);
+  if (!exclusive_ && !LockByte(kDirectoryByte, false, true)) {
+    *err = "locking " + path + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+void BuildDirLock::Share() {
+  if (!exclusive_)
+    return;
+  // Turning a lock of the process into a shared one never waits.
+  LockByte(kDirectoryByte, false, false);
+  exclusive_ = false;
+}
+
+bool BuildDirLock::LockByte(uint64_t offset, bool exclusive, bool wait) {
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = exclusive ? F_WRLCK : F_RDLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = (off_t)offset;
+  lock.l_len = 1;
+  int ret;
+  do {
+    ret = fcntl(fd_, wait ? F_SETLKW : F_SETLK, &lock);
+  } while (ret < 0 && errno == EINTR);
+  return ret == 0;
+}
+
+void BuildDirLock::UnlockByte(uint64_t offset) {
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = F_UNLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = (off_t)offset;
+  lock.l_len = 1;
+  fcntl(fd_, F_SETLK, &lock);
+}
+#endif
+
+bool BuildDirLock::Lock(Log log) {
+  return LockByte(log, true, true);
+}
+
+void BuildDirLock::Unlock(Log log) {
+  UnlockByte(log);
+}
+
+bool BuildDirLock::TryLockEdge(const Edge* edge) {
+  uint64_t slot = Slot(edge);
+  map<uint64_t, int>::iterator held = held_.find(slot);
+  if (held != held_.end()) {
+    ++held->second;
+    return true;
+  }
+  if (!LockByte(kFirstSlotByte + slot, true, false))
+    return false;
+  held_[slot] = 1;
+  return true;
+}
+
+void BuildDirLock::UnlockEdge(const Edge* edge) {
+  map<uint64_t, int>::iterator held = held_.find(Slot(edge));
+  if (held == held_.end() || --held->second > 0)
+    return;
+  UnlockByte(kFirstSlotByte + held->first);
+  held_.erase(held);
+}
+
+uint64_t BuildDirLock::Slot(const Edge* edge) {
+  // The command hash of the build log is the same in every process.
+  return BuildLog::LogEntry::HashCommand(edge->outputs_[0]->path()) %
+         kSlotCount;
+}
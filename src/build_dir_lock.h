@@ -0,0 +1,90 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_BUILD_DIR_LOCK_H_
+#define NINJA_BUILD_DIR_LOCK_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+struct Edge;
+
+/// Lets several ninja processes build in one directory at once, through
+/// advisory locks on bytes of a lock file there (.ninja_lock):
+/// - all of them share the first byte while they run.  One that finds no
+///   other there holds it alone until its logs are open, so that it may
+///   rewrite them meanwhile; the others never rewrite them.
+/// - the next bytes make the appends to each log take turns.
+/// - the rest are a table of slots the edges hash to by their first
+///   output; a process runs an edge only with its slot locked, so that the
+///   others wait for it and then find the outputs up to date.
+/// The locks are those of the operating system (fcntl() record locks,
+/// LockFileEx()), which go away with the process that held them.
+struct BuildDirLock {
+  BuildDirLock();
+  ~BuildDirLock();
+
+  /// The logs whose appends take turns.
+  enum Log { kBuildLog = 1, kDepsLog = 2, kHashLog = 3 };
+
+  /// Open the lock file at |path| and join the processes building in the
+  /// directory, waiting while one of them rewrites the logs.
+  bool Open(const std::string& path, std::string* err);
+
+  bool is_open() const;
+
+  /// Whether no other process was building in the directory when Open()
+  /// ran, which keeps them out until Share().  The logs may only be
+  /// rewritten then.
+  bool exclusive() const { return exclusive_; }
+
+  /// Let the other processes in, once the logs are open.
+  void Share();
+
+  /// Wait for the other processes to be done appending to |log|, and keep
+  /// them from appending to it until Unlock().  Only one thread of the
+  /// process may hold a log at a time.
+  /// @return false, with errno set, on error.
+  bool Lock(Log log);
+  void Unlock(Log log);
+
+  /// Lock the slot of |edge|, unless another process holds it.
+  bool TryLockEdge(const Edge* edge);
+  /// Let go of the slot of |edge|, locked by TryLockEdge().
+  void UnlockEdge(const Edge* edge);
+
+ private:
+  /// The slot of the table |edge| hashes to.
+  static uint64_t Slot(const Edge* edge);
+
+  /// Lock the byte at |offset|, shared by all the processes or held by
+  /// this one alone if |exclusive|, waiting for the others if |wait|.
+  /// @return false, with errno set, on error.
+  bool LockByte(uint64_t offset, bool exclusive, bool wait);
+  void UnlockByte(uint64_t offset);
+
+#ifdef _WIN32
+  void* handle_;
+#else
+  int fd_;
+#endif
+  bool exclusive_;
+  /// The slots this process holds, with the number of its edges in each:
+  /// the operating system counts a lock once per process.
+  std::map<uint64_t, int> held_;
+};
+
+#endif  // NINJA_BUILD_DIR_LOCK_H_
@@ -23,11 +23,18 @@
 #include "build_log.h"
 #include "disk_interface.h"
 
+#include <algorithm>
 #include <cassert>
 #include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <set>
+#include <thread>
+
 #ifndef _WIN32
 #include <inttypes.h>
 #include <unistd.h>
@@ -35,7 +42,11 @@
 
 #include "build.h"
 #include "graph.h"
+#include "memory_stats.h"
 #include "metrics.h"
+#include "parallel.h"
+#include "state.h"
+#include "trace.h"
 #include "util.h"
 #if defined(_MSC_VER) && (_MSC_VER < 1800)
 #define strtoll _strtoi64
@@ -45,16 +56,90 @@ using namespace std;
 
 // Implementation details:
 // Each run's log appends to the log file.
-// To load, we run through all log entries in series, throwing away
-// older runs.
 // Once the number of redundant entries exceeds a threshold, we write
 // out a new file and replace the existing one with it.
+//
+// Since v6 the log is binary.  A rewritten log starts with a hash index of
+// the records following it, so that loading only maps the file and entries
+// are read when first looked up.  Records appended since the last rewrite
+// follow the indexed ones; to load, we run through those in series,
+// throwing away older runs.  Text logs (v4 and v5) are still read, and
+// rewritten in the current format.
+//
+// v7 changed the command hash from MurmurHash2 to a faster wyhash-style
+// function, keeping the v6 layout.  The hashes of older logs can't be
+// converted by themselves, so when such a log is rewritten the command of
+// each output is asked from the BuildLogUser; if it still matches the
+// legacy hash, the entry gets the new hash of the same command.
+//
+// v8 added the CPU times and peak memory of the command to each record.
+// Records are appended in the version of the log they go to, so older
+// logs stay readable until they are rewritten.
+//
+// v9 added the smoothed duration of the command over its runs and its
+// variance.  The history of an older record starts from its last run.
 
 namespace {
 
 const char kFileSignature[] = "# ninja log v%d\n";
 const int kOldestSupportedVersion = 4;
-const int kCurrentVersion = 5;
+const int kFirstIndexedVersion = 6;
+const int kLastLegacyHashVersion = 6;
+const int kFirstUsageVersion = 8;
+const int kFirstDurationHistoryVersion = 9;
+const int kCurrentVersion = 9;
+
+/// The weight of the latest run in the smoothed duration of a command.
+const double kDurationSmoothing = 0.25;
+
+/// The header of an indexed (v6+) log.
+struct IndexedLogHeader {
+  /// kFileSignature, padded with NULs.
+  char signature[16];
+  /// The number of IndexSlots following the header; a power of two, or 0.
+  uint32_t index_size;
+  /// The number of records covered by the index.
+  uint32_t index_count;
+  /// The end of the indexed records.  Records past it were appended since
+  /// the log was last rewritten.
+  uint64_t records_end;
+};
+
+/// A slot of the on-disk open addressing hash table.
+struct IndexSlot {
+  uint64_t path_hash;
+  /// The offset of the record in the file, or 0 for an empty slot.
+  uint64_t offset;
+};
+
+/// The fixed-size part of a record, followed by the output path padded to
+/// a multiple of 8 bytes.
+struct RecordHeader {
+  uint32_t path_size;
+  /// ~path_size, to detect incompletely written records.
+  uint32_t path_check;
+  int32_t start_time;
+  int32_t end_time;
+  int64_t mtime;
+  uint64_t command_hash;
+  // Since v8.
+  int32_t user_time;
+  int32_t system_time;
+  int64_t peak_rss;
+  // Since v9.
+  int32_t avg_duration;
+  uint32_t duration_runs;
+  int64_t duration_variance;
+};
+
+/// The size of a RecordHeader in a log of |version|.
+size_t RecordHeaderSize(int version) {
+  if (version >= kFirstDurationHistoryVersion)
+    return sizeof(RecordHeader);
+  if (version >= kFirstUsageVersion)
+    return offsetof(RecordHeader, avg_duration);
+  return offsetof(RecordHeader, user_time);
+}
 
 // 64bit MurmurHash2, by Austin Appleby
 #if defined(_MSC_VER)
@@ -104,25 +189,217 @@ uint64_t MurmurHash64A(const void* key, size_t len) {
 }
 #undef BIG_CONSTANT
 
+uint64_t HashPath(StringPiece path) {
+  return MurmurHash64A(path.str_, path.len_);
+}
+
+uint64_t PaddedPathSize(uint64_t path_size) {
+  return (path_size + 7) & ~(uint64_t)7;
+}
+
+bool WriteIndexedLogHeader(FILE* f, int version, uint32_t index_size,
+                           uint32_t index_count, uint64_t records_end) {
+  IndexedLogHeader header;
+  memset(&header, 0, sizeof(header));
+  snprintf(header.signature, sizeof(header.signature), kFileSignature,
+           version);
+  header.index_size = index_size;
+  header.index_count = index_count;
+  header.records_end = records_end;
+  return fwrite(&header, sizeof(header), 1, f) == 1;
+}
+
+/// Read the record at |offset| of a log of |version| mapped at |data|,
+/// which must end before |end|.  Returns the offset of the following
+/// record, or 0 if the record is incomplete.
+uint64_t ReadRecord(const char* data, int version, uint64_t offset,
+                    uint64_t end, RecordHeader* record, StringPiece* path) {
+  size_t header_size = RecordHeaderSize(version);
+  if (offset > end || end - offset < header_size)
+    return 0;
+  memset(record, 0, sizeof(*record));
+  memcpy(record, data + offset, header_size);
+  if (record->path_size == 0 || record->path_check != ~record->path_size)
+    return 0;
+  uint64_t path_offset = offset + header_size;
+  if (end - path_offset < PaddedPathSize(record->path_size))
+    return 0;
+  *path = StringPiece(data + path_offset, record->path_size);
+  return path_offset + PaddedPathSize(record->path_size);
+}
+
+/// Find the indexed record of |path| in a log mapped at |data|.
+bool FindRecord(const char* data, int version, uint32_t index_size,
+                uint64_t records_begin, uint64_t records_end, StringPiece path,
+                RecordHeader* record) {
+  if (index_size == 0)
+    return false;
+  uint64_t hash = HashPath(path);
+  const char* index = data + sizeof(IndexedLogHeader);
+  uint32_t mask = index_size - 1;
+  for (uint32_t i = hash & mask, probes = 0; probes < index_size;
+       i = (i + 1) & mask, ++probes) {
+    IndexSlot slot;
+    memcpy(&slot, index + i * sizeof(IndexSlot), sizeof(slot));
+    if (slot.offset == 0)
+      return false;
+    if (slot.path_hash != hash || slot.offset < records_begin)
+      continue;
+    StringPiece record_path;
+    if (ReadRecord(data, version, slot.offset, records_end, record,
+                   &record_path) &&
+        record_path == path)
+      return true;
+  }
+  return false;
+}
+
+void ApplyRecord(int version, const RecordHeader& record,
+                 BuildLog::LogEntry* entry) {
+  entry->command_hash = record.command_hash;
+  entry->start_time = record.start_time;
+  entry->end_time = record.end_time;
+  entry->mtime = record.mtime;
+  entry->usage.user_time = record.user_time;
+  entry->usage.system_time = record.system_time;
+  entry->usage.peak_rss = record.peak_rss;
+  if (version >= kFirstDurationHistoryVersion) {
+    entry->avg_duration = record.avg_duration;
+    entry->duration_runs = record.duration_runs;
+    entry->duration_variance = record.duration_variance;
+  } else {
+    entry->duration_runs = 0;
+    entry->AddDuration(record.end_time - record.start_time);
+  }
+}
+
+/// Append the record of |entry| in a log of |version| to |out|.
+void FormatRecord(int version, const BuildLog::LogEntry& entry,
+                  string* out) {
+  static const char kPadding[8] = {};
+  RecordHeader record;
+  record.path_size = entry.output.size();
+  record.path_check = ~record.path_size;
+  record.start_time = entry.start_time;
+  record.end_time = entry.end_time;
+  record.mtime = entry.mtime;
+  record.command_hash = entry.command_hash;
+  record.user_time = entry.usage.user_time;
+  record.system_time = entry.usage.system_time;
+  record.peak_rss = entry.usage.peak_rss;
+  record.avg_duration = entry.avg_duration;
+  record.duration_runs = entry.duration_runs;
+  record.duration_variance = entry.duration_variance;
+  size_t padding = PaddedPathSize(entry.output.size()) - entry.output.size();
+  out->append(reinterpret_cast<const char*>(&record),
+              RecordHeaderSize(version));
+  out->append(entry.output);
+  out->append(kPadding, padding);
+}
+
+/// Write |entry| to a log of |version|.
+bool WriteRecord(FILE* f, int version, const BuildLog::LogEntry& entry) {
+  string record;
+  FormatRecord(version, entry, &record);
+  return fwrite(record.data(), record.size(), 1, f) == 1;
+}
+
 
 }  // namespace
 
+void BuildLogUser::FindDeadPaths(const vector<StringPiece>& paths,
+                                 vector<bool>* dead) const {
+  dead->assign(paths.size(), false);
+  for (size_t i = 0; i < paths.size(); ++i)
+    (*dead)[i] = IsPathDead(paths[i]);
+}
+
+void FindDeadOutputs(const State& state, const DiskInterface& disk_interface,
+                     const vector<StringPiece>& paths, vector<bool>* dead) {
+  dead->assign(paths.size(), false);
+  // Just checking for a node isn't enough: if an old output is both in the
+  // build log and in the deps log, it has a Node in |state|.  (It also has
+  // an in edge if one of its inputs is another output in the deps log, but
+  // having a deps edge produce an input of another deps edge is rare, and
+  // the first recompaction deletes the old outputs from the deps log, so a
+  // second one clears the build log, which seems good enough.)
+  vector<size_t> to_stat;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    Node* node = state.LookupNode(paths[i]);
+    if (!node || !node->in_edge())
+      to_stat.push_back(i);
+  }
+
+  const int kStatThreads = 16;
+  int thread_count = disk_interface.IsStatThreadSafe() ? kStatThreads : 1;
+  vector<TimeStamp> mtimes(to_stat.size());
+  vector<string> errs(to_stat.size());
+  ParallelFor(to_stat.size(), thread_count, [&](size_t i) {
+    mtimes[i] = disk_interface.Stat(paths[to_stat[i]].AsString(), &errs[i]);
+  });
+  for (size_t i = 0; i < to_stat.size(); ++i) {
+    if (mtimes[i] == -1)
+      Error("%s", errs[i].c_str());  // Log and ignore Stat() errors.
+    (*dead)[to_stat[i]] = mtimes[i] == 0;
+  }
+}
+
 // static
 uint64_t BuildLog::LogEntry::HashCommand(StringPiece command) {
+  return Hash64(command.str_, command.len_);
+}
+
+// static
+uint64_t BuildLog::LogEntry::LegacyHashCommand(StringPiece command) {
   return MurmurHash64A(command.str_, command.len_);
 }
 
 BuildLog::LogEntry::LogEntry(const string& output)
-  : output(output) {}
+  : output(output), avg_duration(0), duration_variance(0), duration_runs(0) {}
 
 BuildLog::LogEntry::LogEntry(const string& output, uint64_t command_hash,
   int start_time, int end_time, TimeStamp restat_mtime)
   : output(output), command_hash(command_hash),
-    start_time(start_time), end_time(end_time), mtime(restat_mtime)
+    start_time(start_time), end_time(end_time), mtime(restat_mtime),
+    avg_duration(0), duration_variance(0), duration_runs(0)
 {}
 
+void BuildLog::LogEntry::AddDuration(int duration) {
+  if (duration < 0)
+    return;
+  if (duration_runs == 0) {
+    avg_duration = duration;
+    duration_variance = 0;
+  } else {
+    // An exponentially weighted moving average, and the variance to go
+    // with it.
+    double delta = duration - avg_duration;
+    avg_duration += (int)llround(kDurationSmoothing * delta);
+    duration_variance = llround(
+        (1 - kDurationSmoothing) *
+        (duration_variance + kDurationSmoothing * delta * delta));
+  }
+  if (duration_runs < INT_MAX)
+    ++duration_runs;
+}
+
+/// A copy of the log being written by another thread.
+struct BuildLog::Recompaction {
+  string path;
+  string temp_path;
+  /// The live entries when the recompaction started.
+  vector<LogEntry> entries;
+  /// Entries recorded since the recompaction started.
+  vector<LogEntry*> recorded;
+  bool ok;
+  string err;
+  std::thread thread;
+};
+
 BuildLog::BuildLog()
-  : log_file_(NULL), needs_recompaction_(false) {}
+  : log_version_(kCurrentVersion), index_size_(0), records_begin_(0), records_end_(0),
+    lock_(NULL), loaded_end_(0), needs_recompaction_(false),
+    legacy_hashes_(false), recompaction_(NULL) {}
 
 BuildLog::~BuildLog() {
   Close();
@@ -130,21 +407,38 @@ BuildLog::~BuildLog() {
 
 bool BuildLog::OpenForWrite(const string& path, const BuildLogUser& user,
                             string* err) {
-  if (needs_recompaction_) {
-    if (!Recompact(path, user, err))
+  // Other processes append to a shared log meanwhile, unless this one has
+  // the build directory to itself for now.
+  bool shared = lock_ && !lock_->exclusive();
+  if (needs_recompaction_ && shared &&
+      log_version_ < kFirstIndexedVersion) {
+    *err = "the build log of an earlier version can't be rewritten while "
+           "other ninja processes use it";
+    return false;
+  }
+  if (needs_recompaction_ && !shared) {
+    // Binary records can't be appended to a text log meanwhile, and the
+    // processes let in later read on from where a shared log ends once
+    // rewritten.
+    if (log_version_ < kFirstIndexedVersion || lock_) {
+      if (!Recompact(path, user, err))
+        return false;
+      loaded_end_ = 0;
+    } else if (!StartRecompaction(path, user, err)) {
       return false;
+    }
   }
 
-  assert(!log_file_);
+  assert(!writer_.started());
   log_file_path_ = path;  // we don't actually open the file right now, but will
                           // do so on the first write attempt
   return true;
 }
 
 bool BuildLog::RecordCommand(Edge* edge, int start_time, int end_time,
-                             TimeStamp mtime) {
-  string command = edge->EvaluateCommand(true);
-  uint64_t command_hash = LogEntry::HashCommand(command);
+                             TimeStamp mtime, const ResourceUsage& usage,
+                             bool restored) {
+  uint64_t command_hash = edge->GetCommandHash();
   for (vector<Node*>::iterator out = edge->outputs_.begin();
        out != edge->outputs_.end(); ++out) {
     const string& path = (*out)->path();
@@ -160,50 +454,79 @@ bool BuildLog::RecordCommand(Edge* edge, int start_time, int end_time,
     log_entry->start_time = start_time;
     log_entry->end_time = end_time;
     log_entry->mtime = mtime;
+    log_entry->usage = usage;
+    if (!restored)
+      log_entry->AddDuration(end_time - start_time);
 
     if (!OpenForWriteIfNeeded()) {
       return false;
     }
-    if (log_file_) {
-      if (!WriteEntry(log_file_, *log_entry))
+    if (writer_.started()) {
+      string record;
+      FormatRecord(log_version_, *log_entry, &record);
+      if (!writer_.Append(record))
         return false;
-      if (fflush(log_file_) != 0) {
-          return false;
-      }
     }
+    if (recompaction_)
+      recompaction_->recorded.push_back(log_entry);
   }
   return true;
 }
 
+bool BuildLog::Flush() {
+  return writer_.Flush();
+}
+
 void BuildLog::Close() {
   OpenForWriteIfNeeded();  // create the file even if nothing has been recorded
-  if (log_file_)
-    fclose(log_file_);
-  log_file_ = NULL;
+  if (!writer_.Close())
+    Warning("writing build log: %s", strerror(errno));
+
+  if (recompaction_) {
+    string err;
+    if (!FinishRecompaction(&err))
+      Warning("recompacting build log: %s", err.c_str());
+  }
 }
 
 bool BuildLog::OpenForWriteIfNeeded() {
-  if (log_file_ || log_file_path_.empty()) {
+  if (writer_.started() || log_file_path_.empty()) {
     return true;
   }
-  log_file_ = fopen(log_file_path_.c_str(), "ab");
-  if (!log_file_) {
+  FILE* f = fopen(log_file_path_.c_str(), "ab");
+  if (!f) {
     return false;
   }
-  if (setvbuf(log_file_, NULL, _IOLBF, BUFSIZ) != 0) {
+  SetCloseOnExec(fileno(f));
+
+  // Only one of the processes sharing the log writes its header.
+  if (lock_ && !lock_->Lock(BuildDirLock::kBuildLog)) {
+    int error = errno;
+    fclose(f);
+    errno = error;
     return false;
   }
-  SetCloseOnExec(fileno(log_file_));
 
   // Opening a file in append mode doesn't set the file pointer to the file's
   // end on Windows. Do that explicitly.
-  fseek(log_file_, 0, SEEK_END);
-
-  if (ftell(log_file_) == 0) {
-    if (fprintf(log_file_, kFileSignature, kCurrentVersion) < 0) {
+  fseek(f, 0, SEEK_END);
+
+  if (ftell(f) == 0) {
+    log_version_ = kCurrentVersion;
+    if (!WriteIndexedLogHeader(f, kCurrentVersion, 0, 0,
+                               sizeof(IndexedLogHeader)) ||
+        fflush(f) != 0) {
+      int error = errno;
+      if (lock_)
+        lock_->Unlock(BuildDirLock::kBuildLog);
+      fclose(f);
+      errno = error;
       return false;
     }
   }
+  if (lock_)
+    lock_->Unlock(BuildDirLock::kBuildLog);
+  writer_.Start(f, lock_, BuildDirLock::kBuildLog);
   return true;
 }
 
@@ -260,6 +583,114 @@ struct LineReader {
 
 LoadStatus BuildLog::Load(const string& path, string* err) {
   METRIC_RECORD(".ninja_log load");
+  TRACE_RECORD(".ninja_log load");
+  index_size_ = 0;
+  loaded_end_ = 0;
+  int ret = log_map_.Open(path, err);
+  if (ret == -ENOENT) {
+    err->clear();
+    return LOAD_NOT_FOUND;
+  }
+  if (ret < 0)
+    return LOAD_ERROR;
+
+  // Both text and indexed logs start with the signature line.
+  int log_version = 0;
+  char signature[sizeof(IndexedLogHeader().signature) + 1] = {};
+  memcpy(signature, log_map_.data(),
+         min(log_map_.size(), sizeof(signature) - 1));
+  sscanf(signature, kFileSignature, &log_version);
+  if (log_version >= kFirstIndexedVersion) {
+    log_version_ = log_version;
+    return LoadIndexed(path, err);
+  }
+
+  log_map_.Close();
+  return LoadText(path, err);
+}
+
+LoadStatus BuildLog::LoadIndexed(const string& path, string* err) {
+  const char* data = log_map_.data();
+  const uint64_t size = log_map_.size();
+  IndexedLogHeader header;
+  bool valid_header = log_version_ <= kCurrentVersion &&
+                      size >= sizeof(header);
+  if (valid_header) {
+    memcpy(&header, data, sizeof(header));
+    records_begin_ =
+        sizeof(header) + (uint64_t)header.index_size * sizeof(IndexSlot);
+    records_end_ = header.records_end;
+    valid_header = (header.index_size & (header.index_size - 1)) == 0 &&
+                   records_begin_ <= records_end_ && records_end_ <= size;
+  }
+  if (!valid_header) {
+    *err = "build log is corrupt or from a newer version; starting over";
+    log_map_.Close();
+    log_version_ = kCurrentVersion;
+    unlink(path.c_str());
+    // Don't report this as a failure.  An empty build log will cause
+    // us to rebuild the outputs anyway.
+    return LOAD_SUCCESS;
+  }
+  index_size_ = header.index_size;
+  if (log_version_ <= kLastLegacyHashVersion)
+    legacy_hashes_ = true;
+  if (log_version_ < kCurrentVersion)
+    needs_recompaction_ = true;
+
+  // Entries already in memory are superseded by the ones on disk.
+  RecordHeader record;
+  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i) {
+    if (FindRecord(data, log_version_, index_size_, records_begin_,
+                   records_end_, i->first, &record))
+      ApplyRecord(log_version_, record, i->second);
+  }
+
+  // Read the records appended since the index was written.
+  int unique_entry_count = 0;
+  int total_entry_count = 0;
+  uint64_t offset = records_end_;
+  while (offset < size) {
+    StringPiece output;
+    uint64_t next =
+        ReadRecord(data, log_version_, offset, size, &record, &output);
+    if (!next) {
+      // An interrupted write left an incomplete record behind.  Appending
+      // after it would make the following records unreadable, so rewrite
+      // the log before writing to it again.
+      needs_recompaction_ = true;
+      break;
+    }
+    offset = next;
+
+    LogEntry* entry;
+    Entries::iterator i = entries_.find(output);
+    if (i != entries_.end()) {
+      entry = i->second;
+    } else {
+      entry = new LogEntry(output.AsString());
+      entries_.insert(Entries::value_type(entry->output, entry));
+      ++unique_entry_count;
+    }
+    ++total_entry_count;
+    ApplyRecord(log_version_, record, entry);
+  }
+  loaded_end_ = offset;
+
+  // Rewrite the log once the records outside the index make up a sizable
+  // part of it, or are mostly redundant.
+  int kMinCompactionEntryCount = 100;
+  int kCompactionRatio = 3;
+  if (total_entry_count > kMinCompactionEntryCount &&
+      ((uint64_t)total_entry_count * kCompactionRatio > header.index_count ||
+       total_entry_count > unique_entry_count * kCompactionRatio)) {
+    needs_recompaction_ = true;
+  }
+
+  return LOAD_SUCCESS;
+}
+
+LoadStatus BuildLog::LoadText(const string& path, string* err) {
   FILE* file = fopen(path.c_str(), "r");
   if (!file) {
     if (errno == ENOENT)
@@ -344,10 +775,13 @@ LoadStatus BuildLog::Load(const string& path, string* err) {
     entry->start_time = start_time;
     entry->end_time = end_time;
     entry->mtime = restat_mtime;
+    entry->duration_runs = 0;
+    entry->AddDuration(end_time - start_time);
     if (log_version >= 5) {
       char c = *end; *end = '\0';
       entry->command_hash = (uint64_t)strtoull(start, NULL, 16);
       *end = c;
+      legacy_hashes_ = true;
     } else {
       entry->command_hash = LogEntry::HashCommand(StringPiece(start,
                                                               end - start));
@@ -358,6 +792,7 @@ LoadStatus BuildLog::Load(const string& path, string* err) {
   if (!line_start) {
     return LOAD_SUCCESS; // file was empty
   }
+  log_version_ = log_version;
 
   // Decide whether it's time to rebuild the log:
   // - if we're upgrading versions
@@ -374,87 +809,313 @@ LoadStatus BuildLog::Load(const string& path, string* err) {
   return LOAD_SUCCESS;
 }
 
+bool BuildLog::CatchUp(string* err) {
+  if (!lock_ || log_file_path_.empty())
+    return true;
+  // Records of this process read back only repeat what's in memory, as
+  // long as none are still queued to be written.
+  if (!writer_.Flush()) {
+    *err = strerror(errno);
+    return false;
+  }
+  FILE* f = fopen(log_file_path_.c_str(), "rb");
+  if (!f) {
+    if (errno == ENOENT)
+      return true;
+    *err = strerror(errno);
+    return false;
+  }
+  if (loaded_end_ == 0) {
+    // The records appended follow the indexed ones.
+    IndexedLogHeader header;
+    int version = 0;
+    char signature[sizeof(header.signature) + 1] = {};
+    if (fread(&header, sizeof(header), 1, f) != 1) {
+      fclose(f);
+      return true;
+    }
+    memcpy(signature, header.signature, sizeof(header.signature));
+    if (sscanf(signature, kFileSignature, &version) != 1 ||
+        version != log_version_) {
+      fclose(f);
+      *err = "build log version changed";
+      return false;
+    }
+    loaded_end_ = header.records_end;
+  }
+  string data;
+  char buf[64 << 10];
+  fseek(f, (long)loaded_end_, SEEK_SET);
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.append(buf, len);
+  fclose(f);
+
+  // The last record may still be being written.
+  uint64_t offset = 0;
+  while (offset < data.size()) {
+    RecordHeader record;
+    StringPiece output;
+    uint64_t next = ReadRecord(data.data(), log_version_, offset,
+                               data.size(), &record, &output);
+    if (!next)
+      break;
+    offset = next;
+    Entries::iterator i = entries_.find(output);
+    LogEntry* entry;
+    if (i != entries_.end()) {
+      entry = i->second;
+    } else {
+      entry = new LogEntry(output.AsString());
+      entries_.insert(Entries::value_type(entry->output, entry));
+    }
+    ApplyRecord(log_version_, record, entry);
+  }
+  loaded_end_ += offset;
+  return true;
+}
+
 BuildLog::LogEntry* BuildLog::LookupByOutput(const string& path) {
   Entries::iterator i = entries_.find(path);
   if (i != entries_.end())
     return i->second;
-  return NULL;
+  return LookupIndexed(path);
+}
+
+BuildLog::LogEntry* BuildLog::LookupIndexed(StringPiece path) {
+  RecordHeader record;
+  if (!FindRecord(log_map_.data(), log_version_, index_size_, records_begin_,
+                  records_end_, path, &record))
+    return NULL;
+  LogEntry* entry = new LogEntry(path.AsString());
+  ApplyRecord(log_version_, record, entry);
+  entries_.insert(Entries::value_type(entry->output, entry));
+  return entry;
+}
+
+void BuildLog::LoadAllIndexed() {
+  if (index_size_) {
+    const char* data = log_map_.data();
+    uint64_t offset = records_begin_;
+    while (offset < records_end_) {
+      RecordHeader record;
+      StringPiece output;
+      offset = ReadRecord(data, log_version_, offset, records_end_, &record,
+                          &output);
+      if (!offset)
+        break;
+      // Entries in memory are never older than the indexed ones.
+      if (entries_.find(output) == entries_.end()) {
+        LogEntry* entry = new LogEntry(output.AsString());
+        ApplyRecord(log_version_, record, entry);
+        entries_.insert(Entries::value_type(entry->output, entry));
+      }
+    }
+  }
+  index_size_ = 0;
+  log_map_.Close();
+}
+
+const BuildLog::Entries& BuildLog::entries() {
+  LoadAllIndexed();
+  return entries_;
+}
+
+void BuildLog::CountMemory(MemoryStats* stats) const {
+  int64_t bytes = 0;
+  for (Entries::const_iterator i = entries_.begin(); i != entries_.end(); ++i)
+    bytes += sizeof(LogEntry) + MemoryStats::HeapBytes(i->second->output);
+  // An entry of the hash map: the pair and a link; a bucket: a link.
+  bytes += entries_.size() * (sizeof(Entries::value_type) + sizeof(void*)) +
+           entries_.bucket_count() * sizeof(void*);
+  stats->Add("BuildLog entries", entries_.size(), bytes);
+  if (log_map_.data())
+    stats->Add("BuildLog mapped file", 1, log_map_.size());
 }
 
 bool BuildLog::WriteEntry(FILE* f, const LogEntry& entry) {
-  return fprintf(f, "%d\t%d\t%" PRId64 "\t%s\t%" PRIx64 "\n",
-          entry.start_time, entry.end_time, entry.mtime,
-          entry.output.c_str(), entry.command_hash) > 0;
+  return WriteRecord(f, log_version_, entry);
+}
+
+bool BuildLog::WriteIndexedLog(FILE* f, const vector<LogEntry*>& entries) {
+  // Legacy hashes that couldn't be rehashed keep their version, so that
+  // they aren't mistaken for current ones.
+  int version = legacy_hashes_ ? kLastLegacyHashVersion : kCurrentVersion;
+  uint32_t index_size = 0;
+  if (!entries.empty()) {
+    // Keep the table at most half full.
+    index_size = 1;
+    while (index_size < 2 * entries.size())
+      index_size <<= 1;
+  }
+
+  vector<IndexSlot> index(index_size);
+  uint64_t offset = sizeof(IndexedLogHeader) +
+                    (uint64_t)index_size * sizeof(IndexSlot);
+  for (vector<LogEntry*>::const_iterator e = entries.begin();
+       e != entries.end(); ++e) {
+    uint64_t hash = HashPath((*e)->output);
+    uint32_t i = hash & (index_size - 1);
+    while (index[i].offset != 0)
+      i = (i + 1) & (index_size - 1);
+    index[i].path_hash = hash;
+    index[i].offset = offset;
+    offset += RecordHeaderSize(version) + PaddedPathSize((*e)->output.size());
+  }
+
+  if (!WriteIndexedLogHeader(f, version, index_size, entries.size(), offset))
+    return false;
+  if (index_size && fwrite(&index[0], sizeof(IndexSlot), index_size, f) !=
+                        index_size)
+    return false;
+  for (vector<LogEntry*>::const_iterator e = entries.begin();
+       e != entries.end(); ++e) {
+    if (!WriteRecord(f, version, **e))
+      return false;
+  }
+  return true;
 }
 
 bool BuildLog::Recompact(const string& path, const BuildLogUser& user,
                          string* err) {
   METRIC_RECORD(".ninja_log recompact");
+  TRACE_RECORD(".ninja_log recompact");
 
+  return StartRecompaction(path, user, err) && FinishRecompaction(err);
+}
+
+bool BuildLog::StartRecompaction(const string& path, const BuildLogUser& user,
+                                 string* err) {
   Close();
-  string temp_path = path + ".recompact";
-  FILE* f = fopen(temp_path.c_str(), "wb");
-  if (!f) {
-    *err = strerror(errno);
-    return false;
-  }
+  LoadAllIndexed();
 
-  if (fprintf(f, kFileSignature, kCurrentVersion) < 0) {
-    *err = strerror(errno);
-    fclose(f);
-    return false;
+  vector<StringPiece> outputs;
+  vector<LogEntry*> entries;
+  outputs.reserve(entries_.size());
+  entries.reserve(entries_.size());
+  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i) {
+    outputs.push_back(i->first);
+    entries.push_back(i->second);
   }
+  vector<bool> dead;
+  user.FindDeadPaths(outputs, &dead);
 
+  vector<LogEntry*> live_entries;
   vector<StringPiece> dead_outputs;
-  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i) {
-    if (user.IsPathDead(i->first)) {
-      dead_outputs.push_back(i->first);
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    if (dead[i]) {
+      dead_outputs.push_back(outputs[i]);
       continue;
     }
+    live_entries.push_back(entries[i]);
+  }
 
-    if (!WriteEntry(f, *i->second)) {
-      *err = strerror(errno);
-      fclose(f);
-      return false;
+  if (legacy_hashes_) {
+    // Carry the entries whose command hasn't changed over to the current
+    // hash.  Others keep a hash that won't match, and are rebuilt.
+    for (vector<LogEntry*>::iterator i = live_entries.begin();
+         i != live_entries.end(); ++i) {
+      Edge* edge = user.EdgeForPath((*i)->output);
+      if (edge && !edge->is_phony() &&
+          LogEntry::LegacyHashCommand(edge->EvaluateCommand(true)) ==
+              (*i)->command_hash)
+        (*i)->command_hash = edge->GetCommandHash();
     }
+    legacy_hashes_ = false;
   }
 
+  // Copy the entries: the build updates them as it goes.
+  Recompaction* recompaction = new Recompaction;
+  recompaction->path = path;
+  recompaction->temp_path = path + ".recompact";
+  recompaction->ok = false;
+  recompaction->entries.reserve(live_entries.size());
+  for (vector<LogEntry*>::iterator i = live_entries.begin();
+       i != live_entries.end(); ++i)
+    recompaction->entries.push_back(**i);
+
   for (size_t i = 0; i < dead_outputs.size(); ++i)
     entries_.erase(dead_outputs[i]);
+  needs_recompaction_ = false;
 
-  fclose(f);
-  if (unlink(path.c_str()) < 0) {
-    *err = strerror(errno);
-    return false;
+  recompaction->thread = std::thread([this, recompaction]() {
+    FILE* f = fopen(recompaction->temp_path.c_str(), "wb");
+    if (!f) {
+      recompaction->err = strerror(errno);
+      return;
+    }
+    vector<LogEntry*> entries;
+    entries.reserve(recompaction->entries.size());
+    for (vector<LogEntry>::iterator i = recompaction->entries.begin();
+         i != recompaction->entries.end(); ++i)
+      entries.push_back(&*i);
+    recompaction->ok = WriteIndexedLog(f, entries);
+    if (fclose(f) != 0)
+      recompaction->ok = false;
+    if (!recompaction->ok)
+      recompaction->err = strerror(errno);
+  });
+  recompaction_ = recompaction;
+  return true;
+}
+
+bool BuildLog::FinishRecompaction(string* err) {
+  Recompaction* recompaction = recompaction_;
+  if (!recompaction)
+    return true;
+  TRACE_RECORD(".ninja_log recompact finish");
+  recompaction_ = NULL;
+  recompaction->thread.join();
+
+  // Append the entries recorded meanwhile to the copy.
+  FILE* f = NULL;
+  if (recompaction->ok) {
+    f = fopen(recompaction->temp_path.c_str(), "ab");
+    recompaction->ok = f != NULL;
+  }
+  if (f) {
+    // Opening a file in append mode doesn't set the file pointer to the
+    // file's end on Windows. Do that explicitly.
+    fseek(f, 0, SEEK_END);
+    set<LogEntry*> seen;
+    for (vector<LogEntry*>::iterator i = recompaction->recorded.begin();
+         i != recompaction->recorded.end() && recompaction->ok; ++i) {
+      if (seen.insert(*i).second)
+        recompaction->ok = WriteRecord(f, kCurrentVersion, **i);
+    }
+    if (fclose(f) != 0)
+      recompaction->ok = false;
+    if (!recompaction->ok)
+      recompaction->err = strerror(errno);
   }
 
-  if (rename(temp_path.c_str(), path.c_str()) < 0) {
+  bool replaced = recompaction->ok;
+  if (!replaced) {
+    *err = recompaction->err;
+    unlink(recompaction->temp_path.c_str());
+  } else if (unlink(recompaction->path.c_str()) < 0 ||
+             rename(recompaction->temp_path.c_str(),
+                    recompaction->path.c_str()) < 0) {
     *err = strerror(errno);
-    return false;
+    replaced = false;
   }
-
-  return true;
+  if (replaced)
+    log_version_ = kCurrentVersion;
+  delete recompaction;
+  return replaced;
 }
 
 bool BuildLog::Restat(const StringPiece path,
                       const DiskInterface& disk_interface,
                       const int output_count, char** outputs,
-                      std::string* const err) {
+                      std::string* const err,
+                      const RestatProgress& progress) {
   METRIC_RECORD(".ninja_log restat");
 
   Close();
-  std::string temp_path = path.AsString() + ".restat";
-  FILE* f = fopen(temp_path.c_str(), "wb");
-  if (!f) {
-    *err = strerror(errno);
-    return false;
-  }
+  LoadAllIndexed();
 
-  if (fprintf(f, kFileSignature, kCurrentVersion) < 0) {
-    *err = strerror(errno);
-    fclose(f);
-    return false;
-  }
+  vector<LogEntry*> to_stat;
   for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i) {
     bool skip = output_count > 0;
     for (int j = 0; j < output_count; ++j) {
@@ -463,20 +1124,81 @@ bool BuildLog::Restat(const StringPiece path,
         break;
       }
     }
-    if (!skip) {
-      const TimeStamp mtime = disk_interface.Stat(i->second->output, err);
-      if (mtime == -1) {
-        fclose(f);
+    if (!skip)
+      to_stat.push_back(i->second);
+  }
+
+  // Stat a chunk at a time, to report progress in between.
+  const size_t kChunkSize = 4096;
+  const int kStatThreads = 16;
+  int thread_count = disk_interface.IsStatThreadSafe() ? kStatThreads : 1;
+  vector<LogEntry*> changed;
+  vector<TimeStamp> mtimes;
+  vector<string> errs;
+  for (size_t start = 0; start < to_stat.size(); start += kChunkSize) {
+    size_t count = min(kChunkSize, to_stat.size() - start);
+    mtimes.assign(count, 0);
+    errs.assign(count, string());
+    ParallelFor(count, thread_count, [&](size_t i) {
+      mtimes[i] = disk_interface.Stat(to_stat[start + i]->output, &errs[i]);
+    });
+    for (size_t i = 0; i < count; ++i) {
+      if (mtimes[i] == -1) {
+        *err = errs[i];
         return false;
       }
-      i->second->mtime = mtime;
+      LogEntry* entry = to_stat[start + i];
+      if (entry->mtime != mtimes[i]) {
+        entry->mtime = mtimes[i];
+        changed.push_back(entry);
+      }
     }
+    if (progress)
+      progress(start + count, to_stat.size());
+  }
 
-    if (!WriteEntry(f, *i->second)) {
+  if (!needs_recompaction_) {
+    // Records appended to the log take precedence over the older ones.
+    if (changed.empty())
+      return true;
+    FILE* f = fopen(path.AsString().c_str(), "ab");
+    if (!f) {
+      *err = strerror(errno);
+      return false;
+    }
+    // Opening a file in append mode doesn't set the file pointer to the
+    // file's end on Windows.
+    fseek(f, 0, SEEK_END);
+    for (vector<LogEntry*>::iterator e = changed.begin(); e != changed.end();
+         ++e) {
+      if (!WriteEntry(f, **e)) {
+        *err = strerror(errno);
+        fclose(f);
+        return false;
+      }
+    }
+    if (fclose(f) != 0) {
       *err = strerror(errno);
-      fclose(f);
       return false;
     }
+    return true;
+  }
+
+  std::string temp_path = path.AsString() + ".restat";
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  vector<LogEntry*> all_entries;
+  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i)
+    all_entries.push_back(i->second);
+
+  if (!WriteIndexedLog(f, all_entries)) {
+    *err = strerror(errno);
+    fclose(f);
+    return false;
   }
 
   fclose(f);
@@ -489,6 +1211,7 @@ bool BuildLog::Restat(const StringPiece path,
     *err = strerror(errno);
     return false;
   }
+  log_version_ = legacy_hashes_ ? kLastLegacyHashVersion : kCurrentVersion;
 
   return true;
 }
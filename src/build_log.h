@@ -15,24 +15,52 @@
 #ifndef NINJA_BUILD_LOG_H_
 #define NINJA_BUILD_LOG_H_
 
+#include <functional>
 #include <string>
+#include <vector>
 #include <stdio.h>
 
 #include "hash_map.h"
 #include "load_status.h"
+#include "log_writer.h"
+#include "mapped_file.h"
+#include "resource_usage.h"
 #include "timestamp.h"
 #include "util.h"  // uint64_t
 
 struct DiskInterface;
 struct Edge;
+struct MemoryStats;
+struct State;
 
 /// Can answer questions about the manifest for the BuildLog.
 struct BuildLogUser {
+  virtual ~BuildLogUser() {}
+
   /// Return if a given output is no longer part of the build manifest.
   /// This is only called during recompaction and doesn't have to be fast.
   virtual bool IsPathDead(StringPiece s) const = 0;
+
+  /// Set |dead| to whether IsPathDead() each of |paths|.  Recompaction asks
+  /// about all the outputs of the log at once; override this to answer
+  /// faster than one at a time.
+  virtual void FindDeadPaths(const std::vector<StringPiece>& paths,
+                             std::vector<bool>* dead) const;
+
+  /// Return the edge that currently produces output |s|, or NULL.  This is
+  /// used to rehash the commands of a log written before v7 when it is
+  /// rewritten; without it, those outputs are rebuilt once.
+  virtual Edge* EdgeForPath(StringPiece s) const { return NULL; }
 };
 
+/// Find which of |paths| are dead for a build of |state|: no edge of it
+/// produces them and no file exists for them any more, as generators may
+/// still want their entries.  Only the paths without an edge are stat'ed,
+/// in parallel if |disk_interface| allows that.
+void FindDeadOutputs(const State& state, const DiskInterface& disk_interface,
+                     const std::vector<StringPiece>& paths,
+                     std::vector<bool>* dead);
+
 /// Store a log of every command ran for every build.
 /// It has a few uses:
 ///
@@ -44,31 +72,71 @@ struct BuildLog {
   BuildLog();
   ~BuildLog();
 
+  /// Share the log with the other processes holding |lock|, which append
+  /// to it in turn.  It's then only rewritten while they're kept out.
+  void set_build_dir_lock(BuildDirLock* lock) { lock_ = lock; }
+
   /// Prepares writing to the log file without actually opening it - that will
-  /// happen when/if it's needed
+  /// happen when/if it's needed.  If the log needs recompaction, that runs in
+  /// the background until Close().
   bool OpenForWrite(const std::string& path, const BuildLogUser& user,
                     std::string* err);
+  /// Record that |edge| ran from |start_time| to |end_time|.  If its
+  /// outputs were |restored| from the action cache instead, those times
+  /// don't tell how long the command takes, and its duration history is
+  /// left as it was.
   bool RecordCommand(Edge* edge, int start_time, int end_time,
-                     TimeStamp mtime = 0);
+                     TimeStamp mtime = 0,
+                     const ResourceUsage& usage = ResourceUsage(),
+                     bool restored = false);
   void Close();
 
+  /// Wait until the commands recorded so far are in the file.
+  bool Flush();
+
   /// Load the on-disk log.
   LoadStatus Load(const std::string& path, std::string* err);
 
+  /// Read the records other processes sharing the log appended since it
+  /// was last read, once it's open for writing.
+  bool CatchUp(std::string* err);
+
   struct LogEntry {
     std::string output;
     uint64_t command_hash;
     int start_time;
     int end_time;
     TimeStamp mtime;
+    /// What the command used when it last ran; 0s before v8.
+    ResourceUsage usage;
+    /// How long the command takes in milliseconds, smoothed over its runs
+    /// (an exponentially weighted moving average), the variance of that in
+    /// square milliseconds, and the number of runs counted.  Before v9, the
+    /// history starts from the last run.
+    int avg_duration;
+    int64_t duration_variance;
+    int duration_runs;
+
+    /// Count a run of the command that took |duration| milliseconds.
+    void AddDuration(int duration);
+    /// How long the command is expected to take in milliseconds, or -1 if
+    /// it never ran.
+    int64_t ExpectedDuration() const {
+      return duration_runs > 0 ? avg_duration : -1;
+    }
 
     static uint64_t HashCommand(StringPiece command);
+    /// The command hash of logs before v7 (64-bit MurmurHash2).
+    static uint64_t LegacyHashCommand(StringPiece command);
 
     // Used by tests.
     bool operator==(const LogEntry& o) {
       return output == o.output && command_hash == o.command_hash &&
           start_time == o.start_time && end_time == o.end_time &&
-          mtime == o.mtime;
+          mtime == o.mtime && usage == o.usage &&
+          avg_duration == o.avg_duration &&
+          duration_variance == o.duration_variance &&
+          duration_runs == o.duration_runs;
     }
 
     explicit LogEntry(const std::string& output);
@@ -76,7 +144,8 @@ struct BuildLog {
              int start_time, int end_time, TimeStamp restat_mtime);
   };
 
-  /// Lookup a previously-run command by its output path.
+  /// Lookup a previously-run command by its output path.  Entries of an
+  /// indexed log are only read from disk when first looked up.
   LogEntry* LookupByOutput(const std::string& path);
 
   /// Serialize an entry into a log file.
@@ -86,22 +155,84 @@ struct BuildLog {
   bool Recompact(const std::string& path, const BuildLogUser& user,
                  std::string* err);
 
-  /// Restat all outputs in the log
+  /// Start rewriting the live entries known now to a copy of the log at
+  /// |path|, on another thread.  Commands recorded meanwhile still go to the
+  /// log itself.
+  bool StartRecompaction(const std::string& path, const BuildLogUser& user,
+                         std::string* err);
+
+  /// Wait for the copy started by StartRecompaction(), append the entries
+  /// recorded since to it and replace the log with it.  Close() calls this.
+  /// On failure, the log is left as it was.
+  bool FinishRecompaction(std::string* err);
+
+  /// Called by Restat() as outputs are stat'ed, with the number done so far
+  /// and the total.
+  typedef std::function<void(size_t, size_t)> RestatProgress;
+
+  /// Restat all outputs in the log, or those among |outputs| if any, on
+  /// several threads if |disk_interface| allows it.  Only the entries whose
+  /// mtime changed are appended to the log, unless it needs rewriting.
   bool Restat(StringPiece path, const DiskInterface& disk_interface,
-              int output_count, char** outputs, std::string* err);
+              int output_count, char** outputs, std::string* err,
+              const RestatProgress& progress = RestatProgress());
 
   typedef ExternalStringHashMap<LogEntry*>::Type Entries;
-  const Entries& entries() const { return entries_; }
+  /// All entries of the log; this reads any not yet looked up from disk.
+  const Entries& entries();
+
+  /// Count the entries in memory, and the log mapped for the others, in
+  /// |stats|.
+  void CountMemory(MemoryStats* stats) const;
 
  private:
-  /// Should be called before using log_file_. When false is returned, errno
+  /// Should be called before using writer_. When false is returned, errno
   /// will be set.
   bool OpenForWriteIfNeeded();
 
+  /// Load a text (pre-v6) log.
+  LoadStatus LoadText(const std::string& path, std::string* err);
+  /// Load an indexed log, already mapped into |log_map_|.
+  LoadStatus LoadIndexed(const std::string& path, std::string* err);
+
+  /// Find |path| in the on-disk index, and add it to |entries_| if found.
+  LogEntry* LookupIndexed(StringPiece path);
+
+  /// Read all the entries of the on-disk index into |entries_| and unmap
+  /// the log.
+  void LoadAllIndexed();
+
+  /// Write a complete indexed log holding |entries| to |f|.
+  bool WriteIndexedLog(FILE* f, const std::vector<LogEntry*>& entries);
+
   Entries entries_;
-  FILE* log_file_;
+
+  /// The log being loaded lazily through its on-disk index, if any.
+  MappedFile log_map_;
+  /// The version of the loaded log, which records are appended in.
+  int log_version_;
+  /// Number of slots of the on-disk index; 0 if there is none.
+  uint32_t index_size_;
+  /// Offsets of the indexed records in |log_map_|.
+  uint64_t records_begin_;
+  uint64_t records_end_;
+
+  /// Appends the records of the commands run, once the log is opened.
+  LogWriter writer_;
   std::string log_file_path_;
+  /// If set, the log is shared with other processes.
+  BuildDirLock* lock_;
+  /// How much of the shared log was read, or 0 to read the records
+  /// appended to it from the end of the indexed ones.
+  uint64_t loaded_end_;
   bool needs_recompaction_;
+  /// Whether the loaded entries hold command hashes of a log before v7,
+  /// to be rehashed by the next Recompact().
+  bool legacy_hashes_;
+
+  /// The recompaction running in the background, if any.
+  struct Recompaction;
+  Recompaction* recompaction_;
 };
 
 #endif // NINJA_BUILD_LOG_H_
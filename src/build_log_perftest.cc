@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -100,10 +102,44 @@ bool WriteTestData(string* err) {
   return true;
 }
 
+/// Time hashing long commands with the current and the pre-v7 hash.
+void BenchmarkHashes() {
+  const size_t kSizes[] = { 4000, 50000, 100000 };
+  for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+    string command = "gcc ";
+    for (int i = 0; command.size() < kSizes[s]; ++i) {
+      char buf[80];
+      sprintf(buf, "-I../../and/arbitrary/but/fairly/long/path/suffixed/%d ",
+              i);
+      command += buf;
+    }
+    const int kIterations = (int)(2000000000 / command.size() / 10);
+    uint64_t sum = 0;
+    int64_t start = GetTimeMillis();
+    for (int i = 0; i < kIterations; ++i) {
+      command[0] = (char)i;
+      sum += BuildLog::LogEntry::LegacyHashCommand(command);
+    }
+    int64_t legacy = GetTimeMillis() - start;
+    start = GetTimeMillis();
+    for (int i = 0; i < kIterations; ++i) {
+      command[0] = (char)i;
+      sum += BuildLog::LogEntry::HashCommand(command);
+    }
+    int64_t current = GetTimeMillis() - start;
+    double mb = (double)command.size() * kIterations / (1 << 20);
+    printf("hash %6d byte commands: before %6.0f MB/s  after %6.0f MB/s"
+           " (%d)\n", (int)command.size(), mb * 1000 / max(legacy, (int64_t)1),
+           mb * 1000 / max(current, (int64_t)1), (int)(sum & 1));
+  }
+}
+
 int main() {
   vector<int> times;
   string err;
 
+  BenchmarkHashes();
+
   if (!WriteTestData(&err)) {
     fprintf(stderr, "Failed to write test data: %s\n", err.c_str());
     return 1;
@@ -14,6 +14,7 @@
 
 #include "build_log.h"
 
+#include "build_dir_lock.h"
 #include "util.h"
 #include "test.h"
 
@@ -26,6 +27,7 @@
 #include <unistd.h>
 #endif
 #include <cassert>
+#include <set>
 
 using namespace std;
 
@@ -72,6 +74,118 @@ TEST_F(BuildLogTest, WriteRead) {
   ASSERT_EQ("out", e1->output);
 }
 
+TEST_F(BuildLogTest, SharedCatchUp) {
+  AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n");
+
+  const char kLockFilename[] = "BuildLogTest-lockfile";
+  unlink(kLockFilename);
+  BuildDirLock lock;
+  string err;
+  ASSERT_TRUE(lock.Open(kLockFilename, &err));
+  lock.Share();
+
+  // Two processes sharing the log, each seeing what the other appended.
+  BuildLog log1, log2;
+  log1.set_build_dir_lock(&lock);
+  log2.set_build_dir_lock(&lock);
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, *this, &err));
+  EXPECT_TRUE(log2.OpenForWrite(kTestFilename, *this, &err));
+  ASSERT_EQ("", err);
+
+  log1.RecordCommand(state_.edges_[0], 15, 18);
+  EXPECT_TRUE(log1.Flush());
+  EXPECT_FALSE(log2.LookupByOutput("out"));
+  EXPECT_TRUE(log2.CatchUp(&err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log2.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(15, e->start_time);
+
+  log2.RecordCommand(state_.edges_[1], 20, 25);
+  EXPECT_TRUE(log2.Flush());
+  EXPECT_TRUE(log1.CatchUp(&err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(log1.LookupByOutput("mid"));
+  log1.Close();
+  log2.Close();
+
+  BuildLog log3;
+  EXPECT_NE(LOAD_ERROR, log3.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(2u, log3.entries().size());
+  unlink(kLockFilename);
+}
+
+TEST_F(BuildLogTest, DurationHistory) {
+  AssertParse(&state_,
+"build out: cat mid\n");
+
+  string err;
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log.RecordCommand(state_.edges_[0], 0, 100);
+    log.RecordCommand(state_.edges_[0], 100, 300);
+    // A run restored from the action cache leaves the history alone.
+    log.RecordCommand(state_.edges_[0], 300, 301, 0, ResourceUsage(), true);
+    log.Close();
+  }
+
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(300, e->start_time);
+  EXPECT_EQ(2, e->duration_runs);
+  EXPECT_EQ(125, e->avg_duration);
+  EXPECT_EQ(1875, e->duration_variance);
+  EXPECT_EQ(125, e->ExpectedDuration());
+  EXPECT_EQ(-1, BuildLog::LogEntry("never").ExpectedDuration());
+}
+
+TEST_F(BuildLogTest, ResourceUsage) {
+  AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n");
+
+  ResourceUsage usage;
+  usage.user_time = 1500;
+  usage.system_time = 20;
+  usage.peak_rss = 12 << 20;
+  string err;
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log.RecordCommand(state_.edges_[0], 15, 18, 0, usage);
+    log.Close();
+  }
+  {
+    // Once rewritten, the usage comes from the index.
+    BuildLog log;
+    EXPECT_TRUE(log.Load(kTestFilename, &err));
+    EXPECT_TRUE(log.Recompact(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    log.RecordCommand(state_.edges_[1], 20, 25);
+    log.Close();
+  }
+
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  EXPECT_TRUE(e->usage == usage);
+  e = log.LookupByOutput("mid");
+  ASSERT_TRUE(e);
+  EXPECT_TRUE(e->usage == ResourceUsage());
+}
+
 TEST_F(BuildLogTest, FirstWriteAddsSignature) {
   const char kExpectedVersion[] = "# ninja log vX\n";
   const size_t kVersionPos = strlen(kExpectedVersion) - 2;  // Points at 'X'.
@@ -87,9 +201,10 @@ TEST_F(BuildLogTest, FirstWriteAddsSignature) {
   ASSERT_EQ("", err);
   if (contents.size() >= kVersionPos)
     contents[kVersionPos] = 'X';
-  EXPECT_EQ(kExpectedVersion, contents);
+  EXPECT_EQ(kExpectedVersion, contents.substr(0, strlen(kExpectedVersion)));
+  size_t header_size = contents.size();
 
-  // Opening the file anew shouldn't add a second version string.
+  // Opening the file anew shouldn't add a second header.
   EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
   ASSERT_EQ("", err);
   log.Close();
@@ -97,9 +212,7 @@ TEST_F(BuildLogTest, FirstWriteAddsSignature) {
   contents.clear();
   ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
   ASSERT_EQ("", err);
-  if (contents.size() >= kVersionPos)
-    contents[kVersionPos] = 'X';
-  EXPECT_EQ(kExpectedVersion, contents);
+  EXPECT_EQ(header_size, contents.size());
 }
 
 TEST_F(BuildLogTest, DoubleEntry) {
@@ -267,6 +380,53 @@ TEST_F(BuildLogTest, Restat) {
   ASSERT_EQ(4, e->mtime);
 }
 
+TEST_F(BuildLogTest, RestatAppendsChangedEntries) {
+  AssertParse(&state_,
+"build out: cat in\n"
+"build out2: cat in\n");
+  string err;
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log.RecordCommand(state_.edges_[0], 1, 2, 3);
+    log.RecordCommand(state_.edges_[1], 1, 2, 4);
+    log.Close();
+  }
+  string before;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &before, &err));
+
+  TestDiskInterface disk_interface;
+  size_t last_done = 0, last_total = 0;
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(log.Restat(kTestFilename, disk_interface, 0, NULL, &err,
+                           [&](size_t done, size_t total) {
+                             last_done = done;
+                             last_total = total;
+                           }));
+    ASSERT_EQ("", err);
+  }
+  EXPECT_EQ(2u, last_done);
+  EXPECT_EQ(2u, last_total);
+
+  // Only out, whose mtime changed, was appended.
+  string after;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &after, &err));
+  ASSERT_GT(after.size(), before.size());
+  EXPECT_EQ(before, after.substr(0, before.size()));
+  EXPECT_NE(string::npos, after.find("out", before.size()));
+  EXPECT_EQ(string::npos, after.find("out2", before.size()));
+
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(4, log.LookupByOutput("out")->mtime);
+  EXPECT_EQ(4, log.LookupByOutput("out2")->mtime);
+}
+
 TEST_F(BuildLogTest, VeryLongInputLine) {
   // Ninja's build log buffer is currently 256kB. Lines longer than that are
   // silently ignored, but don't affect parsing of other lines.
@@ -315,6 +475,156 @@ TEST_F(BuildLogTest, MultiTargetEdge) {
   ASSERT_EQ(22, e2->end_time);
 }
 
+TEST_F(BuildLogTest, IndexedLookup) {
+  AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n"
+"build out2: cat in\n");
+
+  string err;
+  {
+    BuildLog log1;
+    EXPECT_TRUE(log1.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log1.RecordCommand(state_.edges_[0], 15, 18);
+    log1.RecordCommand(state_.edges_[1], 20, 25);
+    log1.Close();
+    // Rewrite the log with an index.
+    ASSERT_TRUE(log1.Recompact(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+
+    // Append past the index, updating one entry and adding another.
+    BuildLog log2;
+    EXPECT_TRUE(log2.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(log2.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log2.RecordCommand(state_.edges_[0], 30, 31);
+    log2.RecordCommand(state_.edges_[2], 40, 41);
+    log2.Close();
+  }
+
+  BuildLog log3;
+  EXPECT_TRUE(log3.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log3.LookupByOutput("mid");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(20, e->start_time);
+  EXPECT_EQ(25, e->end_time);
+  e = log3.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(30, e->start_time);
+  e = log3.LookupByOutput("out2");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(40, e->start_time);
+  EXPECT_FALSE(log3.LookupByOutput("in"));
+  EXPECT_EQ(3u, log3.entries().size());
+}
+
+TEST_F(BuildLogTest, UpgradeTextLog) {
+  FILE* f = fopen(kTestFilename, "wb");
+  fprintf(f, "# ninja log v4\n");
+  fprintf(f, "1\t2\t3\tout\tcommand\n");
+  fclose(f);
+
+  string err;
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    // Older versions are rewritten when opened for writing.
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log.Close();
+  }
+
+  string contents;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  EXPECT_EQ(0u, contents.find("# ninja log v9\n"));
+
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log2.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(3, e->mtime);
+  ASSERT_NO_FATAL_FAILURE(AssertHash("command", e->command_hash));
+}
+
+struct BuildLogUpgradeTest : public BuildLogTest {
+  virtual Edge* EdgeForPath(StringPiece s) const {
+    Node* n = state_.LookupNode(s);
+    return n ? n->in_edge() : NULL;
+  }
+};
+
+TEST_F(BuildLogUpgradeTest, RehashLegacyHashes) {
+  AssertParse(&state_,
+"build out: cat in\n"
+"build out2: cat in2\n");
+  Edge* edge = state_.edges_[0];
+
+  FILE* f = fopen(kTestFilename, "wb");
+  fprintf(f, "# ninja log v5\n");
+  fprintf(f, "1\t2\t3\tout\t%llx\n", (unsigned long long)
+          BuildLog::LogEntry::LegacyHashCommand(edge->EvaluateCommand(true)));
+  // out2's command changed since it was recorded.
+  fprintf(f, "1\t2\t3\tout2\t%llx\n", (unsigned long long)
+          BuildLog::LogEntry::LegacyHashCommand("cat in3 > out2"));
+  fclose(f);
+
+  string err;
+  {
+    // Rewriting the log without the manifest keeps the legacy hashes, in the
+    // last binary version that used them.
+    BuildLog log;
+    EXPECT_TRUE(log.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    TestDiskInterface disk_interface;
+    EXPECT_TRUE(log.Restat(kTestFilename, disk_interface, 0, NULL, &err));
+    ASSERT_EQ("", err);
+  }
+  string contents;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  EXPECT_EQ(0u, contents.find("# ninja log v6\n"));
+
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log.Close();
+  }
+  contents.clear();
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  EXPECT_EQ(0u, contents.find("# ninja log v9\n"));
+
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(4, e->mtime);
+  EXPECT_EQ(edge->GetCommandHash(), e->command_hash);
+  e = log.LookupByOutput("out2");
+  ASSERT_TRUE(e);
+  EXPECT_NE(state_.edges_[1]->GetCommandHash(), e->command_hash);
+}
+
+TEST_F(BuildLogTest, HashCommand) {
+  // Inputs up to and past each of the hash's block sizes.
+  set<uint64_t> hashes;
+  string command;
+  for (int i = 0; i < 200; ++i) {
+    hashes.insert(BuildLog::LogEntry::HashCommand(command));
+    command += (char)('a' + i % 26);
+  }
+  EXPECT_EQ(200u, hashes.size());
+  EXPECT_NE(BuildLog::LogEntry::HashCommand("command"),
+            BuildLog::LogEntry::LegacyHashCommand("command"));
+}
+
 struct BuildLogRecompactTest : public BuildLogTest {
   virtual bool IsPathDead(StringPiece s) const { return s == "out2"; }
 };
@@ -355,4 +665,70 @@ TEST_F(BuildLogRecompactTest, Recompact) {
   ASSERT_FALSE(log2.LookupByOutput("out2"));
 }
 
+TEST_F(BuildLogTest, FindDeadOutputs) {
+  AssertParse(&state_,
+"build out: cat in\n");
+  // "gone" is in the state as an input, without an edge.
+  state_.GetNode("gone", 0);
+  VirtualFileSystem disk_interface;
+  disk_interface.Create("kept", "");
+
+  vector<StringPiece> paths;
+  paths.push_back("out");
+  paths.push_back("gone");
+  paths.push_back("kept");
+  paths.push_back("unknown");
+  vector<bool> dead;
+  FindDeadOutputs(state_, disk_interface, paths, &dead);
+  ASSERT_EQ(4u, dead.size());
+  EXPECT_FALSE(dead[0]);
+  EXPECT_TRUE(dead[1]);
+  // Files still on disk are kept for generators.
+  EXPECT_FALSE(dead[2]);
+  EXPECT_TRUE(dead[3]);
+}
+
+TEST_F(BuildLogRecompactTest, RecompactInBackground) {
+  AssertParse(&state_,
+"build out: cat in\n"
+"build out2: cat in\n"
+"build out3: cat in\n");
+
+  string err;
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    for (int i = 0; i < 200; ++i)
+      log.RecordCommand(state_.edges_[0], 15, 18 + i);
+    log.RecordCommand(state_.edges_[1], 21, 22);
+    log.Close();
+  }
+
+  {
+    // Opening the log starts the recompaction; commands recorded until it
+    // is closed end up in the rewritten log.
+    BuildLog log;
+    EXPECT_TRUE(log.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log.RecordCommand(state_.edges_[0], 30, 31);
+    log.RecordCommand(state_.edges_[2], 40, 41);
+    log.Close();
+  }
+
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(2u, log.entries().size());
+  ASSERT_TRUE(log.LookupByOutput("out"));
+  EXPECT_EQ(30, log.LookupByOutput("out")->start_time);
+  EXPECT_FALSE(log.LookupByOutput("out2"));
+  ASSERT_TRUE(log.LookupByOutput("out3"));
+  EXPECT_EQ(40, log.LookupByOutput("out3")->start_time);
+  struct stat st;
+  EXPECT_NE(0, stat((string(kTestFilename) + ".recompact").c_str(), &st));
+}
+
 }  // anonymous namespace
@@ -0,0 +1,327 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests the performance of whole builds of the manifests written by
+// misc/write_fake_manifests.py: a no-op build, and a build after one source
+// file was touched.  Commands don't run; a fake CommandRunner writes their
+// outputs and depfiles instead.  Expects to be run in ninja's root
+// directory, and prints the time each phase took as JSON.
+
+#include <algorithm>
+#include <deque>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include "getopt.h"
+#include <direct.h>
+#elif defined(_AIX)
+#include "getopt.h"
+#include <unistd.h>
+#else
+#include <getopt.h>
+#include <unistd.h>
+#endif
+
+#include "build.h"
+#include "build_log.h"
+#include "deps_log.h"
+#include "disk_interface.h"
+#include "graph.h"
+#include "manifest_parser.h"
+#include "metrics.h"
+#include "state.h"
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// Completes every command at once, writing its outputs, and for rules
+/// with a depfile, a depfile naming its inputs and the header next to each
+/// source.
+struct FakeCommandRunner : public CommandRunner {
+  FakeCommandRunner(DiskInterface* disk_interface, int parallelism)
+      : disk_interface_(disk_interface), parallelism_(parallelism),
+        commands_(0) {}
+
+  virtual bool CanRunMore() const {
+    return (int)active_.size() < parallelism_;
+  }
+
+  virtual bool StartCommand(Edge* edge) {
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o) {
+      if (!disk_interface_->MakeDirs((*o)->path()) ||
+          !disk_interface_->WriteFile((*o)->path(), ""))
+        return false;
+    }
+    string depfile = edge->GetUnescapedDepfile();
+    if (!depfile.empty()) {
+      string content = edge->outputs_[0]->path() + ":";
+      for (size_t i = 0; i < edge->inputs_.size() - edge->implicit_deps_ -
+                             edge->order_only_deps_; ++i) {
+        const string& path = edge->inputs_[i]->path();
+        content += " " + path;
+        size_t dot = path.rfind('.');
+        if (dot != string::npos && path.compare(dot, string::npos, ".cc") == 0)
+          content += " " + path.substr(0, dot) + ".h";
+      }
+      if (!disk_interface_->WriteFile(depfile, content + "\n"))
+        return false;
+    }
+    active_.push_back(edge);
+    ++commands_;
+    return true;
+  }
+
+  virtual bool WaitForCommand(Result* result,
+                              std::function<void()> update_func) {
+    if (active_.empty())
+      return false;
+    result->edge = active_.front();
+    result->status = ExitSuccess;
+    active_.pop_front();
+    return true;
+  }
+
+  virtual vector<Edge*> GetActiveEdges() {
+    return vector<Edge*>(active_.begin(), active_.end());
+  }
+
+  virtual void Abort() { active_.clear(); }
+
+  DiskInterface* disk_interface_;
+  int parallelism_;
+  deque<Edge*> active_;
+  /// The number of commands started.
+  int commands_;
+};
+
+struct NoDeadPaths : public BuildLogUser {
+  virtual bool IsPathDead(StringPiece s) const { return false; }
+};
+
+/// The time each phase of a build took, in microseconds.
+struct Times {
+  Times()
+      : load(0), logs(0), scan(0), build(0), total(0), commands(0), nodes(0),
+        edges(0) {}
+
+  /// Keep the shortest time of each phase of |this| and |other|.
+  void Min(const Times& other) {
+    load = min(load, other.load);
+    logs = min(logs, other.logs);
+    scan = min(scan, other.scan);
+    build = min(build, other.build);
+    total = min(total, other.total);
+  }
+
+  void PrintJSON(const char* name, bool last) const {
+    printf("  \"%s\": {\"load_us\": %lld, \"logs_us\": %lld, "
+           "\"scan_us\": %lld, \"build_us\": %lld, \"total_us\": %lld, "
+           "\"commands\": %d}%s\n",
+           name, (long long)load, (long long)logs, (long long)scan,
+           (long long)build, (long long)total, commands, last ? "" : ",");
+  }
+
+  /// Loading the manifest.
+  int64_t load;
+  /// Loading the build and deps logs, and opening them for writing.
+  int64_t logs;
+  /// Finding the dirty nodes: Builder::StatTargets() and AddTarget().
+  int64_t scan;
+  /// Builder::Build(): scheduling the commands and recording their results.
+  int64_t build;
+  /// All of the above, and the closing of the logs.
+  int64_t total;
+  int commands;
+  size_t nodes;
+  size_t edges;
+};
+
+/// Run a build of the default targets of build.ninja, as ninja would.
+bool RunBuild(Times* times, string* err) {
+  int64_t start = GetTimeMicros();
+  RealDiskInterface disk_interface;
+  State state;
+  ManifestParser parser(&state, &disk_interface);
+  if (!parser.Load("build.ninja", err))
+    return false;
+  int64_t loaded = GetTimeMicros();
+
+  NoDeadPaths user;
+  BuildLog build_log;
+  DepsLog deps_log;
+  if (build_log.Load(".ninja_log", err) == LOAD_ERROR ||
+      deps_log.Load(".ninja_deps", &state, err) == LOAD_ERROR)
+    return false;
+  err->clear();
+  if (!build_log.OpenForWrite(".ninja_log", user, err) ||
+      !deps_log.OpenForWrite(".ninja_deps", err))
+    return false;
+  int64_t logs_loaded = GetTimeMicros();
+
+  BuildConfig config;
+  config.verbosity = BuildConfig::QUIET;
+  config.parallelism = 64;
+  Builder builder(&state, config, &build_log, &deps_log, &disk_interface);
+  FakeCommandRunner* runner =
+      new FakeCommandRunner(&disk_interface, config.parallelism);
+  builder.command_runner_.reset(runner);
+  vector<Node*> targets = state.DefaultNodes(err);
+  if (!err->empty())
+    return false;
+  builder.StatTargets(targets);
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (!builder.AddTarget(targets[i], err) && !err->empty())
+      return false;
+  }
+  int64_t scanned = GetTimeMicros();
+
+  if (!builder.AlreadyUpToDate() && !builder.Build(err))
+    return false;
+  int64_t built = GetTimeMicros();
+  times->commands = runner->commands_;
+
+  build_log.Close();
+  deps_log.Close();
+  int64_t end = GetTimeMicros();
+
+  times->load = loaded - start;
+  times->logs = logs_loaded - loaded;
+  times->scan = scanned - logs_loaded;
+  times->build = built - scanned;
+  times->total = end - start;
+  times->nodes = state.paths_.size();
+  times->edges = state.edges_.size();
+  return true;
+}
+
+/// Return the first source of build.ninja that has a depfile, or "".
+string FindSource() {
+  RealDiskInterface disk_interface;
+  State state;
+  ManifestParser parser(&state, &disk_interface);
+  string err;
+  if (!parser.Load("build.ninja", &err))
+    return "";
+  for (vector<Edge*>::iterator e = state.edges_.begin();
+       e != state.edges_.end(); ++e) {
+    if (!(*e)->GetUnescapedDepfile().empty() && !(*e)->inputs_.empty())
+      return (*e)->inputs_[0]->path();
+  }
+  return "";
+}
+
+/// Write |path| again, so that it is newer than the outputs built from it.
+bool Touch(const string& path, string* err) {
+  RealDiskInterface disk_interface;
+  string contents;
+  if (disk_interface.ReadFile(path, &contents, err) != FileReader::Okay)
+    return false;
+  if (!disk_interface.WriteFile(path, contents)) {
+    *err = "writing " + path + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+}  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+  int targets = 200;
+  int repetitions = 5;
+  int opt;
+  while ((opt = getopt(argc, argv, const_cast<char*>("t:n:h"))) != -1) {
+    switch (opt) {
+    case 't':
+      targets = atoi(optarg);
+      break;
+    case 'n':
+      repetitions = atoi(optarg);
+      break;
+    case 'h':
+    default:
+      printf("usage: build_perftest [options]\n"
+"\n"
+"options:\n"
+"  -t N   build a manifest of N targets [default=200]\n"
+"  -n N   keep the fastest of N builds [default=5]\n"
+             );
+      return 1;
+    }
+  }
+  if (targets < 2 || repetitions < 1)
+    Fatal("-t must be at least 2, and -n at least 1");
+
+  // The manifest, sources, outputs and logs are written once for each size.
+  char dir[100];
+  snprintf(dir, sizeof(dir), "build/build_perftest_%d", targets);
+  RealDiskInterface disk_interface;
+  string err;
+  TimeStamp mtime = disk_interface.Stat(string(dir) + "/build.ninja", &err);
+  if (mtime == -1)
+    Fatal("%s", err.c_str());
+  if (mtime == 0) {
+    char command[200];
+    snprintf(command, sizeof(command),
+             "python misc/write_fake_manifests.py -t %d -s src %s", targets,
+             dir);
+    fprintf(stderr, "Creating manifest data...");
+    if (system(command) != 0)
+      Fatal("failed to run %s", command);
+    fprintf(stderr, "done.\n");
+  }
+  if (chdir(dir) < 0)
+    Fatal("chdir: %s", strerror(errno));
+
+  // Build everything, in case the logs or outputs aren't there yet.
+  Times times;
+  if (!RunBuild(&times, &err))
+    Fatal("initial build: %s", err.c_str());
+  string source = FindSource();
+  if (source.empty())
+    Fatal("no source with a depfile in build.ninja");
+
+  Times noop, touch_one;
+  for (int i = 0; i < repetitions; ++i) {
+    if (!RunBuild(&times, &err))
+      Fatal("no-op build: %s", err.c_str());
+    if (i == 0)
+      noop = times;
+    noop.Min(times);
+
+    if (!Touch(source, &err))
+      Fatal("%s", err.c_str());
+    if (!RunBuild(&times, &err))
+      Fatal("build after touching %s: %s", source.c_str(), err.c_str());
+    if (i == 0)
+      touch_one = times;
+    touch_one.Min(times);
+  }
+
+  printf("{\n");
+  printf("  \"targets\": %d,\n", targets);
+  printf("  \"nodes\": %zu,\n", noop.nodes);
+  printf("  \"edges\": %zu,\n", noop.edges);
+  printf("  \"repetitions\": %d,\n", repetitions);
+  noop.PrintJSON("noop", false);
+  touch_one.PrintJSON("touch_one", true);
+  printf("}\n");
+  return 0;
+}
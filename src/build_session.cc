@@ -0,0 +1,396 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "build_session.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "action_cache.h"
+#include "clparser.h"
+#include "debug_flags.h"
+#include "deps_log.h"
+#include "graph.h"
+#include "hash_log.h"
+#include "manifest_cache.h"
+#include "state.h"
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// How many times the manifest may be rebuilt before a build gives up.
+const int kCycleLimit = 100;
+
+}  // anonymous namespace
+
+/// Everything loaded from the build directory, replaced as a whole when
+/// the manifest changes.
+struct BuildSession::Loaded {
+  State state;
+  ManifestRecord record;
+  /// The "builddir" of the manifest, where the logs are.
+  string build_dir;
+  BuildLog build_log;
+  DepsLog deps_log;
+  HashLog hash_log;
+
+  string LogPath(const char* name) const {
+    return build_dir.empty() ? name : build_dir + "/" + name;
+  }
+};
+
+BuildSession::BuildSession(const BuildConfig& config,
+                           ManifestParserOptions parser_options)
+    : config_(config), parser_options_(parser_options), snapshots_(false),
+      snapshot_commands_(false), snapshot_epoch_(0) {}
+
+BuildSession::~BuildSession() {
+  Close();
+}
+
+bool BuildSession::Load(const string& manifest, string* err) {
+  manifest_ = manifest;
+  bool success = LoadAll(err);
+  PublishSnapshot();
+  return success;
+}
+
+bool BuildSession::LoadAll(string* err) {
+  Close();
+  loaded_.reset(new Loaded);
+  Loaded* loaded = loaded_.get();
+
+  LoadStatus status = ManifestCache::Load(
+      ManifestCache::kPath, manifest_, parser_options_, &disk_interface_,
+      &loaded->state, &loaded->record, err);
+  if (status == LOAD_ERROR) {
+    // Parsing the manifest again next time gets past it.
+    *err = string("loading ") + ManifestCache::kPath + ": " + *err;
+    disk_interface_.RemoveFile(ManifestCache::kPath);
+    Close();
+    return false;
+  }
+  if (status == LOAD_NOT_FOUND) {
+    err->clear();
+    ManifestParser parser(&loaded->state, &disk_interface_, parser_options_);
+    parser.set_record(&loaded->record);
+    if (!parser.Load(manifest_, err)) {
+      Close();
+      return false;
+    }
+    loaded->record.Stat(&disk_interface_);
+    string save_err;
+    if (!config_.dry_run &&
+        !ManifestCache::Save(ManifestCache::kPath, manifest_, parser_options_,
+                             loaded->state, loaded->record, &save_err)) {
+      Warning("saving %s: %s", ManifestCache::kPath, save_err.c_str());
+    }
+  }
+
+  loaded->build_dir = loaded->state.bindings_.LookupVariable("builddir");
+  if (!loaded->build_dir.empty() && !config_.dry_run &&
+      !disk_interface_.MakeDirs(loaded->build_dir + "/.") && errno != EEXIST) {
+    *err = "creating build directory " + loaded->build_dir + ": " +
+           strerror(errno);
+    Close();
+    return false;
+  }
+
+  // Load() can return a warning via err by returning LOAD_SUCCESS.
+  string path = loaded->LogPath(".ninja_log");
+  if (loaded->build_log.Load(path, err) == LOAD_ERROR) {
+    *err = "loading build log " + path + ": " + *err;
+    Close();
+    return false;
+  }
+  if (!err->empty())
+    Warning("%s", err->c_str());
+  err->clear();
+  if (!config_.dry_run && !loaded->build_log.OpenForWrite(path, *this, err)) {
+    *err = "opening build log: " + *err;
+    Close();
+    return false;
+  }
+
+  path = loaded->LogPath(".ninja_deps");
+  if (loaded->deps_log.Load(path, &loaded->state, err) == LOAD_ERROR) {
+    *err = "loading deps log " + path + ": " + *err;
+    Close();
+    return false;
+  }
+  if (!err->empty())
+    Warning("%s", err->c_str());
+  err->clear();
+  if (!config_.dry_run && !loaded->deps_log.OpenForWrite(path, err)) {
+    *err = "opening deps log: " + *err;
+    Close();
+    return false;
+  }
+
+  path = loaded->LogPath(".ninja_hashes");
+  if (loaded->hash_log.Load(path, err) == LOAD_ERROR) {
+    *err = "loading hash log " + path + ": " + *err;
+    Close();
+    return false;
+  }
+  if (!err->empty())
+    Warning("%s", err->c_str());
+  err->clear();
+  if (!config_.dry_run && !loaded->hash_log.OpenForWrite(path, err)) {
+    *err = "opening hash log: " + *err;
+    Close();
+    return false;
+  }
+
+  // The includes of deps = msvc, normalized by earlier builds.
+  if (!CLParser::LoadNormalizedIncludes(loaded->LogPath(".ninja_includes"),
+                                        err)) {
+    Warning("loading normalized includes: %s", err->c_str());
+  }
+  err->clear();
+  return true;
+}
+
+bool BuildSession::Refresh(string* err) {
+  bool success = Update(err);
+  PublishSnapshot();
+  return success;
+}
+
+bool BuildSession::Update(string* err) {
+  if (!loaded_)
+    return LoadAll(err);
+
+  for (int cycle = 1; cycle <= kCycleLimit; ++cycle) {
+    // What the last build found out about the files is stale by now.
+    loaded_->state.Reset();
+
+    if (loaded_->record.AnyChanged(&disk_interface_)) {
+      // Parse again only the subninjas that changed, if that will do.
+      ManifestParser parser(&loaded_->state, &disk_interface_,
+                            parser_options_);
+      if (parser.Reload(&loaded_->record, &disk_interface_)) {
+        loaded_->state.Reset();
+      } else if (!LoadAll(err)) {
+        return false;
+      }
+    }
+
+    bool rebuilt;
+    if (!RebuildManifest(&rebuilt, err)) {
+      *err = "rebuilding '" + manifest_ + "': " + *err;
+      Close();
+      return false;
+    }
+    if (!rebuilt)
+      return true;
+    // In dry_run mode the regeneration will succeed without changing the
+    // manifest forever.
+    if (config_.dry_run)
+      return true;
+  }
+
+  *err = "manifest '" + manifest_ + "' still dirty after " +
+         to_string(kCycleLimit) + " tries";
+  Close();
+  return false;
+}
+
+bool BuildSession::RebuildManifest(bool* rebuilt, string* err) {
+  *rebuilt = false;
+  string path = manifest_;
+  uint64_t slash_bits;  // Unused because this path is only used for lookup.
+  if (!CanonicalizePath(&path, &slash_bits, err))
+    return false;
+  State* state = &loaded_->state;
+  Node* node = state->LookupNode(path);
+  if (!node)
+    return true;
+
+  Builder builder(state, config_, &loaded_->build_log, &loaded_->deps_log,
+                  &disk_interface_);
+  builder.SetHashLog(&loaded_->hash_log);
+  if (!builder.AddTarget(node, err))
+    return err->empty();
+  if (builder.AlreadyUpToDate())
+    return true;
+  if (!builder.Build(err))
+    return false;
+
+  // The manifest was only rebuilt if it is now dirty (it may have been
+  // cleaned by a restat).
+  if (!node->dirty()) {
+    state->Reset();
+    return true;
+  }
+  *rebuilt = true;
+  return true;
+}
+
+State* BuildSession::state() {
+  return loaded_ ? &loaded_->state : NULL;
+}
+
+Node* BuildSession::LookupTarget(const string& name, string* err) {
+  if (!loaded_) {
+    *err = "nothing loaded";
+    return NULL;
+  }
+  string path = name;
+  uint64_t slash_bits;
+  if (!CanonicalizePath(&path, &slash_bits, err))
+    return NULL;
+
+  // Special syntax: "foo.cc^" means "the first output of foo.cc".
+  bool first_dependent = false;
+  if (!path.empty() && path[path.size() - 1] == '^') {
+    path.resize(path.size() - 1);
+    first_dependent = true;
+  }
+
+  State* state = &loaded_->state;
+  Node* node = state->LookupNode(path);
+  if (!node) {
+    *err =
+        "unknown target '" + Node::PathDecanonicalized(path, slash_bits) + "'";
+    if (Node* suggestion = state->SpellcheckNode(path))
+      *err += ", did you mean '" + suggestion->path() + "'?";
+    return NULL;
+  }
+  if (first_dependent) {
+    if (node->out_edges().empty() || node->out_edges()[0]->outputs_.empty()) {
+      *err = "'" + path + "' has no out edge";
+      return NULL;
+    }
+    node = node->out_edges()[0]->outputs_[0];
+  }
+  return node;
+}
+
+ExitStatus BuildSession::Build(const vector<string>& targets,
+                               CommandRunner* runner, BuildStatus* status,
+                               string* err) {
+  ExitStatus result = BuildTargets(targets, runner, status, err);
+  PublishSnapshot();
+  return result;
+}
+
+ExitStatus BuildSession::BuildTargets(const vector<string>& targets,
+                                      CommandRunner* runner,
+                                      BuildStatus* status, string* err) {
+  if (!Update(err))
+    return ExitFailure;
+
+  vector<Node*> nodes;
+  if (targets.empty()) {
+    nodes = loaded_->state.DefaultNodes(err);
+    if (!err->empty())
+      return ExitFailure;
+  }
+  for (vector<string>::const_iterator i = targets.begin();
+       i != targets.end(); ++i) {
+    Node* node = LookupTarget(*i, err);
+    if (!node)
+      return ExitFailure;
+    nodes.push_back(node);
+  }
+
+  disk_interface_.AllowStatCache(g_experimental_statcache);
+
+  Builder builder(&loaded_->state, config_, &loaded_->build_log,
+                  &loaded_->deps_log, &disk_interface_);
+  builder.SetHashLog(&loaded_->hash_log);
+  if (status)
+    builder.SetStatus(status);
+  builder.StatTargets(nodes);
+  for (vector<Node*>::iterator i = nodes.begin(); i != nodes.end(); ++i) {
+    // An up to date target isn't an error.
+    if (!builder.AddTarget(*i, err) && !err->empty())
+      return ExitFailure;
+  }
+
+  // Make sure restat rules do not see stale timestamps.
+  disk_interface_.AllowStatCache(false);
+
+  if (builder.AlreadyUpToDate())
+    return ExitSuccess;
+
+  if (runner)
+    builder.command_runner_.reset(runner);
+  bool success = builder.Build(err);
+  if (runner)
+    builder.command_runner_.release();
+  if (config_.action_cache)
+    config_.action_cache->Trim();
+  if (success)
+    return ExitSuccess;
+  if (err->find("interrupted by user") != string::npos)
+    return ExitInterrupted;
+  return ExitFailure;
+}
+
+void BuildSession::EnableSnapshots(bool commands) {
+  snapshots_ = true;
+  snapshot_commands_ = commands;
+  PublishSnapshot();
+}
+
+shared_ptr<const GraphSnapshot> BuildSession::snapshot() const {
+  lock_guard<mutex> lock(snapshot_mutex_);
+  return snapshot_;
+}
+
+void BuildSession::PublishSnapshot() {
+  shared_ptr<const GraphSnapshot> snapshot;
+  if (snapshots_ && loaded_) {
+    snapshot = make_shared<GraphSnapshot>(
+        &loaded_->state, &loaded_->deps_log, &loaded_->build_log,
+        snapshot_commands_, ++snapshot_epoch_);
+  }
+  // The snapshot replaced is freed out of the lock, or by its last reader.
+  lock_guard<mutex> lock(snapshot_mutex_);
+  snapshot_.swap(snapshot);
+}
+
+void BuildSession::Close() {
+  if (!loaded_)
+    return;
+  loaded_->build_log.Close();
+  loaded_->deps_log.Close();
+  string err;
+  if (!config_.dry_run &&
+      !CLParser::SaveNormalizedIncludes(loaded_->LogPath(".ninja_includes"),
+                                        &err)) {
+    Warning("saving normalized includes: %s", err.c_str());
+  }
+  loaded_.reset();
+}
+
+bool BuildSession::IsPathDead(StringPiece s) const {
+  vector<bool> dead;
+  FindDeadPaths(vector<StringPiece>(1, s), &dead);
+  return dead[0];
+}
+
+void BuildSession::FindDeadPaths(const vector<StringPiece>& paths,
+                                 vector<bool>* dead) const {
+  FindDeadOutputs(loaded_->state, disk_interface_, paths, dead);
+}
+
+Edge* BuildSession::EdgeForPath(StringPiece s) const {
+  Node* n = loaded_->state.LookupNode(s);
+  return n ? n->in_edge() : NULL;
+}
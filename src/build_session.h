@@ -0,0 +1,150 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_BUILD_SESSION_H_
+#define NINJA_BUILD_SESSION_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "build.h"
+#include "build_log.h"
+#include "disk_interface.h"
+#include "exit_status.h"
+#include "graph_snapshot.h"
+#include "manifest_parser.h"
+
+struct BuildStatus;
+struct CommandRunner;
+struct Node;
+struct State;
+
+/// The interface for programs that embed ninja, like an IDE server that
+/// builds on every save: a build directory loaded once, whose graph can
+/// then be queried and built again and again without paying for loading
+/// the manifest and the logs each time.
+///
+/// Like ninja itself, it works in the current directory, which must be
+/// the build directory while it's in use.  It is not thread-safe; calls
+/// must not overlap, except those to snapshot(): other threads may query
+/// the graph through the snapshots it publishes while a build runs.
+///
+///   BuildSession session(config);
+///   if (!session.Load("build.ninja", &err)) ...
+///   for (;;) {
+///     if (session.Build(targets, NULL, NULL, &err) != ExitSuccess) ...
+///   }
+struct BuildSession : public BuildLogUser {
+  explicit BuildSession(
+      const BuildConfig& config,
+      ManifestParserOptions parser_options = ManifestParserOptions());
+  virtual ~BuildSession();
+
+  /// Load |manifest|, from the manifest cache if it is up to date, and the
+  /// logs, which stay open for the builds to append to.
+  /// @return false on error, with nothing loaded.
+  bool Load(const std::string& manifest, std::string* err);
+
+  /// Bring what's loaded up to date with the disk: load the manifest again
+  /// if its files changed, and rebuild it first if it is out of date, as
+  /// ninja does before every build.  Build() does this first.
+  /// @return false on error, with nothing loaded.
+  bool Refresh(std::string* err);
+
+  /// Publish GraphSnapshots of the graph from now on, with the commands of
+  /// the edges if |commands| is set: after Load(), Refresh() and Build(),
+  /// and whenever PublishSnapshot() is called.  Taking one copies the whole
+  /// graph, so none are taken until this is called.
+  void EnableSnapshots(bool commands);
+
+  /// The snapshot published last, or NULL if there is none.  Unlike the
+  /// rest, this may be called from any thread, while the session is in
+  /// use; the snapshot stays valid as long as it's held.
+  std::shared_ptr<const GraphSnapshot> snapshot() const;
+
+  /// Publish a snapshot of the graph as it is now, if they're enabled and
+  /// something is loaded.  A BuildStatus may call this from its
+  /// notifications, while Build() runs, to publish the progress: the graph
+  /// is consistent then.
+  void PublishSnapshot();
+
+  bool loaded() const { return loaded_.get() != NULL; }
+
+  /// The loaded graph.  Refresh() and Build() may replace it, and with it
+  /// every Node and Edge.
+  State* state();
+
+  /// The node of target |name|, as ninja reads it from its command line:
+  /// |name| is canonicalized, and "foo.c^" stands for the first output of
+  /// foo.c.  @return NULL, saying why in |err|, if there is none.
+  Node* LookupTarget(const std::string& name, std::string* err);
+
+  /// Build |targets|, or the default targets if there are none.  The
+  /// commands run with |runner| if it's not NULL, as ninja runs them
+  /// otherwise, and the progress goes to |status| if it's not NULL, and is
+  /// printed otherwise.  Both stay the caller's.
+  /// @return ExitSuccess if the targets are up to date, with |err| saying
+  /// why if not.
+  ExitStatus Build(const std::vector<std::string>& targets,
+                   CommandRunner* runner, BuildStatus* status,
+                   std::string* err);
+
+  /// Close the logs and forget what was loaded.
+  void Close();
+
+  // BuildLogUser
+  virtual bool IsPathDead(StringPiece s) const;
+  virtual void FindDeadPaths(const std::vector<StringPiece>& paths,
+                             std::vector<bool>* dead) const;
+  virtual Edge* EdgeForPath(StringPiece s) const;
+
+ private:
+  struct Loaded;
+
+  /// Load manifest_ and the logs from scratch.
+  bool LoadAll(std::string* err);
+
+  /// Refresh(), without publishing a snapshot.
+  bool Update(std::string* err);
+
+  /// Build(), without publishing a snapshot.
+  ExitStatus BuildTargets(const std::vector<std::string>& targets,
+                          CommandRunner* runner, BuildStatus* status,
+                          std::string* err);
+
+  /// Rebuild the manifest if it is out of date, setting |rebuilt| if it
+  /// was.  @return false on error.
+  bool RebuildManifest(bool* rebuilt, std::string* err);
+
+  BuildConfig config_;
+  ManifestParserOptions parser_options_;
+  RealDiskInterface disk_interface_;
+  std::string manifest_;
+  std::unique_ptr<Loaded> loaded_;
+
+  bool snapshots_;
+  bool snapshot_commands_;
+  /// Counts the snapshots taken.
+  uint64_t snapshot_epoch_;
+  /// Guards |snapshot_|, which other threads read.
+  mutable std::mutex snapshot_mutex_;
+  std::shared_ptr<const GraphSnapshot> snapshot_;
+
+  BuildSession(const BuildSession& other);     // DO NOT IMPLEMENT
+  void operator=(const BuildSession& other);   // DO NOT IMPLEMENT
+};
+
+#endif  // NINJA_BUILD_SESSION_H_
@@ -0,0 +1,219 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "build_session.h"
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include <deque>
+
+#include "graph.h"
+#include "state.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+/// Writes the outputs of the commands instead of running them, with
+/// mtimes from the test's clock.
+struct TouchCommandRunner : public CommandRunner {
+  explicit TouchCommandRunner(time_t* now) : now_(now) {}
+
+  virtual bool CanRunMore() const { return true; }
+  virtual bool StartCommand(Edge* edge) {
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o) {
+      if (!disk_.WriteFile((*o)->path(), "") || !SetMTime((*o)->path()))
+        return false;
+    }
+    started_.push_back(edge->outputs_[0]->path());
+    running_.push_back(edge);
+    return true;
+  }
+  virtual bool WaitForCommand(Result* result, function<void()>) {
+    if (running_.empty())
+      return false;
+    result->edge = running_.front();
+    result->status = ExitSuccess;
+    running_.pop_front();
+    return true;
+  }
+
+  bool SetMTime(const string& path) {
+    utimbuf times;
+    times.actime = times.modtime = ++*now_;
+    return utime(path.c_str(), &times) == 0;
+  }
+
+  time_t* now_;
+  RealDiskInterface disk_;
+  deque<Edge*> running_;
+  /// The first output of each command started.
+  vector<string> started_;
+};
+
+/// Counts what the builds report, without printing anything.
+struct CountingStatus : public BuildStatus {
+  explicit CountingStatus(const BuildConfig& config)
+      : BuildStatus(config), started_(0), finished_(0) {}
+  virtual void PlanHasTotalEdges(int) {}
+  virtual void BuildEdgeStarted(const Edge*) { ++started_; }
+  virtual void BuildCommandReaped(const Edge*, bool) {}
+  virtual void BuildEdgeOutput(const Edge*, const string&) {}
+  virtual void BuildEdgeFinished(Edge*, bool, const string&, FILE*,
+                                 int* start_time, int* end_time) {
+    *start_time = *end_time = 0;
+    ++finished_;
+  }
+  virtual void BuildLoadDyndeps() {}
+  virtual void BuildStarted() {}
+  virtual void BuildFinished() {}
+  virtual void PrintStatusScrolling() {}
+
+  int started_;
+  int finished_;
+};
+
+struct BuildSessionTest : public testing::Test {
+  BuildSessionTest() : now_(1000000000), runner_(&now_), status_(config_) {}
+
+  virtual void SetUp() {
+    temp_dir_.CreateAndEnter("BuildSessionTest");
+    ASSERT_TRUE(Write("build.ninja",
+"rule touch\n"
+"  command = touch $out\n"
+"build out: touch in\n"
+"default out\n"));
+    ASSERT_TRUE(Write("in", ""));
+  }
+  virtual void TearDown() {
+    temp_dir_.Cleanup();
+  }
+
+  /// Write |path|, with a newer mtime than everything written before.
+  bool Write(const string& path, const string& contents) {
+    return disk_.WriteFile(path, contents) && runner_.SetMTime(path);
+  }
+
+  /// Build |targets|, returning the first outputs of the commands run.
+  vector<string> Build(BuildSession* session,
+                       const vector<string>& targets = vector<string>()) {
+    runner_.started_.clear();
+    string err;
+    EXPECT_EQ(ExitSuccess, session->Build(targets, &runner_, &status_, &err));
+    EXPECT_EQ("", err);
+    return runner_.started_;
+  }
+
+  ScopedTempDir temp_dir_;
+  RealDiskInterface disk_;
+  time_t now_;
+  TouchCommandRunner runner_;
+  BuildConfig config_;
+  CountingStatus status_;
+};
+
+TEST_F(BuildSessionTest, BuildsAgainOnlyWhatChanged) {
+  BuildSession session(config_);
+  string err;
+  ASSERT_TRUE(session.Load("build.ninja", &err));
+  EXPECT_EQ("", err);
+  ASSERT_TRUE(session.state()->LookupNode("out") != NULL);
+
+  vector<string> built = Build(&session);
+  ASSERT_EQ(1u, built.size());
+  EXPECT_EQ("out", built[0]);
+  EXPECT_EQ(1, status_.started_);
+  EXPECT_EQ(1, status_.finished_);
+
+  // Nothing changed.
+  EXPECT_TRUE(Build(&session).empty());
+
+  ASSERT_TRUE(Write("in", "changed"));
+  built = Build(&session);
+  ASSERT_EQ(1u, built.size());
+  EXPECT_EQ("out", built[0]);
+}
+
+TEST_F(BuildSessionTest, ReloadsChangedManifest) {
+  BuildSession session(config_);
+  string err;
+  ASSERT_TRUE(session.Load("build.ninja", &err));
+  EXPECT_EQ(1u, Build(&session).size());
+
+  ASSERT_TRUE(Write("build.ninja",
+"rule touch\n"
+"  command = touch $out\n"
+"build out: touch in\n"
+"build out2: touch in\n"
+"default out out2\n"));
+  vector<string> built = Build(&session);
+  ASSERT_EQ(1u, built.size());
+  EXPECT_EQ("out2", built[0]);
+  EXPECT_TRUE(session.state()->LookupNode("out2") != NULL);
+}
+
+TEST_F(BuildSessionTest, LookupTarget) {
+  BuildSession session(config_);
+  string err;
+  ASSERT_TRUE(session.Load("build.ninja", &err));
+
+  Node* node = session.LookupTarget("./in^", &err);
+  ASSERT_TRUE(node != NULL);
+  EXPECT_EQ("out", node->path());
+
+  EXPECT_TRUE(session.LookupTarget("ot", &err) == NULL);
+  EXPECT_EQ("unknown target 'ot', did you mean 'out'?", err);
+
+  err.clear();
+  EXPECT_EQ(ExitFailure, session.Build(vector<string>(1, "ot"), &runner_,
+                                       &status_, &err));
+  EXPECT_EQ("unknown target 'ot', did you mean 'out'?", err);
+}
+
+TEST_F(BuildSessionTest, Snapshots) {
+  BuildSession session(config_);
+  string err;
+  ASSERT_TRUE(session.Load("build.ninja", &err));
+  EXPECT_TRUE(session.snapshot() == NULL);
+
+  session.EnableSnapshots(true);
+  shared_ptr<const GraphSnapshot> before = session.snapshot();
+  ASSERT_TRUE(before != NULL);
+  EXPECT_EQ(1u, before->epoch());
+  int out = before->LookupNode("out");
+  ASSERT_NE(-1, out);
+  EXPECT_FALSE(before->nodes()[out].logged);
+  int edge = before->nodes()[out].in_edge;
+  ASSERT_NE(-1, edge);
+  EXPECT_EQ("touch out", before->edges()[edge].command);
+
+  EXPECT_EQ(1u, Build(&session).size());
+  shared_ptr<const GraphSnapshot> after = session.snapshot();
+  ASSERT_TRUE(after != NULL);
+  EXPECT_GT(after->epoch(), before->epoch());
+  out = after->LookupNode("out");
+  ASSERT_NE(-1, out);
+  EXPECT_TRUE(after->nodes()[out].logged);
+  EXPECT_NE(0u, after->nodes()[out].command_hash);
+  // The earlier snapshot is as it was.
+  EXPECT_FALSE(before->nodes()[before->LookupNode("out")].logged);
+}
+
+}  // anonymous namespace
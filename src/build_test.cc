@@ -16,9 +16,13 @@
 
 #include <assert.h>
 
+#include <mutex>
+#include <thread>
+
 #include "build_log.h"
 #include "deps_log.h"
 #include "graph.h"
+#include "hash_log.h"
 #include "test.h"
 
 using namespace std;
@@ -199,6 +203,40 @@ TEST_F(PlanTest, DoubleDependent) {
   ASSERT_FALSE(edge);  // done
 }
 
+TEST_F(PlanTest, ManyInputs) {
+  // The edges ready last are those of the inputs checked first.
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build all: phony a1 a2 a3 | a4 || a5\n"
+"build a1: cat in\n"
+"build a2: cat in\n"
+"build a3: cat in\n"
+"build a4: cat in\n"
+"build a5: cat in\n"));
+  for (int i = 1; i <= 5; ++i)
+    GetNode("a" + to_string(i))->MarkDirty();
+  GetNode("all")->MarkDirty();
+
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  deque<Edge*> edges;
+  FindWorkSorted(&edges, 5);
+  for (int i = 4; i >= 0; --i) {
+    // Each one finished is checked off, whatever the order.
+    ASSERT_FALSE(plan_.FindWork());
+    plan_.EdgeFinished(edges[i], Plan::kEdgeSucceeded, &err);
+    ASSERT_EQ("", err);
+  }
+
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("all", edge->outputs_[0]->path());
+  plan_.EdgeFinished(edge, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(plan_.more_to_do());
+}
+
 void PlanTest::TestPoolWithDepthOne(const char* test_case) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_, test_case));
   GetNode("out1")->MarkDirty();
@@ -338,6 +376,118 @@ TEST_F(PlanTest, PoolsWithDepthTwo) {
   ASSERT_FALSE(plan_.FindWork());
 }
 
+TEST_F(PlanTest, PoolWithWeights) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"pool foobar\n"
+"  depth = 3\n"
+"rule poolcat\n"
+"  command = cat $in > $out\n"
+"  pool = foobar\n"
+"build heavy: poolcat in\n"
+"  pool_weight = 2\n"
+"build huge: poolcat in\n"
+"  pool_weight = 5\n"
+"build light1: poolcat in\n"
+"build light2: poolcat in\n"
+"build all: cat heavy huge light1 light2\n"));
+  GetNode("heavy")->MarkDirty();
+  GetNode("huge")->MarkDirty();
+  GetNode("light1")->MarkDirty();
+  GetNode("light2")->MarkDirty();
+  GetNode("all")->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  // Edges are let in while their weights fit in the depth.
+  deque<Edge*> edges;
+  FindWorkSorted(&edges, 2);
+  ASSERT_EQ("heavy", edges[0]->outputs_[0]->path());
+  ASSERT_EQ("light1", edges[1]->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+
+  plan_.EdgeFinished(edges[1], Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  Edge* light2 = plan_.FindWork();
+  ASSERT_TRUE(light2);
+  ASSERT_EQ("light2", light2->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+
+  // An edge heavier than the whole pool waits until it is idle.
+  plan_.EdgeFinished(edges[0], Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  ASSERT_FALSE(plan_.FindWork());
+  plan_.EdgeFinished(light2, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  Edge* huge = plan_.FindWork();
+  ASSERT_TRUE(huge);
+  ASSERT_EQ("huge", huge->outputs_[0]->path());
+  ASSERT_EQ(5, GetNode("huge")->in_edge()->pool()->current_use());
+
+  plan_.EdgeFinished(huge, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  Edge* last = plan_.FindWork();
+  ASSERT_TRUE(last);
+  ASSERT_EQ("all", last->outputs_[0]->path());
+}
+
+TEST_F(PlanTest, PoolWithResources) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"pool lto\n"
+"  depth = 0\n"
+"  resources = memory=16, cpus=8\n"
+"rule link\n"
+"  command = cat $in > $out\n"
+"  pool = lto\n"
+"  pool_resources = memory=12 cpus=2\n"
+"build big1: link in\n"
+"build big2: link in\n"
+"build small1: link in\n"
+"  pool_resources = memory=2, cpus=4\n"
+"build small2: link in\n"
+"  pool_resources = cpus=4\n"
+"build all: cat big1 big2 small1 small2\n"));
+  const char* outs[] = { "big1", "big2", "small1", "small2", "all" };
+  for (size_t i = 0; i < sizeof(outs) / sizeof(outs[0]); ++i)
+    GetNode(outs[i])->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  // big2 doesn't fit in memory next to big1, but small1 and small2 still
+  // run until the cpus are all taken.
+  deque<Edge*> edges;
+  FindWorkSorted(&edges, 2);
+  ASSERT_EQ("big1", edges[0]->outputs_[0]->path());
+  ASSERT_EQ("small1", edges[1]->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+
+  plan_.EdgeFinished(edges[1], Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  Edge* small2 = plan_.FindWork();
+  ASSERT_TRUE(small2);
+  ASSERT_EQ("small2", small2->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+
+  plan_.EdgeFinished(edges[0], Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  Edge* big2 = plan_.FindWork();
+  ASSERT_TRUE(big2);
+  ASSERT_EQ("big2", big2->outputs_[0]->path());
+  const Pool* pool = big2->pool();
+  ASSERT_EQ(12, pool->resources()[0].current_use);
+  ASSERT_EQ(6, pool->resources()[1].current_use);
+
+  plan_.EdgeFinished(small2, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  plan_.EdgeFinished(big2, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  ASSERT_EQ(0, pool->resources()[0].current_use);
+  Edge* last = plan_.FindWork();
+  ASSERT_TRUE(last);
+  ASSERT_EQ("all", last->outputs_[0]->path());
+}
+
 TEST_F(PlanTest, PoolWithRedundantEdges) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
     "pool compile\n"
@@ -466,6 +616,269 @@ TEST_F(PlanTest, PoolWithFailingEdge) {
   ASSERT_EQ(0, edge);
 }
 
+// Test that the edge at the head of the longest chain is started first.
+TEST_F(PlanTest, CriticalPathFirst) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build short: cat in\n"
+"build mid: cat in\n"
+"build long: cat mid\n"
+"build all: phony short long\n"));
+  GetNode("short")->MarkDirty();
+  GetNode("mid")->MarkDirty();
+  GetNode("long")->MarkDirty();
+  GetNode("all")->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+  plan_.PrepareQueue(NULL);
+
+  EXPECT_EQ(2, GetNode("mid")->in_edge()->critical_path_weight());
+  EXPECT_EQ(1, GetNode("long")->in_edge()->critical_path_weight());
+  EXPECT_EQ(1, GetNode("short")->in_edge()->critical_path_weight());
+
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("mid", edge->outputs_[0]->path());
+  edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("short", edge->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+}
+
+// Test that UpcomingEdges() lists the ready edges in FindWork() order.
+TEST_F(PlanTest, UpcomingEdges) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build short: cat in\n"
+"build mid: cat in\n"
+"build long: cat mid\n"
+"build all: phony short long\n"));
+  GetNode("short")->MarkDirty();
+  GetNode("mid")->MarkDirty();
+  GetNode("long")->MarkDirty();
+  GetNode("all")->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+  plan_.PrepareQueue(NULL);
+
+  vector<Edge*> edges;
+  plan_.UpcomingEdges(1, &edges);
+  ASSERT_EQ(1u, edges.size());
+  EXPECT_EQ("mid", edges[0]->outputs_[0]->path());
+  plan_.UpcomingEdges(5, &edges);
+  ASSERT_EQ(3u, edges.size());
+  EXPECT_EQ("mid", edges[1]->outputs_[0]->path());
+  EXPECT_EQ("short", edges[2]->outputs_[0]->path());
+
+  EXPECT_EQ(edges[1], plan_.FindWork());
+  edges.clear();
+  plan_.UpcomingEdges(5, &edges);
+  ASSERT_EQ(1u, edges.size());
+  EXPECT_EQ("short", edges[0]->outputs_[0]->path());
+}
+
+// Test that durations recorded in the build log determine the critical path.
+TEST_F(PlanTest, CriticalPathFromBuildLog) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build short: cat in\n"
+"build mid: cat in\n"
+"build long: cat mid\n"
+"build all: phony short long\n"));
+  GetNode("short")->MarkDirty();
+  GetNode("mid")->MarkDirty();
+  GetNode("long")->MarkDirty();
+  GetNode("all")->MarkDirty();
+
+  BuildLog log;
+  log.RecordCommand(GetNode("short")->in_edge(), 0, 100);
+  log.RecordCommand(GetNode("mid")->in_edge(), 0, 10);
+  log.RecordCommand(GetNode("long")->in_edge(), 10, 30);
+
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+  plan_.PrepareQueue(&log);
+
+  EXPECT_EQ(100, GetNode("short")->in_edge()->critical_path_weight());
+  EXPECT_EQ(30, GetNode("mid")->in_edge()->critical_path_weight());
+
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("short", edge->outputs_[0]->path());
+  edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("mid", edge->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+}
+
+// Test that the work left is tracked as edges finish, with the durations
+// smoothed over the runs in the build log.
+TEST_F(PlanTest, RemainingWork) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build short: cat in\n"
+"build mid: cat in\n"
+"build long: cat mid\n"
+"build all: phony short long\n"));
+  GetNode("short")->MarkDirty();
+  GetNode("mid")->MarkDirty();
+  GetNode("long")->MarkDirty();
+  GetNode("all")->MarkDirty();
+
+  BuildLog log;
+  log.RecordCommand(GetNode("short")->in_edge(), 0, 100);
+  log.RecordCommand(GetNode("mid")->in_edge(), 0, 10);
+  log.RecordCommand(GetNode("long")->in_edge(), 10, 30);
+  // One slow run of "mid" only moves its expected duration up a quarter of
+  // the way; one restored from the action cache doesn't move it.
+  log.RecordCommand(GetNode("mid")->in_edge(), 0, 50);
+  log.RecordCommand(GetNode("mid")->in_edge(), 50, 50, 0, ResourceUsage(),
+                    true);
+
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+  plan_.PrepareQueue(&log);
+
+  EXPECT_EQ(140, plan_.remaining_duration());
+  EXPECT_EQ(100, plan_.critical_path_remaining());
+
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("short", edge->outputs_[0]->path());
+  plan_.EdgeFinished(edge, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  EXPECT_EQ(40, plan_.remaining_duration());
+  EXPECT_EQ(40, plan_.critical_path_remaining());
+
+  edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("mid", edge->outputs_[0]->path());
+  plan_.EdgeFinished(edge, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  EXPECT_EQ(20, plan_.remaining_duration());
+  EXPECT_EQ(20, plan_.critical_path_remaining());
+}
+
+// Test that prioritized edges, and what they wait for, start before the
+// critical path.
+TEST_F(PlanTest, PriorityBeforeCriticalPath) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build short: cat in\n"
+"build mid: cat in\n"
+"build long: cat mid\n"
+"build test.o: cat test.cc\n"
+"build test: cat test.o\n"
+"  priority = 5\n"
+"build docs: cat docs.in\n"
+"  priority = -1\n"
+"build all: phony short long test docs\n"));
+  const char* outputs[] = { "short", "mid", "long", "test.o", "test", "docs",
+                            "all" };
+  for (size_t i = 0; i < sizeof(outputs) / sizeof(outputs[0]); ++i)
+    GetNode(outputs[i])->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+  plan_.PrepareQueue(NULL);
+
+  EXPECT_EQ(5, GetNode("test.o")->in_edge()->critical_path_priority());
+  EXPECT_EQ(0, GetNode("mid")->in_edge()->critical_path_priority());
+
+  const char* expected[] = { "test.o", "mid", "short", "docs" };
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+    Edge* edge = plan_.FindWork();
+    ASSERT_TRUE(edge);
+    EXPECT_EQ(expected[i], edge->outputs_[0]->path());
+  }
+  ASSERT_FALSE(plan_.FindWork());
+}
+
+// Test that a pool lets in its delayed edges by priority.
+TEST_F(PlanTest, PoolWithPriorities) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"pool one\n"
+"  depth = 1\n"
+"rule poolcat\n"
+"  command = cat $in > $out\n"
+"  pool = one\n"
+"build a: poolcat in\n"
+"build b: poolcat in\n"
+"build c: poolcat in\n"
+"  priority = 2\n"
+"build all: phony a b c\n"));
+  GetNode("a")->MarkDirty();
+  GetNode("b")->MarkDirty();
+  GetNode("c")->MarkDirty();
+  GetNode("all")->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+  plan_.PrepareQueue(NULL);
+
+  // The idle pool let in the first edge before the priorities were known.
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("a", edge->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+
+  const char* expected[] = { "c", "b" };
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+    plan_.EdgeFinished(edge, Plan::kEdgeSucceeded, &err);
+    ASSERT_EQ("", err);
+    edge = plan_.FindWork();
+    ASSERT_TRUE(edge);
+    EXPECT_EQ(expected[i], edge->outputs_[0]->path());
+    ASSERT_FALSE(plan_.FindWork());
+  }
+}
+
+TEST(ParallelismTunerTest, FollowsIdleTime) {
+  ParallelismTuner tuner(2, 4, 8);
+  EXPECT_EQ(4, tuner.parallelism());
+
+  CpuTimes times;
+  times.total = 1000;
+  times.idle = 500;
+  times.iowait = 0;
+  // The first sample only sets the baseline.
+  EXPECT_FALSE(tuner.Sample(times, 4));
+
+  // Half the CPUs idle, but already at the ceiling.
+  times.total += 1000;
+  times.idle += 500;
+  EXPECT_FALSE(tuner.Sample(times, 4));
+  EXPECT_EQ(4, tuner.parallelism());
+
+  // Fully busy: back off, but not below the floor.
+  times.total += 1000;
+  EXPECT_FALSE(tuner.Sample(times, 4));
+  EXPECT_EQ(3, tuner.parallelism());
+  times.total += 1000;
+  EXPECT_FALSE(tuner.Sample(times, 3));
+  times.total += 1000;
+  EXPECT_FALSE(tuner.Sample(times, 2));
+  EXPECT_EQ(2, tuner.parallelism());
+
+  // Idle with a free job slot: the jobs aren't the bottleneck.
+  times.total += 1000;
+  times.idle += 500;
+  EXPECT_FALSE(tuner.Sample(times, 1));
+  EXPECT_EQ(2, tuner.parallelism());
+
+  // Waiting for I/O counts as idle.
+  times.total += 1000;
+  times.idle += 300;
+  times.iowait += 300;
+  EXPECT_TRUE(tuner.Sample(times, 2));
+  EXPECT_EQ(3, tuner.parallelism());
+
+  // In between, it holds.
+  times.total += 1000;
+  times.idle += 100;
+  EXPECT_FALSE(tuner.Sample(times, 3));
+  EXPECT_EQ(3, tuner.parallelism());
+}
+
 /// Fake implementation of CommandRunner, useful for tests.
 struct FakeCommandRunner : public CommandRunner {
   explicit FakeCommandRunner(VirtualFileSystem* fs) :
@@ -473,14 +886,18 @@ struct FakeCommandRunner : public CommandRunner {
 
   // CommandRunner impl
   virtual bool CanRunMore() const;
+  virtual bool CanRunEdge(const Edge* edge) const;
   virtual bool StartCommand(Edge* edge);
   virtual bool WaitForCommand(Result* result, std::function<void()> update_func);
+  virtual bool TakeFinishedCommand(Result* result);
   virtual vector<Edge*> GetActiveEdges();
   virtual void Abort();
 
   vector<string> commands_ran_;
   vector<Edge*> active_edges_;
   size_t max_active_edges_;
+  /// If not empty, only one edge of this rule may be active at a time.
+  string one_at_a_time_rule_;
   VirtualFileSystem* fs_;
 };
 
@@ -579,8 +996,20 @@ bool FakeCommandRunner::CanRunMore() const {
   return active_edges_.size() < max_active_edges_;
 }
 
+bool FakeCommandRunner::CanRunEdge(const Edge* edge) const {
+  if (edge->rule().name() != one_at_a_time_rule_)
+    return true;
+  for (vector<Edge*>::const_iterator i = active_edges_.begin();
+       i != active_edges_.end(); ++i) {
+    if ((*i)->rule().name() == one_at_a_time_rule_)
+      return false;
+  }
+  return true;
+}
+
 bool FakeCommandRunner::StartCommand(Edge* edge) {
   assert(active_edges_.size() < max_active_edges_);
+  assert(CanRunEdge(edge));
   assert(find(active_edges_.begin(), active_edges_.end(), edge)
          == active_edges_.end());
   commands_ran_.push_back(edge->EvaluateCommand());
@@ -624,6 +1053,11 @@ bool FakeCommandRunner::StartCommand(Edge* edge) {
   return true;
 }
 
+bool FakeCommandRunner::TakeFinishedCommand(Result* result) {
+  // The active edges finished already.
+  return WaitForCommand(result, [] {});
+}
+
 bool FakeCommandRunner::WaitForCommand(Result* result, std::function<void()> update_func) {
   if (active_edges_.empty())
     return false;
@@ -651,6 +1085,10 @@ bool FakeCommandRunner::WaitForCommand(Result* result, std::function<void()> upd
     return true;
   }
 
+  // Commands writing their depfile to a descriptor depend on a header.
+  if (edge->GetDepfileFd() > 0)
+    result->depfile_content = edge->outputs_[0]->path() + ": header.h\n";
+
   if (edge->rule().name() == "cp_multi_msvc") {
     const std::string prefix = edge->GetBinding("msvc_deps_prefix");
     for (std::vector<Node*>::iterator in = edge->inputs_.begin();
@@ -767,6 +1205,55 @@ TEST_F(BuildTest, TwoStep) {
   EXPECT_EQ("cat cat1 cat2 > cat12", command_runner_.commands_ran_[4]);
 }
 
+TEST_F(BuildTest, StreamScan) {
+  string err;
+  builder_.AddTargetToScan(GetNode("cat12"));
+  EXPECT_FALSE(builder_.AlreadyUpToDate());
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(3u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cat cat1 cat2 > cat12", command_runner_.commands_ran_[2]);
+  EXPECT_EQ("[3/3]", builder_.status_->FormatProgressStatus("[%s/%t]",
+      BuildStatus::kEdgeStarted));
+
+  // Up to date, the build scans and runs nothing.
+  state_.Reset();
+  builder_.AddTargetToScan(GetNode("cat12"));
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(3u, command_runner_.commands_ran_.size());
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+}
+
+TEST_F(BuildTest, StreamScanStartsBeforeScanEnds) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build a: cat in\n"
+"build b: cat missing\n"));
+  fs_.Create("in", "");
+
+  // The command of the first target starts before the scan of the second
+  // finds the error.
+  string err;
+  builder_.AddTargetToScan(GetNode("a"));
+  builder_.AddTargetToScan(GetNode("b"));
+  EXPECT_FALSE(builder_.Build(&err));
+  EXPECT_EQ("'missing', needed by 'b', missing and no known rule to make it",
+            err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cat in > a", command_runner_.commands_ran_[0]);
+}
+
+TEST_F(BuildTest, Prefetch) {
+  config_.prefetch_budget = 1 << 20;
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("cat12", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(3u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cat cat1 cat2 > cat12", command_runner_.commands_ran_[2]);
+}
+
 TEST_F(BuildTest, TwoOutputs) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule touch\n"
@@ -1193,6 +1680,32 @@ TEST_F(BuildTest, SwallowFailures) {
   ASSERT_EQ("subcommands failed", err);
 }
 
+TEST_F(BuildTest, FailFast) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule fail\n"
+"  command = fail\n"
+"build a1: cat in1\n"
+"build b2: fail\n"
+"build c3: cat in1\n"
+"build all: phony a1 b2 c3\n"));
+  command_runner_.max_active_edges_ = 2;
+  config_.fail_fast = true;
+  config_.failures_allowed = 11;
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("all", &err));
+  ASSERT_EQ("", err);
+
+  // b2 fails while a1 runs: a1 is aborted and its output removed, and c3
+  // never starts, even though -k 11 would allow it.
+  EXPECT_FALSE(builder_.Build(&err));
+  EXPECT_EQ("subcommand failed", err);
+  EXPECT_EQ(2u, command_runner_.commands_ran_.size());
+  EXPECT_TRUE(command_runner_.active_edges_.empty());
+  EXPECT_EQ(1u, fs_.files_removed_.count("a1"));
+  EXPECT_EQ(0u, fs_.files_created_.count("c3"));
+}
+
 TEST_F(BuildTest, SwallowFailuresLimit) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule fail\n"
@@ -1263,6 +1776,57 @@ TEST_F(BuildTest, PoolEdgesReadyButNotWanted) {
   EXPECT_GE(save_state.LookupPool("some_pool")->current_use(), 0);
 }
 
+TEST_F(BuildTest, EdgesHeldBackByRunner) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule touch\n"
+"  command = touch $out\n"
+"build a1: cat in\n"
+"build a2: cat in\n"
+"build b: touch in\n"
+"build all: phony a1 a2 b\n"));
+  fs_.Create("in", "");
+
+  // The runner takes one "cat" at a time, like it would take a limited
+  // number of remote commands; the other edges keep it busy meanwhile.
+  command_runner_.max_active_edges_ = 3;
+  command_runner_.one_at_a_time_rule_ = "cat";
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("all", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(3u, command_runner_.commands_ran_.size());
+  EXPECT_GT(fs_.Stat("a1", &err), 0);
+  EXPECT_GT(fs_.Stat("a2", &err), 0);
+}
+
+TEST_F(BuildTest, ReapsFinishedCommandsBeforeStartingMore) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build a: cat in\n"
+"build b: cat in\n"
+"build c: cat a\n"
+"build d: cat b\n"
+"build e: cat d\n"
+"build all: phony c e\n"));
+  fs_.Create("in", "");
+  command_runner_.max_active_edges_ = 2;
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("all", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+
+  // a and b finished together, so d, on the longer path, starts before c.
+  ASSERT_EQ(5u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cat in > b", command_runner_.commands_ran_[0]);
+  EXPECT_EQ("cat in > a", command_runner_.commands_ran_[1]);
+  EXPECT_EQ("cat b > d", command_runner_.commands_ran_[2]);
+  EXPECT_EQ("cat a > c", command_runner_.commands_ran_[3]);
+  EXPECT_EQ("cat d > e", command_runner_.commands_ran_[4]);
+}
+
 struct BuildWithLogTest : public BuildTest {
   BuildWithLogTest() {
     builder_.SetBuildLog(&build_log_);
@@ -1437,6 +2001,87 @@ TEST_F(BuildWithLogTest, RestatTest) {
   ASSERT_EQ(2u, command_runner_.commands_ran_.size());
 }
 
+TEST_F(BuildWithLogTest, RestatFanOut) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule true\n"
+"  command = true\n"
+"  restat = 1\n"
+"build out1: true in\n"
+"build out2: true in\n"
+"build a: cat out1 out2\n"
+"build b: cat out2 out1\n"
+"build c: cat out1 out2 in2\n"
+"build d: cat a\n"
+"build all: phony b c d\n"));
+
+  fs_.Create("out1", "");
+  fs_.Create("out2", "");
+  fs_.Create("in2", "");
+  fs_.Tick();
+  fs_.Create("in", "");
+
+  // Build once for the commands in the log.
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("all", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+
+  fs_.Tick();
+  fs_.Create("in", "");
+  fs_.Create("in2", "");
+
+  // Neither out1 nor out2 change, which cancels a, b and d once both are
+  // clean, but not c, whose other input changed.
+  EXPECT_TRUE(builder_.AddTarget("all", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(3u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("true", command_runner_.commands_ran_[0]);
+  EXPECT_EQ("true", command_runner_.commands_ran_[1]);
+  EXPECT_EQ("cat out1 out2 in2 > c", command_runner_.commands_ran_[2]);
+}
+
+TEST_F(BuildWithLogTest, StreamScanRestat) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule true\n"
+"  command = true\n"
+"  restat = 1\n"
+"rule cc\n"
+"  command = cc\n"
+"  restat = 1\n"
+"build out1: cc in\n"
+"build out2: true out1\n"
+"build out3: cat out2\n"));
+
+  fs_.Create("out1", "");
+  fs_.Create("out2", "");
+  fs_.Create("out3", "");
+  fs_.Tick();
+  fs_.Create("in", "");
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out3", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+
+  // out2 runs while out3 is scanned, and out3 is cleaned as without the
+  // streaming.
+  fs_.Tick();
+  fs_.Create("in", "");
+  builder_.AddTargetToScan(GetNode("out3"));
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cc", command_runner_.commands_ran_[0]);
+  EXPECT_EQ("true", command_runner_.commands_ran_[1]);
+}
+
 TEST_F(BuildWithLogTest, RestatMissingFile) {
   // If a restat rule doesn't create its output, and the output didn't
   // exist before the rule was run, consider that behavior equivalent
@@ -1520,6 +2165,52 @@ TEST_F(BuildWithLogTest, RestatSingleDependentOutputDirty) {
 
 // Test scenario, in which an input file is removed, but output isn't changed
 // https://github.com/ninja-build/ninja/issues/295
+TEST_F(BuildWithLogTest, HashInputs) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cp\n"
+"  command = cp $in $out\n"
+"  hash_inputs = 1\n"
+"build out: cp in\n"));
+
+  HashLog hash_log;
+  builder_.SetHashLog(&hash_log);
+  fs_.Create("in", "contents");
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(1u, command_runner_.commands_ran_.size());
+
+  // Rewriting the input with the same contents doesn't rebuild.
+  fs_.Tick();
+  fs_.Create("in", "contents");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+
+  // Changing them does.
+  fs_.Tick();
+  fs_.Create("in", "other contents");
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder_.AlreadyUpToDate());
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(1u, command_runner_.commands_ran_.size());
+
+  // So does going back to the contents of the first build.
+  fs_.Tick();
+  fs_.Create("in", "contents");
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder_.AlreadyUpToDate());
+}
+
 TEST_F(BuildWithLogTest, RestatMissingInput) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
     "rule true\n"
@@ -1698,6 +2389,47 @@ TEST_F(BuildTest, RspFileFailure) {
   ASSERT_EQ("Another very long command", fs_.files_["out.rsp"].contents);
 }
 
+// Test that a kept RSP file stays after the command, and is only written
+// when its content changes.
+TEST_F(BuildTest, RspFileKeep) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+    "rule cat_rsp\n"
+    "  command = cat $rspfile > $out\n"
+    "  rspfile = $out.rsp\n"
+    "  rspfile_content = $long_command\n"
+    "  rspfile_keep = 1\n"
+    "build out1: cat_rsp in\n"
+    "  long_command = Some very long command\n"
+    "build out2: cat_rsp in\n"
+    "  long_command = Another very long command\n"));
+
+  fs_.Create("out1.rsp", "Some very long command");
+  fs_.Create("out2.rsp", "Some very long command");
+  fs_.Tick();
+  fs_.Create("in", "");
+  fs_.Tick();
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out1", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+
+  size_t files_removed = fs_.files_removed_.size();
+
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, command_runner_.commands_ran_.size());
+
+  // The unchanged RSP file wasn't written again, the changed one was.
+  EXPECT_EQ(1, fs_.files_["out1.rsp"].mtime);
+  EXPECT_EQ(3, fs_.files_["out2.rsp"].mtime);
+  EXPECT_EQ("Another very long command", fs_.files_["out2.rsp"].contents);
+
+  // Neither was removed.
+  EXPECT_EQ(files_removed, fs_.files_removed_.size());
+}
+
 // Test that contents of the RSP file behaves like a regular part of
 // command line, i.e. triggers a rebuild if changed
 TEST_F(BuildWithLogTest, RspFileCmdLineChange) {
@@ -1853,6 +2585,58 @@ TEST_F(BuildTest, StatusFormatReplacePlaceholder) {
                 BuildStatus::kEdgeStarted));
 }
 
+TEST_F(BuildTest, StatusFormatRemainingTime) {
+  EXPECT_EQ("[E?/C?]",
+            status_.FormatProgressStatus("[E%E/C%C]",
+                BuildStatus::kEdgeStarted));
+  status_.SetParallelism(4);
+  status_.PlanHasRemainingWork(20000, 3000);
+  EXPECT_EQ("[E5.0/C3.0]",
+            status_.FormatProgressStatus("[E%E/C%C]",
+                BuildStatus::kEdgeStarted));
+  // The longest chain left can't be split over the jobs.
+  status_.PlanHasRemainingWork(8000, 3000);
+  EXPECT_EQ("[E3.0/C3.0]",
+            status_.FormatProgressStatus("[E%E/C%C]",
+                BuildStatus::kEdgeStarted));
+}
+
+/// Records the frames of the scrolling status rather than writing them.
+struct FrameRecordingStatus : public BuildStatus {
+  explicit FrameRecordingStatus(const BuildConfig& config)
+      : BuildStatus(config) {}
+  virtual void WriteFrame(const string& frame) { frames_.push_back(frame); }
+  vector<string> frames_;
+};
+
+TEST_F(BuildTest, StatusScrollingFrames) {
+  FrameRecordingStatus status(config_);
+  status.PlanHasTotalEdges(3);
+  status.DrawScrollingStatus(1000);
+  ASSERT_EQ(1u, status.frames_.size());
+
+  // A change within a frame's time of the frame on screen isn't drawn...
+  status.BuildEdgeStarted(GetNode("cat1")->in_edge());
+  status.DrawScrollingStatus(1010);
+  EXPECT_EQ(1u, status.frames_.size());
+  // ...until the next update after it, even with nothing else new, so
+  // that the last change is drawn too.
+  status.DrawScrollingStatus(1050);
+  ASSERT_EQ(2u, status.frames_.size());
+  EXPECT_NE(status.frames_[0], status.frames_[1]);
+
+  // The same frame isn't drawn again.
+  status.DrawScrollingStatus(2000);
+  EXPECT_EQ(2u, status.frames_.size());
+
+  // Once cleared, it's drawn again right away.
+  status.ClearScrollingOutput();
+  ASSERT_EQ(3u, status.frames_.size());
+  status.DrawScrollingStatus(2001);
+  ASSERT_EQ(4u, status.frames_.size());
+  EXPECT_EQ(status.frames_[1], status.frames_[3]);
+}
+
 TEST_F(BuildTest, FailedDepsParse) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build bad_deps.o: cat in1\n"
@@ -2356,6 +3140,46 @@ TEST_F(BuildWithDepsLogTest, RestatDepfileDependencyDepsLog) {
   }
 }
 
+TEST_F(BuildWithDepsLogTest, DepfileFd) {
+  string err;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n"
+"  command = cc -MF /dev/fd/$depfile_fd $in\n"
+"  depfile_fd = 3\n"
+"  deps = gcc\n"
+"build foo.o: cc foo.c\n"
+"build bad.o: cc foo.c\n"
+"  depfile_fd = 2\n"));
+  fs_.Create("foo.c", "");
+
+  DepsLog deps_log;
+  ASSERT_TRUE(deps_log.OpenForWrite("ninja_deps", &err));
+  ASSERT_EQ("", err);
+  Builder builder(&state_, config_, NULL, &deps_log, &fs_);
+  builder.command_runner_.reset(&command_runner_);
+  EXPECT_TRUE(builder.AddTarget("foo.o", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cc -MF /dev/fd/3 foo.c", command_runner_.commands_ran_[0]);
+
+  // The deps came from memory, with no depfile to read or remove.
+  DepsLog::Deps* deps = deps_log.GetDeps(GetNode("foo.o"));
+  ASSERT_TRUE(deps != NULL);
+  ASSERT_EQ(1, deps->node_count);
+  EXPECT_EQ("header.h", deps->nodes[0]->path());
+  EXPECT_TRUE(fs_.files_removed_.empty());
+
+  EXPECT_TRUE(builder.AddTarget("bad.o", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder.Build(&err));
+  EXPECT_EQ("invalid depfile_fd '2' for 'bad.o'", err);
+
+  deps_log.Close();
+  builder.command_runner_.release();
+}
+
 TEST_F(BuildWithDepsLogTest, DepFileOKDepsLog) {
   string err;
   const char* manifest =
@@ -2483,6 +3307,172 @@ TEST_F(BuildWithDepsLogTest, DepFileDepsLogCanonicalize) {
 }
 #endif
 
+/// A VirtualFileSystem that may be used from several threads, so that the
+/// builder reads the deps, stats the outputs and removes the files of the
+/// commands on the threads of its deps reader.  Counts the calls made
+/// there, by the path they were for.
+struct ThreadSafeFileSystem : public DiskInterface {
+  explicit ThreadSafeFileSystem(VirtualFileSystem* fs)
+      : fs_(fs), main_thread_(this_thread::get_id()) {}
+
+  virtual TimeStamp Stat(const string& path, string* err) const {
+    lock_guard<mutex> lock(mutex_);
+    Count("stat " + path);
+    if (path == failing_stat_ && fs_->files_.count(path)) {
+      *err = "stat failed";
+      return -1;
+    }
+    return fs_->Stat(path, err);
+  }
+  virtual bool IsStatThreadSafe() const { return true; }
+  virtual bool IsReadThreadSafe() const { return true; }
+  virtual bool MakeDir(const string& path) {
+    lock_guard<mutex> lock(mutex_);
+    return fs_->MakeDir(path);
+  }
+  virtual bool WriteFile(const string& path, const string& contents) {
+    lock_guard<mutex> lock(mutex_);
+    return fs_->WriteFile(path, contents);
+  }
+  virtual Status ReadFile(const string& path, string* contents,
+                          string* err) {
+    lock_guard<mutex> lock(mutex_);
+    Count("read " + path);
+    return fs_->ReadFile(path, contents, err);
+  }
+  virtual int RemoveFile(const string& path) {
+    lock_guard<mutex> lock(mutex_);
+    Count("remove " + path);
+    return fs_->RemoveFile(path);
+  }
+  virtual bool IsRemoveThreadSafe() const { return true; }
+
+  /// Whether |call|, like "stat out", was made off the main thread.
+  bool OffMainThread(const string& call) const {
+    lock_guard<mutex> lock(mutex_);
+    return calls_off_main_thread_.count(call) != 0;
+  }
+
+  /// Stat() fails for this path once it exists.
+  string failing_stat_;
+
+ private:
+  void Count(const string& call) const {
+    if (this_thread::get_id() != main_thread_)
+      calls_off_main_thread_.insert(call);
+  }
+
+  VirtualFileSystem* fs_;
+  mutable mutex mutex_;
+  thread::id main_thread_;
+  mutable set<string> calls_off_main_thread_;
+};
+
+/// Builds through a file system the deps reader uses.  The commands of the
+/// tests depend on each other, so that the fake runner, which uses the
+/// VirtualFileSystem directly, never runs while the deps reader does.
+struct BuildWithDepsReaderTest : public BuildTest {
+  BuildWithDepsReaderTest() : disk_(&fs_) {}
+
+  virtual void SetUp() {
+    BuildTest::SetUp();
+    temp_dir_.CreateAndEnter("BuildWithDepsReaderTest");
+  }
+
+  virtual void TearDown() {
+    temp_dir_.Cleanup();
+  }
+
+  ScopedTempDir temp_dir_;
+  ThreadSafeFileSystem disk_;
+};
+
+TEST_F(BuildWithDepsReaderTest, RestatUnchangedOutput) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule true\n"
+"  command = true\n"
+"  restat = 1\n"
+"build out1: true in\n"
+"build out2: cat out1\n"));
+  fs_.Create("out1", "");
+  fs_.Create("out2", "");
+  fs_.Tick();
+  fs_.Create("in", "");
+
+  Builder builder(&state_, config_, NULL, NULL, &disk_);
+  builder.command_runner_.reset(&command_runner_);
+  string err;
+  EXPECT_TRUE(builder.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder.Build(&err));
+  EXPECT_EQ("", err);
+  builder.command_runner_.release();
+
+  // out1 kept its mtime, as the deps reader found, so out2 isn't rebuilt.
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("true", command_runner_.commands_ran_[0]);
+  EXPECT_TRUE(disk_.OffMainThread("stat out1"));
+}
+
+TEST_F(BuildWithDepsReaderTest, RemovesRspfileAndDepfile) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cat_rsp\n"
+"  command = cat $rspfile > $out\n"
+"  rspfile = $out.rsp\n"
+"  rspfile_content = $in\n"
+"  depfile = $out.d\n"
+"  deps = gcc\n"
+"build out: cat_rsp in\n"));
+  fs_.Create("in", "");
+  fs_.Create("out.d", "out: header.h\n");
+
+  DepsLog deps_log;
+  string err;
+  ASSERT_TRUE(deps_log.OpenForWrite("ninja_deps", &err));
+  ASSERT_EQ("", err);
+  Builder builder(&state_, config_, NULL, &deps_log, &disk_);
+  builder.command_runner_.reset(&command_runner_);
+  EXPECT_TRUE(builder.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder.Build(&err));
+  EXPECT_EQ("", err);
+  builder.command_runner_.release();
+
+  EXPECT_EQ(1u, fs_.files_created_.count("out.rsp"));
+  EXPECT_EQ(1u, fs_.files_removed_.count("out.rsp"));
+  EXPECT_EQ(1u, fs_.files_removed_.count("out.d"));
+  DepsLog::Deps* deps = deps_log.GetDeps(GetNode("out"));
+  ASSERT_TRUE(deps);
+  ASSERT_EQ(1, deps->node_count);
+  EXPECT_EQ("header.h", deps->nodes[0]->path());
+  EXPECT_TRUE(disk_.OffMainThread("read out.d"));
+  EXPECT_TRUE(disk_.OffMainThread("stat out"));
+  EXPECT_TRUE(disk_.OffMainThread("remove out.rsp"));
+  EXPECT_TRUE(disk_.OffMainThread("remove out.d"));
+  deps_log.Close();
+}
+
+TEST_F(BuildWithDepsReaderTest, StatFailure) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out1: cat in\n"
+"build out2: cat out1\n"));
+  fs_.Create("in", "");
+  disk_.failing_stat_ = "out1";
+
+  Builder builder(&state_, config_, NULL, NULL, &disk_);
+  builder.command_runner_.reset(&command_runner_);
+  string err;
+  EXPECT_TRUE(builder.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder.Build(&err));
+  EXPECT_EQ("stat failed", err);
+  builder.command_runner_.release();
+
+  // The build stops at the output that couldn't be stat'ed.
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_TRUE(disk_.OffMainThread("stat out1"));
+}
+
 /// Check that a restat rule doesn't clear an edge if the depfile is missing.
 /// Follows from: https://github.com/ninja-build/ninja/issues/603
 TEST_F(BuildTest, RestatMissingDepfile) {
@@ -20,24 +20,35 @@
 
 using namespace std;
 
-const char kPath[] =
-    "../../third_party/WebKit/Source/WebCore/"
-    "platform/leveldb/LevelDBWriteBatch.cpp";
+namespace {
 
-int main() {
+// An already canonical path, which takes the fast path, and one that
+// has to be rewritten.
+const char* const kPaths[] = {
+  "../../third_party/WebKit/Source/WebCore/"
+  "platform/leveldb/LevelDBWriteBatch.cpp",
+  "../../third_party/WebKit/Source/WebCore/"
+  "platform/./leveldb/../leveldb/LevelDBWriteBatch.cpp",
+};
+
+typedef bool (*CanonicalizeFunc)(char* path, size_t* len,
+                                 uint64_t* slash_bits, string* err);
+
+/// Time |func| on |path|, printing the result as |name|.
+void Time(const char* name, CanonicalizeFunc func, const char* path) {
   vector<int> times;
   string err;
 
   char buf[200];
-  size_t len = strlen(kPath);
-  strcpy(buf, kPath);
-
   for (int j = 0; j < 5; ++j) {
     const int kNumRepetitions = 2000000;
     int64_t start = GetTimeMillis();
     uint64_t slash_bits;
     for (int i = 0; i < kNumRepetitions; ++i) {
-      CanonicalizePath(buf, &len, &slash_bits, &err);
+      // Restore the input, as canonicalizing it may rewrite it.
+      size_t len = strlen(path);
+      memcpy(buf, path, len + 1);
+      func(buf, &len, &slash_bits, &err);
     }
     int delta = (int)(GetTimeMillis() - start);
     times.push_back(delta);
@@ -54,6 +65,29 @@ int main() {
       max = times[i];
   }
 
-  printf("min %dms  max %dms  avg %.1fms\n",
-         min, max, total / times.size());
+  printf("%-8s min %dms  max %dms  avg %.1fms\n",
+         name, min, max, total / times.size());
+}
+
+}  // namespace
+
+int main() {
+  for (size_t i = 0; i < sizeof(kPaths) / sizeof(kPaths[0]); ++i) {
+    // Both versions must agree before comparing their speed.
+    string fast = kPaths[i], scalar = kPaths[i];
+    size_t fast_len = fast.size(), scalar_len = scalar.size();
+    uint64_t fast_bits, scalar_bits;
+    string err;
+    CanonicalizePath(&fast[0], &fast_len, &fast_bits, &err);
+    CanonicalizePathScalar(&scalar[0], &scalar_len, &scalar_bits, &err);
+    if (fast != scalar || fast_len != scalar_len || fast_bits != scalar_bits) {
+      fprintf(stderr, "mismatch canonicalizing %s\n", kPaths[i]);
+      return 1;
+    }
+
+    printf("%s\n", kPaths[i]);
+    Time("fast", CanonicalizePath, kPaths[i]);
+    Time("scalar", CanonicalizePathScalar, kPaths[i]);
+  }
+  return 0;
 }
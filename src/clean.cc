@@ -17,13 +17,35 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <map>
+#include <set>
+
 #include "disk_interface.h"
 #include "graph.h"
+#include "metrics.h"
+#include "parallel.h"
 #include "state.h"
 #include "util.h"
 
 using namespace std;
 
+namespace {
+
+/// Files are removed on this many threads, as removing one mostly waits on
+/// the file system.
+const int kRemoveThreads = 16;
+
+string DirName(const string& path) {
+#ifdef _WIN32
+  string::size_type slash_pos = path.find_last_of("/\\");
+#else
+  string::size_type slash_pos = path.find_last_of('/');
+#endif
+  return slash_pos == string::npos ? string() : path.substr(0, slash_pos);
+}
+
+}  // namespace
+
 Cleaner::Cleaner(State* state,
                  const BuildConfig& config,
                  DiskInterface* disk_interface)
@@ -35,10 +57,6 @@ Cleaner::Cleaner(State* state,
     status_(0) {
 }
 
-int Cleaner::RemoveFile(const string& path) {
-  return disk_interface_->RemoveFile(path);
-}
-
 bool Cleaner::FileExists(const string& path) {
   string err;
   TimeStamp mtime = disk_interface_->Stat(path, &err);
@@ -56,17 +74,48 @@ void Cleaner::Report(const string& path) {
 void Cleaner::Remove(const string& path) {
   if (!IsAlreadyRemoved(path)) {
     removed_.insert(path);
+    to_remove_.push_back(path);
+  }
+}
+
+void Cleaner::RemoveQueued() {
+  METRIC_RECORD("clean remove");
+  // Remove the files of each directory together.
+  map<string, vector<size_t> > dirs;
+  for (size_t i = 0; i < to_remove_.size(); ++i)
+    dirs[DirName(to_remove_[i])].push_back(i);
+  vector<const vector<size_t>*> groups;
+  for (map<string, vector<size_t> >::iterator i = dirs.begin();
+       i != dirs.end(); ++i)
+    groups.push_back(&i->second);
+
+  bool thread_safe = config_.dry_run ? disk_interface_->IsStatThreadSafe()
+                                     : disk_interface_->IsRemoveThreadSafe();
+  vector<int> results(to_remove_.size());
+  ParallelFor(groups.size(), thread_safe ? kRemoveThreads : 1,
+              [&](size_t g) {
+    const vector<size_t>& group = *groups[g];
     if (config_.dry_run) {
-      if (FileExists(path))
-        Report(path);
-    } else {
-      int ret = RemoveFile(path);
-      if (ret == 0)
-        Report(path);
-      else if (ret == -1)
-        status_ = 1;
+      for (size_t i = 0; i < group.size(); ++i)
+        results[group[i]] = FileExists(to_remove_[group[i]]) ? 0 : 1;
+      return;
     }
+    vector<string> paths;
+    for (size_t i = 0; i < group.size(); ++i)
+      paths.push_back(to_remove_[group[i]]);
+    vector<int> group_results;
+    disk_interface_->RemoveFiles(paths, &group_results);
+    for (size_t i = 0; i < group.size(); ++i)
+      results[group[i]] = group_results[i];
+  });
+
+  for (size_t i = 0; i < to_remove_.size(); ++i) {
+    if (results[i] == 0)
+      Report(to_remove_[i]);
+    else if (results[i] == -1)
+      status_ = 1;
   }
+  to_remove_.clear();
 }
 
 bool Cleaner::IsAlreadyRemoved(const string& path) {
@@ -111,7 +160,7 @@ int Cleaner::CleanAll(bool generator) {
     if ((*e)->is_phony())
       continue;
     // Do not remove generator's files unless generator specified.
-    if (!generator && (*e)->GetBindingBool("generator"))
+    if (!generator && (*e)->GetBindingBool(kSymbolGenerator))
       continue;
     for (vector<Node*>::iterator out_node = (*e)->outputs_.begin();
          out_node != (*e)->outputs_.end(); ++out_node) {
@@ -120,6 +169,7 @@ int Cleaner::CleanAll(bool generator) {
 
     RemoveEdgeFiles(*e);
   }
+  RemoveQueued();
   PrintFooter();
   return status_;
 }
@@ -133,6 +183,7 @@ int Cleaner::CleanDead(const BuildLog::Entries& entries) {
       Remove(i->first.AsString());
     }
   }
+  RemoveQueued();
   PrintFooter();
   return status_;
 }
@@ -165,6 +216,7 @@ int Cleaner::CleanTarget(Node* target) {
   PrintHeader();
   LoadDyndeps();
   DoCleanTarget(target);
+  RemoveQueued();
   PrintFooter();
   return status_;
 }
@@ -206,6 +258,7 @@ int Cleaner::CleanTargets(int target_count, char* targets[]) {
       }
     }
   }
+  RemoveQueued();
   PrintFooter();
   return status_;
 }
@@ -232,6 +285,7 @@ int Cleaner::CleanRule(const Rule* rule) {
   PrintHeader();
   LoadDyndeps();
   DoCleanRule(rule);
+  RemoveQueued();
   PrintFooter();
   return status_;
 }
@@ -268,6 +322,7 @@ int Cleaner::CleanRules(int rule_count, char* rules[]) {
       status_ = 1;
     }
   }
+  RemoveQueued();
   PrintFooter();
   return status_;
 }
@@ -276,18 +331,23 @@ void Cleaner::Reset() {
   status_ = 0;
   cleaned_files_count_ = 0;
   removed_.clear();
+  to_remove_.clear();
   cleaned_.clear();
 }
 
 void Cleaner::LoadDyndeps() {
   // Load dyndep files that exist, before they are cleaned.
+  vector<Node*> dyndeps;
+  set<Node*> seen;
   for (vector<Edge*>::iterator e = state_->edges_.begin();
        e != state_->edges_.end(); ++e) {
-    if (Node* dyndep = (*e)->dyndep_) {
-      // Capture and ignore errors loading the dyndep file.
-      // We clean as much of the graph as we know.
-      std::string err;
-      dyndep_loader_.LoadDyndeps(dyndep, &err);
-    }
+    Node* dyndep = (*e)->dyndep_;
+    if (dyndep && dyndep->dyndep_pending() && seen.insert(dyndep).second)
+      dyndeps.push_back(dyndep);
   }
+  // Ignore errors loading the dyndep files.
+  // We clean as much of the graph as we know.
+  vector<DyndepFile> ddfs;
+  vector<string> errs;
+  dyndep_loader_.LoadDyndeps(dyndeps, &ddfs, &errs);
 }
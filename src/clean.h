@@ -17,6 +17,7 @@
 
 #include <set>
 #include <string>
+#include <vector>
 
 #include "build.h"
 #include "dyndep.h"
@@ -74,15 +75,16 @@ struct Cleaner {
   }
 
  private:
-  /// Remove the file @a path.
-  /// @return whether the file has been removed.
-  int RemoveFile(const std::string& path);
   /// @returns whether the file @a path exists.
   bool FileExists(const std::string& path);
   void Report(const std::string& path);
 
-  /// Remove the given @a path file only if it has not been already removed.
+  /// Queue the given @a path file for removal only if it has not been
+  /// already queued.
   void Remove(const std::string& path);
+  /// Remove the queued files, on several threads, then report them in the
+  /// order they were queued.
+  void RemoveQueued();
   /// @return whether the given @a path has already been removed.
   bool IsAlreadyRemoved(const std::string& path);
   /// Remove the depfile and rspfile for an Edge.
@@ -102,6 +104,8 @@ struct Cleaner {
   const BuildConfig& config_;
   DyndepLoader dyndep_loader_;
   std::set<std::string> removed_;
+  /// The files to remove, in the order they were found.
+  std::vector<std::string> to_remove_;
   std::set<Node*> cleaned_;
   int cleaned_files_count_;
   DiskInterface* disk_interface_;
@@ -16,16 +16,20 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <errno.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "metrics.h"
 #include "string_piece_util.h"
+#include "util.h"
 
 #ifdef _WIN32
+#include <mutex>
+#include <unordered_map>
+
 #include "includes_normalize.h"
 #include "string_piece.h"
-#else
-#include "util.h"
 #endif
 
 using namespace std;
@@ -38,6 +42,136 @@ bool EndsWith(const string& input, const string& needle) {
           input.substr(input.size() - needle.size()) == needle);
 }
 
+#ifdef _WIN32
+/// The includes any CLParser has normalized so far, by their text in the
+/// cl.exe output, as most commands include the same headers.  The deps of
+/// several commands are parsed at once, so it is locked.
+struct NormalizedIncludes {
+  NormalizedIncludes() : normalizer_("."), added_(false) {
+    string err;
+    dir_ = IncludesNormalize::AbsPath(".", &err);
+  }
+
+  /// Set |normalized| to the normalized |include|, or to the empty string
+  /// for a system include.
+  bool Get(const string& include, string* normalized, string* err) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      unordered_map<string, string>::iterator i = cache_.find(include);
+      if (i != cache_.end()) {
+        *normalized = i->second;
+        return true;
+      }
+    }
+    if (!normalizer_.Normalize(include, normalized, err))
+      return false;
+    if (CLParser::IsSystemInclude(*normalized))
+      normalized->clear();
+    lock_guard<mutex> lock(mutex_);
+    cache_[include] = *normalized;
+    added_ = true;
+    return true;
+  }
+
+  /// The first line of the file Save() writes.  Normalizing only looks at
+  /// the text of the paths and the directory they're relative to, so the
+  /// entries hold as long as the directory is the same.
+  string Header() const {
+    return "# ninja normalized includes v1\t" + dir_;
+  }
+
+  bool Load(const string& path, string* err) {
+    string contents;
+    int ret = ReadFile(path, &contents, err);
+    if (ret == -ENOENT) {
+      err->clear();
+      return true;
+    }
+    if (ret < 0)
+      return false;
+    string header = Header();
+    if (contents.compare(0, header.size(), header) != 0 ||
+        contents.size() == header.size() || contents[header.size()] != '\n')
+      return true;  // Written elsewhere; start over.
+
+    lock_guard<mutex> lock(mutex_);
+    size_t start = header.size() + 1;
+    for (;;) {
+      // Each line holds an include, a tab, and the include normalized.
+      size_t end = contents.find('\n', start);
+      if (end == string::npos)
+        break;  // Done, or truncated.
+      size_t tab = contents.find('\t', start);
+      if (tab < end) {
+        cache_.insert(make_pair(contents.substr(start, tab - start),
+                                contents.substr(tab + 1, end - tab - 1)));
+      }
+      start = end + 1;
+    }
+    return true;
+  }
+
+  bool Save(const string& path, string* err) {
+    lock_guard<mutex> lock(mutex_);
+    if (!added_)
+      return true;
+    string contents = Header() + '\n';
+    for (unordered_map<string, string>::const_iterator i = cache_.begin();
+         i != cache_.end(); ++i) {
+      contents += i->first;
+      contents += '\t';
+      contents += i->second;
+      contents += '\n';
+    }
+
+    // Write it all under another name first, so that an interrupted write
+    // leaves no truncated file behind.
+    string temp_path = path + ".tmp";
+    FILE* f = fopen(temp_path.c_str(), "wb");
+    if (!f) {
+      *err = strerror(errno);
+      return false;
+    }
+    if (fwrite(contents.data(), contents.size(), 1, f) < 1) {
+      *err = strerror(errno);
+      fclose(f);
+      unlink(temp_path.c_str());
+      return false;
+    }
+    if (fclose(f) != 0) {
+      *err = strerror(errno);
+      unlink(temp_path.c_str());
+      return false;
+    }
+    if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+      *err = strerror(errno);
+      return false;
+    }
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+      *err = strerror(errno);
+      return false;
+    }
+    added_ = false;
+    return true;
+  }
+
+  static NormalizedIncludes* Instance() {
+    // Ninja changes directory, if at all, before it runs any command.
+    static NormalizedIncludes instance;
+    return &instance;
+  }
+
+ private:
+  IncludesNormalize normalizer_;
+  /// The absolute path of the directory the includes are relative to.
+  string dir_;
+  mutex mutex_;
+  unordered_map<string, string> cache_;
+  /// Whether cache_ has entries that weren't loaded or saved.
+  bool added_;
+};
+#endif
+
 }  // anonymous namespace
 
 // static
@@ -76,6 +210,23 @@ bool CLParser::FilterInputFilename(string line) {
 }
 
 // static
+bool CLParser::LoadNormalizedIncludes(const string& path, string* err) {
+#ifdef _WIN32
+  return NormalizedIncludes::Instance()->Load(path, err);
+#else
+  return true;
+#endif
+}
+
+// static
+bool CLParser::SaveNormalizedIncludes(const string& path, string* err) {
+#ifdef _WIN32
+  return NormalizedIncludes::Instance()->Save(path, err);
+#else
+  return true;
+#endif
+}
+
 bool CLParser::Parse(const string& output, const string& deps_prefix,
                      string* filtered_output, string* err) {
   METRIC_RECORD("CLParser::Parse");
@@ -84,7 +235,7 @@ bool CLParser::Parse(const string& output, const string& deps_prefix,
   assert(&output != filtered_output);
   size_t start = 0;
 #ifdef _WIN32
-  IncludesNormalize normalizer(".");
+  NormalizedIncludes* normalized_includes = NormalizedIncludes::Instance();
 #endif
 
   while (start < output.size()) {
@@ -97,17 +248,19 @@ bool CLParser::Parse(const string& output, const string& deps_prefix,
     if (!include.empty()) {
       string normalized;
 #ifdef _WIN32
-      if (!normalizer.Normalize(include, &normalized, err))
+      if (!normalized_includes->Get(include, &normalized, err))
         return false;
+      if (!normalized.empty())
+        includes_.insert(normalized);
 #else
       // TODO: should this make the path relative to cwd?
       normalized = include;
       uint64_t slash_bits;
       if (!CanonicalizePath(&normalized, &slash_bits, err))
         return false;
-#endif
       if (!IsSystemInclude(normalized))
         includes_.insert(normalized);
+#endif
     } else if (FilterInputFilename(line)) {
       // Drop it.
       // TODO: if we support compiling multiple output files in a single
@@ -39,6 +39,20 @@ struct CLParser {
   /// Exposed for testing.
   static bool FilterInputFilename(std::string line);
 
+  /// Add the includes normalized by earlier builds, which
+  /// SaveNormalizedIncludes() wrote to |path|, to those Parse() looks up
+  /// before normalizing an include.  The file is ignored if it is missing
+  /// or was written in another directory.  Only Windows normalizes the
+  /// includes; elsewhere this does nothing.
+  /// @return false on error, saying why in |err|.
+  static bool LoadNormalizedIncludes(const std::string& path,
+                                     std::string* err);
+
+  /// Write the includes normalized so far to |path|, if there are new ones.
+  /// @return false on error, saying why in |err|.
+  static bool SaveNormalizedIncludes(const std::string& path,
+                                     std::string* err);
+
   /// Parse the full output of cl, filling filtered_output with the text that
   /// should be printed (if any). Returns true on success, or false with err
   /// filled. output must not be the same object as filtered_object.
@@ -14,9 +14,14 @@
 
 #include "clparser.h"
 
+#include "disk_interface.h"
 #include "test.h"
 #include "util.h"
 
+#ifdef _WIN32
+#include "includes_normalize.h"
+#endif
+
 using namespace std;
 
 TEST(CLParserTest, ShowIncludes) {
@@ -117,3 +122,62 @@ TEST(CLParserTest, DuplicatedHeaderPathConverted) {
   ASSERT_EQ("", output);
   ASSERT_EQ(2u, parser.includes_.size());
 }
+
+TEST(CLParserTest, ParseAgain) {
+  // The second parser gets the includes the first one normalized.
+  const char kInput[] =
+      "Note: including file: c:\\Program Files\\foo.h\r\n"
+      "Note: including file: sub/./path.h\r\n";
+  for (int i = 0; i < 2; ++i) {
+    CLParser parser;
+    string output, err;
+    ASSERT_TRUE(parser.Parse(kInput, "", &output, &err));
+    ASSERT_EQ("", output);
+    ASSERT_EQ(1u, parser.includes_.size());
+    ASSERT_EQ("sub/path.h", *parser.includes_.begin());
+  }
+}
+
+#ifdef _WIN32
+TEST(CLParserTest, NormalizedIncludesFile) {
+  // The includes are normalized relative to the directory of the first
+  // parse, the current one.
+  CLParser first;
+  string output, err;
+  ASSERT_TRUE(first.Parse("Note: including file: sub/./first.h\r\n", "",
+                          &output, &err));
+  string header = "# ninja normalized includes v1\t" +
+                  IncludesNormalize::AbsPath(".", &err) + "\n";
+
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("CLParserTest");
+  RealDiskInterface disk;
+
+  // The entries of another directory are ignored.
+  ASSERT_TRUE(disk.WriteFile("includes",
+      "# ninja normalized includes v1\tc:/elsewhere\n"
+      "other.h\tfrom/elsewhere.h\n"));
+  ASSERT_TRUE(CLParser::LoadNormalizedIncludes("includes", &err));
+  EXPECT_EQ("", err);
+
+  ASSERT_TRUE(disk.WriteFile("includes", header + "loaded.h\tfrom/file.h\n"));
+  ASSERT_TRUE(CLParser::LoadNormalizedIncludes("includes", &err));
+  EXPECT_EQ("", err);
+
+  CLParser parser;
+  ASSERT_TRUE(parser.Parse("Note: including file: loaded.h\r\n"
+                           "Note: including file: other.h\r\n",
+                           "", &output, &err));
+  ASSERT_EQ(2u, parser.includes_.size());
+  EXPECT_EQ(1u, parser.includes_.count("from/file.h"));
+  EXPECT_EQ(0u, parser.includes_.count("from/elsewhere.h"));
+
+  ASSERT_TRUE(CLParser::SaveNormalizedIncludes("includes", &err));
+  string contents;
+  ASSERT_EQ(0, ReadFile("includes", &contents, &err));
+  EXPECT_EQ(0u, contents.find(header));
+  EXPECT_NE(string::npos, contents.find("\nsub/./first.h\tsub/first.h\n"));
+  EXPECT_NE(string::npos, contents.find("\nloaded.h\tfrom/file.h\n"));
+  temp_dir.Cleanup();
+}
+#endif
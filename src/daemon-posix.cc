@@ -0,0 +1,445 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "daemon.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// Largest request accepted from a client.
+const uint32_t kMaxRequestSize = 16 << 20;
+
+/// The process building for the current client, which receives the signals
+/// the client gets.
+volatile pid_t g_build_pid = 0;
+
+void ForwardSignal(int signum) {
+  if (g_build_pid > 0)
+    kill(g_build_pid, signum);
+}
+
+bool WriteAll(int fd, const void* data, size_t size) {
+  const char* p = (const char*)data;
+  while (size > 0) {
+    ssize_t len = write(fd, p, size);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      return false;
+    p += len;
+    size -= len;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, void* data, size_t size) {
+  char* p = (char*)data;
+  while (size > 0) {
+    ssize_t len = read(fd, p, size);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      return false;
+    p += len;
+    size -= len;
+  }
+  return true;
+}
+
+void SocketAddress(sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strncpy(addr->sun_path, kDaemonSocketName, sizeof(addr->sun_path) - 1);
+}
+
+/// Connect to the socket in the current directory.
+/// Returns the descriptor, or -1 with errno set.
+int ConnectToDaemon() {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  sockaddr_un addr;
+  SocketAddress(&addr);
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  return fd;
+}
+
+/// Whether the process at the other end of |fd| runs as our user.
+bool PeerIsSameUser(int fd) {
+#if defined(__linux__)
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+    return false;
+  return cred.uid == getuid();
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+      defined(__NetBSD__)
+  uid_t uid;
+  gid_t gid;
+  if (getpeereid(fd, &uid, &gid) < 0)
+    return false;
+  return uid == getuid();
+#else
+  // The socket is only accessible to our user, see Listen().
+  return true;
+#endif
+}
+
+}  // namespace
+
+bool DaemonForward(const DaemonRequest& request, int* exit_code,
+                   string* err) {
+  int fd = ConnectToDaemon();
+  if (fd < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  string payload;
+  request.Encode(&payload);
+  uint32_t size = (uint32_t)payload.size();
+
+  // The size goes out along with our stdin, stdout and stderr.
+  int fds[3] = { 0, 1, 2 };
+  char control[CMSG_SPACE(sizeof(fds))];
+  memset(control, 0, sizeof(control));
+  iovec iov = { &size, sizeof(size) };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(fd, &msg, 0);
+  } while (sent < 0 && errno == EINTR);
+  int32_t pid;
+  if (sent != (ssize_t)sizeof(size) ||
+      !WriteAll(fd, payload.data(), payload.size()) ||
+      !ReadAll(fd, &pid, sizeof(pid))) {
+    *err = "daemon closed the connection";
+    close(fd);
+    return false;
+  }
+
+  // From here on the build is running in the daemon; hand interruptions to
+  // it, and let it decide how to stop.
+  g_build_pid = pid;
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = ForwardSignal;
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGTERM, &act, NULL);
+  sigaction(SIGHUP, &act, NULL);
+
+  int32_t code;
+  if (!ReadAll(fd, &code, sizeof(code))) {
+    Error("lost the connection to the ninja daemon");
+    code = 1;
+  }
+  close(fd);
+  *exit_code = code;
+  return true;
+}
+
+DaemonServer::DaemonServer()
+    : listen_fd_(-1), client_fd_(-1), socket_dev_(0), socket_ino_(0) {}
+
+DaemonServer::~DaemonServer() {
+  Close();
+}
+
+bool DaemonServer::Listen(string* err) {
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) {
+    *err = string("socket: ") + strerror(errno);
+    return false;
+  }
+  SetCloseOnExec(listen_fd_);
+
+  sockaddr_un addr;
+  SocketAddress(&addr);
+  for (int attempt = 0; ; ++attempt) {
+    // Only our user may connect and hand us builds to run.
+    mode_t old_umask = umask(077);
+    int ret = bind(listen_fd_, (sockaddr*)&addr, sizeof(addr));
+    umask(old_umask);
+    if (ret == 0)
+      break;
+    if (errno != EADDRINUSE || attempt > 0) {
+      *err = string("bind: ") + strerror(errno);
+      CloseDescriptors();
+      return false;
+    }
+    int fd = ConnectToDaemon();
+    if (fd >= 0) {
+      close(fd);
+      *err = "another daemon is serving this directory";
+      CloseDescriptors();
+      return false;
+    }
+    // Left behind by a daemon that died.
+    unlink(kDaemonSocketName);
+  }
+
+  struct stat st;
+  if (listen(listen_fd_, 16) < 0 || stat(kDaemonSocketName, &st) < 0) {
+    *err = string("listen: ") + strerror(errno);
+    CloseDescriptors();
+    unlink(kDaemonSocketName);
+    return false;
+  }
+  socket_dev_ = st.st_dev;
+  socket_ino_ = st.st_ino;
+  return true;
+}
+
+DaemonServer::AcceptResult DaemonServer::Accept(int timeout_ms, int watch_fd,
+                                                DaemonRequest* request,
+                                                string* err) {
+  pollfd fds[2] = { { listen_fd_, POLLIN, 0 }, { watch_fd, POLLIN, 0 } };
+  int ret;
+  do {
+    ret = poll(fds, watch_fd >= 0 ? 2 : 1, timeout_ms);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    *err = string("poll: ") + strerror(errno);
+    return kFailed;
+  }
+  if (ret == 0)
+    return kTimedOut;
+  if (!(fds[0].revents & POLLIN))
+    return kWatchReady;
+
+  client_fd_ = accept(listen_fd_, NULL, NULL);
+  if (client_fd_ < 0) {
+    *err = string("accept: ") + strerror(errno);
+    return kFailed;
+  }
+  SetCloseOnExec(client_fd_);
+  if (!PeerIsSameUser(client_fd_)) {
+    *err = "rejected a client run by another user";
+    close(client_fd_);
+    client_fd_ = -1;
+    return kFailed;
+  }
+
+  uint32_t size;
+  char control[CMSG_SPACE(sizeof(request->fds))];
+  iovec iov = { &size, sizeof(size) };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t received;
+  do {
+    received = recvmsg(client_fd_, &msg, 0);
+  } while (received < 0 && errno == EINTR);
+
+  cmsghdr* cmsg = received > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS &&
+      cmsg->cmsg_len == CMSG_LEN(sizeof(request->fds))) {
+    memcpy(request->fds, CMSG_DATA(cmsg), sizeof(request->fds));
+    for (int i = 0; i < 3; ++i)
+      SetCloseOnExec(request->fds[i]);
+  }
+
+  string payload;
+  bool valid = received == (ssize_t)sizeof(size) && request->fds[0] >= 0 &&
+               size <= kMaxRequestSize;
+  if (valid) {
+    payload.resize(size);
+    valid = ReadAll(client_fd_, &payload[0], size) &&
+            request->Decode(payload);
+  }
+  if (!valid) {
+    *err = "malformed request";
+    for (int i = 0; i < 3; ++i) {
+      if (request->fds[i] >= 0)
+        close(request->fds[i]);
+      request->fds[i] = -1;
+    }
+    close(client_fd_);
+    client_fd_ = -1;
+    return kFailed;
+  }
+  return kAccepted;
+}
+
+void DaemonServer::SendPid(int pid) {
+  int32_t value = pid;
+  WriteAll(client_fd_, &value, sizeof(value));
+}
+
+void DaemonServer::SendExitCode(int exit_code) {
+  int32_t value = exit_code;
+  WriteAll(client_fd_, &value, sizeof(value));
+  close(client_fd_);
+  client_fd_ = -1;
+}
+
+void DaemonServer::Reject() {
+  close(client_fd_);
+  client_fd_ = -1;
+}
+
+void DaemonServer::Close() {
+  if (listen_fd_ < 0)
+    return;
+  CloseDescriptors();
+  struct stat st;
+  if (stat(kDaemonSocketName, &st) == 0 &&
+      (unsigned long long)st.st_dev == socket_dev_ &&
+      (unsigned long long)st.st_ino == socket_ino_)
+    unlink(kDaemonSocketName);
+}
+
+void DaemonServer::CloseDescriptors() {
+  if (client_fd_ >= 0)
+    close(client_fd_);
+  if (listen_fd_ >= 0)
+    close(listen_fd_);
+  client_fd_ = listen_fd_ = -1;
+}
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher() : fd_(-1) {}
+
+FileWatcher::~FileWatcher() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool FileWatcher::Init(string* err) {
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0) {
+    *err = string("inotify_init1: ") + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool FileWatcher::Watch(const string& dir) {
+  const uint32_t kMask = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                         IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO |
+                         IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+  int wd = inotify_add_watch(fd_, dir.empty() ? "." : dir.c_str(), kMask);
+  if (wd < 0)
+    return false;
+  vector<string>& dirs = dirs_[wd];
+  if (find(dirs.begin(), dirs.end(), dir) == dirs.end())
+    dirs.push_back(dir);
+  return true;
+}
+
+bool FileWatcher::ReadChanges(vector<string>* changed, vector<string>* lost) {
+  bool complete = true;
+  for (;;) {
+    char buf[16 << 10] __attribute__((aligned(__alignof__(inotify_event))));
+    ssize_t len = read(fd_, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+
+    for (char* p = buf; p < buf + len; ) {
+      const inotify_event* event = (const inotify_event*)p;
+      p += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        complete = false;
+        continue;
+      }
+      map<int, vector<string> >::iterator i = dirs_.find(event->wd);
+      if (i == dirs_.end())
+        continue;
+      if (event->mask & IN_IGNORED) {
+        lost->insert(lost->end(), i->second.begin(), i->second.end());
+        dirs_.erase(i);
+        continue;
+      }
+      if (event->mask & IN_MOVE_SELF) {
+        // The watch follows the directory to its new name, under which our
+        // paths are wrong; IN_IGNORED reports it as lost.
+        inotify_rm_watch(fd_, event->wd);
+        continue;
+      }
+      if (event->len == 0)
+        continue;
+      for (vector<string>::iterator dir = i->second.begin();
+           dir != i->second.end(); ++dir) {
+        changed->push_back(dir->empty() ? string(event->name)
+                                        : *dir + "/" + event->name);
+      }
+    }
+  }
+  return complete;
+}
+
+#else  // !__linux__
+
+FileWatcher::FileWatcher() : fd_(-1) {}
+
+FileWatcher::~FileWatcher() {}
+
+bool FileWatcher::Init(string* err) {
+  *err = "file change notifications are not supported on this platform";
+  return false;
+}
+
+bool FileWatcher::Watch(const string& dir) {
+  return false;
+}
+
+bool FileWatcher::ReadChanges(vector<string>* changed, vector<string>* lost) {
+  return false;
+}
+
+#endif  // __linux__
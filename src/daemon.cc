@@ -0,0 +1,77 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "daemon.h"
+
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+const char kDaemonSocketName[] = ".ninja_daemon";
+
+namespace {
+
+// Both ends of the socket run on the same machine, so integers are
+// written in native byte order.
+
+void WriteU32(uint32_t value, string* data) {
+  data->append((const char*)&value, sizeof(value));
+}
+
+void WriteStrings(const vector<string>& strings, string* data) {
+  WriteU32((uint32_t)strings.size(), data);
+  for (vector<string>::const_iterator i = strings.begin();
+       i != strings.end(); ++i) {
+    WriteU32((uint32_t)i->size(), data);
+    data->append(*i);
+  }
+}
+
+bool ReadU32(const string& data, size_t* pos, uint32_t* value) {
+  if (data.size() - *pos < sizeof(*value))
+    return false;
+  memcpy(value, data.data() + *pos, sizeof(*value));
+  *pos += sizeof(*value);
+  return true;
+}
+
+bool ReadStrings(const string& data, size_t* pos, vector<string>* strings) {
+  uint32_t count;
+  if (!ReadU32(data, pos, &count))
+    return false;
+  strings->clear();
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t size;
+    if (!ReadU32(data, pos, &size) || data.size() - *pos < size)
+      return false;
+    strings->push_back(data.substr(*pos, size));
+    *pos += size;
+  }
+  return true;
+}
+
+}  // namespace
+
+void DaemonRequest::Encode(string* data) const {
+  data->clear();
+  WriteStrings(args, data);
+  WriteStrings(env, data);
+}
+
+bool DaemonRequest::Decode(const string& data) {
+  size_t pos = 0;
+  return ReadStrings(data, &pos, &args) && ReadStrings(data, &pos, &env) &&
+         pos == data.size();
+}
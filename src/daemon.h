@@ -0,0 +1,146 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_DAEMON_H_
+#define NINJA_DAEMON_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+/// Support for "ninja --daemon": a server process that keeps the loaded
+/// State, logs and file timestamps of one build directory in memory, and
+/// thin clients that forward their command line to it.
+///
+/// The daemon listens on a Unix socket named kDaemonSocketName in the
+/// directory it serves.  A client sends a DaemonRequest along with its
+/// stdin, stdout and stderr descriptors; the daemon answers with the pid
+/// of the process running the build (so that the client can forward
+/// signals to it) and, once the build is done, its exit code.
+
+/// Name of the socket a daemon listens on, in the directory it serves.
+extern const char kDaemonSocketName[];
+
+/// A build forwarded by a client.
+struct DaemonRequest {
+  DaemonRequest() { fds[0] = fds[1] = fds[2] = -1; }
+
+  /// Command-line arguments, not including argv[0].
+  std::vector<std::string> args;
+  /// Environment of the client, as "NAME=value" strings.
+  std::vector<std::string> env;
+  /// The client's stdin, stdout and stderr, received by the daemon.
+  int fds[3];
+
+  /// Serialize the arguments and environment into |data|.
+  void Encode(std::string* data) const;
+  /// Parse data written by Encode().
+  /// Returns false if |data| is malformed.
+  bool Decode(const std::string& data);
+};
+
+/// Forward |request| (and this process's stdin, stdout and stderr) to the
+/// daemon serving the current directory, and wait for the build to finish.
+/// Returns false and fills |err| if no daemon accepted the request, in which
+/// case the build should run in this process; otherwise sets |exit_code|.
+bool DaemonForward(const DaemonRequest& request, int* exit_code,
+                   std::string* err);
+
+/// The listening end of the daemon socket.
+struct DaemonServer {
+  DaemonServer();
+  ~DaemonServer();
+
+  /// Create the socket in the current directory.  Removes a stale socket
+  /// left behind by a daemon that died, but fails if another daemon is
+  /// serving the directory.
+  bool Listen(std::string* err);
+
+  enum AcceptResult {
+    kAccepted,
+    kWatchReady,
+    kTimedOut,
+    kFailed,
+  };
+  /// Wait up to |timeout_ms| for a request, or until |watch_fd| (if not -1)
+  /// becomes readable.  On kAccepted, |request| holds the request and the
+  /// connection stays open for SendPid() and SendExitCode().
+  AcceptResult Accept(int timeout_ms, int watch_fd, DaemonRequest* request,
+                      std::string* err);
+
+  /// Tell the client which process is running its build.
+  void SendPid(int pid);
+  /// Tell the client the build is done, and close the connection.
+  void SendExitCode(int exit_code);
+  /// Close the connection without running the build, so that the client
+  /// runs it by itself.
+  void Reject();
+
+  /// Close the listening socket and remove it, e.g. when exiting.
+  void Close();
+  /// Close the descriptors without removing the socket, e.g. in a child.
+  void CloseDescriptors();
+
+ private:
+  int listen_fd_;
+  int client_fd_;
+  /// The device and inode of the socket we created, so that Close() does
+  /// not remove a socket since replaced by another daemon.
+  unsigned long long socket_dev_;
+  unsigned long long socket_ino_;
+
+  // Unimplemented copy ctor and operator= ensure we don't close twice.
+  DaemonServer(const DaemonServer& other);      // DO NOT IMPLEMENT
+  void operator=(const DaemonServer& other);    // DO NOT IMPLEMENT
+};
+
+/// FileWatcher reports changes to the entries of a set of directories.
+/// It is only implemented on Linux (with inotify); elsewhere Init() fails.
+struct FileWatcher {
+  FileWatcher();
+  ~FileWatcher();
+
+  /// Start the watcher.  Returns false and fills |err| if change
+  /// notifications are not available.
+  bool Init(std::string* err);
+
+  /// Start watching the entries of directory |dir| ("" for the current
+  /// directory).  Returns false if |dir| can't be watched, e.g. because it
+  /// doesn't exist (yet).
+  bool Watch(const std::string& dir);
+
+  /// Read the pending notifications without blocking.  Appends the paths of
+  /// the entries that changed to |changed|, and the directories that are no
+  /// longer watched (because they were removed or renamed) to |lost|.
+  /// Returns false if notifications were dropped, in which case any path may
+  /// have changed.
+  bool ReadChanges(std::vector<std::string>* changed,
+                   std::vector<std::string>* lost);
+
+  /// The descriptor that becomes readable when notifications are pending,
+  /// or -1.
+  int fd() const { return fd_; }
+
+ private:
+  int fd_;
+  /// Maps watch descriptors to the directories they watch; a directory
+  /// reached through several paths (e.g. symlinks) has one descriptor.
+  std::map<int, std::vector<std::string> > dirs_;
+
+  // Unimplemented copy ctor and operator= ensure we don't close twice.
+  FileWatcher(const FileWatcher& other);        // DO NOT IMPLEMENT
+  void operator=(const FileWatcher& other);     // DO NOT IMPLEMENT
+};
+
+#endif  // NINJA_DAEMON_H_
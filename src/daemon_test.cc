@@ -0,0 +1,133 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "daemon.h"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "test.h"
+
+using namespace std;
+
+TEST(DaemonTest, RequestRoundTrip) {
+  DaemonRequest request;
+  request.args.push_back("-j4");
+  request.args.push_back("");
+  request.args.push_back(string("a\0b", 3));
+  request.env.push_back("PATH=/bin");
+
+  string data;
+  request.Encode(&data);
+  DaemonRequest decoded;
+  ASSERT_TRUE(decoded.Decode(data));
+  EXPECT_EQ(request.args, decoded.args);
+  EXPECT_EQ(request.env, decoded.env);
+}
+
+TEST(DaemonTest, RequestMalformed) {
+  DaemonRequest request;
+  request.args.push_back("all");
+  string data;
+  request.Encode(&data);
+
+  DaemonRequest decoded;
+  EXPECT_FALSE(decoded.Decode(data.substr(0, data.size() - 1)));
+  EXPECT_FALSE(decoded.Decode(data + "x"));
+  EXPECT_FALSE(decoded.Decode(""));
+}
+
+#ifndef _WIN32
+
+TEST(DaemonTest, ForwardWithoutDaemon) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("DaemonTest-ForwardWithoutDaemon");
+  DaemonRequest request;
+  int exit_code = -1;
+  string err;
+  EXPECT_FALSE(DaemonForward(request, &exit_code, &err));
+  EXPECT_NE("", err);
+  EXPECT_EQ(-1, exit_code);
+  temp_dir.Cleanup();
+}
+
+TEST(DaemonTest, ListenReplacesStaleSocket) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("DaemonTest-ListenReplacesStaleSocket");
+  string err;
+  {
+    DaemonServer server;
+    ASSERT_TRUE(server.Listen(&err));
+    DaemonServer other;
+    EXPECT_FALSE(other.Listen(&err));
+    EXPECT_EQ("another daemon is serving this directory", err);
+    // Leave the socket behind, as a daemon that died would.
+    server.CloseDescriptors();
+  }
+  struct stat st;
+  ASSERT_EQ(0, stat(kDaemonSocketName, &st));
+
+  {
+    DaemonServer server;
+    err.clear();
+    EXPECT_TRUE(server.Listen(&err));
+    EXPECT_EQ("", err);
+  }
+  EXPECT_NE(0, stat(kDaemonSocketName, &st));
+  temp_dir.Cleanup();
+}
+
+#endif  // !_WIN32
+
+#ifdef __linux__
+
+TEST(DaemonTest, FileWatcher) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("DaemonTest-FileWatcher");
+  ASSERT_EQ(0, mkdir("sub", 0777));
+
+  FileWatcher watcher;
+  string err;
+  ASSERT_TRUE(watcher.Init(&err));
+  EXPECT_TRUE(watcher.Watch(""));
+  EXPECT_TRUE(watcher.Watch("sub"));
+  EXPECT_FALSE(watcher.Watch("missing"));
+
+  vector<string> changed, lost;
+  EXPECT_TRUE(watcher.ReadChanges(&changed, &lost));
+  EXPECT_TRUE(changed.empty());
+
+  FILE* f = fopen("sub/file", "w");
+  ASSERT_TRUE(f != NULL);
+  fclose(f);
+  EXPECT_TRUE(watcher.ReadChanges(&changed, &lost));
+  EXPECT_TRUE(find(changed.begin(), changed.end(), "sub/file") !=
+              changed.end());
+  EXPECT_TRUE(lost.empty());
+
+  changed.clear();
+  ASSERT_EQ(0, unlink("sub/file"));
+  ASSERT_EQ(0, rmdir("sub"));
+  EXPECT_TRUE(watcher.ReadChanges(&changed, &lost));
+  EXPECT_TRUE(find(changed.begin(), changed.end(), "sub") != changed.end());
+  ASSERT_EQ(1u, lost.size());
+  EXPECT_EQ("sub", lost[0]);
+  temp_dir.Cleanup();
+}
+
+#endif  // __linux__
@@ -18,4 +18,10 @@ bool g_keep_depfile = false;
 
 bool g_keep_rsp = false;
 
+// Reading whole directories pays off on Windows.  Elsewhere a stat is about
+// as cheap as reading its directory entry, except on network file systems.
+#ifdef _WIN32
 bool g_experimental_statcache = true;
+#else
+bool g_experimental_statcache = false;
+#endif
@@ -64,6 +64,16 @@ bool DepfileParser::Parse(string* content, string* err) {
     for (;;) {
       // start: beginning of the current parsed span.
       const char* start = in;
+      // Jump over long runs of plain text (see below) before looking at
+      // the rest byte by byte.
+      in = const_cast<char*>(SkipPathCharBlocks(in, end));
+      if (in != start) {
+        int len = (int)(in - start);
+        if (out < start)
+          memmove(out, start, len);
+        out += len;
+        continue;
+      }
       char* yymarker = NULL;
       
     {
@@ -21,22 +21,36 @@
 
 using namespace std;
 
-int main(int argc, char* argv[]) {
-  if (argc < 2) {
-    printf("usage: %s <file1> <file2...>\n", argv[0]);
-    return 1;
+/// A depfile like those of sources including many headers with long
+/// paths, of about 300 KB.
+string GenerateDepfile() {
+  string depfile = "obj/third_party/blink/renderer/core/layout/layout_block.o:";
+  for (int i = 0; i < 2500; ++i) {
+    char path[200];
+    snprintf(path, sizeof(path),
+             " \\\n  ../../third_party/blink/renderer/platform/wtf/"
+             "allocator/partition_alloc_%d/include/heap_%d.h", i % 50, i);
+    depfile += path;
   }
+  depfile += "\n";
+  return depfile;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2)
+    printf("no file given, using a generated depfile\n");
+  const string generated = argc < 2 ? GenerateDepfile() : "";
 
   vector<float> times;
-  for (int i = 1; i < argc; ++i) {
-    const char* filename = argv[i];
+  for (int i = 1; i < argc || (argc < 2 && i == 1); ++i) {
+    const char* filename = argc < 2 ? "generated" : argv[i];
 
     for (int limit = 1 << 10; limit < (1<<20); limit *= 2) {
       int64_t start = GetTimeMillis();
       for (int rep = 0; rep < limit; ++rep) {
-        string buf;
+        string buf = generated;
         string err;
-        if (ReadFile(filename, &buf, &err) < 0) {
+        if (argc >= 2 && ReadFile(filename, &buf, &err) < 0) {
           printf("%s: %s\n", filename, err.c_str());
           return 1;
         }
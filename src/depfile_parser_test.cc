@@ -62,6 +62,24 @@ TEST_F(DepfileParserTest, Continuation) {
   EXPECT_EQ(2u, parser_.ins_.size());
 }
 
+// Paths spanning several 16-byte blocks, with an escape at each offset.
+TEST_F(DepfileParserTest, LongPaths) {
+  string input = "out.o:";
+  vector<string> expected;
+  for (int i = 0; i < 40; ++i) {
+    string prefix = "third_party/" + string(i, 'x');
+    input += " " + prefix + "\\ " + prefix + ".h";
+    expected.push_back(prefix + " " + prefix + ".h");
+  }
+  input += "\n";
+  string err;
+  EXPECT_TRUE(Parse(input.c_str(), &err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(expected.size(), parser_.ins_.size());
+  for (size_t i = 0; i < expected.size(); ++i)
+    EXPECT_EQ(expected[i], parser_.ins_[i].AsString());
+}
+
 TEST_F(DepfileParserTest, CarriageReturnContinuation) {
   string err;
   EXPECT_TRUE(Parse(
@@ -15,9 +15,16 @@
 #include "deps_log.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <thread>
+#include <unordered_map>
 #ifndef _WIN32
 #include <unistd.h>
 #elif defined(_MSC_VER) && (_MSC_VER < 1900)
@@ -25,9 +32,15 @@ typedef __int32 int32_t;
 typedef unsigned __int32 uint32_t;
 #endif
 
+#include "build_dir_lock.h"
 #include "graph.h"
+#include "hash_map.h"
+#include "mapped_file.h"
+#include "memory_stats.h"
 #include "metrics.h"
+#include "parallel.h"
 #include "state.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace std;
@@ -35,25 +48,354 @@ using namespace std;
 // The version is stored as 4 bytes after the signature and also serves as a
 // byte order mark. Signature and version combined are 16 bytes long.
 const char kFileSignature[] = "# ninjadeps\n";
-const int kCurrentVersion = 4;
+/// The path records hold State::Paths::Hash() of their path, so that
+/// version goes up with any change to it.
+const int kCurrentVersion = 6;
+const size_t kHeaderSize = sizeof(kFileSignature) - 1 + 4;
+/// The last version of fixed size fields, and the last one without hashes
+/// in the path records, which Load() still reads for OpenForWrite() to
+/// rewrite in the current one.
+const int kFixedSizeVersion = 4;
+const int kUnhashedVersion = 5;
 
 // Record size is currently limited to less than the full 32 bit, due to
 // internal buffers having to have this size.
 const unsigned kMaxRecordSize = (1 << 19) - 1;
 
+namespace {
+
+/// How many of the last deps records a new one may share ids with.
+const size_t kRecentRecords = 8;
+/// How many records sharing ids may chain, which bounds the work of
+/// loading one.
+const int kMaxSharingDepth = 8;
+/// The least number of ids worth sharing rather than writing again.
+const size_t kMinSharedIds = 4;
+
+template <typename T>
+void AppendRaw(string* out, const T& value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/// Append |value| to |out| in 7 bit groups, least significant first, the
+/// high bit of each byte set if more follow.
+void AppendVarint(string* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back((char)value);
+}
+
+/// Read a 4-byte field of a record; records may not be aligned if the log is
+/// damaged.
+unsigned ReadU32(const char* p) {
+  unsigned value;
+  memcpy(&value, p, 4);
+  return value;
+}
+
+/// Read what AppendVarint() wrote at |*p|, before |end|, and move past it.
+bool ReadVarint(const char** p, const char* end, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; *p < end && shift < 64; shift += 7) {
+    unsigned char byte = *(*p)++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+/// Append a record of |payload| to |out|: its size, doubled plus one for
+/// deps records, then the payload.  Sets errno on failure.
+bool AppendRecord(bool is_deps, const string& payload, string* out) {
+  if (payload.size() > kMaxRecordSize) {
+    errno = ERANGE;
+    return false;
+  }
+  AppendVarint(out, ((uint64_t)payload.size() << 1) | is_deps);
+  out->append(payload);
+  return true;
+}
+
+/// Append the record of |path| with id |id| to |out|.  Sets errno on
+/// failure.
+bool FormatPathRecord(const string& path, int id, string* out) {
+  assert(!path.empty());
+  // The id checks that the records are numbered as expected, which they
+  // wouldn't be if several processes wrote to the log concurrently.  The
+  // hash saves Load() hashing the path again.
+  string payload;
+  AppendVarint(&payload, id);
+  AppendRaw(&payload, (uint32_t)State::Paths::Hash(path));
+  payload.append(path);
+  return AppendRecord(false, payload, out);
+}
+
+/// Read the id, the path and its hash, if the log of |version| has it,
+/// of the path record of |size| bytes at |p|.
+bool ParsePathRecord(const char* p, unsigned size, int version, int* id,
+                     StringPiece* path, size_t* hash) {
+  const char* end = p + size;
+  uint64_t value;
+  if (!ReadVarint(&p, end, &value) || value > INT_MAX)
+    return false;
+  *id = (int)value;
+  if (version > kUnhashedVersion) {
+    if (end - p < 4)
+      return false;
+    *hash = ReadU32(p);
+    p += 4;
+  }
+  if (p == end)
+    return false;
+  *path = StringPiece(p, end - p);
+  return true;
+}
+
+/// The size of the file at |path|, or 0 if it can't be read.
+uint64_t FileSize(const string& path) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f)
+    return 0;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  return size > 0 ? size : 0;
+}
+
+}  // namespace
+
+/// Formats the deps records of a log, each with its input ids sorted and
+/// delta coded.  A record starting with the same ids as one of the last
+/// few refers to that one for them instead, if |refer|; other processes
+/// read the records of a shared log one at a time.
+struct DepsLog::Encoder {
+  explicit Encoder(bool refer = true) : refer_(refer), records_(0) {}
+
+  /// Append the deps record of |out_id| to |out|, with the sorted ids of
+  /// its inputs.  Sets errno on failure.
+  bool Format(int out_id, TimeStamp mtime, const vector<int>& ids,
+              string* out);
+
+ private:
+  struct Recent {
+    int out_id;
+    vector<int> ids;
+    /// How many records it refers to in a chain.
+    int depth;
+    /// Its number among the deps records.
+    uint64_t index;
+  };
+  deque<Recent> recent_;
+  bool refer_;
+  uint64_t records_;
+};
+
+bool DepsLog::Encoder::Format(int out_id, TimeStamp mtime,
+                              const vector<int>& ids, string* out) {
+  const Recent* base = NULL;
+  size_t shared = 0;
+  for (deque<Recent>::iterator r = recent_.begin(); r != recent_.end(); ++r) {
+    if (r->depth >= kMaxSharingDepth)
+      continue;
+    size_t common = 0;
+    size_t limit = min(ids.size(), r->ids.size());
+    while (common < limit && ids[common] == r->ids[common])
+      ++common;
+    if (common > shared) {
+      base = &*r;
+      shared = common;
+    }
+  }
+  if (shared < kMinSharedIds || !refer_) {
+    base = NULL;
+    shared = 0;
+  }
+
+  // [output id, mtime (8 bytes), distance back to the record shared with
+  // or 0, if shared: (its output id, ids shared), own id count, own ids
+  // as deltas from the id before].
+  string payload;
+  AppendVarint(&payload, out_id);
+  AppendRaw(&payload, (uint64_t)mtime);
+  AppendVarint(&payload, base ? records_ - base->index : 0);
+  if (base) {
+    // The output id checks that the record referred to is the one meant.
+    AppendVarint(&payload, base->out_id);
+    AppendVarint(&payload, shared);
+  }
+  AppendVarint(&payload, ids.size() - shared);
+  int last = shared ? ids[shared - 1] : 0;
+  for (size_t i = shared; i < ids.size(); ++i) {
+    AppendVarint(&payload, ids[i] - last);
+    last = ids[i];
+  }
+  if (!AppendRecord(true, payload, out))
+    return false;
+
+  Recent recent = { out_id, ids, base ? base->depth + 1 : 0, records_++ };
+  recent_.push_back(recent);
+  if (recent_.size() > kRecentRecords)
+    recent_.pop_front();
+  return true;
+}
+
+namespace {
+
+/// Write the record of |path| with id |id| to |f|.  Sets errno on failure.
+bool WritePathRecord(FILE* f, const string& path, int id) {
+  string record;
+  return FormatPathRecord(path, id, &record) &&
+         fwrite(record.data(), record.size(), 1, f) == 1;
+}
+
+/// Write the deps record of |out_id| to |f| through |encoder|, with the
+/// sorted ids of its inputs.  Sets errno on failure.
+bool WriteDepsRecord(FILE* f, DepsLog::Encoder* encoder, int out_id,
+                     TimeStamp mtime, const vector<int>& ids) {
+  string record;
+  return encoder->Format(out_id, mtime, ids, &record) &&
+         fwrite(record.data(), record.size(), 1, f) == 1;
+}
+
+/// Sorts nodes by id.
+bool IdLess(const Node* a, const Node* b) {
+  return a->id() < b->id();
+}
+
+}  // namespace
+
+/// A copy of the log being written by another thread.  It numbers the
+/// nodes itself, leaving their ids to the log in use until it's done.
+struct DepsLog::Recompaction {
+  struct Record {
+    Node* node;
+    TimeStamp mtime;
+    vector<Node*> inputs;
+  };
+
+  /// Write |records| to |temp_path|; run on |thread|.
+  void Write();
+
+  /// Write the deps of |node| to |f|, numbering the nodes not numbered yet.
+  bool WriteDeps(FILE* f, Node* node, TimeStamp mtime, int node_count,
+                 Node* const* inputs);
+
+  string path;
+  string temp_path;
+  /// The live entries when the recompaction started.
+  vector<Record> records;
+  /// The nodes of the copy, by id, and the other way round.
+  vector<Node*> nodes;
+  std::unordered_map<Node*, int> ids;
+  Encoder encoder;
+  /// Outputs whose deps were recorded since the recompaction started.
+  vector<Node*> recorded;
+  bool ok;
+  string err;
+  std::thread thread;
+};
+
+void DepsLog::Recompaction::Write() {
+  ok = false;
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    err = strerror(errno);
+    return;
+  }
+  if (fwrite(kFileSignature, sizeof(kFileSignature) - 1, 1, f) < 1 ||
+      fwrite(&kCurrentVersion, 4, 1, f) < 1) {
+    err = strerror(errno);
+    fclose(f);
+    return;
+  }
+  for (vector<Record>::iterator r = records.begin(); r != records.end(); ++r) {
+    if (!WriteDeps(f, r->node, r->mtime, r->inputs.size(),
+                   r->inputs.empty() ? NULL : &r->inputs[0])) {
+      err = strerror(errno);
+      fclose(f);
+      return;
+    }
+  }
+  if (fclose(f) != 0) {
+    err = strerror(errno);
+    return;
+  }
+  ok = true;
+}
+
+bool DepsLog::Recompaction::WriteDeps(FILE* f, Node* node, TimeStamp mtime,
+                                      int node_count, Node* const* inputs) {
+  vector<int> input_ids;
+  for (int i = -1; i < node_count; ++i) {
+    Node* n = i < 0 ? node : inputs[i];
+    std::pair<std::unordered_map<Node*, int>::iterator, bool> id =
+        ids.insert(std::make_pair(n, (int)nodes.size()));
+    if (id.second) {
+      if (!WritePathRecord(f, n->path(), id.first->second))
+        return false;
+      nodes.push_back(n);
+    }
+    if (i >= 0)
+      input_ids.push_back(id.first->second);
+  }
+  sort(input_ids.begin(), input_ids.end());
+  return WriteDepsRecord(f, &encoder, ids[node], mtime, input_ids);
+}
+
+namespace {
+
+/// The least size of the blocks RecordDeps() stores nodes in.
+const size_t kAppendBlockSize = 4096;
+
+}  // namespace
+
+DepsLog::DepsLog()
+    : needs_recompaction_(false), old_version_(false),
+      encoder_(new Encoder), lock_(NULL), partial_manifest_(false),
+      state_(NULL), loaded_end_(0),
+      recompaction_(NULL), append_(NULL), append_left_(0), stored_nodes_(0),
+      live_nodes_(0) {}
+
 DepsLog::~DepsLog() {
   Close();
+  for (vector<Node**>::iterator i = arenas_.begin(); i != arenas_.end(); ++i)
+    delete [] *i;
 }
 
 bool DepsLog::OpenForWrite(const string& path, string* err) {
-  if (needs_recompaction_) {
+  // Other processes append to a shared log meanwhile, unless this one has
+  // the build directory to itself for now.
+  bool shared = lock_ && !lock_->exclusive();
+  if (old_version_) {
+    // Nothing can be appended to a log of an earlier version; rewrite it
+    // now.
+    if (shared) {
+      *err = "the deps log of an earlier version can't be rewritten while "
+             "other ninja processes use it";
+      return false;
+    }
     if (!Recompact(path, err))
       return false;
+    old_version_ = false;
+    needs_recompaction_ = false;
+    loaded_end_ = FileSize(path);
+  } else if (needs_recompaction_ && !shared) {
+    // The processes let in later read on from where the rewritten log
+    // ends, so it's rewritten before they are.
+    if (!(lock_ ? Recompact(path, err) : StartRecompaction(path, err)))
+      return false;
+    needs_recompaction_ = false;
+    loaded_end_ = FileSize(path);
   }
 
-  assert(!file_);
+  assert(!writer_.started());
+  encoder_.reset(new Encoder(!lock_));
   file_path_ = path;  // we don't actually open the file right now, but will do
                       // so on the first write attempt
+  path_ = path;
   return true;
 }
 
@@ -65,6 +407,24 @@ bool DepsLog::RecordDeps(Node* node, TimeStamp mtime,
 
 bool DepsLog::RecordDeps(Node* node, TimeStamp mtime,
                          int node_count, Node** nodes) {
+  if (!lock_)
+    return AppendDeps(node, mtime, node_count, nodes);
+
+  // Append in turn with the other processes, after their records, which
+  // may have numbered nodes that this one would.
+  if (!lock_->Lock(BuildDirLock::kDepsLog))
+    return false;
+  string err;
+  bool ok = ReadAppended(&err);
+  if (!ok)
+    errno = EIO;
+  ok = ok && AppendDeps(node, mtime, node_count, nodes) && writer_.Flush();
+  lock_->Unlock(BuildDirLock::kDepsLog);
+  return ok;
+}
+
+bool DepsLog::AppendDeps(Node* node, TimeStamp mtime,
+                         int node_count, Node** nodes) {
   // Track whether there's any new data to be recorded.
   bool made_change = false;
 
@@ -82,6 +442,10 @@ bool DepsLog::RecordDeps(Node* node, TimeStamp mtime,
     }
   }
 
+  // The log keeps the inputs sorted by id.
+  vector<Node*> sorted(nodes, nodes + node_count);
+  sort(sorted.begin(), sorted.end(), IdLess);
+
   // See if the new data is different than the existing data, if any.
   if (!made_change) {
     Deps* deps = GetDeps(node);
@@ -90,12 +454,10 @@ bool DepsLog::RecordDeps(Node* node, TimeStamp mtime,
         deps->node_count != node_count) {
       made_change = true;
     } else {
-      for (int i = 0; i < node_count; ++i) {
-        if (deps->nodes[i] != nodes[i]) {
-          made_change = true;
-          break;
-        }
-      }
+      // A recompaction renumbers the nodes of the deps it keeps.
+      vector<Node*> recorded(deps->nodes, deps->nodes + node_count);
+      sort(recorded.begin(), recorded.end(), IdLess);
+      made_change = recorded != sorted;
     }
   }
 
@@ -104,167 +466,517 @@ bool DepsLog::RecordDeps(Node* node, TimeStamp mtime,
     return true;
 
   // Update on-disk representation.
-  unsigned size = 4 * (1 + 2 + node_count);
-  if (size > kMaxRecordSize) {
-    errno = ERANGE;
-    return false;
-  }
-
   if (!OpenForWriteIfNeeded()) {
     return false;
   }
-  size |= 0x80000000;  // Deps record: set high bit.
-  if (fwrite(&size, 4, 1, file_) < 1)
-    return false;
-  int id = node->id();
-  if (fwrite(&id, 4, 1, file_) < 1)
+  vector<int> ids(node_count);
+  for (int i = 0; i < node_count; ++i)
+    ids[i] = sorted[i]->id();
+  string record;
+  if (!encoder_->Format(node->id(), mtime, ids, &record) ||
+      (writer_.started() && !writer_.Append(record))) {
+    // The records that follow mustn't refer to this one.
+    encoder_.reset(new Encoder(!lock_));
     return false;
-  uint32_t mtime_part = static_cast<uint32_t>(mtime & 0xffffffff);
-  if (fwrite(&mtime_part, 4, 1, file_) < 1)
+  }
+  loaded_end_ += record.size();
+  if (recompaction_)
+    recompaction_->recorded.push_back(node);
+
+  // Update in-memory representation.
+  UpdateDeps(node->id(), Deps(mtime, node_count,
+                              StoreNodes(node_count, sorted.data())));
+  RepackIfWasteful();
+
+  return true;
+}
+
+Node** DepsLog::StoreNodes(int node_count, Node* const* nodes) {
+  if (node_count == 0)
+    return NULL;
+  if (Node** stored = FindStored(node_count, nodes))
+    return stored;
+  if (append_left_ < (size_t)node_count) {
+    size_t size = max(kAppendBlockSize, (size_t)node_count);
+    append_ = new Node*[size];
+    arenas_.push_back(append_);
+    append_left_ = size;
+    stored_nodes_ += size;
+  }
+  Node** stored = append_;
+  copy(nodes, nodes + node_count, stored);
+  append_ += node_count;
+  append_left_ -= node_count;
+  AddStored(node_count, stored);
+  return stored;
+}
+
+Node** DepsLog::FindStored(int node_count, Node* const* nodes) {
+  pair<unordered_multimap<unsigned, Stored>::iterator,
+       unordered_multimap<unsigned, Stored>::iterator> range =
+      stored_.equal_range(MurmurHash2(nodes, node_count * sizeof(Node*)));
+  for (; range.first != range.second; ++range.first) {
+    Stored* stored = &range.first->second;
+    if (stored->node_count == node_count &&
+        equal(nodes, nodes + node_count, stored->nodes)) {
+      ++stored->refs;
+      return stored->nodes;
+    }
+  }
+  return NULL;
+}
+
+void DepsLog::AddStored(int node_count, Node** nodes) {
+  Stored stored = { nodes, node_count, 1 };
+  stored_.insert(make_pair(MurmurHash2(nodes, node_count * sizeof(Node*)),
+                           stored));
+  live_nodes_ += node_count;
+}
+
+void DepsLog::ReleaseStored(int node_count, Node** nodes) {
+  if (node_count == 0)
+    return;
+  pair<unordered_multimap<unsigned, Stored>::iterator,
+       unordered_multimap<unsigned, Stored>::iterator> range =
+      stored_.equal_range(MurmurHash2(nodes, node_count * sizeof(Node*)));
+  for (; range.first != range.second; ++range.first) {
+    if (range.first->second.nodes != nodes)
+      continue;
+    if (--range.first->second.refs == 0) {
+      live_nodes_ -= node_count;
+      stored_.erase(range.first);
+    }
+    return;
+  }
+  assert(false && "releasing nodes that aren't stored");
+}
+
+void DepsLog::RepackIfWasteful() {
+  // Copying every node is only worth it once that frees a lot.
+  const size_t kMinRepackNodes = 1 << 20;
+  if (stored_nodes_ < kMinRepackNodes || stored_nodes_ < 2 * live_nodes_)
+    return;
+
+  Node** arena = live_nodes_ ? new Node*[live_nodes_] : NULL;
+  Node** next = arena;
+  // Copy each list once, in id order, keeping them shared.
+  unordered_map<Node**, Node**> moved;
+  for (vector<Deps>::iterator d = deps_.begin(); d != deps_.end(); ++d) {
+    if (d->node_count <= 0)
+      continue;
+    pair<unordered_map<Node**, Node**>::iterator, bool> move =
+        moved.insert(make_pair(d->nodes, next));
+    if (move.second) {
+      copy(d->nodes, d->nodes + d->node_count, next);
+      next += d->node_count;
+    }
+    d->nodes = move.first->second;
+  }
+  for (unordered_multimap<unsigned, Stored>::iterator i = stored_.begin();
+       i != stored_.end(); ++i)
+    i->second.nodes = moved[i->second.nodes];
+  for (vector<Node**>::iterator i = arenas_.begin(); i != arenas_.end(); ++i)
+    delete [] *i;
+  arenas_.clear();
+  if (arena)
+    arenas_.push_back(arena);
+  append_ = NULL;
+  append_left_ = 0;
+  stored_nodes_ = live_nodes_;
+}
+
+void DepsLog::Close() {
+  // create the file even if nothing has been recorded
+  if (!lock_) {
+    OpenForWriteIfNeeded();
+  } else if (lock_->Lock(BuildDirLock::kDepsLog)) {
+    OpenForWriteIfNeeded();
+    lock_->Unlock(BuildDirLock::kDepsLog);
+  }
+  if (!writer_.Close())
+    Warning("writing deps log: %s", strerror(errno));
+
+  if (recompaction_) {
+    string err;
+    if (!FinishRecompaction(&err))
+      Warning("recompacting deps log: %s", err.c_str());
+  }
+}
+
+namespace {
+
+/// Where Load() found a deps record.
+struct DepsRecord {
+  /// The offset of its payload in the file, and its size.
+  size_t offset;
+  unsigned size;
+  int out_id;
+  /// The number of its input ids, including those it shares.
+  int id_count;
+  /// The number of records it shares ids with in a chain.
+  int depth;
+};
+
+/// The fields of a deps record of the current version, up to its own ids.
+struct DepsHeader {
+  uint64_t out_id;
+  uint64_t mtime;
+  uint64_t distance;
+  uint64_t base_out_id;
+  uint64_t shared;
+  uint64_t own;
+  /// Where its own ids start.
+  const char* ids;
+};
+
+bool ReadDepsHeader(const char* p, const char* end, DepsHeader* header) {
+  if (!ReadVarint(&p, end, &header->out_id) || end - p < 8)
     return false;
-  mtime_part = static_cast<uint32_t>((mtime >> 32) & 0xffffffff);
-  if (fwrite(&mtime_part, 4, 1, file_) < 1)
+  memcpy(&header->mtime, p, 8);
+  p += 8;
+  header->base_out_id = header->shared = 0;
+  if (!ReadVarint(&p, end, &header->distance) ||
+      (header->distance && (!ReadVarint(&p, end, &header->base_out_id) ||
+                            !ReadVarint(&p, end, &header->shared))) ||
+      !ReadVarint(&p, end, &header->own))
     return false;
-  for (int i = 0; i < node_count; ++i) {
-    id = nodes[i]->id();
-    if (fwrite(&id, 4, 1, file_) < 1)
+  header->ids = p;
+  return true;
+}
+
+/// Check the deps record of |size| bytes at |p|, in a log of |version|
+/// whose earlier deps records are |records|, and fill in |record|.
+bool ParseDepsRecord(const char* p, unsigned size, int version,
+                     const vector<DepsRecord>& records, DepsRecord* record) {
+  record->depth = 0;
+  if (version == kFixedSizeVersion) {
+    if (size % 4 != 0 || size < 12)
       return false;
+    record->out_id = (int)ReadU32(p);
+    record->id_count = size / 4 - 3;
+    return record->out_id >= 0;
   }
-  if (fflush(file_) != 0)
+
+  const char* end = p + size;
+  DepsHeader header;
+  if (!ReadDepsHeader(p, end, &header) || header.out_id > INT_MAX ||
+      header.own > (uint64_t)(end - header.ids))
     return false;
+  record->out_id = (int)header.out_id;
+  if (header.distance) {
+    if (header.distance > records.size())
+      return false;
+    const DepsRecord& base = records[records.size() - header.distance];
+    if ((uint64_t)base.out_id != header.base_out_id ||
+        header.shared > (uint64_t)base.id_count ||
+        base.depth >= kMaxSharingDepth)
+      return false;
+    record->depth = base.depth + 1;
+  }
+  record->id_count = (int)(header.shared + header.own);
+  p = header.ids;
+  for (uint64_t i = 0; i < header.own; ++i) {
+    uint64_t delta;
+    if (!ReadVarint(&p, end, &delta))
+      return false;
+  }
+  return p == end;
+}
 
-  // Update in-memory representation.
-  Deps* deps = new Deps(mtime, node_count);
-  for (int i = 0; i < node_count; ++i)
-    deps->nodes[i] = nodes[i];
-  UpdateDeps(node->id(), deps);
+/// Read the mtime and input ids of deps record |index| of |records|, which
+/// ParseDepsRecord() checked, from |data|, a log of |version|.
+void DecodeDepsRecord(const char* data, int version,
+                      const vector<DepsRecord>& records, size_t index,
+                      TimeStamp* mtime, vector<int>* ids) {
+  const DepsRecord& record = records[index];
+  const char* p = data + record.offset;
+  ids->clear();
+  if (version == kFixedSizeVersion) {
+    *mtime = (TimeStamp)(((uint64_t)ReadU32(p + 8) << 32) |
+                         (uint64_t)ReadU32(p + 4));
+    for (int i = 0; i < record.id_count; ++i)
+      ids->push_back((int)ReadU32(p + 12 + 4 * i));
+    return;
+  }
 
-  return true;
+  const char* end = p + record.size;
+  DepsHeader header;
+  ReadDepsHeader(p, end, &header);
+  *mtime = (TimeStamp)header.mtime;
+  if (header.distance) {
+    TimeStamp base_mtime;
+    DecodeDepsRecord(data, version, records, index - header.distance,
+                     &base_mtime, ids);
+    ids->resize(header.shared);
+  }
+  uint64_t id = ids->empty() ? 0 : ids->back();
+  p = header.ids;
+  for (uint64_t i = 0; i < header.own; ++i) {
+    uint64_t delta;
+    ReadVarint(&p, end, &delta);
+    id += delta;
+    ids->push_back(id > INT_MAX ? -1 : (int)id);
+  }
 }
 
-void DepsLog::Close() {
-  OpenForWriteIfNeeded();  // create the file even if nothing has been recorded
-  if (file_)
-    fclose(file_);
-  file_ = NULL;
+}  // namespace
+
+size_t DepsLog::AddNodes(State* state, bool hashed,
+                         vector<PathRecord>* paths) {
+  // Look up the nodes that exist already, hashing the paths first if the
+  // log doesn't have their hashes, on several threads for large logs.
+  const size_t kChunk = 4096;
+  size_t chunks = (paths->size() + kChunk - 1) / kChunk;
+  const State::Paths& table = state->paths_;
+  ParallelFor(chunks, chunks > 1 ? GetProcessorCount() : 1,
+              [&](size_t chunk) {
+    size_t end = min(paths->size(), (chunk + 1) * kChunk);
+    for (size_t i = chunk * kChunk; i < end; ++i) {
+      PathRecord* path = &(*paths)[i];
+      if (!hashed)
+        path->hash = State::Paths::Hash(path->path);
+      State::Paths::const_iterator found = table.find(path->path, path->hash);
+      path->node = found == table.end() ? NULL : found->second;
+    }
+  });
+
+  // Then add the others, in a table made large enough for them all.
+  state->paths_.reserve(state->paths_.size() + paths->size());
+  nodes_.reserve(nodes_.size() + paths->size());
+  for (vector<PathRecord>::iterator i = paths->begin(); i != paths->end();
+       ++i) {
+    // It is not necessary to pass in a correct slash_bits here. It will
+    // either be a Node that's in the manifest (in which case it will already
+    // have a correct slash_bits that GetNode will look up), or it is an
+    // implicit dependency from a .d which does not affect the build command
+    // (and so need not have its slashes maintained).
+    Node* node = i->node ? i->node : state->GetNode(i->path, 0, i->hash);
+    if (!node)
+      return i - paths->begin();
+    assert(node->id() < 0);
+    node->set_id((int)nodes_.size());
+    nodes_.push_back(node);
+  }
+  return paths->size();
 }
 
 LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
-  METRIC_RECORD(".ninja_deps load");
-  char buf[kMaxRecordSize + 1];
-  FILE* f = fopen(path.c_str(), "rb");
-  if (!f) {
-    if (errno == ENOENT)
-      return LOAD_NOT_FOUND;
+  state_ = state;
+  path_ = path;
+  loaded_end_ = 0;
+  if (!lock_)
+    return LoadFile(path, state, err);
+
+  // Wait for a process appending to a shared log, so as not to take its
+  // record for a damaged one.
+  if (!lock_->Lock(BuildDirLock::kDepsLog)) {
     *err = strerror(errno);
     return LOAD_ERROR;
   }
+  LoadStatus status = LoadFile(path, state, err);
+  lock_->Unlock(BuildDirLock::kDepsLog);
+  return status;
+}
 
-  bool valid_header = true;
+LoadStatus DepsLog::LoadFile(const string& path, State* state, string* err) {
+  METRIC_RECORD(".ninja_deps load");
+  TRACE_RECORD(".ninja_deps load");
+  MappedFile file;
+  int ret = file.Open(path, err);
+  if (ret == -ENOENT) {
+    err->clear();
+    return LOAD_NOT_FOUND;
+  }
+  if (ret < 0)
+    return LOAD_ERROR;
+
+  const char* data = file.data();
+  const size_t file_size = file.size();
   int version = 0;
-  if (!fgets(buf, sizeof(buf), f) || fread(&version, 4, 1, f) < 1)
-    valid_header = false;
+  bool valid_header = file_size >= kHeaderSize &&
+      memcmp(data, kFileSignature, sizeof(kFileSignature) - 1) == 0;
+  if (file_size >= kHeaderSize)
+    version = (int)ReadU32(data + sizeof(kFileSignature) - 1);
   // Note: For version differences, this should migrate to the new format.
   // But the v1 format could sometimes (rarely) end up with invalid data, so
   // don't migrate v1 to v3 to force a rebuild. (v2 only existed for a few days,
   // and there was no release with it, so pretend that it never happened.)
-  if (!valid_header || strcmp(buf, kFileSignature) != 0 ||
-      version != kCurrentVersion) {
+  if (!valid_header || version < kFixedSizeVersion ||
+      version > kCurrentVersion) {
     if (version == 1)
       *err = "deps log version change; rebuilding";
     else
       *err = "bad deps log signature or version; starting over";
-    fclose(f);
+    file.Close();
     unlink(path.c_str());
     // Don't report this as a failure.  An empty deps log will cause
     // us to rebuild the outputs anyway.
     return LOAD_SUCCESS;
   }
 
-  long offset;
+  // The records are parsed in place.  The first pass collects the paths
+  // and finds the last (winning) deps record of each output; the paths
+  // then get their nodes, and a second pass copies the winning records
+  // into a single arena, so that overwritten records never cost an
+  // allocation.
+  vector<PathRecord> paths;
+  vector<DepsRecord> records;
+  vector<size_t> latest;  // out id -> index of its last deps record + 1
+  size_t offset = kHeaderSize;
   bool read_failed = false;
   int unique_dep_record_count = 0;
   int total_dep_record_count = 0;
-  for (;;) {
-    offset = ftell(f);
-
-    unsigned size;
-    if (fread(&size, 4, 1, f) < 1) {
-      if (!feof(f))
+  size_t arena_size = 0;
+  while (offset < file_size) {
+    const char* buf = data + offset;
+    const char* end = data + file_size;
+    uint64_t size;
+    bool is_deps;
+    if (version == kFixedSizeVersion) {
+      if (file_size - offset < 4) {
         read_failed = true;
-      break;
+        break;
+      }
+      unsigned header = ReadU32(buf);
+      is_deps = (header >> 31) != 0;
+      size = header & 0x7FFFFFFF;
+      buf += 4;
+    } else {
+      uint64_t header;
+      if (!ReadVarint(&buf, end, &header)) {
+        read_failed = true;
+        break;
+      }
+      is_deps = (header & 1) != 0;
+      size = header >> 1;
     }
-    bool is_deps = (size >> 31) != 0;
-    size = size & 0x7FFFFFFF;
 
-    if (size > kMaxRecordSize || fread(buf, size, 1, f) < 1) {
+    if (size > kMaxRecordSize || size > (uint64_t)(end - buf)) {
       read_failed = true;
       break;
     }
 
     if (is_deps) {
-      assert(size % 4 == 0);
-      int* deps_data = reinterpret_cast<int*>(buf);
-      int out_id = deps_data[0];
-      TimeStamp mtime;
-      mtime = (TimeStamp)(((uint64_t)(unsigned int)deps_data[2] << 32) |
-                          (uint64_t)(unsigned int)deps_data[1]);
-      deps_data += 3;
-      int deps_count = (size / 4) - 3;
-
-      Deps* deps = new Deps(mtime, deps_count);
-      for (int i = 0; i < deps_count; ++i) {
-        assert(deps_data[i] < (int)nodes_.size());
-        assert(nodes_[deps_data[i]]);
-        deps->nodes[i] = nodes_[deps_data[i]];
+      DepsRecord record;
+      if (!ParseDepsRecord(buf, (unsigned)size, version, records, &record)) {
+        read_failed = true;
+        break;
       }
-
+      record.offset = buf - data;
+      record.size = (unsigned)size;
+      int out_id = record.out_id;
+      if (out_id >= (int)latest.size())
+        latest.resize(out_id + 1);
       total_dep_record_count++;
-      if (!UpdateDeps(out_id, deps))
+      if (latest[out_id])
+        arena_size -= records[latest[out_id] - 1].id_count;
+      else
         ++unique_dep_record_count;
+      records.push_back(record);
+      latest[out_id] = records.size();
+      arena_size += record.id_count;
     } else {
-      int path_size = size - 4;
-      assert(path_size > 0);  // CanonicalizePath() rejects empty paths.
-      // There can be up to 3 bytes of padding.
-      if (buf[path_size - 1] == '\0') --path_size;
-      if (buf[path_size - 1] == '\0') --path_size;
-      if (buf[path_size - 1] == '\0') --path_size;
-      StringPiece subpath(buf, path_size);
-      // It is not necessary to pass in a correct slash_bits here. It will
-      // either be a Node that's in the manifest (in which case it will already
-      // have a correct slash_bits that GetNode will look up), or it is an
-      // implicit dependency from a .d which does not affect the build command
-      // (and so need not have its slashes maintained).
-      Node* node = state->GetNode(subpath, 0);
+      PathRecord path;
+      path.offset = offset;
+      StringPiece& subpath = path.path;
+      int expected_id;
+      if (version == kFixedSizeVersion) {
+        int path_size = (int)size - 4;
+        // CanonicalizePath() rejects empty paths.
+        if (path_size <= 0) {
+          read_failed = true;
+          break;
+        }
+        // There can be up to 3 bytes of padding.
+        if (buf[path_size - 1] == '\0') --path_size;
+        if (buf[path_size - 1] == '\0') --path_size;
+        if (buf[path_size - 1] == '\0') --path_size;
+        subpath = StringPiece(buf, path_size);
+        // (This uses unary complement to make the checksum look less like
+        // a dependency record entry.)
+        expected_id = ~ReadU32(buf + size - 4);
+      } else if (!ParsePathRecord(buf, (unsigned)size, version, &expected_id,
+                                  &subpath, &path.hash)) {
+        read_failed = true;
+        break;
+      }
 
       // Check that the expected index matches the actual index. This can only
       // happen if two ninja processes write to the same deps log concurrently.
-      // (This uses unary complement to make the checksum look less like a
-      // dependency record entry.)
-      unsigned checksum = *reinterpret_cast<unsigned*>(buf + size - 4);
-      int expected_id = ~checksum;
-      int id = nodes_.size();
+      int id = (int)(nodes_.size() + paths.size());
       if (id != expected_id) {
         read_failed = true;
         break;
       }
+      paths.push_back(path);
+    }
+    offset = buf - data + size;
+  }
+  size_t added = AddNodes(state, version > kUnhashedVersion, &paths);
+  const char* damage = "premature end of file";
+  if (added < paths.size()) {
+    // The path record is damaged; recover as from a truncated log, without
+    // the records after it.
+    damage = "bad path record";
+    read_failed = true;
+    offset = paths[added].offset;
+    latest.assign(latest.size(), 0);
+    for (size_t i = 0; i < records.size() && records[i].offset < offset; ++i)
+      latest[records[i].out_id] = i + 1;
+    // The records now kept may be bigger than the ones they replace.
+    arena_size = 0;
+    for (size_t i = 0; i < latest.size(); ++i) {
+      if (latest[i])
+        arena_size += records[latest[i] - 1].id_count;
+    }
+  }
 
-      assert(node->id() < 0);
-      node->set_id(id);
-      nodes_.push_back(node);
+  Node** arena = NULL;
+  if (arena_size > 0) {
+    arena = new Node*[arena_size];
+    arenas_.push_back(arena);
+    stored_nodes_ += arena_size;
+  }
+  if (latest.size() > deps_.size())
+    deps_.resize(latest.size());
+  vector<int> ids;
+  for (int out_id = 0; out_id < (int)latest.size(); ++out_id) {
+    if (!latest[out_id])
+      continue;
+    TimeStamp mtime;
+    DecodeDepsRecord(data, version, records, latest[out_id] - 1, &mtime,
+                     &ids);
+    int deps_count = ids.size();
+    bool valid = true;
+    for (int i = 0; i < deps_count; ++i) {
+      // A damaged log may name nodes it doesn't have; leave those deps
+      // out, which rebuilds the output.
+      if (ids[i] < 0 || ids[i] >= (int)nodes_.size()) {
+        valid = false;
+        break;
+      }
+      arena[i] = nodes_[ids[i]];
     }
+    if (!valid)
+      continue;
+    // Keep the space for the next record if these deps are stored already.
+    Node** nodes = NULL;
+    if (deps_count > 0 && !(nodes = FindStored(deps_count, arena))) {
+      nodes = arena;
+      AddStored(deps_count, nodes);
+      arena += deps_count;
+    }
+    UpdateDeps(out_id, Deps(mtime, deps_count, nodes));
   }
+  file.Close();
+  // Never append records of the current version to an older log.
+  old_version_ = version != kCurrentVersion;
+  loaded_end_ = offset;
 
   if (read_failed) {
     // An error occurred while loading; try to recover by truncating the
     // file to the last fully-read record.
-    if (ferror(f)) {
-      *err = strerror(ferror(f));
-    } else {
-      *err = "premature end of file";
-    }
-    fclose(f);
-
+    *err = damage;
     if (!Truncate(path, offset, err))
       return LOAD_ERROR;
 
@@ -274,8 +986,6 @@ LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
     return LOAD_SUCCESS;
   }
 
-  fclose(f);
-
   // Rebuild the log if there are too many dead records.
   int kMinCompactionEntryCount = 1000;
   int kCompactionRatio = 3;
@@ -287,65 +997,277 @@ LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
   return LOAD_SUCCESS;
 }
 
+bool DepsLog::CatchUp(string* err) {
+  if (!lock_)
+    return true;
+  if (!lock_->Lock(BuildDirLock::kDepsLog)) {
+    *err = strerror(errno);
+    return false;
+  }
+  bool ok = ReadAppended(err);
+  lock_->Unlock(BuildDirLock::kDepsLog);
+  return ok;
+}
+
+bool DepsLog::ReadAppended(string* err) {
+  FILE* f = fopen(path_.c_str(), "rb");
+  if (!f) {
+    if (errno == ENOENT)
+      return true;
+    *err = strerror(errno);
+    return false;
+  }
+  // A log another process started has its header to check first.
+  uint64_t start = loaded_end_ < kHeaderSize ? 0 : loaded_end_;
+  string data;
+  char buf[64 << 10];
+  fseek(f, (long)start, SEEK_SET);
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.append(buf, len);
+  fclose(f);
+  if (data.empty())
+    return true;
+
+  size_t offset = 0;
+  if (start == 0) {
+    if (data.size() < kHeaderSize)
+      return true;
+    if (memcmp(data.data(), kFileSignature, sizeof(kFileSignature) - 1) != 0 ||
+        ReadU32(data.data() + sizeof(kFileSignature) - 1) !=
+            (unsigned)kCurrentVersion) {
+      *err = "bad deps log signature or version";
+      return false;
+    }
+    offset = kHeaderSize;
+  }
+
+  // The records are complete, as they're appended in turn, and none refers
+  // to an earlier one.
+  const char* end = data.data() + data.size();
+  vector<DepsRecord> records(1);
+  vector<int> ids;
+  vector<Node*> inputs;
+  while (offset < data.size()) {
+    const char* p = data.data() + offset;
+    uint64_t header;
+    if (!ReadVarint(&p, end, &header) || (header >> 1) > kMaxRecordSize ||
+        (header >> 1) > (uint64_t)(end - p)) {
+      *err = "incomplete record appended to the deps log";
+      return false;
+    }
+    unsigned size = (unsigned)(header >> 1);
+    if (header & 1) {
+      DepsRecord* record = &records[0];
+      TimeStamp mtime;
+      if (!ParseDepsRecord(p, size, kCurrentVersion, vector<DepsRecord>(),
+                           record) ||
+          record->out_id >= (int)nodes_.size()) {
+        *err = "bad deps record appended to the deps log";
+        return false;
+      }
+      record->offset = p - data.data();
+      record->size = size;
+      DecodeDepsRecord(data.data(), kCurrentVersion, records, 0, &mtime, &ids);
+      inputs.clear();
+      for (vector<int>::iterator i = ids.begin(); i != ids.end(); ++i) {
+        if (*i < 0 || *i >= (int)nodes_.size()) {
+          *err = "bad deps record appended to the deps log";
+          return false;
+        }
+        inputs.push_back(nodes_[*i]);
+      }
+      UpdateDeps(record->out_id,
+                 Deps(mtime, (int)inputs.size(),
+                      StoreNodes((int)inputs.size(), inputs.data())));
+    } else {
+      int id;
+      StringPiece path;
+      size_t hash;
+      if (!ParsePathRecord(p, size, kCurrentVersion, &id, &path, &hash) ||
+          id != (int)nodes_.size()) {
+        *err = "bad path record appended to the deps log";
+        return false;
+      }
+      Node* node = state_->GetNode(path, 0, hash);
+      if (!node) {
+        *err = "bad path record appended to the deps log";
+        return false;
+      }
+      if (node->id() >= 0) {
+        *err = "path recorded twice in the deps log";
+        return false;
+      }
+      node->set_id(id);
+      nodes_.push_back(node);
+    }
+    offset = p + size - data.data();
+    loaded_end_ = start + offset;
+  }
+  RepackIfWasteful();
+  return true;
+}
+
 DepsLog::Deps* DepsLog::GetDeps(Node* node) {
   // Abort if the node has no id (never referenced in the deps) or if
   // there's no deps recorded for the node.
-  if (node->id() < 0 || node->id() >= (int)deps_.size())
+  if (node->id() < 0 || node->id() >= (int)deps_.size() ||
+      !deps_[node->id()].recorded())
     return NULL;
-  return deps_[node->id()];
+  return &deps_[node->id()];
+}
+
+void DepsLog::CountMemory(MemoryStats* stats) const {
+  int64_t recorded = 0;
+  for (vector<Deps>::const_iterator i = deps_.begin(); i != deps_.end(); ++i)
+    recorded += i->recorded();
+  stats->Add("DepsLog deps", recorded,
+             MemoryStats::HeapBytes(deps_) + MemoryStats::HeapBytes(nodes_));
+  // An entry of the hash map: the pair and a link; a bucket: a link.
+  stats->Add("DepsLog deps arrays", stored_.size(),
+             stored_nodes_ * sizeof(Node*) +
+                 stored_.size() *
+                     (sizeof(decltype(stored_)::value_type) + sizeof(void*)) +
+                 stored_.bucket_count() * sizeof(void*));
+}
+
+void DepsLog::Reset() {
+  assert(!writer_.started());
+  for (vector<Node*>::iterator i = nodes_.begin(); i != nodes_.end(); ++i)
+    (*i)->set_id(-1);
+  nodes_.clear();
+  deps_.clear();
+  stored_.clear();
+  for (vector<Node**>::iterator i = arenas_.begin(); i != arenas_.end(); ++i)
+    delete [] *i;
+  arenas_.clear();
+  append_ = NULL;
+  append_left_ = 0;
+  stored_nodes_ = live_nodes_ = 0;
+  needs_recompaction_ = false;
+  old_version_ = false;
+  loaded_end_ = 0;
 }
 
 bool DepsLog::Recompact(const string& path, string* err) {
   METRIC_RECORD(".ninja_deps recompact");
+  TRACE_RECORD(".ninja_deps recompact");
 
-  Close();
-  string temp_path = path + ".recompact";
-
-  // OpenForWrite() opens for append.  Make sure it's not appending to a
-  // left-over file from a previous recompaction attempt that crashed somehow.
-  unlink(temp_path.c_str());
+  return StartRecompaction(path, err) && FinishRecompaction(err);
+}
 
-  DepsLog new_log;
-  if (!new_log.OpenForWrite(temp_path, err))
-    return false;
+bool DepsLog::StartRecompaction(const string& path, string* err) {
+  Close();
+  Recompaction* recompaction = new Recompaction;
+  recompaction->path = path;
+  recompaction->temp_path = path + ".recompact";
 
-  // Clear all known ids so that new ones can be reassigned.  The new indices
-  // will refer to the ordering in new_log, not in the current log.
-  for (vector<Node*>::iterator i = nodes_.begin(); i != nodes_.end(); ++i)
-    (*i)->set_id(-1);
+  // Make sure not to leave a copy from a previous attempt that crashed
+  // somehow behind, should this one fail.
+  unlink(recompaction->temp_path.c_str());
 
-  // Write out all deps again.
+  // Copy the live deps: the build updates them as it goes.
+  vector<bool> live = LiveEntries();
   for (int old_id = 0; old_id < (int)deps_.size(); ++old_id) {
-    Deps* deps = deps_[old_id];
-    if (!deps) continue;  // If nodes_[old_id] is a leaf, it has no deps.
+    const Deps* deps = &deps_[old_id];
+    // If nodes_[old_id] is a leaf, it has no deps.
+    if (!deps->recorded())
+      continue;
 
-    if (!IsDepsEntryLiveFor(nodes_[old_id]))
+    if (!live[old_id])
       continue;
 
-    if (!new_log.RecordDeps(nodes_[old_id], deps->mtime,
-                            deps->node_count, deps->nodes)) {
-      new_log.Close();
-      return false;
-    }
+    Recompaction::Record record;
+    record.node = nodes_[old_id];
+    record.mtime = deps->mtime;
+    record.inputs.assign(deps->nodes, deps->nodes + deps->node_count);
+    recompaction->records.push_back(record);
   }
 
-  new_log.Close();
+  recompaction->thread = std::thread(&Recompaction::Write, recompaction);
+  recompaction_ = recompaction;
+  return true;
+}
 
-  // All nodes now have ids that refer to new_log, so steal its data.
-  deps_.swap(new_log.deps_);
-  nodes_.swap(new_log.nodes_);
+bool DepsLog::FinishRecompaction(string* err) {
+  Recompaction* recompaction = recompaction_;
+  if (!recompaction)
+    return true;
+  TRACE_RECORD(".ninja_deps recompact finish");
+  recompaction_ = NULL;
+  recompaction->thread.join();
 
-  if (unlink(path.c_str()) < 0) {
-    *err = strerror(errno);
+  // Append the deps recorded meanwhile to the copy.
+  FILE* f = NULL;
+  if (recompaction->ok) {
+    f = fopen(recompaction->temp_path.c_str(), "ab");
+    recompaction->ok = f != NULL;
+  }
+  if (f) {
+    // Opening a file in append mode doesn't set the file pointer to the
+    // file's end on Windows. Do that explicitly.
+    fseek(f, 0, SEEK_END);
+    set<Node*> seen;
+    for (vector<Node*>::iterator i = recompaction->recorded.begin();
+         i != recompaction->recorded.end() && recompaction->ok; ++i) {
+      Deps* deps = GetDeps(*i);
+      if (seen.insert(*i).second && deps) {
+        recompaction->ok = recompaction->WriteDeps(f, *i, deps->mtime,
+                                                   deps->node_count,
+                                                   deps->nodes);
+      }
+    }
+    if (fclose(f) != 0)
+      recompaction->ok = false;
+    if (!recompaction->ok)
+      recompaction->err = strerror(errno);
+  }
+  if (!recompaction->ok) {
+    *err = recompaction->err;
+    unlink(recompaction->temp_path.c_str());
+    delete recompaction;
     return false;
   }
 
-  if (rename(temp_path.c_str(), path.c_str()) < 0) {
-    *err = strerror(errno);
-    return false;
+  // Switch to the ids of the copy, keeping the current deps of the outputs
+  // it has deps for and dropping the others.
+  std::unordered_map<Node*, Deps> current;
+  for (int id = 0; id < (int)deps_.size(); ++id) {
+    if (deps_[id].recorded())
+      current[nodes_[id]] = deps_[id];
+  }
+  for (vector<Node*>::iterator i = nodes_.begin(); i != nodes_.end(); ++i)
+    (*i)->set_id(-1);
+  nodes_.swap(recompaction->nodes);
+  for (int id = 0; id < (int)nodes_.size(); ++id)
+    nodes_[id]->set_id(id);
+  deps_.assign(nodes_.size(), Deps());
+  for (vector<Recompaction::Record>::iterator r =
+           recompaction->records.begin();
+       r != recompaction->records.end(); ++r) {
+    deps_[r->node->id()] = current[r->node];
+    current.erase(r->node);
   }
+  for (vector<Node*>::iterator i = recompaction->recorded.begin();
+       i != recompaction->recorded.end(); ++i) {
+    std::unordered_map<Node*, Deps>::iterator deps = current.find(*i);
+    if (deps != current.end()) {
+      deps_[(*i)->id()] = deps->second;
+      current.erase(deps);
+    }
+  }
+  for (std::unordered_map<Node*, Deps>::iterator i = current.begin();
+       i != current.end(); ++i)
+    ReleaseStored(i->second.node_count, i->second.nodes);
+  RepackIfWasteful();
 
-  return true;
+  bool replaced = unlink(recompaction->path.c_str()) == 0 &&
+                  rename(recompaction->temp_path.c_str(),
+                         recompaction->path.c_str()) == 0;
+  if (!replaced)
+    *err = strerror(errno);
+  delete recompaction;
+  return replaced;
 }
 
 bool DepsLog::IsDepsEntryLiveFor(Node* node) {
@@ -355,47 +1277,50 @@ bool DepsLog::IsDepsEntryLiveFor(Node* node) {
   // entries are no longer needed.
   // (Without the check for "deps", a chain of two or more nodes that each
   // had deps wouldn't be collected in a single recompaction.)
-  return node->in_edge() && !node->in_edge()->GetBinding("deps").empty();
+  return node->in_edge() && !node->in_edge()->GetBinding(kSymbolDeps).empty();
+}
+
+vector<bool> DepsLog::LiveEntries() const {
+  if (partial_manifest_)
+    return vector<bool>(nodes_.size(), true);
+  vector<bool> live(nodes_.size());
+  // Whether each edge, by id, has deps: -1 until looked at.
+  vector<signed char> edge_has_deps;
+  for (size_t id = 0; id < nodes_.size(); ++id) {
+    Edge* edge = nodes_[id]->in_edge();
+    if (!edge)
+      continue;
+    if (edge->id_ >= edge_has_deps.size())
+      edge_has_deps.resize(edge->id_ + 1, -1);
+    signed char& has_deps = edge_has_deps[edge->id_];
+    if (has_deps < 0)
+      has_deps = !edge->GetBinding(kSymbolDeps).empty();
+    live[id] = has_deps != 0;
+  }
+  return live;
 }
 
-bool DepsLog::UpdateDeps(int out_id, Deps* deps) {
+bool DepsLog::UpdateDeps(int out_id, const Deps& deps) {
   if (out_id >= (int)deps_.size())
     deps_.resize(out_id + 1);
 
-  bool delete_old = deps_[out_id] != NULL;
+  bool delete_old = deps_[out_id].recorded();
   if (delete_old)
-    delete deps_[out_id];
+    ReleaseStored(deps_[out_id].node_count, deps_[out_id].nodes);
   deps_[out_id] = deps;
   return delete_old;
 }
 
 bool DepsLog::RecordId(Node* node) {
-  int path_size = node->path().size();
-  int padding = (4 - path_size % 4) % 4;  // Pad path to 4 byte boundary.
-
-  unsigned size = path_size + padding + 4;
-  if (size > kMaxRecordSize) {
-    errno = ERANGE;
-    return false;
-  }
-
   if (!OpenForWriteIfNeeded()) {
     return false;
   }
-  if (fwrite(&size, 4, 1, file_) < 1)
-    return false;
-  if (fwrite(node->path().data(), path_size, 1, file_) < 1) {
-    assert(!node->path().empty());
-    return false;
-  }
-  if (padding && fwrite("\0\0", padding, 1, file_) < 1)
-    return false;
   int id = nodes_.size();
-  unsigned checksum = ~(unsigned)id;
-  if (fwrite(&checksum, 4, 1, file_) < 1)
-    return false;
-  if (fflush(file_) != 0)
+  string record;
+  if (!FormatPathRecord(node->path(), id, &record) ||
+      (writer_.started() && !writer_.Append(record)))
     return false;
+  loaded_end_ += record.size();
 
   node->set_id(id);
   nodes_.push_back(node);
@@ -407,32 +1332,27 @@ bool DepsLog::OpenForWriteIfNeeded() {
   if (file_path_.empty()) {
     return true;
   }
-  file_ = fopen(file_path_.c_str(), "ab");
-  if (!file_) {
-    return false;
-  }
-  // Set the buffer size to this and flush the file buffer after every record
-  // to make sure records aren't written partially.
-  if (setvbuf(file_, NULL, _IOFBF, kMaxRecordSize + 1) != 0) {
+  FILE* f = fopen(file_path_.c_str(), "ab");
+  if (!f) {
     return false;
   }
-  SetCloseOnExec(fileno(file_));
+  SetCloseOnExec(fileno(f));
 
   // Opening a file in append mode doesn't set the file pointer to the file's
   // end on Windows. Do that explicitly.
-  fseek(file_, 0, SEEK_END);
+  fseek(f, 0, SEEK_END);
 
-  if (ftell(file_) == 0) {
-    if (fwrite(kFileSignature, sizeof(kFileSignature) - 1, 1, file_) < 1) {
+  if (ftell(f) == 0) {
+    if (fwrite(kFileSignature, sizeof(kFileSignature) - 1, 1, f) < 1 ||
+        fwrite(&kCurrentVersion, 4, 1, f) < 1 || fflush(f) != 0) {
+      int error = errno;
+      fclose(f);
+      errno = error;
       return false;
     }
-    if (fwrite(&kCurrentVersion, 4, 1, file_) < 1) {
-      return false;
-    }
-  }
-  if (fflush(file_) != 0) {
-    return false;
+    loaded_end_ = kHeaderSize;
   }
+  writer_.Start(f);
   file_path_.clear();
   return true;
 }
@@ -15,14 +15,20 @@
 #ifndef NINJA_DEPS_LOG_H_
 #define NINJA_DEPS_LOG_H_
 
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <stdio.h>
 
 #include "load_status.h"
+#include "log_writer.h"
+#include "string_piece.h"
 #include "timestamp.h"
 
+struct BuildDirLock;
+struct MemoryStats;
 struct Node;
 struct State;
 
@@ -50,26 +56,52 @@ struct State;
 /// A dependency list maps an output id to a list of input ids.
 ///
 /// Concretely, a record is:
-///    four bytes record length, high bit indicates record type
+///    a varint of its size, doubled, plus one for dependency records
 ///      (but max record sizes are capped at 512kB)
-///    path records contain the string name of the path, followed by up to 3
-///      padding bytes to align on 4 byte boundaries, followed by the
-///      one's complement of the expected index of the record (to detect
-///      concurrent writes of multiple ninja processes to the log).
-///    dependency records are an array of 4-byte integers
-///      [output path id,
-///       output path mtime (lower 4 bytes), output path mtime (upper 4 bytes),
-///       input path id, input path id...]
+///    path records contain the varint of the expected index of the record
+///      (to detect concurrent writes of multiple ninja processes to the
+///      log), followed by the string name of the path.
+///    dependency records contain
+///      [output path id (varint), output path mtime (8 bytes),
+///       distance back to an earlier dependency record the input ids start
+///       like, counted in dependency records, or 0 (varint),
+///       if not 0: that record's output path id, shared id count (varints),
+///       count of the remaining input ids (varint),
+///       the remaining input ids, each as the varint of its difference to
+///       the id before it]
 ///      (The mtime is compared against the on-disk output path mtime
 ///      to verify the stored data is up-to-date.)
+///    The input ids of a dependency record are sorted, so that the
+///    differences are small, and a record refers to one of the few before
+///    it at most, in chains of a few records at most.
+/// (Varints are written 7 bits a byte, least significant first, the high
+/// bit set in all but the last byte.)
 /// If two records reference the same output the latter one in the file
 /// wins, allowing updates to just be appended to the file.  A separate
 /// repacking step can run occasionally to remove dead records.
+///
+/// Logs of version 4, with 4 byte fields throughout, are still loaded, and
+/// rewritten in the current version before anything is appended to them.
+///
+/// Several processes may append to a log together through a BuildDirLock.
+/// Each then appends its records in turn, right after reading those the
+/// others appended since, so that the ids stay in file order; deps records
+/// never refer to earlier ones then.
 struct DepsLog {
-  DepsLog() : needs_recompaction_(false), file_(NULL) {}
+  DepsLog();
   ~DepsLog();
 
+  /// Share the log with the other processes holding |lock|, before Load().
+  /// It's then only rewritten while they're kept out.
+  void set_build_dir_lock(BuildDirLock* lock) { lock_ = lock; }
+
+  /// The State holds only part of the manifest: the entries of the nodes
+  /// it has no edge with deps for may still be live.
+  void set_partial_manifest(bool partial) { partial_manifest_ = partial; }
+
   // Writing (build-time) interface.
+  /// Prepare to append to the log at |path|.  If it needs recompaction,
+  /// that runs in the background until Close().
   bool OpenForWrite(const std::string& path, std::string* err);
   bool RecordDeps(Node* node, TimeStamp mtime, const std::vector<Node*>& nodes);
   bool RecordDeps(Node* node, TimeStamp mtime, int node_count, Node** nodes);
@@ -77,50 +109,156 @@ struct DepsLog {
 
   // Reading (startup-time) interface.
   struct Deps {
-    Deps(int64_t mtime, int node_count)
-        : mtime(mtime), node_count(node_count), nodes(new Node*[node_count]) {}
-    ~Deps() { delete [] nodes; }
+    Deps() : mtime(0), node_count(-1), nodes(NULL) {}
+    Deps(TimeStamp mtime, int node_count, Node** nodes)
+        : mtime(mtime), node_count(node_count), nodes(nodes) {}
+    /// Whether this is a record, rather than the lack of one.
+    bool recorded() const { return node_count >= 0; }
     TimeStamp mtime;
     int node_count;
+    /// In the storage of the DepsLog.
     Node** nodes;
   };
   LoadStatus Load(const std::string& path, State* state, std::string* err);
+  /// The deps recorded for |node|, or NULL if there are none.  The pointer
+  /// is valid until the next RecordDeps().
   Deps* GetDeps(Node* node);
 
+  /// Forget everything read by Load(), so that the log can be loaded again
+  /// into the same State.
+  void Reset();
+
+  /// Read the records other processes sharing the log appended since it
+  /// was last read, once it's open for writing.
+  bool CatchUp(std::string* err);
+
   /// Rewrite the known log entries, throwing away old data.
   bool Recompact(const std::string& path, std::string* err);
 
+  /// Start rewriting the live entries known now to a copy of the log at
+  /// |path|, on another thread.  Records added meanwhile still go to the
+  /// log itself, with the ids it uses.
+  bool StartRecompaction(const std::string& path, std::string* err);
+
+  /// Wait for the copy started by StartRecompaction(), append the records
+  /// added since to it, switch to its ids and replace the log with it.
+  /// Close() calls this.  On failure, the log is left as it was on disk.
+  bool FinishRecompaction(std::string* err);
   /// Returns if the deps entry for a node is still reachable from the manifest.
   ///
   /// The deps log can contain deps entries for files that were built in the
   /// past but are no longer part of the manifest.  This function returns if
   /// this is the case for a given node.  This function is slow, don't call
-  /// it from code that runs on every build.
+  /// it from code that runs on every build; to check many nodes, use
+  /// LiveEntries().
   bool IsDepsEntryLiveFor(Node* node);
 
+  /// Whether IsDepsEntryLiveFor() each node of the log, indexed by
+  /// Node::id(), found in one pass that looks at the "deps" binding of each
+  /// edge once.  All are with a partial manifest.
+  std::vector<bool> LiveEntries() const;
+
   /// Used for tests.
   const std::vector<Node*>& nodes() const { return nodes_; }
-  const std::vector<Deps*>& deps() const { return deps_; }
+  const std::vector<Deps>& deps() const { return deps_; }
+
+  /// Count the deps and the arrays of their nodes in |stats|.
+  void CountMemory(MemoryStats* stats) const;
+
+  /// Formats the deps records of a log file.
+  struct Encoder;
 
  private:
-  // Updates the in-memory representation.  Takes ownership of |deps|.
+  // Updates the in-memory representation.
   // Returns true if a prior deps record was deleted.
-  bool UpdateDeps(int out_id, Deps* deps);
+  bool UpdateDeps(int out_id, const Deps& deps);
+  /// Store |nodes|, unless the same list is stored already, and return
+  /// where it is, with a reference taken to it.
+  Node** StoreNodes(int node_count, Node* const* nodes);
+  /// The stored list equal to |nodes|, with a reference taken to it, or
+  /// NULL if there is none.
+  Node** FindStored(int node_count, Node* const* nodes);
+  /// Record |nodes|, in |arenas_|, as stored with one reference.
+  void AddStored(int node_count, Node** nodes);
+  /// Drop a reference to the stored list |nodes|.
+  void ReleaseStored(int node_count, Node** nodes);
+  /// Copy the nodes of the live deps together into a single block, if the
+  /// storage is mostly records overwritten since.
+  void RepackIfWasteful();
   // Write a node name record, assigning it an id.
   bool RecordId(Node* node);
+  /// Append a record of the deps of |node|, unless it has them already.
+  bool AppendDeps(Node* node, TimeStamp mtime, int node_count, Node** nodes);
+  /// A path record read by Load(), where it starts in the log, with the
+  /// hash of the path and the node it names, if there is one already.
+  struct PathRecord {
+    size_t offset;
+    StringPiece path;
+    size_t hash;
+    Node* node;
+  };
+  /// Give the nodes of |paths|, which the log has the hashes of if
+  /// |hashed| is set, the next ids, adding those State doesn't have.
+  /// Returns how many of them it gave ids, which is fewer than all if the
+  /// hash the log has of a path is wrong.
+  size_t AddNodes(State* state, bool hashed, std::vector<PathRecord>* paths);
+  /// Load() with the shared log held.
+  LoadStatus LoadFile(const std::string& path, State* state,
+                      std::string* err);
+  /// Read the records appended to the shared log since |loaded_end_|, with
+  /// the log held.
+  bool ReadAppended(std::string* err);
 
-  /// Should be called before using file_. When false is returned, errno will
-  /// be set.
+  /// Should be called before using writer_. When false is returned, errno
+  /// will be set.
   bool OpenForWriteIfNeeded();
 
   bool needs_recompaction_;
-  FILE* file_;
+  /// Whether Load() read a log of an earlier version, to rewrite.
+  bool old_version_;
+  /// Appends the records, once the log is opened.
+  LogWriter writer_;
+  /// Formats the deps records appended to the log since it was opened.
+  std::unique_ptr<Encoder> encoder_;
   std::string file_path_;
 
+  /// If set, the log is shared with other processes.
+  BuildDirLock* lock_;
+  bool partial_manifest_;
+  /// The shared log, the State its nodes are in, and how much of it was
+  /// read or written.
+  std::string path_;
+  State* state_;
+  uint64_t loaded_end_;
+
+  /// The recompaction running in the background, if any.
+  struct Recompaction;
+  Recompaction* recompaction_;
+
   /// Maps id -> Node.
   std::vector<Node*> nodes_;
-  /// Maps id -> deps of that id.
-  std::vector<Deps*> deps_;
+  /// Maps id -> deps of that id, if recorded().  The nodes of all the
+  /// deps are in |arenas_|: a block filled by Load() in id order, then
+  /// the blocks that RecordDeps() appends to.  Together, the deps of an
+  /// output are a single lookup and the nodes of consecutive outputs are
+  /// mostly next to each other.  Outputs with the same deps, like the
+  /// objects of a source compiled in several configurations, share them.
+  std::vector<Deps> deps_;
+  std::vector<Node**> arenas_;
+  /// A list of nodes in |arenas_| and how many deps refer to it.
+  struct Stored {
+    Node** nodes;
+    int node_count;
+    int refs;
+  };
+  /// The lists in |arenas_| that deps refer to, by the hash of their nodes.
+  std::unordered_multimap<unsigned, Stored> stored_;
+  /// The free space at the end of the last of |arenas_|.
+  Node** append_;
+  size_t append_left_;
+  /// The size of |arenas_|, and how much of that |stored_| uses.
+  size_t stored_nodes_;
+  size_t live_nodes_;
 
   friend struct DepsLogTest;
 };
@@ -0,0 +1,135 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deps_log.h"
+#include "graph.h"
+#include "state.h"
+#include "util.h"
+#include "metrics.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+const char kTestFilename[] = "DepsLogPerfTest-tempfile";
+
+/// The outputs written, and the headers they depend on.  A large project
+/// has tens of thousands of objects, each including a few hundred of tens
+/// of thousands of headers.
+const int kNumOutputs = 30000;
+const int kNumHeaders = 20000;
+const int kDepsPerOutput = 200;
+
+string HeaderPath(int i) {
+  char buf[80];
+  sprintf(buf, "../../third_party/and/a/fairly/long/path/%d/header.h", i);
+  return buf;
+}
+
+string OutputPath(int i) {
+  char buf[80];
+  sprintf(buf, "obj/and/a/fairly/long/path/source%d.o", i);
+  return buf;
+}
+
+bool WriteTestData(string* err) {
+  State state;
+  DepsLog log;
+  if (!log.OpenForWrite(kTestFilename, err))
+    return false;
+
+  vector<Node*> headers;
+  for (int i = 0; i < kNumHeaders; ++i)
+    headers.push_back(state.GetNode(HeaderPath(i), 0));
+  srand(1);
+  vector<Node*> deps;
+  for (int i = 0; i < kNumOutputs; ++i) {
+    deps.clear();
+    int first = rand() % kNumHeaders;
+    for (int d = 0; d < kDepsPerOutput; ++d)
+      deps.push_back(headers[(first + d * 7) % kNumHeaders]);
+    if (!log.RecordDeps(state.GetNode(OutputPath(i), 0), 1, deps)) {
+      *err = strerror(errno);
+      return false;
+    }
+  }
+  log.Close();
+  return true;
+}
+
+/// Time loading the log |kNumRepetitions| times, into a State that has
+/// the outputs already, as after loading the manifest, if |manifest| is
+/// set, and into an empty one otherwise.
+bool TimeLoads(bool manifest, string* err) {
+  const int kNumRepetitions = 5;
+  vector<int> times;
+  for (int i = 0; i < kNumRepetitions; ++i) {
+    State state;
+    for (int o = 0; manifest && o < kNumOutputs; ++o)
+      state.GetNode(OutputPath(o), 0);
+    int64_t start = GetTimeMillis();
+    DepsLog log;
+    if (log.Load(kTestFilename, &state, err) == LOAD_ERROR)
+      return false;
+    times.push_back((int)(GetTimeMillis() - start));
+  }
+
+  int min = times[0];
+  int max = times[0];
+  float total = 0;
+  for (size_t i = 0; i < times.size(); ++i) {
+    total += times[i];
+    if (times[i] < min)
+      min = times[i];
+    else if (times[i] > max)
+      max = times[i];
+  }
+  printf("%s: min %dms  max %dms  avg %.1fms\n",
+         manifest ? "with the outputs" : "into an empty state",
+         min, max, total / times.size());
+  return true;
+}
+
+int main() {
+  string err;
+  if (!WriteTestData(&err)) {
+    fprintf(stderr, "Failed to write test data: %s\n", err.c_str());
+    return 1;
+  }
+
+  {
+    // Read once to warm up disk cache.
+    State state;
+    DepsLog log;
+    if (log.Load(kTestFilename, &state, &err) == LOAD_ERROR) {
+      fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+      return 1;
+    }
+  }
+  if (!TimeLoads(false, &err) || !TimeLoads(true, &err)) {
+    fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+    return 1;
+  }
+
+  unlink(kTestFilename);
+
+  return 0;
+}
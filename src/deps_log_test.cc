@@ -19,6 +19,9 @@
 #include <unistd.h>
 #endif
 
+#include <algorithm>
+
+#include "build_dir_lock.h"
 #include "graph.h"
 #include "util.h"
 #include "test.h"
@@ -122,6 +125,420 @@ TEST_F(DepsLogTest, LotsOfDeps) {
   ASSERT_EQ(kNumDeps, log_deps->node_count);
 }
 
+// Verify that deps recorded over and over keep their nodes, including when
+// the storage of the overwritten ones is given back.
+TEST_F(DepsLogTest, RecordedDepsRepack) {
+  const int kNumDeps = 100000;
+
+  State state;
+  DepsLog log;
+  string err;
+  EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  vector<Node*> deps;
+  for (int i = 0; i < kNumDeps; ++i)
+    deps.push_back(state.GetNode("file" + to_string(i) + ".h", 0));
+  vector<Node*> other_deps(deps.begin(), deps.begin() + 3);
+  log.RecordDeps(state.GetNode("other.o", 0), 1, other_deps);
+
+  // Overwrite the deps of out.o until they are mostly dead storage.
+  for (int mtime = 1; mtime <= 30; ++mtime) {
+    reverse(deps.begin(), deps.end());
+    log.RecordDeps(state.GetNode("out.o", 0), mtime, deps);
+  }
+
+  DepsLog::Deps* log_deps = log.GetDeps(state.GetNode("out.o", 0));
+  ASSERT_TRUE(log_deps);
+  EXPECT_EQ(30, log_deps->mtime);
+  ASSERT_EQ(kNumDeps, log_deps->node_count);
+  // The log keeps deps sorted by id.
+  sort(deps.begin(), deps.end(),
+       [](Node* a, Node* b) { return a->id() < b->id(); });
+  for (int i = 0; i < kNumDeps; ++i)
+    ASSERT_EQ(deps[i], log_deps->nodes[i]);
+
+  log_deps = log.GetDeps(state.GetNode("other.o", 0));
+  ASSERT_TRUE(log_deps);
+  ASSERT_EQ(3, log_deps->node_count);
+  EXPECT_EQ("file0.h", log_deps->nodes[0]->path());
+  EXPECT_EQ("file2.h", log_deps->nodes[2]->path());
+  log.Close();
+}
+
+// Verify that outputs with the same deps share them, in memory and once
+// loaded again.
+TEST_F(DepsLogTest, SharedDeps) {
+  State state1;
+  DepsLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  vector<Node*> deps;
+  deps.push_back(state1.GetNode("foo.h", 0));
+  deps.push_back(state1.GetNode("bar.h", 0));
+  log1.RecordDeps(state1.GetNode("debug/out.o", 0), 1, deps);
+  log1.RecordDeps(state1.GetNode("release/out.o", 0), 2, deps);
+  EXPECT_EQ(log1.GetDeps(state1.GetNode("debug/out.o", 0))->nodes,
+            log1.GetDeps(state1.GetNode("release/out.o", 0))->nodes);
+
+  // Changing the deps of one leaves the other's alone.
+  deps.pop_back();
+  log1.RecordDeps(state1.GetNode("debug/out.o", 0), 3, deps);
+  DepsLog::Deps* log_deps = log1.GetDeps(state1.GetNode("release/out.o", 0));
+  ASSERT_EQ(2, log_deps->node_count);
+  EXPECT_EQ("bar.h", log_deps->nodes[1]->path());
+  log1.RecordDeps(state1.GetNode("other.o", 0), 4, deps);
+  log1.Close();
+
+  State state2;
+  DepsLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &state2, &err));
+  ASSERT_EQ("", err);
+  DepsLog::Deps* debug = log2.GetDeps(state2.GetNode("debug/out.o", 0));
+  DepsLog::Deps* release = log2.GetDeps(state2.GetNode("release/out.o", 0));
+  DepsLog::Deps* other = log2.GetDeps(state2.GetNode("other.o", 0));
+  ASSERT_EQ(1, debug->node_count);
+  ASSERT_EQ(2, release->node_count);
+  EXPECT_EQ("foo.h", debug->nodes[0]->path());
+  EXPECT_EQ(debug->nodes, other->nodes);
+  EXPECT_NE(debug->nodes, release->nodes);
+}
+
+// Verify that deps sharing most of their ids with an earlier record take
+// little space in the log, and load back whole.
+TEST_F(DepsLogTest, SharedPrefixes) {
+  const int kNumOutputs = 100;
+  const int kNumHeaders = 200;
+
+  State state1;
+  DepsLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  vector<Node*> headers;
+  for (int i = 0; i < kNumHeaders; ++i)
+    headers.push_back(state1.GetNode("include/header" + to_string(i) + ".h", 0));
+  for (int i = 0; i < kNumOutputs; ++i) {
+    vector<Node*> deps(headers);
+    deps.push_back(state1.GetNode("src" + to_string(i) + ".cc", 0));
+    log1.RecordDeps(state1.GetNode("out" + to_string(i) + ".o", 0), i, deps);
+  }
+  log1.Close();
+
+  // Full 4-byte ids would take more than 80000 bytes.
+  struct stat st;
+  ASSERT_EQ(0, stat(kTestFilename, &st));
+  EXPECT_LT(st.st_size, 12000);
+
+  State state2;
+  DepsLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &state2, &err));
+  ASSERT_EQ("", err);
+  for (int i = 0; i < kNumOutputs; ++i) {
+    DepsLog::Deps* log_deps =
+        log2.GetDeps(state2.GetNode("out" + to_string(i) + ".o", 0));
+    ASSERT_TRUE(log_deps);
+    EXPECT_EQ(i, log_deps->mtime);
+    ASSERT_EQ(kNumHeaders + 1, log_deps->node_count);
+    EXPECT_EQ("include/header0.h", log_deps->nodes[0]->path());
+    EXPECT_EQ("include/header199.h", log_deps->nodes[kNumHeaders - 1]->path());
+    EXPECT_EQ("src" + to_string(i) + ".cc",
+              log_deps->nodes[kNumHeaders]->path());
+  }
+}
+
+// Verify that a log of the fixed size version loads, and is rewritten in
+// the current one before anything is appended to it.
+TEST_F(DepsLogTest, UpgradeVersion4) {
+  string data("# ninjadeps\n\x04\0\0\0", 16);
+  const char* kPaths[] = { "out.o", "foo.h", "bar.h" };
+  for (int id = 0; id < 3; ++id) {
+    string path = kPaths[id];
+    path.resize((path.size() + 3) & ~3, '\0');
+    unsigned fields[] = { (unsigned)path.size() + 4, ~(unsigned)id };
+    data.append((const char*)&fields[0], 4);
+    data += path;
+    data.append((const char*)&fields[1], 4);
+  }
+  unsigned deps[] = { 5 * 4 | 0x80000000, 0, 7, 0, 1, 2 };
+  data.append((const char*)deps, sizeof(deps));
+  FILE* f = fopen(kTestFilename, "wb");
+  ASSERT_TRUE(f != NULL);
+  ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), f));
+  ASSERT_EQ(0, fclose(f));
+
+  // The rewrite keeps the deps of outputs in the manifest.
+  State state1;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state1,
+"rule cc\n"
+"  command = cc\n"
+"  deps = gcc\n"
+"build out.o: cc\n"
+"build other.o: cc\n"));
+  DepsLog log1;
+  string err;
+  EXPECT_TRUE(log1.Load(kTestFilename, &state1, &err));
+  ASSERT_EQ("", err);
+  DepsLog::Deps* log_deps = log1.GetDeps(state1.GetNode("out.o", 0));
+  ASSERT_TRUE(log_deps);
+  EXPECT_EQ(7, log_deps->mtime);
+  ASSERT_EQ(2, log_deps->node_count);
+  EXPECT_EQ("foo.h", log_deps->nodes[0]->path());
+  EXPECT_EQ("bar.h", log_deps->nodes[1]->path());
+
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  vector<Node*> new_deps;
+  new_deps.push_back(state1.GetNode("baz.h", 0));
+  log1.RecordDeps(state1.GetNode("other.o", 0), 8, new_deps);
+  log1.Close();
+
+  string contents;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  ASSERT_GE(contents.size(), 16u);
+  EXPECT_EQ(6, contents[12]);
+
+  State state2;
+  DepsLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &state2, &err));
+  ASSERT_EQ("", err);
+  log_deps = log2.GetDeps(state2.GetNode("out.o", 0));
+  ASSERT_TRUE(log_deps);
+  ASSERT_EQ(2, log_deps->node_count);
+  EXPECT_EQ("bar.h", log_deps->nodes[1]->path());
+  log_deps = log2.GetDeps(state2.GetNode("other.o", 0));
+  ASSERT_TRUE(log_deps);
+  ASSERT_EQ(1, log_deps->node_count);
+  EXPECT_EQ("baz.h", log_deps->nodes[0]->path());
+}
+
+// Verify that a log without the hashes of its paths loads, and is
+// rewritten with them.
+TEST_F(DepsLogTest, UpgradeVersion5) {
+  string data("# ninjadeps\n\x05\0\0\0", 16);
+  const char* kPaths[] = { "out.o", "foo.h", "bar.h" };
+  for (int id = 0; id < 3; ++id) {
+    string path = kPaths[id];
+    data += (char)((path.size() + 1) << 1);
+    data += (char)id;
+    data += path;
+  }
+  // out.o, mtime 7, no sharing, then foo.h and bar.h as id deltas.
+  data += (char)(13 << 1 | 1);
+  data += '\0';
+  data.append("\x07\0\0\0\0\0\0\0", 8);
+  data.append("\0\x02\x01\x01", 4);
+  FILE* f = fopen(kTestFilename, "wb");
+  ASSERT_TRUE(f != NULL);
+  ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), f));
+  ASSERT_EQ(0, fclose(f));
+
+  State state1;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state1,
+"rule cc\n"
+"  command = cc\n"
+"  deps = gcc\n"
+"build out.o: cc\n"));
+  Node* out = state1.GetNode("out.o", 0);
+  DepsLog log1;
+  string err;
+  EXPECT_TRUE(log1.Load(kTestFilename, &state1, &err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(0, out->id());
+  DepsLog::Deps* log_deps = log1.GetDeps(out);
+  ASSERT_TRUE(log_deps);
+  EXPECT_EQ(7, log_deps->mtime);
+  ASSERT_EQ(2, log_deps->node_count);
+  EXPECT_EQ("foo.h", log_deps->nodes[0]->path());
+  EXPECT_EQ(log_deps->nodes[0], state1.LookupNode("foo.h"));
+  EXPECT_EQ("bar.h", log_deps->nodes[1]->path());
+
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log1.Close();
+
+  string contents;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  ASSERT_GE(contents.size(), 16u);
+  EXPECT_EQ(6, contents[12]);
+
+  State state2;
+  DepsLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &state2, &err));
+  ASSERT_EQ("", err);
+  log_deps = log2.GetDeps(state2.LookupNode("out.o"));
+  ASSERT_TRUE(log_deps);
+  ASSERT_EQ(2, log_deps->node_count);
+  EXPECT_EQ(log_deps->nodes[1], state2.LookupNode("bar.h"));
+}
+
+// Verify that a log with more paths than are looked up at once loads,
+// whether State has some of them already or not.
+TEST_F(DepsLogTest, ManyPaths) {
+  const int kOutputs = 3000;
+  State state1;
+  DepsLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  for (int i = 0; i < kOutputs; ++i) {
+    char buf[32];
+    vector<Node*> deps;
+    snprintf(buf, sizeof(buf), "in%d.h", i);
+    deps.push_back(state1.GetNode(buf, 0));
+    snprintf(buf, sizeof(buf), "in%d.h", i + 1);
+    deps.push_back(state1.GetNode(buf, 0));
+    snprintf(buf, sizeof(buf), "out%d.o", i);
+    log1.RecordDeps(state1.GetNode(buf, 0), 1, deps);
+  }
+  log1.Close();
+
+  State state2;
+  state2.GetNode("in5.h", 0);
+  Node* out = state2.GetNode("out2999.o", 0);
+  DepsLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &state2, &err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(log1.nodes().size(), log2.nodes().size());
+  for (size_t i = 0; i < log2.nodes().size(); ++i) {
+    EXPECT_EQ((int)i, log2.nodes()[i]->id());
+    EXPECT_EQ(log2.nodes()[i], state2.LookupNode(log1.nodes()[i]->path()));
+  }
+  DepsLog::Deps* log_deps = log2.GetDeps(out);
+  ASSERT_TRUE(log_deps);
+  ASSERT_EQ(2, log_deps->node_count);
+  EXPECT_EQ("in3000.h", log_deps->nodes[1]->path());
+  log_deps = log2.GetDeps(state2.LookupNode("out4.o"));
+  ASSERT_TRUE(log_deps);
+  EXPECT_EQ(state2.LookupNode("in5.h"), log_deps->nodes[1]);
+}
+
+// Verify that a path record with a wrong hash is treated as damaged.  A
+// lookup with it can miss a node State has, and add the path again.
+TEST_F(DepsLogTest, BadPathHash) {
+  {
+    State state;
+    DepsLog log;
+    string err;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    vector<Node*> deps;
+    deps.push_back(state.GetNode("foo.h", 0));
+    deps.push_back(state.GetNode("bar.h", 0));
+    log.RecordDeps(state.GetNode("out.o", 0), 1, deps);
+    deps.clear();
+    deps.push_back(state.GetNode("baz.h", 0));
+    log.RecordDeps(state.GetNode("out2.o", 0), 2, deps);
+    log.Close();
+  }
+
+  // The hash is right before the path.
+  string contents, err;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  size_t pos = contents.find("baz.h");
+  ASSERT_NE(string::npos, pos);
+  contents[pos - 1] ^= 1;
+  FILE* f = fopen(kTestFilename, "wb");
+  ASSERT_TRUE(f != NULL);
+  ASSERT_EQ(contents.size(), fwrite(contents.data(), 1, contents.size(), f));
+  ASSERT_EQ(0, fclose(f));
+
+  State state;
+  DepsLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &state, &err));
+  EXPECT_EQ("bad path record; recovering", err);
+  EXPECT_EQ(NULL, state.LookupNode("baz.h"));
+  EXPECT_TRUE(log.GetDeps(state.GetNode("out.o", 0)));
+  EXPECT_FALSE(log.GetDeps(state.GetNode("out2.o", 0)));
+
+  // The log was cut before the record.
+  string truncated;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &truncated, &err));
+  EXPECT_LT(truncated.size(), pos);
+}
+
+// Verify that a bigger earlier record of an output can take the place of the
+// one dropped with a bad path record.
+TEST_F(DepsLogTest, BadPathHashBiggerEarlierRecord) {
+  {
+    State state;
+    DepsLog log;
+    string err;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    vector<Node*> deps;
+    for (int i = 0; i < 200; ++i)
+      deps.push_back(state.GetNode("dep" + to_string(i) + ".h", 0));
+    log.RecordDeps(state.GetNode("out.o", 0), 1, deps);
+    deps.clear();
+    deps.push_back(state.GetNode("new.h", 0));
+    log.RecordDeps(state.GetNode("out.o", 0), 2, deps);
+    log.Close();
+  }
+
+  string contents, err;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  size_t pos = contents.find("new.h");
+  ASSERT_NE(string::npos, pos);
+  contents[pos - 1] ^= 1;
+  FILE* f = fopen(kTestFilename, "wb");
+  ASSERT_TRUE(f != NULL);
+  ASSERT_EQ(contents.size(), fwrite(contents.data(), 1, contents.size(), f));
+  ASSERT_EQ(0, fclose(f));
+
+  State state;
+  DepsLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &state, &err));
+  EXPECT_EQ("bad path record; recovering", err);
+  DepsLog::Deps* deps = log.GetDeps(state.GetNode("out.o", 0));
+  ASSERT_TRUE(deps);
+  EXPECT_EQ(1, deps->mtime);
+  ASSERT_EQ(200, deps->node_count);
+  EXPECT_EQ("dep0.h", deps->nodes[0]->path());
+  EXPECT_EQ("dep199.h", deps->nodes[199]->path());
+}
+
+// Verify that only the last record of each output is kept when loading,
+// including records that shrink or have no deps at all.
+TEST_F(DepsLogTest, OverwrittenRecords) {
+  State state1;
+  DepsLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  vector<Node*> deps;
+  deps.push_back(state1.GetNode("foo.h", 0));
+  deps.push_back(state1.GetNode("bar.h", 0));
+  deps.push_back(state1.GetNode("baz.h", 0));
+  log1.RecordDeps(state1.GetNode("out.o", 0), 1, deps);
+  log1.RecordDeps(state1.GetNode("other.o", 0), 2, deps);
+  deps.pop_back();
+  log1.RecordDeps(state1.GetNode("out.o", 0), 3, deps);
+  log1.RecordDeps(state1.GetNode("other.o", 0), 4, vector<Node*>());
+  log1.Close();
+
+  State state2;
+  DepsLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &state2, &err));
+  ASSERT_EQ("", err);
+
+  DepsLog::Deps* log_deps = log2.GetDeps(state2.GetNode("out.o", 0));
+  ASSERT_TRUE(log_deps);
+  EXPECT_EQ(3, log_deps->mtime);
+  ASSERT_EQ(2, log_deps->node_count);
+  EXPECT_EQ("foo.h", log_deps->nodes[0]->path());
+  EXPECT_EQ("bar.h", log_deps->nodes[1]->path());
+
+  log_deps = log2.GetDeps(state2.GetNode("other.o", 0));
+  ASSERT_TRUE(log_deps);
+  EXPECT_EQ(4, log_deps->mtime);
+  EXPECT_EQ(0, log_deps->node_count);
+}
+
 // Verify that adding the same deps twice doesn't grow the file.
 TEST_F(DepsLogTest, DoubleEntry) {
   // Write some deps to the file and grab its size.
@@ -325,6 +742,179 @@ TEST_F(DepsLogTest, Recompact) {
 }
 
 // Verify that invalid file headers cause a new build.
+TEST_F(DepsLogTest, LiveEntries) {
+  State state;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state,
+"rule cc\n"
+"  command = cc\n"
+"  deps = gcc\n"
+"rule nodeps\n"
+"  command = nodeps\n"
+"build a.o b.o: cc\n"
+"build c.o: nodeps\n"));
+  DepsLog log;
+  string err;
+  ASSERT_TRUE(log.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  vector<Node*> deps;
+  deps.push_back(state.GetNode("foo.h", 0));
+  const char* outputs[] = { "a.o", "b.o", "c.o", "gone.o" };
+  for (size_t i = 0; i < sizeof(outputs) / sizeof(outputs[0]); ++i)
+    log.RecordDeps(state.GetNode(outputs[i], 0), 1, deps);
+  log.Close();
+
+  vector<bool> live = log.LiveEntries();
+  ASSERT_EQ(log.nodes().size(), live.size());
+  for (size_t id = 0; id < live.size(); ++id) {
+    Node* node = log.nodes()[id];
+    EXPECT_EQ(log.IsDepsEntryLiveFor(node), live[id]);
+  }
+  EXPECT_TRUE(live[state.LookupNode("a.o")->id()]);
+  EXPECT_TRUE(live[state.LookupNode("b.o")->id()]);
+  EXPECT_FALSE(live[state.LookupNode("c.o")->id()]);
+  EXPECT_FALSE(live[state.LookupNode("gone.o")->id()]);
+  EXPECT_FALSE(live[state.LookupNode("foo.h")->id()]);
+
+  // gone.o may be declared in the part of the manifest not loaded.
+  log.set_partial_manifest(true);
+  live = log.LiveEntries();
+  EXPECT_TRUE(live[state.LookupNode("gone.o")->id()]);
+}
+
+TEST_F(DepsLogTest, RecompactInBackground) {
+  const char kManifest[] =
+"rule cc\n"
+"  command = cc\n"
+"  deps = gcc\n"
+"build out.o: cc\n"
+"build other_out.o: cc\n"
+"build new_out.o: cc\n";
+
+  {
+    State state;
+    ASSERT_NO_FATAL_FAILURE(AssertParse(&state, kManifest));
+    DepsLog log;
+    string err;
+    ASSERT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    vector<Node*> deps;
+    deps.push_back(state.GetNode("foo.h", 0));
+    log.RecordDeps(state.GetNode("out.o", 0), 1, deps);
+    log.RecordDeps(state.GetNode("dead.o", 0), 1, deps);
+    log.RecordDeps(state.GetNode("other_out.o", 0), 1, deps);
+    log.Close();
+  }
+
+  State state;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state, kManifest));
+  {
+    DepsLog log;
+    string err;
+    ASSERT_TRUE(log.Load(kTestFilename, &state, &err));
+    ASSERT_TRUE(log.StartRecompaction(kTestFilename, &err));
+    ASSERT_TRUE(log.OpenForWrite(kTestFilename, &err));
+
+    // Deps recorded while the copy is written are carried over to it.
+    vector<Node*> deps;
+    deps.push_back(state.GetNode("bar.h", 0));
+    log.RecordDeps(state.GetNode("out.o", 0), 2, deps);
+    log.RecordDeps(state.GetNode("new_out.o", 0), 3, deps);
+    log.Close();
+    ASSERT_EQ("", err);
+
+    int recorded = 0;
+    for (size_t id = 0; id < log.deps().size(); ++id)
+      recorded += log.deps()[id].recorded();
+    EXPECT_EQ(3, recorded);
+    DepsLog::Deps* out_deps = log.GetDeps(state.GetNode("out.o", 0));
+    ASSERT_TRUE(out_deps);
+    EXPECT_EQ(2, out_deps->mtime);
+    EXPECT_FALSE(log.GetDeps(state.GetNode("dead.o", 0)));
+    for (size_t id = 0; id < log.nodes().size(); ++id)
+      EXPECT_EQ((int)id, log.nodes()[id]->id());
+  }
+
+  State state2;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state2, kManifest));
+  DepsLog log;
+  string err;
+  ASSERT_TRUE(log.Load(kTestFilename, &state2, &err));
+  ASSERT_EQ("", err);
+  DepsLog::Deps* deps = log.GetDeps(state2.GetNode("out.o", 0));
+  ASSERT_TRUE(deps);
+  EXPECT_EQ(2, deps->mtime);
+  ASSERT_EQ(1, deps->node_count);
+  EXPECT_EQ("bar.h", deps->nodes[0]->path());
+  deps = log.GetDeps(state2.GetNode("other_out.o", 0));
+  ASSERT_TRUE(deps);
+  EXPECT_EQ("foo.h", deps->nodes[0]->path());
+  deps = log.GetDeps(state2.GetNode("new_out.o", 0));
+  ASSERT_TRUE(deps);
+  EXPECT_EQ(3, deps->mtime);
+  EXPECT_FALSE(log.GetDeps(state2.GetNode("dead.o", 0)));
+}
+
+TEST_F(DepsLogTest, Shared) {
+  const char kLockFilename[] = "DepsLogTest-lockfile";
+  unlink(kLockFilename);
+  BuildDirLock lock;
+  string err;
+  ASSERT_TRUE(lock.Open(kLockFilename, &err));
+  lock.Share();
+
+  // Two processes sharing the log, with graphs of their own.
+  State state1, state2;
+  DepsLog log1, log2;
+  log1.set_build_dir_lock(&lock);
+  log2.set_build_dir_lock(&lock);
+  EXPECT_EQ(LOAD_NOT_FOUND, log1.Load(kTestFilename, &state1, &err));
+  EXPECT_EQ(LOAD_NOT_FOUND, log2.Load(kTestFilename, &state2, &err));
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  EXPECT_TRUE(log2.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  vector<Node*> deps;
+  deps.push_back(state1.GetNode("a.h", 0));
+  deps.push_back(state1.GetNode("b.h", 0));
+  EXPECT_TRUE(log1.RecordDeps(state1.GetNode("out1.o", 0), 1, deps));
+
+  // The ids the first one gave are read before the second appends, and
+  // the inputs are kept in the order of those.
+  deps.clear();
+  deps.push_back(state2.GetNode("c.h", 0));
+  deps.push_back(state2.GetNode("b.h", 0));
+  EXPECT_TRUE(log2.RecordDeps(state2.GetNode("out2.o", 0), 2, deps));
+  DepsLog::Deps* log_deps = log2.GetDeps(state2.GetNode("out1.o", 0));
+  ASSERT_TRUE(log_deps);
+  EXPECT_EQ(1, log_deps->mtime);
+
+  EXPECT_TRUE(log1.CatchUp(&err));
+  ASSERT_EQ("", err);
+  log_deps = log1.GetDeps(state1.GetNode("out2.o", 0));
+  ASSERT_TRUE(log_deps);
+  ASSERT_EQ(2, log_deps->node_count);
+  EXPECT_EQ("b.h", log_deps->nodes[0]->path());
+  EXPECT_EQ("c.h", log_deps->nodes[1]->path());
+  log1.Close();
+  log2.Close();
+
+  State state3;
+  DepsLog log3;
+  EXPECT_EQ(LOAD_SUCCESS, log3.Load(kTestFilename, &state3, &err));
+  ASSERT_EQ("", err);
+  log_deps = log3.GetDeps(state3.GetNode("out1.o", 0));
+  ASSERT_TRUE(log_deps);
+  ASSERT_EQ(2, log_deps->node_count);
+  EXPECT_EQ("a.h", log_deps->nodes[0]->path());
+  EXPECT_EQ("b.h", log_deps->nodes[1]->path());
+  log_deps = log3.GetDeps(state3.GetNode("out2.o", 0));
+  ASSERT_TRUE(log_deps);
+  ASSERT_EQ(2, log_deps->node_count);
+  EXPECT_EQ("b.h", log_deps->nodes[0]->path());
+  EXPECT_EQ("c.h", log_deps->nodes[1]->path());
+  unlink(kLockFilename);
+}
+
 TEST_F(DepsLogTest, InvalidHeader) {
   const char *kInvalidHeaders[] = {
     "",                              // Empty file.
@@ -399,9 +989,9 @@ TEST_F(DepsLogTest, Truncated) {
 
     // Count how many non-NULL deps entries there are.
     int new_deps_count = 0;
-    for (vector<DepsLog::Deps*>::const_iterator i = log.deps().begin();
+    for (vector<DepsLog::Deps>::const_iterator i = log.deps().begin();
          i != log.deps().end(); ++i) {
-      if (*i)
+      if (i->recorded())
         ++new_deps_count;
     }
     ASSERT_GE(deps_count, new_deps_count);
@@ -15,8 +15,10 @@
 #include "disk_interface.h"
 
 #include <algorithm>
+#include <vector>
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -27,9 +29,12 @@
 #include <windows.h>
 #include <direct.h>  // _mkdir
 #else
+#include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
+#include "mapped_file.h"
 #include "metrics.h"
 #include "util.h"
 
@@ -129,30 +134,109 @@ bool StatAllFilesInDir(const string& dir, map<string, TimeStamp>* stamps,
   FindClose(find_handle);
   return true;
 }
+#else
+TimeStamp TimeStampFromStat(const struct stat& st) {
+  // Some users (Flatpak) set mtime to 0, this should be harmless
+  // and avoids conflicting with our return value of 0 meaning
+  // that it doesn't exist.
+  if (st.st_mtime == 0)
+    return 1;
+#if defined(_AIX)
+  return (int64_t)st.st_mtime * 1000000000LL + st.st_mtime_n;
+#elif defined(__APPLE__)
+  return ((int64_t)st.st_mtimespec.tv_sec * 1000000000LL +
+          st.st_mtimespec.tv_nsec);
+#elif defined(st_mtime) // A macro, so we're likely on modern POSIX.
+  return (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+  return (int64_t)st.st_mtime * 1000000000LL + st.st_mtimensec;
+#endif
+}
+
+/// Stat the entries of |dir| relative to it, saving their names into
+/// |names| and their offsets there and timestamps into |stamps|.  A missing
+/// directory has no entries.  Returns false if the entries can't all be
+/// stat'ed this way.
+bool StatAllFilesInDir(const string& dir, string* names,
+                       vector<pair<size_t, TimeStamp> >* stamps) {
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return errno == ENOENT || errno == ENOTDIR;
+  int fd = dirfd(d);
+  bool success = true;
+  while (dirent* entry = readdir(d)) {
+    const char* name = entry->d_name;
+    if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+      continue;
+    struct stat st;
+    if (fstatat(fd, name, &st, 0) < 0) {
+      // E.g. a dangling symlink, or an entry removed since.
+      if (errno == ENOENT || errno == ENOTDIR)
+        continue;
+      success = false;
+      break;
+    }
+    stamps->push_back(make_pair(names->size(), TimeStampFromStat(st)));
+    names->append(name);
+    names->push_back('\0');
+  }
+  closedir(d);
+  return success;
+}
 #endif  // _WIN32
 
 }  // namespace
 
 // DiskInterface ---------------------------------------------------------------
 
-bool DiskInterface::MakeDirs(const string& path) {
+FileReader::Status FileReader::MapFile(const string& path, MappedFile* file,
+                                       string* err) {
+  string contents;
+  Status status = ReadFile(path, &contents, err);
+  if (status == Okay)
+    file->Adopt(&contents);
+  return status;
+}
+
+bool DiskInterface::UpdateFile(const string& path, const string& contents) {
+  MappedFile existing;
+  string err;
+  if (MapFile(path, &existing, &err) == Okay &&
+      existing.size() == contents.size() &&
+      memcmp(existing.data(), contents.data(), contents.size()) == 0)
+    return true;
+  existing.Close();
+  return WriteFile(path, contents);
+}
+
+void DiskInterface::RemoveFiles(const vector<string>& paths,
+                                vector<int>* results) {
+  results->resize(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i)
+    (*results)[i] = RemoveFile(paths[i]);
+}
+
+bool DiskInterface::MakeDirs(const string& path,
+                             unordered_set<string>* existing) {
   string dir = DirName(path);
   if (dir.empty())
     return true;  // Reached root; assume it's there.
+  if (existing && existing->count(dir))
+    return true;
   string err;
   TimeStamp mtime = Stat(dir, &err);
   if (mtime < 0) {
     Error("%s", err.c_str());
     return false;
   }
-  if (mtime > 0)
-    return true;  // Exists already; we're done.
-
-  // Directory doesn't exist.  Try creating its parent first.
-  bool success = MakeDirs(dir);
-  if (!success)
-    return false;
-  return MakeDir(dir);
+  if (mtime == 0) {
+    // Directory doesn't exist.  Try creating its parent first.
+    if (!MakeDirs(dir, existing) || !MakeDir(dir))
+      return false;
+  }
+  if (existing)
+    existing->insert(dir);
+  return true;
 }
 
 // RealDiskInterface -----------------------------------------------------------
@@ -194,6 +278,24 @@ TimeStamp RealDiskInterface::Stat(const string& path, string* err) const {
   DirCache::iterator di = ci->second.find(base);
   return di != ci->second.end() ? di->second : 0;
 #else
+  if (use_cache_) {
+    // "." and ".." aren't among the entries read, and a trailing slash
+    // needs the path to be a directory.
+    string::size_type slash = path.rfind('/');
+    StringPiece base(path.data() + (slash == string::npos ? 0 : slash + 1),
+                     path.size() - (slash == string::npos ? 0 : slash + 1));
+    if (base.len_ && base != "." && base != "..") {
+      const DirCache* cache = LoadDirCache(
+          slash == string::npos ? StringPiece(".") :
+          StringPiece(path.data(), slash == 0 ? 1 : slash));
+      if (cache) {
+        StringPieceHashMap<TimeStamp>::const_iterator i =
+            cache->stamps.find(base);
+        return i != cache->stamps.end() ? i->second : 0;
+      }
+    }
+  }
+
   struct stat st;
   if (stat(path.c_str(), &st) < 0) {
     if (errno == ENOENT || errno == ENOTDIR)
@@ -201,21 +303,67 @@ TimeStamp RealDiskInterface::Stat(const string& path, string* err) const {
     *err = "stat(" + path + "): " + strerror(errno);
     return -1;
   }
-  // Some users (Flatpak) set mtime to 0, this should be harmless
-  // and avoids conflicting with our return value of 0 meaning
-  // that it doesn't exist.
-  if (st.st_mtime == 0)
-    return 1;
-#if defined(_AIX)
-  return (int64_t)st.st_mtime * 1000000000LL + st.st_mtime_n;
-#elif defined(__APPLE__)
-  return ((int64_t)st.st_mtimespec.tv_sec * 1000000000LL +
-          st.st_mtimespec.tv_nsec);
-#elif defined(st_mtime) // A macro, so we're likely on modern POSIX.
-  return (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
-#else
-  return (int64_t)st.st_mtime * 1000000000LL + st.st_mtimensec;
+  return TimeStampFromStat(st);
 #endif
+}
+
+#ifndef _WIN32
+const RealDiskInterface::DirCache*
+RealDiskInterface::LoadDirCache(StringPiece dir) const {
+  DirCache* cache;
+  {
+    lock_guard<mutex> lock(cache_mutex_);
+    Cache::iterator i = cache_.find(dir);
+    if (i != cache_.end()) {
+      cache = i->second;
+    } else {
+      cache = new DirCache(dir);
+      cache_.insert(Cache::value_type(cache->dir, cache));
+    }
+  }
+
+  int state = cache->state.load(memory_order_acquire);
+  if (state == DirCache::kRead)
+    return cache;
+  // Rather than waiting for another thread reading the directory, stat
+  // the entry directly.
+  if (state != DirCache::kUnread ||
+      !cache->state.compare_exchange_strong(state, DirCache::kReading))
+    return NULL;
+
+  vector<pair<size_t, TimeStamp> > stamps;
+  if (!StatAllFilesInDir(cache->dir, &cache->names, &stamps)) {
+    cache->state.store(DirCache::kUnreadable, memory_order_release);
+    return NULL;
+  }
+  for (size_t i = 0; i < stamps.size(); ++i) {
+    const char* name = cache->names.data() + stamps[i].first;
+    cache->stamps.insert(make_pair(StringPiece(name, strlen(name)),
+                                   stamps[i].second));
+  }
+  cache->state.store(DirCache::kRead, memory_order_release);
+  return cache;
+}
+
+void RealDiskInterface::ClearCache() {
+  for (Cache::iterator i = cache_.begin(); i != cache_.end(); ++i)
+    delete i->second;
+  cache_.clear();
+}
+#endif
+
+RealDiskInterface::~RealDiskInterface() {
+#ifndef _WIN32
+  ClearCache();
+#endif
+}
+
+bool RealDiskInterface::IsStatThreadSafe() const {
+#ifdef _WIN32
+  // The stat cache isn't synchronized.
+  return !use_cache_;
+#else
+  return true;
 #endif
 }
 
@@ -254,6 +402,16 @@ bool RealDiskInterface::MakeDir(const string& path) {
   return true;
 }
 
+FileReader::Status RealDiskInterface::MapFile(const string& path,
+                                              MappedFile* file,
+                                              string* err) {
+  switch (file->Open(path, err, true)) {
+  case 0:       return Okay;
+  case -ENOENT: return NotFound;
+  default:      return OtherError;
+  }
+}
+
 FileReader::Status RealDiskInterface::ReadFile(const string& path,
                                                string* contents,
                                                string* err) {
@@ -264,6 +422,65 @@ FileReader::Status RealDiskInterface::ReadFile(const string& path,
   }
 }
 
+#ifndef _WIN32
+int64_t RealDiskInterface::Prefetch(const string& path) const {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return -1;
+  int64_t size = -1;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+#if defined(POSIX_FADV_WILLNEED)
+    // Starts reading in the background, without waiting for it.
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0)
+      size = st.st_size;
+#elif defined(F_RDADVISE)
+    struct radvisory advice;
+    advice.ra_offset = 0;
+    advice.ra_count = st.st_size > INT_MAX ? INT_MAX : (int)st.st_size;
+    if (fcntl(fd, F_RDADVISE, &advice) == 0)
+      size = st.st_size;
+#endif
+  }
+  close(fd);
+  return size;
+}
+
+void RealDiskInterface::RemoveFiles(const vector<string>& paths,
+                                    vector<int>* results) {
+  if (paths.empty())
+    return;
+  string dir = DirName(paths[0]);
+  int dir_fd = open(dir.empty() ? "." : dir.c_str(),
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    // Leave the errors to RemoveFile().
+    DiskInterface::RemoveFiles(paths, results);
+    return;
+  }
+  results->resize(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    const char* name = paths[i].c_str() + dir.size();
+    if (!dir.empty())
+      while (*name == '/')
+        ++name;
+    int ret = unlinkat(dir_fd, name, 0);
+    // Like remove(), also take empty directories.
+    if (ret < 0 && (errno == EISDIR || errno == EPERM))
+      ret = unlinkat(dir_fd, name, AT_REMOVEDIR);
+    if (ret == 0) {
+      (*results)[i] = 0;
+    } else if (errno == ENOENT) {
+      (*results)[i] = 1;
+    } else {
+      Error("remove(%s): %s", paths[i].c_str(), strerror(errno));
+      (*results)[i] = -1;
+    }
+  }
+  close(dir_fd);
+}
+#endif
+
 int RealDiskInterface::RemoveFile(const string& path) {
   if (remove(path.c_str()) < 0) {
     switch (errno) {
@@ -279,9 +496,12 @@ int RealDiskInterface::RemoveFile(const string& path) {
 }
 
 void RealDiskInterface::AllowStatCache(bool allow) {
-#ifdef _WIN32
   use_cache_ = allow;
-  if (!use_cache_)
+  if (!use_cache_) {
+#ifdef _WIN32
     cache_.clear();
+#else
+    ClearCache();
 #endif
+  }
 }
@@ -15,11 +15,18 @@
 #ifndef NINJA_DISK_INTERFACE_H_
 #define NINJA_DISK_INTERFACE_H_
 
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <string>
+#include <unordered_set>
+#include <vector>
 
+#include "hash_map.h"
 #include "timestamp.h"
 
+struct MappedFile;
+
 /// Interface for reading files from disk.  See DiskInterface for details.
 /// This base offers the minimum interface needed just to read files.
 struct FileReader {
@@ -36,6 +43,11 @@ struct FileReader {
   /// On error, return another Status and fill |err|.
   virtual Status ReadFile(const std::string& path, std::string* contents,
                           std::string* err) = 0;
+
+  /// Make |file| hold the contents of |path|, followed by a nul byte, for
+  /// parsing in place.  The default reads it with ReadFile().
+  virtual Status MapFile(const std::string& path, MappedFile* file,
+                         std::string* err);
 };
 
 /// Interface for accessing the disk.
@@ -47,6 +59,13 @@ struct DiskInterface: public FileReader {
   /// other errors.
   virtual TimeStamp Stat(const std::string& path, std::string* err) const = 0;
 
+  /// Whether Stat() may be called from several threads at once.
+  virtual bool IsStatThreadSafe() const { return false; }
+
+  /// Whether ReadFile() may be called from several threads at once, and
+  /// concurrently with the other methods.
+  virtual bool IsReadThreadSafe() const { return false; }
+
   /// Create a directory, returning false on failure.
   virtual bool MakeDir(const std::string& path) = 0;
 
@@ -55,6 +74,11 @@ struct DiskInterface: public FileReader {
   virtual bool WriteFile(const std::string& path,
                          const std::string& contents) = 0;
 
+  /// Like WriteFile(), but leave |path| alone if it holds |contents|
+  /// already, so that a large file isn't written again for nothing.
+  virtual bool UpdateFile(const std::string& path,
+                          const std::string& contents);
+
   /// Remove the file named @a path. It behaves like 'rm -f path' so no errors
   /// are reported if it does not exists.
   /// @returns 0 if the file has been removed,
@@ -62,39 +86,91 @@ struct DiskInterface: public FileReader {
   ///          -1 if an error occurs.
   virtual int RemoveFile(const std::string& path) = 0;
 
+  /// Remove the files |paths|, all in the same directory, as RemoveFile()
+  /// would, and store what it would have returned for each in |results|.
+  virtual void RemoveFiles(const std::vector<std::string>& paths,
+                           std::vector<int>* results);
+
+  /// Whether RemoveFile() and RemoveFiles() may be called from several
+  /// threads at once.
+  virtual bool IsRemoveThreadSafe() const { return false; }
+
+  /// Have the operating system start reading the file |path| into its
+  /// cache, as a command is about to read it.  Safe to call from any
+  /// thread.  The default does nothing.
+  /// @return the size of the file, or -1 if it wasn't read ahead.
+  virtual int64_t Prefetch(const std::string& path) const { return -1; }
+
   /// Create all the parent directories for path; like mkdir -p
   /// `basename path`.
-  bool MakeDirs(const std::string& path);
+  /// If |existing| isn't NULL, the directories in it are known to exist
+  /// and aren't stat'ed, and those found or created are added to it.
+  bool MakeDirs(const std::string& path,
+                std::unordered_set<std::string>* existing = NULL);
 };
 
 /// Implementation of DiskInterface that actually hits the disk.
 struct RealDiskInterface : public DiskInterface {
-  RealDiskInterface()
-#ifdef _WIN32
-                      : use_cache_(false)
-#endif
-                      {}
-  virtual ~RealDiskInterface() {}
+  RealDiskInterface() : use_cache_(false) {}
+  virtual ~RealDiskInterface();
   virtual TimeStamp Stat(const std::string& path, std::string* err) const;
+  virtual bool IsStatThreadSafe() const;
+  virtual bool IsReadThreadSafe() const { return true; }
   virtual bool MakeDir(const std::string& path);
   virtual bool WriteFile(const std::string& path, const std::string& contents);
   virtual Status ReadFile(const std::string& path, std::string* contents,
                           std::string* err);
+  /// Maps large files into memory rather than copying them.
+  virtual Status MapFile(const std::string& path, MappedFile* file,
+                         std::string* err);
   virtual int RemoveFile(const std::string& path);
+#ifndef _WIN32
+  /// Opens the directory once, and unlinks each file relative to it.
+  virtual void RemoveFiles(const std::vector<std::string>& paths,
+                           std::vector<int>* results);
+#endif
+  virtual bool IsRemoveThreadSafe() const { return true; }
+#ifndef _WIN32
+  virtual int64_t Prefetch(const std::string& path) const;
+#endif
 
-  /// Whether stat information can be cached.  Only has an effect on Windows.
+  /// Whether stat information can be cached.  While it is, the entries of
+  /// each directory are stat'ed together the first time one of them is.
   void AllowStatCache(bool allow);
 
  private:
-#ifdef _WIN32
   /// Whether stat information can be cached.
   bool use_cache_;
 
+#ifdef _WIN32
   typedef std::map<std::string, TimeStamp> DirCache;
   // TODO: Neither a map nor a hashmap seems ideal here.  If the statcache
   // works out, come up with a better data structure.
   typedef std::map<std::string, DirCache> Cache;
   mutable Cache cache_;
+#else
+  /// The timestamps of the entries of a directory.  They're filled in by
+  /// the first thread to ask, and only read after that, so lookups don't
+  /// need a lock.
+  struct DirCache {
+    explicit DirCache(StringPiece dir) : dir(dir.AsString()), state(kUnread) {}
+    enum State { kUnread, kReading, kRead, kUnreadable };
+    std::string dir;
+    std::atomic<int> state;
+    /// The names of the entries, NUL-separated; |stamps| points into it.
+    std::string names;
+    StringPieceHashMap<TimeStamp> stamps;
+  };
+  /// Return the cache of |dir|, reading it if needed.  Returns NULL if the
+  /// directory can't be read, or is being read by another thread; its
+  /// entries are stat'ed one by one then.
+  const DirCache* LoadDirCache(StringPiece dir) const;
+  void ClearCache();
+
+  typedef ExternalStringHashMap<DirCache*>::Type Cache;
+  mutable Cache cache_;
+  /// Guards |cache_|, which Stat() calls on several threads share.
+  mutable std::mutex cache_mutex_;
 #endif
 };
 
@@ -17,10 +17,13 @@
 #ifdef _WIN32
 #include <io.h>
 #include <windows.h>
+#else
+#include <unistd.h>
 #endif
 
 #include "disk_interface.h"
 #include "graph.h"
+#include "mapped_file.h"
 #include "test.h"
 
 using namespace std;
@@ -166,6 +169,47 @@ TEST_F(DiskInterfaceTest, StatCache) {
   EXPECT_EQ(0, disk_.Stat("nosuchdir/nosuchfile", &err));
   EXPECT_EQ("", err);
 }
+#else
+TEST_F(DiskInterfaceTest, StatCache) {
+  string err;
+
+  ASSERT_TRUE(Touch("file1"));
+  ASSERT_TRUE(disk_.MakeDir("subdir"));
+  ASSERT_TRUE(disk_.MakeDir("subdir/subsubdir"));
+  ASSERT_TRUE(Touch("subdir/subfile1"));
+  ASSERT_EQ(0, symlink("subfile1", "subdir/link"));
+  ASSERT_EQ(0, symlink("nosuchfile", "subdir/dangling"));
+
+  TimeStamp file1 = disk_.Stat("file1", &err);
+  TimeStamp subfile1 = disk_.Stat("subdir/subfile1", &err);
+  TimeStamp subdir = disk_.Stat("subdir", &err);
+  TimeStamp parent = disk_.Stat("..", &err);
+  disk_.AllowStatCache(true);
+
+  EXPECT_EQ(file1, disk_.Stat("file1", &err));
+  EXPECT_EQ(subfile1, disk_.Stat("subdir/subfile1", &err));
+  EXPECT_EQ(subfile1, disk_.Stat("subdir/link", &err));
+  EXPECT_EQ(0, disk_.Stat("subdir/dangling", &err));
+  EXPECT_EQ(subdir, disk_.Stat("subdir", &err));
+  EXPECT_EQ(subdir, disk_.Stat("subdir/.", &err));
+  EXPECT_EQ(subdir, disk_.Stat("subdir/subsubdir/..", &err));
+  EXPECT_EQ(subdir, disk_.Stat("subdir/", &err));
+  EXPECT_EQ(parent, disk_.Stat("..", &err));
+  EXPECT_GT(disk_.Stat("/", &err), 1);
+  EXPECT_EQ(file1, disk_.Stat(temp_dir_.start_dir_ + "/" +
+                              temp_dir_.temp_dir_name_ + "/file1", &err));
+  EXPECT_EQ(0, disk_.Stat("nosuchfile", &err));
+  EXPECT_EQ(0, disk_.Stat("nosuchdir/nosuchfile", &err));
+  EXPECT_EQ(0, disk_.Stat("file1/nosuchfile", &err));
+  EXPECT_EQ("", err);
+
+  // Directories are read once, until the cache is dropped.
+  ASSERT_TRUE(Touch("subdir/subfile2"));
+  EXPECT_EQ(0, disk_.Stat("subdir/subfile2", &err));
+  disk_.AllowStatCache(false);
+  EXPECT_GT(disk_.Stat("subdir/subfile2", &err), 1);
+  EXPECT_EQ("", err);
+}
 #endif
 
 TEST_F(DiskInterfaceTest, ReadFile) {
@@ -190,6 +234,42 @@ TEST_F(DiskInterfaceTest, ReadFile) {
   EXPECT_EQ("", err);
 }
 
+#ifndef _WIN32
+TEST_F(DiskInterfaceTest, Prefetch) {
+  EXPECT_EQ(-1, disk_.Prefetch("foobar"));
+  ASSERT_TRUE(disk_.MakeDir("subdir"));
+  EXPECT_EQ(-1, disk_.Prefetch("subdir"));
+
+  ASSERT_TRUE(disk_.WriteFile("testfile", "test content"));
+  int64_t size = disk_.Prefetch("testfile");
+  // Some systems can't read ahead.
+  if (size != -1)
+    EXPECT_EQ(12, size);
+}
+#endif
+
+TEST_F(DiskInterfaceTest, MapFile) {
+  string err;
+  MappedFile file;
+  ASSERT_EQ(DiskInterface::NotFound, disk_.MapFile("foobar", &file, &err));
+  EXPECT_NE("", err);
+  err.clear();
+
+  // Empty, small enough to be read, and large enough to be mapped with the
+  // file filling its last page.
+  const size_t kSizes[] = { 0, 15, 1 << 20 };
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); ++i) {
+    string content(kSizes[i], 'x');
+    ASSERT_TRUE(disk_.WriteFile("testfile", content));
+    ASSERT_EQ(DiskInterface::Okay, disk_.MapFile("testfile", &file, &err));
+    EXPECT_EQ("", err);
+    ASSERT_EQ(content.size(), file.size());
+    EXPECT_EQ(content, string(file.data(), file.size()));
+    EXPECT_EQ('\0', file.data()[file.size()]);
+    file.Close();
+  }
+}
+
 TEST_F(DiskInterfaceTest, MakeDirs) {
   string path = "path/with/double//slash/";
   EXPECT_TRUE(disk_.MakeDirs(path));
@@ -205,6 +285,22 @@ TEST_F(DiskInterfaceTest, MakeDirs) {
 #endif
 }
 
+TEST_F(DiskInterfaceTest, MakeDirsExisting) {
+  string err;
+  unordered_set<string> existing;
+  EXPECT_TRUE(disk_.MakeDirs("a/b/c/file", &existing));
+  EXPECT_EQ(3u, existing.size());
+  EXPECT_EQ(1u, existing.count("a/b"));
+  EXPECT_TRUE(disk_.MakeDirs("a/b/d/file", &existing));
+  EXPECT_EQ(4u, existing.size());
+  EXPECT_GT(disk_.Stat("a/b/d", &err), 0);
+
+  // Directories known to exist are taken at their word.
+  existing.insert("known");
+  EXPECT_TRUE(disk_.MakeDirs("known/file", &existing));
+  EXPECT_EQ(0, disk_.Stat("known", &err));
+}
+
 TEST_F(DiskInterfaceTest, RemoveFile) {
   const char* kFileName = "file-to-remove";
   ASSERT_TRUE(Touch(kFileName));
@@ -213,6 +309,36 @@ TEST_F(DiskInterfaceTest, RemoveFile) {
   EXPECT_EQ(1, disk_.RemoveFile("does not exist"));
 }
 
+TEST_F(DiskInterfaceTest, RemoveFiles) {
+  ASSERT_TRUE(disk_.MakeDir("subdir"));
+  ASSERT_TRUE(disk_.MakeDir("subdir/empty"));
+  ASSERT_TRUE(Touch("subdir/a"));
+  ASSERT_TRUE(Touch("subdir/b"));
+  vector<string> paths;
+  paths.push_back("subdir/a");
+  paths.push_back("subdir/missing");
+  paths.push_back("subdir/b");
+  paths.push_back("subdir/empty");
+  vector<int> results;
+  disk_.RemoveFiles(paths, &results);
+  ASSERT_EQ(4u, results.size());
+  EXPECT_EQ(0, results[0]);
+  EXPECT_EQ(1, results[1]);
+  EXPECT_EQ(0, results[2]);
+  EXPECT_EQ(0, results[3]);
+  string err;
+  EXPECT_EQ(0, disk_.Stat("subdir/a", &err));
+  EXPECT_EQ(0, disk_.Stat("subdir/empty", &err));
+
+  // Files at the top level are removed relative to the current directory.
+  ASSERT_TRUE(Touch("top"));
+  paths.assign(1, "top");
+  disk_.RemoveFiles(paths, &results);
+  ASSERT_EQ(1u, results.size());
+  EXPECT_EQ(0, results[0]);
+  EXPECT_EQ(1, disk_.RemoveFile("top"));
+}
+
 struct StatTest : public StateTestWithBuiltinRules,
                   public DiskInterface {
   StatTest() : scan_(&state_, NULL, NULL, this, NULL) {}
@@ -21,7 +21,10 @@
 #include "disk_interface.h"
 #include "dyndep_parser.h"
 #include "graph.h"
+#include "metrics.h"
+#include "parallel.h"
 #include "state.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace std;
@@ -33,6 +36,7 @@ bool DyndepLoader::LoadDyndeps(Node* node, std::string* err) const {
 
 bool DyndepLoader::LoadDyndeps(Node* node, DyndepFile* ddf,
                                std::string* err) const {
+  TRACE_RECORD("dyndep load");
   // We are loading the dyndep file now so it is no longer pending.
   node->set_dyndep_pending(false);
 
@@ -40,7 +44,60 @@ bool DyndepLoader::LoadDyndeps(Node* node, DyndepFile* ddf,
   EXPLAIN("loading dyndep file '%s'", node->path().c_str());
   if (!LoadDyndepFile(node, ddf, err))
     return false;
+  return UpdateEdges(node, ddf, err);
+}
+
+bool DyndepLoader::LoadDyndeps(const vector<Node*>& nodes,
+                               vector<DyndepFile>* ddfs,
+                               vector<string>* errs) const {
+  const int kParseThreads = 16;
+  TRACE_RECORD("dyndep load");
+  ddfs->assign(nodes.size(), DyndepFile());
+  errs->assign(nodes.size(), string());
+  for (vector<Node*>::const_iterator n = nodes.begin(); n != nodes.end();
+       ++n) {
+    (*n)->set_dyndep_pending(false);
+    EXPLAIN("loading dyndep file '%s'", (*n)->path().c_str());
+  }
+
+  // Parse the files without touching the State, which is only read until
+  // they're all done.  Metrics aren't synchronized.
+  vector<char> parsed(nodes.size());
+  bool parallel = disk_interface_->IsReadThreadSafe() && !g_metrics;
+  ParallelFor(nodes.size(), parallel ? kParseThreads : 1, [&](size_t i) {
+    DyndepParser parser(state_, disk_interface_, &(*ddfs)[i], false);
+    parsed[i] = parser.Load(nodes[i]->path(), &(*errs)[i]);
+  });
+
+  bool ok = true;
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    DyndepFile* ddf = &(*ddfs)[i];
+    if (parsed[i]) {
+      for (DyndepFile::iterator d = ddf->begin(); d != ddf->end(); ++d) {
+        Dyndeps* dyndeps = &d->second;
+        for (size_t j = 0; j < dyndeps->implicit_input_paths_.size(); ++j) {
+          dyndeps->implicit_inputs_.push_back(
+              state_->GetNode(dyndeps->implicit_input_paths_[j].first,
+                              dyndeps->implicit_input_paths_[j].second));
+        }
+        for (size_t j = 0; j < dyndeps->implicit_output_paths_.size(); ++j) {
+          dyndeps->implicit_outputs_.push_back(
+              state_->GetNode(dyndeps->implicit_output_paths_[j].first,
+                              dyndeps->implicit_output_paths_[j].second));
+        }
+        dyndeps->implicit_input_paths_.clear();
+        dyndeps->implicit_output_paths_.clear();
+      }
+      if (UpdateEdges(nodes[i], ddf, &(*errs)[i]))
+        continue;
+    }
+    ok = false;
+  }
+  return ok;
+}
 
+bool DyndepLoader::UpdateEdges(Node* node, DyndepFile* ddf,
+                               string* err) const {
   // Update each edge that specified this node as its dyndep binding.
   std::vector<Edge*> const& out_edges = node->out_edges();
   for (std::vector<Edge*>::const_iterator oe = out_edges.begin();
@@ -84,8 +141,10 @@ bool DyndepLoader::UpdateEdge(Edge* edge, Dyndeps const* dyndeps,
   // Add dyndep-discovered bindings to the edge.
   // We know the edge already has its own binding
   // scope because it has a "dyndep" binding.
-  if (dyndeps->restat_)
+  if (dyndeps->restat_) {
     edge->env_->AddBinding("restat", "1");
+    edge->ForgetBindingBools();
+  }
 
   // Add the dyndep-discovered outputs to the edge.
   edge->outputs_.insert(edge->outputs_.end(),
@@ -17,8 +17,11 @@
 
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <stdint.h>
+
 struct DiskInterface;
 struct Edge;
 struct Node;
@@ -31,6 +34,10 @@ struct Dyndeps {
   bool restat_;
   std::vector<Node*> implicit_inputs_;
   std::vector<Node*> implicit_outputs_;
+  /// The canonical paths and slash bits of the implicit inputs and outputs
+  /// parsed without creating their nodes, until the loader does.
+  std::vector<std::pair<std::string, uint64_t> > implicit_input_paths_;
+  std::vector<std::pair<std::string, uint64_t> > implicit_output_paths_;
 };
 
 /// Store data loaded from one dyndep file.  Map from an edge
@@ -52,9 +59,21 @@ struct DyndepLoader {
   bool LoadDyndeps(Node* node, std::string* err) const;
   bool LoadDyndeps(Node* node, DyndepFile* ddf, std::string* err) const;
 
+  /// Load the dyndep files of |nodes| into |ddfs|, reading and parsing them
+  /// on several threads if the disk interface allows it, then update the
+  /// build graph with each in turn.  A file failing to load leaves its
+  /// error in |errs|; the others load anyway.
+  /// @return false if any failed.
+  bool LoadDyndeps(const std::vector<Node*>& nodes,
+                   std::vector<DyndepFile>* ddfs,
+                   std::vector<std::string>* errs) const;
+
  private:
   bool LoadDyndepFile(Node* file, DyndepFile* ddf, std::string* err) const;
 
+  /// Update the edges that have |node| as their dyndep binding.
+  bool UpdateEdges(Node* node, DyndepFile* ddf, std::string* err) const;
+
   bool UpdateEdge(Edge* edge, Dyndeps const* dyndeps, std::string* err) const;
 
   State* state_;
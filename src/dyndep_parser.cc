@@ -25,12 +25,13 @@
 using namespace std;
 
 DyndepParser::DyndepParser(State* state, FileReader* file_reader,
-                           DyndepFile* dyndep_file)
+                           DyndepFile* dyndep_file, bool create_nodes)
     : Parser(state, file_reader)
-    , dyndep_file_(dyndep_file) {
+    , dyndep_file_(dyndep_file)
+    , create_nodes_(create_nodes) {
 }
 
-bool DyndepParser::Parse(const string& filename, const string& input,
+bool DyndepParser::Parse(const string& filename, StringPiece input,
                          string* err) {
   lexer_.Start(filename, input);
 
@@ -206,6 +207,10 @@ bool DyndepParser::ParseEdge(string* err) {
     uint64_t slash_bits;
     if (!CanonicalizePath(&path, &slash_bits, &path_err))
       return lexer_.Error(path_err, err);
+    if (!create_nodes_) {
+      dyndeps->implicit_input_paths_.push_back(make_pair(path, slash_bits));
+      continue;
+    }
     Node* n = state_->GetNode(path, slash_bits);
     dyndeps->implicit_inputs_.push_back(n);
   }
@@ -217,6 +222,10 @@ bool DyndepParser::ParseEdge(string* err) {
     uint64_t slash_bits;
     if (!CanonicalizePath(&path, &slash_bits, &path_err))
       return lexer_.Error(path_err, err);
+    if (!create_nodes_) {
+      dyndeps->implicit_output_paths_.push_back(make_pair(path, slash_bits));
+      continue;
+    }
     Node* n = state_->GetNode(path, slash_bits);
     dyndeps->implicit_outputs_.push_back(n);
   }
@@ -23,8 +23,11 @@ struct EvalString;
 
 /// Parses dyndep files.
 struct DyndepParser: public Parser {
+  /// Unless |create_nodes|, the implicit inputs and outputs are left as
+  /// paths in Dyndeps::implicit_input_paths_ and implicit_output_paths_,
+  /// and the State is only read, so that files can be parsed in parallel.
   DyndepParser(State* state, FileReader* file_reader,
-               DyndepFile* dyndep_file);
+               DyndepFile* dyndep_file, bool create_nodes = true);
 
   /// Parse a text string of input.  Used by tests.
   bool ParseTest(const std::string& input, std::string* err) {
@@ -32,8 +35,8 @@ struct DyndepParser: public Parser {
   }
 
 private:
-  /// Parse a file, given its contents as a string.
-  bool Parse(const std::string& filename, const std::string& input,
+  /// Parse a file, given its contents.
+  bool Parse(const std::string& filename, StringPiece input,
              std:: string* err);
 
   bool ParseDyndepVersion(std::string* err);
@@ -41,6 +44,7 @@ private:
   bool ParseEdge(std::string* err);
 
   DyndepFile* dyndep_file_;
+  bool create_nodes_;
   BindingEnv env_;
 };
 
@@ -14,6 +14,8 @@
 
 #include "edit_distance.h"
 
+#include <stdlib.h>
+
 #include <algorithm>
 #include <vector>
 
@@ -69,3 +71,58 @@ int EditDistance(const StringPiece& s1,
 
   return row[n];
 }
+
+EditDistanceMatcher::EditDistanceMatcher(const StringPiece& pattern)
+    : pattern_(pattern) {
+  fill(peq_, peq_ + 256, 0);
+  if (pattern_.len_ > 64)
+    return;
+  for (size_t i = 0; i < pattern_.len_; ++i)
+    peq_[(unsigned char)pattern_.str_[i]] |= uint64_t(1) << i;
+}
+
+int EditDistanceMatcher::Distance(const StringPiece& text,
+                                  int max_edit_distance) const {
+  int m = pattern_.len_;
+  int n = text.len_;
+  // Every extra byte takes an edit.
+  if (abs(m - n) > max_edit_distance)
+    return max_edit_distance + 1;
+  if (m == 0)
+    return min(n, max_edit_distance + 1);
+  if (m > 64) {
+    return min(EditDistance(text, pattern_, true, max_edit_distance),
+               max_edit_distance + 1);
+  }
+
+  // Myers, "A fast bit-vector algorithm for approximate string matching
+  // based on dynamic programming" (1999), in Hyyro's formulation for the
+  // distance between whole strings.  Bit i of |pv| (|mv|) is set when the
+  // column's entry at row i + 1 is one more (less) than the one above it,
+  // and |score| tracks the entry in the last row.
+  const uint64_t last = uint64_t(1) << (m - 1);
+  uint64_t pv = ~uint64_t(0);
+  uint64_t mv = 0;
+  int score = m;
+  for (int j = 0; j < n; ++j) {
+    uint64_t eq = peq_[(unsigned char)text.str_[j]];
+    uint64_t xv = eq | mv;
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+    if (ph & last)
+      ++score;
+    else if (mh & last)
+      --score;
+    // The first row counts up by one per column.
+    ph = (ph << 1) | 1;
+    mh <<= 1;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+
+    // The score drops by at most one per remaining column.
+    if (score - (n - j - 1) > max_edit_distance)
+      return max_edit_distance + 1;
+  }
+  return min(score, max_edit_distance + 1);
+}
@@ -15,6 +15,8 @@
 #ifndef NINJA_EDIT_DISTANCE_H_
 #define NINJA_EDIT_DISTANCE_H_
 
+#include <stdint.h>
+
 #include "string_piece.h"
 
 int EditDistance(const StringPiece& s1,
@@ -22,4 +24,22 @@ int EditDistance(const StringPiece& s1,
                  bool allow_replacements = true,
                  int max_edit_distance = 0);
 
+/// Computes the edit distance, with replacements allowed, of many strings
+/// to one |pattern|, as a spell checker does.  Patterns of at most 64 bytes
+/// use Myers' bit-parallel algorithm, which handles a whole column of the
+/// dynamic-programming table per character in a few word operations; longer
+/// ones fall back to EditDistance().
+struct EditDistanceMatcher {
+  explicit EditDistanceMatcher(const StringPiece& pattern);
+
+  /// The distance from |text| to the pattern, or, if it is more than
+  /// |max_edit_distance|, max_edit_distance + 1.
+  int Distance(const StringPiece& text, int max_edit_distance) const;
+
+ private:
+  StringPiece pattern_;
+  /// The bits of the pattern positions holding each byte.
+  uint64_t peq_[256];
+};
+
 #endif  // NINJA_EDIT_DISTANCE_H_
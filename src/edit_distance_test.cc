@@ -14,8 +14,14 @@
 
 #include "edit_distance.h"
 
+#include <stdlib.h>
+
+#include <string>
+
 #include "test.h"
 
+using namespace std;
+
 TEST(EditDistanceTest, TestEmpty) {
   EXPECT_EQ(5, EditDistance("", "ninja"));
   EXPECT_EQ(5, EditDistance("ninja", ""));
@@ -46,3 +52,42 @@ TEST(EditDistanceTest, TestBasics) {
   EXPECT_EQ(1, EditDistance("browser_test", "browser_tests"));
   EXPECT_EQ(1, EditDistance("browser_tests", "browser_test"));
 }
+
+TEST(EditDistanceTest, MatcherBasics) {
+  EditDistanceMatcher matcher("browser_tests");
+  EXPECT_EQ(0, matcher.Distance("browser_tests", 3));
+  EXPECT_EQ(1, matcher.Distance("browser_test", 3));
+  EXPECT_EQ(2, matcher.Distance("browsr_tsts", 3));
+  EXPECT_EQ(4, matcher.Distance("", 3));
+  EXPECT_EQ(4, matcher.Distance("stset_resworb", 3));
+
+  EditDistanceMatcher empty("");
+  EXPECT_EQ(2, empty.Distance("ab", 3));
+  EXPECT_EQ(4, empty.Distance("abcdef", 3));
+}
+
+TEST(EditDistanceTest, MatcherAgreesWithEditDistance) {
+  // Random strings over a small alphabet, so that they have a lot in
+  // common, and both sides of the 64 byte limit.
+  srand(1);
+  for (int i = 0; i < 2000; ++i) {
+    string a, b;
+    int a_len = rand() % 80;
+    int b_len = a_len + rand() % 7 - 3;
+    for (int j = 0; j < a_len; ++j)
+      a.push_back("abc/"[rand() % 4]);
+    for (int j = 0; j < b_len; ++j)
+      b.push_back("abc/"[rand() % 4]);
+    if (i % 2) {
+      // Near misses.
+      b = a;
+      for (int edits = rand() % 5; edits > 0 && !b.empty(); --edits)
+        b[rand() % b.size()] = 'x';
+    }
+
+    int distance = EditDistance(a, b);
+    EditDistanceMatcher matcher(a);
+    for (int max = 0; max < 6; ++max)
+      EXPECT_EQ(distance > max ? max + 1 : distance, matcher.Distance(b, max));
+  }
+}
@@ -14,21 +14,172 @@
 
 #include <assert.h>
 
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "eval_env.h"
+#include "hash_map.h"
+#include "memory_stats.h"
 
 using namespace std;
 
-string BindingEnv::LookupVariable(const string& var) {
-  map<string, string>::iterator i = bindings_.find(var);
-  if (i != bindings_.end())
-    return i->second;
-  if (parent_)
-    return parent_->LookupVariable(var);
+namespace {
+
+/// The interned variable names.  Looking up a name interned already, or
+/// the name of a symbol, takes no lock: the names are never freed, and a
+/// table that grows is copied, the old one staying for the threads that
+/// may still be reading it.  Only interning a new name takes the lock.
+struct SymbolTable {
+  SymbolTable() : size_(0) {
+    tables_.emplace_back(new Table(64));
+    current_.store(tables_.back().get(), memory_order_release);
+    Intern("in");
+    Intern("in_newline");
+    Intern("out");
+    Intern("cache");
+    Intern("command");
+    Intern("depfile");
+    Intern("deps");
+    Intern("description");
+    Intern("dyndep");
+    Intern("generator");
+    Intern("hash_inputs");
+    Intern("msvc_deps_prefix");
+    Intern("pool");
+    Intern("pool_resources");
+    Intern("pool_weight");
+    Intern("priority");
+    Intern("remote");
+    Intern("restat");
+    Intern("rspfile");
+    Intern("rspfile_content");
+    Intern("rspfile_keep");
+    Intern("stream_output");
+    Intern("depfile_fd");
+    assert(size_ == kPredefinedSymbols);
+  }
+
+  Symbol Intern(StringPiece name) {
+    unsigned hash = MurmurHash2(name.str_, name.len_);
+    if (const Entry* entry =
+            Find(current_.load(memory_order_acquire), name, hash))
+      return entry->symbol;
+
+    lock_guard<mutex> lock(mutex_);
+    Table* table = current_.load(memory_order_relaxed);
+    if (const Entry* entry = Find(table, name, hash))
+      return entry->symbol;
+    if ((size_ + 1) * 2 > table->capacity)
+      table = Grow(table);
+    entries_.push_back(Entry(name.AsString(), hash, size_));
+    const Entry* entry = &entries_.back();
+    table->names[size_++] = entry;
+    // Publishes the entry, and its name, to the threads that find it.
+    table->slots[FreeSlot(table, hash)].store(entry, memory_order_release);
+    return entry->symbol;
+  }
+
+  const string& Name(Symbol symbol) {
+    const Table* table = current_.load(memory_order_acquire);
+    assert(symbol < table->capacity / 2 && table->names[symbol]);
+    return table->names[symbol]->name;
+  }
+
+ private:
+  struct Entry {
+    Entry(const string& name, unsigned hash, Symbol symbol)
+        : name(name), hash(hash), symbol(symbol) {}
+    string name;
+    unsigned hash;
+    Symbol symbol;
+  };
+
+  /// The entries by name, with open addressing, and by symbol, up to half
+  /// the capacity.
+  struct Table {
+    explicit Table(size_t capacity)
+        : capacity(capacity), slots(new atomic<const Entry*>[capacity]),
+          names(new const Entry*[capacity / 2]()) {
+      for (size_t i = 0; i < capacity; ++i)
+        slots[i].store(NULL, memory_order_relaxed);
+    }
+    size_t capacity;
+    unique_ptr<atomic<const Entry*>[]> slots;
+    unique_ptr<const Entry*[]> names;
+  };
+
+  static const Entry* Find(const Table* table, StringPiece name,
+                           unsigned hash) {
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const Entry* entry = table->slots[i].load(memory_order_acquire);
+      if (!entry)
+        return NULL;
+      if (entry->hash == hash && StringPiece(entry->name) == name)
+        return entry;
+    }
+  }
+
+  static size_t FreeSlot(const Table* table, unsigned hash) {
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+    while (table->slots[i].load(memory_order_relaxed))
+      i = (i + 1) & mask;
+    return i;
+  }
+
+  /// Copy |table| into one twice as large, and make it the current one.
+  Table* Grow(const Table* table) {
+    Table* grown = new Table(table->capacity * 2);
+    tables_.emplace_back(grown);
+    for (Symbol symbol = 0; symbol < size_; ++symbol) {
+      const Entry* entry = table->names[symbol];
+      grown->names[symbol] = entry;
+      grown->slots[FreeSlot(grown, entry->hash)].store(entry,
+                                                       memory_order_relaxed);
+    }
+    current_.store(grown, memory_order_release);
+    return grown;
+  }
+
+  /// Guards the changes, not the lookups.
+  mutex mutex_;
+  /// The entries, in a deque that keeps them in place.
+  deque<Entry> entries_;
+  Symbol size_;
+  /// Every table the symbols were in, the current one last.
+  vector<unique_ptr<Table> > tables_;
+  atomic<Table*> current_;
+};
+
+SymbolTable& GetSymbolTable() {
+  static SymbolTable* table = new SymbolTable;
+  return *table;
+}
+
+}  // namespace
+
+Symbol InternSymbol(StringPiece name) {
+  return GetSymbolTable().Intern(name);
+}
+
+const string& SymbolName(Symbol symbol) {
+  return GetSymbolTable().Name(symbol);
+}
+
+string BindingEnv::LookupVariable(Symbol var) {
+  for (BindingEnv* env = this; env; env = env->parent_) {
+    if (const string* value = env->bindings_.Find(var))
+      return *value;
+  }
   return "";
 }
 
 void BindingEnv::AddBinding(const string& key, const string& val) {
-  bindings_[key] = val;
+  bindings_[InternSymbol(key)] = val;
 }
 
 void BindingEnv::AddRule(const Rule* rule) {
@@ -53,28 +204,46 @@ const Rule* BindingEnv::LookupRule(const string& rule_name) {
 }
 
 void Rule::AddBinding(const string& key, const EvalString& val) {
-  bindings_[key] = val;
+  bindings_[InternSymbol(key)] = val;
 }
 
 const EvalString* Rule::GetBinding(const string& key) const {
-  Bindings::const_iterator i = bindings_.find(key);
-  if (i == bindings_.end())
-    return NULL;
-  return &i->second;
+  return GetBinding(InternSymbol(key));
+}
+
+void Rule::CountMemory(MemoryStats* stats) const {
+  int64_t tokens = 0;
+  int64_t token_bytes = 0;
+  bindings_.ForEach([&](Symbol, const EvalString& value) {
+    tokens += value.token_count();
+    token_bytes += value.HeapBytes();
+  });
+  stats->Add("Rule", 1, sizeof(Rule) + MemoryStats::HeapBytes(name_) +
+                            bindings_.slot_bytes());
+  stats->Add("EvalString tokens", tokens, token_bytes);
 }
 
 // static
 bool Rule::IsReservedBinding(const string& var) {
-  return var == "command" ||
+  return var == "cache" ||
+      var == "command" ||
       var == "depfile" ||
+      var == "depfile_fd" ||
       var == "dyndep" ||
       var == "description" ||
       var == "deps" ||
       var == "generator" ||
+      var == "hash_inputs" ||
       var == "pool" ||
+      var == "pool_resources" ||
+      var == "pool_weight" ||
+      var == "priority" ||
+      var == "remote" ||
       var == "restat" ||
       var == "rspfile" ||
       var == "rspfile_content" ||
+      var == "rspfile_keep" ||
+      var == "stream_output" ||
       var == "msvc_deps_prefix";
 }
 
@@ -82,12 +251,24 @@ const map<string, const Rule*>& BindingEnv::GetRules() const {
   return rules_;
 }
 
-string BindingEnv::LookupWithFallback(const string& var,
-                                      const EvalString* eval,
+int64_t BindingEnv::HeapBytes() const {
+  int64_t bytes = bindings_.slot_bytes();
+  bindings_.ForEach([&](Symbol, const string& value) {
+    bytes += MemoryStats::HeapBytes(value);
+  });
+  // A node of the tree: the value, three links and a color.
+  const int64_t kRuleNodeBytes =
+      sizeof(map<string, const Rule*>::value_type) + 4 * sizeof(void*);
+  for (map<string, const Rule*>::const_iterator i = rules_.begin();
+       i != rules_.end(); ++i)
+    bytes += kRuleNodeBytes + MemoryStats::HeapBytes(i->first);
+  return bytes;
+}
+
+string BindingEnv::LookupWithFallback(Symbol var, const EvalString* eval,
                                       Env* env) {
-  map<string, string>::iterator i = bindings_.find(var);
-  if (i != bindings_.end())
-    return i->second;
+  if (const string* value = bindings_.Find(var))
+    return *value;
 
   if (eval)
     return eval->Evaluate(env);
@@ -99,26 +280,52 @@ string BindingEnv::LookupWithFallback(const string& var,
 }
 
 string EvalString::Evaluate(Env* env) const {
+  // Look the variables up first, so that the result is allocated once.
+  vector<string> values;
+  size_t size = text_.size();
+  for (TokenList::const_iterator i = parsed_.begin(); i != parsed_.end(); ++i) {
+    if (i->type == SPECIAL) {
+      values.push_back(env->LookupVariable(i->symbol));
+      size += values.back().size();
+    }
+  }
+  if (values.empty())
+    return text_;
+
   string result;
+  result.reserve(size);
+  vector<string>::const_iterator value = values.begin();
   for (TokenList::const_iterator i = parsed_.begin(); i != parsed_.end(); ++i) {
-    if (i->second == RAW)
-      result.append(i->first);
+    if (i->type == RAW)
+      result.append(text_, i->offset, i->length);
     else
-      result.append(env->LookupVariable(i->first));
+      result.append(*value++);
   }
   return result;
 }
 
 void EvalString::AddText(StringPiece text) {
   // Add it to the end of an existing RAW token if possible.
-  if (!parsed_.empty() && parsed_.back().second == RAW) {
-    parsed_.back().first.append(text.str_, text.len_);
-  } else {
-    parsed_.push_back(make_pair(text.AsString(), RAW));
+  if (parsed_.empty() || parsed_.back().type != RAW) {
+    Token token = { RAW, (uint32_t)text_.size(), 0, 0 };
+    parsed_.push_back(token);
   }
+  parsed_.back().length += text.len_;
+  text_.append(text.str_, text.len_);
 }
 void EvalString::AddSpecial(StringPiece text) {
-  parsed_.push_back(make_pair(text.AsString(), SPECIAL));
+  Token token = { SPECIAL, 0, 0, InternSymbol(text) };
+  parsed_.push_back(token);
+}
+
+int64_t EvalString::HeapBytes() const {
+  return MemoryStats::HeapBytes(parsed_) + MemoryStats::HeapBytes(text_);
+}
+
+StringPiece EvalString::TokenText(const Token& token) const {
+  if (token.type == SPECIAL)
+    return SymbolName(token.symbol);
+  return StringPiece(text_.data() + token.offset, token.length);
 }
 
 string EvalString::Serialize() const {
@@ -126,9 +333,10 @@ string EvalString::Serialize() const {
   for (TokenList::const_iterator i = parsed_.begin();
        i != parsed_.end(); ++i) {
     result.append("[");
-    if (i->second == SPECIAL)
+    if (i->type == SPECIAL)
       result.append("$");
-    result.append(i->first);
+    StringPiece text = TokenText(*i);
+    result.append(text.str_, text.len_);
     result.append("]");
   }
   return result;
@@ -138,10 +346,11 @@ string EvalString::Unparse() const {
   string result;
   for (TokenList::const_iterator i = parsed_.begin();
        i != parsed_.end(); ++i) {
-    bool special = (i->second == SPECIAL);
+    bool special = (i->type == SPECIAL);
     if (special)
       result.append("${");
-    result.append(i->first);
+    StringPiece text = TokenText(*i);
+    result.append(text.str_, text.len_);
     if (special)
       result.append("}");
   }
@@ -15,18 +15,148 @@
 #ifndef NINJA_EVAL_ENV_H_
 #define NINJA_EVAL_ENV_H_
 
+#include <stdint.h>
+
 #include <map>
 #include <string>
 #include <vector>
 
 #include "string_piece.h"
+#include "util.h"  // For int64_t.
 
+struct MemoryStats;
 struct Rule;
 
+/// Variable names are interned into small integers, symbols, as the
+/// manifest is parsed, so that scopes look variables up without comparing
+/// strings.  Symbols are shared by the whole process and never freed.
+typedef uint32_t Symbol;
+
+/// The symbols of the variables ninja defines for each edge.
+const Symbol kSymbolIn = 0;
+const Symbol kSymbolInNewline = 1;
+const Symbol kSymbolOut = 2;
+/// The symbols of the bindings rules reserve, which ninja looks up for
+/// each edge it scans or runs.
+const Symbol kSymbolCache = 3;
+const Symbol kSymbolCommand = 4;
+const Symbol kSymbolDepfile = 5;
+const Symbol kSymbolDeps = 6;
+const Symbol kSymbolDescription = 7;
+const Symbol kSymbolDyndep = 8;
+const Symbol kSymbolGenerator = 9;
+const Symbol kSymbolHashInputs = 10;
+const Symbol kSymbolMsvcDepsPrefix = 11;
+const Symbol kSymbolPool = 12;
+const Symbol kSymbolPoolResources = 13;
+const Symbol kSymbolPoolWeight = 14;
+const Symbol kSymbolPriority = 15;
+const Symbol kSymbolRemote = 16;
+const Symbol kSymbolRestat = 17;
+const Symbol kSymbolRspfile = 18;
+const Symbol kSymbolRspfileContent = 19;
+const Symbol kSymbolRspfileKeep = 20;
+const Symbol kSymbolStreamOutput = 21;
+const Symbol kSymbolDepfileFd = 22;
+/// The number of symbols above.
+const Symbol kPredefinedSymbols = 23;
+
+/// Return the symbol of variable |name|, interning it if needed.
+/// Thread-safe.
+Symbol InternSymbol(StringPiece name);
+/// Return the name of |symbol|.  Thread-safe.
+const std::string& SymbolName(Symbol symbol);
+
+/// A map from symbols to values, stored in one array with open addressing:
+/// most scopes only hold a few bindings.
+template <typename V>
+struct SymbolMap {
+  SymbolMap() : size_(0) {}
+
+  /// Return the value of |key|, or NULL if it has none.
+  const V* Find(Symbol key) const {
+    if (slots_.empty())
+      return NULL;
+    size_t mask = slots_.size() - 1;
+    for (size_t i = Hash(key) & mask;; i = (i + 1) & mask) {
+      if (slots_[i].key == key)
+        return &slots_[i].value;
+      if (slots_[i].key == kEmpty)
+        return NULL;
+    }
+  }
+  V* Find(Symbol key) {
+    return const_cast<V*>(static_cast<const SymbolMap*>(this)->Find(key));
+  }
+
+  /// Return the value of |key|, adding a default one if it has none.
+  V& operator[](Symbol key) {
+    if (V* value = Find(key))
+      return *value;
+    if ((size_ + 1) * 2 > slots_.size())
+      Grow();
+    ++size_;
+    return Insert(key, V())->value;
+  }
+
+  size_t size() const { return size_; }
+
+  /// The bytes of the slots, without what the values have on the heap.
+  size_t slot_bytes() const { return slots_.capacity() * sizeof(Slot); }
+
+  /// Call |func| with each key and its value, in no particular order.
+  template <typename F>
+  void ForEach(F func) const {
+    for (typename std::vector<Slot>::const_iterator i = slots_.begin();
+         i != slots_.end(); ++i) {
+      if (i->key != kEmpty)
+        func(i->key, i->value);
+    }
+  }
+
+ private:
+  static const Symbol kEmpty = ~static_cast<Symbol>(0);
+
+  struct Slot {
+    Slot() : key(kEmpty) {}
+    Symbol key;
+    V value;
+  };
+
+  static size_t Hash(Symbol key) { return key * 0x9E3779B1u; }
+
+  /// Put (|key|, |value|) in a free slot, there being one.
+  Slot* Insert(Symbol key, const V& value) {
+    size_t mask = slots_.size() - 1;
+    size_t i = Hash(key) & mask;
+    while (slots_[i].key != kEmpty)
+      i = (i + 1) & mask;
+    slots_[i].key = key;
+    slots_[i].value = value;
+    return &slots_[i];
+  }
+
+  void Grow() {
+    std::vector<Slot> old(slots_.empty() ? 4 : slots_.size() * 2);
+    old.swap(slots_);
+    for (typename std::vector<Slot>::iterator i = old.begin(); i != old.end();
+         ++i) {
+      if (i->key != kEmpty)
+        Insert(i->key, i->value);
+    }
+  }
+
+  std::vector<Slot> slots_;
+  size_t size_;
+};
+
 /// An interface for a scope for variable (e.g. "$foo") lookups.
 struct Env {
   virtual ~Env() {}
-  virtual std::string LookupVariable(const std::string& var) = 0;
+  virtual std::string LookupVariable(Symbol var) = 0;
+  std::string LookupVariable(const std::string& var) {
+    return LookupVariable(InternSymbol(var));
+  }
 };
 
 /// A tokenized string that contains variable references.
@@ -39,20 +169,42 @@ struct EvalString {
   /// @return The string with variables not expanded.
   std::string Unparse() const;
 
-  void Clear() { parsed_.clear(); }
+  void Clear() { parsed_.clear(); text_.clear(); }
   bool empty() const { return parsed_.empty(); }
 
   void AddText(StringPiece text);
   void AddSpecial(StringPiece text);
 
+  /// The number of tokens, and the bytes they take on the heap.
+  size_t token_count() const { return parsed_.size(); }
+  int64_t HeapBytes() const;
+
   /// Construct a human-readable representation of the parsed state,
   /// for use in tests.
   std::string Serialize() const;
 
 private:
+  // Allow the manifest cache to save and restore the tokens.
+  friend struct ManifestCache;
+
   enum TokenType { RAW, SPECIAL };
-  typedef std::vector<std::pair<std::string, TokenType> > TokenList;
+  struct Token {
+    TokenType type;
+    /// Where the text of a RAW token is in text_.
+    uint32_t offset;
+    uint32_t length;
+    /// The variable of a SPECIAL token.
+    Symbol symbol;
+  };
+  typedef std::vector<Token> TokenList;
+
+  /// The text of |token|, or its variable's name if it's SPECIAL.
+  StringPiece TokenText(const Token& token) const;
+
   TokenList parsed_;
+  /// The text of the RAW tokens, one after the other, so that each
+  /// token doesn't need an allocation of its own.
+  std::string text_;
 };
 
 /// An invokable build command and associated metadata (description, etc.).
@@ -66,13 +218,20 @@ struct Rule {
   static bool IsReservedBinding(const std::string& var);
 
   const EvalString* GetBinding(const std::string& key) const;
+  const EvalString* GetBinding(Symbol key) const {
+    return bindings_.Find(key);
+  }
+
+  /// Count the rule and the tokens of its bindings in |stats|.
+  void CountMemory(MemoryStats* stats) const;
 
  private:
   // Allow the parsers to reach into this object and fill out its fields.
   friend struct ManifestParser;
+  friend struct ManifestCache;
 
   std::string name_;
-  typedef std::map<std::string, EvalString> Bindings;
+  typedef SymbolMap<EvalString> Bindings;
   Bindings bindings_;
 };
 
@@ -83,7 +242,8 @@ struct BindingEnv : public Env {
   explicit BindingEnv(BindingEnv* parent) : parent_(parent) {}
 
   virtual ~BindingEnv() {}
-  virtual std::string LookupVariable(const std::string& var);
+  using Env::LookupVariable;
+  virtual std::string LookupVariable(Symbol var);
 
   void AddRule(const Rule* rule);
   const Rule* LookupRule(const std::string& rule_name);
@@ -92,16 +252,29 @@ struct BindingEnv : public Env {
 
   void AddBinding(const std::string& key, const std::string& val);
 
+  /// A copy of this scope as it is now, with the same parent, so that a
+  /// nested scope can be parsed while this one keeps changing.
+  BindingEnv* Snapshot() const { return new BindingEnv(*this); }
+
+  BindingEnv* parent() const { return parent_; }
+  void set_parent(BindingEnv* parent) { parent_ = parent; }
+
+  /// The bytes the bindings of this scope and its map of rules take on the
+  /// heap, without the rules themselves.
+  int64_t HeapBytes() const;
+
   /// This is tricky.  Edges want lookup scope to go in this order:
   /// 1) value set on edge itself (edge_->env_)
   /// 2) value set on rule, with expansion in the edge's scope
   /// 3) value set on enclosing scope of edge (edge_->env_->parent_)
   /// This function takes as parameters the necessary info to do (2).
-  std::string LookupWithFallback(const std::string& var, const EvalString* eval,
+  std::string LookupWithFallback(Symbol var, const EvalString* eval,
                                  Env* env);
 
 private:
-  std::map<std::string, std::string> bindings_;
+  friend struct ManifestCache;
+
+  SymbolMap<std::string> bindings_;
   std::map<std::string, const Rule*> rules_;
   BindingEnv* parent_;
 };
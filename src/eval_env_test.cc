@@ -0,0 +1,126 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "eval_env.h"
+
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+TEST(SymbolMapTest, GrowAndFind) {
+  SymbolMap<int> map;
+  EXPECT_EQ(0u, map.size());
+  EXPECT_EQ(NULL, map.Find(0));
+
+  // Well past the load factor of 1/2 of the first few sizes.
+  const Symbol kCount = 100;
+  for (Symbol key = 0; key < kCount; ++key)
+    map[key * 3] = (int)key;
+  EXPECT_EQ(kCount, map.size());
+  EXPECT_GE(map.slot_bytes(), 2 * kCount * sizeof(int));
+  for (Symbol key = 0; key < kCount; ++key) {
+    const int* value = map.Find(key * 3);
+    ASSERT_TRUE(value);
+    EXPECT_EQ((int)key, *value);
+    // Keys never added are missing.
+    EXPECT_EQ(NULL, map.Find(key * 3 + 1));
+  }
+}
+
+TEST(SymbolMapTest, Overwrite) {
+  SymbolMap<string> map;
+  map[5] = "a";
+  map[5] = "b";
+  EXPECT_EQ(1u, map.size());
+  ASSERT_TRUE(map.Find(5));
+  EXPECT_EQ("b", *map.Find(5));
+  *map.Find(5) = "c";
+  EXPECT_EQ("c", map[5]);
+  EXPECT_EQ(1u, map.size());
+}
+
+TEST(SymbolMapTest, ForEach) {
+  SymbolMap<int> map;
+  for (Symbol key = 1; key <= 10; ++key)
+    map[key] = (int)key * 10;
+  int count = 0;
+  int sum = 0;
+  map.ForEach([&](Symbol key, int value) {
+    EXPECT_EQ((int)key * 10, value);
+    ++count;
+    sum += value;
+  });
+  EXPECT_EQ(10, count);
+  EXPECT_EQ(550, sum);
+}
+
+TEST(SymbolTest, Intern) {
+  EXPECT_EQ(kSymbolIn, InternSymbol("in"));
+  EXPECT_EQ(kSymbolCommand, InternSymbol("command"));
+  EXPECT_EQ("depfile_fd", SymbolName(kSymbolDepfileFd));
+
+  Symbol symbol = InternSymbol("symbol_test_intern");
+  EXPECT_GE(symbol, kPredefinedSymbols);
+  EXPECT_EQ(symbol, InternSymbol(string("symbol_test_intern")));
+  EXPECT_EQ("symbol_test_intern", SymbolName(symbol));
+  EXPECT_NE(symbol, InternSymbol("symbol_test_intern2"));
+}
+
+TEST(SymbolTest, InternConcurrently) {
+  // Enough names for the table to grow while the threads look them up.
+  const int kThreads = 4;
+  const int kNames = 2000;
+  vector<vector<Symbol> > symbols(kThreads);
+  vector<thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([t, &symbols]() {
+      for (int i = 0; i < kNames; ++i) {
+        int n = (i + t * kNames / kThreads) % kNames;
+        symbols[t].push_back(
+            InternSymbol("symbol_test_concurrent" + to_string(n)));
+      }
+    });
+  }
+  for (size_t t = 0; t < threads.size(); ++t)
+    threads[t].join();
+
+  for (int t = 0; t < kThreads; ++t) {
+    for (int i = 0; i < kNames; ++i) {
+      int n = (i + t * kNames / kThreads) % kNames;
+      EXPECT_EQ(symbols[0][n], symbols[t][i]);
+      EXPECT_EQ("symbol_test_concurrent" + to_string(n),
+                SymbolName(symbols[t][i]));
+    }
+  }
+}
+
+TEST(BindingEnvTest, LookupThroughParents) {
+  BindingEnv parent;
+  parent.AddBinding("a", "parent");
+  parent.AddBinding("b", "parent");
+  BindingEnv child(&parent);
+  child.AddBinding("b", "child");
+  EXPECT_EQ("parent", child.LookupVariable("a"));
+  EXPECT_EQ("child", child.LookupVariable("b"));
+  EXPECT_EQ("", child.LookupVariable("binding_env_test_missing"));
+  child.AddBinding("b", "again");
+  EXPECT_EQ("again", child.LookupVariable("b"));
+}
+
+}  // anonymous namespace
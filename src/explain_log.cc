@@ -0,0 +1,190 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "explain_log.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "graph.h"
+#include "trace.h"
+#include "util.h"
+
+using namespace std;
+
+ExplainLog* g_explain_log = NULL;
+
+namespace {
+
+/// The buffered records are written beyond this size.
+const size_t kBufferSize = 64 << 10;
+
+/// What each reason means, for the summary on stderr.
+const char* ReasonDescription(ExplainReason reason) {
+  switch (reason) {
+  case kExplainMissingSource:
+    return "missing, with no in-edge";
+  case kExplainInputDirty:
+    return "an input is dirty";
+  case kExplainPhonyOutputMissing:
+    return "phony edge with no inputs has a missing output";
+  case kExplainOutputMissing:
+    return "output doesn't exist";
+  case kExplainOutputOlder:
+    return "output older than most recent input";
+  case kExplainRestatOutputOlder:
+    return "restat of output older than most recent input";
+  case kExplainCommandChanged:
+    return "command line changed";
+  case kExplainRecordedMtimeOlder:
+    return "recorded mtime older than most recent input";
+  case kExplainCommandNotLogged:
+    return "command line not found in log";
+  case kExplainDepfileMissing:
+    return "depfile is missing";
+  case kExplainDepfileMismatch:
+    return "depfile mentions another output";
+  case kExplainDepsMissing:
+    return "deps are missing";
+  case kExplainDepsOutdated:
+    return "stored deps info out of date";
+  case kExplainReasonCount:
+    break;
+  }
+  return "?";
+}
+
+}  // anonymous namespace
+
+ExplainLog::ExplainLog() : file_(NULL) {
+  memset(counts_, 0, sizeof(counts_));
+}
+
+ExplainLog::~ExplainLog() {
+  Close();
+}
+
+bool ExplainLog::Open(const string& path, string* err) {
+  file_ = fopen(path.c_str(), "wb");
+  if (!file_) {
+    *err = strerror(errno);
+    return false;
+  }
+  SetCloseOnExec(fileno(file_));
+  buffer_.reserve(kBufferSize + 1024);
+  return true;
+}
+
+void ExplainLog::Close() {
+  if (!file_)
+    return;
+
+  buffer_ += "{\"summary\":{";
+  vector<ExplainReason> reasons;
+  for (int r = 0; r < kExplainReasonCount; ++r) {
+    if (!counts_[r])
+      continue;
+    if (!reasons.empty())
+      buffer_ += ',';
+    reasons.push_back(ExplainReason(r));
+    buffer_ += '"';
+    buffer_ += ReasonName(ExplainReason(r));
+    buffer_ += "\":" + to_string(counts_[r]);
+  }
+  buffer_ += "}}\n";
+  WriteBuffer();
+  fclose(file_);
+  file_ = NULL;
+
+  // The most common reasons first.
+  stable_sort(reasons.begin(), reasons.end(),
+              [this](ExplainReason a, ExplainReason b) {
+                return counts_[a] > counts_[b];
+              });
+  for (vector<ExplainReason>::iterator r = reasons.begin();
+       r != reasons.end(); ++r) {
+    fprintf(stderr, "ninja explain: %" PRId64 " dirty because %s\n",
+            counts_[*r], ReasonDescription(*r));
+  }
+}
+
+void ExplainLog::Record(ExplainReason reason, const Node* node,
+                        const Node* input, TimeStamp mtime,
+                        TimeStamp input_mtime) {
+  ++counts_[reason];
+  if (!file_)
+    return;
+  buffer_ += "{\"reason\":\"";
+  buffer_ += ReasonName(reason);
+  buffer_ += "\",\"path\":";
+  Tracer::AppendJSONString(node->path(), &buffer_);
+  if (input) {
+    buffer_ += ",\"input\":";
+    Tracer::AppendJSONString(input->path(), &buffer_);
+  }
+  if (mtime || input_mtime) {
+    char buf[64];
+    snprintf(buf, sizeof(buf),
+             ",\"mtime\":%" PRId64 ",\"input_mtime\":%" PRId64, mtime,
+             input_mtime);
+    buffer_ += buf;
+  }
+  buffer_ += "}\n";
+  if (buffer_.size() >= kBufferSize)
+    WriteBuffer();
+}
+
+void ExplainLog::WriteBuffer() {
+  fwrite(buffer_.data(), 1, buffer_.size(), file_);
+  buffer_.clear();
+}
+
+// static
+const char* ExplainLog::ReasonName(ExplainReason reason) {
+  switch (reason) {
+  case kExplainMissingSource:
+    return "missing_source";
+  case kExplainInputDirty:
+    return "input_dirty";
+  case kExplainPhonyOutputMissing:
+    return "phony_output_missing";
+  case kExplainOutputMissing:
+    return "output_missing";
+  case kExplainOutputOlder:
+    return "output_older";
+  case kExplainRestatOutputOlder:
+    return "restat_output_older";
+  case kExplainCommandChanged:
+    return "command_changed";
+  case kExplainRecordedMtimeOlder:
+    return "recorded_mtime_older";
+  case kExplainCommandNotLogged:
+    return "command_not_logged";
+  case kExplainDepfileMissing:
+    return "depfile_missing";
+  case kExplainDepfileMismatch:
+    return "depfile_mismatch";
+  case kExplainDepsMissing:
+    return "deps_missing";
+  case kExplainDepsOutdated:
+    return "deps_outdated";
+  case kExplainReasonCount:
+    break;
+  }
+  return "?";
+}
@@ -0,0 +1,93 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_EXPLAIN_LOG_H_
+#define NINJA_EXPLAIN_LOG_H_
+
+#include <stdio.h>
+
+#include <string>
+
+#include "timestamp.h"
+
+struct Node;
+
+/// Why the scan found a node dirty.
+enum ExplainReason {
+  kExplainMissingSource,
+  kExplainInputDirty,
+  kExplainPhonyOutputMissing,
+  kExplainOutputMissing,
+  kExplainOutputOlder,
+  kExplainRestatOutputOlder,
+  kExplainCommandChanged,
+  kExplainRecordedMtimeOlder,
+  kExplainCommandNotLogged,
+  kExplainDepfileMissing,
+  kExplainDepfileMismatch,
+  kExplainDepsMissing,
+  kExplainDepsOutdated,
+  kExplainReasonCount
+};
+
+/// ExplainLog writes the records of '-d explain=FILE': a line of JSON for
+/// each time the scan finds a node dirty, with the reason and the mtimes
+/// compared, and at the end the number of times each reason came up, in
+/// the file and on stderr.  Much cheaper than the text of '-d explain',
+/// so that it can stay on for large builds.
+struct ExplainLog {
+  ExplainLog();
+  ~ExplainLog();
+
+  /// Start writing the records to |path|.
+  bool Open(const std::string& path, std::string* err);
+
+  /// Write the summary and close the file.
+  void Close();
+
+  /// Record that |node| is dirty for |reason|.  |input|, if not NULL, is
+  /// the input that made it so, and |mtime| and |input_mtime| the mtimes
+  /// compared, if any.
+  void Record(ExplainReason reason, const Node* node, const Node* input,
+              TimeStamp mtime, TimeStamp input_mtime);
+
+  /// The number of records for |reason| so far.
+  int64_t count(ExplainReason reason) const { return counts_[reason]; }
+
+  /// The name of |reason| in the records, e.g. "command_changed".
+  static const char* ReasonName(ExplainReason reason);
+
+ private:
+  void WriteBuffer();
+
+  FILE* file_;
+  /// Records not written yet.
+  std::string buffer_;
+  int64_t counts_[kExplainReasonCount];
+
+  // Unimplemented copy ctor and operator= ensure we don't close twice.
+  ExplainLog(const ExplainLog& other);    // DO NOT IMPLEMENT
+  void operator=(const ExplainLog& other);  // DO NOT IMPLEMENT
+};
+
+/// Use EXPLAIN_RECORD() next to EXPLAIN() where the scan decides that a
+/// node is dirty.
+#define EXPLAIN_RECORD(reason, node, input, mtime, input_mtime) {       \
+  if (g_explain_log)                                                    \
+    g_explain_log->Record(reason, node, input, mtime, input_mtime);     \
+}
+
+extern ExplainLog* g_explain_log;
+
+#endif  // NINJA_EXPLAIN_LOG_H_
@@ -0,0 +1,90 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "explain_log.h"
+
+#include "disk_interface.h"
+#include "graph.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+struct ExplainLogTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    g_explain_log = &explain_log_;
+  }
+  virtual void TearDown() {
+    g_explain_log = NULL;
+  }
+
+  ExplainLog explain_log_;
+  VirtualFileSystem fs_;
+};
+
+TEST_F(ExplainLogTest, WritesRecordsAndSummary) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("ExplainLogTest-WritesRecordsAndSummary");
+  string err;
+  ExplainLog log;
+  ASSERT_TRUE(log.Open("explain.json", &err));
+  log.Record(kExplainOutputOlder, GetNode("out"), GetNode("in \"1\""), 10,
+             20);
+  log.Record(kExplainCommandChanged, GetNode("out2"), NULL, 0, 0);
+  log.Record(kExplainCommandChanged, GetNode("out3"), NULL, 0, 0);
+  EXPECT_EQ(1, log.count(kExplainOutputOlder));
+  EXPECT_EQ(2, log.count(kExplainCommandChanged));
+  EXPECT_EQ(0, log.count(kExplainDepsMissing));
+  log.Close();
+
+  RealDiskInterface disk_interface;
+  string contents;
+  ASSERT_EQ(DiskInterface::Okay,
+            disk_interface.ReadFile("explain.json", &contents, &err));
+  EXPECT_EQ(
+      "{\"reason\":\"output_older\",\"path\":\"out\","
+      "\"input\":\"in \\\"1\\\"\",\"mtime\":10,\"input_mtime\":20}\n"
+      "{\"reason\":\"command_changed\",\"path\":\"out2\"}\n"
+      "{\"reason\":\"command_changed\",\"path\":\"out3\"}\n"
+      "{\"summary\":{\"output_older\":1,\"command_changed\":2}}\n",
+      contents);
+  temp_dir.Cleanup();
+}
+
+TEST_F(ExplainLogTest, CountsWhyTheScanFindsNodesDirty) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build mid: cat in\n"
+"build out: cat mid\n"
+"build out2: cat missing\n"
+"build out3: cat in\n"));
+  fs_.Create("out", "");
+  fs_.Tick();
+  fs_.Create("in", "");
+  fs_.Create("mid", "");
+
+  DependencyScan scan(&state_, NULL, NULL, &fs_, NULL);
+  string err;
+  EXPECT_TRUE(scan.RecomputeDirty(GetNode("out"), &err));
+  EXPECT_TRUE(scan.RecomputeDirty(GetNode("out2"), &err));
+  EXPECT_TRUE(scan.RecomputeDirty(GetNode("out3"), &err));
+  ASSERT_EQ("", err);
+
+  EXPECT_EQ(1, explain_log_.count(kExplainOutputOlder));
+  EXPECT_EQ(1, explain_log_.count(kExplainMissingSource));
+  EXPECT_EQ(1, explain_log_.count(kExplainInputDirty));
+  EXPECT_EQ(1, explain_log_.count(kExplainOutputMissing));
+}
+
+}  // anonymous namespace
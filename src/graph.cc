@@ -15,17 +15,24 @@
 #include "graph.h"
 
 #include <algorithm>
+#include <set>
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "build_log.h"
 #include "debug_flags.h"
 #include "depfile_parser.h"
 #include "deps_log.h"
 #include "disk_interface.h"
+#include "explain_log.h"
+#include "hash_log.h"
 #include "manifest_parser.h"
 #include "metrics.h"
+#include "parallel.h"
 #include "state.h"
+#include "trace.h"
 #include "util.h"
 
 using namespace std;
@@ -34,7 +41,185 @@ bool Node::Stat(DiskInterface* disk_interface, string* err) {
   return (mtime_ = disk_interface->Stat(path_, err)) != -1;
 }
 
+void DependencyScan::StatReachableNodes(const vector<Node*>& targets) {
+  TRACE_RECORD("StatReachableNodes");
+  // Spreading a handful of stats over threads isn't worth starting them.
+  const size_t kMinParallelStats = 256;
+  // Stats mostly wait on the file system, so use more threads than cores.
+  const int kStatThreads = 16;
+  // Hashing a command takes about as long as a stat from the page cache.
+  const size_t kMinParallelHashes = 256;
+
+  // Node metrics aren't synchronized; keep -d stats meaningful by leaving
+  // the stats to RecomputeDirty().
+  if (g_metrics || !disk_interface_->IsStatThreadSafe())
+    return;
+
+  // Depfiles read ahead are held until RecomputeDirty() parses them.
+  const size_t kMaxPrefetchedDepfileBytes = 256 << 20;
+
+  set<Node*> seen(targets.begin(), targets.end());
+  vector<Node*> stack(seen.begin(), seen.end());
+  vector<Node*> to_stat;
+  set<Edge*> hashed_edges;
+  vector<Edge*> depfile_edges;
+  vector<Edge*> command_edges;
+  while (!stack.empty()) {
+    Node* node = stack.back();
+    stack.pop_back();
+    if (!node->status_known())
+      to_stat.push_back(node);
+
+    Edge* edge = node->in_edge();
+    // Edges already scanned, e.g. by the daemon, had their inputs stat'ed.
+    if (!edge || edge->mark_ == Edge::VisitDone)
+      continue;
+    if (hash_log() && edge->GetBindingBool(kSymbolHashInputs))
+      hashed_edges.insert(edge);
+    if (!edge->deps_loaded_ && HasDepfileDeps(edge))
+      depfile_edges.push_back(edge);
+    if (build_log() && !edge->is_phony() && node == edge->outputs_[0])
+      command_edges.push_back(edge);
+    for (vector<Node*>::iterator i = edge->inputs_.begin();
+         i != edge->inputs_.end(); ++i) {
+      if (seen.insert(*i).second)
+        stack.push_back(*i);
+    }
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o) {
+      if (seen.insert(*o).second)
+        stack.push_back(*o);
+    }
+    if (deps_log() && !edge->GetBinding(kSymbolDeps).empty()) {
+      if (DepsLog::Deps* deps = deps_log()->GetDeps(edge->outputs_[0])) {
+        for (int i = 0; i < deps->node_count; ++i) {
+          if (seen.insert(deps->nodes[i]).second)
+            stack.push_back(deps->nodes[i]);
+        }
+      }
+    }
+  }
+
+  if (to_stat.size() >= kMinParallelStats) {
+    DiskInterface* disk_interface = disk_interface_;
+    ParallelFor(to_stat.size(), kStatThreads, [&](size_t i) {
+      string err;
+      to_stat[i]->Stat(disk_interface, &err);
+    });
+  }
+
+  // Past the stats, what takes the scan time is evaluating the commands
+  // of the edges to compare their hashes to the build log.  Each edge's
+  // is independent of the others', so compute them here on all cores while
+  // the graph doesn't change; RecomputeDirty() then walks the graph alone,
+  // which keeps its cycle errors and -d explain output as they were.  Only
+  // the edges with an output and a log entry to compare to are worth it.
+  vector<Edge*>::iterator end = remove_if(
+      command_edges.begin(), command_edges.end(), [this](Edge* edge) {
+        Node* output = edge->outputs_[0];
+        return !output->status_known() || !output->exists() ||
+               !build_log()->LookupByOutput(output->path());
+      });
+  command_edges.erase(end, command_edges.end());
+  if (command_edges.size() >= kMinParallelHashes) {
+    ParallelFor(command_edges.size(), GetProcessorCount(), [&](size_t i) {
+      command_edges[i]->GetCommandHash();
+    });
+  }
+
+  // RecomputeOutputDirty() digests the inputs of the hashed edges that have
+  // one newer than an output; read those files together.
+  vector<Node*> to_digest;
+  for (set<Edge*>::iterator e = hashed_edges.begin(); e != hashed_edges.end();
+       ++e) {
+    TimeStamp oldest_output = -1;
+    for (vector<Node*>::iterator o = (*e)->outputs_.begin();
+         o != (*e)->outputs_.end(); ++o) {
+      if ((*o)->status_known() &&
+          (oldest_output == -1 || (*o)->mtime() < oldest_output))
+        oldest_output = (*o)->mtime();
+    }
+    if (oldest_output <= 0)
+      continue;  // Rebuilt anyway, or not stat'ed.
+    for (size_t i = 0; i < (*e)->inputs_.size() - (*e)->order_only_deps_;
+         ++i) {
+      Node* input = (*e)->inputs_[i];
+      if (input->status_known() && input->mtime() > oldest_output)
+        to_digest.push_back(input);
+    }
+  }
+  if (!to_digest.empty())
+    hash_log()->PrecomputeDigests(to_digest, disk_interface_);
+
+  if (!disk_interface_->IsReadThreadSafe())
+    return;
+  if (lazy_depfiles_) {
+    // Edges with a missing output won't read theirs.
+    end = remove_if(
+        depfile_edges.begin(), depfile_edges.end(), [](Edge* edge) {
+          for (vector<Node*>::iterator o = edge->outputs_.begin();
+               o != edge->outputs_.end(); ++o) {
+            if ((*o)->status_known() && !(*o)->exists())
+              return true;
+          }
+          return false;
+        });
+    depfile_edges.erase(end, depfile_edges.end());
+  }
+  dep_loader_.PrefetchDepfiles(depfile_edges, kMaxPrefetchedDepfileBytes);
+}
+
+void DependencyScan::InvalidateDirty(const vector<Node*>& changed) {
+  TRACE_RECORD("InvalidateDirty");
+  // Edges that weren't visited have nothing visited downstream of them
+  // either, as RecomputeDirty() visits the inputs of an edge first.
+  set<Edge*> edges;
+  vector<Edge*> stack;
+  for (vector<Node*>::const_iterator n = changed.begin(); n != changed.end();
+       ++n) {
+    if ((*n)->in_edge())
+      stack.push_back((*n)->in_edge());
+    else if ((*n)->status_known())
+      (*n)->set_dirty(!(*n)->exists());  // As RecomputeDirty() would.
+    stack.insert(stack.end(), (*n)->out_edges().begin(),
+                 (*n)->out_edges().end());
+  }
+  while (!stack.empty()) {
+    Edge* edge = stack.back();
+    stack.pop_back();
+    if (edge->mark_ == Edge::VisitNone || !edges.insert(edge).second)
+      continue;
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o) {
+      stack.insert(stack.end(), (*o)->out_edges().begin(),
+                   (*o)->out_edges().end());
+    }
+  }
+
+  // Only now change the out edges walked above.
+  for (set<Edge*>::iterator e = edges.begin(); e != edges.end(); ++e) {
+    Edge* edge = *e;
+    edge->mark_ = Edge::VisitNone;
+    edge->outputs_ready_ = false;
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o)
+      (*o)->set_dirty(false);
+    if (!edge->deps_loaded_)
+      continue;
+    vector<Node*>::iterator end = edge->inputs_.end() - edge->order_only_deps_;
+    vector<Node*>::iterator begin = end - edge->loaded_deps_;
+    for (vector<Node*>::iterator i = begin; i != end; ++i)
+      (*i)->RemoveOneOutEdge(edge);
+    edge->inputs_.erase(begin, end);
+    edge->implicit_deps_ -= edge->loaded_deps_;
+    edge->loaded_deps_ = 0;
+    edge->deps_loaded_ = false;
+  }
+  dep_loader_.ClearPrefetched();
+}
+
 bool DependencyScan::RecomputeDirty(Node* node, string* err) {
+  TRACE_RECORD("RecomputeDirty");
   vector<Node*> stack;
   return RecomputeDirty(node, &stack, err);
 }
@@ -49,8 +234,10 @@ bool DependencyScan::RecomputeDirty(Node* node, vector<Node*>* stack,
     // This node has no in-edge; it is dirty if it is missing.
     if (!node->StatIfNecessary(disk_interface_, err))
       return false;
-    if (!node->exists())
+    if (!node->exists()) {
       EXPLAIN("%s has no in-edge and is missing", node->path().c_str());
+      EXPLAIN_RECORD(kExplainMissingSource, node, NULL, 0, 0);
+    }
     node->set_dirty(!node->exists());
     return true;
   }
@@ -106,7 +293,16 @@ bool DependencyScan::RecomputeDirty(Node* node, vector<Node*>* stack,
   if (!edge->deps_loaded_) {
     // This is our first encounter with this edge.  Load discovered deps.
     edge->deps_loaded_ = true;
-    if (!dep_loader_.LoadDeps(edge, err)) {
+    if (lazy_depfiles_ && !edge->is_phony() && HasDepfileDeps(edge)) {
+      // Without inputs to compare to, only what makes the outputs dirty
+      // regardless of them counts.
+      if (!RecomputeOutputsDirty(edge, NULL, &dirty, err))
+        return false;
+      if (dirty)
+        EXPLAIN("not loading the depfile of dirty %s",
+                edge->outputs_[0]->path().c_str());
+    }
+    if (!dirty && !dep_loader_.LoadDeps(edge, err)) {
       if (!err->empty())
         return false;
       // Failed to load dependency info: rebuild to regenerate it.
@@ -134,6 +330,7 @@ bool DependencyScan::RecomputeDirty(Node* node, vector<Node*>* stack,
       // Otherwise consider mtime.
       if ((*i)->dirty()) {
         EXPLAIN("%s is dirty", (*i)->path().c_str());
+        EXPLAIN_RECORD(kExplainInputDirty, edge->outputs_[0], *i, 0, 0);
         dirty = true;
       } else {
         if (!most_recent_input || (*i)->mtime() > most_recent_input->mtime()) {
@@ -173,6 +370,12 @@ bool DependencyScan::RecomputeDirty(Node* node, vector<Node*>* stack,
   return true;
 }
 
+// static
+bool DependencyScan::HasDepfileDeps(Edge* edge) {
+  return edge->GetBinding(kSymbolDeps).empty() &&
+         !edge->GetUnescapedDepfile().empty();
+}
+
 bool DependencyScan::VerifyDAG(Node* node, vector<Node*>* stack, string* err) {
   Edge* edge = node->in_edge();
   assert(edge != NULL);
@@ -214,10 +417,9 @@ bool DependencyScan::VerifyDAG(Node* node, vector<Node*>* stack, string* err) {
 
 bool DependencyScan::RecomputeOutputsDirty(Edge* edge, Node* most_recent_input,
                                            bool* outputs_dirty, string* err) {
-  string command = edge->EvaluateCommand(/*incl_rsp_file=*/true);
   for (vector<Node*>::iterator o = edge->outputs_.begin();
        o != edge->outputs_.end(); ++o) {
-    if (RecomputeOutputDirty(edge, most_recent_input, command, *o)) {
+    if (RecomputeOutputDirty(edge, most_recent_input, *o)) {
       *outputs_dirty = true;
       return true;
     }
@@ -227,7 +429,6 @@ bool DependencyScan::RecomputeOutputsDirty(Edge* edge, Node* most_recent_input,
 
 bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
                                           const Node* most_recent_input,
-                                          const string& command,
                                           Node* output) {
   if (edge->is_phony()) {
     // Phony edges don't write any output.  Outputs are only dirty if
@@ -235,16 +436,21 @@ bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
     if (edge->inputs_.empty() && !output->exists()) {
       EXPLAIN("output %s of phony edge with no inputs doesn't exist",
               output->path().c_str());
+      EXPLAIN_RECORD(kExplainPhonyOutputMissing, output, NULL, 0, 0);
       return true;
     }
     return false;
   }
 
   BuildLog::LogEntry* entry = 0;
+  // Whether the contents of the inputs are those the output was built from,
+  // once it matters.
+  bool inputs_unchanged = false;
 
   // Dirty if we're missing the output.
   if (!output->exists()) {
     EXPLAIN("output %s doesn't exist", output->path().c_str());
+    EXPLAIN_RECORD(kExplainOutputMissing, output, NULL, 0, 0);
     return true;
   }
 
@@ -257,34 +463,41 @@ bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
     // build log.  Use that mtime instead, so that the file will only be
     // considered dirty if an input was modified since the previous run.
     bool used_restat = false;
-    if (edge->GetBindingBool("restat") && build_log() &&
+    if (edge->GetBindingBool(kSymbolRestat) && build_log() &&
         (entry = build_log()->LookupByOutput(output->path()))) {
       output_mtime = entry->mtime;
       used_restat = true;
     }
 
-    if (output_mtime < most_recent_input->mtime()) {
+    if (output_mtime < most_recent_input->mtime() &&
+        !(inputs_unchanged = InputsUnchanged(edge, output))) {
       EXPLAIN("%soutput %s older than most recent input %s "
               "(%" PRId64 " vs %" PRId64 ")",
               used_restat ? "restat of " : "", output->path().c_str(),
               most_recent_input->path().c_str(),
               output_mtime, most_recent_input->mtime());
+      EXPLAIN_RECORD(
+          used_restat ? kExplainRestatOutputOlder : kExplainOutputOlder,
+          output, most_recent_input, output_mtime, most_recent_input->mtime());
       return true;
     }
   }
 
   if (build_log()) {
-    bool generator = edge->GetBindingBool("generator");
+    bool generator = edge->GetBindingBool(kSymbolGenerator);
     if (entry || (entry = build_log()->LookupByOutput(output->path()))) {
       if (!generator &&
-          BuildLog::LogEntry::HashCommand(command) != entry->command_hash) {
+          edge->GetCommandHash() != entry->command_hash) {
         // May also be dirty due to the command changing since the last build.
         // But if this is a generator rule, the command changing does not make us
         // dirty.
         EXPLAIN("command line changed for %s", output->path().c_str());
+        EXPLAIN_RECORD(kExplainCommandChanged, output, NULL, 0, 0);
         return true;
       }
-      if (most_recent_input && entry->mtime < most_recent_input->mtime()) {
+      if (most_recent_input && entry->mtime < most_recent_input->mtime() &&
+          !inputs_unchanged &&
+          !(inputs_unchanged = InputsUnchanged(edge, output))) {
         // May also be dirty due to the mtime in the log being older than the
         // mtime of the most recent input.  This can occur even when the mtime
         // on disk is newer if a previous run wrote to the output file but
@@ -292,18 +505,36 @@ bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
         EXPLAIN("recorded mtime of %s older than most recent input %s (%" PRId64 " vs %" PRId64 ")",
                 output->path().c_str(), most_recent_input->path().c_str(),
                 entry->mtime, most_recent_input->mtime());
+        EXPLAIN_RECORD(kExplainRecordedMtimeOlder, output, most_recent_input,
+                       entry->mtime, most_recent_input->mtime());
         return true;
       }
     }
     if (!entry && !generator) {
       EXPLAIN("command line not found in log for %s", output->path().c_str());
+      EXPLAIN_RECORD(kExplainCommandNotLogged, output, NULL, 0, 0);
       return true;
     }
   }
 
+  if (inputs_unchanged) {
+    EXPLAIN("inputs of %s are newer, but their contents are unchanged",
+            output->path().c_str());
+  }
+
   return false;
 }
 
+bool DependencyScan::InputsUnchanged(const Edge* edge, const Node* output) {
+  if (!hash_log() || !edge->GetBindingBool(kSymbolHashInputs))
+    return false;
+  uint64_t digest;
+  string err;
+  if (!hash_log()->InputsDigest(edge, disk_interface_, false, &digest, &err))
+    return false;
+  return hash_log()->InputsMatch(output, digest);
+}
+
 bool DependencyScan::LoadDyndeps(Node* node, string* err) const {
   return dyndep_loader_.LoadDyndeps(node, err);
 }
@@ -313,6 +544,12 @@ bool DependencyScan::LoadDyndeps(Node* node, DyndepFile* ddf,
   return dyndep_loader_.LoadDyndeps(node, ddf, err);
 }
 
+bool DependencyScan::LoadDyndeps(const vector<Node*>& nodes,
+                                 vector<DyndepFile>* ddfs,
+                                 vector<string>* errs) const {
+  return dyndep_loader_.LoadDyndeps(nodes, ddfs, errs);
+}
+
 bool Edge::AllInputsReady() const {
   for (vector<Node*>::const_iterator i = inputs_.begin();
        i != inputs_.end(); ++i) {
@@ -322,47 +559,68 @@ bool Edge::AllInputsReady() const {
   return true;
 }
 
-/// An Env for an Edge, providing $in and $out.
+/// An Env for an Edge, providing $in and $out.  It keeps the path lists
+/// it built, for the other bindings evaluated with it.
 struct EdgeEnv : public Env {
   enum EscapeKind { kShellEscape, kDoNotEscape };
 
   EdgeEnv(const Edge* const edge, const EscapeKind escape)
-      : edge_(edge), escape_in_out_(escape), recursive_(false) {}
-  virtual string LookupVariable(const string& var);
+      : edge_(edge), escape_in_out_(escape), recursive_(false), lists_(0) {}
+  using Env::LookupVariable;
+  virtual string LookupVariable(Symbol var);
+
+  /// Evaluate the binding |var| of the edge, as a fresh EdgeEnv would.
+  string Evaluate(Symbol var) {
+    lookups_.clear();
+    recursive_ = false;
+    return LookupVariable(var);
+  }
 
   /// Given a span of Nodes, construct a list of paths suitable for a command
   /// line.
   std::string MakePathList(const Node* const* span, size_t size, char sep) const;
 
  private:
-  vector<string> lookups_;
+  /// The path list of |var|, one of the symbols of $in and $out.
+  const string& PathList(Symbol var);
+
+  vector<Symbol> lookups_;
   const Edge* const edge_;
   EscapeKind escape_in_out_;
   bool recursive_;
+  /// The lists built, by symbol, and a bit for each of them in lists_.
+  string path_lists_[kSymbolOut + 1];
+  unsigned lists_;
 };
 
-string EdgeEnv::LookupVariable(const string& var) {
-  if (var == "in" || var == "in_newline") {
+const string& EdgeEnv::PathList(Symbol var) {
+  string* list = &path_lists_[var];
+  if (lists_ & (1u << var))
+    return *list;
+  if (var == kSymbolIn || var == kSymbolInNewline) {
     int explicit_deps_count = edge_->inputs_.size() - edge_->implicit_deps_ -
       edge_->order_only_deps_;
-#if __cplusplus >= 201103L
-    return MakePathList(edge_->inputs_.data(), explicit_deps_count,
-#else
-    return MakePathList(&edge_->inputs_[0], explicit_deps_count,
-#endif
-                        var == "in" ? ' ' : '\n');
-  } else if (var == "out") {
+    *list = MakePathList(edge_->inputs_.data(), explicit_deps_count,
+                         var == kSymbolIn ? ' ' : '\n');
+  } else {
     int explicit_outs_count = edge_->outputs_.size() - edge_->implicit_outs_;
-    return MakePathList(&edge_->outputs_[0], explicit_outs_count, ' ');
+    *list = MakePathList(edge_->outputs_.data(), explicit_outs_count, ' ');
   }
+  lists_ |= 1u << var;
+  return *list;
+}
+
+string EdgeEnv::LookupVariable(Symbol var) {
+  if (var <= kSymbolOut)
+    return PathList(var);
 
   if (recursive_) {
-    vector<string>::const_iterator it;
+    vector<Symbol>::const_iterator it;
     if ((it = find(lookups_.begin(), lookups_.end(), var)) != lookups_.end()) {
       string cycle;
       for (; it != lookups_.end(); ++it)
-        cycle.append(*it + " -> ");
-      cycle.append(var);
+        cycle.append(SymbolName(*it) + " -> ");
+      cycle.append(SymbolName(var));
       Fatal(("cycle in rule variables: " + cycle).c_str());
     }
   }
@@ -380,56 +638,132 @@ string EdgeEnv::LookupVariable(const string& var) {
 
 std::string EdgeEnv::MakePathList(const Node* const* const span,
                                   const size_t size, const char sep) const {
+  // Size the list for the paths as they are, which only escaping grows.
+  size_t length = size;
+  for (const Node* const* i = span; i != span + size; ++i)
+    length += (*i)->path().size();
   string result;
+  result.reserve(length);
+  string decanonicalized;
   for (const Node* const* i = span; i != span + size; ++i) {
-    if (!result.empty())
+    if (i != span)
       result.push_back(sep);
-    const string& path = (*i)->PathDecanonicalized();
+    const string* path = &(*i)->path();
+    if ((*i)->slash_bits()) {
+      decanonicalized = (*i)->PathDecanonicalized();
+      path = &decanonicalized;
+    }
     if (escape_in_out_ == kShellEscape) {
 #ifdef _WIN32
-      GetWin32EscapedString(path, &result);
+      GetWin32EscapedString(*path, &result);
 #else
-      GetShellEscapedString(path, &result);
+      GetShellEscapedString(*path, &result);
 #endif
     } else {
-      result.append(path);
+      result.append(*path);
     }
   }
   return result;
 }
 
 std::string Edge::EvaluateCommand(const bool incl_rsp_file) const {
-  string command = GetBinding("command");
+  if (evaluated_) {
+    if (!incl_rsp_file || evaluated_->rspfile_content.empty())
+      return evaluated_->command;
+    return evaluated_->command + ";rspfile=" + evaluated_->rspfile_content;
+  }
+  // Both usually refer to $in, which is then only listed once.
+  EdgeEnv env(this, EdgeEnv::kShellEscape);
+  string command = env.Evaluate(kSymbolCommand);
   if (incl_rsp_file) {
-    string rspfile_content = GetBinding("rspfile_content");
+    string rspfile_content = env.Evaluate(kSymbolRspfileContent);
     if (!rspfile_content.empty())
       command += ";rspfile=" + rspfile_content;
   }
   return command;
 }
 
+uint64_t Edge::GetCommandHash() const {
+  if (!command_hash_valid_) {
+    command_hash_ = BuildLog::LogEntry::HashCommand(EvaluateCommand(true));
+    command_hash_valid_ = true;
+  }
+  return command_hash_;
+}
+
+void Edge::KeepEvaluatedBindings() {
+  evaluated_.reset();
+  std::unique_ptr<EvaluatedBindings> evaluated(new EvaluatedBindings);
+  EdgeEnv env(this, EdgeEnv::kShellEscape);
+  evaluated->command = env.Evaluate(kSymbolCommand);
+  evaluated->rspfile_content = env.Evaluate(kSymbolRspfileContent);
+  evaluated->depfile = GetUnescapedDepfile();
+  evaluated->rspfile = GetUnescapedRspfile();
+  evaluated_.swap(evaluated);
+}
+
 std::string Edge::GetBinding(const std::string& key) const {
+  return GetBinding(InternSymbol(key));
+}
+
+std::string Edge::GetBinding(Symbol key) const {
   EdgeEnv env(this, EdgeEnv::kShellEscape);
   return env.LookupVariable(key);
 }
 
 bool Edge::GetBindingBool(const string& key) const {
-  return !GetBinding(key).empty();
+  return GetBindingBool(InternSymbol(key));
+}
+
+bool Edge::GetBindingBool(Symbol key) const {
+  static_assert(kPredefinedSymbols <= 32, "bools_ has a bit per symbol");
+  if (key >= kPredefinedSymbols)
+    return !GetBinding(key).empty();
+  uint32_t bit = 1u << key;
+  if (!(bools_known_ & bit)) {
+    if (!GetBinding(key).empty())
+      bools_ |= bit;
+    else
+      bools_ &= ~bit;
+    bools_known_ |= bit;
+  }
+  return (bools_ & bit) != 0;
 }
 
 string Edge::GetUnescapedDepfile() const {
+  if (evaluated_)
+    return evaluated_->depfile;
   EdgeEnv env(this, EdgeEnv::kDoNotEscape);
-  return env.LookupVariable("depfile");
+  return env.LookupVariable(kSymbolDepfile);
+}
+
+int Edge::GetDepfileFd() const {
+  string fd = GetBinding(kSymbolDepfileFd);
+  if (fd.empty())
+    return -1;
+  char* end;
+  long value = strtol(fd.c_str(), &end, 10);
+  if (*end != '\0' || value <= 2 || value > INT_MAX)
+    return 0;
+  return static_cast<int>(value);
 }
 
 string Edge::GetUnescapedDyndep() const {
   EdgeEnv env(this, EdgeEnv::kDoNotEscape);
-  return env.LookupVariable("dyndep");
+  return env.LookupVariable(kSymbolDyndep);
 }
 
 std::string Edge::GetUnescapedRspfile() const {
+  if (evaluated_)
+    return evaluated_->rspfile;
   EdgeEnv env(this, EdgeEnv::kDoNotEscape);
-  return env.LookupVariable("rspfile");
+  return env.LookupVariable(kSymbolRspfile);
+}
+
+std::string Edge::GetRspfileContent() const {
+  if (evaluated_)
+    return evaluated_->rspfile_content;
+  return GetBinding(kSymbolRspfileContent);
 }
 
 void Edge::Dump(const char* prefix) const {
@@ -461,6 +795,12 @@ bool Edge::use_console() const {
   return pool() == &State::kConsolePool;
 }
 
+bool Edge::streams_output() const {
+  // deps=msvc filters the includes out of the whole output.
+  return !use_console() && GetBindingBool(kSymbolStreamOutput) &&
+         GetBinding(kSymbolDeps) != "msvc";
+}
+
 bool Edge::maybe_phonycycle_diagnostic() const {
   // CMake 2.8.12.x and 3.0.x produced self-referencing phony rules
   // of the form "build a: phony ... a ...".   Restrict our
@@ -502,7 +842,7 @@ void Node::Dump(const char* prefix) const {
 }
 
 bool ImplicitDepLoader::LoadDeps(Edge* edge, string* err) {
-  string deps_type = edge->GetBinding("deps");
+  string deps_type = edge->GetBinding(kSymbolDeps);
   if (!deps_type.empty())
     return LoadDepsFromLog(edge, err);
 
@@ -525,24 +865,77 @@ struct matches {
   std::vector<StringPiece>::iterator i_;
 };
 
+void ImplicitDepLoader::PrefetchDepfiles(const vector<Edge*>& edges,
+                                         size_t max_bytes) {
+  TRACE_RECORD("depfile prefetch");
+  // Depfiles are small; read enough at once to hide the latency of a
+  // network file system, and stop between batches once |max_bytes| are
+  // held.
+  const size_t kBatchSize = 256;
+  const int kReadThreads = 16;
+  // Metrics aren't synchronized.
+  if (g_metrics)
+    return;
+
+  size_t bytes = 0;
+  for (size_t start = 0; start < edges.size() && bytes < max_bytes;
+       start += kBatchSize) {
+    size_t batch = min(kBatchSize, edges.size() - start);
+    // Evaluating the bindings isn't thread-safe.
+    vector<string> paths(batch);
+    for (size_t i = 0; i < batch; ++i)
+      paths[i] = edges[start + i]->GetUnescapedDepfile();
+    vector<Prefetched> files(batch);
+    DiskInterface* disk_interface = disk_interface_;
+    ParallelFor(batch, kReadThreads, [&](size_t i) {
+      Prefetched* file = &files[i];
+      FileReader::Status status =
+          disk_interface->ReadFile(paths[i], &file->content, &file->err);
+      file->ok = status != FileReader::OtherError;
+      if (status == FileReader::NotFound)
+        file->err.clear();
+    });
+    for (size_t i = 0; i < batch; ++i) {
+      bytes += files[i].content.size();
+      prefetched_[edges[start + i]] = std::move(files[i]);
+    }
+  }
+}
+
 bool ImplicitDepLoader::LoadDepFile(Edge* edge, const string& path,
                                     string* err) {
   METRIC_RECORD("depfile load");
+  TRACE_RECORD("depfile load");
   // Read depfile content.  Treat a missing depfile as empty.
   string content;
-  switch (disk_interface_->ReadFile(path, &content, err)) {
-  case DiskInterface::Okay:
-    break;
-  case DiskInterface::NotFound:
-    err->clear();
-    break;
-  case DiskInterface::OtherError:
-    *err = "loading '" + path + "': " + *err;
-    return false;
+  unordered_map<Edge*, Prefetched>::iterator prefetched =
+      prefetched_.find(edge);
+  if (prefetched != prefetched_.end()) {
+    bool ok = prefetched->second.ok;
+    content.swap(prefetched->second.content);
+    if (!ok)
+      *err = prefetched->second.err;
+    prefetched_.erase(prefetched);
+    if (!ok) {
+      *err = "loading '" + path + "': " + *err;
+      return false;
+    }
+  } else {
+    switch (disk_interface_->ReadFile(path, &content, err)) {
+    case DiskInterface::Okay:
+      break;
+    case DiskInterface::NotFound:
+      err->clear();
+      break;
+    case DiskInterface::OtherError:
+      *err = "loading '" + path + "': " + *err;
+      return false;
+    }
   }
   // On a missing depfile: return false and empty *err.
   if (content.empty()) {
     EXPLAIN("depfile '%s' is missing", path.c_str());
+    EXPLAIN_RECORD(kExplainDepfileMissing, edge->outputs_[0], NULL, 0, 0);
     return false;
   }
 
@@ -575,6 +968,7 @@ bool ImplicitDepLoader::LoadDepFile(Edge* edge, const string& path,
   if (opath != *primary_out) {
     EXPLAIN("expected depfile '%s' to mention '%s', got '%s'", path.c_str(),
             first_output->path().c_str(), primary_out->AsString().c_str());
+    EXPLAIN_RECORD(kExplainDepfileMismatch, first_output, NULL, 0, 0);
     return false;
   }
 
@@ -615,6 +1009,7 @@ bool ImplicitDepLoader::LoadDepsFromLog(Edge* edge, string* err) {
   DepsLog::Deps* deps = deps_log_ ? deps_log_->GetDeps(output) : NULL;
   if (!deps) {
     EXPLAIN("deps for '%s' are missing", output->path().c_str());
+    EXPLAIN_RECORD(kExplainDepsMissing, output, NULL, 0, 0);
     return false;
   }
 
@@ -622,6 +1017,8 @@ bool ImplicitDepLoader::LoadDepsFromLog(Edge* edge, string* err) {
   if (output->mtime() > deps->mtime) {
     EXPLAIN("stored deps info out of date for '%s' (%" PRId64 " vs %" PRId64 ")",
             output->path().c_str(), deps->mtime, output->mtime());
+    EXPLAIN_RECORD(kExplainDepsOutdated, output, NULL, output->mtime(),
+                   deps->mtime);
     return false;
   }
 
@@ -641,6 +1038,7 @@ vector<Node*>::iterator ImplicitDepLoader::PreallocateSpace(Edge* edge,
   edge->inputs_.insert(edge->inputs_.end() - edge->order_only_deps_,
                        (size_t)count, 0);
   edge->implicit_deps_ += count;
+  edge->loaded_deps_ += count;
   return edge->inputs_.end() - edge->order_only_deps_ - count;
 }
 
@@ -660,3 +1058,46 @@ void ImplicitDepLoader::CreatePhonyInEdge(Node* node) {
   // this node, it will simply set outputs_ready_ to the correct value.
   phony_edge->outputs_ready_ = true;
 }
+
+void DependentsIndex::Dependents(Node* node, vector<Node*>* dependents) {
+  if (!indexed_ && deps_log_) {
+    vector<bool> live = deps_log_->LiveEntries();
+    for (size_t id = 0; id < deps_log_->nodes().size(); ++id) {
+      Node* n = deps_log_->nodes()[id];
+      DepsLog::Deps* deps = deps_log_->GetDeps(n);
+      if (!deps || !live[id])
+        continue;
+      for (int i = 0; i < deps->node_count; ++i)
+        deps_users_[deps->nodes[i]].push_back(n);
+    }
+  }
+  indexed_ = true;
+
+  set<Node*> seen;
+  vector<Node*> stack(1, node);
+  while (!stack.empty()) {
+    Node* n = stack.back();
+    stack.pop_back();
+    for (vector<Edge*>::const_iterator e = n->out_edges().begin();
+         e != n->out_edges().end(); ++e) {
+      for (vector<Node*>::iterator o = (*e)->outputs_.begin();
+           o != (*e)->outputs_.end(); ++o) {
+        if (seen.insert(*o).second)
+          stack.push_back(*o);
+      }
+    }
+    map<Node*, vector<Node*> >::iterator users = deps_users_.find(n);
+    if (users == deps_users_.end())
+      continue;
+    for (vector<Node*>::iterator o = users->second.begin();
+         o != users->second.end(); ++o) {
+      if (seen.insert(*o).second)
+        stack.push_back(*o);
+    }
+  }
+
+  dependents->assign(seen.begin(), seen.end());
+  sort(dependents->begin(), dependents->end(), [](Node* a, Node* b) {
+    return a->path() < b->path();
+  });
+}
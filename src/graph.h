@@ -15,8 +15,12 @@
 #ifndef NINJA_GRAPH_H_
 #define NINJA_GRAPH_H_
 
+#include <algorithm>
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "dyndep.h"
@@ -29,6 +33,7 @@ struct DepfileParserOptions;
 struct DiskInterface;
 struct DepsLog;
 struct Edge;
+struct HashLog;
 struct Node;
 struct Pool;
 struct State;
@@ -37,13 +42,13 @@ struct State;
 /// it's dirty, mtime, etc.
 struct Node {
   Node(const std::string& path, uint64_t slash_bits)
-      : path_(path),
-        slash_bits_(slash_bits),
-        mtime_(-1),
+      : mtime_(-1),
+        in_edge_(NULL),
+        id_(-1),
         dirty_(false),
         dyndep_pending_(false),
-        in_edge_(NULL),
-        id_(-1) {}
+        slash_bits_(slash_bits),
+        path_(path) {}
 
   /// Return false on error.
   bool Stat(DiskInterface* disk_interface, std::string* err);
@@ -100,15 +105,23 @@ struct Node {
 
   const std::vector<Edge*>& out_edges() const { return out_edges_; }
   void AddOutEdge(Edge* edge) { out_edges_.push_back(edge); }
+  void RemoveOutEdge(Edge* edge) {
+    out_edges_.erase(std::remove(out_edges_.begin(), out_edges_.end(), edge),
+                     out_edges_.end());
+  }
+  /// Undo one AddOutEdge(), for a node that may be an input several times.
+  void RemoveOneOutEdge(Edge* edge) {
+    std::vector<Edge*>::reverse_iterator i =
+        std::find(out_edges_.rbegin(), out_edges_.rend(), edge);
+    if (i != out_edges_.rend())
+      out_edges_.erase(i.base() - 1);
+  }
 
   void Dump(const char* prefix="") const;
 
 private:
-  std::string path_;
-
-  /// Set bits starting from lowest for backslashes that were normalized to
-  /// forward slashes by CanonicalizePath. See |PathDecanonicalized|.
-  uint64_t slash_bits_;
+  // The state the scan for dirty nodes reads for every node comes first,
+  // packed without padding, so that it shares a cache line.
 
   /// Possible values of mtime_:
   ///   -1: file hasn't been examined
@@ -116,6 +129,13 @@ private:
   ///   >0: actual file's mtime
   TimeStamp mtime_;
 
+  /// The Edge that produces this Node, or NULL when there is no
+  /// known edge to produce it.
+  Edge* in_edge_;
+
+  /// A dense integer id for the node, assigned and used by DepsLog.
+  int id_;
+
   /// Dirty is true when the underlying file is out-of-date.
   /// But note that Edge::outputs_ready_ is also used in judging which
   /// edges to build.
@@ -125,15 +145,14 @@ private:
   /// has not yet been loaded.
   bool dyndep_pending_;
 
-  /// The Edge that produces this Node, or NULL when there is no
-  /// known edge to produce it.
-  Edge* in_edge_;
-
   /// All Edges that use this Node as an input.
   std::vector<Edge*> out_edges_;
 
-  /// A dense integer id for the node, assigned and used by DepsLog.
-  int id_;
+  /// Set bits starting from lowest for backslashes that were normalized to
+  /// forward slashes by CanonicalizePath. See |PathDecanonicalized|.
+  uint64_t slash_bits_;
+
+  std::string path_;
 };
 
 /// An edge in the dependency graph; links between Nodes using Rules.
@@ -145,10 +164,13 @@ struct Edge {
   };
 
   Edge()
-      : rule_(NULL), pool_(NULL), dyndep_(NULL), env_(NULL), mark_(VisitNone),
-        id_(0), outputs_ready_(false), deps_loaded_(false),
-        deps_missing_(false), implicit_deps_(0), order_only_deps_(0),
-        implicit_outs_(0) {}
+      : mark_(VisitNone), outputs_ready_(false), deps_loaded_(false),
+        deps_missing_(false), rule_(NULL), pool_(NULL), dyndep_(NULL),
+        env_(NULL), id_(0), weight_(1), priority_(0),
+        critical_path_weight_(-1), critical_path_priority_(0),
+        implicit_deps_(0), order_only_deps_(0), loaded_deps_(0),
+        implicit_outs_(0), command_hash_(0), command_hash_valid_(false),
+        bools_known_(0), bools_(0) {}
 
   /// Return true if all inputs' in-edges are ready.
   bool AllInputsReady() const;
@@ -160,32 +182,89 @@ struct Edge {
 
   /// Returns the shell-escaped value of |key|.
   std::string GetBinding(const std::string& key) const;
+  std::string GetBinding(Symbol key) const;
   bool GetBindingBool(const std::string& key) const;
+  /// Whether |key| is set.  The answers for the predefined symbols, e.g.
+  /// kSymbolRestat, are evaluated once and kept until ForgetBindingBools().
+  bool GetBindingBool(Symbol key) const;
+  /// Evaluate the boolean bindings again, once the bindings of the edge
+  /// changed.
+  void ForgetBindingBools() { bools_known_ = 0; }
 
   /// Like GetBinding("depfile"), but without shell escaping.
   std::string GetUnescapedDepfile() const;
+  /// The descriptor the command writes its depfile to ("depfile_fd"),
+  /// which ninja keeps in memory rather than on disk: -1 if it has none,
+  /// 0 if the binding isn't a descriptor past stderr.
+  int GetDepfileFd() const;
   /// Like GetBinding("dyndep"), but without shell escaping.
   std::string GetUnescapedDyndep() const;
   /// Like GetBinding("rspfile"), but without shell escaping.
   std::string GetUnescapedRspfile() const;
+  /// Same as GetBinding("rspfile_content").
+  std::string GetRspfileContent() const;
+  /// The rspfile content kept by KeepEvaluatedBindings(), without a copy.
+  const std::string& kept_rspfile_content() const {
+    return evaluated_->rspfile_content;
+  }
+
+  /// Return the hash of EvaluateCommand(true), as recorded in the build log.
+  /// It is computed once and kept.
+  uint64_t GetCommandHash() const;
+
+  /// Evaluate the command and the depfile and rspfile bindings now, and
+  /// answer EvaluateCommand(), GetUnescapedDepfile(), GetUnescapedRspfile()
+  /// and GetRspfileContent() from them until ReleaseEvaluatedBindings().
+  /// The builder keeps them for the edges it runs, which need them several
+  /// times.
+  void KeepEvaluatedBindings();
+  void ReleaseEvaluatedBindings() { evaluated_.reset(); }
 
   void Dump(const char* prefix="") const;
 
-  const Rule* rule_;
-  Pool* pool_;
+  // The state the scan for dirty nodes keeps for every edge comes first,
+  // packed without padding, so that it shares a cache line with inputs_
+  // and outputs_.
   std::vector<Node*> inputs_;
   std::vector<Node*> outputs_;
-  Node* dyndep_;
-  BindingEnv* env_;
   VisitMark mark_;
-  size_t id_;
   bool outputs_ready_;
   bool deps_loaded_;
   bool deps_missing_;
+  const Rule* rule_;
+  Pool* pool_;
+  Node* dyndep_;
+  BindingEnv* env_;
+  size_t id_;
+  /// What the edge counts for against the depth of its pool, from the
+  /// pool_weight binding.
+  int weight_;
+  /// How much of each resource of its pool the edge uses, in the order of
+  /// Pool::resources(), from the pool_resources binding.  Trailing zeros
+  /// are left out.
+  std::vector<int> resource_use_;
+  /// How much sooner than others the edge should run, from the priority
+  /// binding or else that of its pool; 0 by default, and may be negative.
+  int priority_;
+  /// Estimated time (in milliseconds) needed to run this edge and the
+  /// longest chain of wanted edges that depends on it, or -1 if not yet
+  /// computed.  Computed by Plan and used to schedule edges on the
+  /// critical path first.
+  int64_t critical_path_weight_;
+  /// The highest priority of the edge and the wanted edges that depend on
+  /// it, so that what a prioritized edge waits for runs early too.
+  /// Computed by Plan along with critical_path_weight_.
+  int critical_path_priority_;
 
   const Rule& rule() const { return *rule_; }
   Pool* pool() const { return pool_; }
-  int weight() const { return 1; }
+  int weight() const { return weight_; }
+  int64_t critical_path_weight() const { return critical_path_weight_; }
+  void set_critical_path_weight(int64_t weight) {
+    critical_path_weight_ = weight;
+  }
+  int priority() const { return priority_; }
+  int critical_path_priority() const { return critical_path_priority_; }
   bool outputs_ready() const { return outputs_ready_; }
 
   // There are three types of inputs.
@@ -198,6 +277,9 @@ struct Edge {
   // #2 and #3 when we need to access the various subsets.
   int implicit_deps_;
   int order_only_deps_;
+  /// How many of the implicit deps, at their end, were loaded from a
+  /// depfile or the deps log rather than declared in the manifest.
+  int loaded_deps_;
   bool is_implicit(size_t index) {
     return index >= inputs_.size() - order_only_deps_ - implicit_deps_ &&
         !is_order_only(index);
@@ -218,7 +300,24 @@ struct Edge {
 
   bool is_phony() const;
   bool use_console() const;
+  /// Whether the output of the command is shown line by line as it comes
+  /// ("stream_output"), rather than once it exited.
+  bool streams_output() const;
   bool maybe_phonycycle_diagnostic() const;
+
+ private:
+  struct EvaluatedBindings {
+    std::string command;
+    std::string rspfile_content;
+    std::string depfile;
+    std::string rspfile;
+  };
+  std::unique_ptr<EvaluatedBindings> evaluated_;
+  mutable uint64_t command_hash_;
+  mutable bool command_hash_valid_;
+  /// The GetBindingBool() answers kept, a bit for each predefined symbol.
+  mutable uint32_t bools_known_;
+  mutable uint32_t bools_;
 };
 
 struct EdgeCmp {
@@ -229,6 +328,56 @@ struct EdgeCmp {
 
 typedef std::set<Edge*, EdgeCmp> EdgeSet;
 
+/// Orders edges so that the edge with the highest critical path priority
+/// comes first, then the one with the largest critical path weight,
+/// falling back to manifest order for equal weights.  The priority and
+/// the weight of an edge must not change while it is in an
+/// EdgePriorityQueue.
+struct EdgePriorityCmp {
+  bool operator()(const Edge* a, const Edge* b) const {
+    if (a->critical_path_priority() != b->critical_path_priority())
+      return a->critical_path_priority() > b->critical_path_priority();
+    if (a->critical_path_weight() != b->critical_path_weight())
+      return a->critical_path_weight() > b->critical_path_weight();
+    return EdgeCmp()(a, b);
+  }
+};
+
+/// A binary heap of edges, with the first of them in |Cmp| order on top.
+/// Unlike a std::set, it doesn't allocate for each edge it holds.
+template <typename Cmp>
+struct EdgeHeap {
+  bool empty() const { return edges_.empty(); }
+  size_t size() const { return edges_.size(); }
+  void clear() { edges_.clear(); }
+
+  Edge* top() const { return edges_.front(); }
+
+  void push(Edge* edge) {
+    edges_.push_back(edge);
+    std::push_heap(edges_.begin(), edges_.end(), After());
+  }
+
+  Edge* pop() {
+    std::pop_heap(edges_.begin(), edges_.end(), After());
+    Edge* edge = edges_.back();
+    edges_.pop_back();
+    return edge;
+  }
+
+  /// The edges, in no particular order.
+  const std::vector<Edge*>& edges() const { return edges_; }
+
+ private:
+  /// The std heap functions put the greatest edge on top.
+  struct After {
+    bool operator()(const Edge* a, const Edge* b) const { return Cmp()(b, a); }
+  };
+  std::vector<Edge*> edges_;
+};
+
+typedef EdgeHeap<EdgePriorityCmp> EdgePriorityQueue;
+
 /// ImplicitDepLoader loads implicit dependencies, as referenced via the
 /// "depfile" attribute in build files.
 struct ImplicitDepLoader {
@@ -247,6 +396,15 @@ struct ImplicitDepLoader {
     return deps_log_;
   }
 
+  /// Read the depfiles of |edges| ahead of LoadDeps(), a batch at a time
+  /// on several threads, until |max_bytes| of them are held.  LoadDeps()
+  /// then parses what was read instead of reading the file.
+  void PrefetchDepfiles(const std::vector<Edge*>& edges, size_t max_bytes);
+
+  /// Forget the depfiles PrefetchDepfiles() read that LoadDeps() didn't
+  /// use, as they may be out of date by now.
+  void ClearPrefetched() { prefetched_.clear(); }
+
  private:
   /// Load implicit dependencies for \a edge from a depfile attribute.
   /// @return false on error (without filling \a err if info is just missing).
@@ -269,8 +427,35 @@ struct ImplicitDepLoader {
   DiskInterface* disk_interface_;
   DepsLog* deps_log_;
   DepfileParserOptions const* depfile_parser_options_;
+
+  /// A depfile PrefetchDepfiles() read: its contents, empty if it was
+  /// missing, or the error reading it.
+  struct Prefetched {
+    bool ok;
+    std::string content;
+    std::string err;
+  };
+  std::unordered_map<Edge*, Prefetched> prefetched_;
 };
 
+/// Answers "what depends on this node, directly or not", following both
+/// the edges of the manifest and the deps the deps log recorded.  The
+/// reverse of the deps log is indexed once, on the first query, so that
+/// each query only walks the part of the graph that depends on its node.
+struct DependentsIndex {
+  explicit DependentsIndex(DepsLog* deps_log)
+      : deps_log_(deps_log), indexed_(false) {}
+
+  /// Fill |dependents| with the outputs that depend on |node|, sorted by
+  /// path.
+  void Dependents(Node* node, std::vector<Node*>* dependents);
+
+ private:
+  DepsLog* deps_log_;
+  bool indexed_;
+  /// Maps nodes to the outputs whose live deps log entries list them.
+  std::map<Node*, std::vector<Node*> > deps_users_;
+};
 
 /// DependencyScan manages the process of scanning the files in a graph
 /// and updating the dirty/outputs_ready state of all the nodes and edges.
@@ -279,6 +464,8 @@ struct DependencyScan {
                  DiskInterface* disk_interface,
                  DepfileParserOptions const* depfile_parser_options)
       : build_log_(build_log),
+        hash_log_(NULL),
+        lazy_depfiles_(false),
         disk_interface_(disk_interface),
         dep_loader_(state, deps_log, disk_interface, depfile_parser_options),
         dyndep_loader_(state, disk_interface) {}
@@ -290,6 +477,24 @@ struct DependencyScan {
   /// Returns false on failure.
   bool RecomputeDirty(Node* node, std::string* err);
 
+  /// Stat the nodes reachable from |targets|, including their dependencies
+  /// recorded in the deps log, ahead of RecomputeDirty().  The stats run in
+  /// parallel when the DiskInterface allows it, which hides their latency
+  /// on network file systems.  Errors are left for RecomputeDirty() to
+  /// report.  With a hash log, it also digests the inputs of "hash_inputs"
+  /// edges that look out of date, and it reads the depfiles of edges that
+  /// have one ahead of RecomputeDirty() too.  With a build log, it hashes
+  /// the commands of the edges it has entries for on several threads.
+  void StatReachableNodes(const std::vector<Node*>& targets);
+
+  /// Forget the dirty state RecomputeDirty() found for the edges that the
+  /// |changed| nodes are an input or an output of, and for everything
+  /// downstream of them, so that the next RecomputeDirty() visits only
+  /// those again.  Their loaded deps are dropped, to be loaded afresh; the
+  /// changed nodes are expected to have been stat'ed again already.
+  /// Dyndep information loaded for them stays.
+  void InvalidateDirty(const std::vector<Node*>& changed);
+
   /// Recompute whether any output of the edge is dirty, if so sets |*dirty|.
   /// Returns false on failure.
   bool RecomputeOutputsDirty(Edge* edge, Node* most_recent_input,
@@ -302,16 +507,37 @@ struct DependencyScan {
     build_log_ = log;
   }
 
+  HashLog* hash_log() const {
+    return hash_log_;
+  }
+  void set_hash_log(HashLog* log) {
+    hash_log_ = log;
+  }
+
   DepsLog* deps_log() const {
     return dep_loader_.deps_log();
   }
 
+  /// Don't read the depfile of an edge (with "depfile" but not "deps")
+  /// when its outputs are out of date whatever its inputs are, e.g.
+  /// missing.  It runs anyway; the deps the depfile lists would only order
+  /// it after the edges that generate them, which a depfile naming
+  /// generated files not otherwise declared doesn't get right on a clean
+  /// build either.
+  void set_lazy_depfiles(bool lazy) {
+    lazy_depfiles_ = lazy;
+  }
+
   /// Load a dyndep file from the given node's path and update the
   /// build graph with the new information.  One overload accepts
   /// a caller-owned 'DyndepFile' object in which to store the
   /// information loaded from the dyndep file.
   bool LoadDyndeps(Node* node, std::string* err) const;
   bool LoadDyndeps(Node* node, DyndepFile* ddf, std::string* err) const;
+  /// Load several dyndep files at once; see DyndepLoader.
+  bool LoadDyndeps(const std::vector<Node*>& nodes,
+                   std::vector<DyndepFile>* ddfs,
+                   std::vector<std::string>* errs) const;
 
  private:
   bool RecomputeDirty(Node* node, std::vector<Node*>* stack, std::string* err);
@@ -320,9 +546,18 @@ struct DependencyScan {
   /// Recompute whether a given single output should be marked dirty.
   /// Returns true if so.
   bool RecomputeOutputDirty(const Edge* edge, const Node* most_recent_input,
-                            const std::string& command, Node* output);
+                            Node* output);
+
+  /// Whether |edge| has "hash_inputs" and |output| was last built from
+  /// inputs with the contents they have now.
+  bool InputsUnchanged(const Edge* edge, const Node* output);
+
+  /// Whether |edge| finds its deps in a depfile, not the deps log.
+  static bool HasDepfileDeps(Edge* edge);
 
   BuildLog* build_log_;
+  HashLog* hash_log_;
+  bool lazy_depfiles_;
   DiskInterface* disk_interface_;
   ImplicitDepLoader dep_loader_;
   DyndepLoader dyndep_loader_;
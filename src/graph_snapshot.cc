@@ -0,0 +1,108 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "graph_snapshot.h"
+
+#include <unordered_map>
+
+#include "build_log.h"
+#include "deps_log.h"
+#include "graph.h"
+#include "state.h"
+
+using namespace std;
+
+GraphSnapshot::GraphSnapshot(State* state, DepsLog* deps_log,
+                             BuildLog* build_log, bool commands,
+                             uint64_t epoch)
+    : epoch_(epoch) {
+  unordered_map<const ::Node*, int> node_index;
+  node_index.reserve(state->paths_.size());
+  nodes_.resize(state->paths_.size());
+  int index = 0;
+  for (State::Paths::const_iterator i = state->paths_.begin();
+       i != state->paths_.end(); ++i) {
+    node_index[i->second] = index++;
+  }
+  unordered_map<const ::Edge*, int> edge_index;
+  edge_index.reserve(state->edges_.size());
+  index = 0;
+  for (vector< ::Edge*>::const_iterator e = state->edges_.begin();
+       e != state->edges_.end(); ++e) {
+    edge_index[*e] = index++;
+  }
+
+  for (State::Paths::const_iterator i = state->paths_.begin();
+       i != state->paths_.end(); ++i) {
+    ::Node* node = i->second;
+    Node* copy = &nodes_[node_index[node]];
+    copy->path = node->path();
+    copy->mtime = node->mtime();
+    copy->dirty = node->dirty();
+    copy->in_edge = node->in_edge() ? edge_index[node->in_edge()] : -1;
+    for (vector< ::Edge*>::const_iterator e = node->out_edges().begin();
+         e != node->out_edges().end(); ++e) {
+      copy->out_edges.push_back(edge_index[*e]);
+    }
+
+    DepsLog::Deps* deps = deps_log ? deps_log->GetDeps(node) : NULL;
+    copy->has_deps = deps && deps->recorded();
+    copy->deps_mtime = copy->has_deps ? deps->mtime : 0;
+    for (int d = 0; copy->has_deps && d < deps->node_count; ++d)
+      copy->deps.push_back(node_index[deps->nodes[d]]);
+
+    BuildLog::LogEntry* entry =
+        build_log ? build_log->LookupByOutput(node->path()) : NULL;
+    copy->logged = entry != NULL;
+    copy->command_hash = entry ? entry->command_hash : 0;
+    copy->log_mtime = entry ? entry->mtime : 0;
+  }
+
+  edges_.resize(state->edges_.size());
+  for (vector< ::Edge*>::const_iterator e = state->edges_.begin();
+       e != state->edges_.end(); ++e) {
+    const ::Edge* edge = *e;
+    Edge* copy = &edges_[edge_index[edge]];
+    copy->rule = edge->rule().name();
+    copy->pool = edge->pool() ? edge->pool()->name() : string();
+    if (commands && !edge->is_phony())
+      copy->command = edge->EvaluateCommand();
+    for (vector< ::Node*>::const_iterator n = edge->inputs_.begin();
+         n != edge->inputs_.end(); ++n) {
+      copy->inputs.push_back(node_index[*n]);
+    }
+    copy->implicit_deps = edge->implicit_deps_;
+    copy->order_only_deps = edge->order_only_deps_;
+    for (vector< ::Node*>::const_iterator n = edge->outputs_.begin();
+         n != edge->outputs_.end(); ++n) {
+      copy->outputs.push_back(node_index[*n]);
+    }
+    copy->implicit_outs = edge->implicit_outs_;
+    copy->outputs_ready = edge->outputs_ready();
+  }
+
+  for (vector< ::Node*>::const_iterator n = state->defaults_.begin();
+       n != state->defaults_.end(); ++n) {
+    defaults_.push_back(node_index[*n]);
+  }
+
+  // |nodes_| is complete, so the keys stay put.
+  for (size_t i = 0; i < nodes_.size(); ++i)
+    paths_[nodes_[i].path] = (int)i;
+}
+
+int GraphSnapshot::LookupNode(StringPiece path) const {
+  Paths::const_iterator i = paths_.find(path);
+  return i == paths_.end() ? -1 : i->second;
+}
@@ -0,0 +1,101 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_GRAPH_SNAPSHOT_H_
+#define NINJA_GRAPH_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "hash_map.h"
+#include "string_piece.h"
+#include "timestamp.h"
+
+struct BuildLog;
+struct DepsLog;
+struct State;
+
+/// A copy of a loaded graph, and of what the logs say about its nodes, as
+/// they were when it was taken.  Nothing changes it afterwards, so that
+/// read-only tools (queries, compilation databases, browsing) may use it
+/// on other threads while a build goes on with the graph itself.  The
+/// nodes and edges refer to each other by their indexes in it.
+struct GraphSnapshot {
+  /// Copy |state|, with the deps and build log entries of its nodes from
+  /// |deps_log| and |build_log| if they're not NULL.  The commands of the
+  /// edges are evaluated too if |commands| is set.  |epoch| tells the
+  /// snapshots taken one after another apart.
+  /// Must run on the thread that changes |state| and the logs.
+  GraphSnapshot(State* state, DepsLog* deps_log, BuildLog* build_log,
+                bool commands, uint64_t epoch);
+
+  struct Node {
+    std::string path;
+    /// As Node::mtime() was: -1 if the node wasn't stat'ed, 0 if it
+    /// doesn't exist.
+    TimeStamp mtime;
+    bool dirty;
+    /// The edge producing the node, or -1 if it's a source.
+    int in_edge;
+    std::vector<int> out_edges;
+    /// The nodes the deps log recorded as its dependencies, if it has
+    /// an entry for it, and the mtime recorded with them.
+    bool has_deps;
+    TimeStamp deps_mtime;
+    std::vector<int> deps;
+    /// The build log entry of the node, if it has one.
+    bool logged;
+    uint64_t command_hash;
+    TimeStamp log_mtime;
+  };
+
+  struct Edge {
+    std::string rule;
+    std::string pool;
+    /// Empty unless the snapshot was taken with the commands.
+    std::string command;
+    /// Like Edge::inputs_ and outputs_, with the implicit and order-only
+    /// ones last.
+    std::vector<int> inputs;
+    int implicit_deps;
+    int order_only_deps;
+    std::vector<int> outputs;
+    int implicit_outs;
+    bool outputs_ready;
+  };
+
+  uint64_t epoch() const { return epoch_; }
+  const std::vector<Node>& nodes() const { return nodes_; }
+  const std::vector<Edge>& edges() const { return edges_; }
+  const std::vector<int>& defaults() const { return defaults_; }
+
+  /// The index of the node at canonical |path|, or -1 if there is none.
+  int LookupNode(StringPiece path) const;
+
+ private:
+  uint64_t epoch_;
+  std::vector<Node> nodes_;
+  std::vector<Edge> edges_;
+  std::vector<int> defaults_;
+  /// The nodes by path, pointing into |nodes_|.
+  typedef ExternalStringHashMap<int>::Type Paths;
+  Paths paths_;
+
+  GraphSnapshot(const GraphSnapshot& other);   // DO NOT IMPLEMENT
+  void operator=(const GraphSnapshot& other);  // DO NOT IMPLEMENT
+};
+
+#endif  // NINJA_GRAPH_SNAPSHOT_H_
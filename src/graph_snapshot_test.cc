@@ -0,0 +1,75 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "graph_snapshot.h"
+
+#include "graph.h"
+#include "state.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+struct GraphSnapshotTest : public StateTestWithBuiltinRules {};
+
+TEST_F(GraphSnapshotTest, CopiesGraph) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build a.o: cat a.c | a.h || gen\n"
+"build out | out.map: cat a.o\n"
+"build gen: phony\n"
+"default out\n"));
+  GetNode("a.o")->set_dirty(true);
+  GetNode("a.c")->MarkMissing();
+
+  GraphSnapshot snapshot(&state_, NULL, NULL, true, 7);
+  EXPECT_EQ(7u, snapshot.epoch());
+  EXPECT_EQ(state_.paths_.size(), snapshot.nodes().size());
+  ASSERT_EQ(3u, snapshot.edges().size());
+  EXPECT_EQ(-1, snapshot.LookupNode("missing"));
+
+  int a_o = snapshot.LookupNode("a.o");
+  ASSERT_NE(-1, a_o);
+  const GraphSnapshot::Node& node = snapshot.nodes()[a_o];
+  EXPECT_EQ("a.o", node.path);
+  EXPECT_TRUE(node.dirty);
+  EXPECT_FALSE(node.has_deps);
+  EXPECT_FALSE(node.logged);
+  ASSERT_EQ(1u, node.out_edges.size());
+
+  const GraphSnapshot::Edge& edge = snapshot.edges()[node.in_edge];
+  EXPECT_EQ("cat", edge.rule);
+  EXPECT_EQ("cat a.c > a.o", edge.command);
+  ASSERT_EQ(3u, edge.inputs.size());
+  EXPECT_EQ("a.c", snapshot.nodes()[edge.inputs[0]].path);
+  EXPECT_EQ(0, snapshot.nodes()[edge.inputs[0]].mtime);
+  EXPECT_EQ(-1, snapshot.nodes()[edge.inputs[1]].mtime);
+  EXPECT_EQ("gen", snapshot.nodes()[edge.inputs[2]].path);
+  EXPECT_EQ(1, edge.implicit_deps);
+  EXPECT_EQ(1, edge.order_only_deps);
+
+  const GraphSnapshot::Edge& link = snapshot.edges()[node.out_edges[0]];
+  ASSERT_EQ(2u, link.outputs.size());
+  EXPECT_EQ("out.map", snapshot.nodes()[link.outputs[1]].path);
+  EXPECT_EQ(1, link.implicit_outs);
+
+  ASSERT_EQ(1u, snapshot.defaults().size());
+  EXPECT_EQ("out", snapshot.nodes()[snapshot.defaults()[0]].path);
+
+  // Changes to the graph don't show.
+  GetNode("a.o")->set_dirty(false);
+  EXPECT_TRUE(snapshot.nodes()[a_o].dirty);
+}
+
+}  // anonymous namespace
@@ -14,6 +14,8 @@
 
 #include "graph.h"
 #include "build.h"
+#include "build_log.h"
+#include "deps_log.h"
 
 #include "test.h"
 
@@ -42,6 +44,178 @@ TEST_F(GraphTest, MissingImplicit) {
   EXPECT_TRUE(GetNode("out")->dirty());
 }
 
+TEST_F(GraphTest, StatReachableNodes) {
+  string manifest = "build out: cat mid0 mid1 | implicit\n";
+  for (int i = 0; i < 2; ++i) {
+    manifest += "build mid" + to_string(i) + ": cat";
+    for (int j = 0; j < 200; ++j)
+      manifest += " in" + to_string(i) + "_" + to_string(j);
+    manifest += "\n";
+  }
+  manifest += "build unrelated: cat in0_0\n";
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_, manifest.c_str()));
+  fs_.Create("in0_0", "");
+  fs_.Create("out", "");
+
+  vector<Node*> targets(1, GetNode("out"));
+  scan_.StatReachableNodes(targets);
+
+  EXPECT_TRUE(GetNode("out")->status_known());
+  EXPECT_TRUE(GetNode("out")->exists());
+  EXPECT_TRUE(GetNode("implicit")->status_known());
+  EXPECT_FALSE(GetNode("implicit")->exists());
+  EXPECT_TRUE(GetNode("mid1")->status_known());
+  EXPECT_TRUE(GetNode("in0_0")->exists());
+  EXPECT_TRUE(GetNode("in1_199")->status_known());
+  EXPECT_FALSE(GetNode("unrelated")->status_known());
+
+  string err;
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(GetNode("out")->dirty());
+}
+
+TEST_F(GraphTest, StatReachableNodesHashesCommands) {
+  string manifest = "build all: phony";
+  for (int i = 0; i < 300; ++i)
+    manifest += " out" + to_string(i);
+  manifest += "\n";
+  for (int i = 0; i < 300; ++i)
+    manifest += "build out" + to_string(i) + ": cat in\n";
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_, manifest.c_str()));
+  fs_.Create("in", "");
+  fs_.Tick();
+
+  // Log the commands of a manifest where the one of out7 differs.
+  string changed = manifest;
+  changed.replace(changed.find("out7: cat in"), 12, "out7: cat in in");
+  State logged;
+  AddCatRule(&logged);
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&logged, changed.c_str()));
+  BuildLog log;
+  for (int i = 0; i < 300; ++i) {
+    Node* out = GetNode("out" + to_string(i));
+    fs_.Create(out->path(), "");
+    log.RecordCommand(logged.LookupNode(out->path())->in_edge(), 0, 0,
+                      fs_.now_);
+  }
+  scan_.set_build_log(&log);
+
+  vector<Node*> targets(1, GetNode("all"));
+  scan_.StatReachableNodes(targets);
+  string err;
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  // Only the command that changed makes its output dirty.
+  for (int i = 0; i < 300; ++i) {
+    Node* out = GetNode("out" + to_string(i));
+    EXPECT_EQ((i == 7), out->dirty());
+  }
+}
+
+TEST_F(GraphTest, LazyDepfiles) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule catdep\n"
+"  depfile = $out.d\n"
+"  command = cat $in > $out\n"
+"build missing: catdep in\n"
+"build present: catdep in\n"));
+  fs_.Create("in", "");
+  fs_.Create("header.h", "");
+  fs_.Create("missing.d", "missing: header.h\n");
+  fs_.Create("present.d", "present: header.h\n");
+  fs_.Tick();
+  fs_.Create("present", "");
+  scan_.set_lazy_depfiles(true);
+
+  string err;
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("missing"), &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(GetNode("missing")->dirty());
+  EXPECT_EQ(1u, GetNode("missing")->in_edge()->inputs_.size());
+
+  // Whether an existing output is dirty depends on its deps.
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("present"), &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(GetNode("present")->dirty());
+  EXPECT_EQ(2u, GetNode("present")->in_edge()->inputs_.size());
+
+  ASSERT_EQ(1u, fs_.files_read_.size());
+  EXPECT_EQ("present.d", fs_.files_read_[0]);
+}
+
+TEST_F(GraphTest, PrefetchDepfiles) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule catdep\n"
+"  depfile = $out.d\n"
+"  command = cat $in > $out\n"
+"build out: catdep in\n"));
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("GraphTest-PrefetchDepfiles");
+  RealDiskInterface disk_interface;
+  ASSERT_TRUE(disk_interface.WriteFile("out.d", "out: header.h\n"));
+  DependencyScan scan(&state_, NULL, NULL, &disk_interface, NULL);
+
+  vector<Node*> targets(1, GetNode("out"));
+  scan.StatReachableNodes(targets);
+  // The depfile was read ahead of the scan.
+  ASSERT_EQ(0, disk_interface.RemoveFile("out.d"));
+  string err;
+  EXPECT_TRUE(scan.RecomputeDirty(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, GetNode("out")->in_edge()->inputs_.size());
+  EXPECT_EQ("header.h", GetNode("out")->in_edge()->inputs_[1]->path());
+
+  temp_dir.Cleanup();
+}
+
+TEST_F(GraphTest, InvalidateDirty) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build mid: cat in1\n"
+"build other: cat in2\n"
+"build out: cat mid other\n"));
+  fs_.Create("in1", "");
+  fs_.Create("in2", "");
+  fs_.Tick();
+  fs_.Create("mid", "");
+  fs_.Create("other", "");
+  fs_.Tick();
+  fs_.Create("out", "");
+
+  string err;
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(GetNode("out")->dirty());
+
+  // Only what is downstream of the changed node is visited again.
+  fs_.Tick();
+  fs_.Create("in1", "");
+  Node* in1 = GetNode("in1");
+  in1->ResetState();
+  EXPECT_TRUE(in1->Stat(&fs_, &err));
+  scan_.InvalidateDirty(vector<Node*>(1, in1));
+  EXPECT_EQ(Edge::VisitNone, GetNode("mid")->in_edge()->mark_);
+  EXPECT_EQ(Edge::VisitNone, GetNode("out")->in_edge()->mark_);
+  EXPECT_EQ(Edge::VisitDone, GetNode("other")->in_edge()->mark_);
+
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(GetNode("mid")->dirty());
+  EXPECT_TRUE(GetNode("out")->dirty());
+  EXPECT_FALSE(GetNode("other")->dirty());
+
+  // A removed source makes its consumers dirty again.
+  fs_.RemoveFile("in2");
+  Node* in2 = GetNode("in2");
+  in2->ResetState();
+  EXPECT_TRUE(in2->Stat(&fs_, &err));
+  scan_.InvalidateDirty(vector<Node*>(1, in2));
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(GetNode("other")->dirty());
+}
+
 TEST_F(GraphTest, ModifiedImplicit) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out: cat in | implicit\n"));
@@ -229,6 +403,52 @@ TEST_F(GraphTest, VarInOutPathEscaping) {
 #endif
 }
 
+TEST_F(GraphTest, KeepEvaluatedBindings) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule link\n"
+"  command = link @$rspfile > $out\n"
+"  rspfile = $out.rsp\n"
+"  rspfile_content = $in\n"
+"  depfile = $out.d\n"
+"build out: link in1 in2\n"));
+
+  Edge* edge = GetNode("out")->in_edge();
+  string command = edge->EvaluateCommand(true);
+  EXPECT_EQ("link @out.rsp > out;rspfile=in1 in2", command);
+  EXPECT_EQ(BuildLog::LogEntry::HashCommand(command), edge->GetCommandHash());
+
+  edge->KeepEvaluatedBindings();
+  EXPECT_EQ("link @out.rsp > out", edge->EvaluateCommand());
+  EXPECT_EQ(command, edge->EvaluateCommand(true));
+  EXPECT_EQ("out.d", edge->GetUnescapedDepfile());
+  EXPECT_EQ("out.rsp", edge->GetUnescapedRspfile());
+  EXPECT_EQ("in1 in2", edge->GetRspfileContent());
+  edge->ReleaseEvaluatedBindings();
+  EXPECT_EQ(command, edge->EvaluateCommand(true));
+}
+
+TEST_F(GraphTest, EvaluateCommandSharesPathLists) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule link\n"
+"  command = link $in @$rspfile > $out\n"
+"  rspfile = $out.rsp\n"
+"  rspfile_content = $in_newline $in $rspfile\n"
+"build out$ 1: link in1 in$ 2\n"));
+
+  // Both bindings refer to $rspfile, which isn't taken for a cycle.
+  Edge* edge = GetNode("out 1")->in_edge();
+#ifdef _WIN32
+  string command = "link in1 \"in 2\" @\"out 1\".rsp > \"out 1\";"
+                   "rspfile=in1\n\"in 2\" in1 \"in 2\" \"out 1\".rsp";
+#else
+  string command = "link in1 'in 2' @'out 1'.rsp > 'out 1';"
+                   "rspfile=in1\n'in 2' in1 'in 2' 'out 1'.rsp";
+#endif
+  EXPECT_EQ(command, edge->EvaluateCommand(true));
+  edge->KeepEvaluatedBindings();
+  EXPECT_EQ(command, edge->EvaluateCommand(true));
+}
+
 // Regression test for https://github.com/ninja-build/ninja/issues/380
 TEST_F(GraphTest, DepfileWithCanonicalizablePath) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
@@ -609,6 +829,58 @@ TEST_F(GraphTest, DyndepLoadOutputWithMultipleRules2) {
   EXPECT_EQ("multiple rules generate out-twice.imp", err);
 }
 
+TEST_F(GraphTest, DyndepLoadFiles) {
+  AssertParse(&state_,
+"rule r\n"
+"  command = unused\n"
+"build out1: r in1 || dd1\n"
+"  dyndep = dd1\n"
+"build out2: r in2 || dd2\n"
+"  dyndep = dd2\n"
+"build out3: r in3 || dd3\n"
+"  dyndep = dd3\n"
+  );
+  fs_.Create("dd1",
+"ninja_dyndep_version = 1\n"
+"build out1 | out1imp: dyndep | in1imp\n"
+  );
+  fs_.Create("dd2",
+"ninja_dyndep_version = 1\n"
+"build out2 | in2new: dyndep\n"
+  );
+  fs_.Create("dd3",
+"ninja_dyndep_version = 1\n"
+"build out3: dyndep | in1imp\n"
+  );
+
+  vector<Node*> nodes;
+  nodes.push_back(GetNode("dd1"));
+  nodes.push_back(GetNode("dd2"));
+  nodes.push_back(GetNode("dd3"));
+  // A file failing to parse creates none of its nodes.
+  fs_.Create("dd2", "ninja_dyndep_version = 1\nbuild out2 | in2new: bad\n");
+  vector<DyndepFile> ddfs;
+  vector<string> errs;
+  EXPECT_FALSE(scan_.LoadDyndeps(nodes, &ddfs, &errs));
+  ASSERT_EQ(3u, errs.size());
+  EXPECT_EQ("", errs[0]);
+  EXPECT_EQ(0u, errs[1].find("dd2:2: expected build command name 'dyndep'"));
+  EXPECT_EQ("", errs[2]);
+  EXPECT_FALSE(GetNode("dd2")->dyndep_pending());
+  EXPECT_FALSE(state_.LookupNode("in2new"));
+
+  Edge* edge1 = GetNode("out1")->in_edge();
+  ASSERT_EQ(2u, edge1->outputs_.size());
+  EXPECT_EQ("out1imp", edge1->outputs_[1]->path());
+  ASSERT_EQ(3u, edge1->inputs_.size());
+  EXPECT_EQ("in1imp", edge1->inputs_[1]->path());
+  // Both files name the same new node.
+  Edge* edge3 = GetNode("out3")->in_edge();
+  ASSERT_EQ(3u, edge3->inputs_.size());
+  EXPECT_EQ(edge1->inputs_[1], edge3->inputs_[1]);
+  EXPECT_EQ(2u, GetNode("in1imp")->out_edges().size());
+}
+
 TEST_F(GraphTest, DyndepLoadMultiple) {
   AssertParse(&state_,
 "rule r\n"
@@ -665,6 +937,32 @@ TEST_F(GraphTest, DyndepLoadMultiple) {
   EXPECT_EQ(edge2, in2imp->out_edges()[0]);
 }
 
+TEST_F(GraphTest, DyndepRestatKeptBindingBool) {
+  AssertParse(&state_,
+"rule r\n"
+"  command = unused\n"
+"build out: r in || dd\n"
+"  dyndep = dd\n"
+  );
+  fs_.Create("dd",
+"ninja_dyndep_version = 1\n"
+"build out: dyndep\n"
+"  restat = 1\n"
+  );
+
+  EXPECT_EQ(kSymbolRestat, InternSymbol("restat"));
+  EXPECT_EQ(kSymbolStreamOutput, InternSymbol("stream_output"));
+
+  // The answer kept before the dyndep file is loaded is stale after.
+  Edge* edge = GetNode("out")->in_edge();
+  EXPECT_FALSE(edge->GetBindingBool(kSymbolRestat));
+  string err;
+  EXPECT_TRUE(scan_.LoadDyndeps(GetNode("dd"), &err));
+  EXPECT_EQ("", err);
+  EXPECT_TRUE(edge->GetBindingBool(kSymbolRestat));
+  EXPECT_TRUE(edge->GetBindingBool("restat"));
+}
+
 TEST_F(GraphTest, DyndepFileMissing) {
   AssertParse(&state_,
 "rule r\n"
@@ -858,3 +1156,53 @@ TEST_F(GraphTest, DyndepFileCircular) {
   EXPECT_EQ(1u, edge->implicit_deps_);
   EXPECT_EQ(1u, edge->order_only_deps_);
 }
+
+TEST_F(GraphTest, Dependents) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n"
+"  command = cc $in\n"
+"  deps = gcc\n"
+"build a.o: cc a.c\n"
+"build b.o: cc b.c\n"
+"build gen.h: cat gen.in\n"
+"build lib: cat a.o b.o\n"
+"build app: cat lib\n"
+"build other: cat gen.in\n"));
+
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("GraphTest-Dependents");
+  DepsLog deps_log;
+  string err;
+  ASSERT_TRUE(deps_log.OpenForWrite(".ninja_deps", &err));
+  vector<Node*> deps;
+  deps.push_back(GetNode("gen.h"));
+  deps_log.RecordDeps(GetNode("b.o"), 1, deps);
+  deps_log.RecordDeps(GetNode("other"), 1, deps);
+
+  DependentsIndex index(&deps_log);
+  vector<Node*> dependents;
+  index.Dependents(GetNode("gen.in"), &dependents);
+  ASSERT_EQ(5u, dependents.size());
+  EXPECT_EQ("app", dependents[0]->path());
+  EXPECT_EQ("b.o", dependents[1]->path());
+  EXPECT_EQ("gen.h", dependents[2]->path());
+  EXPECT_EQ("lib", dependents[3]->path());
+  EXPECT_EQ("other", dependents[4]->path());
+
+  // "other" only depends on gen.h through its dead deps log entry.
+  index.Dependents(GetNode("gen.h"), &dependents);
+  ASSERT_EQ(3u, dependents.size());
+  EXPECT_EQ("app", dependents[0]->path());
+  EXPECT_EQ("b.o", dependents[1]->path());
+  EXPECT_EQ("lib", dependents[2]->path());
+
+  index.Dependents(GetNode("a.c"), &dependents);
+  ASSERT_EQ(3u, dependents.size());
+  EXPECT_EQ("a.o", dependents[0]->path());
+
+  index.Dependents(GetNode("app"), &dependents);
+  EXPECT_TRUE(dependents.empty());
+
+  deps_log.Close();
+  temp_dir.Cleanup();
+}
@@ -19,30 +19,79 @@
 
 #include "dyndep.h"
 #include "graph.h"
+#include "util.h"
 
 using namespace std;
 
-void GraphViz::AddTarget(Node* node) {
-  if (visited_nodes_.find(node) != visited_nodes_.end())
-    return;
+namespace {
 
-  string pathstr = node->path();
-  replace(pathstr.begin(), pathstr.end(), '\\', '/');
-  printf("\"%p\" [label=\"%s\"]\n", node, pathstr.c_str());
-  visited_nodes_.insert(node);
+/// The output is written out once this much of it is buffered.
+const size_t kFlushBytes = 64 * 1024;
 
-  Edge* edge = node->in_edge();
+string Id(const void* p) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "\"%p\"", p);
+  return buf;
+}
 
-  if (!edge) {
-    // Leaf node.
-    // Draw as a rect?
-    return;
+/// Quote |text| as a dot string.
+string Quote(const string& text) {
+  string quoted = "\"";
+  for (string::const_iterator c = text.begin(); c != text.end(); ++c) {
+    if (*c == '"' || *c == '\\')
+      quoted.push_back('\\');
+    quoted.push_back(*c);
   }
+  quoted.push_back('"');
+  return quoted;
+}
+
+string DisplayPath(const Node* node) {
+  string path = node->path();
+  replace(path.begin(), path.end(), '\\', '/');
+  return path;
+}
+
+}  // namespace
+
+void GraphViz::Start() {
+  Write("digraph ninja {\n"
+        "rankdir=\"LR\"\n"
+        "node [fontsize=10, shape=box, height=0.25]\n"
+        "edge [fontsize=10]\n");
+}
 
-  if (visited_edges_.find(edge) != visited_edges_.end())
+void GraphViz::AddTarget(Node* node) {
+  Visit(node, 0);
+}
+
+void GraphViz::Visit(Node* node, int depth) {
+  if (!visited_nodes_.insert(node).second)
     return;
-  visited_edges_.insert(edge);
+  queue_.push_back(make_pair(node, depth));
+}
+
+void GraphViz::Finish() {
+  // Walk breadth first, so that with a depth limit a node reachable from
+  // several targets is expanded from the closest one.
+  while (!queue_.empty()) {
+    Node* node = queue_.front().first;
+    int depth = queue_.front().second;
+    queue_.pop_front();
+
+    Declare(node);
+    Edge* edge = node->in_edge();
+    if (!edge || depth == max_depth_)
+      continue;
+    if (!visited_edges_.insert(edge).second)
+      continue;
+    AddEdge(edge, depth + 1);
+  }
+  Write("}\n");
+  Flush();
+}
 
+void GraphViz::AddEdge(Edge* edge, int depth) {
   if (edge->dyndep_ && edge->dyndep_->dyndep_pending()) {
     std::string err;
     if (!dyndep_loader_.LoadDyndeps(edge->dyndep_, &err)) {
@@ -50,41 +99,100 @@ void GraphViz::AddTarget(Node* node) {
     }
   }
 
-  if (edge->inputs_.size() == 1 && edge->outputs_.size() == 1) {
-    // Can draw simply.
-    // Note extra space before label text -- this is cosmetic and feels
-    // like a graphviz bug.
-    printf("\"%p\" -> \"%p\" [label=\" %s\"]\n",
-           edge->inputs_[0], edge->outputs_[0], edge->rule_->name().c_str());
-  } else {
-    printf("\"%p\" [label=\"%s\", shape=ellipse]\n",
-           edge, edge->rule_->name().c_str());
+  vector<Node*> inputs;
+  if (dirty_only_) {
+    TimeStamp oldest_output = 0;
+    bool dirty = false;
     for (vector<Node*>::iterator out = edge->outputs_.begin();
          out != edge->outputs_.end(); ++out) {
-      printf("\"%p\" -> \"%p\"\n", edge, *out);
+      dirty = dirty || (*out)->dirty();
+      if (out == edge->outputs_.begin() || (*out)->mtime() < oldest_output)
+        oldest_output = (*out)->mtime();
     }
+    if (!dirty)
+      return;
     for (vector<Node*>::iterator in = edge->inputs_.begin();
          in != edge->inputs_.end(); ++in) {
+      if ((*in)->dirty() || !(*in)->exists() ||
+          (*in)->mtime() > oldest_output)
+        inputs.push_back(*in);
+    }
+  } else {
+    inputs = edge->inputs_;
+  }
+
+  if (collapse_ != kCollapseNone) {
+    for (vector<Node*>::iterator out = edge->outputs_.begin();
+         out != edge->outputs_.end(); ++out) {
+      string to = Declare(*out);
+      for (vector<Node*>::iterator in = inputs.begin(); in != inputs.end();
+           ++in) {
+        string from = Declare(*in);
+        if (from != to && group_arrows_.insert(make_pair(from, to)).second)
+          Write(from + " -> " + to + "\n");
+      }
+    }
+  } else if (edge->inputs_.size() == 1 && edge->outputs_.size() == 1) {
+    if (!inputs.empty()) {
+      // Can draw simply.
+      // Note extra space before label text -- this is cosmetic and feels
+      // like a graphviz bug.
+      Write(Id(edge->inputs_[0]) + " -> " + Id(edge->outputs_[0]) +
+            " [label=" + Quote(" " + edge->rule_->name()) + "]\n");
+    }
+  } else {
+    Write(Id(edge) + " [label=" + Quote(edge->rule_->name()) +
+          ", shape=ellipse]\n");
+    for (vector<Node*>::iterator out = edge->outputs_.begin();
+         out != edge->outputs_.end(); ++out) {
+      Write(Id(edge) + " -> " + Id(*out) + "\n");
+    }
+    for (size_t i = 0; i < edge->inputs_.size(); ++i) {
+      Node* in = edge->inputs_[i];
+      if (dirty_only_ && find(inputs.begin(), inputs.end(), in) == inputs.end())
+        continue;
       const char* order_only = "";
-      if (edge->is_order_only(in - edge->inputs_.begin()))
+      if (edge->is_order_only(i))
         order_only = " style=dotted";
-      printf("\"%p\" -> \"%p\" [arrowhead=none%s]\n", (*in), edge, order_only);
+      Write(Id(in) + " -> " + Id(edge) + " [arrowhead=none" + order_only +
+            "]\n");
     }
   }
 
-  for (vector<Node*>::iterator in = edge->inputs_.begin();
-       in != edge->inputs_.end(); ++in) {
-    AddTarget(*in);
+  for (vector<Node*>::iterator in = inputs.begin(); in != inputs.end(); ++in)
+    Visit(*in, depth);
+}
+
+string GraphViz::Declare(Node* node) {
+  if (collapse_ == kCollapseNone) {
+    // Nodes are only declared once they are popped off the queue, which
+    // happens once per node.
+    string id = Id(node);
+    Write(id + " [label=" + Quote(DisplayPath(node)) + "]\n");
+    return id;
+  }
+
+  string group;
+  if (collapse_ == kCollapseRule) {
+    group = node->in_edge() ? node->in_edge()->rule_->name() : "(source)";
+  } else {
+    group = DisplayPath(node);
+    string::size_type slash = group.rfind('/');
+    group = slash == string::npos ? "." : group.substr(0, slash);
   }
+  string id = Quote(group);
+  if (groups_.insert(group).second)
+    Write(id + "\n");
+  return id;
 }
 
-void GraphViz::Start() {
-  printf("digraph ninja {\n");
-  printf("rankdir=\"LR\"\n");
-  printf("node [fontsize=10, shape=box, height=0.25]\n");
-  printf("edge [fontsize=10]\n");
+void GraphViz::Write(const string& text) {
+  buffer_ += text;
+  if (buffer_.size() >= kFlushBytes)
+    Flush();
 }
 
-void GraphViz::Finish() {
-  printf("}\n");
+void GraphViz::Flush() {
+  fwrite(buffer_.data(), 1, buffer_.size(), out_);
+  buffer_.clear();
 }
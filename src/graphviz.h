@@ -15,7 +15,13 @@
 #ifndef NINJA_GRAPHVIZ_H_
 #define NINJA_GRAPHVIZ_H_
 
+#include <stdio.h>
+
+#include <deque>
 #include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
 
 #include "dyndep.h"
 #include "graph.h"
@@ -25,17 +31,59 @@ struct Node;
 struct Edge;
 struct State;
 
-/// Runs the process of creating GraphViz .dot file output.
+/// Writes the graph of the targets added to it in the dot format of
+/// graphviz.  The graph is walked breadth first from the targets once
+/// Finish() is called, and written out as it goes.
 struct GraphViz {
   GraphViz(State* state, DiskInterface* disk_interface)
-      : dyndep_loader_(state, disk_interface) {}
+      : max_depth_(-1), collapse_(kCollapseNone), dirty_only_(false),
+        out_(stdout), dyndep_loader_(state, disk_interface) {}
+
+  /// How nodes are merged, to keep large graphs readable.
+  enum Collapse {
+    kCollapseNone,
+    /// One node per rule building the files, and one for the sources.
+    kCollapseRule,
+    /// One node per directory.
+    kCollapseDir,
+  };
+
   void Start();
   void AddTarget(Node* node);
   void Finish();
 
+  /// Don't go further than this many edges from the targets, if not -1.
+  int max_depth_;
+  Collapse collapse_;
+  /// Only draw the edges whose outputs are dirty, and of their inputs
+  /// those that are dirty or newer than an output, so that the graph shows
+  /// what the next build runs and why.  The targets must have been scanned
+  /// with DependencyScan::RecomputeDirty().
+  bool dirty_only_;
+  /// Where to write.
+  FILE* out_;
+
+ private:
+  /// Draw |edge| and queue its inputs at |depth|.
+  void AddEdge(Edge* edge, int depth);
+  /// Queue |node| to be drawn at |depth|, unless it was already.
+  void Visit(Node* node, int depth);
+  /// Declare the graphviz node of |node|, or in a collapsed graph, of its
+  /// group, the first time.  Returns its identifier.
+  std::string Declare(Node* node);
+  /// Append to the output, writing it out in large chunks.
+  void Write(const std::string& text);
+  void Flush();
+
   DyndepLoader dyndep_loader_;
-  std::set<Node*> visited_nodes_;
-  EdgeSet visited_edges_;
+  std::deque<std::pair<Node*, int> > queue_;
+  std::unordered_set<Node*> visited_nodes_;
+  std::unordered_set<Edge*> visited_edges_;
+  /// The groups of a collapsed graph already declared, and the arrows
+  /// already drawn between them.
+  std::unordered_set<std::string> groups_;
+  std::set<std::pair<std::string, std::string> > group_arrows_;
+  std::string buffer_;
 };
 
 #endif  // NINJA_GRAPHVIZ_H_
@@ -0,0 +1,145 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "graphviz.h"
+
+#include <stdio.h>
+
+#include "graph.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+const char kHeader[] =
+    "digraph ninja {\n"
+    "rankdir=\"LR\"\n"
+    "node [fontsize=10, shape=box, height=0.25]\n"
+    "edge [fontsize=10]\n";
+
+struct GraphVizTest : public StateTestWithBuiltinRules {
+  GraphVizTest() : graph_(&state_, &fs_) {}
+
+  /// Draw |target|, returning the output without its header.
+  string Draw(const char* target) {
+    FILE* out = tmpfile();
+    graph_.out_ = out;
+    graph_.Start();
+    graph_.AddTarget(state_.LookupNode(target));
+    graph_.Finish();
+
+    string text;
+    rewind(out);
+    char buf[256];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), out)) > 0)
+      text.append(buf, len);
+    fclose(out);
+    EXPECT_EQ(0u, text.find(kHeader));
+    return text.substr(sizeof(kHeader) - 1);
+  }
+
+  /// The declaration of the node of |path|.
+  string Declared(const char* path) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "\"%p\" [label=\"%s\"]\n", GetNode(path),
+             path);
+    return buf;
+  }
+
+  VirtualFileSystem fs_;
+  GraphViz graph_;
+};
+
+TEST_F(GraphVizTest, Full) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n"));
+  string text = Draw("out");
+  EXPECT_EQ(0u, text.find(Declared("out")));
+  EXPECT_NE(string::npos, text.find(Declared("mid")));
+  EXPECT_NE(string::npos, text.find(Declared("in")));
+  EXPECT_NE(string::npos, text.find("[label=\" cat\"]"));
+}
+
+TEST_F(GraphVizTest, MaxDepth) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n"));
+  graph_.max_depth_ = 1;
+  string text = Draw("out");
+  // The nodes at the limit are drawn, but not their inputs.
+  EXPECT_NE(string::npos, text.find(Declared("mid")));
+  EXPECT_EQ(string::npos, text.find(Declared("in")));
+}
+
+TEST_F(GraphVizTest, CollapseRule) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n"
+"  command = cc $in\n"
+"rule link\n"
+"  command = link $in\n"
+"build out: link a.o b.o\n"
+"build a.o: cc a.c\n"
+"build b.o: cc b.c\n"));
+  graph_.collapse_ = GraphViz::kCollapseRule;
+  EXPECT_EQ("\"link\"\n"
+            "\"cc\"\n"
+            "\"cc\" -> \"link\"\n"
+            "\"(source)\"\n"
+            "\"(source)\" -> \"cc\"\n"
+            "}\n",
+            Draw("out"));
+}
+
+TEST_F(GraphVizTest, CollapseDir) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out/lib: cat out/a.o src/\"q\".c\n"
+"build out/a.o: cat src/a.c\n"));
+  graph_.collapse_ = GraphViz::kCollapseDir;
+  EXPECT_EQ("\"out\"\n"
+            "\"src\"\n"
+            "\"src\" -> \"out\"\n"
+            "}\n",
+            Draw("out/lib"));
+}
+
+TEST_F(GraphVizTest, DirtyOnly) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat mid other\n"
+"build mid: cat in\n"
+"build other: cat other.in\n"));
+  fs_.Create("in", "");
+  fs_.Create("other.in", "");
+  fs_.Create("other", "");
+  fs_.Tick();
+  fs_.Create("mid", "");
+  fs_.Create("out", "");
+  fs_.Tick();
+  fs_.Create("in", "");
+
+  DependencyScan scan(&state_, NULL, NULL, &fs_, NULL);
+  string err;
+  ASSERT_TRUE(scan.RecomputeDirty(GetNode("out"), &err));
+  graph_.dirty_only_ = true;
+  string text = Draw("out");
+  EXPECT_NE(string::npos, text.find(Declared("mid")));
+  EXPECT_NE(string::npos, text.find(Declared("in")));
+  // Up to date, and older than out.
+  EXPECT_EQ(string::npos, text.find(Declared("other")));
+  EXPECT_EQ(string::npos, text.find(Declared("other.in")));
+}
+
+}  // namespace
@@ -15,10 +15,14 @@
 #include "build_log.h"
 
 #include <algorithm>
+#include <unordered_map>
 
 #include <stdlib.h>
 #include <time.h>
 
+#include "hash_map.h"
+#include "metrics.h"
+
 using namespace std;
 
 int random(int low, int high) {
@@ -33,7 +37,45 @@ void RandomCommand(char** s) {
   (*s)[len] = '\0';
 }
 
+/// Time inserting |paths| into a |Map| and looking each up a few times.
+template<typename Map>
+void TimeMap(const char* name, const vector<string>& paths) {
+  int64_t start = GetTimeMillis();
+  Map map;
+  for (size_t i = 0; i < paths.size(); ++i)
+    map.insert(make_pair(StringPiece(paths[i]), (int)i));
+  int64_t inserted = GetTimeMillis();
+
+  // Look the paths up in an order unrelated to the insertion order.
+  size_t found = 0;
+  for (int rep = 0; rep < 5; ++rep) {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      size_t j = (i * 7919 + rep) % paths.size();
+      found += map.find(StringPiece(paths[j])) != map.end();
+    }
+  }
+  int64_t end = GetTimeMillis();
+  printf("%-20s insert %dms  lookup %dms  (%d found, %d buckets)\n", name,
+         (int)(inserted - start), (int)(end - inserted), (int)found,
+         (int)map.bucket_count());
+}
+
+/// Compare the maps that could hold State::paths_ on a million paths.
+void BenchmarkMaps() {
+  vector<string> paths;
+  for (int i = 0; i < 1000 * 1000; ++i) {
+    char path[100];
+    snprintf(path, sizeof(path), "obj/third_party/module_%d/src/file_%d.o",
+             i / 1000, i);
+    paths.push_back(path);
+  }
+  TimeMap<std::unordered_map<StringPiece, int> >("std::unordered_map", paths);
+  TimeMap<StringPieceHashMap<int> >("StringPieceHashMap", paths);
+}
+
 int main() {
+  BenchmarkMaps();
+
   const int N = 20 * 1000 * 1000;
 
   // Leak these, else 10% of the runtime is spent destroying strings.
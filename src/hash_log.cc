@@ -0,0 +1,383 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hash_log.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "build_dir_lock.h"
+#include "disk_interface.h"
+#include "graph.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "parallel.h"
+#include "trace.h"
+
+using namespace std;
+
+namespace {
+
+const char kFileSignature[] = "# ninja hashes v1\n";
+const size_t kFileSignatureSize = sizeof(kFileSignature) - 1;
+
+/// The fixed part of a record, followed by path_size bytes of path.
+struct HashRecord {
+  uint32_t path_size;
+  uint32_t flags;
+  int64_t mtime;
+  uint64_t content_digest;
+  uint64_t inputs_digest;
+};
+
+enum { kHasInputsDigest = 1 };
+
+// Rewrite the log once it has this many records, and three times as many
+// as paths.
+const int kMinCompactionEntryCount = 1000;
+const int kCompactionRatio = 3;
+
+// Hashing a handful of files isn't worth starting threads.
+const size_t kMinParallelDigests = 16;
+
+/// Digest the |contents| of a file.
+uint64_t DigestContents(const string& contents) {
+  return Hash64(contents.data(), contents.size());
+}
+
+}  // anonymous namespace
+
+HashLog::HashLog()
+    : file_(NULL), needs_recompaction_(false), lock_(NULL) {}
+
+HashLog::~HashLog() {
+  Close();
+  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i)
+    delete i->second;
+}
+
+LoadStatus HashLog::Load(const string& path, string* err) {
+  METRIC_RECORD(".ninja_hashes load");
+  TRACE_RECORD(".ninja_hashes load");
+  MappedFile map;
+  int ret = map.Open(path, err);
+  if (ret == -ENOENT) {
+    err->clear();
+    return LOAD_NOT_FOUND;
+  }
+  if (ret < 0)
+    return LOAD_ERROR;
+
+  const char* data = map.data();
+  size_t size = map.size();
+  if (size < kFileSignatureSize ||
+      memcmp(data, kFileSignature, kFileSignatureSize) != 0) {
+    *err = "hash log is corrupt or from a newer version; starting over";
+    map.Close();
+    unlink(path.c_str());
+    // Don't report this as a failure.  Without digests, edges are checked
+    // by their mtimes alone.
+    return LOAD_SUCCESS;
+  }
+
+  int unique_entry_count = 0;
+  int total_entry_count = 0;
+  size_t offset = kFileSignatureSize;
+  while (offset < size) {
+    HashRecord record;
+    if (size - offset < sizeof(record)) {
+      needs_recompaction_ = true;
+      break;
+    }
+    memcpy(&record, data + offset, sizeof(record));
+    offset += sizeof(record);
+    if (size - offset < record.path_size) {
+      // An interrupted write left an incomplete record behind.  Appending
+      // after it would make the following records unreadable, so rewrite
+      // the log before writing to it again.
+      needs_recompaction_ = true;
+      break;
+    }
+    StringPiece record_path(data + offset, record.path_size);
+    offset += record.path_size;
+
+    Entry* entry;
+    Entries::iterator i = entries_.find(record_path);
+    if (i != entries_.end()) {
+      entry = i->second;
+    } else {
+      entry = new Entry;
+      entry->path = record_path.AsString();
+      entries_.insert(Entries::value_type(entry->path, entry));
+      ++unique_entry_count;
+    }
+    ++total_entry_count;
+    entry->mtime = record.mtime;
+    entry->content_digest = record.content_digest;
+    entry->inputs_digest = record.inputs_digest;
+    entry->has_inputs_digest = (record.flags & kHasInputsDigest) != 0;
+  }
+
+  if (total_entry_count > kMinCompactionEntryCount &&
+      total_entry_count > unique_entry_count * kCompactionRatio) {
+    needs_recompaction_ = true;
+  }
+  return LOAD_SUCCESS;
+}
+
+bool HashLog::OpenForWrite(const string& path, string* err) {
+  // Other processes append to a shared log meanwhile, unless this one has
+  // the build directory to itself for now.
+  if (needs_recompaction_ && (!lock_ || lock_->exclusive())) {
+    if (!Recompact(path, err))
+      return false;
+  }
+
+  assert(!file_);
+  file_path_ = path;  // we don't actually open the file right now, but will
+                      // do so on the first write attempt
+  return true;
+}
+
+void HashLog::Close() {
+  WriteDirtyEntries();
+  if (file_)
+    fclose(file_);
+  file_ = NULL;
+}
+
+bool HashLog::Recompact(const string& path, string* err) {
+  METRIC_RECORD(".ninja_hashes recompact");
+  TRACE_RECORD(".ninja_hashes recompact");
+
+  Close();
+  string temp_path = path + ".recompact";
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  if (fwrite(kFileSignature, kFileSignatureSize, 1, f) < 1) {
+    *err = strerror(errno);
+    fclose(f);
+    return false;
+  }
+  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i) {
+    if (!WriteEntry(f, *i->second)) {
+      *err = strerror(errno);
+      fclose(f);
+      return false;
+    }
+  }
+
+  fclose(f);
+  if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  if (rename(temp_path.c_str(), path.c_str()) < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  // Everything is on disk now.
+  for (vector<Entry*>::iterator i = dirty_.begin(); i != dirty_.end(); ++i)
+    (*i)->dirty = false;
+  dirty_.clear();
+  needs_recompaction_ = false;
+  return true;
+}
+
+uint64_t HashLog::ContentDigest(const string& path, TimeStamp mtime,
+                                DiskInterface* disk_interface) {
+  Entry* entry = GetEntry(path);
+  if (entry->mtime == mtime)
+    return entry->content_digest;
+
+  string contents, err;
+  uint64_t digest = (uint64_t)mtime;
+  if (mtime > 0 &&
+      disk_interface->ReadFile(path, &contents, &err) == DiskInterface::Okay)
+    digest = DigestContents(contents);
+  entry->mtime = mtime;
+  entry->content_digest = digest;
+  if (!entry->dirty) {
+    entry->dirty = true;
+    dirty_.push_back(entry);
+  }
+  return digest;
+}
+
+void HashLog::PrecomputeDigests(const vector<Node*>& nodes,
+                                DiskInterface* disk_interface) {
+  TRACE_RECORD("PrecomputeDigests");
+  // Hashing mostly waits on reading the files, so use more threads than
+  // cores, like stat'ing does.
+  const int kDigestThreads = 16;
+
+  if (!disk_interface->IsReadThreadSafe())
+    return;
+
+  // The threads only read and hash the files; the entries are updated
+  // afterwards, on this thread.
+  vector<Node*> to_read;
+  for (vector<Node*>::const_iterator i = nodes.begin(); i != nodes.end();
+       ++i) {
+    if ((*i)->mtime() <= 0)
+      continue;
+    Entries::const_iterator e = entries_.find((*i)->path());
+    if (e == entries_.end() || e->second->mtime != (*i)->mtime())
+      to_read.push_back(*i);
+  }
+  if (to_read.size() < kMinParallelDigests)
+    return;
+
+  vector<uint64_t> digests(to_read.size());
+  vector<char> read(to_read.size());
+  ParallelFor(to_read.size(), kDigestThreads, [&](size_t i) {
+    string contents, err;
+    if (disk_interface->ReadFile(to_read[i]->path(), &contents, &err) ==
+        DiskInterface::Okay) {
+      digests[i] = DigestContents(contents);
+      read[i] = true;
+    }
+  });
+
+  for (size_t i = 0; i < to_read.size(); ++i) {
+    if (!read[i])
+      continue;  // Left to ContentDigest().
+    Entry* entry = GetEntry(to_read[i]->path());
+    entry->mtime = to_read[i]->mtime();
+    entry->content_digest = digests[i];
+    if (!entry->dirty) {
+      entry->dirty = true;
+      dirty_.push_back(entry);
+    }
+  }
+}
+
+bool HashLog::InputsDigest(const Edge* edge, DiskInterface* disk_interface,
+                           bool restat, uint64_t* digest, string* err) {
+  vector<uint64_t> parts;
+  size_t count = edge->inputs_.size() - edge->order_only_deps_;
+  parts.reserve(count * 2);
+  for (size_t i = 0; i < count; ++i) {
+    const Node* input = edge->inputs_[i];
+    TimeStamp mtime = input->mtime();
+    if (restat) {
+      mtime = disk_interface->Stat(input->path(), err);
+      if (mtime == -1)
+        return false;
+    }
+    parts.push_back(Hash64(input->path().data(), input->path().size()));
+    parts.push_back(ContentDigest(input->path(), mtime, disk_interface));
+  }
+  *digest = Hash64(parts.data(), parts.size() * sizeof(parts[0]));
+  return true;
+}
+
+bool HashLog::InputsMatch(const Node* output, uint64_t digest) const {
+  Entries::const_iterator i = entries_.find(output->path());
+  return i != entries_.end() && i->second->has_inputs_digest &&
+         i->second->inputs_digest == digest;
+}
+
+bool HashLog::RecordInputsDigest(const Edge* edge, uint64_t digest) {
+  for (vector<Node*>::const_iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o) {
+    Entry* entry = GetEntry((*o)->path());
+    entry->inputs_digest = digest;
+    entry->has_inputs_digest = true;
+    if (!entry->dirty) {
+      entry->dirty = true;
+      dirty_.push_back(entry);
+    }
+  }
+  return WriteDirtyEntries();
+}
+
+HashLog::Entry* HashLog::GetEntry(StringPiece path) {
+  Entries::iterator i = entries_.find(path);
+  if (i != entries_.end())
+    return i->second;
+  Entry* entry = new Entry;
+  entry->path = path.AsString();
+  entries_.insert(Entries::value_type(entry->path, entry));
+  return entry;
+}
+
+bool HashLog::WriteDirtyEntries() {
+  if (dirty_.empty())
+    return true;
+  // The records of the processes sharing the log mustn't interleave.
+  if (lock_ && !lock_->Lock(BuildDirLock::kHashLog))
+    return false;
+  bool ok = OpenForWriteIfNeeded();
+  // Nothing is written without OpenForWrite(), as in -n.
+  if (ok && file_) {
+    for (vector<Entry*>::iterator i = dirty_.begin(); i != dirty_.end();
+         ++i) {
+      if (!(ok = WriteEntry(file_, **i)))
+        break;
+      (*i)->dirty = false;
+    }
+    if (ok) {
+      dirty_.clear();
+      ok = fflush(file_) == 0;
+    }
+  }
+  if (lock_)
+    lock_->Unlock(BuildDirLock::kHashLog);
+  return ok;
+}
+
+bool HashLog::WriteEntry(FILE* f, const Entry& entry) {
+  HashRecord record;
+  memset(&record, 0, sizeof(record));
+  record.path_size = (uint32_t)entry.path.size();
+  record.flags = entry.has_inputs_digest ? kHasInputsDigest : 0;
+  record.mtime = entry.mtime;
+  record.content_digest = entry.content_digest;
+  record.inputs_digest = entry.inputs_digest;
+  return fwrite(&record, sizeof(record), 1, f) == 1 &&
+         fwrite(entry.path.data(), entry.path.size(), 1, f) == 1;
+}
+
+bool HashLog::OpenForWriteIfNeeded() {
+  if (file_ || file_path_.empty())
+    return true;
+  file_ = fopen(file_path_.c_str(), "ab");
+  if (!file_)
+    return false;
+  if (setvbuf(file_, NULL, _IOFBF, BUFSIZ) != 0)
+    return false;
+  SetCloseOnExec(fileno(file_));
+
+  // Opening a file in append mode doesn't set the file pointer to the file's
+  // end on Windows. Do that explicitly.
+  fseek(file_, 0, SEEK_END);
+
+  if (ftell(file_) == 0) {
+    if (fwrite(kFileSignature, kFileSignatureSize, 1, file_) < 1 ||
+        fflush(file_) != 0)
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,123 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_HASH_LOG_H_
+#define NINJA_HASH_LOG_H_
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "hash_map.h"
+#include "load_status.h"
+#include "timestamp.h"
+#include "util.h"  // uint64_t
+
+struct BuildDirLock;
+struct DiskInterface;
+struct Edge;
+struct Node;
+struct StringPiece;
+
+/// HashLog persists content digests for edges with the "hash_inputs"
+/// binding, in .ninja_hashes next to the build log.  Such an edge is not
+/// rebuilt for inputs that are only newer than its outputs if their
+/// contents match those it last ran with.
+///
+/// For every path it keeps the digest of the file's contents along with
+/// the mtime it had then, so that a file is only read again once its mtime
+/// changes, and, for outputs of such edges, the digest of their inputs'
+/// contents when the edge last ran.
+///
+/// The log is a header line followed by fixed-size records, each followed
+/// by its path; loading keeps the last record of each path.
+struct HashLog {
+  HashLog();
+  ~HashLog();
+
+  /// Share the log with the other processes holding |lock|, which append
+  /// to it in turn.  It's then only rewritten while they're kept out.
+  void set_build_dir_lock(BuildDirLock* lock) { lock_ = lock; }
+
+  LoadStatus Load(const std::string& path, std::string* err);
+  bool OpenForWrite(const std::string& path, std::string* err);
+  void Close();
+
+  /// Rewrite the log with only the latest record of each path.
+  bool Recompact(const std::string& path, std::string* err);
+
+  /// The digest of the contents of |path|, which has |mtime|; read from
+  /// the disk unless the log has one for this mtime.  A missing file, or
+  /// one that can't be read (like a directory), has its mtime as digest.
+  uint64_t ContentDigest(const std::string& path, TimeStamp mtime,
+                         DiskInterface* disk_interface);
+
+  /// Compute ContentDigest() of the given (stat'ed) nodes up front, on
+  /// several threads.
+  void PrecomputeDigests(const std::vector<Node*>& nodes,
+                         DiskInterface* disk_interface);
+
+  /// The combined digest of the paths and contents of the regular (non
+  /// order-only) inputs of |edge|.  Uses the mtimes of the input nodes,
+  /// unless |restat| is set to stat them again; returns false if that
+  /// fails.
+  bool InputsDigest(const Edge* edge, DiskInterface* disk_interface,
+                    bool restat, uint64_t* digest, std::string* err);
+
+  /// Return whether |output| was last built from inputs with |digest|.
+  bool InputsMatch(const Node* output, uint64_t digest) const;
+
+  /// Record that the outputs of |edge| were built from inputs with
+  /// |digest|, along with the content digests computed since.
+  bool RecordInputsDigest(const Edge* edge, uint64_t digest);
+
+  struct Entry {
+    Entry() : mtime(-1), content_digest(0), inputs_digest(0),
+              has_inputs_digest(false), dirty(false) {}
+    std::string path;
+    /// The mtime the file had when |content_digest| was computed, or -1.
+    TimeStamp mtime;
+    uint64_t content_digest;
+    /// The digest of the inputs of the edge that last wrote this output.
+    uint64_t inputs_digest;
+    bool has_inputs_digest;
+    /// Whether the entry changed since it was last written to the log.
+    bool dirty;
+  };
+  typedef ExternalStringHashMap<Entry*>::Type Entries;
+  const Entries& entries() const { return entries_; }
+
+ private:
+  Entry* GetEntry(StringPiece path);
+  /// Append the records of the dirty entries to the log.
+  bool WriteDirtyEntries();
+  bool WriteEntry(FILE* f, const Entry& entry);
+  bool OpenForWriteIfNeeded();
+
+  Entries entries_;
+  /// Dirty entries not yet written, because the log isn't open.
+  std::vector<Entry*> dirty_;
+  FILE* file_;
+  std::string file_path_;
+  bool needs_recompaction_;
+  /// If set, the log is shared with other processes.
+  BuildDirLock* lock_;
+
+  // Unimplemented copy ctor and operator= ensure we don't close twice.
+  HashLog(const HashLog& other);       // DO NOT IMPLEMENT
+  void operator=(const HashLog& other); // DO NOT IMPLEMENT
+};
+
+#endif  // NINJA_HASH_LOG_H_
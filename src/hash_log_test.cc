@@ -0,0 +1,182 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hash_log.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "graph.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+const char kTestFilename[] = "HashLogTest-tempfile";
+
+struct HashLogTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    // In case a crashing test left a stale file behind.
+    unlink(kTestFilename);
+  }
+  virtual void TearDown() {
+    unlink(kTestFilename);
+  }
+
+  /// Stat the inputs of |edge| and digest them.
+  uint64_t Digest(HashLog* log, Edge* edge) {
+    uint64_t digest = 0;
+    string err;
+    EXPECT_TRUE(log->InputsDigest(edge, &fs_, true, &digest, &err));
+    EXPECT_EQ("", err);
+    return digest;
+  }
+
+  VirtualFileSystem fs_;
+};
+
+TEST_F(HashLogTest, ContentDigest) {
+  fs_.Create("a", "contents");
+  fs_.Create("b", "contents");
+  fs_.Create("c", "other contents");
+
+  HashLog log;
+  EXPECT_EQ(log.ContentDigest("a", 1, &fs_), log.ContentDigest("b", 1, &fs_));
+  EXPECT_NE(log.ContentDigest("a", 1, &fs_), log.ContentDigest("c", 1, &fs_));
+  // Files are only read again once their mtime changes.
+  EXPECT_EQ(3u, fs_.files_read_.size());
+  log.ContentDigest("a", 2, &fs_);
+  EXPECT_EQ(4u, fs_.files_read_.size());
+
+  // Missing files are told apart by their mtime only.
+  EXPECT_EQ(0u, log.ContentDigest("missing", 0, &fs_));
+  EXPECT_EQ(4u, fs_.files_read_.size());
+}
+
+TEST_F(HashLogTest, InputsDigest) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat a b | c || d\n"));
+  Edge* edge = GetNode("out")->in_edge();
+  fs_.Create("a", "a");
+  fs_.Create("b", "b");
+  fs_.Create("c", "c");
+  fs_.Create("d", "d");
+
+  HashLog log;
+  uint64_t digest = Digest(&log, edge);
+  fs_.Tick();
+  fs_.Create("a", "a");
+  EXPECT_EQ(digest, Digest(&log, edge));
+
+  // Order-only inputs don't count.
+  fs_.Create("d", "changed");
+  EXPECT_EQ(digest, Digest(&log, edge));
+
+  // Implicit ones do.
+  fs_.Create("c", "changed");
+  EXPECT_NE(digest, Digest(&log, edge));
+
+  // So does swapping contents between inputs.
+  fs_.Create("c", "c");
+  fs_.Create("a", "b");
+  fs_.Create("b", "a");
+  EXPECT_NE(digest, Digest(&log, edge));
+}
+
+TEST_F(HashLogTest, WriteRead) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out1 out2: cat in1\n"
+"build out3: cat in2\n"));
+  Edge* edge1 = GetNode("out1")->in_edge();
+  Edge* edge2 = GetNode("out3")->in_edge();
+  fs_.Create("in1", "1");
+  fs_.Create("in2", "2");
+
+  string err;
+  uint64_t digest1, digest2;
+  {
+    HashLog log;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    digest1 = Digest(&log, edge1);
+    digest2 = Digest(&log, edge2);
+    EXPECT_TRUE(log.RecordInputsDigest(edge1, digest1));
+    EXPECT_FALSE(log.InputsMatch(GetNode("out3"), digest2));
+    EXPECT_TRUE(log.RecordInputsDigest(edge2, digest1));
+    EXPECT_TRUE(log.RecordInputsDigest(edge2, digest2));
+    log.Close();
+  }
+
+  HashLog log;
+  EXPECT_EQ(LOAD_SUCCESS, log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(log.InputsMatch(GetNode("out1"), digest1));
+  EXPECT_TRUE(log.InputsMatch(GetNode("out2"), digest1));
+  EXPECT_FALSE(log.InputsMatch(GetNode("out3"), digest1));
+  EXPECT_TRUE(log.InputsMatch(GetNode("out3"), digest2));
+  EXPECT_FALSE(log.InputsMatch(GetNode("in1"), digest1));
+
+  // The content digests came along, so nothing is read again.
+  fs_.files_read_.clear();
+  EXPECT_EQ(digest1, Digest(&log, edge1));
+  EXPECT_EQ(0u, fs_.files_read_.size());
+}
+
+TEST_F(HashLogTest, Truncated) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat in\n"));
+  Edge* edge = GetNode("out")->in_edge();
+  fs_.Create("in", "contents");
+
+  string err;
+  uint64_t digest;
+  {
+    HashLog log;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    digest = Digest(&log, edge);
+    EXPECT_TRUE(log.RecordInputsDigest(edge, digest));
+    log.Close();
+  }
+
+  // Cut the last record short.
+  RealDiskInterface disk_interface;
+  string contents;
+  ASSERT_EQ(DiskInterface::Okay,
+            disk_interface.ReadFile(kTestFilename, &contents, &err));
+  contents.resize(contents.size() - 1);
+  ASSERT_TRUE(disk_interface.WriteFile(kTestFilename, contents));
+
+  {
+    HashLog log;
+    EXPECT_EQ(LOAD_SUCCESS, log.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    EXPECT_FALSE(log.InputsMatch(GetNode("out"), digest));
+    // The log is rewritten before it is appended to.
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(log.RecordInputsDigest(edge, digest));
+    log.Close();
+  }
+
+  HashLog log;
+  EXPECT_EQ(LOAD_SUCCESS, log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(log.InputsMatch(GetNode("out"), digest));
+}
+
+}  // anonymous namespace
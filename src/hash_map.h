@@ -17,9 +17,20 @@
 
 #include <algorithm>
 #include <string.h>
+#include <utility>
+#include <vector>
 #include "string_piece.h"
 #include "util.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NINJA_HASH_MAP_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 // MurmurHash2, by Austin Appleby
 static inline
 unsigned int MurmurHash2(const void* key, size_t len) {
@@ -105,19 +116,257 @@ struct hash<StringPiece> {
 }
 #endif
 
+/// A hash map keyed by StringPieces whose strings are owned externally,
+/// laid out like a Swiss table: slots are stored in one array, and a
+/// parallel array holds a control byte per slot with 7 bits of the hash of
+/// its key, so that a lookup checks the slots of a group of 16 at once and
+/// mostly compares a single key.  Supports the parts of the std::
+/// unordered_map interface ninja uses; iterators are invalidated by
+/// insertions.
+template<typename V>
+struct StringPieceHashMap {
+  typedef std::pair<StringPiece, V> value_type;
+
+  template<typename Map, typename Value>
+  struct Iterator {
+    Iterator(Map* map, size_t index) : map_(map), index_(index) { Skip(); }
+    /// Allow converting iterators to const_iterators.
+    template<typename OtherMap, typename OtherValue>
+    Iterator(const Iterator<OtherMap, OtherValue>& other)
+        : map_(other.map_), index_(other.index_) {}
+
+    Value& operator*() const { return map_->slots_[index_]; }
+    Value* operator->() const { return &map_->slots_[index_]; }
+    Iterator& operator++() {
+      ++index_;
+      Skip();
+      return *this;
+    }
+    bool operator==(const Iterator& other) const {
+      return index_ == other.index_;
+    }
+    bool operator!=(const Iterator& other) const {
+      return index_ != other.index_;
+    }
+
+    Map* map_;
+    size_t index_;
+
+   private:
+    /// Move to the next full slot, if not at one.
+    void Skip() {
+      while (index_ < map_->slots_.size() && map_->ctrl_[index_] < 0)
+        ++index_;
+    }
+  };
+  typedef Iterator<StringPieceHashMap, value_type> iterator;
+  typedef Iterator<const StringPieceHashMap, const value_type> const_iterator;
+
+  StringPieceHashMap() : size_(0), deleted_(0) {}
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, slots_.size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, slots_.size()); }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  /// The number of slots.
+  size_t bucket_count() const { return slots_.size(); }
+
+  /// The hash of |key| the map uses.  The find() and insert() taking it
+  /// skip hashing keys whose hash is known already.
+  static size_t Hash(StringPiece key) {
+    return MurmurHash2(key.str_, key.len_);
+  }
+
+  iterator find(StringPiece key) {
+    return find(key, Hash(key));
+  }
+  const_iterator find(StringPiece key) const {
+    return find(key, Hash(key));
+  }
+  iterator find(StringPiece key, size_t hash) {
+    size_t i = FindIndex(key, hash);
+    return i == kNotFound ? end() : iterator(this, i);
+  }
+  const_iterator find(StringPiece key, size_t hash) const {
+    size_t i = FindIndex(key, hash);
+    return i == kNotFound ? end() : const_iterator(this, i);
+  }
+  size_t count(StringPiece key) const {
+    return FindIndex(key, Hash(key)) == kNotFound ? 0 : 1;
+  }
+
+  std::pair<iterator, bool> insert(const value_type& value) {
+    return insert(value, Hash(value.first));
+  }
+  std::pair<iterator, bool> insert(const value_type& value, size_t hash) {
+    size_t i = FindIndex(value.first, hash);
+    if (i != kNotFound)
+      return std::make_pair(iterator(this, i), false);
+    if ((size_ + deleted_ + 1) * 8 > slots_.size() * 7)
+      Rehash(size_ + 1);
+    i = FindFree(hash);
+    if (ctrl_[i] == kDeleted)
+      --deleted_;
+    SetCtrl(i, static_cast<signed char>(hash & 0x7f));
+    slots_[i] = value;
+    ++size_;
+    return std::make_pair(iterator(this, i), true);
+  }
+
+  V& operator[](StringPiece key) {
+    return insert(value_type(key, V())).first->second;
+  }
+
+  size_t erase(StringPiece key) {
+    size_t i = FindIndex(key, Hash(key));
+    if (i == kNotFound)
+      return 0;
+    // Leave a tombstone, so that lookups keep probing past the slot.
+    SetCtrl(i, kDeleted);
+    slots_[i] = value_type();
+    --size_;
+    ++deleted_;
+    return 1;
+  }
+
+  /// Make room for |count| entries in all, so that inserting up to that
+  /// many doesn't rehash.
+  void reserve(size_t count) {
+    count = std::max(count, size_);
+    if ((count + deleted_) * 8 > slots_.size() * 7)
+      Rehash(count);
+  }
+
+  void clear() {
+    ctrl_.clear();
+    slots_.clear();
+    size_ = 0;
+    deleted_ = 0;
+  }
+
+ private:
+  enum { kGroupSize = 16 };
+  /// Control bytes of the slots without an entry; full slots have the
+  /// (non-negative) low 7 bits of the hash of their key.
+  enum { kEmpty = -128, kDeleted = -2 };
+  static const size_t kNotFound = ~static_cast<size_t>(0);
+
+  static int CountTrailingZeros(unsigned bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctz(bits);
+#endif
+  }
+
+  /// The bits of the control bytes of the group at |pos| equal to |c|.
+  unsigned Match(size_t pos, signed char c) const {
+#ifdef NINJA_HASH_MAP_SSE2
+    __m128i group =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(&ctrl_[pos]));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#else
+    unsigned bits = 0;
+    for (int i = 0; i < kGroupSize; ++i)
+      bits |= (unsigned)(ctrl_[pos + i] == c) << i;
+    return bits;
+#endif
+  }
+
+  /// The bits of the empty or deleted slots of the group at |pos|.
+  unsigned MatchFree(size_t pos) const {
+#ifdef NINJA_HASH_MAP_SSE2
+    return _mm_movemask_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(&ctrl_[pos])));
+#else
+    unsigned bits = 0;
+    for (int i = 0; i < kGroupSize; ++i)
+      bits |= (unsigned)(ctrl_[pos + i] < 0) << i;
+    return bits;
+#endif
+  }
+
+  // Groups are probed at triangular offsets from the slot the hash picks,
+  // which visits every group as the number of slots is a power of two.
+  // Groups may wrap around the end: the first control bytes are repeated
+  // after the last one.
+
+  size_t FindIndex(StringPiece key, size_t hash) const {
+    if (slots_.empty())
+      return kNotFound;
+    size_t mask = slots_.size() - 1;
+    signed char h2 = static_cast<signed char>(hash & 0x7f);
+    size_t pos = (hash >> 7) & mask;
+    for (size_t step = kGroupSize;; step += kGroupSize) {
+      for (unsigned bits = Match(pos, h2); bits; bits &= bits - 1) {
+        size_t i = (pos + CountTrailingZeros(bits)) & mask;
+        if (slots_[i].first == key)
+          return i;
+      }
+      if (Match(pos, kEmpty))
+        return kNotFound;
+      pos = (pos + step) & mask;
+    }
+  }
+
+  /// Find a free slot for a key with |hash|, there being one.
+  size_t FindFree(size_t hash) const {
+    size_t mask = slots_.size() - 1;
+    size_t pos = (hash >> 7) & mask;
+    for (size_t step = kGroupSize;; step += kGroupSize) {
+      if (unsigned bits = MatchFree(pos))
+        return (pos + CountTrailingZeros(bits)) & mask;
+      pos = (pos + step) & mask;
+    }
+  }
+
+  void SetCtrl(size_t i, signed char c) {
+    ctrl_[i] = c;
+    if (i < kGroupSize)
+      ctrl_[slots_.size() + i] = c;
+  }
+
+  /// Drop the tombstones, and make room for |count| entries if needed, so
+  /// that at most 7/16 of the slots are full.
+  void Rehash(size_t count) {
+    size_t capacity = kGroupSize;
+    while (capacity * 7 < count * 16)
+      capacity *= 2;
+    std::vector<signed char> old_ctrl(capacity + kGroupSize,
+                                      static_cast<signed char>(kEmpty));
+    std::vector<value_type> old_slots(capacity);
+    old_ctrl.swap(ctrl_);
+    old_slots.swap(slots_);
+    deleted_ = 0;
+    for (size_t i = 0; i < old_slots.size(); ++i) {
+      if (old_ctrl[i] < 0)
+        continue;
+      size_t hash = Hash(old_slots[i].first);
+      size_t j = FindFree(hash);
+      SetCtrl(j, static_cast<signed char>(hash & 0x7f));
+      slots_[j] = old_slots[i];
+    }
+  }
+
+  /// slots_.size() + kGroupSize control bytes.
+  std::vector<signed char> ctrl_;
+  std::vector<value_type> slots_;
+  size_t size_;
+  size_t deleted_;
+};
+
 /// A template for hash_maps keyed by a StringPiece whose string is
 /// owned externally (typically by the values).  Use like:
 /// ExternalStringHash<Foo*>::Type foos; to make foos into a hash
 /// mapping StringPiece => Foo*.
 template<typename V>
 struct ExternalStringHashMap {
-#if (__cplusplus >= 201103L) || (_MSC_VER >= 1900)
-  typedef std::unordered_map<StringPiece, V> Type;
-#elif defined(_MSC_VER)
-  typedef hash_map<StringPiece, V, StringPieceCmp> Type;
-#else
-  typedef hash_map<StringPiece, V> Type;
-#endif
+  typedef StringPieceHashMap<V> Type;
 };
 
 #endif // NINJA_MAP_H_
@@ -0,0 +1,85 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hash_map.h"
+
+#include <map>
+#include <string>
+
+#include "test.h"
+
+using namespace std;
+
+TEST(StringPieceHashMapTest, Basic) {
+  StringPieceHashMap<int> map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.find("a") == map.end());
+  EXPECT_TRUE(map.begin() == map.end());
+
+  EXPECT_TRUE(map.insert(make_pair(StringPiece("a"), 1)).second);
+  EXPECT_FALSE(map.insert(make_pair(StringPiece("a"), 2)).second);
+  map["b"] = 3;
+  EXPECT_EQ(2u, map.size());
+  EXPECT_EQ(1, map.find("a")->second);
+  EXPECT_EQ(3, map["b"]);
+  EXPECT_EQ(1u, map.count("b"));
+  EXPECT_EQ(0u, map.count("c"));
+
+  EXPECT_EQ(1u, map.erase("a"));
+  EXPECT_EQ(0u, map.erase("a"));
+  EXPECT_TRUE(map.find("a") == map.end());
+  EXPECT_EQ(1u, map.size());
+
+  map.clear();
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.find("b") == map.end());
+}
+
+// Growing, and reusing the slots of erased keys, keeps every key findable.
+TEST(StringPieceHashMapTest, MatchesStdMap) {
+  const int kKeys = 5000;
+  vector<string> keys;
+  for (int i = 0; i < kKeys; ++i)
+    keys.push_back("out/obj/file" + to_string(i) + ".o");
+
+  StringPieceHashMap<int> map;
+  std::map<string, int> expected;
+  unsigned seed = 1;
+  for (int n = 0; n < 50000; ++n) {
+    seed = seed * 1103515245 + 12345;
+    const string& key = keys[(seed >> 16) % kKeys];
+    if ((seed >> 8) % 3 == 0) {
+      EXPECT_EQ(expected.erase(key), map.erase(key));
+    } else {
+      map[key] = n;
+      expected[key] = n;
+    }
+  }
+
+  EXPECT_EQ(expected.size(), map.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    std::map<string, int>::iterator e = expected.find(keys[i]);
+    StringPieceHashMap<int>::const_iterator m = map.find(keys[i]);
+    ASSERT_EQ((e == expected.end()), (m == map.end()));
+    if (m != map.end())
+      EXPECT_EQ(e->second, m->second);
+  }
+
+  size_t visited = 0;
+  for (StringPieceHashMap<int>::iterator i = map.begin(); i != map.end(); ++i) {
+    EXPECT_EQ(expected[i->first.AsString()], i->second);
+    ++visited;
+  }
+  EXPECT_EQ(expected.size(), visited);
+}
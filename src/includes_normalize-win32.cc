@@ -194,6 +194,17 @@ bool IncludesNormalize::Normalize(const string& input,
   if (!CanonicalizePath(copy, &len, &slash_bits, err))
     return false;
   StringPiece partially_fixed(copy, len);
+
+  // Most includes are full paths under |relative_to_|: relativize those
+  // without splitting and joining them.
+  size_t prefix = relative_to_.size();
+  if (len > prefix + 1 && copy[prefix] == '/' &&
+      relative_to_[prefix - 1] != '/' && IsFullPathName(partially_fixed) &&
+      EqualsCaseInsensitiveASCII(StringPiece(copy, prefix), relative_to_)) {
+    result->assign(copy + prefix + 1, len - prefix - 1);
+    return true;
+  }
+
   string abs_input = AbsPath(partially_fixed, err);
   if (!err->empty())
     return false;
@@ -0,0 +1,195 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jobserver.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// Open a non-blocking descriptor of the pipe that |fd| reads, or return
+/// -1 if the system can't.  O_NONBLOCK is a flag of the open file
+/// description, which the other processes sharing the pool have too, and
+/// make may read the pipe with blocking reads; on Linux, opening the pipe
+/// again through /proc gives a description of our own.
+int OpenPrivateReader(int fd) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  int reader = open(path, O_RDONLY | O_NONBLOCK);
+  if (reader >= 0)
+    SetCloseOnExec(reader);
+  return reader;
+}
+
+}  // namespace
+
+Jobserver::Jobserver()
+    : read_fd_(-1), write_fd_(-1), private_read_fd_(-1), owns_fds_(false) {}
+
+Jobserver::~Jobserver() {
+  while (!tokens_.empty())
+    Release();
+  if (private_read_fd_ >= 0)
+    close(private_read_fd_);
+  if (owns_fds_) {
+    close(read_fd_);
+    if (write_fd_ != read_fd_)
+      close(write_fd_);
+  }
+}
+
+bool Jobserver::Connect(const Config& config, string* err) {
+  assert(!is_valid());
+  switch (config.mode) {
+  case Config::kModeNone:
+    *err = "no jobserver available";
+    return false;
+
+  case Config::kModePipe:
+    if (fcntl(config.read_fd, F_GETFD) < 0 ||
+        fcntl(config.write_fd, F_GETFD) < 0) {
+      // make closes the descriptors for commands that it doesn't know to be
+      // recursive invocations (i.e. not prefixed by '+' or using $(MAKE)).
+      *err = "jobserver descriptors are not open; "
+             "mark the rule running ninja as recursive with '+'";
+      return false;
+    }
+    // The flags of the descriptors are shared with make and the other
+    // jobs, so they are left as they are.
+    read_fd_ = config.read_fd;
+    write_fd_ = config.write_fd;
+    private_read_fd_ = OpenPrivateReader(read_fd_);
+    owns_fds_ = false;
+    return true;
+
+  case Config::kModeFifo: {
+    int fd = open(config.path.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+      *err = "jobserver fifo " + config.path + ": " + strerror(errno);
+      return false;
+    }
+    SetCloseOnExec(fd);
+    read_fd_ = write_fd_ = fd;
+    owns_fds_ = true;
+    return true;
+  }
+
+  case Config::kModeSemaphore:
+    *err = "jobserver semaphore '" + config.path +
+           "' is not supported on this platform";
+    return false;
+  }
+  return false;
+}
+
+bool Jobserver::CreatePool(int slots, string* err) {
+  assert(!is_valid());
+  int fds[2];
+  if (pipe(fds) < 0) {
+    *err = string("jobserver pipe: ") + strerror(errno);
+    return false;
+  }
+  // One slot is implicit.  Keep the tokens within what a pipe is guaranteed
+  // to be able to hold so that filling it can't block.
+  int tokens = slots - 1;
+  if (tokens > PIPE_BUF)
+    tokens = PIPE_BUF;
+  string buf(tokens, '+');
+  if (tokens > 0 && write(fds[1], buf.data(), buf.size()) != (ssize_t)tokens) {
+    *err = string("jobserver pipe: ") + strerror(errno);
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+
+  // The descriptors deliberately stay inheritable so that the commands we
+  // run can use them.
+  // They stay blocking as well, as sub-makes expect.
+  read_fd_ = fds[0];
+  write_fd_ = fds[1];
+  private_read_fd_ = OpenPrivateReader(read_fd_);
+  owns_fds_ = true;
+
+  string makeflags;
+  if (const char* old_makeflags = getenv("MAKEFLAGS")) {
+    makeflags = old_makeflags;
+    if (!makeflags.empty())
+      makeflags += ' ';
+  }
+  char auth[64];
+  snprintf(auth, sizeof(auth), "-j%d --jobserver-auth=%d,%d", tokens + 1,
+           read_fd_, write_fd_);
+  makeflags += auth;
+  if (setenv("MAKEFLAGS", makeflags.c_str(), 1) < 0) {
+    *err = string("setenv: ") + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool Jobserver::is_valid() const {
+  return read_fd_ >= 0;
+}
+
+bool Jobserver::TryAcquire() {
+  if (!is_valid())
+    return false;
+  int fd = private_read_fd_;
+  if (fd < 0) {
+    // Without a non-blocking descriptor of our own, only read if there is
+    // a token.  Another process may still take it first, leaving the read
+    // to wait for the next token released.
+    pollfd pfd = { read_fd_, POLLIN, 0 };
+    int ready;
+    do {
+      ready = poll(&pfd, 1, 0);
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0 || !(pfd.revents & POLLIN))
+      return false;
+    fd = read_fd_;
+  }
+  char token;
+  ssize_t len;
+  do {
+    len = read(fd, &token, 1);
+  } while (len < 0 && errno == EINTR);
+  if (len != 1)
+    return false;  // EAGAIN: no token available right now.
+  tokens_.push_back(token);
+  return true;
+}
+
+void Jobserver::Release() {
+  assert(!tokens_.empty());
+  char token = tokens_[tokens_.size() - 1];
+  tokens_.resize(tokens_.size() - 1);
+  ssize_t len;
+  do {
+    len = write(write_fd_, &token, 1);
+  } while (len < 0 && errno == EINTR);
+  if (len != 1)
+    Warning("failed to return jobserver token: %s", strerror(errno));
+}
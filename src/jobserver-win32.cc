@@ -0,0 +1,98 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jobserver.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util.h"
+
+using namespace std;
+
+Jobserver::Jobserver() : semaphore_(NULL) {}
+
+Jobserver::~Jobserver() {
+  while (!tokens_.empty())
+    Release();
+  if (semaphore_)
+    CloseHandle(semaphore_);
+}
+
+bool Jobserver::Connect(const Config& config, string* err) {
+  assert(!is_valid());
+  if (config.mode != Config::kModeSemaphore) {
+    *err = "only semaphore jobservers are supported on this platform";
+    return false;
+  }
+  semaphore_ = OpenSemaphoreA(SEMAPHORE_MODIFY_STATE | SYNCHRONIZE, FALSE,
+                              config.path.c_str());
+  if (!semaphore_) {
+    *err = "jobserver semaphore '" + config.path + "': " +
+           GetLastErrorString();
+    return false;
+  }
+  return true;
+}
+
+bool Jobserver::CreatePool(int slots, string* err) {
+  assert(!is_valid());
+  char name[64];
+  snprintf(name, sizeof(name), "ninja_jobserver_%lu", GetCurrentProcessId());
+
+  // One slot is implicit.
+  LONG tokens = slots - 1;
+  semaphore_ = CreateSemaphoreA(NULL, tokens, tokens > 0 ? tokens : 1, name);
+  if (!semaphore_) {
+    *err = string("CreateSemaphore: ") + GetLastErrorString();
+    return false;
+  }
+
+  string makeflags;
+  if (const char* old_makeflags = getenv("MAKEFLAGS")) {
+    makeflags = old_makeflags;
+    if (!makeflags.empty())
+      makeflags += ' ';
+  }
+  char auth[128];
+  snprintf(auth, sizeof(auth), "-j%ld --jobserver-auth=%s", tokens + 1, name);
+  makeflags += auth;
+  if (!SetEnvironmentVariableA("MAKEFLAGS", makeflags.c_str())) {
+    *err = string("SetEnvironmentVariable: ") + GetLastErrorString();
+    return false;
+  }
+  return true;
+}
+
+bool Jobserver::is_valid() const {
+  return semaphore_ != NULL;
+}
+
+bool Jobserver::TryAcquire() {
+  if (!is_valid())
+    return false;
+  if (WaitForSingleObject(semaphore_, 0) != WAIT_OBJECT_0)
+    return false;
+  tokens_.push_back('+');
+  return true;
+}
+
+void Jobserver::Release() {
+  assert(!tokens_.empty());
+  tokens_.resize(tokens_.size() - 1);
+  if (!ReleaseSemaphore(semaphore_, 1, NULL))
+    Warning("failed to return jobserver token: %s",
+            GetLastErrorString().c_str());
+}
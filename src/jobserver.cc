@@ -0,0 +1,95 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jobserver.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+namespace {
+
+/// Return true and the value if |word| starts with |prefix|.
+bool MatchOption(const string& word, const char* prefix, string* value) {
+  size_t len = strlen(prefix);
+  if (word.compare(0, len, prefix) != 0)
+    return false;
+  *value = word.substr(len);
+  return true;
+}
+
+}  // namespace
+
+// static
+bool Jobserver::ParseMakeflags(const string& makeflags, Config* config,
+                               string* err) {
+  *config = Config();
+
+  // Find the last jobserver option; make appends to MAKEFLAGS so later
+  // options override earlier ones.
+  string auth;
+  bool found = false;
+  size_t pos = 0;
+  while (pos < makeflags.size()) {
+    size_t end = makeflags.find(' ', pos);
+    if (end == string::npos)
+      end = makeflags.size();
+    string word = makeflags.substr(pos, end - pos);
+    pos = end + 1;
+
+    string value;
+    if (MatchOption(word, "--jobserver-auth=", &value) ||
+        MatchOption(word, "--jobserver-fds=", &value)) {
+      auth = value;
+      found = true;
+    }
+  }
+  if (!found)
+    return true;
+
+  if (auth.empty()) {
+    *err = "empty jobserver description in MAKEFLAGS";
+    return false;
+  }
+
+  string path;
+  if (MatchOption(auth, "fifo:", &path)) {
+    if (path.empty()) {
+      *err = "empty jobserver fifo path in MAKEFLAGS";
+      return false;
+    }
+    config->mode = Config::kModeFifo;
+    config->path = path;
+    return true;
+  }
+
+  int read_fd, write_fd;
+  char trailing;
+  if (sscanf(auth.c_str(), "%d,%d%c", &read_fd, &write_fd, &trailing) == 2) {
+    if (read_fd < 0 || write_fd < 0) {
+      // make passes negative descriptors to commands it doesn't consider
+      // to be recursive invocations.
+      return true;
+    }
+    config->mode = Config::kModePipe;
+    config->read_fd = read_fd;
+    config->write_fd = write_fd;
+    return true;
+  }
+
+  config->mode = Config::kModeSemaphore;
+  config->path = auth;
+  return true;
+}
@@ -0,0 +1,115 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_JOBSERVER_H_
+#define NINJA_JOBSERVER_H_
+
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/// Jobserver is a GNU make compatible pool of job tokens shared by a tree
+/// of processes, so that e.g. make running ninja running make respects a
+/// single -j budget.
+///
+/// Every process in the tree owns one implicit token, which lets it run one
+/// job without asking.  Each additional concurrent job needs a token taken
+/// from the pool, which must be given back once the job completes.
+///
+/// A Jobserver either connects to a pool described by an inherited
+/// MAKEFLAGS value, or creates a new pool and describes it in MAKEFLAGS
+/// for the commands ninja runs.
+struct Jobserver {
+  /// The pool described by a MAKEFLAGS value.
+  struct Config {
+    Config() : mode(kModeNone), read_fd(-1), write_fd(-1) {}
+
+    enum Mode {
+      /// No jobserver is available.
+      kModeNone,
+      /// Tokens are bytes in an anonymous pipe ("--jobserver-auth=R,W").
+      kModePipe,
+      /// Tokens are bytes in a named pipe ("--jobserver-auth=fifo:PATH").
+      kModeFifo,
+      /// Tokens are counts of a named Win32 semaphore
+      /// ("--jobserver-auth=NAME").
+      kModeSemaphore,
+    };
+    Mode mode;
+    /// Inherited file descriptors, for kModePipe.
+    int read_fd;
+    int write_fd;
+    /// Fifo path or semaphore name, for kModeFifo and kModeSemaphore.
+    std::string path;
+  };
+
+  /// Parse the jobserver description out of a MAKEFLAGS value.  The last
+  /// --jobserver-auth= (or legacy --jobserver-fds=) option wins.
+  /// Returns false and fills |err| if the description is malformed;
+  /// |config->mode| is kModeNone if MAKEFLAGS doesn't describe a jobserver.
+  static bool ParseMakeflags(const std::string& makeflags, Config* config,
+                             std::string* err);
+
+  Jobserver();
+  ~Jobserver();
+
+  /// Connect to the pool described by |config|.
+  /// Returns false and fills |err| if the pool can not be used.
+  bool Connect(const Config& config, std::string* err);
+
+  /// Create a new pool allowing |slots| concurrent jobs in total, and
+  /// append its description to MAKEFLAGS in the environment so that
+  /// commands started by ninja join it.
+  /// Returns false and fills |err| on failure.
+  bool CreatePool(int slots, std::string* err);
+
+  /// Whether the jobserver is connected to a pool.
+  bool is_valid() const;
+
+  /// Take a token out of the pool without blocking.
+  /// Returns false if no token is currently available.
+  bool TryAcquire();
+
+  /// Give back a token previously returned by TryAcquire().
+  void Release();
+
+  /// Number of tokens currently held by this process.
+  int acquired() const { return (int)tokens_.size(); }
+
+ private:
+  /// The bytes read out of the pool; they are written back as they were
+  /// read, as GNU make requires.
+  std::string tokens_;
+
+#ifdef _WIN32
+  HANDLE semaphore_;
+#else
+  int read_fd_;
+  int write_fd_;
+  /// A non-blocking descriptor of the pipe of |read_fd_| of our own, or
+  /// -1 if the system can't open one.  The fifo is opened non-blocking.
+  int private_read_fd_;
+  /// Whether the descriptors were opened (rather than inherited) by this
+  /// process and should be closed when done.
+  bool owns_fds_;
+#endif
+
+  // Unimplemented copy ctor and operator= ensure we don't leak tokens.
+  Jobserver(const Jobserver& other);         // DO NOT IMPLEMENT
+  void operator=(const Jobserver& other);    // DO NOT IMPLEMENT
+};
+
+#endif  // NINJA_JOBSERVER_H_
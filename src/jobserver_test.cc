@@ -0,0 +1,160 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jobserver.h"
+
+#include <stdlib.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "test.h"
+
+using namespace std;
+
+TEST(JobserverTest, ParseNoJobserver) {
+  Jobserver::Config config;
+  string err;
+  EXPECT_TRUE(Jobserver::ParseMakeflags("", &config, &err));
+  EXPECT_EQ(Jobserver::Config::kModeNone, config.mode);
+  EXPECT_TRUE(Jobserver::ParseMakeflags("kw -j4 -- FOO=bar", &config, &err));
+  EXPECT_EQ(Jobserver::Config::kModeNone, config.mode);
+  EXPECT_EQ("", err);
+}
+
+TEST(JobserverTest, ParsePipe) {
+  Jobserver::Config config;
+  string err;
+  EXPECT_TRUE(Jobserver::ParseMakeflags(" -j8 --jobserver-auth=3,4 -- ",
+                                        &config, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(Jobserver::Config::kModePipe, config.mode);
+  EXPECT_EQ(3, config.read_fd);
+  EXPECT_EQ(4, config.write_fd);
+
+  // The legacy option name is understood, and the last option wins.
+  EXPECT_TRUE(Jobserver::ParseMakeflags(
+      "--jobserver-auth=3,4 --jobserver-fds=5,6", &config, &err));
+  EXPECT_EQ(Jobserver::Config::kModePipe, config.mode);
+  EXPECT_EQ(5, config.read_fd);
+  EXPECT_EQ(6, config.write_fd);
+
+  // make hands out negative descriptors to non-recursive commands.
+  EXPECT_TRUE(Jobserver::ParseMakeflags("--jobserver-auth=-2,-2",
+                                        &config, &err));
+  EXPECT_EQ(Jobserver::Config::kModeNone, config.mode);
+}
+
+TEST(JobserverTest, ParseFifoAndSemaphore) {
+  Jobserver::Config config;
+  string err;
+  EXPECT_TRUE(Jobserver::ParseMakeflags("--jobserver-auth=fifo:/tmp/GMfifo1",
+                                        &config, &err));
+  EXPECT_EQ(Jobserver::Config::kModeFifo, config.mode);
+  EXPECT_EQ("/tmp/GMfifo1", config.path);
+
+  EXPECT_TRUE(Jobserver::ParseMakeflags("--jobserver-auth=gmake_semaphore_1",
+                                        &config, &err));
+  EXPECT_EQ(Jobserver::Config::kModeSemaphore, config.mode);
+  EXPECT_EQ("gmake_semaphore_1", config.path);
+}
+
+TEST(JobserverTest, ParseErrors) {
+  Jobserver::Config config;
+  string err;
+  EXPECT_FALSE(Jobserver::ParseMakeflags("--jobserver-auth=", &config, &err));
+  EXPECT_EQ("empty jobserver description in MAKEFLAGS", err);
+  err.clear();
+  EXPECT_FALSE(Jobserver::ParseMakeflags("--jobserver-auth=fifo:",
+                                         &config, &err));
+  EXPECT_EQ("empty jobserver fifo path in MAKEFLAGS", err);
+}
+
+TEST(JobserverTest, Pool) {
+  string old_makeflags;
+  const char* makeflags = getenv("MAKEFLAGS");
+  bool had_makeflags = makeflags != NULL;
+  if (had_makeflags)
+    old_makeflags = makeflags;
+
+  string err;
+  Jobserver::Config config;
+  {
+    Jobserver pool;
+    ASSERT_TRUE(pool.CreatePool(3, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(pool.is_valid());
+
+    // Two tokens besides the implicit one.
+    EXPECT_TRUE(pool.TryAcquire());
+    EXPECT_TRUE(pool.TryAcquire());
+    EXPECT_FALSE(pool.TryAcquire());
+    EXPECT_EQ(2, pool.acquired());
+
+    pool.Release();
+    EXPECT_EQ(1, pool.acquired());
+    EXPECT_TRUE(pool.TryAcquire());
+    EXPECT_FALSE(pool.TryAcquire());
+
+    // The pool is advertised to our children.
+    makeflags = getenv("MAKEFLAGS");
+    ASSERT_TRUE(makeflags != NULL);
+    ASSERT_TRUE(Jobserver::ParseMakeflags(makeflags, &config, &err));
+    EXPECT_NE(Jobserver::Config::kModeNone, config.mode);
+  }
+
+#ifdef _WIN32
+  SetEnvironmentVariableA("MAKEFLAGS",
+                          had_makeflags ? old_makeflags.c_str() : NULL);
+#else
+  if (had_makeflags)
+    setenv("MAKEFLAGS", old_makeflags.c_str(), 1);
+  else
+    unsetenv("MAKEFLAGS");
+#endif
+}
+
+#ifndef _WIN32
+TEST(JobserverTest, InheritedPipeStaysBlocking) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  ASSERT_EQ(2, write(fds[1], "++", 2));
+
+  Jobserver::Config config;
+  config.mode = Jobserver::Config::kModePipe;
+  config.read_fd = fds[0];
+  config.write_fd = fds[1];
+  string err;
+  {
+    Jobserver jobserver;
+    ASSERT_TRUE(jobserver.Connect(config, &err));
+    ASSERT_EQ("", err);
+    // make and the other jobs share the flags of the descriptors.
+    EXPECT_EQ(0, (fcntl(fds[0], F_GETFL) & O_NONBLOCK));
+    EXPECT_EQ(0, (fcntl(fds[1], F_GETFL) & O_NONBLOCK));
+
+    EXPECT_TRUE(jobserver.TryAcquire());
+    EXPECT_TRUE(jobserver.TryAcquire());
+    // An empty pool doesn't block.
+    EXPECT_FALSE(jobserver.TryAcquire());
+  }
+
+  // The tokens went back, and the descriptors are still open.
+  char tokens[2];
+  EXPECT_EQ(2, read(fds[0], tokens, 2));
+  close(fds[0]);
+  close(fds[1]);
+}
+#endif
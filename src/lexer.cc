@@ -616,11 +616,25 @@ yy93:
 }
 
 bool Lexer::ReadEvalString(EvalString* eval, bool path, string* err) {
+  // The characters that end a run of text; see the first rule below.  For
+  // values, spaces, colons and pipes are text as well.
+  static const char kPathStops[] = "$ :\r\n|";
+  static const char kValueStops[] = "$\r\n";
+  const char* stops = path ? kPathStops : kValueStops;
+  // Including the terminating '\0'.
+  const int stop_count = path ? sizeof(kPathStops) : sizeof(kValueStops);
+  const char* end = input_.str_ + input_.len_;
   const char* p = ofs_;
   const char* q;
   const char* start;
   for (;;) {
     start = p;
+    // Jump over long runs of text before looking at the rest byte by byte.
+    p = SkipBlocksWithout(p, end, stops, stop_count);
+    if (p != start) {
+      eval->AddText(StringPiece(start, p - start));
+      continue;
+    }
     
 {
 	unsigned char yych;
@@ -39,6 +39,31 @@ TEST(Lexer, ReadEvalStringEscapes) {
             eval.Serialize());
 }
 
+// Text spanning several 16-byte blocks, with an escape at each offset.
+TEST(Lexer, ReadEvalStringLong) {
+  string input, expected;
+  for (int i = 0; i < 40; ++i) {
+    input += string(i, 'x') + " a:b|c" + "$$";
+    expected += string(i, 'x') + " a:b|c" + "$";
+  }
+  input += "\n";
+
+  Lexer lexer(input.c_str());
+  EvalString eval;
+  string err;
+  EXPECT_TRUE(lexer.ReadVarValue(&eval, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ("[" + expected + "]", eval.Serialize());
+
+  string path_input = string(40, 'x') + "$ y" + string(40, 'z') + " w\n";
+  Lexer path_lexer(path_input.c_str());
+  EvalString path;
+  EXPECT_TRUE(path_lexer.ReadPath(&path, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ("[" + string(40, 'x') + " y" + string(40, 'z') + "]",
+            path.Serialize());
+}
+
 TEST(Lexer, ReadIdent) {
   Lexer lexer("foo baR baz_123 foo-bar");
   string ident;
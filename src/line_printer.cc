@@ -22,6 +22,7 @@
 #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x4
 #endif
 #else
+#include <signal.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <termios.h>
@@ -30,12 +31,27 @@
 
 #include <cstring>
 
-#include <regex>
-
+#include "reformat.h"
 #include "util.h"
 
 using namespace std;
 
+#ifndef _WIN32
+namespace {
+
+/// Set when the size of the terminal may have changed since
+/// g_terminal_columns was queried, as it may have at first.
+volatile sig_atomic_t g_terminal_resized = 1;
+/// The columns of the terminal, or 0 if unknown.
+int g_terminal_columns = 0;
+
+void SetTerminalResized(int) {
+  g_terminal_resized = 1;
+}
+
+}  // namespace
+#endif
+
 LinePrinter::LinePrinter() : have_blank_line_(true), console_locked_(false) {
   const char* term = getenv("TERM");
 #ifndef _WIN32
@@ -53,6 +69,20 @@ LinePrinter::LinePrinter() : have_blank_line_(true), console_locked_(false) {
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     smart_terminal_ = GetConsoleScreenBufferInfo(console_, &csbi);
   }
+#endif
+#ifndef _WIN32
+  // Query the size of the terminal again only when it changes.  While a
+  // SubprocessSet exists SIGWINCH is blocked, like the interruptions, and
+  // taken when it waits for the commands, which then redraw the status.
+  static bool handling_resize = false;
+  if (smart_terminal_ && !handling_resize) {
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = SetTerminalResized;
+    act.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &act, NULL);
+    handling_resize = true;
+  }
 #endif
   supports_color_ = smart_terminal_;
   if (!supports_color_) {
@@ -70,57 +100,79 @@ LinePrinter::LinePrinter() : have_blank_line_(true), console_locked_(false) {
     }
   }
 #endif
+  if (GetOutputThreadMode())
+    writer_.Start(stdout);
 }
 
-string CustomFormat(string const& input) {
-  auto res = input;
-  res = regex_replace(res, std::regex{"building rds definition (.*)"}, "\u001b[36mbuilding rds script\u001b[0m \u001b[34m$1\u001b[0m");
-  res = regex_replace(res, std::regex{"Building CXX(.*) ([^ ]+)"}, "\u001b[32mbuilding c++$1 \u001b[34m$2\u001b[0m");
-  res = regex_replace(res, std::regex{"Linking CXX static library(.*) ([^ ]+)"}, "\u001b[33;1mlinking: c++ static$1 \u001b[34;1m$2\u001b[0m");
-  res = regex_replace(res, std::regex{"Building C(.*) ([^ ]+)"}, "\u001b[32mbuilding c  $1 \u001b[34m$2\u001b[0m");
-  res = regex_replace(res, std::regex{"Linking CXX executable(.*) ([^ ]+)"}, "\u001b[33;1mlinking: c++ binary$1 \u001b[34;1m$2\u001b[0m");
-  res = regex_replace(res, std::regex{"Linking C static library(.*) ([^ ]+)"}, "\u001b[33;1mlinking: c   static$1 \u001b[34;1m$2\u001b[0m");
-  res = regex_replace(res, std::regex{"Linking C(.*) ([^ ]+)"}, "\u001b[33;1mlinking: c  $1 \u001b[34;1m$2\u001b[0m");
-  // foo/xyz.dir/bar --> foo/bar
-  res = regex_replace(res, std::regex{"[^/ ]+\\.dir/"}, "");
-  // foo/CMakeFiles/bar --> foo/bar
-  res = regex_replace(res, std::regex{"CMakeFiles/"}, "");
-  // foo.cpp.o --> foo.cpp
-  res = regex_replace(res, std::regex{"\\.cpp\\.o"}, ".cpp");
-  // Color the progress numbers e.g. [37/120].
-  res = regex_replace(res, std::regex{"\\[([ 0-9]+)/([ 0-9]+)\\]"}, "[\u001b[37;1m$1\u001b[0m/\u001b[37m$2\u001b[0m]");
-  return res;
+namespace {
+
+/// The rules of the "pretty" reformat mode: those of the file that
+/// DSICILIA_NINJA_REFORMAT_RULES names, if any, or the default ones.
+const Reformatter& GetPrettyReformatter() {
+  static const Reformatter* reformatter = [] {
+    Reformatter* reformatter = new Reformatter;
+    const char* path = getenv("DSICILIA_NINJA_REFORMAT_RULES");
+    string err;
+    if (path && !reformatter->LoadRules(path, &err)) {
+      Warning("%s; using the default reformat rules", err.c_str());
+      *reformatter = Reformatter();
+      path = NULL;
+    }
+    if (!path)
+      reformatter->AddDefaultRules();
+    return reformatter;
+  }();
+  return *reformatter;
 }
 
+}  // namespace
+
 int LinePrinter::TerminalColumns( int def ) {
-  winsize size;
-  if ((ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0) && size.ws_col)
-    return size.ws_col;
+#ifdef _WIN32
+  CONSOLE_SCREEN_BUFFER_INFO csbi;
+  if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi))
+    return csbi.dwSize.X;
   return def;
+#else
+  if (g_terminal_resized) {
+    // Clear the flag first, so that a resize while querying isn't lost.
+    g_terminal_resized = 0;
+    winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0)
+      g_terminal_columns = size.ws_col;
+    else
+      g_terminal_columns = 0;
+  }
+  return g_terminal_columns ? g_terminal_columns : def;
+#endif
+}
+
+string LinePrinter::Reformat(const string& to_print) {
+  if (GetReformatMode() == e_reformat_mode::pretty)
+    return GetPrettyReformatter().Apply(to_print);
+  return to_print;
 }
 
 void LinePrinter::Print(string to_print, LineType type) {
-  if (GetReformatMode() == e_reformat_mode::pretty) {
-    to_print = CustomFormat(to_print);
-  }
+  to_print = Reformat(to_print);
   if (console_locked_) {
     line_buffer_ = to_print;
     line_type_ = type;
     return;
   }
   if (GetStatusPrintMode() == e_status_print_mode::multiline) {
-    printf("%s\n", to_print.c_str());
+    Write(to_print + "\n");
     return;
   }
 
-  if (smart_terminal_) {
-    printf("\r");  // Print over previous line, if any.
-    // On Windows, calling a C library function writing to stdout also handles
-    // pausing the executable when the "Pause" key or Ctrl-S is pressed.
-  }
-
   if (smart_terminal_ && type == ELIDE) {
 #ifdef _WIN32
+    // Print over previous line, if any.  Calling a C library function
+    // writing to stdout also handles pausing the executable when the
+    // "Pause" key or Ctrl-S is pressed.
+    Write("\r");
+    // The console buffer is written directly below.
+    writer_.Flush();
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     GetConsoleScreenBufferInfo(console_, &csbi);
 
@@ -144,24 +196,31 @@ void LinePrinter::Print(string to_print, LineType type) {
 #else
     // Limit output to width of the terminal if provided so we don't cause
     // line-wrapping.
-    winsize size;
-    if ((ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0) && size.ws_col) {
-      to_print = ElideMiddle(to_print, size.ws_col);
-    }
-    printf("%s", to_print.c_str());
-    printf("\x1B[K");  // Clear to end of line.
-    fflush(stdout);
+    if (int columns = TerminalColumns(0))
+      to_print = ElideMiddle(to_print, columns);
+    // Print over previous line, if any, and clear to end of line.
+    WriteFrame("\r" + to_print + "\x1B[K");
 #endif
 
     have_blank_line_ = false;
+  } else if (smart_terminal_) {
+    Write("\r" + to_print + "\n");  // Print over previous line, if any.
   } else {
-    printf("%s\n", to_print.c_str());
+    Write(to_print + "\n");
   }
 }
 
 void LinePrinter::PrintOrBuffer(const char* data, size_t size) {
   if (console_locked_) {
     output_buffer_.append(data, size);
+  } else {
+    Write(data, size);
+  }
+}
+
+void LinePrinter::Write(const char* data, size_t size) {
+  if (writer_.started()) {
+    writer_.Write(string(data, size));
   } else {
     // Avoid printf and C strings, since the actual output might contain null
     // bytes like UTF-16 does (yuck).
@@ -169,6 +228,20 @@ void LinePrinter::PrintOrBuffer(const char* data, size_t size) {
   }
 }
 
+void LinePrinter::WriteFrame(const string& frame) {
+  if (writer_.started()) {
+    writer_.WriteFrame(frame);
+  } else {
+    fwrite(frame.data(), 1, frame.size(), stdout);
+    fflush(stdout);
+  }
+}
+
+void LinePrinter::Flush() {
+  writer_.Flush();
+  fflush(stdout);
+}
+
 void LinePrinter::PrintWithoutNewLine(const string& to_print) {
   if (console_locked_ && !line_buffer_.empty()) {
     output_buffer_.append(line_buffer_);
@@ -209,6 +282,14 @@ e_reformat_mode LinePrinter::GetReformatMode() {
   return mode;
 }
 
+bool LinePrinter::GetOutputThreadMode() {
+  static bool mode = []{
+    char const* mode = getenv("DSICILIA_NINJA_OUTPUT_THREAD");
+    return mode != nullptr && strcmp( mode, "1" ) == 0;
+  }();
+  return mode;
+}
+
 e_status_print_mode LinePrinter::GetStatusPrintMode() {
   static e_status_print_mode mode = []{
     char const* mode = getenv("DSICILIA_NINJA_STATUS_PRINT_MODE");
@@ -232,8 +313,9 @@ void LinePrinter::SetConsoleLocked(bool locked) {
     // practice means that we start to run a custom command). In-
     // stead, just erase the current line to prepare for the cus-
     // tomer command.
-    printf("\r\x1B[K\r");  // Clear to end of line.
-    fflush(stdout);
+    Write("\r\x1B[K\r");  // Clear to end of line.
+    // The command writes to the terminal itself.
+    Flush();
   }
 
   console_locked_ = locked;
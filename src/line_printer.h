@@ -18,6 +18,8 @@
 #include <stddef.h>
 #include <string>
 
+#include "terminal_writer.h"
+
 enum class e_reformat_mode {
   none,
   pretty
@@ -57,11 +59,21 @@ struct LinePrinter {
   /// console is locked will not be printed until it is unlocked.
   void SetConsoleLocked(bool locked);
 
+  /// Wait until everything printed so far is on the terminal.
+  void Flush();
+
   static e_status_print_mode GetStatusPrintMode();
+  /// Whether DSICILIA_NINJA_OUTPUT_THREAD asks to write to the terminal
+  /// on a thread of its own, so that a slow one doesn't hold up the build.
+  static bool GetOutputThreadMode();
   static e_reformat_mode GetReformatMode();
 
+  /// Apply the reformat mode to a line, as Print() does.
+  static std::string Reformat(const std::string& to_print);
+
   // Get number of columns in terminal, or return specified de-
-  // fault value if not available.
+  // fault value if not available.  The number is queried again only
+  // after the terminal was resized (SIGWINCH).
   static int TerminalColumns( int def );
 
  private:
@@ -90,8 +102,17 @@ struct LinePrinter {
   void* console_;
 #endif
 
+  /// Writes to stdout in the output thread mode.
+  TerminalWriter writer_;
+
   /// Print the given data to the console, or buffer it if it is locked.
   void PrintOrBuffer(const char *data, size_t size);
+
+  /// Write to stdout, or queue to writer_ if it is started.
+  void Write(const char* data, size_t size);
+  void Write(const std::string& data) { Write(data.data(), data.size()); }
+  /// Write a status line, which overwrites the previous one.
+  void WriteFrame(const std::string& frame);
 };
 
 #endif  // NINJA_LINE_PRINTER_H_
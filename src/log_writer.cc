@@ -0,0 +1,125 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "log_writer.h"
+
+#include <errno.h>
+
+using namespace std;
+
+namespace {
+
+/// Append() waits for the thread beyond this much queued.
+const size_t kMaxPendingBytes = 16 << 20;
+
+}  // anonymous namespace
+
+LogWriter::LogWriter()
+    : queued_bytes_(0), written_bytes_(0), stopping_(false), error_(0),
+      file_(NULL), lock_(NULL), log_(BuildDirLock::kBuildLog) {}
+
+LogWriter::~LogWriter() {
+  Close();
+}
+
+void LogWriter::Start(FILE* file, BuildDirLock* lock, BuildDirLock::Log log) {
+  file_ = file;
+  lock_ = lock;
+  log_ = log;
+  queued_bytes_ = written_bytes_ = 0;
+  stopping_ = false;
+  error_ = 0;
+  thread_ = std::thread(&LogWriter::Run, this);
+}
+
+bool LogWriter::Append(const string& record) {
+  unique_lock<mutex> lock(mutex_);
+  while (!error_ && pending_.size() >= kMaxPendingBytes)
+    written_.wait(lock);
+  if (error_) {
+    errno = error_;
+    return false;
+  }
+  pending_.append(record);
+  queued_bytes_ += record.size();
+  queued_.notify_one();
+  return true;
+}
+
+bool LogWriter::Flush() {
+  if (!file_)
+    return true;
+  unique_lock<mutex> lock(mutex_);
+  uint64_t target = queued_bytes_;
+  while (!error_ && written_bytes_ < target)
+    written_.wait(lock);
+  if (error_) {
+    errno = error_;
+    return false;
+  }
+  return true;
+}
+
+bool LogWriter::Close() {
+  if (!file_)
+    return true;
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+    queued_.notify_one();
+  }
+  thread_.join();
+  int error = error_;
+  if (fclose(file_) != 0 && !error)
+    error = errno;
+  file_ = NULL;
+  if (error) {
+    errno = error;
+    return false;
+  }
+  return true;
+}
+
+void LogWriter::Run() {
+  string batch;
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    while (pending_.empty() && !stopping_)
+      queued_.wait(lock);
+    if (pending_.empty())
+      return;  // Stopping, with everything written.
+
+    // Take all that's queued, and let more queue up meanwhile.
+    batch.swap(pending_);
+    pending_.clear();
+    lock.unlock();
+    int error = 0;
+    if (!error_) {
+      if (lock_ && !lock_->Lock(log_)) {
+        error = errno;
+      } else {
+        if (fwrite(batch.data(), batch.size(), 1, file_) != 1 ||
+            fflush(file_) != 0)
+          error = errno ? errno : EIO;
+        if (lock_)
+          lock_->Unlock(log_);
+      }
+    }
+    lock.lock();
+    if (error && !error_)
+      error_ = error;
+    written_bytes_ += batch.size();
+    written_.notify_all();
+  }
+}
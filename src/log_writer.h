@@ -0,0 +1,79 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_LOG_WRITER_H_
+#define NINJA_LOG_WRITER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "build_dir_lock.h"
+
+/// Appends the records of a log to its file on a thread of its own, so
+/// that recording an edge doesn't wait for the file system.  Records
+/// queued while a write is under way go out together with the next one
+/// (a group commit).  Each write holds whole records, so that a crash
+/// can only truncate the last one, which loading the log detects and
+/// discards.
+struct LogWriter {
+  LogWriter();
+  ~LogWriter();
+
+  /// Start appending to |file|, which it then owns.  If |lock| is set,
+  /// other processes append to the file too, and each write holds |log|
+  /// there.
+  void Start(FILE* file, BuildDirLock* lock = NULL,
+             BuildDirLock::Log log = BuildDirLock::kBuildLog);
+
+  bool started() const { return file_ != NULL; }
+
+  /// Queue |record| to be written.  It only waits when much is queued
+  /// already.  @return false, with errno set, if an earlier write failed.
+  bool Append(const std::string& record);
+
+  /// Wait until everything queued so far is written.
+  /// @return false, with errno set, on error.
+  bool Flush();
+
+  /// Flush, stop the thread and close the file.
+  /// @return false, with errno set, on error.
+  bool Close();
+
+ private:
+  void Run();
+
+  std::mutex mutex_;
+  /// Wakes up the thread.
+  std::condition_variable queued_;
+  /// Wakes up those waiting for the thread.
+  std::condition_variable written_;
+  std::string pending_;
+  /// The bytes queued and written since Start().
+  uint64_t queued_bytes_;
+  uint64_t written_bytes_;
+  bool stopping_;
+  /// The errno of the first failed write, or 0.
+  int error_;
+  FILE* file_;
+  BuildDirLock* lock_;
+  BuildDirLock::Log log_;
+  std::thread thread_;
+};
+
+#endif  // NINJA_LOG_WRITER_H_
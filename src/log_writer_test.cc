@@ -0,0 +1,76 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "log_writer.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "test.h"
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+const char kTestFilename[] = "LogWriterTest-tempfile";
+
+struct LogWriterTest : public testing::Test {
+  virtual void SetUp() {
+    unlink(kTestFilename);
+  }
+  virtual void TearDown() {
+    unlink(kTestFilename);
+  }
+
+  string Contents() {
+    string contents, err;
+    EXPECT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+    return contents;
+  }
+};
+
+TEST_F(LogWriterTest, AppendsInOrder) {
+  FILE* f = fopen(kTestFilename, "wb");
+  ASSERT_TRUE(f != NULL);
+  LogWriter writer;
+  EXPECT_FALSE(writer.started());
+  writer.Start(f);
+  EXPECT_TRUE(writer.started());
+
+  string expected;
+  for (int i = 0; i < 1000; ++i) {
+    string record = "record " + to_string(i) + "\n";
+    EXPECT_TRUE(writer.Append(record));
+    expected += record;
+  }
+  EXPECT_TRUE(writer.Flush());
+  EXPECT_EQ(expected, Contents());
+
+  EXPECT_TRUE(writer.Append("last\n"));
+  EXPECT_TRUE(writer.Close());
+  EXPECT_FALSE(writer.started());
+  EXPECT_EQ(expected + "last\n", Contents());
+}
+
+TEST_F(LogWriterTest, CloseWithoutStart) {
+  LogWriter writer;
+  EXPECT_TRUE(writer.Flush());
+  EXPECT_TRUE(writer.Close());
+}
+
+}  // anonymous namespace
@@ -0,0 +1,831 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "disk_interface.h"
+#include "graph.h"
+#include "hash_map.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "state.h"
+#include "trace.h"
+#include "util.h"
+#include "version.h"
+
+using namespace std;
+
+namespace {
+
+const char kFileSignature[] = "# ninja manifest v7\n";
+const size_t kFileSignatureSize = sizeof(kFileSignature) - 1;
+
+/// Follows the signature: the size and hash of the rest of the file, which
+/// is only trusted once both match.
+struct CacheHeader {
+  uint64_t body_size;
+  uint64_t body_hash;
+};
+
+/// Builds the body of the cache.  Numbers are in the byte order of the
+/// machine, as the cache never leaves it.
+struct Writer {
+  template <typename T>
+  void Put(T value) {
+    buffer_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+  void PutString(StringPiece s) {
+    Put<uint32_t>((uint32_t)s.len_);
+    buffer_.append(s.str_, s.len_);
+  }
+
+  string buffer_;
+};
+
+/// The index written for a missing node or rule.
+const uint32_t kNone = ~0u;
+
+/// Reads the body of the cache, failing once it runs past the end.
+struct Reader {
+  Reader(const char* data, size_t size)
+      : pos_(data), end_(data + size), ok_(true) {}
+
+  template <typename T>
+  T Get() {
+    T value = T();
+    if ((size_t)(end_ - pos_) < sizeof(value)) {
+      ok_ = false;
+      return value;
+    }
+    memcpy(&value, pos_, sizeof(value));
+    pos_ += sizeof(value);
+    return value;
+  }
+  StringPiece GetString() {
+    uint32_t size = Get<uint32_t>();
+    if (!ok_ || (size_t)(end_ - pos_) < size) {
+      ok_ = false;
+      return StringPiece();
+    }
+    StringPiece s(pos_, size);
+    pos_ += size;
+    return s;
+  }
+  void Skip(uint64_t size) {
+    if ((uint64_t)(end_ - pos_) < size) {
+      ok_ = false;
+      return;
+    }
+    pos_ += size;
+  }
+  /// Read an index below |count|, or kNone if |optional|, failing if it
+  /// is anything else.
+  uint32_t GetIndex(size_t count, bool optional = false) {
+    uint32_t index = Get<uint32_t>();
+    if (index >= count && !(optional && index == kNone))
+      ok_ = false;
+    return ok_ ? index : kNone;
+  }
+
+  const char* pos_;
+  const char* end_;
+  bool ok_;
+};
+
+/// The options that change the parse, as written to the cache.
+uint32_t OptionBits(const ManifestParserOptions& options) {
+  return (options.dupe_edge_action_ == kDupeEdgeActionError ? 1 : 0) |
+         (options.phony_cycle_action_ == kPhonyCycleActionError ? 2 : 0);
+}
+
+/// Check the signature and the checksum of the cache in |map|, and point
+/// |r| at its body.
+bool OpenBody(const MappedFile& map, Reader* r) {
+  CacheHeader header;
+  if (map.size() < kFileSignatureSize + sizeof(header) ||
+      memcmp(map.data(), kFileSignature, kFileSignatureSize) != 0)
+    return false;
+  memcpy(&header, map.data() + kFileSignatureSize, sizeof(header));
+  const char* body = map.data() + kFileSignatureSize + sizeof(header);
+  if (header.body_size != map.size() - kFileSignatureSize - sizeof(header) ||
+      Hash64(body, header.body_size) != header.body_hash)
+    return false;
+  *r = Reader(body, header.body_size);
+  return true;
+}
+
+/// Read the start of the body, checking that it was saved for |manifest|
+/// parsed with |options| and that its files, listed in |record|, are
+/// unchanged.
+bool ReadPreamble(Reader* r, const string& manifest,
+                  const ManifestParserOptions& options,
+                  DiskInterface* disk_interface, ManifestRecord* record) {
+  if (r->GetString() != kNinjaVersion || r->GetString() != manifest ||
+      r->Get<uint32_t>() != OptionBits(options))
+    return false;
+
+  uint32_t file_count = r->Get<uint32_t>();
+  for (uint32_t i = 0; i < file_count && r->ok_; ++i) {
+    string file_path = r->GetString().AsString();
+    TimeStamp mtime = r->Get<int64_t>();
+    uint64_t size = r->Get<uint64_t>();
+    uint64_t digest = r->Get<uint64_t>();
+    record->files.push_back(ManifestRecord::File(file_path, size, digest));
+    record->files.back().mtime = mtime;
+  }
+  if (!r->ok_ || record->Changed(disk_interface)) {
+    record->files.clear();
+    return false;
+  }
+  return true;
+}
+
+void WriteIndex(const ManifestIndex& index, Writer* w) {
+  w->Put<uint32_t>((uint32_t)index.rule_names.size());
+  for (size_t i = 0; i < index.rule_names.size(); ++i) {
+    w->PutString(index.rule_names[i]);
+    const vector<uint32_t>& outputs = index.outputs_by_rule[i];
+    w->Put<uint32_t>((uint32_t)outputs.size());
+    for (size_t o = 0; o < outputs.size(); ++o)
+      w->Put<uint32_t>(outputs[o]);
+  }
+  w->Put<uint32_t>((uint32_t)index.outputs.size());
+  for (size_t i = 0; i < index.outputs.size(); ++i) {
+    w->PutString(index.outputs[i].path);
+    w->Put<uint32_t>(index.outputs[i].rule);
+  }
+  w->Put<uint32_t>((uint32_t)index.roots.size());
+  for (size_t i = 0; i < index.roots.size(); ++i)
+    w->Put<uint32_t>(index.roots[i]);
+  w->PutString(index.roots_error);
+  w->Put<uint32_t>((uint32_t)index.rules.size());
+  for (size_t i = 0; i < index.rules.size(); ++i) {
+    w->PutString(index.rules[i].name);
+    w->Put<uint8_t>(index.rules[i].has_description);
+    w->PutString(index.rules[i].description);
+  }
+  w->Put<uint32_t>((uint32_t)index.subninjas.size());
+  for (size_t i = 0; i < index.subninjas.size(); ++i) {
+    const ManifestIndex::Subninja& subninja = index.subninjas[i];
+    w->PutString(subninja.path);
+    w->Put<uint32_t>(subninja.parent);
+    w->Put<uint8_t>(subninja.declares_pools);
+  }
+  // One of each per output, if there are subninjas.
+  for (size_t i = 0; i < index.output_subninjas.size(); ++i) {
+    w->Put<uint32_t>(index.output_subninjas[i]);
+    const vector<uint32_t>& inputs = index.output_inputs[i];
+    w->Put<uint32_t>((uint32_t)inputs.size());
+    for (size_t j = 0; j < inputs.size(); ++j)
+      w->Put<uint32_t>(inputs[j]);
+  }
+}
+
+void ReadIndex(Reader* r, ManifestIndex* index) {
+  uint32_t rule_count = r->Get<uint32_t>();
+  for (uint32_t i = 0; i < rule_count && r->ok_; ++i) {
+    index->rule_names.push_back(r->GetString().AsString());
+    index->outputs_by_rule.push_back(vector<uint32_t>());
+    uint32_t output_count = r->Get<uint32_t>();
+    for (uint32_t o = 0; o < output_count && r->ok_; ++o)
+      index->outputs_by_rule.back().push_back(r->Get<uint32_t>());
+  }
+  uint32_t output_count = r->Get<uint32_t>();
+  for (uint32_t i = 0; i < output_count && r->ok_; ++i) {
+    ManifestIndex::Output output;
+    output.path = r->GetString().AsString();
+    output.rule = r->GetIndex(index->rule_names.size());
+    index->outputs.push_back(output);
+  }
+  uint32_t root_count = r->Get<uint32_t>();
+  for (uint32_t i = 0; i < root_count && r->ok_; ++i)
+    index->roots.push_back(r->GetIndex(index->outputs.size()));
+  index->roots_error = r->GetString().AsString();
+  uint32_t top_rule_count = r->Get<uint32_t>();
+  for (uint32_t i = 0; i < top_rule_count && r->ok_; ++i) {
+    ManifestIndex::RuleInfo rule;
+    rule.name = r->GetString().AsString();
+    rule.has_description = r->Get<uint8_t>() != 0;
+    rule.description = r->GetString().AsString();
+    index->rules.push_back(rule);
+  }
+  uint32_t subninja_count = r->Get<uint32_t>();
+  for (uint32_t i = 0; i < subninja_count && r->ok_; ++i) {
+    ManifestIndex::Subninja subninja;
+    subninja.path = r->GetString().AsString();
+    // Each file comes after its parent; the manifest has none.
+    subninja.parent = r->GetIndex(i, i == 0);
+    subninja.declares_pools = r->Get<uint8_t>() != 0;
+    index->subninjas.push_back(subninja);
+  }
+  for (size_t i = 0; i < index->outputs.size() && subninja_count && r->ok_;
+       ++i) {
+    index->output_subninjas.push_back(r->GetIndex(subninja_count));
+    index->output_inputs.push_back(vector<uint32_t>());
+    uint32_t input_count = r->Get<uint32_t>();
+    for (uint32_t j = 0; j < input_count && r->ok_; ++j)
+      index->output_inputs.back().push_back(
+          r->GetIndex(index->outputs.size()));
+  }
+  // The outputs of each rule come before the outputs themselves.
+  for (size_t i = 0; i < index->outputs_by_rule.size() && r->ok_; ++i) {
+    const vector<uint32_t>& outputs = index->outputs_by_rule[i];
+    for (size_t o = 0; o < outputs.size(); ++o) {
+      if (outputs[o] >= index->outputs.size())
+        r->ok_ = false;
+    }
+  }
+}
+
+}  // anonymous namespace
+
+namespace {
+
+/// Add |record| and its subninjas to |index|, below |parent|, and note in
+/// |files| which of them declares each edge.
+void AddSubninjas(const ManifestRecord* record, uint32_t parent,
+                  ManifestIndex* index,
+                  unordered_map<const Edge*, uint32_t>* files) {
+  uint32_t id = (uint32_t)index->subninjas.size();
+  index->subninjas.push_back(ManifestIndex::Subninja());
+  ManifestIndex::Subninja* subninja = &index->subninjas.back();
+  subninja->path = record->path;
+  subninja->parent = parent;
+  subninja->declares_pools = record->added_pools;
+  for (vector<Edge*>::const_iterator e = record->edges.begin();
+       e != record->edges.end(); ++e)
+    (*files)[*e] = id;
+
+  for (vector<ManifestRecord*>::const_iterator i = record->subninjas.begin();
+       i != record->subninjas.end(); ++i)
+    AddSubninjas(*i, id, index, files);
+}
+
+}  // anonymous namespace
+
+void ManifestIndex::Build(const State& state, const ManifestRecord* record) {
+  // The files of the edges, if the record has them all.
+  unordered_map<const Edge*, uint32_t> files;
+  if (record && record->EdgeCount() == state.edges_.size())
+    AddSubninjas(record, kNone, this, &files);
+  unordered_map<const Node*, uint32_t> output_ids;
+
+  // Rules of subninjas may share a name, and are listed together.
+  map<string, uint32_t> rule_ids;
+  for (vector<Edge*>::const_iterator e = state.edges_.begin();
+       e != state.edges_.end(); ++e) {
+    const string& name = (*e)->rule_->name();
+    map<string, uint32_t>::iterator id = rule_ids.find(name);
+    if (id == rule_ids.end()) {
+      id = rule_ids.insert(make_pair(name,
+                                     (uint32_t)rule_names.size())).first;
+      rule_names.push_back(name);
+      outputs_by_rule.push_back(vector<uint32_t>());
+    }
+    for (vector<Node*>::const_iterator o = (*e)->outputs_.begin();
+         o != (*e)->outputs_.end(); ++o) {
+      uint32_t output = (uint32_t)outputs.size();
+      Output entry;
+      entry.path = (*o)->path();
+      entry.rule = id->second;
+      outputs.push_back(entry);
+      outputs_by_rule[id->second].push_back(output);
+      if (!subninjas.empty())
+        output_subninjas.push_back(files[*e]);
+      output_ids[*o] = output;
+      // As State::RootNodes() finds them.
+      if ((*o)->out_edges().empty())
+        roots.push_back(output);
+    }
+  }
+  if (!state.edges_.empty() && roots.empty())
+    roots_error = "could not determine root nodes of build graph";
+
+  for (vector<Edge*>::const_iterator e = state.edges_.begin();
+       e != state.edges_.end() && !subninjas.empty(); ++e) {
+    vector<uint32_t> inputs;
+    for (vector<Node*>::const_iterator i = (*e)->inputs_.begin();
+         i != (*e)->inputs_.end(); ++i) {
+      unordered_map<const Node*, uint32_t>::iterator id = output_ids.find(*i);
+      if (id != output_ids.end())
+        inputs.push_back(id->second);
+    }
+    for (size_t o = 0; o < (*e)->outputs_.size(); ++o)
+      output_inputs.push_back(inputs);
+  }
+
+  for (size_t i = 0; i < outputs_by_rule.size(); ++i) {
+    sort(outputs_by_rule[i].begin(), outputs_by_rule[i].end(),
+         [this](uint32_t a, uint32_t b) {
+           return outputs[a].path < outputs[b].path;
+         });
+  }
+
+  const map<string, const Rule*>& top_rules = state.bindings_.GetRules();
+  for (map<string, const Rule*>::const_iterator r = top_rules.begin();
+       r != top_rules.end(); ++r) {
+    RuleInfo rule;
+    rule.name = r->first;
+    const EvalString* description = r->second->GetBinding("description");
+    rule.has_description = description != NULL;
+    if (description)
+      rule.description = description->Unparse();
+    rules.push_back(rule);
+  }
+}
+
+bool ManifestIndex::SubninjasFor(const vector<string>& targets,
+                                 const string& manifest,
+                                 set<string>* paths) const {
+  if (subninjas.empty())
+    return false;
+
+  ExternalStringHashMap<uint32_t>::Type ids;
+  for (size_t i = 0; i < outputs.size(); ++i)
+    ids[outputs[i].path] = (uint32_t)i;
+  vector<uint32_t> pending;
+  for (vector<string>::const_iterator t = targets.begin();
+       t != targets.end(); ++t) {
+    ExternalStringHashMap<uint32_t>::Type::iterator id = ids.find(*t);
+    if (id == ids.end())
+      return false;
+    pending.push_back(id->second);
+  }
+  ExternalStringHashMap<uint32_t>::Type::iterator id = ids.find(manifest);
+  if (id != ids.end())
+    pending.push_back(id->second);
+
+  // The files of the edges the targets need, with the files naming them
+  // for their scopes.
+  vector<bool> needed(subninjas.size());
+  auto need = [&](uint32_t file) {
+    for (; file != kNone && !needed[file]; file = subninjas[file].parent)
+      needed[file] = true;
+  };
+  for (size_t i = 0; i < subninjas.size(); ++i) {
+    if (subninjas[i].declares_pools)
+      need((uint32_t)i);
+  }
+  vector<bool> visited(outputs.size());
+  while (!pending.empty()) {
+    uint32_t output = pending.back();
+    pending.pop_back();
+    if (visited[output])
+      continue;
+    visited[output] = true;
+    need(output_subninjas[output]);
+    pending.insert(pending.end(), output_inputs[output].begin(),
+                   output_inputs[output].end());
+  }
+
+  for (size_t i = 1; i < subninjas.size(); ++i) {
+    if (needed[i])
+      paths->insert(subninjas[i].path);
+  }
+  return true;
+}
+
+const char ManifestCache::kPath[] = ".ninja_manifest";
+
+// static
+bool ManifestCache::Save(const string& path, const string& manifest,
+                         const ManifestParserOptions& options,
+                         const State& state, const ManifestRecord& record,
+                         string* err) {
+  METRIC_RECORD(".ninja_manifest save");
+  TRACE_RECORD(".ninja_manifest save");
+  Writer w;
+  w.PutString(kNinjaVersion);
+  w.PutString(manifest);
+  w.Put<uint32_t>(OptionBits(options));
+
+  vector<const ManifestRecord::File*> files;
+  record.CollectFiles(&files);
+  w.Put<uint32_t>((uint32_t)files.size());
+  for (vector<const ManifestRecord::File*>::iterator i = files.begin();
+       i != files.end(); ++i) {
+    w.PutString((*i)->path);
+    w.Put<int64_t>((*i)->mtime);
+    w.Put<uint64_t>((*i)->size);
+    w.Put<uint64_t>((*i)->digest);
+  }
+
+  // The index follows the files, with its size so that Load() can skip it.
+  ManifestIndex index;
+  index.Build(state, &record);
+  Writer index_writer;
+  WriteIndex(index, &index_writer);
+  w.Put<uint64_t>(index_writer.buffer_.size());
+  w.buffer_.append(index_writer.buffer_);
+
+  // The built-in pools come first, and aren't written.
+  map<const Pool*, uint32_t> pool_ids;
+  pool_ids[&State::kDefaultPool] = 0;
+  pool_ids[&State::kConsolePool] = 1;
+  w.Put<uint32_t>((uint32_t)state.pools_.size() - 2);
+  for (map<string, Pool*>::const_iterator i = state.pools_.begin();
+       i != state.pools_.end(); ++i) {
+    if (pool_ids.count(i->second))
+      continue;
+    uint32_t id = (uint32_t)pool_ids.size();
+    pool_ids[i->second] = id;
+    w.PutString(i->first);
+    w.Put<int32_t>(i->second->depth());
+    w.Put<int32_t>(i->second->priority());
+    const vector<Pool::Resource>& resources = i->second->resources();
+    w.Put<uint32_t>((uint32_t)resources.size());
+    for (vector<Pool::Resource>::const_iterator r = resources.begin();
+         r != resources.end(); ++r) {
+      w.PutString(r->name);
+      w.Put<int32_t>(r->capacity);
+    }
+    const vector<int>& cpus = i->second->cpus();
+    w.Put<uint32_t>((uint32_t)cpus.size());
+    for (size_t c = 0; c < cpus.size(); ++c)
+      w.Put<int32_t>(cpus[c]);
+    const Pool::CgroupSettings& cgroup = i->second->cgroup();
+    w.Put<uint32_t>((uint32_t)cgroup.size());
+    for (size_t c = 0; c < cgroup.size(); ++c) {
+      w.PutString(cgroup[c].first);
+      w.PutString(cgroup[c].second);
+    }
+  }
+
+  // The scopes the edges use, each after its parent.  The top-level one
+  // comes first.
+  unordered_map<const BindingEnv*, uint32_t> scope_ids;
+  vector<const BindingEnv*> scopes;
+  scope_ids[&state.bindings_] = 0;
+  scopes.push_back(&state.bindings_);
+  for (vector<Edge*>::const_iterator e = state.edges_.begin();
+       e != state.edges_.end(); ++e) {
+    vector<const BindingEnv*> chain;
+    for (const BindingEnv* scope = (*e)->env_;
+         scope && !scope_ids.count(scope); scope = scope->parent_)
+      chain.push_back(scope);
+    for (vector<const BindingEnv*>::reverse_iterator i = chain.rbegin();
+         i != chain.rend(); ++i) {
+      uint32_t id = (uint32_t)scopes.size();
+      scope_ids[*i] = id;
+      scopes.push_back(*i);
+    }
+  }
+
+  map<const Rule*, uint32_t> rule_ids;
+  w.Put<uint32_t>((uint32_t)scopes.size());
+  for (vector<const BindingEnv*>::iterator s = scopes.begin();
+       s != scopes.end(); ++s) {
+    const BindingEnv* scope = *s;
+    w.Put<uint32_t>(scope->parent_ ? scope_ids[scope->parent_] : kNone);
+    w.Put<uint32_t>((uint32_t)scope->bindings_.size());
+    scope->bindings_.ForEach([&](Symbol key, const string& value) {
+      w.PutString(SymbolName(key));
+      w.PutString(value);
+    });
+
+    uint32_t rule_count = 0;
+    for (map<string, const Rule*>::const_iterator r = scope->rules_.begin();
+         r != scope->rules_.end(); ++r)
+      rule_count += r->second != &State::kPhonyRule;
+    w.Put<uint32_t>(rule_count);
+    for (map<string, const Rule*>::const_iterator r = scope->rules_.begin();
+         r != scope->rules_.end(); ++r) {
+      const Rule* rule = r->second;
+      if (rule == &State::kPhonyRule)
+        continue;
+      uint32_t id = (uint32_t)rule_ids.size();
+      rule_ids[rule] = id;
+      w.PutString(rule->name());
+      w.Put<uint32_t>((uint32_t)rule->bindings_.size());
+      rule->bindings_.ForEach([&](Symbol key, const EvalString& value) {
+        w.PutString(SymbolName(key));
+        w.Put<uint32_t>((uint32_t)value.parsed_.size());
+        for (EvalString::TokenList::const_iterator t = value.parsed_.begin();
+             t != value.parsed_.end(); ++t) {
+          w.Put<uint8_t>(t->type == EvalString::SPECIAL);
+          w.PutString(value.TokenText(*t));
+        }
+      });
+    }
+  }
+
+  unordered_map<const Node*, uint32_t> node_ids;
+  w.Put<uint32_t>((uint32_t)state.paths_.size());
+  for (State::Paths::const_iterator i = state.paths_.begin();
+       i != state.paths_.end(); ++i) {
+    const Node* node = i->second;
+    uint32_t id = (uint32_t)node_ids.size();
+    node_ids[node] = id;
+    w.PutString(node->path());
+    w.Put<uint64_t>(node->slash_bits());
+    w.Put<uint8_t>(node->dyndep_pending());
+  }
+
+  w.Put<uint32_t>((uint32_t)state.edges_.size());
+  for (vector<Edge*>::const_iterator e = state.edges_.begin();
+       e != state.edges_.end(); ++e) {
+    const Edge* edge = *e;
+    w.Put<uint32_t>(edge->is_phony() ? kNone : rule_ids[edge->rule_]);
+    w.Put<uint32_t>(pool_ids[edge->pool_]);
+    w.Put<uint32_t>(scope_ids[edge->env_]);
+    w.Put<uint32_t>((uint32_t)edge->outputs_.size());
+    for (vector<Node*>::const_iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o)
+      w.Put<uint32_t>(node_ids[*o]);
+    w.Put<uint32_t>((uint32_t)edge->inputs_.size());
+    for (vector<Node*>::const_iterator i = edge->inputs_.begin();
+         i != edge->inputs_.end(); ++i)
+      w.Put<uint32_t>(node_ids[*i]);
+    w.Put<int32_t>(edge->implicit_outs_);
+    w.Put<int32_t>(edge->implicit_deps_);
+    w.Put<int32_t>(edge->order_only_deps_);
+    w.Put<uint32_t>(edge->dyndep_ ? node_ids[edge->dyndep_] : kNone);
+    w.Put<int32_t>(edge->weight_);
+    w.Put<int32_t>(edge->priority_);
+    w.Put<uint32_t>((uint32_t)edge->resource_use_.size());
+    for (vector<int>::const_iterator u = edge->resource_use_.begin();
+         u != edge->resource_use_.end(); ++u)
+      w.Put<int32_t>(*u);
+  }
+
+  w.Put<uint32_t>((uint32_t)state.defaults_.size());
+  for (vector<Node*>::const_iterator i = state.defaults_.begin();
+       i != state.defaults_.end(); ++i)
+    w.Put<uint32_t>(node_ids[*i]);
+
+  // Write it all under another name first, so that an interrupted write
+  // leaves no truncated cache behind.
+  string temp_path = path + ".tmp";
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    *err = strerror(errno);
+    return false;
+  }
+  CacheHeader header;
+  header.body_size = w.buffer_.size();
+  header.body_hash = Hash64(w.buffer_.data(), w.buffer_.size());
+  if (fwrite(kFileSignature, kFileSignatureSize, 1, f) < 1 ||
+      fwrite(&header, sizeof(header), 1, f) < 1 ||
+      fwrite(w.buffer_.data(), w.buffer_.size(), 1, f) < 1) {
+    *err = strerror(errno);
+    fclose(f);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  if (fclose(f) != 0) {
+    *err = strerror(errno);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+    *err = strerror(errno);
+    return false;
+  }
+  if (rename(temp_path.c_str(), path.c_str()) < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+// static
+LoadStatus ManifestCache::LoadIndex(const string& path,
+                                    const string& manifest,
+                                    const ManifestParserOptions& options,
+                                    DiskInterface* disk_interface,
+                                    ManifestIndex* index, string* err) {
+  METRIC_RECORD(".ninja_manifest load index");
+  MappedFile map;
+  int ret = map.Open(path, err);
+  if (ret == -ENOENT) {
+    err->clear();
+    return LOAD_NOT_FOUND;
+  }
+  if (ret < 0)
+    return LOAD_ERROR;
+
+  Reader r(NULL, 0);
+  ManifestRecord record;
+  if (!OpenBody(map, &r) ||
+      !ReadPreamble(&r, manifest, options, disk_interface, &record))
+    return LOAD_NOT_FOUND;
+  uint64_t size = r.Get<uint64_t>();
+  if (!r.ok_ || (uint64_t)(r.end_ - r.pos_) < size) {
+    *err = "manifest cache is corrupt";
+    return LOAD_ERROR;
+  }
+  const char* end = r.pos_ + size;
+  ReadIndex(&r, index);
+  if (!r.ok_ || r.pos_ != end) {
+    *err = "manifest cache is corrupt";
+    return LOAD_ERROR;
+  }
+  return LOAD_SUCCESS;
+}
+
+// static
+LoadStatus ManifestCache::Load(
+const string& path, const string& manifest,
+                               const ManifestParserOptions& options,
+                               DiskInterface* disk_interface, State* state,
+                               ManifestRecord* record, string* err) {
+  METRIC_RECORD(".ninja_manifest load");
+  TRACE_RECORD(".ninja_manifest load");
+  MappedFile map;
+  int ret = map.Open(path, err);
+  if (ret == -ENOENT) {
+    err->clear();
+    return LOAD_NOT_FOUND;
+  }
+  if (ret < 0)
+    return LOAD_ERROR;
+
+  Reader r(NULL, 0);
+  if (!OpenBody(map, &r) ||
+      !ReadPreamble(&r, manifest, options, disk_interface, record))
+    return LOAD_NOT_FOUND;
+  r.Skip(r.Get<uint64_t>());
+
+  vector<Pool*> pools;
+  pools.push_back(&State::kDefaultPool);
+  pools.push_back(&State::kConsolePool);
+  uint32_t pool_count = r.Get<uint32_t>();
+  for (uint32_t i = 0; i < pool_count && r.ok_; ++i) {
+    string name = r.GetString().AsString();
+    int depth = r.Get<int32_t>();
+    pools.push_back(new Pool(name, depth));
+    pools.back()->set_priority(r.Get<int32_t>());
+    state->AddPool(pools.back());
+    uint32_t resource_count = r.Get<uint32_t>();
+    for (uint32_t j = 0; j < resource_count && r.ok_; ++j) {
+      string resource = r.GetString().AsString();
+      int capacity = r.Get<int32_t>();
+      if (!r.ok_ || pools.back()->LookupResource(resource) >= 0) {
+        r.ok_ = false;
+        break;
+      }
+      pools.back()->AddResource(resource, capacity);
+    }
+    vector<int> cpus;
+    uint32_t cpu_count = r.Get<uint32_t>();
+    for (uint32_t j = 0; j < cpu_count && r.ok_; ++j)
+      cpus.push_back(r.Get<int32_t>());
+    pools.back()->set_cpus(cpus);
+    Pool::CgroupSettings cgroup;
+    uint32_t setting_count = r.Get<uint32_t>();
+    for (uint32_t j = 0; j < setting_count && r.ok_; ++j) {
+      string file = r.GetString().AsString();
+      cgroup.push_back(make_pair(file, r.GetString().AsString()));
+    }
+    pools.back()->set_cgroup(cgroup);
+  }
+
+  vector<BindingEnv*> scopes;
+  vector<const Rule*> rules;
+  uint32_t scope_count = r.Get<uint32_t>();
+  for (uint32_t i = 0; i < scope_count && r.ok_; ++i) {
+    // The top-level scope comes first, without a parent.
+    uint32_t parent = r.GetIndex(i, i == 0);
+    if (!r.ok_)
+      break;
+    BindingEnv* scope = &state->bindings_;
+    if (i > 0)
+      scope = new BindingEnv(scopes[parent]);
+    scopes.push_back(scope);
+
+    uint32_t binding_count = r.Get<uint32_t>();
+    for (uint32_t b = 0; b < binding_count && r.ok_; ++b) {
+      StringPiece key = r.GetString();
+      scope->bindings_[InternSymbol(key)] = r.GetString().AsString();
+    }
+
+    uint32_t rule_count = r.Get<uint32_t>();
+    for (uint32_t j = 0; j < rule_count && r.ok_; ++j) {
+      Rule* rule = new Rule(r.GetString().AsString());
+      uint32_t rule_binding_count = r.Get<uint32_t>();
+      for (uint32_t b = 0; b < rule_binding_count && r.ok_; ++b) {
+        EvalString& value = rule->bindings_[InternSymbol(r.GetString())];
+        uint32_t token_count = r.Get<uint32_t>();
+        for (uint32_t t = 0; t < token_count && r.ok_; ++t) {
+          bool special = r.Get<uint8_t>() != 0;
+          StringPiece text = r.GetString();
+          if (special)
+            value.AddSpecial(text);
+          else
+            value.AddText(text);
+        }
+      }
+      if (!r.ok_ || scope->LookupRuleCurrentScope(rule->name())) {
+        r.ok_ = false;
+        delete rule;
+        break;
+      }
+      scope->AddRule(rule);
+      rules.push_back(rule);
+    }
+  }
+  if (!r.ok_ || scopes.empty()) {
+    *err = "manifest cache is corrupt";
+    return LOAD_ERROR;
+  }
+
+  vector<Node*> nodes;
+  uint32_t node_count = r.Get<uint32_t>();
+  nodes.reserve(node_count);
+  for (uint32_t i = 0; i < node_count && r.ok_; ++i) {
+    StringPiece node_path = r.GetString();
+    uint64_t slash_bits = r.Get<uint64_t>();
+    bool dyndep_pending = r.Get<uint8_t>() != 0;
+    Node* node = state->GetNode(node_path, slash_bits);
+    node->set_dyndep_pending(dyndep_pending);
+    nodes.push_back(node);
+  }
+
+  uint32_t edge_count = r.Get<uint32_t>();
+  state->edges_.reserve(edge_count);
+  for (uint32_t i = 0; i < edge_count && r.ok_; ++i) {
+    uint32_t rule = r.GetIndex(rules.size(), true);
+    uint32_t pool = r.GetIndex(pools.size());
+    uint32_t scope = r.GetIndex(scopes.size());
+    if (!r.ok_)
+      break;
+    Edge* edge =
+        state->AddEdge(rule == kNone ? &State::kPhonyRule : rules[rule]);
+    edge->pool_ = pools[pool];
+    edge->env_ = scopes[scope];
+    uint32_t output_count = r.Get<uint32_t>();
+    for (uint32_t o = 0; o < output_count && r.ok_; ++o) {
+      uint32_t node = r.GetIndex(nodes.size());
+      if (!r.ok_ || nodes[node]->in_edge()) {
+        r.ok_ = false;
+        break;
+      }
+      edge->outputs_.push_back(nodes[node]);
+      nodes[node]->set_in_edge(edge);
+    }
+    uint32_t input_count = r.Get<uint32_t>();
+    for (uint32_t n = 0; n < input_count && r.ok_; ++n) {
+      uint32_t node = r.GetIndex(nodes.size());
+      if (!r.ok_)
+        break;
+      edge->inputs_.push_back(nodes[node]);
+      nodes[node]->AddOutEdge(edge);
+    }
+    edge->implicit_outs_ = r.Get<int32_t>();
+    edge->implicit_deps_ = r.Get<int32_t>();
+    edge->order_only_deps_ = r.Get<int32_t>();
+    uint32_t dyndep = r.GetIndex(nodes.size(), true);
+    if (r.ok_ && dyndep != kNone)
+      edge->dyndep_ = nodes[dyndep];
+    edge->weight_ = r.Get<int32_t>();
+    edge->priority_ = r.Get<int32_t>();
+    uint32_t use_count = r.Get<uint32_t>();
+    if (use_count > edge->pool_->resources().size())
+      r.ok_ = false;
+    for (uint32_t u = 0; u < use_count && r.ok_; ++u)
+      edge->resource_use_.push_back(r.Get<int32_t>());
+    if (edge->implicit_outs_ < 0 ||
+        (size_t)edge->implicit_outs_ > edge->outputs_.size() ||
+        edge->implicit_deps_ < 0 || edge->order_only_deps_ < 0 ||
+        (size_t)(edge->implicit_deps_ + edge->order_only_deps_) >
+            edge->inputs_.size())
+      r.ok_ = false;
+  }
+
+  uint32_t default_count = r.Get<uint32_t>();
+  for (uint32_t i = 0; i < default_count && r.ok_; ++i) {
+    uint32_t node = r.GetIndex(nodes.size());
+    if (r.ok_)
+      state->defaults_.push_back(nodes[node]);
+  }
+
+  if (!r.ok_ || r.pos_ != r.end_) {
+    *err = "manifest cache is corrupt";
+    return LOAD_ERROR;
+  }
+  return LOAD_SUCCESS;
+}
@@ -0,0 +1,133 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_MANIFEST_CACHE_H_
+#define NINJA_MANIFEST_CACHE_H_
+
+#include <stdint.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "load_status.h"
+#include "manifest_parser.h"
+
+struct DiskInterface;
+struct State;
+
+/// ManifestCache saves the State parsed from a manifest (.ninja_manifest),
+/// so that later runs restore it without lexing or parsing anything while
+/// the files of the manifest stay the same.
+///
+/// The cache holds the nodes, the edges, the scopes with their bindings,
+/// the rules with their unevaluated bindings, the pools and the defaults,
+/// along with the path, mtime, size and hash of every file parsed.  Files
+/// with another mtime are read again and compared by size and hash.
+/// What "ninja -t targets" and "ninja -t rules" list, saved along with the
+/// manifest cache so that they can answer without restoring the graph.
+struct ManifestIndex {
+  /// Fill from the graph of |state|, and from |record| the files that
+  /// declare each edge, if it holds them all.
+  void Build(const State& state, const ManifestRecord* record = NULL);
+
+  /// The names of the rules the edges use.
+  std::vector<std::string> rule_names;
+
+  struct Output {
+    std::string path;
+    /// The index of its rule in |rule_names|.
+    uint32_t rule;
+  };
+  /// The outputs of all edges, in manifest order.
+  std::vector<Output> outputs;
+  /// For each of |rule_names|, the indexes in |outputs| of its outputs,
+  /// sorted by path.
+  std::vector<std::vector<uint32_t> > outputs_by_rule;
+  /// The indexes in |outputs| of the root nodes, or why there are none.
+  std::vector<uint32_t> roots;
+  std::string roots_error;
+
+  struct RuleInfo {
+    std::string name;
+    bool has_description;
+    std::string description;
+  };
+  /// The rules of the top-level scope, by name.
+  std::vector<RuleInfo> rules;
+
+  /// A file with a scope of its own: the manifest or a subninja.
+  struct Subninja {
+    /// As its subninja statement names it; empty for the manifest.
+    std::string path;
+    /// The index in |subninjas| of the file naming it; ~0u for the
+    /// manifest.
+    uint32_t parent;
+    /// Whether it declares pools, which the edges of any file may use.
+    bool declares_pools;
+  };
+  /// The manifest, then the subninjas, each after the file naming it, or
+  /// nothing if the parse wasn't recorded.
+  std::vector<Subninja> subninjas;
+  /// For each of |outputs|, if there are |subninjas|, the index there of
+  /// its file, and the indexes in |outputs| of the inputs of its edge that
+  /// are outputs too.
+  std::vector<uint32_t> output_subninjas;
+  std::vector<std::vector<uint32_t> > output_inputs;
+
+  /// Collect in |paths| the subninjas a build of |targets| needs, after
+  /// that of |manifest| if it is an output: those declaring the edges it
+  /// may run, the files naming them, and those declaring pools.  What the
+  /// edges only find they read at build time, through depfiles or dyndep
+  /// files, isn't known here.
+  /// @return false if the index has no subninjas to tell, or one of
+  /// |targets| is no output.
+  bool SubninjasFor(const std::vector<std::string>& targets,
+                    const std::string& manifest,
+                    std::set<std::string>* paths) const;
+};
+
+struct ManifestCache {
+  /// Where ninja keeps the cache, in the directory it runs in.
+  static const char kPath[];
+
+  /// Restore into the empty |state| the cache at |path|, if it was saved
+  /// for |manifest| parsed with |options| and its files are unchanged.
+  /// The files are listed in |record|.
+  /// @return LOAD_NOT_FOUND if there's no such cache, or it is out of date
+  /// or fails its checksum; LOAD_ERROR if it can't be read or doesn't match
+  /// itself, leaving |state| half restored.
+  static LoadStatus Load(const std::string& path, const std::string& manifest,
+                         const ManifestParserOptions& options,
+                         DiskInterface* disk_interface, State* state,
+                         ManifestRecord* record, std::string* err);
+
+  /// Read only the index of the cache at |path|, if it is up to date as
+  /// Load() requires.
+  /// @return LOAD_NOT_FOUND if there's no such cache, or it is out of date;
+  /// LOAD_ERROR if it can't be read or doesn't match itself.
+  static LoadStatus LoadIndex(const std::string& path,
+                              const std::string& manifest,
+                              const ManifestParserOptions& options,
+                              DiskInterface* disk_interface,
+                              ManifestIndex* index, std::string* err);
+
+  /// Save |state|, just parsed from |manifest| with |options| into
+  /// |record|, to |path|, with its index.
+  static bool Save(const std::string& path, const std::string& manifest,
+                   const ManifestParserOptions& options, const State& state,
+                   const ManifestRecord& record, std::string* err);
+};
+
+#endif  // NINJA_MANIFEST_CACHE_H_
@@ -0,0 +1,362 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest_cache.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "graph.h"
+#include "state.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+const char kTestFilename[] = "ManifestCacheTest-tempfile";
+
+struct ManifestCacheTest : public testing::Test {
+  virtual void SetUp() {
+    // In case a crashing test left a stale file behind.
+    unlink(kTestFilename);
+    fs_.Create("build.ninja",
+"rule echo\n"
+"  command = echo $var $in > $out\n"
+"  description = ECHO $out\n"
+"var = outer\n"
+"pool link\n"
+"  depth = 2\n"
+"  priority = 3\n"
+"  resources = memory=8\n"
+"  cpus = 0-1,4\n"
+"  cgroup = memory.max=4G\n"
+"include rules.ninja\n"
+"subninja a.ninja\n"
+"var = changed\n"
+"build top: echo a1 b1 | c1 || order\n"
+"  pool = link\n"
+"  pool_weight = 2\n"
+"  pool_resources = memory=6\n"
+"build order: phony\n"
+"default top\n");
+    fs_.Create("rules.ninja",
+"rule copy\n"
+"  command = cp $in $out\n"
+"  dyndep = $out.dd\n");
+    fs_.Create("a.ninja",
+"var = a\n"
+"build a1 a_$var: echo src/a.c\n"
+"build b1: copy a1 || b1.dd\n"
+"  dyndep = b1.dd\n"
+"  pool = console\n"
+"build c1: echo\n"
+"  var = edge\n"
+"default a1\n");
+    fs_.Create("b1.dd", "");
+    Parse(&state_, &record_);
+  }
+  virtual void TearDown() {
+    unlink(kTestFilename);
+  }
+
+  void Parse(State* state, ManifestRecord* record) {
+    ManifestParser parser(state, &fs_, options_);
+    parser.set_record(record);
+    string err;
+    EXPECT_TRUE(parser.Load("build.ninja", &err));
+    ASSERT_EQ("", err);
+    record->Stat(&fs_);
+  }
+
+  void Save() {
+    string err;
+    EXPECT_TRUE(ManifestCache::Save(kTestFilename, "build.ninja", options_,
+                                    state_, record_, &err));
+    ASSERT_EQ("", err);
+  }
+
+  LoadStatus Load(State* state, const string& manifest = "build.ninja") {
+    ManifestRecord record;
+    string err;
+    LoadStatus status = ManifestCache::Load(
+        kTestFilename, manifest, options_, &fs_, state, &record, &err);
+    EXPECT_EQ("", err);
+    return status;
+  }
+
+  static string Join(const set<string>& paths) {
+    string result;
+    for (set<string>::const_iterator i = paths.begin(); i != paths.end();
+         ++i)
+      result += (result.empty() ? "" : " ") + *i;
+    return result;
+  }
+
+  static string Describe(State& state) {
+    string result;
+    for (vector<Edge*>::iterator e = state.edges_.begin();
+         e != state.edges_.end(); ++e) {
+      result += (*e)->EvaluateCommand() + " [" +
+                (*e)->GetBinding("description") + "] |";
+      for (vector<Node*>::iterator n = (*e)->outputs_.begin();
+           n != (*e)->outputs_.end(); ++n)
+        result += " " + (*n)->path();
+      result += " <-";
+      for (vector<Node*>::iterator n = (*e)->inputs_.begin();
+           n != (*e)->inputs_.end(); ++n)
+        result += " " + (*n)->path();
+      char counts[32];
+      snprintf(counts, sizeof(counts), " %d/%d/%d", (*e)->implicit_deps_,
+               (*e)->order_only_deps_, (*e)->implicit_outs_);
+      result += counts;
+      result += " pool=" + (*e)->pool()->name();
+      snprintf(counts, sizeof(counts), " weight=%d priority=%d",
+               (*e)->weight(), (*e)->priority());
+      result += counts;
+      for (size_t i = 0; i < (*e)->resource_use_.size(); ++i) {
+        snprintf(counts, sizeof(counts), " %s=%d",
+                 (*e)->pool()->resources()[i].name.c_str(),
+                 (*e)->resource_use_[i]);
+        result += counts;
+      }
+      if ((*e)->dyndep_)
+        result += " dyndep=" + (*e)->dyndep_->path();
+      result += "\n";
+    }
+    vector<Node*> defaults = state.DefaultNodes(NULL);
+    for (vector<Node*>::iterator n = defaults.begin(); n != defaults.end();
+         ++n)
+      result += "default " + (*n)->path() + "\n";
+    return result;
+  }
+
+  VirtualFileSystem fs_;
+  ManifestParserOptions options_;
+  State state_;
+  ManifestRecord record_;
+};
+
+TEST_F(ManifestCacheTest, RoundTrip) {
+  ASSERT_NO_FATAL_FAILURE(Save());
+  State state;
+  fs_.files_read_.clear();
+  EXPECT_EQ(LOAD_SUCCESS, Load(&state));
+  EXPECT_TRUE(fs_.files_read_.empty());
+
+  EXPECT_EQ(Describe(state_), Describe(state));
+  VerifyGraph(state);
+  ASSERT_TRUE(state.LookupPool("link"));
+  EXPECT_EQ(2, state.LookupPool("link")->depth());
+  EXPECT_EQ(3, state.LookupPool("link")->priority());
+  ASSERT_EQ(1u, state.LookupPool("link")->resources().size());
+  EXPECT_EQ(8, state.LookupPool("link")->resources()[0].capacity);
+  ASSERT_EQ(3u, state.LookupPool("link")->cpus().size());
+  EXPECT_EQ(4, state.LookupPool("link")->cpus()[2]);
+  ASSERT_EQ(1u, state.LookupPool("link")->cgroup().size());
+  EXPECT_EQ("4G", state.LookupPool("link")->cgroup()[0].second);
+  EXPECT_EQ(2, state.LookupNode("top")->in_edge()->weight());
+  EXPECT_EQ(3, state.LookupNode("top")->in_edge()->priority());
+  EXPECT_TRUE(state.LookupNode("a_a"));
+  EXPECT_TRUE(state.LookupNode("b1.dd")->dyndep_pending());
+  // Rules evaluate their bindings lazily, in the restored scopes.
+  EXPECT_EQ("cp a1 b1", state.LookupNode("b1")->in_edge()->EvaluateCommand());
+  EXPECT_EQ("b1.dd",
+            state.LookupNode("b1")->in_edge()->GetUnescapedDyndep());
+  EXPECT_EQ("changed", state.bindings_.LookupVariable("var"));
+}
+
+TEST_F(ManifestCacheTest, ChangedFiles) {
+  ASSERT_NO_FATAL_FAILURE(Save());
+
+  // A newer file with the same contents still hits.
+  fs_.Tick();
+  fs_.Create("a.ninja", fs_.files_["a.ninja"].contents);
+  {
+    State state;
+    EXPECT_EQ(LOAD_SUCCESS, Load(&state));
+  }
+
+  fs_.Create("rules.ninja", "rule copy\n  command = ln $in $out\n");
+  State state;
+  EXPECT_EQ(LOAD_NOT_FOUND, Load(&state));
+  EXPECT_TRUE(state.edges_.empty());
+}
+
+TEST_F(ManifestCacheTest, OtherManifestOrOptions) {
+  ASSERT_NO_FATAL_FAILURE(Save());
+  {
+    State state;
+    EXPECT_EQ(LOAD_NOT_FOUND, Load(&state, "other.ninja"));
+  }
+  options_.dupe_edge_action_ = kDupeEdgeActionError;
+  State state;
+  EXPECT_EQ(LOAD_NOT_FOUND, Load(&state));
+}
+
+TEST_F(ManifestCacheTest, Index) {
+  ASSERT_NO_FATAL_FAILURE(Save());
+  ManifestIndex index;
+  string err;
+  EXPECT_EQ(LOAD_SUCCESS,
+            ManifestCache::LoadIndex(kTestFilename, "build.ninja", options_,
+                                     &fs_, &index, &err));
+  EXPECT_EQ("", err);
+
+  string outputs;
+  for (size_t i = 0; i < index.outputs.size(); ++i) {
+    outputs += index.outputs[i].path + ": " +
+               index.rule_names[index.outputs[i].rule] + "\n";
+  }
+  EXPECT_EQ("a1: echo\n"
+            "a_a: echo\n"
+            "b1: copy\n"
+            "c1: echo\n"
+            "top: echo\n"
+            "order: phony\n",
+            outputs);
+
+  ASSERT_EQ(3u, index.outputs_by_rule.size());
+  ASSERT_EQ("echo", index.rule_names[0]);
+  const vector<uint32_t>& echo = index.outputs_by_rule[0];
+  ASSERT_EQ(4u, echo.size());
+  EXPECT_EQ("a1", index.outputs[echo[0]].path);
+  EXPECT_EQ("a_a", index.outputs[echo[1]].path);
+  EXPECT_EQ("c1", index.outputs[echo[2]].path);
+  EXPECT_EQ("top", index.outputs[echo[3]].path);
+
+  ASSERT_EQ(2u, index.roots.size());
+  EXPECT_EQ("a_a", index.outputs[index.roots[0]].path);
+  EXPECT_EQ("top", index.outputs[index.roots[1]].path);
+  EXPECT_EQ("", index.roots_error);
+
+  // The top-level rules, with phony.
+  ASSERT_EQ(3u, index.rules.size());
+  EXPECT_EQ("copy", index.rules[0].name);
+  EXPECT_FALSE(index.rules[0].has_description);
+  EXPECT_EQ("echo", index.rules[1].name);
+  EXPECT_EQ("ECHO ${out}", index.rules[1].description);
+  EXPECT_EQ("phony", index.rules[2].name);
+
+  // The files of the outputs, and what they read.
+  ASSERT_EQ(2u, index.subninjas.size());
+  EXPECT_EQ("", index.subninjas[0].path);
+  EXPECT_EQ(~0u, index.subninjas[0].parent);
+  EXPECT_TRUE(index.subninjas[0].declares_pools);
+  EXPECT_EQ("a.ninja", index.subninjas[1].path);
+  EXPECT_EQ(0u, index.subninjas[1].parent);
+  EXPECT_FALSE(index.subninjas[1].declares_pools);
+  ASSERT_EQ(index.outputs.size(), index.output_subninjas.size());
+  EXPECT_EQ(1u, index.output_subninjas[0]);
+  EXPECT_EQ(0u, index.output_subninjas[4]);
+  // top reads a1, b1, c1 and order.
+  ASSERT_EQ(index.outputs.size(), index.output_inputs.size());
+  ASSERT_EQ(4u, index.output_inputs[4].size());
+  EXPECT_EQ("a1", index.outputs[index.output_inputs[4][0]].path);
+  EXPECT_EQ("order", index.outputs[index.output_inputs[4][3]].path);
+
+  // It's as out of date as the rest of the cache.
+  fs_.Tick();
+  fs_.Create("rules.ninja", "rule copy\n  command = ln $in $out\n");
+  ManifestIndex stale;
+  EXPECT_EQ(LOAD_NOT_FOUND,
+            ManifestCache::LoadIndex(kTestFilename, "build.ninja", options_,
+                                     &fs_, &stale, &err));
+}
+
+TEST_F(ManifestCacheTest, SubninjasFor) {
+  fs_.Create("build.ninja",
+"rule echo\n"
+"  command = echo $in > $out\n"
+"subninja a.ninja\n"
+"subninja b.ninja\n"
+"subninja c.ninja\n"
+"subninja d.ninja\n"
+"build all: phony a_out b_out d_out\n");
+  fs_.Create("a.ninja",
+"build a_out: echo a.c\n"
+"subninja lib.ninja\n");
+  fs_.Create("lib.ninja", "build lib_out: echo lib.c\n");
+  fs_.Create("b.ninja", "build b_out: echo lib_out\n");
+  fs_.Create("c.ninja", "pool one\n  depth = 1\n");
+  fs_.Create("d.ninja", "build d_out: echo d.c\n  pool = one\n");
+  State full;
+  ManifestRecord record;
+  ASSERT_NO_FATAL_FAILURE(Parse(&full, &record));
+  string err;
+  EXPECT_TRUE(ManifestCache::Save(kTestFilename, "build.ninja", options_,
+                                  full, record, &err));
+  ManifestIndex index;
+  ASSERT_EQ(LOAD_SUCCESS,
+            ManifestCache::LoadIndex(kTestFilename, "build.ninja", options_,
+                                     &fs_, &index, &err));
+
+  // b_out reads what lib.ninja writes, which needs the scope of a.ninja;
+  // c.ninja declares a pool.  The edges of the manifest don't need the
+  // targets of theirs that aren't built.
+  set<string> paths;
+  EXPECT_TRUE(index.SubninjasFor(vector<string>(1, "b_out"), "build.ninja",
+                                 &paths));
+  EXPECT_EQ("a.ninja b.ninja c.ninja lib.ninja", Join(paths));
+  paths.clear();
+  EXPECT_TRUE(index.SubninjasFor(vector<string>(1, "a_out"), "build.ninja",
+                                 &paths));
+  EXPECT_EQ("a.ninja c.ninja", Join(paths));
+  paths.clear();
+  EXPECT_TRUE(index.SubninjasFor(vector<string>(1, "all"), "build.ninja",
+                                 &paths));
+  EXPECT_EQ("a.ninja b.ninja c.ninja d.ninja lib.ninja", Join(paths));
+
+  // Unknown targets need the whole manifest.
+  EXPECT_FALSE(index.SubninjasFor(vector<string>(1, "a.c"), "build.ninja",
+                                  &paths));
+
+  // Loading only those gives the edges the targets need.
+  paths.clear();
+  EXPECT_TRUE(index.SubninjasFor(vector<string>(1, "b_out"), "build.ninja",
+                                 &paths));
+  options_.subninjas_ = &paths;
+  State partial;
+  ManifestRecord partial_record;
+  ASSERT_NO_FATAL_FAILURE(Parse(&partial, &partial_record));
+  EXPECT_TRUE(partial.LookupNode("b_out")->in_edge());
+  EXPECT_TRUE(partial.LookupNode("lib_out")->in_edge());
+  EXPECT_FALSE(partial.LookupNode("d_out")->in_edge());
+  EXPECT_EQ(4u, partial.edges_.size());
+}
+
+TEST_F(ManifestCacheTest, Missing) {
+  State state;
+  EXPECT_EQ(LOAD_NOT_FOUND, Load(&state));
+}
+
+TEST_F(ManifestCacheTest, Corrupt) {
+  ASSERT_NO_FATAL_FAILURE(Save());
+  RealDiskInterface disk_interface;
+  string contents, err;
+  ASSERT_EQ(FileReader::Okay,
+            disk_interface.ReadFile(kTestFilename, &contents, &err));
+  contents[contents.size() - 1] ^= 1;
+  ASSERT_TRUE(disk_interface.WriteFile(kTestFilename, contents));
+
+  // A cache failing its checksum is parsed over again.
+  State state;
+  EXPECT_EQ(LOAD_NOT_FOUND, Load(&state));
+  EXPECT_TRUE(state.edges_.empty());
+}
+
+}  // anonymous namespace
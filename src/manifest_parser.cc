@@ -16,23 +16,394 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+
+#include <deque>
+#include <set>
 #include <vector>
 
+#include "disk_interface.h"
 #include "graph.h"
+#include "manifest_stats.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "parallel.h"
 #include "state.h"
+#include "trace.h"
 #include "util.h"
 #include "version.h"
 
 using namespace std;
 
+/// A change to the State, recorded while parsing in parallel.
+struct ManifestParser::Action {
+  enum Type {
+    /// Check that pool |name| is new, then add it unless |depth| is -1
+    /// (because parsing the declaration failed).
+    kPool,
+    /// Add target |name| to the defaults.
+    kDefault,
+    /// Add |edge|.
+    kEdge,
+    /// Apply the actions of subninja |file|.
+    kSubninja,
+    /// Stop with error message |name|.
+    kError,
+  };
+
+  explicit Action(Type type)
+      : type(type), depth(-1), priority(0), file(NULL) {}
+
+  Type type;
+  /// Positioned as when the action would have been applied right away.
+  Lexer lexer;
+  std::string name;
+  int depth;
+  /// The priority of pool |name|.
+  int priority;
+  /// The resources of pool |name|.
+  vector<pair<string, int> > resources;
+  /// The CPUs of pool |name|.
+  vector<int> cpus;
+  /// The cgroup settings of pool |name|.
+  Pool::CgroupSettings cgroup;
+  ParsedEdge edge;
+  FileActions* file;
+};
+
+/// The actions recorded for the main manifest or one subninja.
+struct ManifestParser::FileActions {
+  FileActions()
+      : scope(NULL), parent_scope(NULL), snapshot(NULL), record(NULL) {}
+  ~FileActions() {
+    for (vector<Action>::iterator i = actions.begin(); i != actions.end(); ++i)
+      delete i->file;
+  }
+
+  void AddError(const string& err) {
+    actions.push_back(Action(Action::kError));
+    actions.back().name = err;
+  }
+
+  /// The subninja file name.
+  string filename;
+  /// Names and contents of the files parsed, referred to by the lexers.
+  deque<string> names;
+  deque<MappedFile> inputs;
+  vector<Action> actions;
+  /// The scope of the subninja and its real parent.  While parsing, the
+  /// parent of |scope| is |snapshot|, a copy of |parent_scope| as it was at
+  /// the subninja statement.
+  BindingEnv* scope;
+  BindingEnv* parent_scope;
+  BindingEnv* snapshot;
+  /// Positioned at the subninja statement, for errors reading the file.
+  Lexer parent_lexer;
+  /// Where to record what the file adds, if anywhere.
+  ManifestRecord* record;
+};
+
+namespace {
+
+/// Parse a non-negative integer taking all of |s|, or return -1.
+int ParseCount(const string& s) {
+  if (s.empty() || s.size() > 9 ||
+      s.find_first_not_of("0123456789") != string::npos)
+    return -1;
+  return atoi(s.c_str());
+}
+
+/// Parse a priority, an integer taking all of |s| that may be negative.
+bool ParsePriority(const string& s, int* priority) {
+  bool negative = !s.empty() && s[0] == '-';
+  int magnitude = ParseCount(negative ? s.substr(1) : s);
+  if (magnitude < 0)
+    return false;
+  *priority = negative ? -magnitude : magnitude;
+  return true;
+}
+
+/// Parse |value|, a list of resources and amounts separated by commas or
+/// spaces such as "memory_gb=4, cpus=8", into |amounts|.
+bool ParseAmounts(const string& value, vector<pair<string, int> >* amounts,
+                  string* err) {
+  const char kSeparators[] = ", \t";
+  size_t pos = value.find_first_not_of(kSeparators);
+  while (pos != string::npos) {
+    size_t end = value.find_first_of(kSeparators, pos);
+    string item = value.substr(pos, end == string::npos ? end : end - pos);
+    size_t equals = item.find('=');
+    int amount = -1;
+    if (equals != string::npos && equals != 0)
+      amount = ParseCount(item.substr(equals + 1));
+    if (amount < 0) {
+      *err = "expected 'name=amount', got '" + item + "'";
+      return false;
+    }
+    string name = item.substr(0, equals);
+    for (size_t i = 0; i < amounts->size(); ++i) {
+      if ((*amounts)[i].first == name) {
+        *err = "duplicate resource '" + name + "'";
+        return false;
+      }
+    }
+    amounts->push_back(make_pair(name, amount));
+    pos = value.find_first_not_of(kSeparators, end);
+  }
+  return true;
+}
+
+/// Parse |value|, a list of cgroup interface files and the values to
+/// write to them separated by commas or spaces such as
+/// "memory.max=4G cpu.weight=50", into |settings|.
+bool ParseCgroupSettings(const string& value, Pool::CgroupSettings* settings,
+                         string* err) {
+  const char kSeparators[] = ", \t";
+  size_t pos = value.find_first_not_of(kSeparators);
+  while (pos != string::npos) {
+    size_t end = value.find_first_of(kSeparators, pos);
+    string item = value.substr(pos, end == string::npos ? end : end - pos);
+    size_t equals = item.find('=');
+    // The files of controllers are named "controller.setting".
+    if (equals == string::npos || equals + 1 == item.size() ||
+        item.find('.') > equals ||
+        item.find_first_not_of("abcdefghijklmnopqrstuvwxyz._") < equals) {
+      *err = "expected 'controller.file=value', got '" + item + "'";
+      return false;
+    }
+    settings->push_back(make_pair(item.substr(0, equals),
+                                  item.substr(equals + 1)));
+    pos = value.find_first_not_of(kSeparators, end);
+  }
+  return true;
+}
+
+/// Add the chain of records from |parents|.front(), the manifest, to each
+/// subninja below |parents|.back() whose files changed to |changed|.
+void FindChanged(vector<ManifestRecord*>* parents,
+                 DiskInterface* disk_interface,
+                 vector<vector<ManifestRecord*> >* changed) {
+  const vector<ManifestRecord*>& subninjas = parents->back()->subninjas;
+  for (vector<ManifestRecord*>::const_iterator i = subninjas.begin();
+       i != subninjas.end(); ++i) {
+    parents->push_back(*i);
+    if ((*i)->Changed(disk_interface))
+      changed->push_back(*parents);
+    else
+      FindChanged(parents, disk_interface, changed);
+    parents->pop_back();
+  }
+}
+
+bool AddedPools(const ManifestRecord* record) {
+  if (record->added_pools)
+    return true;
+  for (vector<ManifestRecord*>::const_iterator i = record->subninjas.begin();
+       i != record->subninjas.end(); ++i) {
+    if (AddedPools(*i))
+      return true;
+  }
+  return false;
+}
+
+/// Collect what |record| and its subninjas added to the State.
+void CollectAdded(const ManifestRecord* record, set<Edge*>* edges,
+                  vector<Node*>* defaults) {
+  edges->insert(record->edges.begin(), record->edges.end());
+  defaults->insert(defaults->end(), record->defaults.begin(),
+                   record->defaults.end());
+  for (vector<ManifestRecord*>::const_iterator i = record->subninjas.begin();
+       i != record->subninjas.end(); ++i)
+    CollectAdded(*i, edges, defaults);
+}
+
+}  // anonymous namespace
+
+ManifestRecord::~ManifestRecord() {
+  for (vector<ManifestRecord*>::iterator i = subninjas.begin();
+       i != subninjas.end(); ++i)
+    delete *i;
+  delete snapshot;
+}
+
+void ManifestRecord::Stat(DiskInterface* disk_interface) {
+  for (vector<File>::iterator i = files.begin(); i != files.end(); ++i) {
+    string err;
+    i->mtime = disk_interface->Stat(i->path, &err);
+  }
+  for (vector<ManifestRecord*>::iterator i = subninjas.begin();
+       i != subninjas.end(); ++i)
+    (*i)->Stat(disk_interface);
+}
+
+bool ManifestRecord::Changed(DiskInterface* disk_interface) {
+  for (vector<File>::iterator i = files.begin(); i != files.end(); ++i) {
+    string err;
+    TimeStamp mtime = disk_interface->Stat(i->path, &err);
+    if (mtime > 0 && mtime == i->mtime)
+      continue;
+    string contents;
+    if (disk_interface->ReadFile(i->path, &contents, &err) !=
+            DiskInterface::Okay ||
+        contents.size() != i->size ||
+        Hash64(contents.data(), contents.size()) != i->digest)
+      return true;
+    i->mtime = mtime;
+  }
+  return false;
+}
+
+bool ManifestRecord::AnyChanged(DiskInterface* disk_interface) {
+  if (Changed(disk_interface))
+    return true;
+  for (vector<ManifestRecord*>::iterator i = subninjas.begin();
+       i != subninjas.end(); ++i) {
+    if ((*i)->AnyChanged(disk_interface))
+      return true;
+  }
+  return false;
+}
+
+void ManifestRecord::CollectFiles(vector<const File*>* all_files) const {
+  for (vector<File>::const_iterator i = files.begin(); i != files.end(); ++i)
+    all_files->push_back(&*i);
+  for (vector<ManifestRecord*>::const_iterator i = subninjas.begin();
+       i != subninjas.end(); ++i)
+    (*i)->CollectFiles(all_files);
+}
+
+size_t ManifestRecord::EdgeCount() const {
+  size_t count = edges.size();
+  for (vector<ManifestRecord*>::const_iterator i = subninjas.begin();
+       i != subninjas.end(); ++i)
+    count += (*i)->EdgeCount();
+  return count;
+}
+
 ManifestParser::ManifestParser(State* state, FileReader* file_reader,
                                ManifestParserOptions options)
     : Parser(state, file_reader),
-      options_(options), quiet_(false) {
+      options_(options), quiet_(false), actions_(NULL), tasks_(NULL),
+      record_(NULL) {
   env_ = &state->bindings_;
 }
 
-bool ManifestParser::Parse(const string& filename, const string& input,
+bool ManifestParser::Load(const string& filename, string* err,
+                          Lexer* parent) {
+  if (actions_) {
+    TRACE_RECORD(".ninja parse");
+    // Keep the input around for the errors of the recorded actions.
+    actions_->names.push_back(filename);
+    const string& name = actions_->names.back();
+    actions_->inputs.emplace_back();
+    MappedFile* input = &actions_->inputs.back();
+    if (!ReadInput(name, input, err, parent))
+      return false;
+    StringPiece contents(input->data(), input->size());
+    RecordFile(name, contents);
+    return Parse(name, contents, err);
+  }
+
+  // Metrics aren't synchronized, so -d stats and -d manifest parse in
+  // order.
+  if (!options_.parallel_subninjas_ || g_metrics || g_manifest_stats) {
+    METRIC_RECORD(".ninja parse");
+    TRACE_RECORD(".ninja parse");
+    MappedFile input;
+    if (!ReadInput(filename, &input, err, parent))
+      return false;
+    StringPiece contents(input.data(), input.size());
+    RecordFile(filename, contents);
+    if (!g_manifest_stats)
+      return Parse(filename, contents, err);
+    g_manifest_stats->StartFile(filename, contents.size());
+    bool success = Parse(filename, contents, err);
+    g_manifest_stats->EndFile();
+    return success;
+  }
+
+  // Record what every file does to the State, spreading the subninjas over
+  // threads, then apply it all in the order of a sequential parse.
+  FileActions root;
+  root.record = record_;
+  {
+    TaskGroup tasks(GetProcessorCount());
+    actions_ = &root;
+    tasks_ = &tasks;
+    string parse_err;
+    if (!Load(filename, &parse_err, parent))
+      root.AddError(parse_err);
+    tasks.Wait();
+  }
+  actions_ = NULL;
+  tasks_ = NULL;
+
+  bool success;
+  {
+    TRACE_RECORD("apply manifest");
+    success = ApplyActions(&root, err);
+  }
+  FinishActions(&root);
+  return success;
+}
+
+void ManifestParser::ParseSubninjaTask(FileActions* file) {
+  env_ = file->scope;
+  actions_ = file;
+  record_ = file->record;
+  string err;
+  if (!Load(file->filename, &err, &file->parent_lexer))
+    file->AddError(err);
+}
+
+bool ManifestParser::ApplyActions(FileActions* file, string* err) {
+  ManifestRecord* parent_record = record_;
+  record_ = file->record;
+  for (vector<Action>::iterator i = file->actions.begin();
+       i != file->actions.end(); ++i) {
+    switch (i->type) {
+    case Action::kPool:
+      if (!CheckPool(i->name, &i->lexer, err))
+        return false;
+      if (i->depth >= 0)
+        AddPool(i->name, i->depth, i->priority, i->resources, i->cpus,
+                i->cgroup);
+      break;
+    case Action::kDefault:
+      if (!AddDefault(i->name, &i->lexer, err))
+        return false;
+      break;
+    case Action::kEdge:
+      if (!AddEdge(&i->edge, &i->lexer, err))
+        return false;
+      break;
+    case Action::kSubninja:
+      if (!ApplyActions(i->file, err))
+        return false;
+      break;
+    case Action::kError:
+      *err = i->name;
+      return false;
+    }
+  }
+  record_ = parent_record;
+  return true;
+}
+
+// static
+void ManifestParser::FinishActions(FileActions* file) {
+  for (vector<Action>::iterator i = file->actions.begin();
+       i != file->actions.end(); ++i) {
+    if (i->type == Action::kSubninja)
+      FinishActions(i->file);
+  }
+  if (file->scope) {
+    file->scope->set_parent(file->parent_scope);
+    delete file->snapshot;
+    file->snapshot = NULL;
+  }
+}
+
+bool ManifestParser::Parse(const string& filename, StringPiece input,
                            string* err) {
   lexer_.Start(filename, input);
 
@@ -67,6 +438,8 @@ bool ManifestParser::Parse(const string& filename, const string& input,
       if (name == "ninja_required_version")
         CheckNinjaVersion(value);
       env_->AddBinding(name, value);
+      if (g_manifest_stats)
+        g_manifest_stats->AddBinding();
       break;
     }
     case Lexer::INCLUDE:
@@ -101,10 +474,21 @@ bool ManifestParser::ParsePool(string* err) {
   if (!ExpectToken(Lexer::NEWLINE, err))
     return false;
 
-  if (state_->LookupPool(name) != NULL)
-    return lexer_.Error("duplicate pool '" + name + "'", err);
+  size_t action = 0;
+  if (actions_) {
+    action = actions_->actions.size();
+    actions_->actions.push_back(Action(Action::kPool));
+    actions_->actions.back().lexer = lexer_;
+    actions_->actions.back().name = name;
+  } else if (!CheckPool(name, &lexer_, err)) {
+    return false;
+  }
 
   int depth = -1;
+  int priority = 0;
+  vector<pair<string, int> > resources;
+  vector<int> cpus;
+  Pool::CgroupSettings cgroup;
 
   while (lexer_.PeekToken(Lexer::INDENT)) {
     string key;
@@ -117,6 +501,25 @@ bool ManifestParser::ParsePool(string* err) {
       depth = atol(depth_string.c_str());
       if (depth < 0)
         return lexer_.Error("invalid pool depth", err);
+    } else if (key == "priority") {
+      string priority_string = value.Evaluate(env_);
+      if (!ParsePriority(priority_string, &priority))
+        return lexer_.Error("invalid pool priority '" + priority_string + "'",
+                            err);
+    } else if (key == "resources") {
+      string resources_err;
+      resources.clear();
+      if (!ParseAmounts(value.Evaluate(env_), &resources, &resources_err))
+        return lexer_.Error("invalid pool resources: " + resources_err, err);
+    } else if (key == "cpus") {
+      string cpus_string = value.Evaluate(env_);
+      if (!ParseCpuList(cpus_string, &cpus))
+        return lexer_.Error("invalid pool cpus '" + cpus_string + "'", err);
+    } else if (key == "cgroup") {
+      string cgroup_err;
+      cgroup.clear();
+      if (!ParseCgroupSettings(value.Evaluate(env_), &cgroup, &cgroup_err))
+        return lexer_.Error("invalid pool cgroup: " + cgroup_err, err);
     } else {
       return lexer_.Error("unexpected variable '" + key + "'", err);
     }
@@ -125,10 +528,40 @@ bool ManifestParser::ParsePool(string* err) {
   if (depth < 0)
     return lexer_.Error("expected 'depth =' line", err);
 
-  state_->AddPool(new Pool(name, depth));
+  if (actions_) {
+    actions_->actions[action].depth = depth;
+    actions_->actions[action].priority = priority;
+    actions_->actions[action].resources.swap(resources);
+    actions_->actions[action].cpus.swap(cpus);
+    actions_->actions[action].cgroup.swap(cgroup);
+  } else {
+    AddPool(name, depth, priority, resources, cpus, cgroup);
+  }
+  return true;
+}
+
+bool ManifestParser::CheckPool(const string& name, Lexer* lexer,
+                               string* err) {
+  if (state_->LookupPool(name) != NULL)
+    return lexer->Error("duplicate pool '" + name + "'", err);
   return true;
 }
 
+void ManifestParser::AddPool(const string& name, int depth, int priority,
+                             const vector<pair<string, int> >& resources,
+                             const vector<int>& cpus,
+                             const Pool::CgroupSettings& cgroup) {
+  Pool* pool = new Pool(name, depth);
+  pool->set_priority(priority);
+  pool->set_cpus(cpus);
+  pool->set_cgroup(cgroup);
+  for (size_t i = 0; i < resources.size(); ++i)
+    pool->AddResource(resources[i].first, resources[i].second);
+  state_->AddPool(pool);
+  if (record_)
+    record_->added_pools = true;
+}
+
 
 bool ManifestParser::ParseRule(string* err) {
   string name;
@@ -143,7 +576,9 @@ bool ManifestParser::ParseRule(string* err) {
 
   Rule* rule = new Rule(name);  // XXX scoped_ptr
 
+  int bindings = 0;
   while (lexer_.PeekToken(Lexer::INDENT)) {
+    ++bindings;
     string key;
     EvalString value;
     if (!ParseLet(&key, &value, err))
@@ -158,16 +593,18 @@ bool ManifestParser::ParseRule(string* err) {
     }
   }
 
-  if (rule->bindings_["rspfile"].empty() !=
-      rule->bindings_["rspfile_content"].empty()) {
+  if (rule->bindings_[InternSymbol("rspfile")].empty() !=
+      rule->bindings_[InternSymbol("rspfile_content")].empty()) {
     return lexer_.Error("rspfile and rspfile_content need to be "
                         "both specified", err);
   }
 
-  if (rule->bindings_["command"].empty())
+  if (rule->bindings_[InternSymbol("command")].empty())
     return lexer_.Error("expected 'command =' line", err);
 
   env_->AddRule(rule);
+  if (g_manifest_stats)
+    g_manifest_stats->AddRule(bindings);
   return true;
 }
 
@@ -194,8 +631,13 @@ bool ManifestParser::ParseDefault(string* err) {
     uint64_t slash_bits;  // Unused because this only does lookup.
     if (!CanonicalizePath(&path, &slash_bits, &path_err))
       return lexer_.Error(path_err, err);
-    if (!state_->AddDefault(path, &path_err))
-      return lexer_.Error(path_err, err);
+    if (actions_) {
+      actions_->actions.push_back(Action(Action::kDefault));
+      actions_->actions.back().lexer = lexer_;
+      actions_->actions.back().name = path;
+    } else if (!AddDefault(path, &lexer_, err)) {
+      return false;
+    }
 
     eval.Clear();
     if (!lexer_.ReadPath(&eval, err))
@@ -205,6 +647,27 @@ bool ManifestParser::ParseDefault(string* err) {
   return ExpectToken(Lexer::NEWLINE, err);
 }
 
+bool ManifestParser::AddDefault(const string& path, Lexer* lexer,
+                                string* err) {
+  string path_err;
+  if (!state_->AddDefault(path, &path_err))
+    return lexer->Error(path_err, err);
+  if (record_)
+    record_->defaults.push_back(state_->defaults_.back());
+  return true;
+}
+
+// static
+void ManifestParser::EvaluatePaths(const vector<EvalString>& paths, Env* env,
+                                   vector<ParsedPath>* parsed) {
+  parsed->resize(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    ParsedPath* path = &(*parsed)[i];
+    path->path = paths[i].Evaluate(env);
+    CanonicalizePath(&path->path, &path->slash_bits, &path->err);
+  }
+}
+
 bool ManifestParser::ParseEdge(string* err) {
   vector<EvalString> ins, outs;
 
@@ -293,7 +756,9 @@ bool ManifestParser::ParseEdge(string* err) {
   // Bindings on edges are rare, so allocate per-edge envs only when needed.
   bool has_indent_token = lexer_.PeekToken(Lexer::INDENT);
   BindingEnv* env = has_indent_token ? new BindingEnv(env_) : env_;
+  int bindings = 0;
   while (has_indent_token) {
+    ++bindings;
     string key;
     EvalString val;
     if (!ParseLet(&key, &val, err))
@@ -302,36 +767,139 @@ bool ManifestParser::ParseEdge(string* err) {
     env->AddBinding(key, val.Evaluate(env_));
     has_indent_token = lexer_.PeekToken(Lexer::INDENT);
   }
+  if (g_manifest_stats)
+    g_manifest_stats->AddEdge(bindings);
+
+  ParsedEdge parsed;
+  parsed.rule = rule;
+  parsed.env = env;
+  EvaluatePaths(outs, env, &parsed.outs);
+  EvaluatePaths(ins, env, &parsed.ins);
+  parsed.implicit_outs = implicit_outs;
+  parsed.implicit = implicit;
+  parsed.order_only = order_only;
+
+  if (!actions_)
+    return AddEdge(&parsed, &lexer_, err);
+
+  // The scopes keep changing while parsing goes on, so evaluate now the
+  // bindings that AddEdge() looks up.  Only rule bindings can refer to $in
+  // and $out, which need nodes; they don't account for duplicate outputs.
+  Edge edge;
+  edge.rule_ = rule;
+  edge.env_ = env;
+  parsed.pool_name = edge.GetBinding(kSymbolPool);
+  parsed.pool_weight = edge.GetBinding(kSymbolPoolWeight);
+  parsed.pool_resources = edge.GetBinding(kSymbolPoolResources);
+  parsed.priority = edge.GetBinding(kSymbolPriority);
+  vector<Node*> nodes;
+  if (rule->GetBinding(kSymbolDyndep)) {
+    for (size_t i = 0; i < parsed.outs.size(); ++i) {
+      nodes.push_back(new Node(parsed.outs[i].path, parsed.outs[i].slash_bits));
+      edge.outputs_.push_back(nodes.back());
+    }
+    for (size_t i = 0; i < parsed.ins.size(); ++i) {
+      nodes.push_back(new Node(parsed.ins[i].path, parsed.ins[i].slash_bits));
+      edge.inputs_.push_back(nodes.back());
+    }
+    edge.implicit_outs_ = implicit_outs;
+    edge.implicit_deps_ = implicit;
+    edge.order_only_deps_ = order_only;
+  }
+  parsed.dyndep = edge.GetUnescapedDyndep();
+  for (vector<Node*>::iterator i = nodes.begin(); i != nodes.end(); ++i)
+    delete *i;
+  parsed.bindings_evaluated = true;
 
-  Edge* edge = state_->AddEdge(rule);
-  edge->env_ = env;
+  actions_->actions.push_back(Action(Action::kEdge));
+  Action* action = &actions_->actions.back();
+  action->lexer = lexer_;
+  action->edge.outs.swap(parsed.outs);
+  action->edge.ins.swap(parsed.ins);
+  action->edge.rule = parsed.rule;
+  action->edge.env = parsed.env;
+  action->edge.implicit_outs = parsed.implicit_outs;
+  action->edge.implicit = parsed.implicit;
+  action->edge.order_only = parsed.order_only;
+  action->edge.bindings_evaluated = true;
+  action->edge.pool_name.swap(parsed.pool_name);
+  action->edge.pool_weight.swap(parsed.pool_weight);
+  action->edge.pool_resources.swap(parsed.pool_resources);
+  action->edge.priority.swap(parsed.priority);
+  action->edge.dyndep.swap(parsed.dyndep);
+  return true;
+}
+
+bool ManifestParser::AddEdge(ParsedEdge* parsed, Lexer* lexer, string* err) {
+  Edge* edge = state_->AddEdge(parsed->rule);
+  edge->env_ = parsed->env;
 
-  string pool_name = edge->GetBinding("pool");
+  string pool_name = parsed->bindings_evaluated
+                         ? parsed->pool_name
+                         : edge->GetBinding(kSymbolPool);
   if (!pool_name.empty()) {
     Pool* pool = state_->LookupPool(pool_name);
     if (pool == NULL)
-      return lexer_.Error("unknown pool name '" + pool_name + "'", err);
+      return lexer->Error("unknown pool name '" + pool_name + "'", err);
     edge->pool_ = pool;
   }
 
-  edge->outputs_.reserve(outs.size());
-  for (size_t i = 0, e = outs.size(); i != e; ++i) {
-    string path = outs[i].Evaluate(env);
-    string path_err;
-    uint64_t slash_bits;
-    if (!CanonicalizePath(&path, &slash_bits, &path_err))
-      return lexer_.Error(path_err, err);
-    if (!state_->AddOut(edge, path, slash_bits)) {
+  string pool_weight = parsed->bindings_evaluated
+                           ? parsed->pool_weight
+                           : edge->GetBinding(kSymbolPoolWeight);
+  if (!pool_weight.empty()) {
+    edge->weight_ = ParseCount(pool_weight);
+    if (edge->weight_ < 0)
+      return lexer->Error("invalid pool_weight '" + pool_weight + "'", err);
+  }
+
+  string pool_resources = parsed->bindings_evaluated
+                              ? parsed->pool_resources
+                              : edge->GetBinding(kSymbolPoolResources);
+  if (!pool_resources.empty()) {
+    vector<pair<string, int> > amounts;
+    string amounts_err;
+    if (!ParseAmounts(pool_resources, &amounts, &amounts_err))
+      return lexer->Error("invalid pool_resources: " + amounts_err, err);
+    const Pool* pool = edge->pool();
+    for (size_t i = 0; i < amounts.size(); ++i) {
+      int index = pool->LookupResource(amounts[i].first);
+      if (index < 0) {
+        return lexer->Error("unknown resource '" + amounts[i].first +
+                            "' in pool '" + pool->name() + "'", err);
+      }
+      if (amounts[i].second == 0)
+        continue;
+      if (edge->resource_use_.size() <= (size_t)index)
+        edge->resource_use_.resize(index + 1);
+      edge->resource_use_[index] = amounts[i].second;
+    }
+  }
+
+  string priority = parsed->bindings_evaluated
+                        ? parsed->priority
+                        : edge->GetBinding(kSymbolPriority);
+  edge->priority_ = edge->pool()->priority();
+  if (!priority.empty() && !ParsePriority(priority, &edge->priority_))
+    return lexer->Error("invalid priority '" + priority + "'", err);
+
+  int implicit_outs = parsed->implicit_outs;
+  edge->outputs_.reserve(parsed->outs.size());
+  for (size_t i = 0, e = parsed->outs.size(); i != e; ++i) {
+    const ParsedPath& out = parsed->outs[i];
+    if (!out.err.empty())
+      return lexer->Error(out.err, err);
+    if (!state_->AddOut(edge, out.path, out.slash_bits)) {
       if (options_.dupe_edge_action_ == kDupeEdgeActionError) {
-        lexer_.Error("multiple rules generate " + path + " [-w dupbuild=err]",
-                     err);
+        lexer->Error("multiple rules generate " + out.path +
+                     " [-w dupbuild=err]", err);
         return false;
       } else {
         if (!quiet_) {
           Warning("multiple rules generate %s. "
                   "builds involving this target will not be correct; "
                   "continuing anyway [-w dupbuild=warn]",
-                  path.c_str());
+                  out.path.c_str());
         }
         if (e - i <= static_cast<size_t>(implicit_outs))
           --implicit_outs;
@@ -341,23 +909,20 @@ bool ManifestParser::ParseEdge(string* err) {
   if (edge->outputs_.empty()) {
     // All outputs of the edge are already created by other edges. Don't add
     // this edge.  Do this check before input nodes are connected to the edge.
-    state_->edges_.pop_back();
-    delete edge;
+    state_->RemoveLastEdge();
     return true;
   }
   edge->implicit_outs_ = implicit_outs;
 
-  edge->inputs_.reserve(ins.size());
-  for (vector<EvalString>::iterator i = ins.begin(); i != ins.end(); ++i) {
-    string path = i->Evaluate(env);
-    string path_err;
-    uint64_t slash_bits;
-    if (!CanonicalizePath(&path, &slash_bits, &path_err))
-      return lexer_.Error(path_err, err);
-    state_->AddIn(edge, path, slash_bits);
+  edge->inputs_.reserve(parsed->ins.size());
+  for (vector<ParsedPath>::iterator i = parsed->ins.begin();
+       i != parsed->ins.end(); ++i) {
+    if (!i->err.empty())
+      return lexer->Error(i->err, err);
+    state_->AddIn(edge, i->path, i->slash_bits);
   }
-  edge->implicit_deps_ = implicit;
-  edge->order_only_deps_ = order_only;
+  edge->implicit_deps_ = parsed->implicit;
+  edge->order_only_deps_ = parsed->order_only;
 
   if (options_.phony_cycle_action_ == kPhonyCycleActionWarn &&
       edge->maybe_phonycycle_diagnostic()) {
@@ -381,7 +946,8 @@ bool ManifestParser::ParseEdge(string* err) {
   // Lookup, validate, and save any dyndep binding.  It will be used later
   // to load generated dependency information dynamically, but it must
   // be one of our manifest-specified inputs.
-  string dyndep = edge->GetUnescapedDyndep();
+  string dyndep = parsed->bindings_evaluated ? parsed->dyndep
+                                             : edge->GetUnescapedDyndep();
   if (!dyndep.empty()) {
     uint64_t slash_bits;
     if (!CanonicalizePath(&dyndep, &slash_bits, err))
@@ -391,10 +957,12 @@ bool ManifestParser::ParseEdge(string* err) {
     vector<Node*>::iterator dgi =
       std::find(edge->inputs_.begin(), edge->inputs_.end(), edge->dyndep_);
     if (dgi == edge->inputs_.end()) {
-      return lexer_.Error("dyndep '" + dyndep + "' is not an input", err);
+      return lexer->Error("dyndep '" + dyndep + "' is not an input", err);
     }
   }
 
+  if (record_)
+    record_->edges.push_back(edge);
   return true;
 }
 
@@ -403,10 +971,53 @@ bool ManifestParser::ParseFileInclude(bool new_scope, string* err) {
   if (!lexer_.ReadPath(&eval, err))
     return false;
   string path = eval.Evaluate(env_);
+  if (new_scope && options_.subninjas_ && !options_.subninjas_->count(path))
+    return ExpectToken(Lexer::NEWLINE, err);
+
+  ManifestRecord* record = record_;
+  if (new_scope && record_) {
+    record = new ManifestRecord;
+    record->path = path;
+    record->parent_scope = env_;
+    record->snapshot = env_->Snapshot();
+    record_->subninjas.push_back(record);
+  }
+
+  if (new_scope && actions_) {
+    // Parse the subninja on another thread, against a copy of the scope
+    // as it is now.
+    FileActions* file = new FileActions;
+    file->filename = path;
+    file->parent_scope = env_;
+    file->snapshot = env_->Snapshot();
+    file->scope = new BindingEnv(file->snapshot);
+    file->parent_lexer = lexer_;
+    file->record = record;
+    if (record)
+      record->scope = file->scope;
+    actions_->actions.push_back(Action(Action::kSubninja));
+    actions_->actions.back().file = file;
+
+    State* state = state_;
+    FileReader* file_reader = file_reader_;
+    ManifestParserOptions options = options_;
+    TaskGroup* tasks = tasks_;
+    tasks_->Add([=]() {
+      ManifestParser subparser(state, file_reader, options);
+      subparser.tasks_ = tasks;
+      subparser.ParseSubninjaTask(file);
+    });
+    return ExpectToken(Lexer::NEWLINE, err);
+  }
 
   ManifestParser subparser(state_, file_reader_, options_);
+  subparser.actions_ = actions_;
+  subparser.tasks_ = tasks_;
+  subparser.record_ = record;
   if (new_scope) {
     subparser.env_ = new BindingEnv(env_);
+    if (record)
+      record->scope = subparser.env_;
   } else {
     subparser.env_ = env_;
   }
@@ -419,3 +1030,96 @@ bool ManifestParser::ParseFileInclude(bool new_scope, string* err) {
 
   return true;
 }
+
+void ManifestParser::RecordFile(const string& filename, StringPiece contents) {
+  if (!record_)
+    return;
+  record_->files.push_back(ManifestRecord::File(
+      filename, contents.size(), Hash64(contents.str_, contents.size())));
+}
+
+bool ManifestParser::Reload(ManifestRecord* record,
+                            DiskInterface* disk_interface) {
+  METRIC_RECORD(".ninja reload");
+  TRACE_RECORD(".ninja reload");
+
+  // The files of the manifest itself make the scope of all the others.
+  if (record->Changed(disk_interface))
+    return false;
+  // Edges added since, like the phony ones for the nodes of loaded deps,
+  // could clash with the ones parsed again.
+  if (record->EdgeCount() != state_->edges_.size())
+    return false;
+
+  vector<vector<ManifestRecord*> > changed;
+  vector<ManifestRecord*> parents(1, record);
+  FindChanged(&parents, disk_interface, &changed);
+
+  // Drop what the changed subninjas added.  Pools may be used anywhere
+  // after their declaration, so only a full load replaces those.
+  set<Edge*> edges;
+  vector<Node*> defaults;
+  for (vector<vector<ManifestRecord*> >::iterator i = changed.begin();
+       i != changed.end(); ++i) {
+    if (AddedPools(i->back()))
+      return false;
+    CollectAdded(i->back(), &edges, &defaults);
+  }
+  state_->RemoveEdges(edges);
+  for (vector<Node*>::iterator i = defaults.begin(); i != defaults.end();
+       ++i) {
+    state_->defaults_.erase(
+        find(state_->defaults_.begin(), state_->defaults_.end(), *i));
+  }
+
+  for (vector<vector<ManifestRecord*> >::iterator i = changed.begin();
+       i != changed.end(); ++i) {
+    ManifestRecord* stale = i->back();
+    i->pop_back();
+    ManifestRecord* fresh = new ManifestRecord;
+    vector<ManifestRecord*>& siblings = i->back()->subninjas;
+    *find(siblings.begin(), siblings.end(), stale) = fresh;
+
+    // Errors are left for the full load to report, in its own words.
+    string err;
+    bool success = ParseAgain(*i, stale, fresh, &err);
+    delete stale;
+    if (!success)
+      return false;
+    fresh->Stat(disk_interface);
+  }
+  return true;
+}
+
+bool ManifestParser::ParseAgain(const vector<ManifestRecord*>& parents,
+                                const ManifestRecord* record,
+                                ManifestRecord* fresh, string* err) {
+  // Parse against copies of the scopes as they were at the subninja
+  // statements leading to this one.  The manifest's own scope, at the top,
+  // has no statement to go back to.
+  vector<BindingEnv*> copies;
+  BindingEnv* parent = NULL;
+  for (size_t i = 1; i <= parents.size(); ++i) {
+    const ManifestRecord* scope = i < parents.size() ? parents[i] : record;
+    copies.push_back(scope->snapshot->Snapshot());
+    copies.back()->set_parent(parent);
+    parent = copies.back();
+  }
+
+  fresh->path = record->path;
+  fresh->parent_scope = record->parent_scope;
+  fresh->snapshot = record->snapshot->Snapshot();
+  fresh->scope = new BindingEnv(parent);
+
+  ManifestParser parser(state_, file_reader_, options_);
+  parser.quiet_ = quiet_;
+  parser.env_ = fresh->scope;
+  parser.record_ = fresh;
+  bool success = parser.Load(fresh->path, err);
+
+  fresh->scope->set_parent(fresh->parent_scope);
+  for (vector<BindingEnv*>::iterator i = copies.begin(); i != copies.end();
+       ++i)
+    delete *i;
+  return success;
+}
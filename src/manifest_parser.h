@@ -15,10 +15,24 @@
 #ifndef NINJA_MANIFEST_PARSER_H_
 #define NINJA_MANIFEST_PARSER_H_
 
+#include <stdint.h>
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "parser.h"
+#include "timestamp.h"
 
 struct BindingEnv;
+struct DiskInterface;
+struct Edge;
+struct Env;
 struct EvalString;
+struct Node;
+struct Rule;
+struct TaskGroup;
 
 enum DupeEdgeAction {
   kDupeEdgeActionWarn,
@@ -33,9 +47,73 @@ enum PhonyCycleAction {
 struct ManifestParserOptions {
   ManifestParserOptions()
       : dupe_edge_action_(kDupeEdgeActionWarn),
-        phony_cycle_action_(kPhonyCycleActionWarn) {}
+        phony_cycle_action_(kPhonyCycleActionWarn),
+        parallel_subninjas_(false), subninjas_(NULL) {}
   DupeEdgeAction dupe_edge_action_;
   PhonyCycleAction phony_cycle_action_;
+  /// Whether to parse subninja files on several threads.  The result,
+  /// including errors and warnings, is the same as parsing them in order;
+  /// the FileReader must allow concurrent reads.
+  bool parallel_subninjas_;
+  /// If set, only the subninja statements naming one of these files are
+  /// followed; the others are skipped, with all their files declare.  See
+  /// ManifestIndex::SubninjasFor().
+  const std::set<std::string>* subninjas_;
+};
+
+/// What parsing a manifest or one of its subninjas added to the State, and
+/// from which files, so that ManifestParser::Reload() can parse again only
+/// the subninjas that changed.
+struct ManifestRecord {
+  ManifestRecord() : added_pools(false), scope(NULL), snapshot(NULL) {}
+  ~ManifestRecord();
+
+  /// A file that was parsed, as it was then.
+  struct File {
+    File(const std::string& path, size_t size, uint64_t digest)
+        : path(path), mtime(0), size(size), digest(digest) {}
+    std::string path;
+    /// Set by Stat(), after parsing.
+    TimeStamp mtime;
+    size_t size;
+    uint64_t digest;
+  };
+
+  /// Fill in the mtimes of the files, here and in the subninjas.
+  void Stat(DiskInterface* disk_interface);
+
+  /// Whether any of |files| changed since.  Files with the same mtime are
+  /// assumed unchanged; the others are read again, and their new mtime
+  /// recorded if their contents are the same.
+  bool Changed(DiskInterface* disk_interface);
+
+  /// Whether the files changed here or in any of the subninjas, as
+  /// Changed() tells.
+  bool AnyChanged(DiskInterface* disk_interface);
+
+  /// The number of edges added, here and in the subninjas.
+  size_t EdgeCount() const;
+
+  /// Collect the files parsed, here and in the subninjas.
+  void CollectFiles(std::vector<const File*>* files) const;
+
+  /// The subninja path, empty for the manifest itself.
+  std::string path;
+  /// The file itself, then the files it includes.
+  std::vector<File> files;
+  std::vector<ManifestRecord*> subninjas;
+  std::vector<Edge*> edges;
+  std::vector<Node*> defaults;
+  bool added_pools;
+  /// The scope of the subninja and its parent, and a copy of the parent as
+  /// it was at the subninja statement, whose own parent isn't kept.
+  BindingEnv* scope;
+  BindingEnv* parent_scope;
+  BindingEnv* snapshot;
+
+ private:
+  ManifestRecord(const ManifestRecord& other);   // DO NOT IMPLEMENT
+  void operator=(const ManifestRecord& other);   // DO NOT IMPLEMENT
 };
 
 /// Parses .ninja files.
@@ -43,17 +121,90 @@ struct ManifestParser : public Parser {
   ManifestParser(State* state, FileReader* file_reader,
                  ManifestParserOptions options = ManifestParserOptions());
 
+  /// Load and parse a file, with its subninjas in parallel if requested.
+  bool Load(const std::string& filename, std::string* err,
+            Lexer* parent = NULL);
+
   /// Parse a text string of input.  Used by tests.
   bool ParseTest(const std::string& input, std::string* err) {
     quiet_ = true;
     return Parse("input", input, err);
   }
 
+  /// Record what Load() adds to the State in |record|.
+  void set_record(ManifestRecord* record) { record_ = record; }
+
+  /// Bring the State loaded into |record| up to date with the manifest, by
+  /// parsing again the subninjas whose files changed, in place of what they
+  /// added before.
+  /// @return false if only loading the manifest from scratch would do,
+  /// as its top-level files changed, they declared pools, or something
+  /// else added edges to the State; it may be left half updated then.
+  bool Reload(ManifestRecord* record, DiskInterface* disk_interface);
+
 private:
-  /// Parse a file, given its contents as a string.
-  bool Parse(const std::string& filename, const std::string& input,
+  /// A path of a build statement, evaluated and canonicalized (or the
+  /// error canonicalizing it).
+  struct ParsedPath {
+    std::string path;
+    uint64_t slash_bits;
+    std::string err;
+  };
+
+  /// A build statement, parsed but not added to the State yet.
+  struct ParsedEdge {
+    ParsedEdge()
+        : rule(NULL), env(NULL), implicit_outs(0), implicit(0), order_only(0),
+          bindings_evaluated(false) {}
+    const Rule* rule;
+    BindingEnv* env;
+    std::vector<ParsedPath> outs;
+    std::vector<ParsedPath> ins;
+    int implicit_outs;
+    int implicit;
+    int order_only;
+    /// Whether pool_name, pool_weight, pool_resources, priority and dyndep
+    /// were evaluated while parsing, rather than left for AddEdge().
+    bool bindings_evaluated;
+    std::string pool_name;
+    std::string pool_weight;
+    std::string pool_resources;
+    std::string priority;
+    std::string dyndep;
+  };
+
+  struct Action;
+  struct FileActions;
+
+  /// Parse a file, given its contents.
+  bool Parse(const std::string& filename, StringPiece input,
              std::string* err);
 
+  /// Evaluate the paths of a build statement in |env|.
+  static void EvaluatePaths(const std::vector<EvalString>& paths, Env* env,
+                            std::vector<ParsedPath>* parsed);
+
+  /// Parse subninja |file| into its actions, on a TaskGroup thread.
+  void ParseSubninjaTask(FileActions* file);
+
+  /// Apply the actions recorded for |file| and its subninjas, in order.
+  bool ApplyActions(FileActions* file, std::string* err);
+
+  /// Restore the scopes of |file| and its subninjas to their real parents
+  /// and free the snapshots used while parsing.
+  static void FinishActions(FileActions* file);
+
+  /// Change the State for the various statement types.  |lexer| is
+  /// positioned for error messages as the statement was parsed.
+  bool CheckPool(const std::string& name, Lexer* lexer, std::string* err);
+  void AddPool(const std::string& name, int depth, int priority,
+               const std::vector<std::pair<std::string, int> >& resources,
+               const std::vector<int>& cpus,
+               const std::vector<std::pair<std::string, std::string> >&
+                   cgroup);
+  bool AddDefault(const std::string& path, Lexer* lexer, std::string* err);
+  bool AddEdge(ParsedEdge* parsed, Lexer* lexer, std::string* err);
+
   /// Parse various statement types.
   bool ParsePool(std::string* err);
   bool ParseRule(std::string* err);
@@ -64,9 +215,26 @@ private:
   /// Parse either a 'subninja' or 'include' line.
   bool ParseFileInclude(bool new_scope, std::string* err);
 
+  /// Note in |record_| that |filename| was parsed, with |contents|.
+  void RecordFile(const std::string& filename, StringPiece contents);
+
+  /// Parse subninja |record|, whose ancestors are |parents| starting with
+  /// the manifest, again into |fresh|.
+  bool ParseAgain(const std::vector<ManifestRecord*>& parents,
+                  const ManifestRecord* record, ManifestRecord* fresh,
+                  std::string* err);
+
   BindingEnv* env_;
   ManifestParserOptions options_;
   bool quiet_;
+
+  /// When parsing in parallel, the actions recorded for the file being
+  /// parsed, to be applied to the State once all files are parsed.
+  FileActions* actions_;
+  /// When parsing in parallel, runs the subninja parses.
+  TaskGroup* tasks_;
+  /// If not NULL, where to record what the file being parsed adds.
+  ManifestRecord* record_;
 };
 
 #endif  // NINJA_MANIFEST_PARSER_H_
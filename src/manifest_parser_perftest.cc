@@ -57,12 +57,46 @@ bool WriteFakeManifests(const string& dir, string* err) {
   return exit_code == 0;
 }
 
-int LoadManifests(bool measure_command_evaluation) {
+/// Write |dir|/long_lines.ninja, whose edges have command lines of more than
+/// 10 KB, if it doesn't exist yet.
+bool WriteLongLinesManifest(const string& dir, string* err) {
+  RealDiskInterface disk_interface;
+  string path = dir + "/long_lines.ninja";
+  TimeStamp mtime = disk_interface.Stat(path, err);
+  if (mtime != 0)
+    return mtime != -1;
+
+  string flags;
+  for (int i = 0; flags.size() < 10000; ++i) {
+    char flag[100];
+    snprintf(flag, sizeof(flag),
+             " -I../../third_party/library_%d/include -DLIBRARY_%d_ENABLED=1",
+             i, i);
+    flags += flag;
+  }
+  string manifest = "rule cc\n  command = clang++ $flags -c $in -o $out\n";
+  for (int i = 0; i < 2000; ++i) {
+    char edge[200];
+    snprintf(edge, sizeof(edge),
+             "build obj/module_%d/source_%d.o: cc ../../src/module_%d/source_%d.cc\n",
+             i / 100, i, i / 100, i);
+    manifest += edge;
+    manifest += "  flags =" + flags + "\n";
+  }
+  if (!disk_interface.MakeDirs(path) ||
+      !disk_interface.WriteFile(path, manifest)) {
+    *err = "Failed to write " + path;
+    return false;
+  }
+  return true;
+}
+
+int LoadManifests(const char* manifest, bool measure_command_evaluation) {
   string err;
   RealDiskInterface disk_interface;
   State state;
   ManifestParser parser(&state, &disk_interface);
-  if (!parser.Load("build.ninja", &err)) {
+  if (!parser.Load(manifest, &err)) {
     fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
     exit(1);
   }
@@ -78,18 +112,23 @@ int LoadManifests(bool measure_command_evaluation) {
 
 int main(int argc, char* argv[]) {
   bool measure_command_evaluation = true;
+  bool long_lines = false;
   int opt;
-  while ((opt = getopt(argc, argv, const_cast<char*>("fh"))) != -1) {
+  while ((opt = getopt(argc, argv, const_cast<char*>("flh"))) != -1) {
     switch (opt) {
     case 'f':
       measure_command_evaluation = false;
       break;
+    case 'l':
+      long_lines = true;
+      break;
     case 'h':
     default:
       printf("usage: manifest_parser_perftest\n"
 "\n"
 "options:\n"
 "  -f     only measure manifest load time, not command evaluation time\n"
+"  -l     load a manifest with 10 KB command lines instead\n"
              );
     return 1;
     }
@@ -98,10 +137,12 @@ int main(int argc, char* argv[]) {
   const char kManifestDir[] = "build/manifest_perftest";
 
   string err;
-  if (!WriteFakeManifests(kManifestDir, &err)) {
+  if (!(long_lines ? WriteLongLinesManifest(kManifestDir, &err)
+                   : WriteFakeManifests(kManifestDir, &err))) {
     fprintf(stderr, "Failed to write test data: %s\n", err.c_str());
     return 1;
   }
+  const char* manifest = long_lines ? "long_lines.ninja" : "build.ninja";
 
   if (chdir(kManifestDir) < 0)
     Fatal("chdir: %s", strerror(errno));
@@ -110,7 +151,8 @@ int main(int argc, char* argv[]) {
   vector<int> times;
   for (int i = 0; i < kNumRepetitions; ++i) {
     int64_t start = GetTimeMillis();
-    int optimization_guard = LoadManifests(measure_command_evaluation);
+    int optimization_guard =
+        LoadManifests(manifest, measure_command_evaluation);
     int delta = (int)(GetTimeMillis() - start);
     printf("%dms (hash: %x)\n", delta, optimization_guard);
     times.push_back(delta);
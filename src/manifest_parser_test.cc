@@ -838,6 +838,191 @@ TEST_F(ParserTest, Errors) {
   }
 }
 
+TEST_F(ParserTest, PoolWeightsAndResources) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+"pool lto\n"
+"  depth = 4\n"
+"  resources = memory_gb=48, cpus=32 io=1\n"
+"rule link\n"
+"  command = ld $in -o $out\n"
+"  pool = lto\n"
+"  pool_resources = cpus=$cpus\n"
+"build a: link a.o\n"
+"  cpus = 8\n"
+"  pool_weight = 2\n"
+"build b: link b.o\n"
+"  cpus = 0\n"
+"  pool_resources = memory_gb=12\n"
+"rule cc\n"
+"  command = cc $in -o $out\n"
+"build c: cc c.o\n"));
+
+  const Pool* pool = state.LookupPool("lto");
+  ASSERT_EQ(3u, pool->resources().size());
+  EXPECT_EQ("memory_gb", pool->resources()[0].name);
+  EXPECT_EQ(48, pool->resources()[0].capacity);
+  EXPECT_EQ("io", pool->resources()[2].name);
+  EXPECT_EQ(1, pool->resources()[2].capacity);
+  EXPECT_EQ(1, pool->LookupResource("cpus"));
+  EXPECT_EQ(-1, pool->LookupResource("disk"));
+
+  Edge* a = state.LookupNode("a")->in_edge();
+  EXPECT_EQ(2, a->weight());
+  ASSERT_EQ(2u, a->resource_use_.size());
+  EXPECT_EQ(0, a->resource_use_[0]);
+  EXPECT_EQ(8, a->resource_use_[1]);
+  Edge* b = state.LookupNode("b")->in_edge();
+  EXPECT_EQ(1, b->weight());
+  ASSERT_EQ(1u, b->resource_use_.size());
+  EXPECT_EQ(12, b->resource_use_[0]);
+  EXPECT_TRUE(state.LookupNode("c")->in_edge()->resource_use_.empty());
+}
+
+TEST_F(ParserTest, Priorities) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+"pool docs\n"
+"  depth = 2\n"
+"  priority = -5\n"
+"rule doc\n"
+"  command = doc $in > $out\n"
+"  pool = docs\n"
+"rule link\n"
+"  command = ld $in -o $out\n"
+"  priority = 10\n"
+"build manual: doc manual.txt\n"
+"build index: doc index.txt\n"
+"  priority = 1\n"
+"build test: link test.o\n"
+"build tool: link tool.o\n"
+"  priority = $level\n"
+"  level = 0\n"
+"build plain: doc plain.txt\n"
+"  pool =\n"));
+
+  EXPECT_EQ(-5, state.LookupPool("docs")->priority());
+  EXPECT_EQ(-5, state.LookupNode("manual")->in_edge()->priority());
+  EXPECT_EQ(1, state.LookupNode("index")->in_edge()->priority());
+  EXPECT_EQ(10, state.LookupNode("test")->in_edge()->priority());
+  EXPECT_EQ(0, state.LookupNode("tool")->in_edge()->priority());
+  EXPECT_EQ(0, state.LookupNode("plain")->in_edge()->priority());
+
+  State local_state;
+  ManifestParser parser(&local_state, NULL);
+  string err;
+  EXPECT_FALSE(parser.ParseTest("rule run\n"
+                                "  command = echo\n"
+                                "build out: run in\n"
+                                "  priority = high\n", &err));
+  EXPECT_EQ("input:5: invalid priority 'high'\n", err);
+}
+
+TEST_F(ParserTest, PoolCpus) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+"first = 0\n"
+"pool link\n"
+"  depth = 2\n"
+"  cpus = 8-9,$first\n"
+"pool any\n"
+"  depth = 2\n"));
+
+  const vector<int>& cpus = state.LookupPool("link")->cpus();
+  ASSERT_EQ(3u, cpus.size());
+  EXPECT_EQ(8, cpus[0]);
+  EXPECT_EQ(9, cpus[1]);
+  EXPECT_EQ(0, cpus[2]);
+  EXPECT_TRUE(state.LookupPool("any")->cpus().empty());
+
+  State local_state;
+  ManifestParser parser(&local_state, NULL);
+  string err;
+  EXPECT_FALSE(parser.ParseTest("pool foo\n"
+                                "  depth = 1\n"
+                                "  cpus = 4-2\n", &err));
+  EXPECT_EQ("input:3: invalid pool cpus '4-2'\n"
+            "  cpus = 4-2\n"
+            "            ^ near here", err);
+}
+
+TEST_F(ParserTest, PoolCgroup) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+"pool test\n"
+"  depth = 2\n"
+"  cgroup = memory.max=4G, pids.max=512\n"));
+
+  const Pool::CgroupSettings& cgroup = state.LookupPool("test")->cgroup();
+  ASSERT_EQ(2u, cgroup.size());
+  EXPECT_EQ("memory.max", cgroup[0].first);
+  EXPECT_EQ("4G", cgroup[0].second);
+  EXPECT_EQ("pids.max", cgroup[1].first);
+  EXPECT_EQ("512", cgroup[1].second);
+
+  State local_state;
+  ManifestParser parser(&local_state, NULL);
+  string err;
+  EXPECT_FALSE(parser.ParseTest("pool foo\n"
+                                "  depth = 1\n"
+                                "  cgroup = ../tasks=1\n", &err));
+  EXPECT_EQ("input:3: invalid pool cgroup: expected 'controller.file=value', "
+            "got '../tasks=1'\n"
+            "  cgroup = ../tasks=1\n"
+            "                     ^ near here", err);
+}
+
+TEST_F(ParserTest, PoolWeightsAndResourcesErrors) {
+  {
+    State local_state;
+    ManifestParser parser(&local_state, NULL);
+    string err;
+    EXPECT_FALSE(parser.ParseTest("pool foo\n"
+                                  "  depth = 1\n"
+                                  "  resources = cpus=4 memory\n", &err));
+    EXPECT_EQ("input:3: invalid pool resources: expected 'name=amount', "
+              "got 'memory'\n"
+              "  resources = cpus=4 memory\n"
+              "                           ^ near here"
+              , err);
+  }
+
+  {
+    State local_state;
+    ManifestParser parser(&local_state, NULL);
+    string err;
+    EXPECT_FALSE(parser.ParseTest("pool foo\n"
+                                  "  depth = 1\n"
+                                  "  resources = cpus=4 cpus=2\n", &err));
+    EXPECT_EQ("input:3: invalid pool resources: duplicate resource 'cpus'\n"
+              "  resources = cpus=4 cpus=2\n"
+              "                           ^ near here"
+              , err);
+  }
+
+  {
+    State local_state;
+    ManifestParser parser(&local_state, NULL);
+    string err;
+    EXPECT_FALSE(parser.ParseTest("rule run\n"
+                                  "  command = echo\n"
+                                  "build out: run in\n"
+                                  "  pool_weight = -2\n", &err));
+    EXPECT_EQ("input:5: invalid pool_weight '-2'\n", err);
+  }
+
+  {
+    State local_state;
+    ManifestParser parser(&local_state, NULL);
+    string err;
+    EXPECT_FALSE(parser.ParseTest("pool foo\n"
+                                  "  depth = 1\n"
+                                  "  resources = cpus=4\n"
+                                  "rule run\n"
+                                  "  command = echo\n"
+                                  "  pool = foo\n"
+                                  "build out: run in\n"
+                                  "  pool_resources = memory=2\n", &err));
+    EXPECT_EQ("input:9: unknown resource 'memory' in pool 'foo'\n", err);
+  }
+}
+
 TEST_F(ParserTest, MissingInput) {
   State local_state;
   ManifestParser parser(&local_state, &fs_);
@@ -1156,3 +1341,284 @@ TEST_F(ParserTest, DyndepRuleInput) {
   EXPECT_TRUE(edge->dyndep_->dyndep_pending());
   EXPECT_EQ(edge->dyndep_->path(), "in");
 }
+
+/// A FileReader that can be read from several threads.
+struct ConstFileReader : public FileReader {
+  virtual Status ReadFile(const string& path, string* contents, string* err) {
+    map<string, string>::const_iterator i = files_.find(path);
+    if (i == files_.end()) {
+      *err = "No such file or directory";
+      return NotFound;
+    }
+    *contents = i->second;
+    return Okay;
+  }
+
+  map<string, string> files_;
+};
+
+struct ParallelParserTest : public testing::Test {
+  /// Load build.ninja sequentially then in parallel, and check that both
+  /// produce the same graph and error.  Returns the error.
+  string LoadBoth(ManifestParserOptions options) {
+    string seq_err, par_err;
+    State seq_state, par_state;
+    ManifestParser seq_parser(&seq_state, &reader_, options);
+    bool seq_ok = seq_parser.Load("build.ninja", &seq_err);
+    options.parallel_subninjas_ = true;
+    ManifestParser par_parser(&par_state, &reader_, options);
+    bool par_ok = par_parser.Load("build.ninja", &par_err);
+    EXPECT_EQ(seq_ok, par_ok);
+    EXPECT_EQ(seq_err, par_err);
+    EXPECT_EQ(Describe(seq_state), Describe(par_state));
+    return par_err;
+  }
+
+  static string Describe(State& state) {
+    string result;
+    for (vector<Edge*>::iterator e = state.edges_.begin();
+         e != state.edges_.end(); ++e) {
+      if ((*e)->is_phony() && (*e)->outputs_.empty())
+        continue;
+      result += (*e)->EvaluateCommand() + " |";
+      for (vector<Node*>::iterator n = (*e)->outputs_.begin();
+           n != (*e)->outputs_.end(); ++n)
+        result += " " + (*n)->path();
+      result += " <-";
+      for (vector<Node*>::iterator n = (*e)->inputs_.begin();
+           n != (*e)->inputs_.end(); ++n)
+        result += " " + (*n)->path();
+      if ((*e)->pool() != &State::kDefaultPool)
+        result += " pool=" + (*e)->pool()->name();
+      if ((*e)->dyndep_)
+        result += " dyndep=" + (*e)->dyndep_->path();
+      result += "\n";
+    }
+    vector<Node*> defaults = state.DefaultNodes(NULL);
+    for (vector<Node*>::iterator n = defaults.begin(); n != defaults.end();
+         ++n)
+      result += "default " + (*n)->path() + "\n";
+    return result;
+  }
+
+  ConstFileReader reader_;
+};
+
+TEST_F(ParallelParserTest, Scopes) {
+  reader_.files_["build.ninja"] =
+"rule echo\n"
+"  command = echo $var $in\n"
+"var = outer\n"
+"pool link\n"
+"  depth = 1\n"
+"subninja a.ninja\n"
+"var = changed\n"
+"include rules.ninja\n"
+"subninja b.ninja\n"
+"build top: echo a1 b1 | c1\n"
+"default top\n";
+  reader_.files_["rules.ninja"] = "rule copy\n  command = cp $in $out\n";
+  reader_.files_["a.ninja"] =
+"build a1: echo src/../a.c\n"
+"  pool = link\n"
+"subninja c.ninja\n"
+"default a1\n";
+  reader_.files_["b.ninja"] =
+"var = b\n"
+"build b1: copy a1 || dd\n"
+"  dyndep = dd\n";
+  reader_.files_["c.ninja"] = "build c1: echo\n";
+  EXPECT_EQ("", LoadBoth(ManifestParserOptions()));
+}
+
+TEST_F(ParallelParserTest, DuplicateEdges) {
+  reader_.files_["build.ninja"] =
+"rule echo\n"
+"  command = echo $out\n"
+"build x: echo\n"
+"subninja a.ninja\n"
+"subninja b.ninja\n";
+  reader_.files_["a.ninja"] = "build y z: echo\n";
+  reader_.files_["b.ninja"] = "build x y w: echo\n";
+
+  EXPECT_EQ("", LoadBoth(ManifestParserOptions()));
+  ManifestParserOptions options;
+  options.dupe_edge_action_ = kDupeEdgeActionError;
+  EXPECT_EQ("b.ninja:2: multiple rules generate x [-w dupbuild=err]\n",
+            LoadBoth(options));
+}
+
+TEST_F(ParallelParserTest, Errors) {
+  reader_.files_["build.ninja"] =
+"rule echo\n"
+"  command = echo\n"
+"subninja a.ninja\n"
+"build out: echo\n"
+"  pool = later\n"
+"subninja b.ninja\n"
+"pool later\n"
+"  depth = 1\n";
+  reader_.files_["a.ninja"] = "pool later\n  depth = 2\n";
+  reader_.files_["b.ninja"] = "build\n";
+  // The pool declared in a.ninja is visible to the next statement.
+  EXPECT_EQ("b.ninja:1: expected path\n"
+            "build\n"
+            "     ^ near here", LoadBoth(ManifestParserOptions()));
+
+  reader_.files_["b.ninja"] = "subninja missing.ninja\n";
+  EXPECT_EQ("b.ninja:1: loading 'missing.ninja': No such file or directory\n"
+            "subninja missing.ninja\n"
+            "                      ^ near here",
+            LoadBoth(ManifestParserOptions()));
+
+  reader_.files_["b.ninja"] = "";
+  EXPECT_EQ("build.ninja:7: duplicate pool 'later'\n"
+            "pool later\n"
+            "          ^ near here", LoadBoth(ManifestParserOptions()));
+}
+
+struct ManifestReloadTest : public testing::Test {
+  /// Load build.ninja into |state_|, recording it in |record_|.
+  void Load(bool parallel) {
+    options_.parallel_subninjas_ = parallel;
+    ManifestParser parser(&state_, &fs_, options_);
+    parser.set_record(&record_);
+    string err;
+    EXPECT_TRUE(parser.Load("build.ninja", &err));
+    ASSERT_EQ("", err);
+    record_.Stat(&fs_);
+  }
+
+  /// Reload |state_| and check that it matches a load from scratch, but
+  /// for the order of the edges.
+  bool Reload() {
+    fs_.files_read_.clear();
+    ManifestParser parser(&state_, &fs_, options_);
+    if (!parser.Reload(&record_, &fs_))
+      return false;
+    files_read_ = fs_.files_read_;
+    State fresh;
+    ManifestParser fresh_parser(&fresh, &fs_, options_);
+    string err;
+    EXPECT_TRUE(fresh_parser.Load("build.ninja", &err));
+    EXPECT_EQ("", err);
+    EXPECT_EQ(Describe(fresh), Describe(state_));
+    VerifyGraph(state_);
+    return true;
+  }
+
+  static string Describe(State& state) {
+    string description = ParallelParserTest::Describe(state);
+    vector<string> lines;
+    for (size_t start = 0, end; start < description.size(); start = end + 1) {
+      end = description.find('\n', start);
+      lines.push_back(description.substr(start, end - start));
+    }
+    sort(lines.begin(), lines.end());
+    string result;
+    for (vector<string>::iterator i = lines.begin(); i != lines.end(); ++i)
+      result += *i + "\n";
+    return result;
+  }
+
+  /// Whether the last Reload() read |path|.
+  bool WasRead(const string& path) {
+    return find(files_read_.begin(), files_read_.end(), path) !=
+           files_read_.end();
+  }
+
+  void CheckChangedSubninjas(bool parallel);
+
+  VirtualFileSystem fs_;
+  ManifestParserOptions options_;
+  State state_;
+  ManifestRecord record_;
+  vector<string> files_read_;
+};
+
+void ManifestReloadTest::CheckChangedSubninjas(bool parallel) {
+  fs_.Create("build.ninja",
+"rule echo\n"
+"  command = echo $var $in\n"
+"var = outer\n"
+"subninja a.ninja\n"
+"var = changed\n"
+"include rules.ninja\n"
+"subninja b.ninja\n"
+"build top: echo a1 b1 | c1\n"
+"default top\n");
+  fs_.Create("rules.ninja", "rule copy\n  command = cp $in $out\n");
+  fs_.Create("a.ninja",
+"build a1: echo src/../a.c\n"
+"var = a\n"
+"subninja c.ninja\n"
+"default a1\n");
+  fs_.Create("b.ninja", "build b1: copy a1\n");
+  fs_.Create("c.ninja", "build c1: echo\n");
+  ASSERT_NO_FATAL_FAILURE(Load(parallel));
+
+  EXPECT_TRUE(Reload());
+  EXPECT_FALSE(WasRead("a.ninja"));
+
+  // c.ninja is parsed in the scopes as they were at its subninja statement.
+  fs_.Tick();
+  fs_.Create("c.ninja", "build c1 c_$var: echo\n");
+  EXPECT_TRUE(Reload());
+  EXPECT_TRUE(WasRead("c.ninja"));
+  EXPECT_FALSE(WasRead("a.ninja"));
+  EXPECT_FALSE(WasRead("b.ninja"));
+  EXPECT_TRUE(state_.LookupNode("c_a")->in_edge());
+
+  // So is a.ninja, with its subninja.
+  fs_.Tick();
+  fs_.Create("a.ninja", "build a1 a_$var: echo\nsubninja c.ninja\n");
+  EXPECT_TRUE(Reload());
+  EXPECT_TRUE(state_.LookupNode("a_outer")->in_edge());
+  EXPECT_TRUE(state_.LookupNode("c_outer")->in_edge());
+  EXPECT_FALSE(state_.LookupNode("c_a")->in_edge());
+
+  // Written again with the same contents, b.ninja isn't parsed again.
+  fs_.Tick();
+  fs_.Create("b.ninja", "build b1: copy a1\n");
+  EXPECT_TRUE(Reload());
+  ASSERT_EQ(1u, files_read_.size());
+  EXPECT_EQ("b.ninja", files_read_[0]);
+}
+
+TEST_F(ManifestReloadTest, ChangedSubninjas) {
+  CheckChangedSubninjas(false);
+}
+
+TEST_F(ManifestReloadTest, ChangedSubninjasParallel) {
+  CheckChangedSubninjas(true);
+}
+
+TEST_F(ManifestReloadTest, NeedsFullLoad) {
+  fs_.Create("build.ninja",
+"rule echo\n"
+"  command = echo\n"
+"subninja a.ninja\n");
+  fs_.Create("a.ninja", "build a: echo\n");
+  ASSERT_NO_FATAL_FAILURE(Load(false));
+
+  // The manifest itself changed.
+  fs_.Tick();
+  fs_.Create("build.ninja",
+"rule echo\n"
+"  command = echo $in\n"
+"subninja a.ninja\n");
+  EXPECT_FALSE(Reload());
+}
+
+TEST_F(ManifestReloadTest, NeedsFullLoadForPools) {
+  fs_.Create("build.ninja",
+"rule echo\n"
+"  command = echo\n"
+"subninja a.ninja\n");
+  fs_.Create("a.ninja", "pool p\n  depth = 1\nbuild a: echo\n  pool = p\n");
+  ASSERT_NO_FATAL_FAILURE(Load(false));
+
+  fs_.Tick();
+  fs_.Create("a.ninja", "pool p\n  depth = 2\nbuild a: echo\n  pool = p\n");
+  EXPECT_FALSE(Reload());
+}
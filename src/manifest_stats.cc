@@ -0,0 +1,214 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+
+#include "graph.h"
+#include "metrics.h"
+#include "state.h"
+
+using namespace std;
+
+ManifestStats* g_manifest_stats = NULL;
+
+namespace {
+
+bool SlowerFile(const ManifestStats::File* a, const ManifestStats::File* b) {
+  return a->micros > b->micros;
+}
+
+bool MoreEdges(const ManifestStats::RuleEntry& a,
+               const ManifestStats::RuleEntry& b) {
+  if (a.edges != b.edges)
+    return a.edges > b.edges;
+  return a.name < b.name;
+}
+
+bool LargerCommand(const pair<int64_t, const Edge*>& a,
+                   const pair<int64_t, const Edge*>& b) {
+  return a.first > b.first;
+}
+
+}  // anonymous namespace
+
+ManifestStats::ManifestStats()
+    : rule_count(0), rule_bindings(0), edge_count(0),
+      edges_with_bindings(0), edge_bindings(0), max_edge_bindings(0) {
+  memset(input_counts, 0, sizeof(input_counts));
+}
+
+void ManifestStats::StartFile(const string& path, int64_t bytes) {
+  File file = { path, bytes, 0, 0, 0 };
+  files.push_back(file);
+  OpenFile open = { files.size() - 1, GetTimeMicros(), 0 };
+  open_.push_back(open);
+}
+
+void ManifestStats::EndFile() {
+  OpenFile open = open_.back();
+  open_.pop_back();
+  int64_t elapsed = GetTimeMicros() - open.start;
+  files[open.file].micros = elapsed - open.nested;
+  if (!open_.empty())
+    open_.back().nested += elapsed;
+}
+
+void ManifestStats::AddBinding() {
+  if (!open_.empty())
+    ++files[open_.back().file].bindings;
+}
+
+void ManifestStats::AddRule(int bindings) {
+  ++rule_count;
+  rule_bindings += bindings;
+}
+
+void ManifestStats::AddEdge(int bindings) {
+  if (!open_.empty())
+    ++files[open_.back().file].edges;
+  if (bindings > 0) {
+    ++edges_with_bindings;
+    edge_bindings += bindings;
+    max_edge_bindings = max(bindings, max_edge_bindings);
+  }
+}
+
+void ManifestStats::CountState(const State& state) {
+  // Rules of different scopes may share a name.
+  map<const Rule*, RuleEntry> by_rule;
+  vector<pair<int64_t, const Edge*> > sizes;
+  sizes.reserve(state.edges_.size());
+  edge_count = (int)state.edges_.size();
+  for (vector<Edge*>::const_iterator i = state.edges_.begin();
+       i != state.edges_.end(); ++i) {
+    const Edge* edge = *i;
+    RuleEntry& rule = by_rule[edge->rule_];
+    rule.name = edge->rule_->name();
+    ++rule.edges;
+    int64_t bytes = (int64_t)edge->EvaluateCommand().size();
+    rule.command_bytes += bytes;
+    sizes.push_back(make_pair(bytes, edge));
+
+    int bucket = 0;
+    for (size_t n = edge->inputs_.size(); n > 0 && bucket < kInputBuckets - 1;
+         n >>= 1) {
+      ++bucket;
+    }
+    ++input_counts[bucket];
+  }
+
+  rules.clear();
+  for (map<const Rule*, RuleEntry>::iterator i = by_rule.begin();
+       i != by_rule.end(); ++i) {
+    rules.push_back(i->second);
+  }
+  sort(rules.begin(), rules.end(), MoreEdges);
+
+  size_t top = min(sizes.size(), (size_t)kTop);
+  partial_sort(sizes.begin(), sizes.begin() + top, sizes.end(),
+               LargerCommand);
+  commands.clear();
+  for (size_t i = 0; i < top && sizes[i].first > 0; ++i) {
+    const Edge* edge = sizes[i].second;
+    Command command = { edge->outputs_.empty()
+                            ? string() : edge->outputs_[0]->path(),
+                        sizes[i].first };
+    commands.push_back(command);
+  }
+}
+
+void ManifestStats::Report() const {
+  vector<const File*> slowest;
+  int64_t total_bytes = 0, total_micros = 0;
+  int width = (int)strlen("manifest file");
+  for (vector<File>::const_iterator i = files.begin(); i != files.end(); ++i) {
+    slowest.push_back(&*i);
+    total_bytes += i->bytes;
+    total_micros += i->micros;
+  }
+  size_t top = min(slowest.size(), (size_t)kTop);
+  partial_sort(slowest.begin(), slowest.begin() + top, slowest.end(),
+               SlowerFile);
+  for (size_t i = 0; i < top; ++i)
+    width = max((int)slowest[i]->path.size(), width);
+
+  printf("%-*s\t%-10s\t%-10s\t%-8s\t%s\n", width, "manifest file",
+         "parse (ms)", "bytes", "edges", "bindings");
+  for (size_t i = 0; i < top; ++i) {
+    const File* file = slowest[i];
+    printf("%-*s\t%-10.1f\t%-10lld\t%-8d\t%d\n", width, file->path.c_str(),
+           file->micros / 1000.0, (long long)file->bytes, file->edges,
+           file->bindings);
+  }
+  printf("%d files, %lld bytes parsed in %.1f ms\n", (int)files.size(),
+         (long long)total_bytes, total_micros / 1000.0);
+
+  printf("\n");
+  top = min(rules.size(), (size_t)kTop);
+  width = (int)strlen("rule");
+  for (size_t i = 0; i < top; ++i)
+    width = max((int)rules[i].name.size(), width);
+  printf("%-*s\t%-8s\t%-14s\t%s\n", width, "rule", "edges", "command bytes",
+         "avg command");
+  for (size_t i = 0; i < top; ++i) {
+    const RuleEntry& rule = rules[i];
+    printf("%-*s\t%-8d\t%-14lld\t%.0f\n", width, rule.name.c_str(),
+           rule.edges, (long long)rule.command_bytes,
+           rule.command_bytes / (double)rule.edges);
+  }
+
+  if (!commands.empty()) {
+    printf("\n");
+    width = (int)strlen("largest command of");
+    for (vector<Command>::const_iterator i = commands.begin();
+         i != commands.end(); ++i) {
+      width = max((int)i->output.size(), width);
+    }
+    printf("%-*s\t%s\n", width, "largest command of", "bytes");
+    for (vector<Command>::const_iterator i = commands.begin();
+         i != commands.end(); ++i) {
+      printf("%-*s\t%lld\n", width, i->output.c_str(), (long long)i->bytes);
+    }
+  }
+
+  printf("\n");
+  int file_bindings = 0;
+  for (vector<File>::const_iterator i = files.begin(); i != files.end(); ++i)
+    file_bindings += i->bindings;
+  printf("bindings: %d at file level, %d in %d rules, %d on %d of %d edges "
+         "(at most %d on one)\n",
+         file_bindings, rule_bindings, rule_count, edge_bindings,
+         edges_with_bindings, edge_count, max_edge_bindings);
+
+  printf("\n");
+  printf("%-10s\t%s\n", "inputs", "edges");
+  for (int i = 0; i < kInputBuckets; ++i) {
+    if (!input_counts[i])
+      continue;
+    char range[32];
+    if (i <= 1)
+      snprintf(range, sizeof(range), "%d", i);
+    else if (i == kInputBuckets - 1)
+      snprintf(range, sizeof(range), "%d+", 1 << (i - 1));
+    else
+      snprintf(range, sizeof(range), "%d-%d", 1 << (i - 1), (1 << i) - 1);
+    printf("%-10s\t%d\n", range, input_counts[i]);
+  }
+}
@@ -0,0 +1,110 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_MANIFEST_STATS_H_
+#define NINJA_MANIFEST_STATS_H_
+
+#include <string>
+#include <vector>
+
+#include "util.h"  // For int64_t.
+
+struct State;
+
+/// What parsing the manifest took, file by file, and the shape of the graph
+/// it built, for the debug mode telling which constructs of a generated
+/// manifest make it slow to load ('-d manifest').  The parser fills it in
+/// as it goes, so it only parses in order while this is on.
+struct ManifestStats {
+  ManifestStats();
+
+  /// How many of the files, rules and commands the report lists.
+  static const int kTop = 10;
+  /// Bucket 0 counts the edges without inputs, and bucket i those with
+  /// 2^(i-1) up to 2^i - 1 of them, the last one without an upper bound.
+  static const int kInputBuckets = 16;
+
+  struct File {
+    std::string path;
+    int64_t bytes;
+    /// Time spent parsing the file, without the files it includes.
+    int64_t micros;
+    int edges;
+    /// The variables set at the top level of the file.
+    int bindings;
+  };
+
+  struct RuleEntry {
+    std::string name;
+    int edges;
+    /// The bytes of the commands of its edges.
+    int64_t command_bytes;
+  };
+
+  struct Command {
+    std::string output;
+    int64_t bytes;
+  };
+
+  /// Start timing the parse of |path|, |bytes| long, inside the file
+  /// started last if it isn't over yet.
+  void StartFile(const std::string& path, int64_t bytes);
+  /// Stop timing the file started last.
+  void EndFile();
+
+  /// Count a variable set at the top level of the file being parsed.
+  void AddBinding();
+  /// Count a rule with |bindings| variables.
+  void AddRule(int bindings);
+  /// Count an edge with |bindings| variables of its own.
+  void AddEdge(int bindings);
+
+  /// Count the edges of each rule, their commands and their inputs in
+  /// |state|, once it's loaded.
+  void CountState(const State& state);
+
+  /// Print the slowest files, the rules with the most edges, the largest
+  /// commands, the bindings in each kind of scope and how many inputs the
+  /// edges have.
+  void Report() const;
+
+  /// In the order the files started.
+  std::vector<File> files;
+  /// By decreasing number of edges.
+  std::vector<RuleEntry> rules;
+  /// The kTop largest, largest first.
+  std::vector<Command> commands;
+  int input_counts[kInputBuckets];
+
+  int rule_count;
+  int rule_bindings;
+  int edge_count;
+  int edges_with_bindings;
+  int edge_bindings;
+  int max_edge_bindings;
+
+ private:
+  /// A file being parsed.
+  struct OpenFile {
+    size_t file;
+    int64_t start;
+    /// Time spent in the files it includes so far.
+    int64_t nested;
+  };
+  std::vector<OpenFile> open_;
+};
+
+extern ManifestStats* g_manifest_stats;
+
+#endif  // NINJA_MANIFEST_STATS_H_
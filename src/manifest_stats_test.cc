@@ -0,0 +1,117 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest_stats.h"
+
+#include <string.h>
+
+#include "manifest_parser.h"
+#include "state.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+struct ManifestStatsTest : public testing::Test {
+  virtual void SetUp() { g_manifest_stats = &stats_; }
+  virtual void TearDown() { g_manifest_stats = NULL; }
+
+  ManifestStats stats_;
+  State state_;
+  VirtualFileSystem fs_;
+};
+
+TEST_F(ManifestStatsTest, Files) {
+  fs_.Create("build.ninja",
+"flags = -O2\n"
+"rule cc\n"
+"  command = cc $flags $in -o $out\n"
+"  description = CC $out\n"
+"build a.o: cc a.c\n"
+"subninja sub.ninja\n"
+"include inc.ninja\n");
+  fs_.Create("sub.ninja",
+"flags = -O0\n"
+"extra = 1\n"
+"build b.o: cc b.c\n"
+"  flags = -g\n"
+"build c.o: cc c.c\n");
+  fs_.Create("inc.ninja", "build d.o: cc d.c\n");
+
+  ManifestParserOptions options;
+  options.parallel_subninjas_ = true;
+  ManifestParser parser(&state_, &fs_, options);
+  string err;
+  EXPECT_TRUE(parser.Load("build.ninja", &err));
+  ASSERT_EQ("", err);
+
+  ASSERT_EQ(3u, stats_.files.size());
+  EXPECT_EQ("build.ninja", stats_.files[0].path);
+  EXPECT_EQ(1, stats_.files[0].bindings);
+  EXPECT_EQ(1, stats_.files[0].edges);
+  EXPECT_EQ("sub.ninja", stats_.files[1].path);
+  EXPECT_EQ(71, stats_.files[1].bytes);
+  EXPECT_EQ(2, stats_.files[1].bindings);
+  EXPECT_EQ(2, stats_.files[1].edges);
+  EXPECT_EQ("inc.ninja", stats_.files[2].path);
+  EXPECT_EQ(1, stats_.files[2].edges);
+  for (size_t i = 0; i < stats_.files.size(); ++i)
+    EXPECT_GE(stats_.files[i].micros, 0);
+
+  EXPECT_EQ(1, stats_.rule_count);
+  EXPECT_EQ(2, stats_.rule_bindings);
+  EXPECT_EQ(1, stats_.edges_with_bindings);
+  EXPECT_EQ(1, stats_.edge_bindings);
+  EXPECT_EQ(1, stats_.max_edge_bindings);
+}
+
+TEST_F(ManifestStatsTest, CountState) {
+  ManifestParser parser(&state_, &fs_);
+  string err;
+  EXPECT_TRUE(parser.ParseTest(
+"rule cc\n"
+"  command = cc $in -o $out\n"
+"rule link\n"
+"  command = link $in -o $out\n"
+"build a.o: cc a.c\n"
+"build b.o: cc b.c | b.h\n"
+"build c.o: cc c.c | c.h d.h e.h\n"
+"build out: link a.o b.o c.o\n"
+"build all: phony\n", &err));
+  ASSERT_EQ("", err);
+
+  stats_.CountState(state_);
+  EXPECT_EQ(5, stats_.edge_count);
+  ASSERT_EQ(3u, stats_.rules.size());
+  EXPECT_EQ("cc", stats_.rules[0].name);
+  EXPECT_EQ(3, stats_.rules[0].edges);
+  EXPECT_EQ((int64_t)(strlen("cc a.c -o a.o") * 3),
+            stats_.rules[0].command_bytes);
+  EXPECT_EQ("link", stats_.rules[1].name);
+  EXPECT_EQ("phony", stats_.rules[2].name);
+
+  // The phony edge has no command.
+  ASSERT_EQ(4u, stats_.commands.size());
+  EXPECT_EQ("out", stats_.commands[0].output);
+  EXPECT_EQ((int64_t)strlen("link a.o b.o c.o -o out"),
+            stats_.commands[0].bytes);
+
+  EXPECT_EQ(1, stats_.input_counts[0]);  // all
+  EXPECT_EQ(1, stats_.input_counts[1]);  // a.o
+  EXPECT_EQ(2, stats_.input_counts[2]);  // b.o, out
+  EXPECT_EQ(1, stats_.input_counts[3]);  // c.o
+}
+
+}  // anonymous namespace
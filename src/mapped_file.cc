@@ -0,0 +1,179 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mapped_file.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// Nul-terminated files smaller than this are read rather than mapped.
+const size_t kMinMapSize = 64 << 10;
+
+}  // anonymous namespace
+
+#ifdef _WIN32
+MappedFile::MappedFile()
+    : data_(NULL), size_(0), mapping_(NULL), map_size_(0), mapped_(false) {}
+#else
+MappedFile::MappedFile()
+    : data_(NULL), size_(0), map_size_(0), mapped_(false) {}
+#endif
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+int MappedFile::Open(const string& path, string* err, bool nul_terminated) {
+  Close();
+#ifdef _WIN32
+  HANDLE f = ::CreateFileA(path.c_str(), GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                           OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (f == INVALID_HANDLE_VALUE) {
+    DWORD error = GetLastError();
+    err->assign(GetLastErrorString());
+    return error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND
+               ? -ENOENT : -EIO;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(f, &size)) {
+    err->assign(GetLastErrorString());
+    CloseHandle(f);
+    return -EIO;
+  }
+  size_ = (size_t)size.QuadPart;
+  if (size_ == 0) {
+    CloseHandle(f);
+    if (nul_terminated)
+      data_ = "";
+    return 0;
+  }
+  // The view ends with the file, whose last page is zero-filled past its
+  // end: a nul byte follows unless the file fills that page.
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  if (!nul_terminated ||
+      (size_ >= kMinMapSize && size_ % info.dwPageSize != 0)) {
+    mapping_ = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_)
+      data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+  }
+  CloseHandle(f);
+  if (!data_) {
+    if (mapping_)
+      CloseHandle(mapping_);
+    mapping_ = NULL;
+    size_ = 0;
+    // Fall back to reading the file.
+    if (int ret = ::ReadFile(path, &contents_, err))
+      return ret;
+    data_ = contents_.data();
+    size_ = contents_.size();
+    return 0;
+  }
+  mapped_ = true;
+  return 0;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    err->assign(strerror(errno));
+    return -errno;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int error = errno;
+    err->assign(strerror(error));
+    close(fd);
+    return -error;
+  }
+  size_ = st.st_size;
+  if (size_ == 0) {
+    close(fd);
+    if (nul_terminated)
+      data_ = "";
+    return 0;
+  }
+  void* data = MAP_FAILED;
+  if (!nul_terminated) {
+    map_size_ = size_;
+    data = mmap(NULL, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  } else if (size_ >= kMinMapSize) {
+    // Reserve a zero-filled page past the end of the file for the nul byte,
+    // then map the file over the start of it.
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    map_size_ = (size_ / page_size + 1) * page_size;
+    data = mmap(NULL, map_size_, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                -1, 0);
+    if (data != MAP_FAILED &&
+        mmap(data, size_, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+            MAP_FAILED) {
+      munmap(data, map_size_);
+      data = MAP_FAILED;
+    }
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    // Some file systems don't support mmap, and small files are cheaper to
+    // read; fall back to reading the file.
+    size_ = 0;
+    if (int ret = ::ReadFile(path, &contents_, err))
+      return ret;
+    data_ = contents_.data();
+    size_ = contents_.size();
+    return 0;
+  }
+  data_ = (const char*)data;
+  mapped_ = true;
+  return 0;
+#endif
+}
+
+void MappedFile::Close() {
+  if (mapped_) {
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+    CloseHandle(mapping_);
+    mapping_ = NULL;
+#else
+    munmap(const_cast<char*>(data_), map_size_);
+#endif
+  }
+  mapped_ = false;
+  data_ = NULL;
+  size_ = 0;
+  map_size_ = 0;
+  contents_.clear();
+}
+
+void MappedFile::Adopt(string* contents) {
+  Close();
+  contents_.swap(*contents);
+  data_ = contents_.data();
+  size_ = contents_.size();
+}
@@ -0,0 +1,61 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_MAPPED_FILE_H_
+#define NINJA_MAPPED_FILE_H_
+
+#include <stddef.h>
+
+#include <string>
+
+/// A read-only view of the full contents of a file, memory-mapped so that
+/// large files can be parsed in place without copying them.  Falls back to
+/// reading the file into memory where it can't be mapped.
+struct MappedFile {
+  MappedFile();
+  ~MappedFile();
+
+  /// Map |path|.  Returns -errno and fills in \a err on error, like
+  /// ReadFile().  If |nul_terminated|, data()[size()] is a nul byte, for
+  /// the lexers; small files are then read instead, which is cheaper than
+  /// mapping them.
+  int Open(const std::string& path, std::string* err,
+           bool nul_terminated = false);
+
+  /// Hold |contents|, which is swapped out, instead of a mapping.
+  void Adopt(std::string* contents);
+
+  /// Release the mapping; data() is invalid afterwards.
+  void Close();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+  /// Holds the contents if the file couldn't be mapped.
+  std::string contents_;
+#ifdef _WIN32
+  void* mapping_;
+#endif
+  /// The length of the mapping, which may extend past the file.
+  size_t map_size_;
+  bool mapped_;
+
+  MappedFile(const MappedFile& other);       // DO NOT IMPLEMENT
+  void operator=(const MappedFile& other);   // DO NOT IMPLEMENT
+};
+
+#endif  // NINJA_MAPPED_FILE_H_
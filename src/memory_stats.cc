@@ -0,0 +1,116 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "memory_stats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+// Have GetProcessMemoryInfo() come from kernel32, without linking psapi.
+#ifndef PSAPI_VERSION
+#define PSAPI_VERSION 2
+#endif
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+using namespace std;
+
+MemoryStats* g_memory_stats = NULL;
+
+void MemoryStats::Add(const string& kind, int64_t count, int64_t bytes) {
+  Entry* entry = FindOrAdd(kind);
+  entry->count += count;
+  entry->bytes += bytes;
+}
+
+void MemoryStats::Peak(const string& kind, int64_t count, int64_t bytes) {
+  Entry* entry = FindOrAdd(kind);
+  if (bytes > entry->bytes) {
+    entry->count = count;
+    entry->bytes = bytes;
+  }
+}
+
+const MemoryStats::Entry* MemoryStats::Find(const string& kind) const {
+  for (vector<Entry>::const_iterator i = entries_.begin();
+       i != entries_.end(); ++i) {
+    if (i->kind == kind)
+      return &*i;
+  }
+  return NULL;
+}
+
+MemoryStats::Entry* MemoryStats::FindOrAdd(const string& kind) {
+  if (const Entry* entry = Find(kind))
+    return const_cast<Entry*>(entry);
+  Entry entry = { kind, 0, 0 };
+  entries_.push_back(entry);
+  return &entries_.back();
+}
+
+void MemoryStats::Report() const {
+  int width = (int)strlen("total");
+  for (vector<Entry>::const_iterator i = entries_.begin();
+       i != entries_.end(); ++i) {
+    width = max((int)i->kind.size(), width);
+  }
+
+  printf("%-*s\t%-10s\t%s\n", width, "memory", "count", "bytes");
+  int64_t total = 0;
+  for (vector<Entry>::const_iterator i = entries_.begin();
+       i != entries_.end(); ++i) {
+    printf("%-*s\t%-10lld\t%lld\n", width, i->kind.c_str(),
+           (long long)i->count, (long long)i->bytes);
+    total += i->bytes;
+  }
+  printf("%-*s\t%-10s\t%lld\n", width, "total", "", (long long)total);
+
+  int64_t peak_rss = PeakRss();
+  if (peak_rss >= 0)
+    printf("peak RSS %lld bytes\n", (long long)peak_rss);
+}
+
+int64_t MemoryStats::HeapBytes(const string& s) {
+  // Short strings are kept in the string object itself.
+  const char* data = s.data();
+  const char* object = reinterpret_cast<const char*>(&s);
+  if (data >= object && data < object + sizeof(s))
+    return 0;
+  return (int64_t)s.capacity() + 1;
+}
+
+int64_t MemoryStats::PeakRss() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return -1;
+  return (int64_t)counters.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) < 0)
+    return -1;
+#ifdef __APPLE__
+  // macOS counts in bytes.
+  return (int64_t)usage.ru_maxrss;
+#else
+  return (int64_t)usage.ru_maxrss << 10;
+#endif
+#endif
+}
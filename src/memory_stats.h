@@ -0,0 +1,69 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_MEMORY_STATS_H_
+#define NINJA_MEMORY_STATS_H_
+
+#include <string>
+#include <vector>
+
+#include "util.h"  // For int64_t.
+
+/// Support for "-d memstats": the memory that the data structures of a
+/// build take, by kind, counted from the sizes and capacities of their
+/// objects, strings and containers.  What the allocator adds on top isn't
+/// counted, so the total falls short of the peak RSS, reported alongside.
+struct MemoryStats {
+  struct Entry {
+    std::string kind;
+    int64_t count;
+    int64_t bytes;
+  };
+
+  /// Count |count| objects of |kind| taking |bytes| in all.
+  void Add(const std::string& kind, int64_t count, int64_t bytes);
+
+  /// Count |count| objects of |kind| taking |bytes|, if that's more bytes
+  /// than any time before: for the things that come and go.
+  void Peak(const std::string& kind, int64_t count, int64_t bytes);
+
+  /// The counts of |kind|, or NULL if there are none.
+  const Entry* Find(const std::string& kind) const;
+
+  /// Print the counts, in the order they were first added, the total and
+  /// the peak RSS.
+  void Report() const;
+
+  /// The bytes |s| has on the heap: none if it's short enough to be
+  /// stored in the string itself.
+  static int64_t HeapBytes(const std::string& s);
+  template <typename T>
+  static int64_t HeapBytes(const std::vector<T>& v) {
+    return (int64_t)(v.capacity() * sizeof(T));
+  }
+
+  /// The most memory ninja had resident so far, in bytes, or -1 if the
+  /// system doesn't say.
+  static int64_t PeakRss();
+
+ private:
+  Entry* FindOrAdd(const std::string& kind);
+
+  std::vector<Entry> entries_;
+};
+
+/// The global memory stats, when "-d memstats" is on.
+extern MemoryStats* g_memory_stats;
+
+#endif  // NINJA_MEMORY_STATS_H_
@@ -0,0 +1,82 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "memory_stats.h"
+
+#include "graph.h"
+#include "state.h"
+#include "test.h"
+
+using namespace std;
+
+TEST(MemoryStatsTest, AddAndPeak) {
+  MemoryStats stats;
+  EXPECT_TRUE(stats.Find("Node") == NULL);
+  stats.Add("Node", 2, 100);
+  stats.Add("Node", 1, 50);
+  stats.Peak("Subprocess buffers", 4, 1000);
+  stats.Peak("Subprocess buffers", 8, 500);
+
+  const MemoryStats::Entry* entry = stats.Find("Node");
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ(3, entry->count);
+  EXPECT_EQ(150, entry->bytes);
+  entry = stats.Find("Subprocess buffers");
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ(4, entry->count);
+  EXPECT_EQ(1000, entry->bytes);
+}
+
+TEST(MemoryStatsTest, HeapBytes) {
+  EXPECT_EQ(0, MemoryStats::HeapBytes(string("a.o")));
+  string path(100, 'x');
+  EXPECT_GE(MemoryStats::HeapBytes(path), 101);
+  vector<int> ids(10);
+  EXPECT_GE(MemoryStats::HeapBytes(ids), (int64_t)(10 * sizeof(int)));
+  EXPECT_GT(MemoryStats::PeakRss(), 0);
+}
+
+TEST_F(StateTestWithBuiltinRules, CountMemory) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule link\n"
+"  command = link $in -o $out\n"
+"build a.o: cat a.c\n"
+"build b.o: cat b.c\n"
+"build out: link a.o b.o\n"
+"  extra = 1\n"));
+
+  MemoryStats stats;
+  state_.CountMemory(&stats);
+  const MemoryStats::Entry* entry = stats.Find("Node");
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ(5, entry->count);
+  EXPECT_EQ((int64_t)(5 * sizeof(Node)), entry->bytes);
+  entry = stats.Find("Edge");
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ(3, entry->count);
+  entry = stats.Find("Edge inputs_");
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ(4, entry->count);
+  // The global scope and that of "out".
+  entry = stats.Find("BindingEnv");
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ(2, entry->count);
+  // "cat", "link" and "phony".
+  entry = stats.Find("Rule");
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ(3, entry->count);
+  entry = stats.Find("EvalString tokens");
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_GT(entry->count, 0);
+}
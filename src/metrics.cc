@@ -86,9 +86,31 @@ ScopedMetric::ScopedMetric(Metric* metric) {
 ScopedMetric::~ScopedMetric() {
   if (!metric_)
     return;
-  metric_->count++;
-  int64_t dt = TimerToMicros(HighResTimer() - start_);
-  metric_->sum += dt;
+  metric_->Add(TimerToMicros(HighResTimer() - start_));
+}
+
+void Metric::Add(int64_t dt) {
+  ++count;
+  sum += dt;
+  if (dt > max)
+    max = dt;
+  int bucket = 0;
+  while (dt > 0 && bucket < kBuckets - 1) {
+    dt >>= 1;
+    ++bucket;
+  }
+  ++buckets[bucket];
+}
+
+int64_t Metric::Percentile(double p) const {
+  int64_t rank = (int64_t)(p * count + 0.5);
+  int64_t seen = 0;
+  for (int i = 0; i < kBuckets - 1; ++i) {
+    seen += buckets[i];
+    if (seen >= rank && seen > 0)
+      return min((int64_t)1 << i, max);
+  }
+  return max;
 }
 
 Metric* Metrics::NewMetric(const string& name) {
@@ -96,6 +118,9 @@ Metric* Metrics::NewMetric(const string& name) {
   metric->name = name;
   metric->count = 0;
   metric->sum = 0;
+  metric->max = 0;
+  fill(metric->buckets, metric->buckets + Metric::kBuckets, 0);
+  lock_guard<mutex> lock(mutex_);
   metrics_.push_back(metric);
   return metric;
 }
@@ -107,18 +132,47 @@ void Metrics::Report() {
     width = max((int)(*i)->name.size(), width);
   }
 
-  printf("%-*s\t%-6s\t%-9s\t%s\n", width,
-         "metric", "count", "avg (us)", "total (ms)");
+  printf("%-*s\t%-6s\t%-9s\t%-10s\t%-8s\t%-8s\t%-8s\t%s\n", width,
+         "metric", "count", "avg (us)", "total (ms)", "p50 (us)", "p90 (us)",
+         "p99 (us)", "max (us)");
   for (vector<Metric*>::iterator i = metrics_.begin();
        i != metrics_.end(); ++i) {
     Metric* metric = *i;
     double total = metric->sum / (double)1000;
     double avg = metric->sum / (double)metric->count;
-    printf("%-*s\t%-6d\t%-8.1f\t%.1f\n", width, metric->name.c_str(),
-           metric->count, avg, total);
+    printf("%-*s\t%-6d\t%-8.1f\t%-10.1f\t%-8lld\t%-8lld\t%-8lld\t%lld\n",
+           width, metric->name.c_str(), metric->count, avg, total,
+           (long long)metric->Percentile(0.5),
+           (long long)metric->Percentile(0.9),
+           (long long)metric->Percentile(0.99), (long long)metric->max);
   }
 }
 
+void Metrics::ReportJSON() {
+  printf("{\"metrics\": [");
+  for (vector<Metric*>::iterator i = metrics_.begin();
+       i != metrics_.end(); ++i) {
+    Metric* metric = *i;
+    // Metric names are literals in the source, without anything to escape.
+    printf("%s\n  {\"name\": \"%s\", \"count\": %d, \"total_us\": %lld, "
+           "\"p50_us\": %lld, \"p90_us\": %lld, \"p99_us\": %lld, "
+           "\"max_us\": %lld, \"buckets\": [",
+           i == metrics_.begin() ? "" : ",", metric->name.c_str(),
+           metric->count, (long long)metric->sum,
+           (long long)metric->Percentile(0.5),
+           (long long)metric->Percentile(0.9),
+           (long long)metric->Percentile(0.99), (long long)metric->max);
+    // Leave out the empty buckets at the end.
+    int used = Metric::kBuckets;
+    while (used > 0 && metric->buckets[used - 1] == 0)
+      --used;
+    for (int b = 0; b < used; ++b)
+      printf("%s%d", b ? ", " : "", metric->buckets[b]);
+    printf("]}");
+  }
+  printf("\n]}\n");
+}
+
 uint64_t Stopwatch::Now() const {
   return TimerToMicros(HighResTimer());
 }
@@ -127,3 +181,7 @@ int64_t GetTimeMillis() {
   return TimerToMicros(HighResTimer()) / 1000;
 }
 
+int64_t GetTimeMicros() {
+  return TimerToMicros(HighResTimer());
+}
+
@@ -15,6 +15,7 @@
 #ifndef NINJA_METRICS_H_
 #define NINJA_METRICS_H_
 
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -25,11 +26,28 @@
 
 /// A single metrics we're tracking, like "depfile load time".
 struct Metric {
+  /// The number of histogram buckets: bucket 0 counts the times under 1us,
+  /// and bucket i the times from 2^(i-1) up to 2^i us, the last one
+  /// without an upper bound.
+  static const int kBuckets = 40;
+
   std::string name;
   /// Number of times we've hit the code path.
   int count;
   /// Total time (in micros) we've spent on the code path.
   int64_t sum;
+  /// The longest time (in micros) spent on the code path at once.
+  int64_t max;
+  /// How many times took how long, in powers of two of micros.
+  int buckets[kBuckets];
+
+  /// Count one more time of |dt| micros.
+  void Add(int64_t dt);
+
+  /// An estimate of the time (in micros) under which the fraction |p| of
+  /// the times fall: the upper bound of the bucket it reaches, but no more
+  /// than |max|.
+  int64_t Percentile(double p) const;
 };
 
 
@@ -48,19 +66,29 @@ private:
 
 /// The singleton that stores metrics and prints the report.
 struct Metrics {
+  /// Safe to call from any thread.
   Metric* NewMetric(const std::string& name);
 
   /// Print a summary report to stdout.
   void Report();
 
+  /// Print the metrics as JSON to stdout, with their histograms.
+  void ReportJSON();
+
+  const std::vector<Metric*>& metrics() const { return metrics_; }
+
 private:
   std::vector<Metric*> metrics_;
+  std::mutex mutex_;
 };
 
 /// Get the current time as relative to some epoch.
 /// Epoch varies between platforms; only useful for measuring elapsed time.
 int64_t GetTimeMillis();
 
+/// Like GetTimeMillis(), in microseconds.
+int64_t GetTimeMicros();
+
 /// A simple stopwatch which returns the time
 /// in seconds since Restart() was called.
 struct Stopwatch {
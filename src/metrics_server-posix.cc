@@ -0,0 +1,236 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "metrics_server.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// Largest request accepted from a client.
+const size_t kMaxRequestSize = 8 << 10;
+
+/// How long a client may take to send its request.
+const int kRequestTimeoutSeconds = 1;
+
+#ifdef MSG_NOSIGNAL
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+bool SendAll(int fd, const string& data) {
+  const char* p = data.data();
+  size_t size = data.size();
+  while (size > 0) {
+    ssize_t len = send(fd, p, size, kSendFlags);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      return false;
+    p += len;
+    size -= len;
+  }
+  return true;
+}
+
+/// Whether |address| is a port number rather than a path.
+bool IsPort(const string& address, int* port) {
+  if (address.empty() || address.size() > 5 ||
+      address.find_first_not_of("0123456789") != string::npos)
+    return false;
+  *port = atoi(address.c_str());
+  return *port > 0 && *port < 65536;
+}
+
+/// Whether a process accepts connections on the socket at |addr|.
+bool IsServed(const sockaddr_un& addr) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return true;
+  bool served = connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0 ||
+                errno != ECONNREFUSED;
+  close(fd);
+  return served;
+}
+
+}  // namespace
+
+MetricsServer::MetricsServer() : listen_fd_(-1) {
+  stop_pipe_[0] = stop_pipe_[1] = -1;
+}
+
+MetricsServer::~MetricsServer() {
+  Stop();
+}
+
+bool MetricsServer::Listen(const string& address, string* err) {
+  int port;
+  if (IsPort(address, &port)) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+      *err = string("socket: ") + strerror(errno);
+      return false;
+    }
+    SetCloseOnExec(listen_fd_);
+    int reuse = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) {
+      *err = string("bind: ") + strerror(errno);
+      Stop();
+      return false;
+    }
+  } else {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (address.size() >= sizeof(addr.sun_path)) {
+      *err = "socket path too long: " + address;
+      return false;
+    }
+    strcpy(addr.sun_path, address.c_str());
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+      *err = string("socket: ") + strerror(errno);
+      return false;
+    }
+    SetCloseOnExec(listen_fd_);
+    for (int attempt = 0; ; ++attempt) {
+      if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) == 0)
+        break;
+      int bind_errno = errno;
+      if (bind_errno != EADDRINUSE || attempt > 0 || IsServed(addr)) {
+        *err = string("bind: ") + strerror(bind_errno);
+        Stop();
+        return false;
+      }
+      // Left behind by a build that died.
+      unlink(address.c_str());
+    }
+    socket_path_ = address;
+  }
+
+  if (listen(listen_fd_, 16) < 0 || pipe(stop_pipe_) < 0) {
+    *err = string("listen: ") + strerror(errno);
+    Stop();
+    return false;
+  }
+  SetCloseOnExec(stop_pipe_[0]);
+  SetCloseOnExec(stop_pipe_[1]);
+  thread_ = thread(&MetricsServer::Serve, this);
+  return true;
+}
+
+void MetricsServer::Stop() {
+  if (thread_.joinable()) {
+    char byte = 0;
+    while (write(stop_pipe_[1], &byte, 1) < 0 && errno == EINTR) {}
+    thread_.join();
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (stop_pipe_[i] >= 0)
+      close(stop_pipe_[i]);
+    stop_pipe_[i] = -1;
+  }
+  if (listen_fd_ >= 0)
+    close(listen_fd_);
+  listen_fd_ = -1;
+  if (!socket_path_.empty())
+    unlink(socket_path_.c_str());
+  socket_path_.clear();
+}
+
+void MetricsServer::Serve() {
+  for (;;) {
+    pollfd fds[2] = { { listen_fd_, POLLIN, 0 }, { stop_pipe_[0], POLLIN, 0 } };
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (fds[1].revents)
+      return;
+    if (!(fds[0].revents & POLLIN))
+      continue;
+    int fd = accept(listen_fd_, NULL, NULL);
+    if (fd >= 0)
+      Answer(fd);
+  }
+}
+
+void MetricsServer::Answer(int fd) {
+  SetCloseOnExec(fd);
+#ifdef SO_NOSIGPIPE
+  int no_sigpipe = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof(no_sigpipe));
+#endif
+  timeval timeout = { kRequestTimeoutSeconds, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  // Read up to the end of the headers; only the request line matters.
+  string request;
+  char buf[1024];
+  while (request.find("\r\n\r\n") == string::npos &&
+         request.find("\n\n") == string::npos &&
+         request.size() < kMaxRequestSize) {
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    request.append(buf, len);
+  }
+
+  string path;
+  if (request.compare(0, 4, "GET ") == 0)
+    path = request.substr(4, request.find_first_of(" \r\n", 4) - 4);
+  string status, body;
+  if (path == "/metrics" || path == "/") {
+    status = "200 OK";
+    lock_guard<mutex> lock(mutex_);
+    body = page_;
+  } else if (path.empty()) {
+    status = "405 Method Not Allowed";
+  } else {
+    status = "404 Not Found";
+  }
+
+  char length[32];
+  snprintf(length, sizeof(length), "%zu", body.size());
+  SendAll(fd, "HTTP/1.0 " + status + "\r\n"
+              "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+              "Content-Length: " + length + "\r\n"
+              "Connection: close\r\n"
+              "\r\n" + body);
+  close(fd);
+}
@@ -0,0 +1,76 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "metrics_server.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+using namespace std;
+
+void MetricsPage::Family(const char* name, const char* type,
+                         const char* help) {
+  family_ = name;
+  text_ += string("# HELP ") + name + " " + help + "\n";
+  text_ += string("# TYPE ") + name + " " + type + "\n";
+}
+
+void MetricsPage::AppendName(const char* label, const string& label_value) {
+  text_ += family_;
+  if (!label)
+    return;
+  text_ += string("{") + label + "=\"";
+  for (string::const_iterator c = label_value.begin();
+       c != label_value.end(); ++c) {
+    if (*c == '\\' || *c == '"')
+      text_ += '\\';
+    if (*c == '\n')
+      text_ += "\\n";
+    else
+      text_ += *c;
+  }
+  text_ += "\"}";
+}
+
+void MetricsPage::Sample(int64_t value) {
+  Sample(NULL, "", value);
+}
+
+void MetricsPage::Sample(double value) {
+  Sample(NULL, "", value);
+}
+
+void MetricsPage::Sample(const char* label, const string& label_value,
+                         int64_t value) {
+  AppendName(label, label_value);
+  char buf[32];
+  snprintf(buf, sizeof(buf), " %" PRId64 "\n", value);
+  text_ += buf;
+}
+
+void MetricsPage::Sample(const char* label, const string& label_value,
+                         double value) {
+  AppendName(label, label_value);
+  char buf[32];
+  if (value < 0)
+    snprintf(buf, sizeof(buf), " NaN\n");
+  else
+    snprintf(buf, sizeof(buf), " %.6g\n", value);
+  text_ += buf;
+}
+
+void MetricsServer::Publish(const MetricsPage& page) {
+  lock_guard<mutex> lock(mutex_);
+  page_ = page.text();
+}
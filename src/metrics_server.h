@@ -0,0 +1,91 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_METRICS_SERVER_H_
+#define NINJA_METRICS_SERVER_H_
+
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "util.h"  // For int64_t.
+
+/// Support for "ninja --metrics-listen": the progress of a running build,
+/// served over HTTP in the Prometheus text format, for scrapers and
+/// dashboards to follow long builds with.
+
+/// A page in the Prometheus text exposition format (version 0.0.4).
+struct MetricsPage {
+  /// Start the metric family |name|, of |type| "counter" or "gauge".
+  void Family(const char* name, const char* type, const char* help);
+
+  /// Add a sample of the family started last.  A negative |value| in the
+  /// double overload stands for an unknown one, and reads as NaN.
+  void Sample(int64_t value);
+  void Sample(double value);
+  /// Add a sample with one label, as in name{label="label_value"}.
+  void Sample(const char* label, const std::string& label_value,
+              int64_t value);
+  void Sample(const char* label, const std::string& label_value,
+              double value);
+
+  const std::string& text() const { return text_; }
+
+ private:
+  void AppendName(const char* label, const std::string& label_value);
+
+  std::string text_;
+  std::string family_;
+};
+
+/// Serves the last page published to it on a background thread, to HTTP
+/// clients of a TCP port on the loopback interface, or of a Unix socket.
+/// Only implemented on POSIX systems.
+struct MetricsServer {
+  MetricsServer();
+  /// Stops the server, and removes its Unix socket.
+  ~MetricsServer();
+
+  /// Listen at |address|: a port number on 127.0.0.1, or else the path of
+  /// a Unix socket to create, and start serving.
+  bool Listen(const std::string& address, std::string* err);
+
+  /// Serve |page| from now on.  Safe to call from any thread.
+  void Publish(const MetricsPage& page);
+
+  /// Stop serving, and close the socket.
+  void Stop();
+
+ private:
+  /// Answer the clients on the server thread, until Stop().
+  void Serve();
+  /// Answer the request of one client on |fd|, then close it.
+  void Answer(int fd);
+
+  int listen_fd_;
+  /// Written to by Stop() to end Serve().
+  int stop_pipe_[2];
+  /// The path of our Unix socket, to remove once done, or "".
+  std::string socket_path_;
+  std::thread thread_;
+
+  std::mutex mutex_;
+  std::string page_;
+
+  // Unimplemented copy ctor and operator= ensure we don't close twice.
+  MetricsServer(const MetricsServer& other);    // DO NOT IMPLEMENT
+  void operator=(const MetricsServer& other);   // DO NOT IMPLEMENT
+};
+
+#endif  // NINJA_METRICS_SERVER_H_
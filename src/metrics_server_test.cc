@@ -0,0 +1,109 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "metrics_server.h"
+
+#ifndef _WIN32
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "test.h"
+
+using namespace std;
+
+TEST(MetricsPageTest, Format) {
+  MetricsPage page;
+  page.Family("ninja_edges_started_total", "counter", "Commands started.");
+  page.Sample((int64_t)12);
+  page.Family("ninja_current_rate", "gauge", "Rate.");
+  page.Sample(2.5);
+  page.Sample(-1.0);
+  EXPECT_EQ("# HELP ninja_edges_started_total Commands started.\n"
+            "# TYPE ninja_edges_started_total counter\n"
+            "ninja_edges_started_total 12\n"
+            "# HELP ninja_current_rate Rate.\n"
+            "# TYPE ninja_current_rate gauge\n"
+            "ninja_current_rate 2.5\n"
+            "ninja_current_rate NaN\n",
+            page.text());
+}
+
+TEST(MetricsPageTest, EscapeLabels) {
+  MetricsPage page;
+  page.Family("ninja_pool_current_use", "gauge", "Use.");
+  page.Sample("pool", "link", (int64_t)3);
+  page.Sample("pool", "a\"b\\c\nd", (int64_t)0);
+  EXPECT_EQ("# HELP ninja_pool_current_use Use.\n"
+            "# TYPE ninja_pool_current_use gauge\n"
+            "ninja_pool_current_use{pool=\"link\"} 3\n"
+            "ninja_pool_current_use{pool=\"a\\\"b\\\\c\\nd\"} 0\n",
+            page.text());
+}
+
+#ifndef _WIN32
+
+namespace {
+
+/// Send |request| to the Unix socket at |path| and return the response.
+string Fetch(const string& path, const string& request) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  string response;
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0 &&
+      write(fd, request.data(), request.size()) == (ssize_t)request.size()) {
+    char buf[1024];
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+      response.append(buf, len);
+  }
+  close(fd);
+  return response;
+}
+
+}  // namespace
+
+TEST(MetricsServerTest, Serve) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("MetricsServerTest-Serve");
+  MetricsServer server;
+  string err;
+  ASSERT_TRUE(server.Listen("metrics.sock", &err));
+
+  MetricsPage page;
+  page.Family("ninja_edges_running", "gauge", "Commands running.");
+  page.Sample((int64_t)4);
+  server.Publish(page);
+
+  string response = Fetch("metrics.sock", "GET /metrics HTTP/1.1\r\n"
+                                          "Host: localhost\r\n\r\n");
+  EXPECT_EQ(0u, response.find("HTTP/1.0 200 OK\r\n"));
+  EXPECT_NE(string::npos, response.find("Content-Length: " +
+                                        to_string(page.text().size())));
+  EXPECT_EQ(response.size() - page.text().size(), response.find(page.text()));
+
+  response = Fetch("metrics.sock", "GET /other HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(0u, response.find("HTTP/1.0 404 Not Found\r\n"));
+
+  server.Stop();
+  EXPECT_NE(0, access("metrics.sock", F_OK));
+  temp_dir.Cleanup();
+}
+
+#endif  // !_WIN32
@@ -0,0 +1,51 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "metrics.h"
+
+#include "test.h"
+
+TEST(MetricsTest, Histogram) {
+  Metrics metrics;
+  Metric* metric = metrics.NewMetric("stat");
+  metric->Add(0);
+  metric->Add(1);
+  metric->Add(3);
+  metric->Add(4);
+  metric->Add(1000);
+  EXPECT_EQ(5, metric->count);
+  EXPECT_EQ(1008, metric->sum);
+  EXPECT_EQ(1000, metric->max);
+  EXPECT_EQ(1, metric->buckets[0]);
+  EXPECT_EQ(1, metric->buckets[1]);
+  EXPECT_EQ(1, metric->buckets[2]);
+  EXPECT_EQ(1, metric->buckets[3]);
+  EXPECT_EQ(1, metric->buckets[10]);
+}
+
+TEST(MetricsTest, Percentile) {
+  Metrics metrics;
+  Metric* metric = metrics.NewMetric("stat");
+  EXPECT_EQ(0, metric->Percentile(0.5));
+
+  // A long tail: 98 fast times, and two slow ones.
+  for (int i = 0; i < 98; ++i)
+    metric->Add(10);
+  metric->Add(5000);
+  metric->Add(70000);
+  EXPECT_EQ(16, metric->Percentile(0.5));
+  EXPECT_EQ(16, metric->Percentile(0.9));
+  EXPECT_EQ(8192, metric->Percentile(0.99));
+  EXPECT_EQ(70000, metric->Percentile(1));
+}
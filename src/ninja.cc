@@ -17,7 +17,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <cstdlib>
+#include <functional>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #ifdef _WIN32
 #include "getopt.h"
@@ -31,18 +38,42 @@
 #include <unistd.h>
 #endif
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+extern char** environ;
+#endif
+
+#include "action_cache.h"
 #include "browse.h"
 #include "build.h"
+#include "build_dir_lock.h"
 #include "build_log.h"
 #include "deps_log.h"
 #include "clean.h"
+#include "clparser.h"
+#include "daemon.h"
 #include "debug_flags.h"
 #include "disk_interface.h"
+#include "explain_log.h"
 #include "graph.h"
 #include "graphviz.h"
+#include "hash_log.h"
+#include "jobserver.h"
+#include "line_printer.h"
+#include "manifest_cache.h"
+#include "manifest_stats.h"
 #include "manifest_parser.h"
+#include "memory_stats.h"
 #include "metrics.h"
+#include "metrics_server.h"
+#include "parallel.h"
+#include "remote_cache.h"
+#include "shard.h"
 #include "state.h"
+#include "trace.h"
 #include "util.h"
 #include "version.h"
 
@@ -60,6 +91,9 @@ namespace {
 
 struct Tool;
 
+/// Whether '-d stats=json' asked for the metrics as JSON.
+bool g_metrics_json = false;
+
 /// Command-line options.
 struct Options {
   /// Build file to load.
@@ -76,13 +110,39 @@ struct Options {
 
   /// Whether phony cycles should warn or print an error.
   bool phony_cycle_should_err;
+
+  /// Whether -j was passed explicitly.
+  bool parallelism_set;
+
+  /// Whether to create a jobserver pool for the commands we run.
+  bool jobserver_pool;
+
+  /// Whether to hand the build to a daemon keeping the manifest loaded.
+  bool daemon;
+
+  /// The directory of the action cache, if any, and its size budget in
+  /// bytes.
+  const char* cache_dir;
+  int64_t cache_size;
+
+  /// The URL of the HTTP server to share the action cache through, if any.
+  const char* remote_cache;
+
+  /// Where to serve the progress of the build, if anywhere: a port or the
+  /// path of a Unix socket.
+  const char* metrics_listen;
+
+  /// Whether to load only the subninjas the targets need, when the index
+  /// of the manifest cache tells which.
+  bool lazy_subninjas;
 };
 
 /// The Ninja main() loads up a series of data structures; various tools need
 /// to poke into these, so store them as fields on an object.
 struct NinjaMain : public BuildLogUser {
   NinjaMain(const char* ninja_command, const BuildConfig& config) :
-      ninja_command_(ninja_command), config_(config) {}
+      ninja_command_(ninja_command), config_(config), logs_loaded_(false),
+      manifest_partial_(false) {}
 
   /// Command line used to run Ninja.
   const char* ninja_command_;
@@ -99,8 +159,24 @@ struct NinjaMain : public BuildLogUser {
   /// The build directory, used for storing the build log etc.
   string build_dir_;
 
+  /// Shared with the other processes building in |build_dir_|, if
+  /// --shared-builddir.  The logs refer to it, so it outlives them.
+  BuildDirLock build_dir_lock_;
+
   BuildLog build_log_;
   DepsLog deps_log_;
+  HashLog hash_log_;
+
+  /// What parsing the manifest added to |state_|, file by file.
+  ManifestRecord manifest_record_;
+
+  /// Whether LoadLogs() already loaded the logs, which OpenBuildLog() and
+  /// OpenDepsLog() then only open for writing.
+  bool logs_loaded_;
+
+  /// Whether only the subninjas some targets need were loaded, so that the
+  /// outputs |state_| doesn't know may still be live.
+  bool manifest_partial_;
 
   /// The type of functions that are the entry points to tools (subcommands).
   typedef int (NinjaMain::*ToolFunc)(const Options*, int, char**);
@@ -121,14 +197,34 @@ struct NinjaMain : public BuildLogUser {
   int ToolMSVC(const Options* options, int argc, char* argv[]);
   int ToolTargets(const Options* options, int argc, char* argv[]);
   int ToolCommands(const Options* options, int argc, char* argv[]);
+  int ToolDirty(const Options* options, int argc, char* argv[]);
   int ToolClean(const Options* options, int argc, char* argv[]);
   int ToolCleanDead(const Options* options, int argc, char* argv[]);
   int ToolCompilationDatabase(const Options* options, int argc, char* argv[]);
   int ToolRecompact(const Options* options, int argc, char* argv[]);
   int ToolRestat(const Options* options, int argc, char* argv[]);
+  int ToolUsage(const Options* options, int argc, char* argv[]);
+  int ToolShard(const Options* options, int argc, char* argv[]);
   int ToolUrtle(const Options* options, int argc, char** argv);
   int ToolRules(const Options* options, int argc, char* argv[]);
 
+  /// Path of the log file |name| in the build directory.
+  string LogPath(const char* name) const;
+
+  /// Load the build log at |path|, reporting any problem.
+  LoadStatus LoadBuildLog(const string& path);
+
+  /// Report the problem, if any, loading the build log at |path| found.
+  LoadStatus ReportBuildLogLoad(const string& path, LoadStatus status,
+                                const string& err);
+
+  /// Load the deps log at |path|, reporting any problem.
+  LoadStatus LoadDepsLog(const string& path);
+
+  /// Load both logs, at once, without opening them for writing.
+  /// @return false on error.
+  bool LoadLogs();
+
   /// Open the build log.
   /// @return LOAD_ERROR on error.
   bool OpenBuildLog(bool recompact_only = false);
@@ -137,10 +233,32 @@ struct NinjaMain : public BuildLogUser {
   /// @return LOAD_ERROR on error.
   bool OpenDepsLog(bool recompact_only = false);
 
+  /// Open the hash log: load it, then open for writing.
+  /// @return false on error.
+  bool OpenHashLog(bool recompact_only = false);
+
+  /// Close the logs opened for writing, finishing their recompaction if
+  /// it runs in the background.
+  void CloseLogs();
+
   /// Ensure the build directory exists, creating it if necessary.
   /// @return false on error.
   bool EnsureBuildDirExists();
 
+  /// Join the other processes building in the build directory, for
+  /// --shared-builddir, before the logs are loaded.
+  /// @return false on error.
+  bool LockBuildDir();
+
+  /// For tools that run after the flags: fill |index| from the manifest
+  /// cache, if it's up to date.
+  bool LoadManifestIndex(const Options& options, ManifestIndex* index);
+
+  /// For tools that run after the flags: load the manifest, as it is for
+  /// the tools that run after the load.
+  /// @return false on error.
+  bool EnsureManifestLoaded(const Options& options);
+
   /// Rebuild the manifest, if necessary.
   /// Fills in \a err on error.
   /// @return true if the manifest was rebuilt.
@@ -153,24 +271,31 @@ struct NinjaMain : public BuildLogUser {
   /// Dump the output requested by '-d stats'.
   void DumpMetrics();
 
+  /// Dump the output requested by '-d memstats'.
+  void DumpMemoryStats();
+
+  /// Dump the output requested by '-d manifest', about the manifest just
+  /// parsed.
+  void DumpManifestStats();
+
   virtual bool IsPathDead(StringPiece s) const {
+    vector<bool> dead;
+    FindDeadPaths(vector<StringPiece>(1, s), &dead);
+    return dead[0];
+  }
+
+  virtual void FindDeadPaths(const vector<StringPiece>& paths,
+                             vector<bool>* dead) const {
+    if (manifest_partial_) {
+      dead->assign(paths.size(), false);
+      return;
+    }
+    FindDeadOutputs(state_, disk_interface_, paths, dead);
+  }
+
+  virtual Edge* EdgeForPath(StringPiece s) const {
     Node* n = state_.LookupNode(s);
-    if (n && n->in_edge())
-      return false;
-    // Just checking n isn't enough: If an old output is both in the build log
-    // and in the deps log, it will have a Node object in state_.  (It will also
-    // have an in edge if one of its inputs is another output that's in the deps
-    // log, but having a deps edge product an output that's input to another deps
-    // edge is rare, and the first recompaction will delete all old outputs from
-    // the deps log, and then a second recompaction will clear the build log,
-    // which seems good enough for this corner case.)
-    // Do keep entries around for files which still exist on disk, for
-    // generators that want to use this information.
-    string err;
-    TimeStamp mtime = disk_interface_.Stat(s.AsString(), &err);
-    if (mtime == -1)
-      Error("%s", err.c_str());  // Log and ignore Stat() errors.
-    return mtime == 0;
+    return n ? n->in_edge() : NULL;
   }
 };
 
@@ -199,6 +324,10 @@ struct Tool {
   NinjaMain::ToolFunc func;
 };
 
+/// The default size budget of the action cache, in megabytes, and the
+/// default number of remote commands per -j.
+enum { kDefaultCacheSizeMB = 5 << 10, kDefaultRemoteJobsFactor = 8 };
+
 /// Print usage information.
 void Usage(const BuildConfig& config) {
   fprintf(stderr,
@@ -209,6 +338,25 @@ void Usage(const BuildConfig& config) {
 "options:\n"
 "  --version      print ninja version (\"%s\")\n"
 "  -v, --verbose  show all command lines while building\n"
+"  --jobserver    share -j with the commands run through a GNU make jobserver\n"
+"  --daemon       keep the loaded build in a background process between runs\n"
+"  --direct-spawn spawn commands that need no shell without /bin/sh\n"
+"  --cache-dir=DIR  restore the outputs of rules with cache = 1 from DIR\n"
+"  --cache-size=MB  evict from the cache beyond MB megabytes [default=%d]\n"
+"  --remote-cache=URL  share the --cache-dir entries through an HTTP server\n"
+"  --remote-exec=CMD  run the commands of rules with remote = 1 as 'CMD command'\n"
+"  --remote-jobs=N    run N remote commands in parallel [default=%d x -j]\n"
+"  --adaptive-jobs=MIN:MAX  tune -j between MIN and MAX to keep the CPUs busy\n"
+"  --metrics-listen=PORT|PATH  serve build progress to Prometheus over HTTP\n"
+"  --lazy-depfiles  don't read the depfiles of edges that are dirty anyway\n"
+"  --fail-fast    kill the running commands and stop on the first failure\n"
+"  --numa         pin each command to the CPUs of a NUMA node, in turn\n"
+"  --cgroup=DIR   run each command in a cgroup of its own under cgroup v2 DIR\n"
+"  --shared-builddir  build alongside other ninjas running in the same build dir\n"
+"  --stream-scan  start commands while the rest of the graph is still scanned\n"
+"  --prefetch=MB  read ahead up to MB megabytes of inputs of the next commands\n"
+"  --lazy-subninjas  load only the subninjas the targets need, if known\n"
+"  --dedup-output  print the diagnostics the commands repeat only once\n"
 "\n"
 "  -C DIR   change to DIR before doing anything else\n"
 "  -f FILE  specify input build file [default=build.ninja]\n"
@@ -216,13 +364,15 @@ void Usage(const BuildConfig& config) {
 "  -j N     run N jobs in parallel (0 means infinity) [default=%d on this system]\n"
 "  -k N     keep going until N jobs fail (0 means infinity) [default=1]\n"
 "  -l N     do not start new jobs if the load average is greater than N\n"
+"  -m N     do not start new jobs if less than N MiB of memory is available\n"
 "  -n       dry run (don't run commands but act like they succeeded)\n"
 "\n"
 "  -d MODE  enable debugging (use '-d list' to list modes)\n"
 "  -t TOOL  run a subtool (use '-t list' to list subtools)\n"
 "    terminates toplevel options; further flags are passed to the tool\n"
 "  -w FLAG  adjust warnings (use '-w list' to list warnings)\n",
-          kNinjaVersion, config.parallelism);
+          kNinjaVersion, kDefaultCacheSizeMB, kDefaultRemoteJobsFactor,
+          config.parallelism);
 }
 
 /// Choose a default value for the -j (parallelism) flag.
@@ -238,6 +388,78 @@ int GuessParallelism() {
   }
 }
 
+/// Join the jobserver described by MAKEFLAGS if we're run by make, or
+/// create a pool for our own commands if --jobserver was passed.
+void SetupJobserver(const Options& options, BuildConfig* config,
+                    Jobserver* jobserver) {
+  string err;
+  if (const char* makeflags = getenv("MAKEFLAGS")) {
+    Jobserver::Config jobserver_config;
+    if (!Jobserver::ParseMakeflags(makeflags, &jobserver_config, &err)) {
+      Warning("ignoring jobserver: %s", err.c_str());
+      return;
+    }
+    if (jobserver_config.mode != Jobserver::Config::kModeNone) {
+      if (!jobserver->Connect(jobserver_config, &err)) {
+        Warning("ignoring jobserver: %s", err.c_str());
+        return;
+      }
+      // The jobserver imposes the limit, unless -j asks for a lower one.
+      if (!options.parallelism_set)
+        config->parallelism = INT_MAX;
+      config->jobserver = jobserver;
+      return;
+    }
+  }
+
+  if (options.jobserver_pool) {
+    if (!jobserver->CreatePool(config->parallelism, &err)) {
+      Warning("not creating jobserver: %s", err.c_str());
+      return;
+    }
+    config->jobserver = jobserver;
+  }
+}
+
+/// Serve the progress of the build at --metrics-listen's address, if given.
+void SetupMetricsServer(const Options& options, BuildConfig* config) {
+  if (!options.metrics_listen)
+    return;
+#ifdef _WIN32
+  Warning("--metrics-listen is not supported on Windows");
+#else
+  // Static, so that exit() stops it and removes its socket.
+  static MetricsServer server;
+  string err;
+  if (!server.Listen(options.metrics_listen, &err)) {
+    Warning("not serving metrics: %s", err.c_str());
+    return;
+  }
+  config->metrics_server = &server;
+#endif
+}
+
+/// Share the action cache through --remote-cache's server, if given.
+void SetupRemoteCache(const Options& options, ActionCache* action_cache,
+                      RemoteCache* remote_cache) {
+  if (!options.remote_cache)
+    return;
+#ifdef _WIN32
+  Warning("--remote-cache is not supported on Windows");
+#else
+  if (!options.cache_dir) {
+    Warning("--remote-cache needs a --cache-dir; not using it");
+    return;
+  }
+  string err;
+  if (!remote_cache->Init(options.remote_cache, &err)) {
+    Warning("not using the remote cache: %s", err.c_str());
+    return;
+  }
+  action_cache->set_remote(remote_cache);
+#endif
+}
+
 /// Rebuild the build manifest, if necessary.
 /// Returns true if the manifest was rebuilt.
 bool NinjaMain::RebuildManifest(const char* input_file, string* err) {
@@ -250,6 +472,9 @@ bool NinjaMain::RebuildManifest(const char* input_file, string* err) {
     return false;
 
   Builder builder(&state_, config_, &build_log_, &deps_log_, &disk_interface_);
+  builder.SetHashLog(&hash_log_);
+  if (build_dir_lock_.is_open())
+    builder.SetBuildDirLock(&build_dir_lock_);
   if (!builder.AddTarget(node, err))
     return false;
 
@@ -333,6 +558,53 @@ bool NinjaMain::CollectTargetsFromArgs(int argc, char* argv[],
 }
 
 int NinjaMain::ToolGraph(const Options* options, int argc, char* argv[]) {
+  // The graph tool uses getopt, and expects argv[0] to contain the name of
+  // the tool, i.e. "graph".
+  argc++;
+  argv--;
+
+  GraphViz graph(&state_, &disk_interface_);
+  optind = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, const_cast<char*>("hl:c:d"))) != -1) {
+    switch (opt) {
+    case 'l': {
+      char* end;
+      graph.max_depth_ = strtol(optarg, &end, 10);
+      if (*end != 0 || graph.max_depth_ < 0) {
+        Error("invalid -l parameter");
+        return 1;
+      }
+      break;
+    }
+    case 'c':
+      if (strcmp(optarg, "rule") == 0) {
+        graph.collapse_ = GraphViz::kCollapseRule;
+      } else if (strcmp(optarg, "dir") == 0) {
+        graph.collapse_ = GraphViz::kCollapseDir;
+      } else {
+        Error("unknown -c mode '%s', expected 'rule' or 'dir'", optarg);
+        return 1;
+      }
+      break;
+    case 'd':
+      graph.dirty_only_ = true;
+      break;
+    case 'h':
+    default:
+      printf("usage: ninja -t graph [options] [targets...]\n"
+"\n"
+"options:\n"
+"  -l DEPTH    stop DEPTH edges away from the targets\n"
+"  -c rule|dir draw one node per rule, or per directory\n"
+"  -d          draw only what the next build would run\n"
+             );
+      return 1;
+    }
+  }
+  argv += optind;
+  argc -= optind;
+
   vector<Node*> nodes;
   string err;
   if (!CollectTargetsFromArgs(argc, argv, &nodes, &err)) {
@@ -340,7 +612,18 @@ int NinjaMain::ToolGraph(const Options* options, int argc, char* argv[]) {
     return 1;
   }
 
-  GraphViz graph(&state_, &disk_interface_);
+  if (graph.dirty_only_) {
+    DependencyScan scan(&state_, &build_log_, &deps_log_, &disk_interface_,
+                        &config_.depfile_parser_options);
+    for (vector<Node*>::const_iterator n = nodes.begin(); n != nodes.end();
+         ++n) {
+      if (!scan.RecomputeDirty(*n, &err)) {
+        Error("%s", err.c_str());
+        return 1;
+      }
+    }
+  }
+
   graph.Start();
   for (vector<Node*>::const_iterator n = nodes.begin(); n != nodes.end(); ++n)
     graph.AddTarget(*n);
@@ -349,14 +632,96 @@ int NinjaMain::ToolGraph(const Options* options, int argc, char* argv[]) {
   return 0;
 }
 
+/// Print what "ninja -t query" shows of |node|: the inputs of its in edge
+/// (and, with |deps_log|, the deps recorded for it), the outputs of its out
+/// edges, and, with |dependents|, every output that depends on it.
+void PrintQuery(Node* node, DepsLog* deps_log, DependentsIndex* dependents) {
+  printf("%s:\n", node->path().c_str());
+  if (Edge* edge = node->in_edge()) {
+    printf("  input: %s\n", edge->rule_->name().c_str());
+    for (int in = 0; in < (int)edge->inputs_.size(); in++) {
+      const char* label = "";
+      if (edge->is_implicit(in))
+        label = "| ";
+      else if (edge->is_order_only(in))
+        label = "|| ";
+      printf("    %s%s\n", label, edge->inputs_[in]->path().c_str());
+    }
+  }
+  if (deps_log) {
+    DepsLog::Deps* deps = deps_log->GetDeps(node);
+    if (deps && deps_log->IsDepsEntryLiveFor(node)) {
+      printf("  deps:\n");
+      for (int i = 0; i < deps->node_count; ++i)
+        printf("    %s\n", deps->nodes[i]->path().c_str());
+    }
+  }
+  printf("  outputs:\n");
+  for (vector<Edge*>::const_iterator edge = node->out_edges().begin();
+       edge != node->out_edges().end(); ++edge) {
+    for (vector<Node*>::iterator out = (*edge)->outputs_.begin();
+         out != (*edge)->outputs_.end(); ++out) {
+      printf("    %s\n", (*out)->path().c_str());
+    }
+  }
+  if (dependents) {
+    vector<Node*> nodes;
+    dependents->Dependents(node, &nodes);
+    printf("  dependents:\n");
+    for (vector<Node*>::iterator n = nodes.begin(); n != nodes.end(); ++n)
+      printf("    %s\n", (*n)->path().c_str());
+  }
+}
+
 int NinjaMain::ToolQuery(const Options* options, int argc, char* argv[]) {
-  if (argc == 0) {
+  // The query tool uses getopt, and expects argv[0] to contain the name of
+  // the tool, i.e. "query".
+  argc++;
+  argv--;
+
+  const char* input = NULL;
+  bool show_deps = false;
+  bool show_dependents = false;
+  optind = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, const_cast<char*>("hi:dr"))) != -1) {
+    switch (opt) {
+    case 'i':
+      input = optarg;
+      break;
+    case 'd':
+      show_deps = true;
+      break;
+    case 'r':
+      show_dependents = true;
+      break;
+    case 'h':
+    default:
+      printf("usage: ninja -t query [options] [targets...]\n"
+"\n"
+"options:\n"
+"  -i FILE  then query the paths in FILE, one per line, answering each as\n"
+"           it is read; '-' reads them from stdin\n"
+"  -d       list the deps the deps log recorded too\n"
+"  -r       list every output that depends on the target, directly or not\n"
+             );
+      return 1;
+    }
+  }
+  argv += optind;
+  argc -= optind;
+
+  if (argc == 0 && !input) {
     Error("expected a target to query");
     return 1;
   }
 
-  DyndepLoader dyndep_loader(&state_, &disk_interface_);
+  DepsLog* deps_log = show_deps ? &deps_log_ : NULL;
+  DependentsIndex index(&deps_log_);
+  DependentsIndex* dependents = show_dependents ? &index : NULL;
 
+  vector<Node*> nodes;
+  vector<Node*> dyndeps;
   for (int i = 0; i < argc; ++i) {
     string err;
     Node* node = CollectTarget(argv[i], &err);
@@ -364,41 +729,135 @@ int NinjaMain::ToolQuery(const Options* options, int argc, char* argv[]) {
       Error("%s", err.c_str());
       return 1;
     }
+    nodes.push_back(node);
+    Edge* edge = node->in_edge();
+    if (edge && edge->dyndep_ && edge->dyndep_->dyndep_pending() &&
+        find(dyndeps.begin(), dyndeps.end(), edge->dyndep_) == dyndeps.end())
+      dyndeps.push_back(edge->dyndep_);
+  }
 
-    printf("%s:\n", node->path().c_str());
-    if (Edge* edge = node->in_edge()) {
-      if (edge->dyndep_ && edge->dyndep_->dyndep_pending()) {
-        if (!dyndep_loader.LoadDyndeps(edge->dyndep_, &err)) {
-          Warning("%s\n", err.c_str());
-        }
-      }
-      printf("  input: %s\n", edge->rule_->name().c_str());
-      for (int in = 0; in < (int)edge->inputs_.size(); in++) {
-        const char* label = "";
-        if (edge->is_implicit(in))
-          label = "| ";
-        else if (edge->is_order_only(in))
-          label = "|| ";
-        printf("    %s%s\n", label, edge->inputs_[in]->path().c_str());
-      }
+  // Load the dyndep files of all the targets together.
+  DyndepLoader dyndep_loader(&state_, &disk_interface_);
+  vector<DyndepFile> ddfs;
+  vector<string> errs;
+  dyndep_loader.LoadDyndeps(dyndeps, &ddfs, &errs);
+  for (vector<string>::iterator err = errs.begin(); err != errs.end(); ++err) {
+    if (!err->empty())
+      Warning("%s\n", err->c_str());
+  }
+
+  for (vector<Node*>::iterator n = nodes.begin(); n != nodes.end(); ++n)
+    PrintQuery(*n, deps_log, dependents);
+  if (!input)
+    return 0;
+
+  // Answer the paths of |input| one at a time, so that a tool can keep us
+  // running and ask as it goes.  Unknown paths don't stop the others.
+  FILE* file = strcmp(input, "-") == 0 ? stdin : fopen(input, "r");
+  if (!file) {
+    Error("opening %s: %s", input, strerror(errno));
+    return 1;
+  }
+  int status = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), file)) {
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = '\0';
+    if (len == 0)
+      continue;
+    string err;
+    Node* node = CollectTarget(line, &err);
+    if (!node) {
+      Error("%s", err.c_str());
+      status = 1;
+      continue;
     }
-    printf("  outputs:\n");
-    for (vector<Edge*>::const_iterator edge = node->out_edges().begin();
-         edge != node->out_edges().end(); ++edge) {
-      for (vector<Node*>::iterator out = (*edge)->outputs_.begin();
-           out != (*edge)->outputs_.end(); ++out) {
-        printf("    %s\n", (*out)->path().c_str());
-      }
+    Edge* edge = node->in_edge();
+    if (edge && edge->dyndep_ && edge->dyndep_->dyndep_pending()) {
+      if (!dyndep_loader.LoadDyndeps(edge->dyndep_, &err))
+        Warning("%s\n", err.c_str());
     }
+    PrintQuery(node, deps_log, dependents);
+    fflush(stdout);
   }
-  return 0;
+  if (file != stdin)
+    fclose(file);
+  return status;
 }
 
 #if defined(NINJA_HAVE_BROWSE)
 int NinjaMain::ToolBrowse(const Options* options, int argc, char* argv[]) {
-  RunBrowsePython(&state_, ninja_command_, options->input_file, argc, argv);
-  // If we get here, the browse failed.
-  return 1;
+  // The browse tool uses getopt, and expects argv[0] to contain the name of
+  // the tool, i.e. "browse".
+  argc++;
+  argv--;
+
+  enum { OPT_NO_BROWSER = 1 };
+  const option kLongOptions[] = {
+    { "port", required_argument, NULL, 'p' },
+    { "hostname", required_argument, NULL, 'a' },
+    { "no-browser", no_argument, NULL, OPT_NO_BROWSER },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int port = 8000;
+  string hostname = "localhost";
+  bool open_browser = true;
+  optind = 1;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "p:a:h", kLongOptions, NULL)) != -1) {
+    switch (opt) {
+    case 'p': {
+      char* end;
+      port = strtol(optarg, &end, 10);
+      if (*end != 0 || port <= 0 || port > 65535) {
+        Error("invalid port '%s'", optarg);
+        return 1;
+      }
+      break;
+    }
+    case 'a':
+      hostname = optarg;
+      break;
+    case OPT_NO_BROWSER:
+      open_browser = false;
+      break;
+    case 'h':
+    default:
+      printf("usage: ninja -t browse [options] [target]\n"
+"\n"
+"options:\n"
+"  -p, --port=PORT          port number to use [default=8000]\n"
+"  -a, --hostname=HOSTNAME  hostname to bind to [default=localhost]\n"
+"  --no-browser             don't open a web browser on startup\n"
+"\n"
+"The first page shows target [default=all].\n"
+             );
+      return 1;
+    }
+  }
+  argv += optind;
+  argc -= optind;
+  if (argc > 1) {
+    Error("expected at most one target");
+    return 1;
+  }
+
+  // Answer from the loaded state, as "ninja -t query" would.
+  BrowseServer server([this](const string& target, string* err) {
+    Node* node = CollectTarget(target.c_str(), err);
+    Edge* edge = node ? node->in_edge() : NULL;
+    if (edge && edge->dyndep_ && edge->dyndep_->dyndep_pending()) {
+      DyndepLoader dyndep_loader(&state_, &disk_interface_);
+      string dyndep_err;
+      if (!dyndep_loader.LoadDyndeps(edge->dyndep_, &dyndep_err))
+        Warning("%s", dyndep_err.c_str());
+    }
+    return node;
+  }, &deps_log_, argc ? argv[0] : "all");
+  return server.Run(hostname, port, open_browser);
 }
 #else
 int NinjaMain::ToolBrowse(const Options*, int, char**) {
@@ -470,6 +929,38 @@ int ToolTargetsList(State* state, const string& rule_name) {
   return 0;
 }
 
+int ToolTargetsList(const ManifestIndex& index, const string& rule_name) {
+  for (size_t r = 0; r < index.rule_names.size(); ++r) {
+    if (index.rule_names[r] != rule_name)
+      continue;
+    const vector<uint32_t>& outputs = index.outputs_by_rule[r];
+    for (vector<uint32_t>::const_iterator o = outputs.begin();
+         o != outputs.end(); ++o)
+      printf("%s\n", index.outputs[*o].path.c_str());
+  }
+  return 0;
+}
+
+int ToolTargetsList(const ManifestIndex& index,
+                    const vector<uint32_t>& outputs) {
+  for (vector<uint32_t>::const_iterator o = outputs.begin();
+       o != outputs.end(); ++o) {
+    const ManifestIndex::Output& output = index.outputs[*o];
+    printf("%s: %s\n", output.path.c_str(),
+           index.rule_names[output.rule].c_str());
+  }
+  return 0;
+}
+
+int ToolTargetsList(const ManifestIndex& index) {
+  for (vector<ManifestIndex::Output>::const_iterator o =
+           index.outputs.begin();
+       o != index.outputs.end(); ++o) {
+    printf("%s: %s\n", o->path.c_str(), index.rule_names[o->rule].c_str());
+  }
+  return 0;
+}
+
 int ToolTargetsList(State* state) {
   for (vector<Edge*>::iterator e = state->edges_.begin();
        e != state->edges_.end(); ++e) {
@@ -486,10 +977,10 @@ int ToolTargetsList(State* state) {
 int NinjaMain::ToolDeps(const Options* options, int argc, char** argv) {
   vector<Node*> nodes;
   if (argc == 0) {
-    for (vector<Node*>::const_iterator ni = deps_log_.nodes().begin();
-         ni != deps_log_.nodes().end(); ++ni) {
-      if (deps_log_.IsDepsEntryLiveFor(*ni))
-        nodes.push_back(*ni);
+    vector<bool> live = deps_log_.LiveEntries();
+    for (size_t id = 0; id < deps_log_.nodes().size(); ++id) {
+      if (live[id])
+        nodes.push_back(deps_log_.nodes()[id]);
     }
   } else {
     string err;
@@ -525,22 +1016,17 @@ int NinjaMain::ToolDeps(const Options* options, int argc, char** argv) {
 
 int NinjaMain::ToolTargets(const Options* options, int argc, char* argv[]) {
   int depth = 1;
+  string mode = "depth";
+  string rule;
   if (argc >= 1) {
-    string mode = argv[0];
+    mode = argv[0];
     if (mode == "rule") {
-      string rule;
       if (argc > 1)
         rule = argv[1];
-      if (rule.empty())
-        return ToolTargetsSourceList(&state_);
-      else
-        return ToolTargetsList(&state_, rule);
     } else if (mode == "depth") {
       if (argc > 1)
         depth = atoi(argv[1]);
-    } else if (mode == "all") {
-      return ToolTargetsList(&state_);
-    } else {
+    } else if (mode != "all") {
       const char* suggestion =
           SpellcheckString(mode.c_str(), "rule", "depth", "all", NULL);
       if (suggestion) {
@@ -553,6 +1039,34 @@ int NinjaMain::ToolTargets(const Options* options, int argc, char* argv[]) {
     }
   }
 
+  // Shell completion lists the targets on every key press, so the modes
+  // that list outputs answer from the index of the manifest cache when
+  // it's up to date, without restoring the graph.
+  ManifestIndex index;
+  bool indexed = (mode == "all" || (mode == "rule" && !rule.empty()) ||
+                  (mode == "depth" && depth == 1)) &&
+                 LoadManifestIndex(*options, &index);
+  if (!indexed && !EnsureManifestLoaded(*options))
+    return 1;
+
+  if (mode == "rule") {
+    if (rule.empty())
+      return ToolTargetsSourceList(&state_);
+    else if (indexed)
+      return ToolTargetsList(index, rule);
+    else
+      return ToolTargetsList(&state_, rule);
+  } else if (mode == "all") {
+    return indexed ? ToolTargetsList(index) : ToolTargetsList(&state_);
+  }
+
+  if (indexed) {
+    if (!index.roots_error.empty()) {
+      Error("%s", index.roots_error.c_str());
+      return 1;
+    }
+    return ToolTargetsList(index, index.roots);
+  }
   string err;
   vector<Node*> root_nodes = state_.RootNodes(&err);
   if (err.empty()) {
@@ -594,6 +1108,21 @@ int NinjaMain::ToolRules(const Options* options, int argc, char* argv[]) {
   argv += optind;
   argc -= optind;
 
+  ManifestIndex index;
+  if (LoadManifestIndex(*options, &index)) {
+    for (vector<ManifestIndex::RuleInfo>::const_iterator i =
+             index.rules.begin();
+         i != index.rules.end(); ++i) {
+      printf("%s", i->name.c_str());
+      if (print_description && i->has_description)
+        printf(": %s", i->description.c_str());
+      printf("\n");
+    }
+    return 0;
+  }
+  if (!EnsureManifestLoaded(*options))
+    return 1;
+
   // Print rules
 
   typedef map<string, const Rule*> Rules;
@@ -602,7 +1131,7 @@ int NinjaMain::ToolRules(const Options* options, int argc, char* argv[]) {
     printf("%s", i->first.c_str());
     if (print_description) {
       const Rule* rule = i->second;
-      const EvalString* description = rule->GetBinding("description");
+      const EvalString* description = rule->GetBinding(kSymbolDescription);
       if (description != NULL) {
         printf(": %s", description->Unparse().c_str());
       }
@@ -612,8 +1141,29 @@ int NinjaMain::ToolRules(const Options* options, int argc, char* argv[]) {
   return 0;
 }
 
+/// Write the texts |format| makes for each index in [0, count) to stdout,
+/// in order.  They're formatted on several threads a batch at a time, so
+/// that output starts early and only one batch is held in memory.
+void PrintInParallel(size_t count,
+                     const function<void(size_t, string*)>& format) {
+  const size_t kBatchSize = 1024;
+  int thread_count = GetProcessorCount();
+  vector<string> texts;
+  for (size_t start = 0; start < count; start += kBatchSize) {
+    size_t batch = min(kBatchSize, count - start);
+    texts.resize(batch);
+    ParallelFor(batch, thread_count, [&](size_t i) {
+      texts[i].clear();
+      format(start + i, &texts[i]);
+    });
+    for (size_t i = 0; i < batch; ++i)
+      fwrite(texts[i].data(), 1, texts[i].size(), stdout);
+  }
+}
+
 enum PrintCommandMode { PCM_Single, PCM_All };
-void PrintCommands(Edge* edge, EdgeSet* seen, PrintCommandMode mode) {
+void CollectCommands(Edge* edge, EdgeSet* seen, PrintCommandMode mode,
+                     vector<Edge*>* edges) {
   if (!edge)
     return;
   if (!seen->insert(edge).second)
@@ -622,11 +1172,11 @@ void PrintCommands(Edge* edge, EdgeSet* seen, PrintCommandMode mode) {
   if (mode == PCM_All) {
     for (vector<Node*>::iterator in = edge->inputs_.begin();
          in != edge->inputs_.end(); ++in)
-      PrintCommands((*in)->in_edge(), seen, mode);
+      CollectCommands((*in)->in_edge(), seen, mode, edges);
   }
 
   if (!edge->is_phony())
-    puts(edge->EvaluateCommand().c_str());
+    edges->push_back(edge);
 }
 
 int NinjaMain::ToolCommands(const Options* options, int argc, char* argv[]) {
@@ -665,49 +1215,158 @@ int NinjaMain::ToolCommands(const Options* options, int argc, char* argv[]) {
   }
 
   EdgeSet seen;
+  vector<Edge*> edges;
   for (vector<Node*>::iterator in = nodes.begin(); in != nodes.end(); ++in)
-    PrintCommands((*in)->in_edge(), &seen, mode);
+    CollectCommands((*in)->in_edge(), &seen, mode, &edges);
+  PrintInParallel(edges.size(), [&](size_t i, string* text) {
+    *text = edges[i]->EvaluateCommand();
+    text->push_back('\n');
+  });
 
   return 0;
 }
 
-int NinjaMain::ToolClean(const Options* options, int argc, char* argv[]) {
-  // The clean tool uses getopt, and expects argv[0] to contain the name of
-  // the tool, i.e. "clean".
-  argc++;
-  argv--;
+/// Print the edges below |node| that RecomputeDirty() found out of date,
+/// inputs first, as the lines of their outputs, or with |edges| as a line
+/// each of their rule and outputs.  Only the edges of |rules| are printed,
+/// unless it's empty.
+void PrintDirty(Node* node, const set<const Rule*>& rules, bool edges,
+                EdgeSet* seen) {
+  Edge* edge = node->in_edge();
+  // Everything below an edge that is ready is up to date.
+  if (!edge || edge->outputs_ready() || !seen->insert(edge).second)
+    return;
+  for (vector<Node*>::iterator in = edge->inputs_.begin();
+       in != edge->inputs_.end(); ++in)
+    PrintDirty(*in, rules, edges, seen);
 
-  bool generator = false;
-  bool clean_rules = false;
+  // An edge may be waiting for order-only inputs without being dirty.
+  if (edge->is_phony() || !edge->outputs_[0]->dirty() ||
+      (!rules.empty() && !rules.count(&edge->rule())))
+    return;
+  string line;
+  if (edges)
+    line = edge->rule().name();
+  for (vector<Node*>::iterator out = edge->outputs_.begin();
+       out != edge->outputs_.end(); ++out) {
+    if (edges && !line.empty())
+      line.push_back(' ');
+    line += (*out)->path();
+    if (!edges) {
+      line.push_back('\n');
+      fwrite(line.data(), 1, line.size(), stdout);
+      line.clear();
+    }
+  }
+  if (edges) {
+    line.push_back('\n');
+    fwrite(line.data(), 1, line.size(), stdout);
+  }
+}
+
+int NinjaMain::ToolDirty(const Options* options, int argc, char* argv[]) {
+  // The dirty tool uses getopt, and expects argv[0] to contain the name of
+  // the tool, i.e. "dirty".
+  ++argc;
+  --argv;
 
+  bool edges = false;
+  set<const Rule*> rules;
   optind = 1;
   int opt;
-  while ((opt = getopt(argc, argv, const_cast<char*>("hgr"))) != -1) {
+  while ((opt = getopt(argc, argv, const_cast<char*>("her:"))) != -1) {
     switch (opt) {
-    case 'g':
-      generator = true;
+    case 'e':
+      edges = true;
       break;
-    case 'r':
-      clean_rules = true;
+    case 'r': {
+      const Rule* rule = state_.bindings_.LookupRule(optarg);
+      if (!rule) {
+        Error("unknown rule '%s'", optarg);
+        return 1;
+      }
+      rules.insert(rule);
       break;
+    }
     case 'h':
     default:
-      printf("usage: ninja -t clean [options] [targets]\n"
+      printf("usage: ninja -t dirty [options] [targets]\n"
+"\n"
+"list the outputs the next build of the targets would update, without\n"
+"running or printing the commands, dependencies first\n"
 "\n"
 "options:\n"
-"  -g     also clean files marked as ninja generator output\n"
-"  -r     interpret targets as a list of rules to clean instead\n"
+"  -e       print a line per edge, its rule and then its outputs\n"
+"  -r RULE  only list the edges of RULE (may be repeated)\n"
              );
-    return 1;
+      return 1;
     }
   }
   argv += optind;
   argc -= optind;
 
-  if (clean_rules && argc == 0) {
-    Error("expected a rule to clean");
-    return 1;
-  }
+  vector<Node*> nodes;
+  string err;
+  if (!CollectTargetsFromArgs(argc, argv, &nodes, &err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+
+  // The scan of a build, without the plan it makes.
+  disk_interface_.AllowStatCache(g_experimental_statcache);
+  DependencyScan scan(&state_, &build_log_, &deps_log_, &disk_interface_,
+                      &config_.depfile_parser_options);
+  scan.set_hash_log(&hash_log_);
+  scan.set_lazy_depfiles(config_.lazy_depfiles);
+  scan.StatReachableNodes(nodes);
+  EdgeSet seen;
+  for (vector<Node*>::iterator n = nodes.begin(); n != nodes.end(); ++n) {
+    if (!scan.RecomputeDirty(*n, &err)) {
+      Error("%s", err.c_str());
+      return 1;
+    }
+    PrintDirty(*n, rules, edges, &seen);
+  }
+  return 0;
+}
+
+int NinjaMain::ToolClean(const Options* options, int argc, char* argv[]) {
+  // The clean tool uses getopt, and expects argv[0] to contain the name of
+  // the tool, i.e. "clean".
+  argc++;
+  argv--;
+
+  bool generator = false;
+  bool clean_rules = false;
+
+  optind = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, const_cast<char*>("hgr"))) != -1) {
+    switch (opt) {
+    case 'g':
+      generator = true;
+      break;
+    case 'r':
+      clean_rules = true;
+      break;
+    case 'h':
+    default:
+      printf("usage: ninja -t clean [options] [targets]\n"
+"\n"
+"options:\n"
+"  -g     also clean files marked as ninja generator output\n"
+"  -r     interpret targets as a list of rules to clean instead\n"
+             );
+    return 1;
+    }
+  }
+  argv += optind;
+  argc -= optind;
+
+  if (clean_rules && argc == 0) {
+    Error("expected a rule to clean");
+    return 1;
+  }
 
   Cleaner cleaner(&state_, config_, &disk_interface_);
   if (argc >= 1) {
@@ -725,15 +1384,6 @@ int NinjaMain::ToolCleanDead(const Options* options, int argc, char* argv[]) {
   return cleaner.CleanDead(build_log_.entries());
 }
 
-void EncodeJSONString(const char *str) {
-  while (*str) {
-    if (*str == '"' || *str == '\\')
-      putchar('\\');
-    putchar(*str);
-    str++;
-  }
-}
-
 enum EvaluateCommandMode {
   ECM_NORMAL,
   ECM_EXPAND_RSPFILE
@@ -752,7 +1402,7 @@ std::string EvaluateCommandWithRspfile(const Edge* edge,
   if (index == 0 || index == string::npos || command[index - 1] != '@')
     return command;
 
-  string rspfile_content = edge->GetBinding("rspfile_content");
+  string rspfile_content = edge->GetRspfileContent();
   size_t newline_index = 0;
   while ((newline_index = rspfile_content.find('\n', newline_index)) !=
          string::npos) {
@@ -763,17 +1413,17 @@ std::string EvaluateCommandWithRspfile(const Edge* edge,
   return command;
 }
 
-void printCompdb(const char* const directory, const Edge* const edge,
-                 const EvaluateCommandMode eval_mode) {
-  printf("\n  {\n    \"directory\": \"");
-  EncodeJSONString(directory);
-  printf("\",\n    \"command\": \"");
-  EncodeJSONString(EvaluateCommandWithRspfile(edge, eval_mode).c_str());
-  printf("\",\n    \"file\": \"");
-  EncodeJSONString(edge->inputs_[0]->path().c_str());
-  printf("\",\n    \"output\": \"");
-  EncodeJSONString(edge->outputs_[0]->path().c_str());
-  printf("\"\n  }");
+void FormatCompdb(const string& directory, const Edge* const edge,
+                  const EvaluateCommandMode eval_mode, string* text) {
+  text->append("\n  {\n    \"directory\": \"");
+  GetJSONEscapedString(directory, text);
+  text->append("\",\n    \"command\": \"");
+  GetJSONEscapedString(EvaluateCommandWithRspfile(edge, eval_mode), text);
+  text->append("\",\n    \"file\": \"");
+  GetJSONEscapedString(edge->inputs_[0]->path(), text);
+  text->append("\",\n    \"output\": \"");
+  GetJSONEscapedString(edge->outputs_[0]->path(), text);
+  text->append("\"\n  }");
 }
 
 int NinjaMain::ToolCompilationDatabase(const Options* options, int argc,
@@ -807,7 +1457,6 @@ int NinjaMain::ToolCompilationDatabase(const Options* options, int argc,
   argv += optind;
   argc -= optind;
 
-  bool first = true;
   vector<char> cwd;
   char* success = NULL;
 
@@ -821,30 +1470,29 @@ int NinjaMain::ToolCompilationDatabase(const Options* options, int argc,
     return 1;
   }
 
-  putchar('[');
+  // An edge is listed once for each of the rules given it matches.
+  vector<Edge*> edges;
   for (vector<Edge*>::iterator e = state_.edges_.begin();
        e != state_.edges_.end(); ++e) {
     if ((*e)->inputs_.empty())
       continue;
     if (argc == 0) {
-      if (!first) {
-        putchar(',');
-      }
-      printCompdb(&cwd[0], *e, eval_mode);
-      first = false;
+      edges.push_back(*e);
     } else {
       for (int i = 0; i != argc; ++i) {
-        if ((*e)->rule_->name() == argv[i]) {
-          if (!first) {
-            putchar(',');
-          }
-          printCompdb(&cwd[0], *e, eval_mode);
-          first = false;
-        }
+        if ((*e)->rule_->name() == argv[i])
+          edges.push_back(*e);
       }
     }
   }
 
+  putchar('[');
+  string directory = &cwd[0];
+  PrintInParallel(edges.size(), [&](size_t i, string* text) {
+    if (i > 0)
+      text->push_back(',');
+    FormatCompdb(directory, edges[i], eval_mode, text);
+  });
   puts("\n]");
   return 0;
 }
@@ -854,7 +1502,8 @@ int NinjaMain::ToolRecompact(const Options* options, int argc, char* argv[]) {
     return 1;
 
   if (OpenBuildLog(/*recompact_only=*/true) == LOAD_ERROR ||
-      OpenDepsLog(/*recompact_only=*/true) == LOAD_ERROR)
+      OpenDepsLog(/*recompact_only=*/true) == LOAD_ERROR ||
+      OpenHashLog(/*recompact_only=*/true) == LOAD_ERROR)
     return 1;
 
   return 0;
@@ -902,7 +1551,20 @@ int NinjaMain::ToolRestat(const Options* options, int argc, char* argv[]) {
     err.clear();
   }
 
-  bool success = build_log_.Restat(log_path, disk_interface_, argc, argv, &err);
+  LinePrinter printer;
+  BuildLog::RestatProgress progress;
+  if (printer.is_smart_terminal()) {
+    progress = [&printer](size_t done, size_t total) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "[%lu/%lu] restat", (unsigned long)done,
+               (unsigned long)total);
+      printer.Print(buf, LinePrinter::ELIDE);
+    };
+  }
+  bool success = build_log_.Restat(log_path, disk_interface_, argc, argv, &err,
+                                   progress);
+  if (progress)
+    printer.PrintOnNewLine("");
   if (!success) {
     Error("failed recompaction: %s", err.c_str());
     return EXIT_FAILURE;
@@ -918,6 +1580,177 @@ int NinjaMain::ToolRestat(const Options* options, int argc, char* argv[]) {
   return EXIT_SUCCESS;
 }
 
+int NinjaMain::ToolShard(const Options* options, int argc, char* argv[]) {
+  // The shard tool uses getopt, and expects argv[0] to contain the name of
+  // the tool, i.e. "shard".
+  argc++;
+  argv--;
+
+  int count = 2;
+  int only = 0;
+  bool dirty_only = false;
+  optind = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, const_cast<char*>("dhn:s:"))) != -1) {
+    switch (opt) {
+    case 'd':
+      dirty_only = true;
+      break;
+    case 'n':
+    case 's': {
+      char* end;
+      int value = strtol(optarg, &end, 10);
+      if (*end != 0 || value <= 0) {
+        Error("invalid -%c parameter", opt);
+        return 1;
+      }
+      (opt == 'n' ? count : only) = value;
+      break;
+    }
+    case 'h':
+    default:
+      printf(
+"usage: ninja -t shard [options] [targets]\n"
+"\n"
+"split the targets into shards that take about as long to build, by the\n"
+"times in the build log, each after a line '# shard I of N: SECONDS'\n"
+"\n"
+"options:\n"
+"  -n N   make N shards [default=2]\n"
+"  -s I   only list the targets of shard I (from 1 to N)\n"
+"  -d     only count what the next build would run\n");
+      return 1;
+    }
+  }
+  argv += optind;
+  argc -= optind;
+  if (only > count) {
+    Error("shard %d of %d", only, count);
+    return 1;
+  }
+
+  vector<Node*> nodes;
+  string err;
+  if (!CollectTargetsFromArgs(argc, argv, &nodes, &err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+
+  // The deps of the edges come from the scan of a build.
+  disk_interface_.AllowStatCache(g_experimental_statcache);
+  DependencyScan scan(&state_, &build_log_, &deps_log_, &disk_interface_,
+                      &config_.depfile_parser_options);
+  scan.set_hash_log(&hash_log_);
+  scan.StatReachableNodes(nodes);
+  for (vector<Node*>::iterator n = nodes.begin(); n != nodes.end(); ++n) {
+    if (!scan.RecomputeDirty(*n, &err)) {
+      Error("%s", err.c_str());
+      return 1;
+    }
+  }
+
+  vector<Shard> shards;
+  ShardTargets(&state_, &build_log_, nodes, count, dirty_only, &shards);
+  for (int i = 0; i < count; ++i) {
+    if (only && i + 1 != only)
+      continue;
+    if (!only)
+      printf("# shard %d of %d: %.1f\n", i + 1, count, shards[i].cost / 1000.0);
+    for (vector<Node*>::iterator t = shards[i].targets.begin();
+         t != shards[i].targets.end(); ++t)
+      printf("%s\n", (*t)->path().c_str());
+  }
+  return 0;
+}
+
+int NinjaMain::ToolUsage(const Options* options, int argc, char* argv[]) {
+  // The usage tool uses getopt, and expects argv[0] to contain the name of
+  // the tool, i.e. "usage".
+  argc++;
+  argv--;
+
+  bool by_memory = false;
+  int count = 20;
+  optind = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, const_cast<char*>("hmn:"))) != -1) {
+    switch (opt) {
+    case 'm':
+      by_memory = true;
+      break;
+    case 'n': {
+      char* end;
+      count = strtol(optarg, &end, 10);
+      if (*end != 0 || count < 0) {
+        Error("invalid -n parameter");
+        return 1;
+      }
+      break;
+    }
+    case 'h':
+    default:
+      printf(
+"usage: ninja -t usage [options]\n"
+"\n"
+"list the edges that used the most CPU time when they last ran\n"
+"\n"
+"options:\n"
+"  -m     sort by peak memory instead\n"
+"  -n N   list N edges (0 means all) [default=20]\n");
+      return 1;
+    }
+  }
+
+  // Each edge once, under its first output.
+  vector<const BuildLog::LogEntry*> entries;
+  set<const Edge*> seen;
+  int64_t total_cpu_time = 0;
+  const BuildLog::Entries& log_entries = build_log_.entries();
+  for (BuildLog::Entries::const_iterator i = log_entries.begin();
+       i != log_entries.end(); ++i) {
+    const BuildLog::LogEntry* entry = i->second;
+    if (entry->usage == ResourceUsage())
+      continue;
+    Node* node = state_.LookupNode(entry->output);
+    const Edge* edge = node ? node->in_edge() : NULL;
+    if (!edge || !seen.insert(edge).second)
+      continue;
+    entry = build_log_.LookupByOutput(edge->outputs_[0]->path());
+    if (!entry)
+      entry = i->second;
+    entries.push_back(entry);
+    total_cpu_time += entry->usage.user_time + entry->usage.system_time;
+  }
+
+  sort(entries.begin(), entries.end(),
+       [by_memory](const BuildLog::LogEntry* a, const BuildLog::LogEntry* b) {
+    int64_t a_key = by_memory ? a->usage.peak_rss
+                              : a->usage.user_time + a->usage.system_time;
+    int64_t b_key = by_memory ? b->usage.peak_rss
+                              : b->usage.user_time + b->usage.system_time;
+    if (a_key != b_key)
+      return a_key > b_key;
+    return a->output < b->output;
+  });
+  if (count > 0 && entries.size() > (size_t)count)
+    entries.resize(count);
+
+  printf("%10s %10s %10s %12s  %s\n", "cpu (s)", "user (s)", "wall (s)",
+         "memory (MiB)", "output");
+  for (vector<const BuildLog::LogEntry*>::iterator e = entries.begin();
+       e != entries.end(); ++e) {
+    const ResourceUsage& usage = (*e)->usage;
+    printf("%10.2f %10.2f %10.2f %12.1f  %s\n",
+           (usage.user_time + usage.system_time) / 1000.0,
+           usage.user_time / 1000.0,
+           ((*e)->end_time - (*e)->start_time) / 1000.0,
+           usage.peak_rss / 1024.0, (*e)->output.c_str());
+  }
+  printf("%d edges used %.2f s of CPU time in all\n", (int)seen.size(),
+         total_cpu_time / 1000.0);
+  return 0;
+}
+
 int NinjaMain::ToolUrtle(const Options* options, int argc, char** argv) {
   // RLE encoded.
   const char* urtle =
@@ -949,7 +1782,7 @@ int NinjaMain::ToolUrtle(const Options* options, int argc, char** argv) {
 const Tool* ChooseTool(const string& tool_name) {
   static const Tool kTools[] = {
     { "browse", "browse dependency graph in a web browser",
-      Tool::RUN_AFTER_LOAD, &NinjaMain::ToolBrowse },
+      Tool::RUN_AFTER_LOGS, &NinjaMain::ToolBrowse },
 #if defined(_MSC_VER)
     { "msvc", "build helper for MSVC cl.exe (EXPERIMENTAL)",
       Tool::RUN_AFTER_FLAGS, &NinjaMain::ToolMSVC },
@@ -958,22 +1791,28 @@ const Tool* ChooseTool(const string& tool_name) {
       Tool::RUN_AFTER_LOAD, &NinjaMain::ToolClean },
     { "commands", "list all commands required to rebuild given targets",
       Tool::RUN_AFTER_LOAD, &NinjaMain::ToolCommands },
+    { "dirty", "list the outputs the next build would update",
+      Tool::RUN_AFTER_LOGS, &NinjaMain::ToolDirty },
     { "deps", "show dependencies stored in the deps log",
       Tool::RUN_AFTER_LOGS, &NinjaMain::ToolDeps },
     { "graph", "output graphviz dot file for targets",
-      Tool::RUN_AFTER_LOAD, &NinjaMain::ToolGraph },
+      Tool::RUN_AFTER_LOGS, &NinjaMain::ToolGraph },
     { "query", "show inputs/outputs for a path",
       Tool::RUN_AFTER_LOGS, &NinjaMain::ToolQuery },
     { "targets",  "list targets by their rule or depth in the DAG",
-      Tool::RUN_AFTER_LOAD, &NinjaMain::ToolTargets },
+      Tool::RUN_AFTER_FLAGS, &NinjaMain::ToolTargets },
     { "compdb",  "dump JSON compilation database to stdout",
       Tool::RUN_AFTER_LOAD, &NinjaMain::ToolCompilationDatabase },
     { "recompact",  "recompacts ninja-internal data structures",
       Tool::RUN_AFTER_LOAD, &NinjaMain::ToolRecompact },
     { "restat",  "restats all outputs in the build log",
       Tool::RUN_AFTER_FLAGS, &NinjaMain::ToolRestat },
+    { "usage",  "list the edges using the most CPU time or memory",
+      Tool::RUN_AFTER_LOGS, &NinjaMain::ToolUsage },
+    { "shard",  "split targets into shards taking as long to build",
+      Tool::RUN_AFTER_LOGS, &NinjaMain::ToolShard },
     { "rules",  "list all rules",
-      Tool::RUN_AFTER_LOAD, &NinjaMain::ToolRules },
+      Tool::RUN_AFTER_FLAGS, &NinjaMain::ToolRules },
     { "cleandead",  "clean built files that are no longer produced by the manifest",
       Tool::RUN_AFTER_LOGS, &NinjaMain::ToolCleanDead },
     { "urtle", NULL,
@@ -1008,26 +1847,84 @@ const Tool* ChooseTool(const string& tool_name) {
   return NULL;  // Not reached.
 }
 
+/// Finish the -d trace profile, however ninja exits.
+void CloseTrace() {
+  if (g_tracer)
+    g_tracer->Close();
+}
+
+void CloseExplainLog() {
+  if (g_explain_log)
+    g_explain_log->Close();
+}
+
 /// Enable a debugging mode.  Returns false if Ninja should exit instead
 /// of continuing.
 bool DebugEnable(const string& name) {
   if (name == "list") {
     printf("debugging modes:\n"
 "  stats        print operation counts/timing info\n"
+"  stats=json   print them as JSON, with their histograms\n"
+"  memstats     print the memory the graph, the logs and the commands' output\n"
+"               take, and the peak RSS\n"
+"  manifest     print the slowest manifest files to parse, the rules with the\n"
+"               most edges, the largest commands, bindings and input counts\n"
+"  trace=FILE   write a Chrome trace-event profile of the build to FILE\n"
 "  explain      explain what caused a command to execute\n"
+"  explain=FILE write why each node is dirty to FILE as JSON lines, and a\n"
+"               count of each reason to stderr\n"
 "  keepdepfile  don't delete depfiles after they're read by ninja\n"
 "  keeprsp      don't delete @response files on success\n"
 #ifdef _WIN32
 "  nostatcache  don't batch stat() calls per directory and cache them\n"
+#else
+"  statcache    batch stat() calls per directory and cache them (for network\n"
+"               file systems)\n"
 #endif
 "multiple modes can be enabled via -d FOO -d BAR\n");
     return false;
-  } else if (name == "stats") {
-    g_metrics = new Metrics;
+  } else if (name == "stats" || name == "stats=json") {
+    if (!g_metrics)
+      g_metrics = new Metrics;
+    g_metrics_json = name == "stats=json";
+    return true;
+  } else if (name == "memstats") {
+    if (!g_memory_stats)
+      g_memory_stats = new MemoryStats;
+    return true;
+  } else if (name == "manifest") {
+    if (!g_manifest_stats)
+      g_manifest_stats = new ManifestStats;
+    return true;
+  } else if (name.compare(0, 6, "trace=") == 0 && name.size() > 6) {
+    string err;
+    Tracer* tracer = new Tracer;
+    if (!tracer->Open(name.substr(6), &err)) {
+      Error("opening trace file '%s': %s", name.c_str() + 6, err.c_str());
+      delete tracer;
+      return false;
+    }
+    if (!g_tracer)
+      atexit(CloseTrace);
+    delete g_tracer;
+    g_tracer = tracer;
     return true;
   } else if (name == "explain") {
     g_explaining = true;
     return true;
+  } else if (name.compare(0, 8, "explain=") == 0 && name.size() > 8) {
+    string err;
+    ExplainLog* explain_log = new ExplainLog;
+    if (!explain_log->Open(name.substr(8), &err)) {
+      Error("opening explain file '%s': %s", name.c_str() + 8, err.c_str());
+      delete explain_log;
+      return false;
+    }
+    if (!g_explain_log)
+      atexit(CloseExplainLog);
+    delete g_explain_log;
+    g_explain_log = explain_log;
+    return true;
   } else if (name == "keepdepfile") {
     g_keep_depfile = true;
     return true;
@@ -1037,11 +1934,18 @@ bool DebugEnable(const string& name) {
   } else if (name == "nostatcache") {
     g_experimental_statcache = false;
     return true;
+  } else if (name == "statcache") {
+    g_experimental_statcache = true;
+    return true;
   } else {
     const char* suggestion =
         SpellcheckString(name.c_str(),
-                         "stats", "explain", "keepdepfile", "keeprsp",
-                         "nostatcache", NULL);
+                         "stats", "stats=json", "memstats", "manifest",
+                         "trace=",
+                         "explain",
+                         "explain=",
+                         "keepdepfile",
+                         "keeprsp", "nostatcache", "statcache", NULL);
     if (suggestion) {
       Error("unknown debug setting '%s', did you mean '%s'?",
             name.c_str(), suggestion);
@@ -1091,23 +1995,74 @@ bool WarningEnable(const string& name, Options* options) {
   }
 }
 
-bool NinjaMain::OpenBuildLog(bool recompact_only) {
-  string log_path = ".ninja_log";
-  if (!build_dir_.empty())
-    log_path = build_dir_ + "/" + log_path;
+string NinjaMain::LogPath(const char* name) const {
+  if (build_dir_.empty())
+    return name;
+  return build_dir_ + "/" + name;
+}
 
+LoadStatus NinjaMain::LoadBuildLog(const string& path) {
   string err;
-  const LoadStatus status = build_log_.Load(log_path, &err);
+  return ReportBuildLogLoad(path, build_log_.Load(path, &err), err);
+}
+
+LoadStatus NinjaMain::ReportBuildLogLoad(const string& path,
+                                         LoadStatus status,
+                                         const string& err) {
   if (status == LOAD_ERROR) {
-    Error("loading build log %s: %s", log_path.c_str(), err.c_str());
-    return false;
+    Error("loading build log %s: %s", path.c_str(), err.c_str());
+    return status;
   }
   if (!err.empty()) {
     // Hack: Load() can return a warning via err by returning LOAD_SUCCESS.
     Warning("%s", err.c_str());
-    err.clear();
   }
+  return status;
+}
+
+LoadStatus NinjaMain::LoadDepsLog(const string& path) {
+  string err;
+  const LoadStatus status = deps_log_.Load(path, &state_, &err);
+  if (status == LOAD_ERROR) {
+    Error("loading deps log %s: %s", path.c_str(), err.c_str());
+    return status;
+  }
+  if (!err.empty()) {
+    // Hack: Load() can return a warning via err by returning LOAD_SUCCESS.
+    Warning("%s", err.c_str());
+  }
+  return status;
+}
 
+bool NinjaMain::LoadLogs() {
+  // The build log doesn't refer to the graph, so it loads on another
+  // thread while the deps log is loaded into the graph.
+  string build_log_path = LogPath(".ninja_log");
+  LoadStatus build_log_status;
+  string build_log_err;
+  thread build_log_thread([&] {
+    build_log_status = build_log_.Load(build_log_path, &build_log_err);
+  });
+  LoadStatus deps_log_status = LoadDepsLog(LogPath(".ninja_deps"));
+  build_log_thread.join();
+  if (ReportBuildLogLoad(build_log_path, build_log_status, build_log_err) ==
+          LOAD_ERROR ||
+      deps_log_status == LOAD_ERROR) {
+    return false;
+  }
+  logs_loaded_ = true;
+  return true;
+}
+
+bool NinjaMain::OpenBuildLog(bool recompact_only) {
+  string log_path = LogPath(".ninja_log");
+
+  const LoadStatus status =
+      logs_loaded_ ? LOAD_SUCCESS : LoadBuildLog(log_path);
+  if (status == LOAD_ERROR)
+    return false;
+
+  string err;
   if (recompact_only) {
     if (status == LOAD_NOT_FOUND) {
       return true;
@@ -1131,14 +2086,46 @@ bool NinjaMain::OpenBuildLog(bool recompact_only) {
 /// Open the deps log: load it, then open for writing.
 /// @return false on error.
 bool NinjaMain::OpenDepsLog(bool recompact_only) {
-  string path = ".ninja_deps";
-  if (!build_dir_.empty())
-    path = build_dir_ + "/" + path;
+  string path = LogPath(".ninja_deps");
+
+  const LoadStatus status = logs_loaded_ ? LOAD_SUCCESS : LoadDepsLog(path);
+  if (status == LOAD_ERROR)
+    return false;
 
   string err;
-  const LoadStatus status = deps_log_.Load(path, &state_, &err);
+  if (recompact_only) {
+    if (status == LOAD_NOT_FOUND) {
+      return true;
+    }
+    bool success = deps_log_.Recompact(path, &err);
+    if (!success)
+      Error("failed recompaction: %s", err.c_str());
+    return success;
+  }
+
+  if (!config_.dry_run) {
+    if (!deps_log_.OpenForWrite(path, &err)) {
+      Error("opening deps log: %s", err.c_str());
+      return false;
+    }
+  }
+
+  // The includes of deps = msvc, normalized by earlier builds.
+  if (!CLParser::LoadNormalizedIncludes(LogPath(".ninja_includes"), &err))
+    Warning("loading normalized includes: %s", err.c_str());
+
+  return true;
+}
+
+bool NinjaMain::OpenHashLog(bool recompact_only) {
+  string path = LogPath(".ninja_hashes");
+
+  // The hash log is loaded here even for the daemon, which doesn't keep a
+  // copy of it.
+  string err;
+  const LoadStatus status = hash_log_.Load(path, &err);
   if (status == LOAD_ERROR) {
-    Error("loading deps log %s: %s", path.c_str(), err.c_str());
+    Error("loading hash log %s: %s", path.c_str(), err.c_str());
     return false;
   }
   if (!err.empty()) {
@@ -1151,15 +2138,15 @@ bool NinjaMain::OpenDepsLog(bool recompact_only) {
     if (status == LOAD_NOT_FOUND) {
       return true;
     }
-    bool success = deps_log_.Recompact(path, &err);
+    bool success = hash_log_.Recompact(path, &err);
     if (!success)
       Error("failed recompaction: %s", err.c_str());
     return success;
   }
 
   if (!config_.dry_run) {
-    if (!deps_log_.OpenForWrite(path, &err)) {
-      Error("opening deps log: %s", err.c_str());
+    if (!hash_log_.OpenForWrite(path, &err)) {
+      Error("opening hash log: %s", err.c_str());
       return false;
     }
   }
@@ -1167,7 +2154,20 @@ bool NinjaMain::OpenDepsLog(bool recompact_only) {
   return true;
 }
 
+void NinjaMain::CloseLogs() {
+  build_log_.Close();
+  deps_log_.Close();
+  string err;
+  if (!config_.dry_run &&
+      !CLParser::SaveNormalizedIncludes(LogPath(".ninja_includes"), &err))
+    Warning("saving normalized includes: %s", err.c_str());
+}
+
 void NinjaMain::DumpMetrics() {
+  if (g_metrics_json) {
+    g_metrics->ReportJSON();
+    return;
+  }
   g_metrics->Report();
 
   printf("\n");
@@ -1177,6 +2177,20 @@ void NinjaMain::DumpMetrics() {
          count / (double) buckets, count, buckets);
 }
 
+void NinjaMain::DumpMemoryStats() {
+  state_.CountMemory(g_memory_stats);
+  build_log_.CountMemory(g_memory_stats);
+  deps_log_.CountMemory(g_memory_stats);
+  g_memory_stats->Report();
+}
+
+void NinjaMain::DumpManifestStats() {
+  g_manifest_stats->CountState(state_);
+  g_manifest_stats->Report();
+  // Another load, after the manifest is rebuilt, reports afresh.
+  *g_manifest_stats = ManifestStats();
+}
+
 bool NinjaMain::EnsureBuildDirExists() {
   build_dir_ = state_.bindings_.LookupVariable("builddir");
   if (!build_dir_.empty() && !config_.dry_run) {
@@ -1189,6 +2203,21 @@ bool NinjaMain::EnsureBuildDirExists() {
   return true;
 }
 
+bool NinjaMain::LockBuildDir() {
+  if (!config_.shared_build_dir || config_.dry_run ||
+      build_dir_lock_.is_open())
+    return true;
+  string err;
+  if (!build_dir_lock_.Open(LogPath(".ninja_lock"), &err)) {
+    Error("%s", err.c_str());
+    return false;
+  }
+  build_log_.set_build_dir_lock(&build_dir_lock_);
+  deps_log_.set_build_dir_lock(&build_dir_lock_);
+  hash_log_.set_build_dir_lock(&build_dir_lock_);
+  return true;
+}
+
 int NinjaMain::RunBuild(int argc, char** argv) {
   string err;
   vector<Node*> targets;
@@ -1197,17 +2226,30 @@ int NinjaMain::RunBuild(int argc, char** argv) {
     return 1;
   }
 
-  disk_interface_.AllowStatCache(g_experimental_statcache);
-
   Builder builder(&state_, config_, &build_log_, &deps_log_, &disk_interface_);
-  for (size_t i = 0; i < targets.size(); ++i) {
-    if (!builder.AddTarget(targets[i], &err)) {
-      if (!err.empty()) {
-        Error("%s", err.c_str());
-        return 1;
-      } else {
-        // Added a target that is already up-to-date; not really
-        // an error.
+  builder.SetHashLog(&hash_log_);
+  if (build_dir_lock_.is_open())
+    builder.SetBuildDirLock(&build_dir_lock_);
+
+  // With -d explain, the explanations all come before the build, as
+  // without --stream-scan.
+  if (config_.stream_scan && !g_explaining) {
+    // Stat'ing everything up front would hold the build back as long as
+    // the scan; the stat cache would go stale as the build goes.
+    for (size_t i = 0; i < targets.size(); ++i)
+      builder.AddTargetToScan(targets[i]);
+  } else {
+    disk_interface_.AllowStatCache(g_experimental_statcache);
+    builder.StatTargets(targets);
+    for (size_t i = 0; i < targets.size(); ++i) {
+      if (!builder.AddTarget(targets[i], &err)) {
+        if (!err.empty()) {
+          Error("%s", err.c_str());
+          return 1;
+        } else {
+          // Added a target that is already up-to-date; not really
+          // an error.
+        }
       }
     }
   }
@@ -1219,7 +2261,10 @@ int NinjaMain::RunBuild(int argc, char** argv) {
     return 0;
   }
 
-  if (!builder.Build(&err)) {
+  bool success = builder.Build(&err);
+  if (config_.action_cache)
+    config_.action_cache->Trim();
+  if (!success) {
     // printf("ninja: build stopped: %s.\n", err.c_str());
     if (err.find("interrupted by user") != string::npos) {
       return 2;
@@ -1259,17 +2304,43 @@ int ReadFlags(int* argc, char*** argv,
               Options* options, BuildConfig* config) {
   config->parallelism = GuessParallelism();
 
-  enum { OPT_VERSION = 1 };
+  enum { OPT_VERSION = 1, OPT_JOBSERVER = 2, OPT_DAEMON = 3,
+         OPT_DIRECT_SPAWN = 4, OPT_CACHE_DIR = 5, OPT_CACHE_SIZE = 6,
+         OPT_REMOTE_EXEC = 7, OPT_REMOTE_JOBS = 8, OPT_ADAPTIVE_JOBS = 9,
+         OPT_METRICS_LISTEN = 10, OPT_LAZY_DEPFILES = 11,
+         OPT_FAIL_FAST = 12, OPT_NUMA = 13, OPT_CGROUP = 14,
+         OPT_REMOTE_CACHE = 15, OPT_SHARED_BUILDDIR = 16,
+         OPT_STREAM_SCAN = 17, OPT_PREFETCH = 18, OPT_LAZY_SUBNINJAS = 19,
+         OPT_DEDUP_OUTPUT = 20 };
   const option kLongOptions[] = {
     { "help", no_argument, NULL, 'h' },
     { "version", no_argument, NULL, OPT_VERSION },
     { "verbose", no_argument, NULL, 'v' },
+    { "jobserver", no_argument, NULL, OPT_JOBSERVER },
+    { "daemon", no_argument, NULL, OPT_DAEMON },
+    { "direct-spawn", no_argument, NULL, OPT_DIRECT_SPAWN },
+    { "cache-dir", required_argument, NULL, OPT_CACHE_DIR },
+    { "cache-size", required_argument, NULL, OPT_CACHE_SIZE },
+    { "remote-cache", required_argument, NULL, OPT_REMOTE_CACHE },
+    { "remote-exec", required_argument, NULL, OPT_REMOTE_EXEC },
+    { "remote-jobs", required_argument, NULL, OPT_REMOTE_JOBS },
+    { "adaptive-jobs", required_argument, NULL, OPT_ADAPTIVE_JOBS },
+    { "metrics-listen", required_argument, NULL, OPT_METRICS_LISTEN },
+    { "lazy-depfiles", no_argument, NULL, OPT_LAZY_DEPFILES },
+    { "fail-fast", no_argument, NULL, OPT_FAIL_FAST },
+    { "numa", no_argument, NULL, OPT_NUMA },
+    { "cgroup", required_argument, NULL, OPT_CGROUP },
+    { "shared-builddir", no_argument, NULL, OPT_SHARED_BUILDDIR },
+    { "stream-scan", no_argument, NULL, OPT_STREAM_SCAN },
+    { "prefetch", required_argument, NULL, OPT_PREFETCH },
+    { "lazy-subninjas", no_argument, NULL, OPT_LAZY_SUBNINJAS },
+    { "dedup-output", no_argument, NULL, OPT_DEDUP_OUTPUT },
     { NULL, 0, NULL, 0 }
   };
 
   int opt;
   while (!options->tool &&
-         (opt = getopt_long(*argc, *argv, "d:f:j:k:l:nt:vw:C:h", kLongOptions,
+         (opt = getopt_long(*argc, *argv, "d:f:j:k:l:m:nt:vw:C:h", kLongOptions,
                             NULL)) != -1) {
     switch (opt) {
       case 'd':
@@ -1288,6 +2359,7 @@ int ReadFlags(int* argc, char*** argv,
         // We want to run N jobs in parallel. For N = 0, INT_MAX
         // is close enough to infinite for most sane builds.
         config->parallelism = value > 0 ? value : INT_MAX;
+        options->parallelism_set = true;
         break;
       }
       case 'k': {
@@ -1310,6 +2382,14 @@ int ReadFlags(int* argc, char*** argv,
         config->max_load_average = value;
         break;
       }
+      case 'm': {
+        char* end;
+        long value = strtol(optarg, &end, 10);
+        if (*end != 0 || value < 0)
+          Fatal("invalid -m parameter");
+        config->min_available_memory = (int64_t)value << 20;
+        break;
+      }
       case 'n':
         config->dry_run = true;
         break;
@@ -1328,6 +2408,87 @@ int ReadFlags(int* argc, char*** argv,
       case 'C':
         options->working_dir = optarg;
         break;
+      case OPT_JOBSERVER:
+        options->jobserver_pool = true;
+        break;
+      case OPT_DAEMON:
+        options->daemon = true;
+        break;
+      case OPT_DIRECT_SPAWN:
+        config->direct_spawn = true;
+        break;
+      case OPT_CACHE_DIR:
+        options->cache_dir = optarg;
+        break;
+      case OPT_CACHE_SIZE: {
+        char* end;
+        long value = strtol(optarg, &end, 10);
+        if (*end != 0 || value <= 0)
+          Fatal("invalid --cache-size parameter");
+        options->cache_size = (int64_t)value << 20;
+        break;
+      }
+      case OPT_REMOTE_CACHE:
+        options->remote_cache = optarg;
+        break;
+      case OPT_REMOTE_EXEC:
+        config->remote_exec = optarg;
+        break;
+      case OPT_REMOTE_JOBS: {
+        char* end;
+        int value = strtol(optarg, &end, 10);
+        if (*end != 0 || value <= 0)
+          Fatal("invalid --remote-jobs parameter");
+        config->remote_parallelism = value;
+        break;
+      }
+      case OPT_ADAPTIVE_JOBS: {
+        char* end;
+        int min_value = strtol(optarg, &end, 10);
+        if (*end != ':' || min_value <= 0)
+          Fatal("invalid --adaptive-jobs parameter");
+        int max_value = strtol(end + 1, &end, 10);
+        if (*end != 0 || max_value < min_value)
+          Fatal("invalid --adaptive-jobs parameter");
+        config->min_parallelism = min_value;
+        config->max_parallelism = max_value;
+        break;
+      }
+      case OPT_LAZY_DEPFILES:
+        config->lazy_depfiles = true;
+        break;
+      case OPT_FAIL_FAST:
+        config->fail_fast = true;
+        break;
+      case OPT_NUMA:
+        config->numa_placement = true;
+        break;
+      case OPT_CGROUP:
+        config->cgroup = optarg;
+        break;
+      case OPT_SHARED_BUILDDIR:
+        config->shared_build_dir = true;
+        break;
+      case OPT_STREAM_SCAN:
+        config->stream_scan = true;
+        break;
+      case OPT_LAZY_SUBNINJAS:
+        options->lazy_subninjas = true;
+        break;
+      case OPT_DEDUP_OUTPUT:
+        config->dedup_output = true;
+        break;
+      case OPT_PREFETCH: {
+        char* end;
+        long value = strtol(optarg, &end, 10);
+        if (*end != 0 || value <= 0)
+          Fatal("invalid --prefetch parameter");
+        config->prefetch_budget = (int64_t)value << 20;
+        break;
+      }
+      case OPT_METRICS_LISTEN:
+        options->metrics_listen = optarg;
+        break;
       case OPT_VERSION:
         printf("%s\n", kNinjaVersion);
         return 0;
@@ -1340,9 +2501,741 @@ int ReadFlags(int* argc, char*** argv,
   *argv += optind;
   *argc -= optind;
 
+  if (config->remote_parallelism == 0) {
+    // Remote commands mostly wait on the network, so many more of them
+    // than local ones can run at once.
+    config->remote_parallelism =
+        config->parallelism < INT_MAX / kDefaultRemoteJobsFactor
+            ? config->parallelism * kDefaultRemoteJobsFactor
+            : INT_MAX;
+  }
+
   return -1;
 }
 
+/// The options to parse the manifest with.
+ManifestParserOptions ParserOptions(const Options& options) {
+  ManifestParserOptions parser_opts;
+  if (options.dupe_edges_should_err) {
+    parser_opts.dupe_edge_action_ = kDupeEdgeActionError;
+  }
+  if (options.phony_cycle_should_err) {
+    parser_opts.phony_cycle_action_ = kPhonyCycleActionError;
+  }
+  parser_opts.parallel_subninjas_ = true;
+  return parser_opts;
+}
+
+/// Save the state of |ninja|, just parsed, to the manifest cache.
+void SaveManifestCache(NinjaMain* ninja, const Options& options) {
+  if (ninja->config_.dry_run)
+    return;
+  string err;
+  if (!ManifestCache::Save(ManifestCache::kPath, options.input_file,
+                           ParserOptions(options), ninja->state_,
+                           ninja->manifest_record_, &err)) {
+    Warning("saving %s: %s", ManifestCache::kPath, err.c_str());
+  }
+}
+
+/// Load the manifest named on the command line into |ninja|, from the
+/// manifest cache if it's up to date.
+/// @return false on error.
+bool LoadManifest(NinjaMain* ninja, const Options& options) {
+  ManifestParserOptions parser_opts = ParserOptions(options);
+  string err;
+  // -d manifest is about parsing, which the cache skips.
+  LoadStatus status = LOAD_NOT_FOUND;
+  if (!g_manifest_stats) {
+    status = ManifestCache::Load(ManifestCache::kPath, options.input_file,
+                                 parser_opts, &ninja->disk_interface_,
+                                 &ninja->state_, &ninja->manifest_record_,
+                                 &err);
+  }
+  if (status == LOAD_SUCCESS)
+    return true;
+  if (status == LOAD_ERROR) {
+    // Parsing the manifest again next time gets past it.
+    Error("loading %s: %s", ManifestCache::kPath, err.c_str());
+    unlink(ManifestCache::kPath);
+    return false;
+  }
+
+  ManifestParser parser(&ninja->state_, &ninja->disk_interface_, parser_opts);
+  parser.set_record(&ninja->manifest_record_);
+  if (!parser.Load(options.input_file, &err)) {
+    Error("%s", err.c_str());
+    return false;
+  }
+  if (g_manifest_stats)
+    ninja->DumpManifestStats();
+  ninja->manifest_record_.Stat(&ninja->disk_interface_);
+  SaveManifestCache(ninja, options);
+  return true;
+}
+
+/// Load into |ninja| only the subninjas the |targets| need, along with the
+/// manifest, if the index of the manifest cache tells which.  Nothing is
+/// saved to the cache then.
+/// @return LOAD_NOT_FOUND if the whole manifest has to be loaded.
+LoadStatus LoadManifestLazily(NinjaMain* ninja, const Options& options,
+                              int target_count, char** targets) {
+  METRIC_RECORD(".ninja lazy load");
+  vector<string> paths;
+  for (int i = 0; i < target_count; ++i) {
+    string path = targets[i];
+    uint64_t slash_bits;
+    string err;
+    // The "foo^" syntax needs the out edges of foo, anywhere.
+    if (!CanonicalizePath(&path, &slash_bits, &err) || path.empty() ||
+        path[path.size() - 1] == '^')
+      return LOAD_NOT_FOUND;
+    paths.push_back(path);
+  }
+  ManifestIndex index;
+  set<string> subninjas;
+  if (!ninja->LoadManifestIndex(options, &index) ||
+      !index.SubninjasFor(paths, options.input_file, &subninjas))
+    return LOAD_NOT_FOUND;
+
+  ManifestParserOptions parser_opts = ParserOptions(options);
+  parser_opts.subninjas_ = &subninjas;
+  ManifestParser parser(&ninja->state_, &ninja->disk_interface_, parser_opts);
+  parser.set_record(&ninja->manifest_record_);
+  string err;
+  if (!parser.Load(options.input_file, &err)) {
+    Error("%s", err.c_str());
+    return LOAD_ERROR;
+  }
+  if (g_manifest_stats)
+    ninja->DumpManifestStats();
+  ninja->manifest_partial_ = true;
+  ninja->deps_log_.set_partial_manifest(true);
+  return LOAD_SUCCESS;
+}
+
+bool NinjaMain::LoadManifestIndex(const Options& options,
+                                  ManifestIndex* index) {
+  string err;
+  return ManifestCache::LoadIndex(ManifestCache::kPath, options.input_file,
+                                  ParserOptions(options), &disk_interface_,
+                                  index, &err) == LOAD_SUCCESS;
+}
+
+bool NinjaMain::EnsureManifestLoaded(const Options& options) {
+  return LoadManifest(this, options);
+}
+
+/// Bring the manifest loaded into |ninja| up to date after it was rebuilt,
+/// parsing again only the subninjas that changed.
+/// @return false if it has to be loaded from scratch instead.
+bool ReloadManifest(NinjaMain* ninja, const Options& options) {
+  // Which subninjas a partial manifest needs may have changed too, and
+  // -d manifest reports on the whole parse.
+  if (ninja->manifest_partial_ || g_manifest_stats)
+    return false;
+  ManifestParser parser(&ninja->state_, &ninja->disk_interface_,
+                        ParserOptions(options));
+  if (!parser.Reload(&ninja->manifest_record_, &ninja->disk_interface_))
+    return false;
+  ninja->state_.Reset();
+  SaveManifestCache(ninja, options);
+  return true;
+}
+
+/// Load the manifest and the logs, rebuild the manifest if needed, and run
+/// the build or the tool.  The first cycle uses |loaded| if it's not NULL,
+/// which already holds the loaded manifest and logs.
+NORETURN void RunManifestCycles(const char* ninja_command,
+                                const Options& options,
+                                const BuildConfig& config,
+                                int argc, char** argv, NinjaMain* loaded) {
+  // Limit number of rebuilds, to prevent infinite loops.
+  const int kCycleLimit = 100;
+  for (int cycle = 1; cycle <= kCycleLimit; ++cycle) {
+    NinjaMain fresh(ninja_command, config);
+    NinjaMain* ninja = &fresh;
+    if (cycle == 1 && loaded) {
+      ninja = loaded;
+    } else {
+      LoadStatus status = LOAD_NOT_FOUND;
+      if (options.lazy_subninjas && !options.tool && argc > 0)
+        status = LoadManifestLazily(ninja, options, argc, argv);
+      if (status == LOAD_ERROR ||
+          (status == LOAD_NOT_FOUND && !LoadManifest(ninja, options)))
+        exit(1);
+
+      if (options.tool && options.tool->when == Tool::RUN_AFTER_LOAD)
+        exit((ninja->*options.tool->func)(&options, argc, argv));
+
+      if (!ninja->EnsureBuildDirExists())
+        exit(1);
+    }
+
+    if (!ninja->LockBuildDir() ||
+        (!ninja->logs_loaded_ && !ninja->LoadLogs()) ||
+        !ninja->OpenBuildLog() || !ninja->OpenDepsLog() ||
+        !ninja->OpenHashLog())
+      exit(1);
+    // The logs are rewritten, if they need it; the others may come in.
+    if (ninja->build_dir_lock_.is_open())
+      ninja->build_dir_lock_.Share();
+
+    if (options.tool && options.tool->when == Tool::RUN_AFTER_LOGS) {
+      int result = (ninja->*options.tool->func)(&options, argc, argv);
+      ninja->CloseLogs();
+      exit(result);
+    }
+
+    // Attempt to rebuild the manifest before building anything else
+    string err;
+    bool rebuilt;
+    while ((rebuilt = ninja->RebuildManifest(options.input_file, &err))) {
+      // In dry_run mode the regeneration will succeed without changing the
+      // manifest forever. Better to return immediately.
+      if (config.dry_run)
+        exit(0);
+      // Start the build over with the new manifest, parsing again only the
+      // subninjas that changed when the rest is the same.
+      if (cycle == kCycleLimit || !ReloadManifest(ninja, options))
+        break;
+      ++cycle;
+    }
+    if (rebuilt) {
+      // Load the new manifest from scratch.
+      continue;
+    } else if (!err.empty()) {
+      Error("rebuilding '%s': %s", options.input_file, err.c_str());
+      exit(1);
+    }
+
+    int result = ninja->RunBuild(argc, argv);
+    ninja->CloseLogs();
+    if (g_metrics)
+      ninja->DumpMetrics();
+    if (g_memory_stats)
+      ninja->DumpMemoryStats();
+    exit(result);
+  }
+
+  Error("manifest '%s' still dirty after %d tries\n",
+      options.input_file, kCycleLimit);
+  exit(1);
+}
+
+#ifndef _WIN32
+
+/// How long the daemon waits for a request before exiting.
+const int kDaemonIdleTimeoutMs = 3 * 60 * 60 * 1000;
+
+/// The directory part of |path|, "" for the current directory.
+string DirName(const string& path) {
+  string::size_type slash = path.find_last_of('/');
+  if (slash == string::npos)
+    return string();
+  if (slash == 0)
+    return "/";
+  return path.substr(0, slash);
+}
+
+/// The process behind "ninja --daemon".  It keeps the manifest and the logs
+/// loaded, and the timestamps of the files they mention up to date by
+/// watching their directories.  It also keeps the dirty state of the graph,
+/// recomputing only downstream of what changed.  Each request gets a
+/// fork()ed copy of that state, which runs the build as a normal ninja
+/// would, writing to the client's stdout and stderr.
+struct Daemon {
+  Daemon(const char* ninja_command, const Options& options,
+         const BuildConfig& config)
+      : ninja_command_(ninja_command), options_(options), config_(config),
+        ninja_(NULL), scan_(NULL), watching_(false), logs_changed_(false) {}
+
+  /// Serve requests until idle for kDaemonIdleTimeoutMs.
+  NORETURN void Run();
+
+ private:
+  /// Load the manifest and the logs, and stat the files they mention.
+  /// Errors are left for the build processes to report, as they load the
+  /// manifest by themselves when nothing is loaded.
+  void Load();
+  /// Drop the loaded manifest, e.g. once it changed.
+  void Unload();
+  /// Start watching |dir|, unless already tried.
+  /// @return whether |dir| is being watched.
+  bool WatchDir(const string& dir);
+  /// Watch the directories of the nodes created since the last call, and
+  /// stat those in watched directories.
+  void TrackNodes();
+  /// Apply the pending change notifications to the loaded state.
+  void ProcessChanges();
+  /// Make the loaded state current, ready to fork a build.
+  void Prepare();
+  /// Forget the dirty state downstream of |nodes|, which changed.
+  void Invalidate(const vector<Node*>& nodes);
+  /// Forget the dirty state of the whole graph.
+  void InvalidateAll();
+  /// Bring the dirty state of the graph up to date.
+  void ScanDirty();
+  /// Run the build for |request| and tell the client how it went.
+  void Serve(DaemonRequest* request);
+  /// In the fork()ed process: run the build for |request| on the loaded
+  /// state.
+  NORETURN void RunRequest(const DaemonRequest& request);
+
+  const char* ninja_command_;
+  /// Options of the client that started the daemon, which determine how
+  /// the manifest is parsed.
+  Options options_;
+  /// Referenced by ninja_; each build process sets it from its own flags.
+  BuildConfig config_;
+  NinjaMain* ninja_;
+  /// Keeps the dirty state of ninja_'s graph.
+  DependencyScan* scan_;
+  /// The nodes ScanDirty() starts from.
+  vector<Node*> roots_;
+  /// The outputs of the "hash_inputs" edges, whose dirty state is left to
+  /// the builds, as the daemon doesn't keep the hash log.
+  vector<Node*> hashed_outputs_;
+
+  DaemonServer server_;
+  FileWatcher watcher_;
+  /// Whether watcher_ works.  Without it nothing loaded could be trusted,
+  /// so each build loads everything by itself.
+  bool watching_;
+  /// Whether the logs changed since they were loaded.
+  bool logs_changed_;
+  /// The manifest files read, whose change requires reloading.
+  set<string> manifest_paths_;
+  /// Nodes by directory, for the directories being watched.
+  map<string, vector<Node*> > watched_dirs_;
+  /// Nodes by directory, for the directories that couldn't be watched
+  /// (e.g. because they don't exist yet), whose timestamps can't be kept.
+  map<string, vector<Node*> > unwatched_dirs_;
+  /// The nodes sorted into watched_dirs_ and unwatched_dirs_.
+  set<Node*> tracked_nodes_;
+};
+
+void Daemon::Run() {
+  // Writes to clients that went away must not kill the daemon.
+  signal(SIGPIPE, SIG_IGN);
+
+  string err;
+  if (!server_.Listen(&err))
+    exit(1);
+  watching_ = watcher_.Init(&err);
+
+  Load();
+  for (;;) {
+    DaemonRequest request;
+    switch (server_.Accept(kDaemonIdleTimeoutMs,
+                           watching_ ? watcher_.fd() : -1, &request, &err)) {
+    case DaemonServer::kAccepted:
+      Serve(&request);
+      break;
+    case DaemonServer::kWatchReady:
+      // Keep up with the changes while idle, in particular the logs
+      // written by the last build.
+      Prepare();
+      break;
+    case DaemonServer::kTimedOut:
+      server_.Close();
+      exit(0);
+    case DaemonServer::kFailed:
+      break;
+    }
+  }
+}
+
+void Daemon::Load() {
+  if (!watching_)
+    return;
+  ninja_ = new NinjaMain(ninja_command_, config_);
+  if (!LoadManifest(ninja_, options_) || !ninja_->EnsureBuildDirExists() ||
+      !ninja_->LoadLogs()) {
+    Unload();
+    return;
+  }
+  vector<const ManifestRecord::File*> files;
+  ninja_->manifest_record_.CollectFiles(&files);
+  for (vector<const ManifestRecord::File*>::iterator i = files.begin();
+       i != files.end(); ++i) {
+    string path = (*i)->path;
+    uint64_t slash_bits;
+    string err;
+    if (CanonicalizePath(&path, &slash_bits, &err))
+      manifest_paths_.insert(path);
+  }
+  logs_changed_ = false;
+
+  // Missing a change to the manifest or the logs would break builds.
+  bool watched = WatchDir(DirName(ninja_->LogPath(".ninja_log")));
+  for (set<string>::iterator i = manifest_paths_.begin();
+       i != manifest_paths_.end(); ++i)
+    watched = WatchDir(DirName(*i)) && watched;
+  if (!watched) {
+    Unload();
+    return;
+  }
+  TrackNodes();
+
+  scan_ = new DependencyScan(&ninja_->state_, &ninja_->build_log_,
+                             &ninja_->deps_log_, &ninja_->disk_interface_,
+                             &config_.depfile_parser_options);
+  string err;
+  roots_ = ninja_->state_.RootNodes(&err);
+  for (vector<Edge*>::iterator e = ninja_->state_.edges_.begin();
+       e != ninja_->state_.edges_.end(); ++e) {
+    if ((*e)->GetBindingBool(kSymbolHashInputs)) {
+      hashed_outputs_.insert(hashed_outputs_.end(), (*e)->outputs_.begin(),
+                             (*e)->outputs_.end());
+    }
+  }
+}
+
+void Daemon::Unload() {
+  delete scan_;
+  scan_ = NULL;
+  roots_.clear();
+  hashed_outputs_.clear();
+  delete ninja_;
+  ninja_ = NULL;
+  manifest_paths_.clear();
+  watched_dirs_.clear();
+  unwatched_dirs_.clear();
+  tracked_nodes_.clear();
+}
+
+bool Daemon::WatchDir(const string& dir) {
+  if (watched_dirs_.count(dir))
+    return true;
+  if (unwatched_dirs_.count(dir))
+    return false;
+  if (watcher_.Watch(dir)) {
+    watched_dirs_[dir];
+    return true;
+  }
+  unwatched_dirs_[dir];
+  return false;
+}
+
+void Daemon::TrackNodes() {
+  // Nodes are never removed, so there's nothing new if the counts match.
+  State::Paths& paths = ninja_->state_.paths_;
+  if (paths.size() == tracked_nodes_.size())
+    return;
+
+  vector<Node*> to_stat;
+  for (State::Paths::iterator i = paths.begin(); i != paths.end(); ++i) {
+    Node* node = i->second;
+    if (!tracked_nodes_.insert(node).second)
+      continue;
+    string dir = DirName(node->path());
+    if (WatchDir(dir)) {
+      watched_dirs_[dir].push_back(node);
+      if (!node->status_known())
+        to_stat.push_back(node);
+    } else {
+      unwatched_dirs_[dir].push_back(node);
+    }
+  }
+
+  DiskInterface* disk_interface = &ninja_->disk_interface_;
+  ParallelFor(to_stat.size(), 16, [&](size_t i) {
+    string err;
+    to_stat[i]->Stat(disk_interface, &err);
+  });
+}
+
+void Daemon::ProcessChanges() {
+  if (!watching_)
+    return;
+  vector<string> changed, lost;
+  if (!watcher_.ReadChanges(&changed, &lost)) {
+    // Notifications were dropped; anything may have changed.
+    Unload();
+    return;
+  }
+  if (!ninja_)
+    return;
+
+  const string build_log_path = ninja_->LogPath(".ninja_log");
+  const string deps_log_path = ninja_->LogPath(".ninja_deps");
+  vector<Node*> to_stat;
+  for (vector<string>::iterator i = changed.begin(); i != changed.end(); ++i) {
+    if (manifest_paths_.count(*i)) {
+      Unload();
+      return;
+    }
+    if (*i == build_log_path || *i == deps_log_path)
+      logs_changed_ = true;
+    if (Node* node = ninja_->state_.LookupNode(*i)) {
+      // Dyndep information can't be unloaded from the graph.
+      if (!node->dyndep_pending()) {
+        for (vector<Edge*>::const_iterator oe = node->out_edges().begin();
+             oe != node->out_edges().end(); ++oe) {
+          if ((*oe)->dyndep_ == node) {
+            Unload();
+            return;
+          }
+        }
+      }
+      node->ResetState();
+      to_stat.push_back(node);
+    }
+  }
+  for (vector<string>::iterator i = lost.begin(); i != lost.end(); ++i) {
+    map<string, vector<Node*> >::iterator dir = watched_dirs_.find(*i);
+    if (dir == watched_dirs_.end())
+      continue;
+    if (*i == DirName(build_log_path)) {
+      Unload();
+      return;
+    }
+    for (set<string>::iterator m = manifest_paths_.begin();
+         m != manifest_paths_.end(); ++m) {
+      if (*i == DirName(*m)) {
+        Unload();
+        return;
+      }
+    }
+    vector<Node*>& nodes = unwatched_dirs_[*i];
+    nodes.insert(nodes.end(), dir->second.begin(), dir->second.end());
+    watched_dirs_.erase(dir);
+  }
+
+  string err;
+  for (vector<Node*>::iterator i = to_stat.begin(); i != to_stat.end(); ++i) {
+    if (!(*i)->status_known())
+      (*i)->Stat(&ninja_->disk_interface_, &err);
+  }
+  Invalidate(to_stat);
+}
+
+void Daemon::Prepare() {
+  ProcessChanges();
+  if (!ninja_) {
+    Load();
+    if (!ninja_)
+      return;
+  }
+
+  if (logs_changed_) {
+    // The last build may have run any of the edges that were dirty, even
+    // those whose outputs it left as they were.
+    vector<Node*> built;
+    for (vector<Edge*>::iterator e = ninja_->state_.edges_.begin();
+         e != ninja_->state_.edges_.end(); ++e) {
+      if ((*e)->mark_ != Edge::VisitNone && !(*e)->outputs_ready())
+        built.insert(built.end(), (*e)->outputs_.begin(), (*e)->outputs_.end());
+    }
+    Invalidate(built);
+
+    // The build processes append to the logs using the ids of the loaded
+    // copies, so those must match the files exactly.
+    ninja_->deps_log_.Reset();
+    if (ninja_->LoadBuildLog(ninja_->LogPath(".ninja_log")) == LOAD_ERROR ||
+        ninja_->LoadDepsLog(ninja_->LogPath(".ninja_deps")) == LOAD_ERROR) {
+      Unload();
+      return;
+    }
+    logs_changed_ = false;
+  }
+
+  // Nodes first seen in the logs the last build wrote.
+  TrackNodes();
+
+  // Directories created since the last build can be watched now; the
+  // timestamps in the others have to be read again by the build.
+  vector<Node*> changed;
+  for (map<string, vector<Node*> >::iterator i = unwatched_dirs_.begin();
+       i != unwatched_dirs_.end(); ) {
+    changed.insert(changed.end(), i->second.begin(), i->second.end());
+    if (watcher_.Watch(i->first)) {
+      string err;
+      for (vector<Node*>::iterator n = i->second.begin();
+           n != i->second.end(); ++n)
+        (*n)->Stat(&ninja_->disk_interface_, &err);
+      vector<Node*>& nodes = watched_dirs_[i->first];
+      nodes.insert(nodes.end(), i->second.begin(), i->second.end());
+      unwatched_dirs_.erase(i++);
+    } else {
+      for (vector<Node*>::iterator n = i->second.begin();
+           n != i->second.end(); ++n)
+        (*n)->ResetState();
+      ++i;
+    }
+  }
+  Invalidate(changed);
+
+  ScanDirty();
+}
+
+void Daemon::Invalidate(const vector<Node*>& nodes) {
+  if (scan_ && !nodes.empty())
+    scan_->InvalidateDirty(nodes);
+}
+
+void Daemon::InvalidateAll() {
+  vector<Node*> nodes;
+  State::Paths& paths = ninja_->state_.paths_;
+  for (State::Paths::iterator i = paths.begin(); i != paths.end(); ++i)
+    nodes.push_back(i->second);
+  Invalidate(nodes);
+}
+
+void Daemon::ScanDirty() {
+  // Only what changed since the last scan is visited again.
+  string err;
+  for (vector<Node*>::iterator i = roots_.begin(); i != roots_.end(); ++i) {
+    if (!scan_->RecomputeDirty(*i, &err)) {
+      // Leave the error, e.g. a cycle, for the build to report.
+      InvalidateAll();
+      return;
+    }
+  }
+  Invalidate(hashed_outputs_);
+}
+
+void Daemon::Serve(DaemonRequest* request) {
+  Prepare();
+
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0)
+    RunRequest(*request);
+  for (int i = 0; i < 3; ++i)
+    close(request->fds[i]);
+  if (pid < 0) {
+    // Let the client build by itself.
+    server_.Reject();
+    return;
+  }
+
+  server_.SendPid(pid);
+  int status;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+  int exit_code = 1;
+  if (WIFEXITED(status))
+    exit_code = WEXITSTATUS(status);
+  else if (WIFSIGNALED(status))
+    exit_code = 128 + WTERMSIG(status);
+  server_.SendExitCode(exit_code);
+}
+
+void Daemon::RunRequest(const DaemonRequest& request) {
+  server_.CloseDescriptors();
+  for (int i = 0; i < 3; ++i) {
+    dup2(request.fds[i], i);
+    close(request.fds[i]);
+  }
+  signal(SIGPIPE, SIG_DFL);
+
+  // Run with the client's environment and command line.  The client already
+  // changed to the -C directory, which is the one we serve.
+  char** env = new char*[request.env.size() + 1];
+  for (size_t i = 0; i < request.env.size(); ++i)
+    env[i] = strdup(request.env[i].c_str());
+  env[request.env.size()] = NULL;
+  environ = env;
+
+  int argc = (int)request.args.size() + 1;
+  char** argv = new char*[argc + 1];
+  argv[0] = strdup(ninja_command_);
+  for (size_t i = 0; i < request.args.size(); ++i)
+    argv[i + 1] = strdup(request.args[i].c_str());
+  argv[argc] = NULL;
+
+  Options options = {};
+  options.input_file = "build.ninja";
+  options.dupe_edges_should_err = true;
+  options.cache_size = (int64_t)kDefaultCacheSizeMB << 20;
+  config_ = BuildConfig();
+  optind = 1;
+  int exit_code = ReadFlags(&argc, &argv, &options, &config_);
+  if (exit_code >= 0)
+    exit(exit_code);
+  // Explain all the dirty state, not just what changed.
+  if (g_explaining && ninja_)
+    InvalidateAll();
+
+  Jobserver jobserver;
+  SetupJobserver(options, &config_, &jobserver);
+  SetupMetricsServer(options, &config_);
+
+  // Declared first, as the action cache uses it until destroyed.
+  RemoteCache remote_cache;
+  ActionCache action_cache(options.cache_dir ? options.cache_dir : "",
+                           options.cache_size);
+  if (options.cache_dir)
+    config_.action_cache = &action_cache;
+  SetupRemoteCache(options, &action_cache, &remote_cache);
+
+  // The loaded state only helps builds of the same manifest, parsed the
+  // same way.
+  NinjaMain* loaded = ninja_;
+  if (options.tool || strcmp(options.input_file, options_.input_file) != 0 ||
+      options.dupe_edges_should_err != options_.dupe_edges_should_err ||
+      options.phony_cycle_should_err != options_.phony_cycle_should_err)
+    loaded = NULL;
+  RunManifestCycles(ninja_command_, options, config_, argc, argv, loaded);
+}
+
+/// Fork a daemon serving the current directory.
+/// @return false on error.
+bool StartDaemon(const char* ninja_command, const Options& options,
+                 const BuildConfig& config) {
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    Warning("starting ninja daemon: %s", strerror(errno));
+    return false;
+  }
+  if (pid == 0) {
+    // Leave the terminal's session, and fork again so that init reaps the
+    // daemon once it exits.
+    setsid();
+    if (fork() != 0)
+      _exit(0);
+    int null_fd = open("/dev/null", O_RDWR);
+    for (int i = 0; i < 3; ++i)
+      dup2(null_fd, i);
+    if (null_fd > 2)
+      close(null_fd);
+    Daemon daemon(ninja_command, options, config);
+    daemon.Run();
+  }
+  while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {}
+  return true;
+}
+
+/// Hand the build to the daemon serving the current directory, starting it
+/// if needed.  Only returns if the build has to run in this process.
+void BuildThroughDaemon(const char* ninja_command, const Options& options,
+                        const BuildConfig& config, int argc, char** argv) {
+  DaemonRequest request;
+  request.args.assign(argv + 1, argv + argc);
+  for (char** var = environ; *var; ++var)
+    request.env.push_back(*var);
+
+  int exit_code;
+  string err;
+  if (DaemonForward(request, &exit_code, &err))
+    exit(exit_code);
+  if (!StartDaemon(ninja_command, options, config))
+    return;
+  // Give the new daemon some time to create its socket.
+  for (int attempt = 0; attempt < 200; ++attempt) {
+    if (DaemonForward(request, &exit_code, &err))
+      exit(exit_code);
+    usleep(10 * 1000);
+  }
+  Warning("ninja daemon unavailable (%s); building without it", err.c_str());
+}
+
+#endif  // !_WIN32
+
 NORETURN void real_main(int argc, char** argv) {
   // Use exit() instead of return in this function to avoid potentially
   // expensive cleanup when destructing NinjaMain.
@@ -1350,9 +3243,12 @@ NORETURN void real_main(int argc, char** argv) {
   Options options = {};
   options.input_file = "build.ninja";
   options.dupe_edges_should_err = true;
+  options.cache_size = (int64_t)kDefaultCacheSizeMB << 20;
 
   setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
   const char* ninja_command = argv[0];
+  const int original_argc = argc;
+  char** const original_argv = argv;
 
   int exit_code = ReadFlags(&argc, &argv, &options, &config);
   if (exit_code >= 0)
@@ -1372,65 +3268,35 @@ NORETURN void real_main(int argc, char** argv) {
   }
 
   if (options.tool && options.tool->when == Tool::RUN_AFTER_FLAGS) {
-    // None of the RUN_AFTER_FLAGS actually use a NinjaMain, but it's needed
-    // by other tools.
+    // Most of the RUN_AFTER_FLAGS don't use a NinjaMain, but "targets" and
+    // "rules" load the manifest into it when its index isn't enough.
     NinjaMain ninja(ninja_command, config);
     exit((ninja.*options.tool->func)(&options, argc, argv));
   }
 
-  // Limit number of rebuilds, to prevent infinite loops.
-  const int kCycleLimit = 100;
-  for (int cycle = 1; cycle <= kCycleLimit; ++cycle) {
-    NinjaMain ninja(ninja_command, config);
-
-    ManifestParserOptions parser_opts;
-    if (options.dupe_edges_should_err) {
-      parser_opts.dupe_edge_action_ = kDupeEdgeActionError;
-    }
-    if (options.phony_cycle_should_err) {
-      parser_opts.phony_cycle_action_ = kPhonyCycleActionError;
-    }
-    ManifestParser parser(&ninja.state_, &ninja.disk_interface_, parser_opts);
-    string err;
-    if (!parser.Load(options.input_file, &err)) {
-      Error("%s", err.c_str());
-      exit(1);
-    }
-
-    if (options.tool && options.tool->when == Tool::RUN_AFTER_LOAD)
-      exit((ninja.*options.tool->func)(&options, argc, argv));
-
-    if (!ninja.EnsureBuildDirExists())
-      exit(1);
+  // Tools always run in this process.
+  if (options.daemon && !options.tool) {
+#ifdef _WIN32
+    Warning("--daemon is not supported on Windows; building without it");
+#else
+    BuildThroughDaemon(ninja_command, options, config, original_argc,
+                       original_argv);
+#endif
+  }
 
-    if (!ninja.OpenBuildLog() || !ninja.OpenDepsLog())
-      exit(1);
+  Jobserver jobserver;
+  SetupJobserver(options, &config, &jobserver);
+  SetupMetricsServer(options, &config);
 
-    if (options.tool && options.tool->when == Tool::RUN_AFTER_LOGS)
-      exit((ninja.*options.tool->func)(&options, argc, argv));
+  // Declared first, as the action cache uses it until destroyed.
+  RemoteCache remote_cache;
+  ActionCache action_cache(options.cache_dir ? options.cache_dir : "",
+                           options.cache_size);
+  if (options.cache_dir)
+    config.action_cache = &action_cache;
+  SetupRemoteCache(options, &action_cache, &remote_cache);
 
-    // Attempt to rebuild the manifest before building anything else
-    if (ninja.RebuildManifest(options.input_file, &err)) {
-      // In dry_run mode the regeneration will succeed without changing the
-      // manifest forever. Better to return immediately.
-      if (config.dry_run)
-        exit(0);
-      // Start the build over with the new manifest.
-      continue;
-    } else if (!err.empty()) {
-      Error("rebuilding '%s': %s", options.input_file, err.c_str());
-      exit(1);
-    }
-
-    int result = ninja.RunBuild(argc, argv);
-    if (g_metrics)
-      ninja.DumpMetrics();
-    exit(result);
-  }
-
-  Error("manifest '%s' still dirty after %d tries\n",
-      options.input_file, kCycleLimit);
-  exit(1);
+  RunManifestCycles(ninja_command, options, config, argc, argv, NULL);
 }
 
 }  // anonymous namespace
@@ -0,0 +1,93 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "output_dedup.h"
+
+#include <algorithm>
+
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// The end of the line starting at |start| of |s|, past its newline.
+size_t LineEnd(const string& s, size_t start) {
+  size_t end = s.find('\n', start);
+  return end == string::npos ? s.size() : end + 1;
+}
+
+bool IsContinuation(const string& s, size_t start) {
+  return s[start] == ' ' || s[start] == '\t';
+}
+
+bool MoreRepeated(const OutputDeduper::Repeat& a,
+                  const OutputDeduper::Repeat& b) {
+  return a.count > b.count;
+}
+
+}  // anonymous namespace
+
+string OutputDeduper::Filter(const string& output) {
+  string result;
+  size_t start = 0;
+  while (start < output.size()) {
+    size_t first_end = LineEnd(output, start);
+    size_t end = first_end;
+    while (end < output.size() && IsContinuation(output, end))
+      end = LineEnd(output, end);
+
+    string block = output.substr(start, end - start);
+    string stripped;
+    const string& text = StripAnsiEscapeCodes(block, &stripped);
+    size_t index = blocks_.size();
+    pair<unordered_map<uint64_t, size_t>::iterator, bool> found =
+        seen_.insert(make_pair(Hash64(text.data(), text.size()), index));
+    if (found.second) {
+      Repeat repeat;
+      repeat.first_line = text.substr(0, text.find('\n'));
+      repeat.count = 0;
+      blocks_.push_back(repeat);
+      result += block;
+    } else {
+      Repeat* repeat = &blocks_[found.first->second];
+      string reference = Reference(repeat->first_line);
+      if (reference.size() < text.size()) {
+        ++repeat->count;
+        left_out_bytes_ += text.size() - reference.size();
+        result += reference;
+      } else {
+        result += block;
+      }
+    }
+    start = end;
+  }
+  return result;
+}
+
+vector<OutputDeduper::Repeat> OutputDeduper::Repeats() const {
+  vector<Repeat> repeats;
+  for (vector<Repeat>::const_iterator i = blocks_.begin();
+       i != blocks_.end(); ++i) {
+    if (i->count > 0)
+      repeats.push_back(*i);
+  }
+  stable_sort(repeats.begin(), repeats.end(), MoreRepeated);
+  return repeats;
+}
+
+// static
+string OutputDeduper::Reference(const string& first_line) {
+  return "(repeated) " + first_line + "\n";
+}
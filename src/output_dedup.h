@@ -0,0 +1,62 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_OUTPUT_DEDUP_H_
+#define NINJA_OUTPUT_DEDUP_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Shortens the output of the commands by leaving out the diagnostics
+/// printed before, like a warning of a header that many of them include.
+/// The output is cut into blocks, one per diagnostic: a line that doesn't
+/// start with whitespace and the indented lines after it, which compilers
+/// print its context in.  A block seen before is replaced with a reference
+/// line naming its first line, if that's shorter.
+struct OutputDeduper {
+  OutputDeduper() : left_out_bytes_(0) {}
+
+  /// Return |output|, whole lines, with the blocks seen before replaced.
+  /// Escape codes don't tell blocks apart.
+  std::string Filter(const std::string& output);
+
+  struct Repeat {
+    /// The first line of the block, without escape codes.
+    std::string first_line;
+    /// How many times it was replaced.
+    int count;
+  };
+
+  /// The blocks replaced at least once, most replaced first.
+  std::vector<Repeat> Repeats() const;
+
+  /// The bytes the replaced blocks would have taken, less those of the
+  /// references.
+  int64_t left_out_bytes() const { return left_out_bytes_; }
+
+  /// The reference to a block with |first_line|.
+  static std::string Reference(const std::string& first_line);
+
+ private:
+  /// The blocks seen, by the hash of their text without escape codes, as
+  /// indexes in |blocks_|.
+  std::unordered_map<uint64_t, size_t> seen_;
+  std::vector<Repeat> blocks_;
+  int64_t left_out_bytes_;
+};
+
+#endif  // NINJA_OUTPUT_DEDUP_H_
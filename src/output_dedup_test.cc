@@ -0,0 +1,68 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "output_dedup.h"
+
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+const char kContext[] =
+"    3 |   int x;\n"
+"      |       ^\n";
+const string kWarning =
+    string("foo.h:3:7: warning: unused variable 'x' [-Wunused-variable]\n") +
+    kContext;
+
+TEST(OutputDedupTest, RepeatedBlocks) {
+  OutputDeduper deduper;
+  string first = "In file included from a.c:1:\n" + kWarning;
+  EXPECT_EQ(first, deduper.Filter(first));
+
+  // The include trail differs, the warning doesn't.
+  string second = "In file included from b.c:1:\n" + kWarning;
+  string reference = OutputDeduper::Reference(
+      "foo.h:3:7: warning: unused variable 'x' [-Wunused-variable]");
+  EXPECT_EQ("In file included from b.c:1:\n" + reference,
+            deduper.Filter(second));
+
+  // Colors don't make it another block.
+  string colored = string("\x1B[1mfoo.h:3:7:\x1B[0m warning: unused variable "
+                          "'x' [-Wunused-variable]\n") +
+                   kContext;
+  EXPECT_EQ(reference, deduper.Filter(colored));
+
+  vector<OutputDeduper::Repeat> repeats = deduper.Repeats();
+  ASSERT_EQ(1u, repeats.size());
+  EXPECT_EQ(2, repeats[0].count);
+  EXPECT_EQ(2 * (int64_t)(kWarning.size() - reference.size()),
+            deduper.left_out_bytes());
+}
+
+TEST(OutputDedupTest, ShortBlocksStay) {
+  OutputDeduper deduper;
+  // Repeated, but a reference would be longer.
+  EXPECT_EQ("1 warning generated.\n",
+            deduper.Filter("1 warning generated.\n"));
+  EXPECT_EQ("1 warning generated.\n",
+            deduper.Filter("1 warning generated.\n"));
+  // No newline at the end.
+  EXPECT_EQ("done", deduper.Filter("done"));
+  EXPECT_TRUE(deduper.Repeats().empty());
+  EXPECT_EQ(0, deduper.left_out_bytes());
+}
+
+}  // anonymous namespace
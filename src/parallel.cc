@@ -0,0 +1,88 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "parallel.h"
+
+#include <atomic>
+
+using namespace std;
+
+void ParallelFor(size_t count, int thread_count,
+                 const function<void(size_t)>& func) {
+  atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i; (i = next.fetch_add(1)) < count;)
+      func(i);
+  };
+
+  vector<thread> threads;
+  for (int i = 1; i < thread_count && (size_t)i < count; ++i)
+    threads.push_back(thread(work));
+  work();
+  for (vector<thread>::iterator t = threads.begin(); t != threads.end(); ++t)
+    t->join();
+}
+
+TaskGroup::TaskGroup(int thread_count)
+    : thread_count_(thread_count), running_(0), stopping_(false) {}
+
+TaskGroup::~TaskGroup() {
+  Wait();
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  changed_.notify_all();
+  for (vector<thread>::iterator t = threads_.begin(); t != threads_.end(); ++t)
+    t->join();
+}
+
+void TaskGroup::Add(const function<void()>& task) {
+  lock_guard<mutex> lock(mutex_);
+  queue_.push_back(task);
+  // Start another thread if all the current ones may be busy.
+  if ((int)threads_.size() < thread_count_ &&
+      queue_.size() + running_ > threads_.size()) {
+    threads_.push_back(thread([this]() {
+      unique_lock<mutex> lock(mutex_);
+      RunTasks(&lock, [this]() { return stopping_; });
+    }));
+  }
+  changed_.notify_one();
+}
+
+void TaskGroup::Wait() {
+  unique_lock<mutex> lock(mutex_);
+  RunTasks(&lock, [this]() { return queue_.empty() && running_ == 0; });
+}
+
+void TaskGroup::RunTasks(unique_lock<mutex>* lock,
+                         const function<bool()>& stop) {
+  for (;;) {
+    if (!queue_.empty()) {
+      function<void()> task = queue_.front();
+      queue_.pop_front();
+      ++running_;
+      lock->unlock();
+      task();
+      lock->lock();
+      if (--running_ == 0 && queue_.empty())
+        changed_.notify_all();
+      continue;
+    }
+    if (stop())
+      return;
+    changed_.wait(*lock);
+  }
+}
@@ -0,0 +1,68 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_PARALLEL_H_
+#define NINJA_PARALLEL_H_
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Call |func| with each index in [0, count), spread over up to
+/// |thread_count| threads including the calling one, and return once all
+/// the calls have returned.  |func| must be safe to call concurrently.
+void ParallelFor(size_t count, int thread_count,
+                 const std::function<void(size_t)>& func);
+
+/// A set of tasks run on up to |thread_count| threads, plus the thread
+/// calling Wait().  Tasks may add further tasks.  Threads are only started
+/// once there is a task for them.
+struct TaskGroup {
+  explicit TaskGroup(int thread_count);
+  /// Waits for the tasks still pending.
+  ~TaskGroup();
+
+  /// Queue |task| to run on some thread.  Safe to call from tasks.
+  void Add(const std::function<void()>& task);
+
+  /// Help running the tasks until all have returned, including the ones
+  /// they added.
+  void Wait();
+
+ private:
+  /// Run queued tasks until |stop| returns true; called with |lock| held.
+  void RunTasks(std::unique_lock<std::mutex>* lock,
+                const std::function<bool()>& stop);
+
+  int thread_count_;
+  std::mutex mutex_;
+  /// Signaled when a task is queued, or the last running task returns.
+  std::condition_variable changed_;
+  std::deque<std::function<void()> > queue_;
+  /// Number of tasks currently running.
+  int running_;
+  bool stopping_;
+  std::vector<std::thread> threads_;
+
+  // Unimplemented copy ctor and operator= ensure we don't join twice.
+  TaskGroup(const TaskGroup& other);         // DO NOT IMPLEMENT
+  void operator=(const TaskGroup& other);    // DO NOT IMPLEMENT
+};
+
+#endif  // NINJA_PARALLEL_H_
@@ -0,0 +1,54 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "parallel.h"
+
+#include <atomic>
+#include <vector>
+
+#include "test.h"
+
+using namespace std;
+
+TEST(ParallelFor, CallsEachIndexOnce) {
+  vector<int> calls(1000);
+  ParallelFor(calls.size(), 8, [&](size_t i) { ++calls[i]; });
+  for (size_t i = 0; i < calls.size(); ++i)
+    EXPECT_EQ(1, calls[i]);
+}
+
+TEST(ParallelFor, Empty) {
+  int calls = 0;
+  ParallelFor(0, 8, [&](size_t) { ++calls; });
+  EXPECT_EQ(0, calls);
+}
+
+TEST(TaskGroup, RunsNestedTasks) {
+  atomic<int> calls(0);
+  TaskGroup tasks(4);
+  for (int i = 0; i < 10; ++i) {
+    tasks.Add([&]() {
+      for (int j = 0; j < 10; ++j)
+        tasks.Add([&]() { ++calls; });
+      ++calls;
+    });
+  }
+  tasks.Wait();
+  EXPECT_EQ(110, calls.load());
+
+  // The group can be reused once idle.
+  tasks.Add([&]() { ++calls; });
+  tasks.Wait();
+  EXPECT_EQ(111, calls.load());
+}
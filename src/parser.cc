@@ -15,30 +15,31 @@
 #include "parser.h"
 
 #include "disk_interface.h"
+#include "mapped_file.h"
 #include "metrics.h"
+#include "trace.h"
 
 using namespace std;
 
 bool Parser::Load(const string& filename, string* err, Lexer* parent) {
   METRIC_RECORD(".ninja parse");
-  string contents;
+  TRACE_RECORD(".ninja parse");
+  MappedFile input;
+  if (!ReadInput(filename, &input, err, parent))
+    return false;
+  return Parse(filename, StringPiece(input.data(), input.size()), err);
+}
+
+bool Parser::ReadInput(const string& filename, MappedFile* input, string* err,
+                       Lexer* parent) {
   string read_err;
-  if (file_reader_->ReadFile(filename, &contents, &read_err) !=
-      FileReader::Okay) {
+  if (file_reader_->MapFile(filename, input, &read_err) != FileReader::Okay) {
     *err = "loading '" + filename + "': " + read_err;
     if (parent)
       parent->Error(string(*err), err);
     return false;
   }
-
-  // The lexer needs a nul byte at the end of its input, to know when it's done.
-  // It takes a StringPiece, and StringPiece's string constructor uses
-  // string::data().  data()'s return value isn't guaranteed to be
-  // null-terminated (although in practice - libc++, libstdc++, msvc's stl --
-  // it is, and C++11 demands that too), so add an explicit nul byte.
-  contents.resize(contents.size() + 1);
-
-  return Parse(filename, contents, err);
+  return true;
 }
 
 bool Parser::ExpectToken(Lexer::Token expected, string* err) {
@@ -20,6 +20,7 @@
 #include "lexer.h"
 
 struct FileReader;
+struct MappedFile;
 struct State;
 
 /// Base class for parsers.
@@ -35,13 +36,19 @@ protected:
   /// saying "expected foo, got bar".
   bool ExpectToken(Lexer::Token expected, std::string* err);
 
+  /// Map |filename| into |input|, nul-terminated for the lexer, which
+  /// then scans it in place.  Errors are located at |parent| if not NULL.
+  bool ReadInput(const std::string& filename, MappedFile* input,
+                 std::string* err, Lexer* parent);
+
   State* state_;
   FileReader* file_reader_;
   Lexer lexer_;
 
 private:
-  /// Parse a file, given its contents as a string.
-  virtual bool Parse(const std::string& filename, const std::string& input,
+  /// Parse a file, given its contents, which must be followed by a nul
+  /// byte.
+  virtual bool Parse(const std::string& filename, StringPiece input,
                      std::string* err) = 0;
 };
 
@@ -0,0 +1,203 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reformat.h"
+
+#include <assert.h>
+#include <ctype.h>
+
+#include "util.h"
+
+using namespace std;
+
+bool Reformatter::AddRule(const string& pattern, const string& format,
+                          string* err) {
+  Rule rule;
+#ifdef __cpp_exceptions
+  try {
+    rule.regex = regex(pattern, regex::ECMAScript | regex::optimize);
+  } catch (const regex_error& e) {
+    *err = "invalid pattern '" + pattern + "': " + e.what();
+    return false;
+  }
+#else
+  // Without exceptions, an invalid pattern aborts.
+  rule.regex = regex(pattern, regex::ECMAScript | regex::optimize);
+#endif
+  rule.format = format;
+  rule.literal = RequiredLiteral(pattern);
+  rules_.push_back(rule);
+  return true;
+}
+
+bool Reformatter::LoadRules(const string& path, string* err) {
+  string contents;
+  if (ReadFile(path, &contents, err) < 0) {
+    *err = "loading '" + path + "': " + *err;
+    return false;
+  }
+  size_t start = 0;
+  for (int line_number = 1; start < contents.size(); ++line_number) {
+    size_t end = contents.find('\n', start);
+    if (end == string::npos)
+      end = contents.size();
+    string line = contents.substr(start, end - start);
+    start = end + 1;
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.resize(line.size() - 1);
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    size_t tab = line.find('\t');
+    if (tab == string::npos) {
+      *err = path + ":" + to_string(line_number) +
+             ": expected a pattern and a replacement separated by a tab";
+      return false;
+    }
+    string format;
+    for (size_t i = tab + 1; i < line.size(); ++i) {
+      if (line[i] == '\\' && i + 1 < line.size() && line[i + 1] == 'e') {
+        format += '\x1b';
+        ++i;
+      } else {
+        format += line[i];
+      }
+    }
+    if (!AddRule(line.substr(0, tab), format, err)) {
+      *err = path + ":" + to_string(line_number) + ": " + *err;
+      return false;
+    }
+  }
+  return true;
+}
+
+void Reformatter::AddDefaultRules() {
+  static const char* const kRules[][2] = {
+    { "building rds definition (.*)",
+      "\x1b[36mbuilding rds script\x1b[0m \x1b[34m$1\x1b[0m" },
+    { "Building CXX(.*) ([^ ]+)",
+      "\x1b[32mbuilding c++$1 \x1b[34m$2\x1b[0m" },
+    { "Linking CXX static library(.*) ([^ ]+)",
+      "\x1b[33;1mlinking: c++ static$1 \x1b[34;1m$2\x1b[0m" },
+    { "Building C(.*) ([^ ]+)",
+      "\x1b[32mbuilding c  $1 \x1b[34m$2\x1b[0m" },
+    { "Linking CXX executable(.*) ([^ ]+)",
+      "\x1b[33;1mlinking: c++ binary$1 \x1b[34;1m$2\x1b[0m" },
+    { "Linking C static library(.*) ([^ ]+)",
+      "\x1b[33;1mlinking: c   static$1 \x1b[34;1m$2\x1b[0m" },
+    { "Linking C(.*) ([^ ]+)",
+      "\x1b[33;1mlinking: c  $1 \x1b[34;1m$2\x1b[0m" },
+    // foo/xyz.dir/bar --> foo/bar
+    { "[^/ ]+\\.dir/", "" },
+    // foo/CMakeFiles/bar --> foo/bar
+    { "CMakeFiles/", "" },
+    // foo.cpp.o --> foo.cpp
+    { "\\.cpp\\.o", ".cpp" },
+    // Color the progress numbers e.g. [37/120].
+    { "\\[([ 0-9]+)/([ 0-9]+)\\]",
+      "[\x1b[37;1m$1\x1b[0m/\x1b[37m$2\x1b[0m]" },
+  };
+  for (size_t i = 0; i < sizeof(kRules) / sizeof(kRules[0]); ++i) {
+    string err;
+    bool ok = AddRule(kRules[i][0], kRules[i][1], &err);
+    assert(ok);
+    (void)ok;
+  }
+}
+
+string Reformatter::Apply(const string& line) const {
+  string result = line;
+  for (vector<Rule>::const_iterator r = rules_.begin(); r != rules_.end();
+       ++r) {
+    if (!r->literal.empty() && result.find(r->literal) == string::npos)
+      continue;
+    result = regex_replace(result, r->regex, r->format);
+  }
+  return result;
+}
+
+string RequiredLiteral(const string& pattern) {
+  // The literal characters outside groups, in runs broken by anything
+  // else; a character made optional by a quantifier leaves its run.
+  string best, run;
+  int depth = 0;
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    char c = pattern[i];
+    bool literal = false;
+    switch (c) {
+    case '\\':
+      if (i + 1 == pattern.size())
+        return "";
+      c = pattern[++i];
+      // Escaped punctuation stands for itself; letters and digits make
+      // classes, anchors, backreferences and character codes.
+      literal = !isalnum((unsigned char)c);
+      if (c == 'x')
+        i += 2;
+      else if (c == 'u')
+        i += 4;
+      else if (c == 'c')
+        i += 1;
+      break;
+    case '|':
+      if (depth == 0)
+        return "";
+      break;
+    case '[':
+      ++i;
+      if (i < pattern.size() && pattern[i] == '^')
+        ++i;
+      if (i < pattern.size() && pattern[i] == ']')
+        ++i;
+      for (; i < pattern.size() && pattern[i] != ']'; ++i) {
+        if (pattern[i] == '\\')
+          ++i;
+      }
+      break;
+    case '(':
+      ++depth;
+      break;
+    case ')':
+      --depth;
+      break;
+    case '*':
+    case '?':
+    case '{':
+      if (!run.empty())
+        run.resize(run.size() - 1);
+      if (c == '{') {
+        while (i < pattern.size() && pattern[i] != '}')
+          ++i;
+      }
+      break;
+    case '+':
+    case '.':
+    case '^':
+    case '$':
+      break;
+    default:
+      literal = true;
+    }
+    if (literal && depth == 0) {
+      run += c;
+      continue;
+    }
+    if (run.size() > best.size())
+      best = run;
+    run.clear();
+  }
+  if (run.size() > best.size())
+    best = run;
+  return best;
+}
@@ -0,0 +1,63 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_REFORMAT_H_
+#define NINJA_REFORMAT_H_
+
+#include <regex>
+#include <string>
+#include <vector>
+
+/// Rewrites the status lines ninja prints, e.g. to shorten and color them,
+/// with rules applied in turn, each a std::regex and its replacement.  The
+/// rules are compiled once.  Each also keeps a literal that any match
+/// contains, so that a line without it costs a substring search rather
+/// than running the regex.
+struct Reformatter {
+  /// Add a rule replacing the matches of |pattern|, an ECMAScript regex,
+  /// with |format|, as std::regex_replace() does.
+  /// @return false if |pattern| is invalid, saying why in |err|.
+  bool AddRule(const std::string& pattern, const std::string& format,
+               std::string* err);
+
+  /// Add the rules of the file at |path|.  Each of its lines holds a
+  /// pattern and its replacement, separated by a tab; "\e" in the
+  /// replacement stands for the escape character of terminal colors.
+  /// Empty lines and lines starting with '#' are skipped.
+  /// @return false on error, saying why in |err|.
+  bool LoadRules(const std::string& path, std::string* err);
+
+  /// Add the rules for CMake's messages, which shorten and color them.
+  void AddDefaultRules();
+
+  /// Apply the rules to |line|.
+  std::string Apply(const std::string& line) const;
+
+  size_t size() const { return rules_.size(); }
+
+ private:
+  struct Rule {
+    std::regex regex;
+    std::string format;
+    /// Contained in every match, or empty if that isn't known.
+    std::string literal;
+  };
+  std::vector<Rule> rules_;
+};
+
+/// The longest string that every match of the ECMAScript regex |pattern|
+/// contains, or "" if none can be told, e.g. if it has alternatives.
+std::string RequiredLiteral(const std::string& pattern);
+
+#endif  // NINJA_REFORMAT_H_
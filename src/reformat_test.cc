@@ -0,0 +1,85 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reformat.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "disk_interface.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+const char kTestFilename[] = "ReformatTest-tempfile";
+
+TEST(Reformat, RequiredLiteral) {
+  EXPECT_EQ("Building CXX", RequiredLiteral("Building CXX(.*) ([^ ]+)"));
+  EXPECT_EQ(".dir/", RequiredLiteral("[^/ ]+\\.dir/"));
+  EXPECT_EQ(".cpp.o", RequiredLiteral("\\.cpp\\.o"));
+  EXPECT_EQ("[", RequiredLiteral("\\[([ 0-9]+)/([ 0-9]+)\\]"));
+  // Optional characters leave the literal.
+  EXPECT_EQ("colo", RequiredLiteral("colou?r"));
+  EXPECT_EQ("abc", RequiredLiteral("abc\\d{2}de"));
+  EXPECT_EQ("ab", RequiredLiteral("ab+c"));
+  // Groups and classes may hold anything.
+  EXPECT_EQ("tail", RequiredLiteral("(head|body)tail"));
+  EXPECT_EQ("ab", RequiredLiteral("[xyz\\]]ab"));
+  EXPECT_EQ("", RequiredLiteral("foo|bar"));
+  EXPECT_EQ("", RequiredLiteral(".*"));
+  EXPECT_EQ("A", RequiredLiteral("\\u0041A"));
+}
+
+TEST(Reformat, DefaultRules) {
+  Reformatter reformatter;
+  reformatter.AddDefaultRules();
+  EXPECT_EQ(
+      "[\x1b[37;1m3\x1b[0m/\x1b[37m10\x1b[0m] "
+      "\x1b[32mbuilding c++ object \x1b[34msrc/foo.cpp\x1b[0m",
+      reformatter.Apply("[3/10] Building CXX object "
+                        "src/CMakeFiles/foo.dir/foo.cpp.o"));
+  EXPECT_EQ("nothing to see", reformatter.Apply("nothing to see"));
+}
+
+TEST(Reformat, LoadRules) {
+  unlink(kTestFilename);
+  RealDiskInterface disk;
+  ASSERT_TRUE(disk.WriteFile(kTestFilename,
+"# Shorten the paths.\n"
+"\n"
+"out/[^ ]+/\tout/\n"
+"^Compiling (.*)\t\\e[1m$1\\e[0m\n"));
+
+  Reformatter reformatter;
+  string err;
+  EXPECT_TRUE(reformatter.LoadRules(kTestFilename, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(2u, reformatter.size());
+  EXPECT_EQ("\x1b[1mout/foo.o\x1b[0m",
+            reformatter.Apply("Compiling out/debug/obj/foo.o"));
+
+  ASSERT_TRUE(disk.WriteFile(kTestFilename, "no tab\n"));
+  EXPECT_FALSE(reformatter.LoadRules(kTestFilename, &err));
+  EXPECT_EQ(string(kTestFilename) +
+                ":1: expected a pattern and a replacement separated by a tab",
+            err);
+  unlink(kTestFilename);
+}
+
+}  // anonymous namespace
@@ -0,0 +1,152 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "remote_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+/// How long the server may stall a request before it fails, and the build
+/// runs the command instead.
+const int kTimeoutSeconds = 30;
+
+#ifdef MSG_NOSIGNAL
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+bool SendAll(int fd, const char* p, size_t size) {
+  while (size > 0) {
+    ssize_t len = send(fd, p, size, kSendFlags);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      return false;
+    p += len;
+    size -= len;
+  }
+  return true;
+}
+
+/// Connect to |host| at |port|, with kTimeoutSeconds on each send and
+/// receive.  @return the socket, or -1.
+int Connect(const string& host, int port, string* err) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addrs;
+  int ret = getaddrinfo(host.c_str(), to_string(port).c_str(), &hints,
+                        &addrs);
+  if (ret != 0) {
+    *err = host + ": " + gai_strerror(ret);
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo* a = addrs; a; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0)
+      continue;
+    // Keep it out of the commands starting meanwhile.
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    timeval timeout = { kTimeoutSeconds, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+      break;
+    *err = host + ": " + strerror(errno);
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addrs);
+  return fd;
+}
+
+}  // anonymous namespace
+
+bool RemoteCache::Request(const char* method, const string& name,
+                          const string& body, int* status, string* response,
+                          string* err) {
+  int fd = Connect(host_, port_, err);
+  if (fd < 0)
+    return false;
+
+  // HTTP/1.0 keeps the response free of chunked encoding, and closes the
+  // connection once done.
+  string header = string(method) + " " + path_ + "/" + name +
+                  " HTTP/1.0\r\n"
+                  "Host: " + host_ + "\r\n"
+                  "Content-Length: " + to_string(body.size()) + "\r\n"
+                  "\r\n";
+  if (!SendAll(fd, header.data(), header.size()) ||
+      !SendAll(fd, body.data(), body.size())) {
+    *err = string(method) + " " + name + ": " + strerror(errno);
+    close(fd);
+    return false;
+  }
+
+  string data;
+  char buf[64 << 10];
+  for (;;) {
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len < 0) {
+      *err = string(method) + " " + name + ": " + strerror(errno);
+      close(fd);
+      return false;
+    }
+    if (len == 0)
+      break;
+    data.append(buf, len);
+  }
+  close(fd);
+
+  // "HTTP/1.1 200 OK", the headers, then the body.
+  size_t end = data.find("\r\n\r\n");
+  if (data.compare(0, 5, "HTTP/") != 0 || end == string::npos ||
+      data.find(' ') > end) {
+    *err = string(method) + " " + name + ": malformed response";
+    return false;
+  }
+  *status = atoi(data.c_str() + data.find(' ') + 1);
+  response->assign(data, end + 4, string::npos);
+
+  // A connection that broke off early leaves the body short.
+  for (size_t pos = data.find("\r\n"); pos < end;
+       pos = data.find("\r\n", pos + 2)) {
+    const char kLength[] = "content-length:";
+    if (strncasecmp(data.c_str() + pos + 2, kLength, sizeof(kLength) - 1) ==
+            0 &&
+        strtoull(data.c_str() + pos + 2 + sizeof(kLength) - 1, NULL, 10) !=
+            response->size()) {
+      *err = string(method) + " " + name + ": truncated response";
+      return false;
+    }
+  }
+  return true;
+}
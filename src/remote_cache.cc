@@ -0,0 +1,113 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "remote_cache.h"
+
+#include <stdlib.h>
+
+using namespace std;
+
+bool RemoteCache::Init(const string& url, string* err) {
+  const char kScheme[] = "http://";
+  if (url.compare(0, sizeof(kScheme) - 1, kScheme) != 0) {
+    *err = "expected an http:// URL, got '" + url + "'";
+    return false;
+  }
+  string rest = url.substr(sizeof(kScheme) - 1);
+  size_t slash = rest.find('/');
+  string authority = rest.substr(0, slash);
+  path_ = slash == string::npos ? "" : rest.substr(slash);
+  while (!path_.empty() && path_[path_.size() - 1] == '/')
+    path_.resize(path_.size() - 1);
+
+  // An IPv6 address is in brackets, as in "http://[::1]:8080".
+  size_t colon = authority.rfind(':');
+  if (colon != string::npos && authority.find(']', colon) != string::npos)
+    colon = string::npos;
+  host_ = authority.substr(0, colon);
+  if (host_.size() > 1 && host_[0] == '[' && host_[host_.size() - 1] == ']')
+    host_ = host_.substr(1, host_.size() - 2);
+  port_ = 80;
+  if (colon != string::npos) {
+    string port = authority.substr(colon + 1);
+    char* end;
+    long value = strtol(port.c_str(), &end, 10);
+    if (port.empty() || *end != 0 || value <= 0 || value > 65535) {
+      *err = "invalid port in '" + url + "'";
+      return false;
+    }
+    port_ = (int)value;
+  }
+  if (host_.empty()) {
+    *err = "no host in '" + url + "'";
+    return false;
+  }
+  return true;
+}
+
+RemoteCache::Status RemoteCache::Get(const string& name, string* blob,
+                                     string* err) {
+  int status;
+  if (!Request("GET", name, "", &status, blob, err)) {
+    Failed(*err);
+    return OtherError;
+  }
+  if (status == 200) {
+    ++hits_;
+    return Okay;
+  }
+  if (status == 404) {
+    ++misses_;
+    return NotFound;
+  }
+  *err = "GET " + name + ": HTTP status " + to_string(status);
+  Failed(*err);
+  return OtherError;
+}
+
+bool RemoteCache::Put(const string& name, const string& blob, string* err) {
+  int status;
+  string response;
+  if (!Request("PUT", name, blob, &status, &response, err)) {
+    Failed(*err);
+    return false;
+  }
+  if (status < 200 || status > 299) {
+    *err = "PUT " + name + ": HTTP status " + to_string(status);
+    Failed(*err);
+    return false;
+  }
+  ++uploads_;
+  return true;
+}
+
+string RemoteCache::last_error() const {
+  lock_guard<mutex> lock(mutex_);
+  return last_error_;
+}
+
+void RemoteCache::Failed(const string& err) {
+  lock_guard<mutex> lock(mutex_);
+  ++errors_;
+  last_error_ = err;
+}
+
+#ifdef _WIN32
+bool RemoteCache::Request(const char* method, const string& name,
+                          const string& body, int* status, string* response,
+                          string* err) {
+  *err = "remote caches are not supported on Windows";
+  return false;
+}
+#endif
@@ -0,0 +1,85 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_REMOTE_CACHE_H_
+#define NINJA_REMOTE_CACHE_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "util.h"  // For int64_t.
+
+/// Support for "ninja --remote-cache": the entries of the action cache,
+/// shared between machines through an HTTP server that stores what is PUT
+/// to a URL and serves it back to GETs, such as nginx with WebDAV or
+/// bazel-remote.  Requests go out on whatever thread calls, one connection
+/// each.  Only implemented on POSIX systems.
+struct RemoteCache {
+  RemoteCache() : port_(80), hits_(0), misses_(0), errors_(0),
+                  uploads_(0) {}
+
+  /// Use the server at |url|, "http://host[:port][/path]".  Blobs live
+  /// under the path.
+  bool Init(const std::string& url, std::string* err);
+
+  enum Status {
+    Okay,
+    NotFound,
+    OtherError
+  };
+
+  /// Download blob |name| into |blob|.
+  Status Get(const std::string& name, std::string* blob, std::string* err);
+
+  /// Upload |blob| as blob |name|.
+  bool Put(const std::string& name, const std::string& blob,
+           std::string* err);
+
+  const std::string& host() const { return host_; }
+  int port() const { return port_; }
+  const std::string& path() const { return path_; }
+
+  /// What the requests came to so far.
+  int64_t hits() const { return hits_; }
+  int64_t misses() const { return misses_; }
+  int64_t errors() const { return errors_; }
+  int64_t uploads() const { return uploads_; }
+  /// The error of the last request that failed.
+  std::string last_error() const;
+
+ private:
+  /// Send a |method| request for blob |name| with |body|, and read back the
+  /// HTTP |status| and |response| body.
+  bool Request(const char* method, const std::string& name,
+               const std::string& body, int* status, std::string* response,
+               std::string* err);
+
+  /// Count a request failing with |err|.
+  void Failed(const std::string& err);
+
+  std::string host_;
+  int port_;
+  /// The path of the blobs, without a trailing slash.
+  std::string path_;
+
+  std::atomic<int64_t> hits_;
+  std::atomic<int64_t> misses_;
+  std::atomic<int64_t> errors_;
+  std::atomic<int64_t> uploads_;
+  mutable std::mutex mutex_;
+  std::string last_error_;
+};
+
+#endif  // NINJA_REMOTE_CACHE_H_
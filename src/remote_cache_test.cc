@@ -0,0 +1,248 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "remote_cache.h"
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+#include <thread>
+#endif
+
+#include "action_cache.h"
+#include "graph.h"
+#include "test.h"
+
+using namespace std;
+
+TEST(RemoteCacheTest, Init) {
+  RemoteCache remote;
+  string err;
+  EXPECT_TRUE(remote.Init("http://cache.example.com", &err));
+  EXPECT_EQ("cache.example.com", remote.host());
+  EXPECT_EQ(80, remote.port());
+  EXPECT_EQ("", remote.path());
+
+  EXPECT_TRUE(remote.Init("http://10.0.0.1:8080/ninja/cas/", &err));
+  EXPECT_EQ("10.0.0.1", remote.host());
+  EXPECT_EQ(8080, remote.port());
+  EXPECT_EQ("/ninja/cas", remote.path());
+
+  EXPECT_TRUE(remote.Init("http://[::1]:9090/", &err));
+  EXPECT_EQ("::1", remote.host());
+  EXPECT_EQ(9090, remote.port());
+
+  EXPECT_FALSE(remote.Init("https://cache.example.com", &err));
+  EXPECT_EQ("expected an http:// URL, got 'https://cache.example.com'", err);
+  EXPECT_FALSE(remote.Init("http://cache:http", &err));
+  EXPECT_EQ("invalid port in 'http://cache:http'", err);
+  EXPECT_FALSE(remote.Init("http:///path", &err));
+  EXPECT_EQ("no host in 'http:///path'", err);
+}
+
+#ifndef _WIN32
+
+namespace {
+
+/// Stores what is PUT to it, and serves it back, on 127.0.0.1.
+struct TestServer {
+  TestServer() : fd_(-1), port_(0), stopping_(false) {}
+  ~TestServer() { Stop(); }
+
+  bool Start() {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd_ < 0 || bind(fd_, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(fd_, 16) < 0 ||
+        getsockname(fd_, (sockaddr*)&addr, &len) < 0)
+      return false;
+    port_ = ntohs(addr.sin_port);
+    thread_ = thread(&TestServer::Serve, this);
+    return true;
+  }
+
+  void Stop() {
+    if (!thread_.joinable())
+      return;
+    // Wake the server up from accept().
+    stopping_ = true;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port_);
+    connect(fd, (sockaddr*)&addr, sizeof(addr));
+    close(fd);
+    thread_.join();
+    close(fd_);
+  }
+
+  void Serve() {
+    for (;;) {
+      int fd = accept(fd_, NULL, NULL);
+      if (fd < 0)
+        continue;
+      if (stopping_) {
+        close(fd);
+        return;
+      }
+      string request;
+      char buf[4096];
+      size_t end;
+      ssize_t len;
+      while ((end = request.find("\r\n\r\n")) == string::npos &&
+             (len = read(fd, buf, sizeof(buf))) > 0)
+        request.append(buf, len);
+      const char* length = strstr(request.c_str(), "Content-Length: ");
+      size_t size = length ? strtoul(length + 16, NULL, 10) : 0;
+      while (request.size() < end + 4 + size &&
+             (len = read(fd, buf, sizeof(buf))) > 0)
+        request.append(buf, len);
+
+      string path = request.substr(request.find(' ') + 1);
+      path.resize(path.find(' '));
+      string response;
+      if (request.compare(0, 4, "PUT ") == 0) {
+        blobs_[path] = request.substr(end + 4);
+        response = "HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n";
+      } else if (blobs_.count(path)) {
+        response = "HTTP/1.1 200 OK\r\nContent-Length: " +
+                   to_string(blobs_[path].size()) + "\r\n\r\n" +
+                   blobs_[path];
+      } else {
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+      }
+      if (write(fd, response.data(), response.size()) < 0) {}
+      close(fd);
+    }
+  }
+
+  int fd_;
+  int port_;
+  atomic<bool> stopping_;
+  thread thread_;
+  /// Only used by the server thread until Stop().
+  map<string, string> blobs_;
+};
+
+}  // namespace
+
+TEST(RemoteCacheTest, GetPut) {
+  TestServer server;
+  ASSERT_TRUE(server.Start());
+  RemoteCache remote;
+  string err;
+  ASSERT_TRUE(remote.Init("http://127.0.0.1:" + to_string(server.port_) +
+                              "/cas/",
+                          &err));
+
+  string blob;
+  EXPECT_EQ(RemoteCache::NotFound, remote.Get("abc", &blob, &err));
+  EXPECT_TRUE(remote.Put("abc", string("blob\0data", 9), &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(RemoteCache::Okay, remote.Get("abc", &blob, &err));
+  EXPECT_EQ(string("blob\0data", 9), blob);
+  EXPECT_EQ(1, remote.hits());
+  EXPECT_EQ(1, remote.misses());
+  EXPECT_EQ(1, remote.uploads());
+  EXPECT_EQ(0, remote.errors());
+
+  server.Stop();
+  EXPECT_EQ(1u, server.blobs_.size());
+  EXPECT_EQ(1u, server.blobs_.count("/cas/abc"));
+}
+
+namespace {
+
+struct RemoteActionCacheTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    temp_dir_.CreateAndEnter("RemoteActionCacheTest");
+    ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule link\n"
+"  command = link $in -o $out\n"
+"  cache = 1\n"
+"build out: link in.o\n"));
+    edge_ = GetNode("out")->in_edge();
+  }
+  virtual void TearDown() {
+    temp_dir_.Cleanup();
+  }
+
+  ScopedTempDir temp_dir_;
+  RealDiskInterface disk_;
+  Edge* edge_;
+};
+
+TEST_F(RemoteActionCacheTest, StoreFetch) {
+  TestServer server;
+  ASSERT_TRUE(server.Start());
+  RemoteCache remote;
+  string err;
+  ASSERT_TRUE(remote.Init("http://127.0.0.1:" + to_string(server.port_),
+                          &err));
+
+  disk_.WriteFile("in.o", "object");
+  disk_.WriteFile("out", "binary");
+  chmod("out", 0755);
+  ActionCache::Key key;
+  {
+    // Store() uploads the entry, and Trim() waits for it.
+    ActionCache cache("cache1", 1 << 20);
+    cache.set_remote(&remote);
+    ASSERT_TRUE(cache.ComputeKey(edge_, &disk_, NULL, &key, &err));
+    EXPECT_TRUE(cache.Store(edge_, key, vector<Node*>(), "linked", &disk_,
+                            NULL, &err));
+    cache.Trim();
+    EXPECT_EQ(1, remote.uploads());
+  }
+
+  // Another cache finds it there.
+  disk_.RemoveFile("out");
+  ActionCache cache("cache2", 1 << 20);
+  cache.set_remote(&remote);
+  vector<ActionCache::Dep> deps;
+  string output;
+  EXPECT_FALSE(cache.Restore(edge_, key, &disk_, NULL, &deps, &output));
+  EXPECT_TRUE(cache.Fetch(key));
+  EXPECT_TRUE(cache.Restore(edge_, key, &disk_, NULL, &deps, &output));
+  EXPECT_EQ("linked", output);
+  string contents;
+  EXPECT_EQ(DiskInterface::Okay, disk_.ReadFile("out", &contents, &err));
+  EXPECT_EQ("binary", contents);
+  struct stat st;
+  ASSERT_EQ(0, stat("out", &st));
+  EXPECT_EQ(0755, (int)(st.st_mode & 0777));
+
+  // A key it never stored misses.
+  key.hash ^= 1;
+  EXPECT_FALSE(cache.Fetch(key));
+  EXPECT_EQ(1, remote.hits());
+  EXPECT_EQ(1, remote.misses());
+}
+
+}  // namespace
+
+#endif  // !_WIN32
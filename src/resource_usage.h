@@ -0,0 +1,38 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_RESOURCE_USAGE_H_
+#define NINJA_RESOURCE_USAGE_H_
+
+#include <stdint.h>
+
+/// The resources a command used, as the system reports them once it
+/// exited.  What isn't known is 0.
+struct ResourceUsage {
+  ResourceUsage() : user_time(0), system_time(0), peak_rss(0) {}
+
+  /// CPU time spent running the command and in the kernel for it, in
+  /// milliseconds.
+  int32_t user_time;
+  int32_t system_time;
+  /// The largest resident set size of the command, in kilobytes.
+  int64_t peak_rss;
+
+  bool operator==(const ResourceUsage& o) const {
+    return user_time == o.user_time && system_time == o.system_time &&
+           peak_rss == o.peak_rss;
+  }
+};
+
+#endif  // NINJA_RESOURCE_USAGE_H_
@@ -0,0 +1,192 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests how many edges per second the scheduling of a build goes through:
+// Plan, Builder and BuildStatus, with commands that complete at once and a
+// disk that is never touched.
+
+#include <atomic>
+#include <deque>
+#include <new>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include "getopt.h"
+#elif defined(_AIX)
+#include "getopt.h"
+#include <unistd.h>
+#else
+#include <getopt.h>
+#include <unistd.h>
+#endif
+
+#include "build.h"
+#include "disk_interface.h"
+#include "graph.h"
+#include "manifest_parser.h"
+#include "metrics.h"
+#include "state.h"
+#include "util.h"
+
+using namespace std;
+
+/// The number of allocations made so far.
+static atomic<int64_t> g_allocations(0);
+
+void* operator new(size_t size) {
+  ++g_allocations;
+  if (void* p = malloc(size ? size : 1))
+    return p;
+  throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+namespace {
+
+/// Sources, under src/, exist; nothing else does.
+struct FakeDiskInterface : public DiskInterface {
+  virtual TimeStamp Stat(const string& path, string* err) const {
+    return path.compare(0, 4, "src/") == 0 ? 1 : 0;
+  }
+  virtual bool MakeDir(const string& path) { return true; }
+  virtual bool WriteFile(const string& path, const string& contents) {
+    return true;
+  }
+  virtual int RemoveFile(const string& path) { return 1; }
+  virtual Status ReadFile(const string& path, string* contents,
+                          string* err) {
+    return NotFound;
+  }
+};
+
+/// Completes every command at once.
+struct FakeCommandRunner : public CommandRunner {
+  explicit FakeCommandRunner(int parallelism) : parallelism_(parallelism) {}
+
+  virtual bool CanRunMore() const {
+    return (int)active_.size() < parallelism_;
+  }
+  virtual bool StartCommand(Edge* edge) {
+    active_.push_back(edge);
+    return true;
+  }
+  virtual bool WaitForCommand(Result* result,
+                              std::function<void()> update_func) {
+    if (active_.empty())
+      return false;
+    result->edge = active_.front();
+    result->status = ExitSuccess;
+    active_.pop_front();
+    return true;
+  }
+  virtual vector<Edge*> GetActiveEdges() {
+    return vector<Edge*>(active_.begin(), active_.end());
+  }
+  virtual void Abort() { active_.clear(); }
+
+  int parallelism_;
+  deque<Edge*> active_;
+};
+
+/// |objects| compiles, archived 100 at a time, linked into "out/all".
+string MakeManifest(int objects) {
+  string manifest =
+      "rule cc\n  command = cc -c $in -o $out\n"
+      "rule ar\n  command = ar rcs $out $in\n"
+      "rule link\n  command = link $in -o $out\n";
+  string link = "build out/all: link";
+  string archive;
+  char buf[100];
+  for (int i = 0; i < objects; ++i) {
+    if (i % 100 == 0) {
+      if (!archive.empty())
+        manifest += archive + "\n";
+      snprintf(buf, sizeof(buf), "out/lib_%d.a", i / 100);
+      archive = string("build ") + buf + ": ar";
+      link += string(" ") + buf;
+    }
+    snprintf(buf, sizeof(buf), "out/obj_%d.o", i);
+    manifest += string("build ") + buf + ": cc src/source_" +
+                to_string(i) + ".cc\n";
+    archive += string(" ") + buf;
+  }
+  return manifest + archive + "\n" + link + "\n";
+}
+
+}  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+  int objects = 1000000;
+  int parallelism = 64;
+  int opt;
+  while ((opt = getopt(argc, argv, const_cast<char*>("n:j:h"))) != -1) {
+    switch (opt) {
+    case 'n':
+      objects = atoi(optarg);
+      break;
+    case 'j':
+      parallelism = atoi(optarg);
+      break;
+    case 'h':
+    default:
+      printf("usage: scheduler_perftest [options]\n"
+"\n"
+"options:\n"
+"  -n N   build N objects [default=1000000]\n"
+"  -j N   run N commands at once [default=64]\n"
+             );
+      return 1;
+    }
+  }
+  if (objects < 1 || parallelism < 1)
+    Fatal("-n and -j must be at least 1");
+
+  State state;
+  FakeDiskInterface disk_interface;
+  string err;
+  {
+    ManifestParser parser(&state, &disk_interface);
+    if (!parser.ParseTest(MakeManifest(objects), &err))
+      Fatal("%s", err.c_str());
+  }
+
+  BuildConfig config;
+  config.verbosity = BuildConfig::QUIET;
+  config.parallelism = parallelism;
+  Builder builder(&state, config, NULL, NULL, &disk_interface);
+  builder.command_runner_.reset(new FakeCommandRunner(parallelism));
+  if (!builder.AddTarget(state.LookupNode("out/all"), &err))
+    Fatal("%s", err.c_str());
+
+  int64_t allocations = g_allocations;
+  int64_t start = GetTimeMicros();
+  if (!builder.Build(&err))
+    Fatal("%s", err.c_str());
+  int64_t delta = GetTimeMicros() - start;
+  allocations = g_allocations - allocations;
+
+  size_t edges = state.edges_.size();
+  printf("%zu edges in %.1fms: %.0f edges/s, %.1f allocations/edge\n", edges,
+         delta / 1e3, edges / (delta / 1e6), (double)allocations / edges);
+  return 0;
+}
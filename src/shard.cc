@@ -0,0 +1,160 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shard.h"
+
+#include <algorithm>
+#include <set>
+
+#include "build_log.h"
+#include "graph.h"
+#include "state.h"
+
+using namespace std;
+
+namespace {
+
+/// Walks the edges needed to build a target, once each.
+struct EdgeCollector {
+  EdgeCollector(size_t edge_count, bool dirty_only)
+      : visited_(edge_count, 0), stamp_(0), dirty_only_(dirty_only) {}
+
+  /// Fill |edges| with the edges needed to build |target|.
+  void Collect(Node* target, vector<Edge*>* edges) {
+    edges->clear();
+    ++stamp_;
+    Visit(target, edges);
+  }
+
+ private:
+  void Visit(Node* node, vector<Edge*>* edges) {
+    Edge* edge = node->in_edge();
+    if (!edge || visited_[edge->id_] == stamp_)
+      return;
+    visited_[edge->id_] = stamp_;
+    // Everything below an edge that is ready is up to date.
+    if (dirty_only_ && edge->outputs_ready())
+      return;
+    for (vector<Node*>::iterator in = edge->inputs_.begin();
+         in != edge->inputs_.end(); ++in)
+      Visit(*in, edges);
+    if (!edge->is_phony())
+      edges->push_back(edge);
+  }
+
+  /// The stamp of the walk that visited each edge last, by id.
+  vector<unsigned> visited_;
+  unsigned stamp_;
+  bool dirty_only_;
+};
+
+/// Add |node| to |roots|, or the inputs of its phony edge in its place.
+void AddRoot(Node* node, set<Node*>* seen, vector<Node*>* roots) {
+  if (!seen->insert(node).second)
+    return;
+  Edge* edge = node->in_edge();
+  if (!edge || !edge->is_phony() || edge->inputs_.empty()) {
+    roots->push_back(node);
+    return;
+  }
+  for (vector<Node*>::iterator in = edge->inputs_.begin();
+       in != edge->inputs_.end(); ++in)
+    AddRoot(*in, seen, roots);
+}
+
+}  // namespace
+
+void ShardTargets(State* state, BuildLog* build_log,
+                  const vector<Node*>& targets, int count,
+                  bool dirty_only, vector<Shard>* shards) {
+  shards->assign(count, Shard());
+
+  // What each edge is expected to take from its previous runs, by id;
+  // edges we have no timing information for are assumed to take as long as
+  // the average edge we do know about, as Plan::ComputeCriticalPath() does.
+  vector<int64_t> costs(state->edges_.size(), -1);
+  int64_t total_duration = 0;
+  int known_durations = 0;
+  for (vector<Edge*>::iterator e = state->edges_.begin();
+       e != state->edges_.end(); ++e) {
+    if ((*e)->is_phony() || (*e)->outputs_.empty() || !build_log)
+      continue;
+    BuildLog::LogEntry* entry =
+        build_log->LookupByOutput((*e)->outputs_[0]->path());
+    if (entry && entry->ExpectedDuration() >= 0) {
+      costs[(*e)->id_] = entry->ExpectedDuration();
+      total_duration += costs[(*e)->id_];
+      ++known_durations;
+    }
+  }
+  int64_t default_duration = 1;
+  if (known_durations && total_duration / known_durations > 1)
+    default_duration = total_duration / known_durations;
+  for (vector<int64_t>::iterator c = costs.begin(); c != costs.end(); ++c) {
+    if (*c < 0)
+      *c = default_duration;
+  }
+
+  vector<Node*> roots;
+  set<Node*> seen;
+  for (vector<Node*>::const_iterator t = targets.begin(); t != targets.end();
+       ++t)
+    AddRoot(*t, &seen, &roots);
+
+  // The most expensive targets go first, so that the cheap ones even the
+  // shards out at the end.
+  EdgeCollector collector(state->edges_.size(), dirty_only);
+  vector<Edge*> edges;
+  vector<pair<int64_t, size_t> > order;
+  for (size_t i = 0; i < roots.size(); ++i) {
+    collector.Collect(roots[i], &edges);
+    int64_t cost = 0;
+    for (vector<Edge*>::iterator e = edges.begin(); e != edges.end(); ++e)
+      cost += costs[(*e)->id_];
+    order.push_back(make_pair(-cost, i));
+  }
+  sort(order.begin(), order.end());
+
+  // The edges each shard builds already, by id, and those any does.
+  vector<vector<bool> > built(count, vector<bool>(state->edges_.size()));
+  vector<bool> built_anywhere(state->edges_.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    Node* target = roots[order[i].second];
+    collector.Collect(target, &edges);
+    int best = 0;
+    int64_t best_score = 0, best_cost = 0;
+    for (int s = 0; s < count; ++s) {
+      int64_t cost = (*shards)[s].cost, duplicated = 0;
+      for (vector<Edge*>::iterator e = edges.begin(); e != edges.end(); ++e) {
+        if (built[s][(*e)->id_])
+          continue;
+        cost += costs[(*e)->id_];
+        if (built_anywhere[(*e)->id_])
+          duplicated += costs[(*e)->id_];
+      }
+      if (s == 0 || cost + duplicated < best_score) {
+        best = s;
+        best_score = cost + duplicated;
+        best_cost = cost;
+      }
+    }
+    Shard* shard = &(*shards)[best];
+    shard->targets.push_back(target);
+    shard->cost = best_cost;
+    for (vector<Edge*>::iterator e = edges.begin(); e != edges.end(); ++e) {
+      built[best][(*e)->id_] = true;
+      built_anywhere[(*e)->id_] = true;
+    }
+  }
+}
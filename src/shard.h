@@ -0,0 +1,53 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_SHARD_H_
+#define NINJA_SHARD_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+struct BuildLog;
+struct Node;
+struct State;
+
+/// A part of the targets of a build, for one of several machines to build.
+struct Shard {
+  Shard() : cost(0) {}
+
+  std::vector<Node*> targets;
+  /// How long the commands needed to build |targets| are expected to take,
+  /// from their previous runs, in milliseconds, including those other
+  /// shards run too.
+  int64_t cost;
+};
+
+/// Split |targets| into |count| shards costing about the same.  The cost of
+/// an edge is how long it takes according to |build_log|, smoothed over its
+/// runs, or the average of those that it knows if it doesn't know that
+/// one.  An edge needed by the targets of several shards costs each of
+/// them.  Phony targets are split into their inputs.  If |dirty_only|, only
+/// the edges that aren't ready cost anything, which supposes that
+/// DependencyScan::RecomputeDirty() visited the targets.
+///
+/// The targets are taken by decreasing cost, each to the shard where its
+/// edges add the least, counting what they cost it plus, again, what they
+/// cost that other shards already pay for: duplicating work is only worth
+/// it to even out shards that are far apart.
+void ShardTargets(State* state, BuildLog* build_log,
+                  const std::vector<Node*>& targets, int count,
+                  bool dirty_only, std::vector<Shard>* shards);
+
+#endif  // NINJA_SHARD_H_
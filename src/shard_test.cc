@@ -0,0 +1,102 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shard.h"
+
+#include "build_log.h"
+#include "graph.h"
+#include "state.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+struct ShardTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build lib: cat lib.c\n"
+"build a: cat a.c lib\n"
+"build b: cat b.c lib\n"
+"build c: cat c.c\n"
+"build d: cat d.c\n"
+"build all: phony a b c d\n"));
+  }
+
+  /// Record that the edge building |output| took |duration| milliseconds.
+  void Took(const string& output, int duration) {
+    log_.RecordCommand(GetNode(output)->in_edge(), 0, duration);
+  }
+
+  BuildLog log_;
+};
+
+TEST_F(ShardTest, KeepsSharedWorkTogether) {
+  Took("lib", 100);
+  Took("a", 10);
+  Took("b", 10);
+  Took("c", 100);
+  Took("d", 5);
+
+  vector<Shard> shards;
+  ShardTargets(&state_, &log_, vector<Node*>(1, GetNode("all")), 2, false,
+               &shards);
+  ASSERT_EQ(2u, shards.size());
+  // Putting a and b apart would even the shards out, at the cost of
+  // building lib twice.
+  ASSERT_EQ(2u, shards[0].targets.size());
+  EXPECT_EQ("a", shards[0].targets[0]->path());
+  EXPECT_EQ("b", shards[0].targets[1]->path());
+  EXPECT_EQ(120, shards[0].cost);
+  ASSERT_EQ(2u, shards[1].targets.size());
+  EXPECT_EQ("c", shards[1].targets[0]->path());
+  EXPECT_EQ("d", shards[1].targets[1]->path());
+  EXPECT_EQ(105, shards[1].cost);
+}
+
+TEST_F(ShardTest, DuplicatesSharedWorkToBalance) {
+  Took("lib", 10);
+  Took("a", 100);
+  Took("b", 100);
+
+  // Unknown edges cost the average of the known ones.
+  vector<Shard> shards;
+  ShardTargets(&state_, &log_, vector<Node*>(1, GetNode("all")), 2, false,
+               &shards);
+  ASSERT_EQ(2u, shards.size());
+  EXPECT_EQ(110 + 70, shards[0].cost);
+  EXPECT_EQ(110 + 70, shards[1].cost);
+}
+
+TEST_F(ShardTest, DirtyOnly) {
+  Took("lib", 100);
+  Took("a", 10);
+  Took("b", 10);
+  Took("c", 100);
+  Took("d", 5);
+  // All but b is up to date.
+  for (vector<Edge*>::iterator e = state_.edges_.begin();
+       e != state_.edges_.end(); ++e)
+    (*e)->outputs_ready_ = (*e)->outputs_[0]->path() != "b";
+  GetNode("all")->in_edge()->outputs_ready_ = false;
+
+  vector<Shard> shards;
+  ShardTargets(&state_, &log_, vector<Node*>(1, GetNode("all")), 2, true,
+               &shards);
+  ASSERT_EQ(2u, shards.size());
+  EXPECT_EQ(10, shards[0].cost);
+  EXPECT_EQ(0, shards[1].cost);
+}
+
+}  // anonymous namespace
@@ -17,45 +17,113 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <algorithm>
+#include <new>
+#include <set>
+
 #include "edit_distance.h"
 #include "graph.h"
+#include "memory_stats.h"
 #include "metrics.h"
 #include "util.h"
 
 using namespace std;
 
+void Pool::AddResource(const string& name, int capacity) {
+  assert(LookupResource(name) < 0);
+  resources_.push_back(Resource(name, capacity));
+}
+
+int Pool::LookupResource(const string& name) const {
+  for (size_t i = 0; i < resources_.size(); ++i) {
+    if (resources_[i].name == name)
+      return (int)i;
+  }
+  return -1;
+}
+
 void Pool::EdgeScheduled(const Edge& edge) {
-  if (depth_ != 0)
-    current_use_ += edge.weight();
+  if (!ShouldDelayEdge())
+    return;
+  current_use_ += edge.weight();
+  for (size_t i = 0; i < edge.resource_use_.size(); ++i)
+    resources_[i].current_use += edge.resource_use_[i];
 }
 
 void Pool::EdgeFinished(const Edge& edge) {
-  if (depth_ != 0)
-    current_use_ -= edge.weight();
+  if (!ShouldDelayEdge())
+    return;
+  current_use_ -= edge.weight();
+  for (size_t i = 0; i < edge.resource_use_.size(); ++i)
+    resources_[i].current_use -= edge.resource_use_[i];
 }
 
 void Pool::DelayEdge(Edge* edge) {
-  assert(depth_ != 0);
-  delayed_.insert(edge);
+  assert(ShouldDelayEdge());
+  delayed_.push(edge);
 }
 
-void Pool::RetrieveReadyEdges(EdgeSet* ready_queue) {
-  DelayedEdges::iterator it = delayed_.begin();
-  while (it != delayed_.end()) {
-    Edge* edge = *it;
-    if (current_use_ + edge->weight() > depth_)
+bool Pool::CanSchedule(const Edge& edge) const {
+  bool idle = current_use_ == 0;
+  bool fits = depth_ == 0 || current_use_ + edge.weight() <= depth_;
+  for (size_t i = 0; i < edge.resource_use_.size(); ++i) {
+    const Resource& resource = resources_[i];
+    idle = idle && resource.current_use == 0;
+    if (resource.current_use + edge.resource_use_[i] > resource.capacity)
+      fits = false;
+  }
+  return fits || idle;
+}
+
+void Pool::RetrieveReadyEdges(EdgePriorityQueue* ready_queue) {
+  if (resources_.empty()) {
+    // The lightest edge of the highest priority is on top: none after the
+    // first one left out fits, or should run before it.
+    while (!delayed_.empty() && CanSchedule(*delayed_.top())) {
+      Edge* edge = delayed_.pop();
+      ready_queue->push(edge);
+      EdgeScheduled(*edge);
+    }
+    return;
+  }
+
+  // An edge left out for a resource doesn't keep lighter users of the
+  // other resources from running.
+  vector<Edge*> left_out;
+  while (!delayed_.empty()) {
+    Edge* edge = delayed_.top();
+    if (depth_ != 0 && current_use_ + edge->weight() > depth_ &&
+        current_use_ != 0)
       break;
-    ready_queue->insert(edge);
+    delayed_.pop();
+    if (!CanSchedule(*edge)) {
+      left_out.push_back(edge);
+      continue;
+    }
+    ready_queue->push(edge);
     EdgeScheduled(*edge);
-    ++it;
   }
-  delayed_.erase(delayed_.begin(), it);
+  for (vector<Edge*>::iterator e = left_out.begin(); e != left_out.end(); ++e)
+    delayed_.push(*e);
+}
+
+void Pool::ReorderDelayedEdges() {
+  vector<Edge*> delayed(delayed_.edges());
+  delayed_.clear();
+  for (vector<Edge*>::iterator e = delayed.begin(); e != delayed.end(); ++e)
+    delayed_.push(*e);
 }
 
 void Pool::Dump() const {
-  printf("%s (%d/%d) ->\n", name_.c_str(), current_use_, depth_);
-  for (DelayedEdges::const_iterator it = delayed_.begin();
-       it != delayed_.end(); ++it)
+  printf("%s (%d/%d)", name_.c_str(), current_use_, depth_);
+  for (vector<Resource>::const_iterator r = resources_.begin();
+       r != resources_.end(); ++r)
+    printf(" %s (%d/%d)", r->name.c_str(), r->current_use, r->capacity);
+  printf(" ->\n");
+  vector<Edge*> delayed(delayed_.edges());
+  sort(delayed.begin(), delayed.end(), WeightedEdgeCmp());
+  for (vector<Edge*>::const_iterator it = delayed.begin();
+       it != delayed.end(); ++it)
   {
     printf("\t");
     (*it)->Dump();
@@ -72,6 +140,13 @@ State::State() {
   AddPool(&kConsolePool);
 }
 
+State::~State() {
+  for (Paths::iterator i = paths_.begin(); i != paths_.end(); ++i)
+    i->second->~Node();
+  for (vector<Edge*>::iterator e = edges_.begin(); e != edges_.end(); ++e)
+    (*e)->~Edge();
+}
+
 void State::AddPool(Pool* pool) {
   assert(LookupPool(pool->name()) == NULL);
   pools_[pool->name()] = pool;
@@ -85,7 +160,7 @@ Pool* State::LookupPool(const string& pool_name) {
 }
 
 Edge* State::AddEdge(const Rule* rule) {
-  Edge* edge = new Edge();
+  Edge* edge = new (arena_.Allocate(sizeof(Edge), alignof(Edge))) Edge();
   edge->rule_ = rule;
   edge->pool_ = &State::kDefaultPool;
   edge->env_ = &bindings_;
@@ -94,15 +169,61 @@ Edge* State::AddEdge(const Rule* rule) {
   return edge;
 }
 
+void State::RemoveLastEdge() {
+  Edge* edge = edges_.back();
+  edges_.pop_back();
+  // Its memory stays in the arena, which is fine for this rare case.
+  edge->~Edge();
+}
+
+void State::RemoveEdges(const set<Edge*>& edges) {
+  if (edges.empty())
+    return;
+  size_t kept = 0;
+  for (vector<Edge*>::iterator e = edges_.begin(); e != edges_.end(); ++e) {
+    Edge* edge = *e;
+    if (edges.count(edge) == 0) {
+      // Keep the ids dense, as AddEdge() hands out the next one.
+      edge->id_ = kept;
+      edges_[kept++] = edge;
+      continue;
+    }
+    for (vector<Node*>::iterator i = edge->inputs_.begin();
+         i != edge->inputs_.end(); ++i)
+      (*i)->RemoveOutEdge(edge);
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o) {
+      if ((*o)->in_edge() == edge)
+        (*o)->set_in_edge(NULL);
+    }
+    edge->~Edge();
+  }
+  edges_.resize(kept);
+}
+
 Node* State::GetNode(StringPiece path, uint64_t slash_bits) {
   Node* node = LookupNode(path);
   if (node)
     return node;
-  node = new Node(path.AsString(), slash_bits);
+  node = new (arena_.Allocate(sizeof(Node), alignof(Node)))
+      Node(path.AsString(), slash_bits);
   paths_[node->path()] = node;
   return node;
 }
 
+Node* State::GetNode(StringPiece path, uint64_t slash_bits, size_t hash) {
+  Paths::iterator i = paths_.find(path, hash);
+  if (i != paths_.end())
+    return i->second;
+  // A wrong hash can only miss, and would add the path a second time.
+  if (hash != Paths::Hash(path))
+    return NULL;
+  Node* node = new (arena_.Allocate(sizeof(Node), alignof(Node)))
+      Node(path.AsString(), slash_bits);
+  paths_.insert(make_pair(StringPiece(node->path()), node), hash);
+  return node;
+}
+
 Node* State::LookupNode(StringPiece path) const {
   METRIC_RECORD("lookup node");
   Paths::const_iterator i = paths_.find(path);
@@ -112,14 +233,14 @@ Node* State::LookupNode(StringPiece path) const {
 }
 
 Node* State::SpellcheckNode(const string& path) {
-  const bool kAllowReplacements = true;
   const int kMaxValidEditDistance = 3;
 
+  EditDistanceMatcher matcher(path);
   int min_distance = kMaxValidEditDistance + 1;
   Node* result = NULL;
   for (Paths::iterator i = paths_.begin(); i != paths_.end(); ++i) {
-    int distance = EditDistance(
-        i->first, path, kAllowReplacements, kMaxValidEditDistance);
+    // Only a closer path can win, so give up on the others early.
+    int distance = matcher.Distance(i->first, min_distance - 1);
     if (distance < min_distance && i->second) {
       min_distance = distance;
       result = i->second;
@@ -185,6 +306,74 @@ void State::Reset() {
   }
 }
 
+void State::CountMemory(MemoryStats* stats) const {
+  int64_t path_bytes = 0;
+  int64_t out_edges = 0;
+  int64_t out_edges_bytes = 0;
+  for (Paths::const_iterator i = paths_.begin(); i != paths_.end(); ++i) {
+    Node* node = i->second;
+    path_bytes += MemoryStats::HeapBytes(node->path());
+    out_edges += node->out_edges().size();
+    out_edges_bytes += MemoryStats::HeapBytes(node->out_edges());
+  }
+  int64_t nodes = paths_.size();
+  stats->Add("Node", nodes, nodes * sizeof(Node));
+  stats->Add("Node paths", nodes, path_bytes);
+  stats->Add("Node out_edges_", out_edges, out_edges_bytes);
+  // An entry of the hash map: the pair and a link; a bucket: a link.
+  stats->Add("path -> Node map", nodes,
+             nodes * (sizeof(Paths::value_type) + sizeof(void*)) +
+                 paths_.bucket_count() * sizeof(void*));
+
+  int64_t inputs = 0;
+  int64_t inputs_bytes = 0;
+  int64_t outputs = 0;
+  int64_t outputs_bytes = 0;
+  set<const BindingEnv*> scopes;
+  scopes.insert(&bindings_);
+  for (vector<Edge*>::const_iterator i = edges_.begin(); i != edges_.end();
+       ++i) {
+    Edge* edge = *i;
+    inputs += edge->inputs_.size();
+    inputs_bytes += MemoryStats::HeapBytes(edge->inputs_);
+    outputs += edge->outputs_.size();
+    outputs_bytes += MemoryStats::HeapBytes(edge->outputs_) +
+                     MemoryStats::HeapBytes(edge->resource_use_);
+    for (const BindingEnv* env = edge->env_; env; env = env->parent()) {
+      if (!scopes.insert(env).second)
+        break;
+    }
+  }
+  int64_t edges = edges_.size();
+  stats->Add("Edge", edges, edges * sizeof(Edge));
+  stats->Add("Edge inputs_", inputs, inputs_bytes);
+  stats->Add("Edge outputs_", outputs, outputs_bytes);
+  stats->Add("State edges_", edges, MemoryStats::HeapBytes(edges_));
+  // The nodes and edges are carved from the arena, which keeps the rest of
+  // its last block.
+  stats->Add("arena slack", 1,
+             max((int64_t)0, (int64_t)arena_.capacity() -
+                                 nodes * (int64_t)sizeof(Node) -
+                                 edges * (int64_t)sizeof(Edge)));
+
+  int64_t scope_bytes = 0;
+  set<const Rule*> rules;
+  for (set<const BindingEnv*>::iterator i = scopes.begin(); i != scopes.end();
+       ++i) {
+    // The global scope is part of the State.
+    if (*i != &bindings_)
+      scope_bytes += sizeof(BindingEnv);
+    scope_bytes += (*i)->HeapBytes();
+    const map<string, const Rule*>& scope_rules = (*i)->GetRules();
+    for (map<string, const Rule*>::const_iterator r = scope_rules.begin();
+         r != scope_rules.end(); ++r)
+      rules.insert(r->second);
+  }
+  stats->Add("BindingEnv", scopes.size(), scope_bytes);
+  for (set<const Rule*>::iterator i = rules.begin(); i != rules.end(); ++i)
+    (*i)->CountMemory(stats);
+}
+
 void State::Dump() {
   for (Paths::iterator i = paths_.begin(); i != paths_.end(); ++i) {
     Node* node = i->second;
@@ -20,12 +20,14 @@
 #include <string>
 #include <vector>
 
+#include "arena.h"
 #include "eval_env.h"
 #include "graph.h"
 #include "hash_map.h"
 #include "util.h"
 
 struct Edge;
+struct MemoryStats;
 struct Node;
 struct Rule;
 
@@ -37,18 +39,53 @@ struct Rule;
 /// allowing the Plan to schedule it. The Pool will relinquish queued Edges when
 /// the total scheduled weight diminishes enough (i.e. when a scheduled edge
 /// completes).
+///
+/// A Pool may also have named resources, such as memory or cores, of which
+/// each edge asks for some amount.  Edges are then only scheduled while the
+/// amounts of every resource in use stay within the capacities.  An edge
+/// asking for more than the Pool has still runs, once the Pool is idle.
+///
+/// Delayed edges are scheduled highest critical path priority first, and
+/// then lightest first.
 struct Pool {
   Pool(const std::string& name, int depth)
-    : name_(name), current_use_(0), depth_(depth), delayed_() {}
+    : name_(name), current_use_(0), depth_(depth), priority_(0), delayed_() {}
+
+  struct Resource {
+    Resource(const std::string& name, int capacity)
+        : name(name), capacity(capacity), current_use(0) {}
+    std::string name;
+    int capacity;
+    int current_use;
+  };
 
   // A depth of 0 is infinite
   bool is_valid() const { return depth_ >= 0; }
   int depth() const { return depth_; }
   const std::string& name() const { return name_; }
   int current_use() const { return current_use_; }
+  /// The priority of the edges in the pool that don't set one.
+  int priority() const { return priority_; }
+  void set_priority(int priority) { priority_ = priority; }
+  const std::vector<Resource>& resources() const { return resources_; }
+  /// The CPUs the commands of the pool run on, or none for any.
+  const std::vector<int>& cpus() const { return cpus_; }
+  void set_cpus(const std::vector<int>& cpus) { cpus_ = cpus; }
+  /// The cgroup interface files set for each command of the pool, with
+  /// their values, e.g. ("memory.max", "4G"); see BuildConfig::cgroup.
+  typedef std::vector<std::pair<std::string, std::string> > CgroupSettings;
+  const CgroupSettings& cgroup() const { return cgroup_; }
+  void set_cgroup(const CgroupSettings& cgroup) { cgroup_ = cgroup; }
+
+  /// Add resource |name|, of which the scheduled edges use |capacity| at
+  /// most.
+  void AddResource(const std::string& name, int capacity);
+
+  /// Return the index of resource |name| in resources(), or -1.
+  int LookupResource(const std::string& name) const;
 
   /// true if the Pool might delay this edge
-  bool ShouldDelayEdge() const { return depth_ != 0; }
+  bool ShouldDelayEdge() const { return depth_ != 0 || !resources_.empty(); }
 
   /// informs this Pool that the given edge is committed to be run.
   /// Pool will count this edge as using resources from this pool.
@@ -62,29 +99,43 @@ struct Pool {
   void DelayEdge(Edge* edge);
 
   /// Pool will add zero or more edges to the ready_queue
-  void RetrieveReadyEdges(EdgeSet* ready_queue);
+  void RetrieveReadyEdges(EdgePriorityQueue* ready_queue);
+
+  /// Order the delayed edges again, after their critical path priorities
+  /// changed.
+  void ReorderDelayedEdges();
 
   /// Dump the Pool and its edges (useful for debugging).
   void Dump() const;
 
  private:
+  /// Return true if |edge| can be scheduled now without going over the
+  /// depth or the capacity of a resource.
+  bool CanSchedule(const Edge& edge) const;
+
   std::string name_;
 
   /// |current_use_| is the total of the weights of the edges which are
   /// currently scheduled in the Plan (i.e. the edges in Plan::ready_).
   int current_use_;
   int depth_;
+  int priority_;
+  std::vector<Resource> resources_;
+  std::vector<int> cpus_;
+  CgroupSettings cgroup_;
 
   struct WeightedEdgeCmp {
     bool operator()(const Edge* a, const Edge* b) const {
       if (!a) return b;
       if (!b) return false;
+      if (a->critical_path_priority() != b->critical_path_priority())
+        return a->critical_path_priority() > b->critical_path_priority();
       int weight_diff = a->weight() - b->weight();
       return ((weight_diff < 0) || (weight_diff == 0 && EdgeCmp()(a, b)));
     }
   };
 
-  typedef std::set<Edge*, WeightedEdgeCmp> DelayedEdges;
+  typedef EdgeHeap<WeightedEdgeCmp> DelayedEdges;
   DelayedEdges delayed_;
 };
 
@@ -95,13 +146,22 @@ struct State {
   static const Rule kPhonyRule;
 
   State();
+  ~State();
 
   void AddPool(Pool* pool);
   Pool* LookupPool(const std::string& pool_name);
 
   Edge* AddEdge(const Rule* rule);
+  /// Remove the edge last returned by AddEdge(), before any node refers
+  /// to it.
+  void RemoveLastEdge();
+  /// Remove |edges|, unlinking them from their nodes.  The nodes stay.
+  void RemoveEdges(const std::set<Edge*>& edges);
 
   Node* GetNode(StringPiece path, uint64_t slash_bits);
+  /// Like GetNode(), given Paths::Hash(path) as read from a file.
+  /// Returns NULL if |hash| is wrong.
+  Node* GetNode(StringPiece path, uint64_t slash_bits, size_t hash);
   Node* LookupNode(StringPiece path) const;
   Node* SpellcheckNode(const std::string& path);
 
@@ -116,6 +176,9 @@ struct State {
   /// Dump the nodes and Pools (useful for debugging).
   void Dump();
 
+  /// Count the nodes, edges, scopes and rules in |stats|.
+  void CountMemory(MemoryStats* stats) const;
+
   /// @return the root node(s) of the graph. (Root nodes have no output edges).
   /// @param error where to write the error message if somethings went wrong.
   std::vector<Node*> RootNodes(std::string* error) const;
@@ -133,6 +196,13 @@ struct State {
 
   BindingEnv bindings_;
   std::vector<Node*> defaults_;
+
+ private:
+  /// Holds the nodes and edges, which are freed with the State.
+  Arena arena_;
+
+  State(const State& other);          // DO NOT IMPLEMENT
+  void operator=(const State& other); // DO NOT IMPLEMENT
 };
 
 #endif  // NINJA_STATE_H_
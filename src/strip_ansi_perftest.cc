@@ -0,0 +1,112 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+
+#include "metrics.h"
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+/// The character by character version StripAnsiEscapeCodes() replaced,
+/// to compare with.
+string StripAnsiEscapeCodesScalar(const string& in) {
+  string stripped;
+  stripped.reserve(in.size());
+
+  for (size_t i = 0; i < in.size(); ++i) {
+    if (in[i] != '\33') {
+      stripped.push_back(in[i]);
+      continue;
+    }
+    if (i + 1 >= in.size()) break;
+    if (in[i + 1] != '[') continue;
+    i += 2;
+    while (i < in.size() && !islatinalpha(in[i]))
+      ++i;
+  }
+  return stripped;
+}
+
+/// Time stripping |testdata| over and over, printing the result as |name|.
+template <typename Func>
+void TimeStrip(const char* name, Func func, const string& testdata) {
+  size_t total_size = 0;
+  for (int limit = 1 << 4; limit < (1 << 20); limit *= 2) {
+    int64_t start = GetTimeMillis();
+    for (int rep = 0; rep < limit; ++rep)
+      total_size += func(testdata);
+    int64_t end = GetTimeMillis();
+
+    if (end - start > 1000) {
+      int delta_ms = (int)(end - start);
+      printf("%-24s strip %d times in %dms avg %.1fus\n",
+             name, limit, delta_ms, float(delta_ms * 1000) / limit);
+      break;
+    }
+  }
+  if (total_size == 0)
+    printf("(nothing)\n");  // Keep the work from being optimized away.
+}
+
+/// Strip with the fast version, reusing |*stripped| as the builder may.
+size_t StripFast(const string& in, string* stripped) {
+  return StripAnsiEscapeCodes(in, stripped).size();
+}
+
+size_t StripScalar(const string& in) {
+  return StripAnsiEscapeCodesScalar(in).size();
+}
+
+}  // anonymous namespace
+
+int main() {
+  // About a megabyte of clang warnings, with and without colors.
+  const char kPlain[] =
+      "../../src/foo/affixmgr.cxx:286:15: warning: using the result of an "
+      "assignment as a condition without parentheses [-Wparentheses]\n"
+      "  if (pHMgr = ptr) {\n"
+      "      ~~~~~~^~~~~\n";
+  const char kColored[] =
+      "\33[1m../../src/foo/affixmgr.cxx:286:15: \33[0m\33[0;1;35mwarning: "
+      "\33[0m\33[1musing the result of an assignment as a condition without "
+      "parentheses [-Wparentheses]\33[0m\n"
+      "  if (pHMgr = ptr) {\n"
+      "\33[0;1;32m      ~~~~~~^~~~~\n\33[0m";
+  string plain, colored;
+  while (plain.size() < (1 << 20)) {
+    plain += kPlain;
+    colored += kColored;
+  }
+
+  // Both versions must agree before comparing their speed.
+  string stripped;
+  if (StripAnsiEscapeCodes(colored, &stripped) !=
+          StripAnsiEscapeCodesScalar(colored) ||
+      stripped != plain || StripAnsiEscapeCodes(plain, &stripped) != plain) {
+    fprintf(stderr, "mismatch stripping escape codes\n");
+    return 1;
+  }
+
+  auto fast = [&stripped](const string& in) {
+    return StripFast(in, &stripped);
+  };
+  TimeStrip("plain fast", fast, plain);
+  TimeStrip("plain scalar", StripScalar, plain);
+  TimeStrip("colored fast", fast, colored);
+  TimeStrip("colored scalar", StripScalar, colored);
+  return 0;
+}
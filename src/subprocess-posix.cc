@@ -15,12 +15,16 @@
 #include "subprocess.h"
 
 #include <sys/select.h>
+#include <algorithm>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <spawn.h>
 
@@ -30,25 +34,184 @@
 #include <sys/select.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <stdint.h>
+#include <sys/epoll.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
 extern char** environ;
 
 #include "util.h"
 
 using namespace std;
 
-Subprocess::Subprocess(bool use_console) : fd_(-1), pid_(-1),
-                                           use_console_(use_console) {
+namespace {
+
+/// Characters that /bin/sh takes literally outside of quotes, anywhere in
+/// a word.  ('~' and '#' are only special at the start of a word, but are
+/// rare enough in commands to be left to the shell.)
+bool IsPlainChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || strchr("%+,-./:=@^_", c) != NULL;
+}
+
+/// Whether |word|, as the first word of a command, would not run the
+/// program of that name: reserved words, builtins and variable
+/// assignments.  Builtins may behave differently from the programs (dash's
+/// echo expands escapes, coreutils' doesn't), or have none, like cd.
+bool IsShellSyntax(const string& word) {
+  static const char* const kWords[] = {
+    // Reserved words and special builtins.
+    "!", ".", ":", "break", "case", "continue", "do", "done", "elif", "else",
+    "esac", "eval", "exec", "exit", "export", "fi", "for", "if", "in",
+    "readonly", "return", "set", "shift", "then", "time", "times", "trap",
+    "until", "unset", "while",
+    // Regular builtins, and those that shells commonly build in.
+    "[", "alias", "bg", "cd", "command", "echo", "false", "fc", "fg",
+    "getopts", "hash", "jobs", "kill", "local", "newgrp", "printf", "pwd",
+    "read", "test", "true", "type", "ulimit", "umask", "unalias", "wait",
+  };
+  for (size_t i = 0; i < sizeof(kWords) / sizeof(kWords[0]); ++i) {
+    if (word == kWords[i])
+      return true;
+  }
+  // NAME=value, where NAME is [A-Za-z_][A-Za-z0-9_]*.
+  size_t eq = word.find('=');
+  if (eq == string::npos || eq == 0 || (word[0] >= '0' && word[0] <= '9'))
+    return false;
+  for (size_t i = 0; i < eq; ++i) {
+    char c = word[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9') || c == '_'))
+      return false;
+  }
+  return true;
+}
+
+/// Open an anonymous file for a command to write its depfile to: in
+/// memory where the kernel has memfds, or else a temporary file already
+/// unlinked.  The descriptor is closed on exec.
+int OpenAnonymousFile() {
+#if defined(__linux__) && defined(SYS_memfd_create)
+  const unsigned kMemfdCloexec = 1;  // MFD_CLOEXEC
+  int memfd = syscall(SYS_memfd_create, "ninja-depfile", kMemfdCloexec);
+  if (memfd >= 0)
+    return memfd;
+#endif
+  FILE* file = tmpfile();
+  if (!file)
+    Fatal("tmpfile: %s", strerror(errno));
+  int fd = dup(fileno(file));
+  if (fd < 0)
+    Fatal("dup: %s", strerror(errno));
+  fclose(file);
+  SetCloseOnExec(fd);
+  return fd;
+}
+
+#ifdef __linux__
+/// Write |value| to the cgroup file |path|, leaving errno set on failure.
+bool WriteCgroupFile(const string& path, const string& value) {
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  ssize_t len = write(fd, value.data(), value.size());
+  int write_errno = errno;
+  close(fd);
+  errno = write_errno;
+  return len == static_cast<ssize_t>(value.size());
+}
+
+/// The number following |key| on a line of |stat|, a cgroup file of
+/// "key value" lines such as cpu.stat, or -1 if it has none.
+int64_t CgroupStat(const string& stat, const string& key) {
+  for (size_t pos = 0; pos < stat.size();) {
+    size_t end = stat.find('\n', pos);
+    if (end == string::npos)
+      end = stat.size();
+    if (stat.compare(pos, key.size(), key) == 0 &&
+        stat[pos + key.size()] == ' ')
+      return strtoll(stat.c_str() + pos + key.size() + 1, NULL, 10);
+    pos = end + 1;
+  }
+  return -1;
+}
+#endif
+
+}  // namespace
+
+bool SplitSimpleCommand(const string& command, vector<string>* args) {
+  args->clear();
+  const char* p = command.c_str();
+  for (;;) {
+    while (*p == ' ' || *p == '\t')
+      ++p;
+    if (*p == '\0')
+      break;
+    string word;
+    while (*p != '\0' && *p != ' ' && *p != '\t') {
+      if (*p == '\'') {
+        const char* end = strchr(p + 1, '\'');
+        if (!end)
+          return false;
+        word.append(p + 1, end - p - 1);
+        p = end + 1;
+      } else if (*p == '"') {
+        const char* end = p + 1;
+        while (*end != '\0' && *end != '"') {
+          // Expansions and escapes still apply within double quotes.
+          if (*end == '$' || *end == '`' || *end == '\\')
+            return false;
+          ++end;
+        }
+        if (*end == '\0')
+          return false;
+        word.append(p + 1, end - p - 1);
+        p = end + 1;
+      } else if (IsPlainChar(*p)) {
+        word.push_back(*p++);
+      } else {
+        return false;
+      }
+    }
+    args->push_back(word);
+  }
+  return !args->empty() && !args->front().empty() &&
+         !IsShellSyntax(args->front());
+}
+
+Subprocess::Subprocess(bool use_console, size_t output_limit)
+    : output_limit_(output_limit), overflow_(NULL), fd_(-1), pid_(-1),
+      depfile_(-1),
+#ifdef USE_EPOLL
+      pidfd_(-1),
+#endif
+      use_console_(use_console) {
 }
 
 Subprocess::~Subprocess() {
+  if (overflow_)
+    fclose(overflow_);
   if (fd_ >= 0)
     close(fd_);
+  if (depfile_ >= 0)
+    close(depfile_);
+#ifdef USE_EPOLL
+  if (pidfd_ >= 0)
+    close(pidfd_);
+#endif
   // Reap child if forgotten.
   if (pid_ != -1)
     Finish();
 }
 
-bool Subprocess::Start(SubprocessSet* set, const string& command) {
+bool Subprocess::Start(SubprocessSet* set, const string& command,
+                       int depfile_fd) {
   int output_pipe[2];
   if (pipe(output_pipe) < 0)
     Fatal("pipe: %s", strerror(errno));
@@ -108,6 +271,21 @@ bool Subprocess::Start(SubprocessSet* set, const string& command) {
       Fatal("posix_spawn_file_actions_addclose: %s", strerror(err));
     // In the console case, output_pipe is still inherited by the child and
     // closed when the subprocess finishes, which then notifies ninja.
+
+    if (depfile_fd >= 0) {
+      depfile_ = OpenAnonymousFile();
+      if (depfile_ == depfile_fd) {
+        // dup2() onto itself would leave it closed on exec.
+        int fd = fcntl(depfile_, F_DUPFD_CLOEXEC, depfile_fd + 1);
+        if (fd < 0)
+          Fatal("fcntl: %s", strerror(errno));
+        close(depfile_);
+        depfile_ = fd;
+      }
+      err = posix_spawn_file_actions_adddup2(&action, depfile_, depfile_fd);
+      if (err != 0)
+        Fatal("posix_spawn_file_actions_adddup2: %s", strerror(err));
+    }
   }
 #ifdef POSIX_SPAWN_USEVFORK
   flags |= POSIX_SPAWN_USEVFORK;
@@ -117,11 +295,69 @@ bool Subprocess::Start(SubprocessSet* set, const string& command) {
   if (err != 0)
     Fatal("posix_spawnattr_setflags: %s", strerror(err));
 
-  const char* spawned_args[] = { "/bin/sh", "-c", command.c_str(), NULL };
-  err = posix_spawn(&pid_, "/bin/sh", &action, &attr,
-        const_cast<char**>(spawned_args), environ);
-  if (err != 0)
-    Fatal("posix_spawn: %s", strerror(err));
+#ifdef __linux__
+  if (!set->cgroup_.empty())
+    cgroup_ = set->MakeCgroup();
+
+  // The child inherits the affinity of the thread spawning it, so pin this
+  // one meanwhile: the child then never runs elsewhere, unlike with
+  // sched_setaffinity() on the child once it runs.
+  cpu_set_t old_cpus;
+  bool pinned = false;
+  if (!set->cpus_.empty() &&
+      sched_getaffinity(0, sizeof(old_cpus), &old_cpus) == 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (vector<int>::const_iterator i = set->cpus_.begin();
+         i != set->cpus_.end(); ++i) {
+      if (*i >= 0 && *i < CPU_SETSIZE)
+        CPU_SET(*i, &cpus);
+    }
+    pinned = sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+  }
+#endif
+
+  err = -1;
+  vector<string> args;
+  bool direct = set->direct_spawn_ && SplitSimpleCommand(command, &args);
+#ifdef __linux__
+  if (!cgroup_.empty()) {
+    // posix_spawn() can't start the child in a cgroup, so the child is a
+    // shell moving itself to the cgroup of the command before running it,
+    // which then has no process outside the cgroup.
+    static const char kMoveThenExec[] =
+        "{ echo $$ >\"$0\"; } 2>/dev/null; exec \"$@\"";
+    static const char kMoveThenEval[] =
+        "{ echo $$ >\"$0\"; } 2>/dev/null; eval \"$1\"";
+    if (!direct)
+      args.assign(1, command);
+    args.insert(args.begin(), cgroup_ + "/cgroup.procs");
+    args.insert(args.begin(), direct ? kMoveThenExec : kMoveThenEval);
+    args.insert(args.begin(), "-c");
+    args.insert(args.begin(), "/bin/sh");
+    direct = true;
+  }
+#endif
+  if (direct) {
+    vector<char*> argv;
+    for (vector<string>::iterator i = args.begin(); i != args.end(); ++i)
+      argv.push_back(const_cast<char*>(i->c_str()));
+    argv.push_back(NULL);
+    err = posix_spawnp(&pid_, argv[0], &action, &attr, &argv[0], environ);
+    // If the program can't be run, let the shell report it the usual way.
+  }
+  if (err != 0) {
+    const char* spawned_args[] = { "/bin/sh", "-c", command.c_str(), NULL };
+    err = posix_spawn(&pid_, "/bin/sh", &action, &attr,
+          const_cast<char**>(spawned_args), environ);
+    if (err != 0)
+      Fatal("posix_spawn: %s", strerror(err));
+  }
+
+#ifdef __linux__
+  if (pinned && sched_setaffinity(0, sizeof(old_cpus), &old_cpus) < 0)
+    Fatal("sched_setaffinity: %s", strerror(errno));
+#endif
 
   err = posix_spawnattr_destroy(&attr);
   if (err != 0)
@@ -131,29 +367,87 @@ bool Subprocess::Start(SubprocessSet* set, const string& command) {
     Fatal("posix_spawn_file_actions_destroy: %s", strerror(err));
 
   close(output_pipe[1]);
+
+#ifdef USE_EPOLL
+  if (set->epoll_fd_ >= 0) {
+    // The output is drained on each wakeup, and once more when the child
+    // exits, so reads must not block.
+    if (fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK) < 0)
+      Fatal("fcntl: %s", strerror(errno));
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = reinterpret_cast<uintptr_t>(this);
+    if (epoll_ctl(set->epoll_fd_, EPOLL_CTL_ADD, fd_, &event) < 0)
+      Fatal("epoll_ctl: %s", strerror(errno));
+
+#ifdef SYS_pidfd_open
+    // Knowing when the child exits means not waiting for the end of the
+    // output, which processes it left in the background may hold open.
+    pidfd_ = syscall(SYS_pidfd_open, pid_, 0);
+    if (pidfd_ >= 0) {
+      SetCloseOnExec(pidfd_);
+      // Tell the pidfd from the pipe by the low bit of the pointer.
+      event.data.u64 = reinterpret_cast<uintptr_t>(this) | 1;
+      if (epoll_ctl(set->epoll_fd_, EPOLL_CTL_ADD, pidfd_, &event) < 0)
+        Fatal("epoll_ctl: %s", strerror(errno));
+    }
+#endif
+  }
+#endif  // USE_EPOLL
   return true;
 }
 
 void Subprocess::OnPipeReady() {
-  char buf[4 << 10];
+  char buf[64 << 10];
   ssize_t len = read(fd_, buf, sizeof(buf));
   if (len > 0) {
-    buf_.append(buf, len);
+    AppendOutput(buf, len);
   } else {
-    if (len < 0)
+    if (len < 0) {
+      if (errno == EAGAIN || errno == EINTR)
+        return;
       Fatal("read: %s", strerror(errno));
+    }
     close(fd_);
     fd_ = -1;
   }
 }
 
+#ifdef USE_EPOLL
+void Subprocess::OnExited() {
+  char buf[64 << 10];
+  ssize_t len;
+  while ((len = read(fd_, buf, sizeof(buf))) > 0)
+    AppendOutput(buf, len);
+  if (len < 0 && errno != EAGAIN && errno != EINTR)
+    Fatal("read: %s", strerror(errno));
+  close(fd_);
+  fd_ = -1;
+}
+#endif
+
 ExitStatus Subprocess::Finish() {
   assert(pid_ != -1);
   int status;
-  if (waitpid(pid_, &status, 0) < 0)
-    Fatal("waitpid(%d): %s", pid_, strerror(errno));
+  struct rusage usage;
+  memset(&usage, 0, sizeof(usage));
+  if (wait4(pid_, &status, 0, &usage) < 0)
+    Fatal("wait4(%d): %s", pid_, strerror(errno));
   pid_ = -1;
 
+  usage_.user_time = (int32_t)(usage.ru_utime.tv_sec * 1000 +
+                               usage.ru_utime.tv_usec / 1000);
+  usage_.system_time = (int32_t)(usage.ru_stime.tv_sec * 1000 +
+                                 usage.ru_stime.tv_usec / 1000);
+#ifdef __APPLE__
+  // macOS counts in bytes.
+  usage_.peak_rss = usage.ru_maxrss >> 10;
+#else
+  usage_.peak_rss = usage.ru_maxrss;
+#endif
+  if (!cgroup_.empty())
+    FinishCgroup();
+
 #ifdef _AIX
   if (WIFEXITED(status) && WEXITSTATUS(status) & 0x80) {
     // Map the shell's exit code used for signal failure (128 + signal) to the
@@ -176,14 +470,94 @@ ExitStatus Subprocess::Finish() {
   return ExitFailure;
 }
 
+void Subprocess::FinishCgroup() {
+#ifdef __linux__
+  // Unlike wait4(), the cgroup also counts the processes the command left
+  // running, and the memory of all of them at once.  Nothing counted
+  // means the command never made it to the cgroup.
+  string contents, err;
+  if (ReadFile(cgroup_ + "/cpu.stat", &contents, &err) == 0 &&
+      CgroupStat(contents, "usage_usec") > 0) {
+    usage_.user_time = (int32_t)(CgroupStat(contents, "user_usec") / 1000);
+    usage_.system_time =
+        (int32_t)(CgroupStat(contents, "system_usec") / 1000);
+    contents.clear();
+    if (ReadFile(cgroup_ + "/memory.peak", &contents, &err) == 0 &&
+        !contents.empty())
+      usage_.peak_rss = strtoll(contents.c_str(), NULL, 10) >> 10;
+  }
+  // Processes left running keep their cgroup, which shows them.
+  rmdir(cgroup_.c_str());
+#endif
+  cgroup_.clear();
+}
+
+void Subprocess::TakeDepfile(string* depfile) {
+  depfile->clear();
+  if (depfile_ < 0)
+    return;
+  // The command may have written through a descriptor of its own, at an
+  // offset of its own.
+  char buf[64 << 10];
+  ssize_t len;
+  while ((len = pread(depfile_, buf, sizeof(buf), depfile->size())) != 0) {
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      Fatal("reading depfile: %s", strerror(errno));
+    }
+    depfile->append(buf, len);
+  }
+  close(depfile_);
+  depfile_ = -1;
+}
+
 bool Subprocess::Done() const {
   return fd_ == -1;
 }
 
+void Subprocess::AppendOutput(const char* data, size_t len) {
+  if (output_limit_ && buf_.size() + len > output_limit_) {
+    size_t room = output_limit_ - buf_.size();
+    buf_.append(data, room);
+    data += room;
+    len -= room;
+    if (!overflow_ && !(overflow_ = tmpfile())) {
+      // Keep it all in memory then.
+      Warning("spilling output: %s", strerror(errno));
+      output_limit_ = 0;
+    } else if (fwrite(data, 1, len, overflow_) != len) {
+      Fatal("spilling output: %s", strerror(errno));
+    }
+  }
+  if (!output_limit_ || buf_.size() + len <= output_limit_)
+    buf_.append(data, len);
+}
+
 const string& Subprocess::GetOutput() const {
   return buf_;
 }
 
+void Subprocess::TakeOutput(string* output, shared_ptr<FILE>* overflow) {
+  output->swap(buf_);
+  buf_.clear();
+  if (overflow_) {
+    rewind(overflow_);
+    overflow->reset(overflow_, fclose);
+    overflow_ = NULL;
+  }
+}
+
+bool Subprocess::TakeLines(string* lines) {
+  // Once some output is in overflow_, buf_ holds what comes before it.
+  size_t end = buf_.rfind('\n');
+  if (overflow_ || end == string::npos)
+    return false;
+  lines->assign(buf_, 0, end + 1);
+  buf_.erase(0, end + 1);
+  return true;
+}
+
 int SubprocessSet::interrupted_;
 
 void SubprocessSet::SetInterruptedFlag(int signum) {
@@ -205,12 +579,17 @@ void SubprocessSet::HandlePendingInterruption() {
     interrupted_ = SIGHUP;
 }
 
-SubprocessSet::SubprocessSet() {
+SubprocessSet::SubprocessSet()
+    : direct_spawn_(false), output_limit_(0), cgroups_made_(0),
+      cgroup_warned_(false) {
   sigset_t set;
   sigemptyset(&set);
   sigaddset(&set, SIGINT);
   sigaddset(&set, SIGTERM);
   sigaddset(&set, SIGHUP);
+  // Resizes of the terminal are taken only while waiting, too, rather
+  // than interrupting whatever runs.
+  sigaddset(&set, SIGWINCH);
   if (sigprocmask(SIG_BLOCK, &set, &old_mask_) < 0)
     Fatal("sigprocmask: %s", strerror(errno));
 
@@ -223,6 +602,27 @@ SubprocessSet::SubprocessSet() {
     Fatal("sigaction: %s", strerror(errno));
   if (sigaction(SIGHUP, &act, &old_hup_act_) < 0)
     Fatal("sigaction: %s", strerror(errno));
+
+  if (pipe(wake_pipe_) < 0)
+    Fatal("pipe: %s", strerror(errno));
+  for (int i = 0; i < 2; ++i) {
+    SetCloseOnExec(wake_pipe_[i]);
+    if (fcntl(wake_pipe_[i], F_SETFL,
+              fcntl(wake_pipe_[i], F_GETFL) | O_NONBLOCK) < 0)
+      Fatal("fcntl: %s", strerror(errno));
+  }
+
+#ifdef USE_EPOLL
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ >= 0) {
+    // Subprocesses are never at address 0.
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = 0;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_pipe_[0], &event) < 0)
+      Fatal("epoll_ctl: %s", strerror(errno));
+  }
+#endif
 }
 
 SubprocessSet::~SubprocessSet() {
@@ -236,11 +636,18 @@ SubprocessSet::~SubprocessSet() {
     Fatal("sigaction: %s", strerror(errno));
   if (sigprocmask(SIG_SETMASK, &old_mask_, 0) < 0)
     Fatal("sigprocmask: %s", strerror(errno));
+  close(wake_pipe_[0]);
+  close(wake_pipe_[1]);
+#ifdef USE_EPOLL
+  if (epoll_fd_ >= 0)
+    close(epoll_fd_);
+#endif
 }
 
-Subprocess *SubprocessSet::Add(const string& command, bool use_console) {
-  Subprocess *subprocess = new Subprocess(use_console);
-  if (!subprocess->Start(this, command)) {
+Subprocess *SubprocessSet::Add(const string& command, bool use_console,
+                               int depfile_fd) {
+  Subprocess *subprocess = new Subprocess(use_console, output_limit_);
+  if (!subprocess->Start(this, command, depfile_fd)) {
     delete subprocess;
     return 0;
   }
@@ -248,10 +655,76 @@ Subprocess *SubprocessSet::Add(const string& command, bool use_console) {
   return subprocess;
 }
 
+string SubprocessSet::MakeCgroup() {
+#ifdef __linux__
+  // The controllers of the settings must be enabled for the cgroups made,
+  // and the memory controller measures their peak too.  The "cgroup."
+  // files are those of every cgroup.
+  vector<string> controllers(1, "memory");
+  for (size_t i = 0; i < cgroup_settings_.size(); ++i) {
+    const string& file = cgroup_settings_[i].first;
+    string controller = file.substr(0, file.find('.'));
+    if (controller != "cgroup" &&
+        find(controllers.begin(), controllers.end(), controller) ==
+            controllers.end())
+      controllers.push_back(controller);
+  }
+  for (size_t i = 0; i < controllers.size(); ++i) {
+    string enabled = cgroup_ + "/+" + controllers[i];
+    if (find(cgroup_controllers_.begin(), cgroup_controllers_.end(),
+             enabled) != cgroup_controllers_.end())
+      continue;
+    cgroup_controllers_.push_back(enabled);
+    // A controller that can't be enabled fails the settings using it.
+    WriteCgroupFile(cgroup_ + "/cgroup.subtree_control",
+                    "+" + controllers[i]);
+  }
+
+  string err;
+  string path = cgroup_ + "/ninja-" + to_string(getpid()) + "-" +
+                to_string(++cgroups_made_);
+  if (mkdir(path.c_str(), 0755) < 0) {
+    err = "creating " + path + ": " + strerror(errno);
+    path.clear();
+  }
+  for (size_t i = 0; !path.empty() && i < cgroup_settings_.size(); ++i) {
+    const string& file = cgroup_settings_[i].first;
+    if (!WriteCgroupFile(path + "/" + file, cgroup_settings_[i].second)) {
+      err = "setting " + file + " to '" + cgroup_settings_[i].second +
+            "': " + strerror(errno);
+    }
+  }
+  if (!err.empty() && !cgroup_warned_) {
+    Warning("%s", err.c_str());
+    cgroup_warned_ = true;
+  }
+  return path;
+#else
+  return "";
+#endif
+}
+
+void SubprocessSet::Wake() {
+  char c = 0;
+  // EAGAIN means the pipe is full of wakeups already.
+  while (write(wake_pipe_[1], &c, 1) < 0 && errno == EINTR) {}
+}
+
+void SubprocessSet::DrainWakePipe() {
+  char buf[64];
+  while (read(wake_pipe_[0], buf, sizeof(buf)) > 0) {}
+}
+
 #ifdef USE_PPOLL
 bool SubprocessSet::DoWork() {
+#ifdef USE_EPOLL
+  if (epoll_fd_ >= 0)
+    return DoWorkEpoll();
+#endif
   vector<pollfd> fds;
-  nfds_t nfds = 0;
+  pollfd wake_pfd = { wake_pipe_[0], POLLIN, 0 };
+  fds.push_back(wake_pfd);
+  nfds_t nfds = 1;
 
   for (vector<Subprocess*>::iterator i = running_.begin();
        i != running_.end(); ++i) {
@@ -280,7 +753,10 @@ bool SubprocessSet::DoWork() {
   if (IsInterrupted())
     return true;
 
-  nfds_t cur_nfd = 0;
+  if (fds[0].revents)
+    DrainWakePipe();
+
+  nfds_t cur_nfd = 1;
   for (vector<Subprocess*>::iterator i = running_.begin();
        i != running_.end(); ) {
     int fd = (*i)->fd_;
@@ -303,9 +779,14 @@ bool SubprocessSet::DoWork() {
 
 #else  // !defined(USE_PPOLL)
 bool SubprocessSet::DoWork() {
+#ifdef USE_EPOLL
+  if (epoll_fd_ >= 0)
+    return DoWorkEpoll();
+#endif
   fd_set set;
-  int nfds = 0;
   FD_ZERO(&set);
+  FD_SET(wake_pipe_[0], &set);
+  int nfds = wake_pipe_[0] + 1;
 
   for (vector<Subprocess*>::iterator i = running_.begin();
        i != running_.end(); ++i) {
@@ -334,6 +815,9 @@ bool SubprocessSet::DoWork() {
   if (IsInterrupted())
     return true;
 
+  if (FD_ISSET(wake_pipe_[0], &set))
+    DrainWakePipe();
+
   for (vector<Subprocess*>::iterator i = running_.begin();
        i != running_.end(); ) {
     int fd = (*i)->fd_;
@@ -352,6 +836,54 @@ bool SubprocessSet::DoWork() {
 }
 #endif  // !defined(USE_PPOLL)
 
+#ifdef USE_EPOLL
+bool SubprocessSet::DoWorkEpoll() {
+  epoll_event events[64];
+  interrupted_ = 0;
+  int ret = epoll_pwait(epoll_fd_, events, sizeof(events) / sizeof(events[0]),
+                        500, &old_mask_);
+  if (ret == -1) {
+    if (errno != EINTR) {
+      perror("ninja: epoll_pwait");
+      return false;
+    }
+    return IsInterrupted();
+  }
+
+  HandlePendingInterruption();
+  if (IsInterrupted())
+    return true;
+
+  for (int i = 0; i < ret; ++i) {
+    uintptr_t data = static_cast<uintptr_t>(events[i].data.u64);
+    if (data == 0) {
+      DrainWakePipe();
+      continue;
+    }
+    Subprocess* subproc = reinterpret_cast<Subprocess*>(data & ~uintptr_t(1));
+    if (subproc->Done())
+      continue;  // Both its descriptors were ready.
+    if (data & 1) {
+      subproc->OnExited();
+      close(subproc->pidfd_);
+      subproc->pidfd_ = -1;
+    } else {
+      subproc->OnPipeReady();
+      if (subproc->Done() && subproc->pidfd_ >= 0) {
+        close(subproc->pidfd_);
+        subproc->pidfd_ = -1;
+      }
+    }
+    if (subproc->Done()) {
+      finished_.push(subproc);
+      running_.erase(find(running_.begin(), running_.end(), subproc));
+    }
+  }
+
+  return IsInterrupted();
+}
+#endif  // USE_EPOLL
+
 Subprocess* SubprocessSet::NextFinished() {
   if (finished_.empty())
     return NULL;
@@ -15,7 +15,9 @@
 #include "subprocess.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <algorithm>
 
@@ -23,12 +25,25 @@
 
 using namespace std;
 
-Subprocess::Subprocess(bool use_console) : child_(NULL) , overlapped_(),
-                                           is_reading_(false),
-                                           use_console_(use_console) {
+namespace {
+
+/// The size of the buffer of the pipes the commands write their output
+/// to, so that they rarely wait for ninja to read it.
+const DWORD kPipeBufferSize = 64 << 10;
+
+/// The most completions SubprocessSet::DoWork() takes at once.
+const ULONG kMaxCompletions = 64;
+
+}  // anonymous namespace
+
+Subprocess::Subprocess(bool use_console, size_t output_limit)
+    : output_limit_(output_limit), overflow_(NULL), child_(NULL),
+      overlapped_(), is_reading_(false), use_console_(use_console) {
 }
 
 Subprocess::~Subprocess() {
+  if (overflow_)
+    fclose(overflow_);
   if (pipe_) {
     if (!CloseHandle(pipe_))
       Win32Fatal("CloseHandle");
@@ -47,7 +62,8 @@ HANDLE Subprocess::SetupPipe(HANDLE ioport) {
                              PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED,
                              PIPE_TYPE_BYTE,
                              PIPE_UNLIMITED_INSTANCES,
-                             0, 0, INFINITE, NULL);
+                             kPipeBufferSize, kPipeBufferSize, INFINITE,
+                             NULL);
   if (pipe_ == INVALID_HANDLE_VALUE)
     Win32Fatal("CreateNamedPipe");
 
@@ -74,7 +90,8 @@ HANDLE Subprocess::SetupPipe(HANDLE ioport) {
   return output_write_child;
 }
 
-bool Subprocess::Start(SubprocessSet* set, const string& command) {
+bool Subprocess::Start(SubprocessSet* set, const string& command,
+                       int /*depfile_fd*/) {
   HANDLE child_pipe = SetupPipe(set->ioport_);
 
   SECURITY_ATTRIBUTES security_attributes;
@@ -166,7 +183,7 @@ void Subprocess::OnPipeReady() {
   }
 
   if (is_reading_ && bytes)
-    buf_.append(overlapped_buf_, bytes);
+    AppendOutput(overlapped_buf_, bytes);
 
   memset(&overlapped_, 0, sizeof(overlapped_));
   is_reading_ = true;
@@ -195,6 +212,18 @@ ExitStatus Subprocess::Finish() {
   DWORD exit_code = 0;
   GetExitCodeProcess(child_, &exit_code);
 
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (GetProcessTimes(child_, &creation_time, &exit_time, &kernel_time,
+                      &user_time)) {
+    // In units of 100ns.
+    usage_.user_time = (int32_t)(
+        ((uint64_t)user_time.dwHighDateTime << 32 | user_time.dwLowDateTime) /
+        10000);
+    usage_.system_time = (int32_t)(
+        ((uint64_t)kernel_time.dwHighDateTime << 32 |
+         kernel_time.dwLowDateTime) / 10000);
+  }
+
   CloseHandle(child_);
   child_ = NULL;
 
@@ -207,13 +236,56 @@ bool Subprocess::Done() const {
   return pipe_ == NULL;
 }
 
+void Subprocess::AppendOutput(const char* data, size_t len) {
+  if (output_limit_ && buf_.size() + len > output_limit_) {
+    size_t room = output_limit_ - buf_.size();
+    buf_.append(data, room);
+    data += room;
+    len -= room;
+    if (!overflow_ && !(overflow_ = tmpfile())) {
+      // Keep it all in memory then.
+      Warning("spilling output: %s", strerror(errno));
+      output_limit_ = 0;
+    } else if (fwrite(data, 1, len, overflow_) != len) {
+      Fatal("spilling output: %s", strerror(errno));
+    }
+  }
+  if (!output_limit_ || buf_.size() + len <= output_limit_)
+    buf_.append(data, len);
+}
+
 const string& Subprocess::GetOutput() const {
   return buf_;
 }
 
+void Subprocess::TakeOutput(string* output, shared_ptr<FILE>* overflow) {
+  output->swap(buf_);
+  buf_.clear();
+  if (overflow_) {
+    rewind(overflow_);
+    overflow->reset(overflow_, fclose);
+    overflow_ = NULL;
+  }
+}
+
+void Subprocess::TakeDepfile(string* depfile) {
+  depfile->clear();
+}
+
+bool Subprocess::TakeLines(string* lines) {
+  // Once some output is in overflow_, buf_ holds what comes before it.
+  size_t end = buf_.rfind('\n');
+  if (overflow_ || end == string::npos)
+    return false;
+  lines->assign(buf_, 0, end + 1);
+  buf_.erase(0, end + 1);
+  return true;
+}
+
 HANDLE SubprocessSet::ioport_;
+char SubprocessSet::wake_key_;
 
-SubprocessSet::SubprocessSet() {
+SubprocessSet::SubprocessSet() : direct_spawn_(false), output_limit_(0) {
   ioport_ = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
   if (!ioport_)
     Win32Fatal("CreateIoCompletionPort");
@@ -238,9 +310,15 @@ BOOL WINAPI SubprocessSet::NotifyInterrupted(DWORD dwCtrlType) {
   return FALSE;
 }
 
-Subprocess *SubprocessSet::Add(const string& command, bool use_console) {
-  Subprocess *subprocess = new Subprocess(use_console);
-  if (!subprocess->Start(this, command)) {
+void SubprocessSet::Wake() {
+  if (!PostQueuedCompletionStatus(ioport_, 0, (ULONG_PTR)&wake_key_, NULL))
+    Win32Fatal("PostQueuedCompletionStatus");
+}
+
+Subprocess *SubprocessSet::Add(const string& command, bool use_console,
+                               int depfile_fd) {
+  Subprocess *subprocess = new Subprocess(use_console, output_limit_);
+  if (!subprocess->Start(this, command, depfile_fd)) {
     delete subprocess;
     return 0;
   }
@@ -252,32 +330,42 @@ Subprocess *SubprocessSet::Add(const string& command, bool use_console) {
 }
 
 bool SubprocessSet::DoWork() {
-  DWORD bytes_read;
-  Subprocess* subproc;
-  OVERLAPPED* overlapped;
-
-  if (!GetQueuedCompletionStatus(ioport_, &bytes_read, (PULONG_PTR)&subproc,
-                                 &overlapped, INFINITE)) {
-    if (GetLastError() != ERROR_BROKEN_PIPE)
-      Win32Fatal("GetQueuedCompletionStatus");
+  // Take all the completions queued, up to kMaxCompletions, at once: with
+  // many commands running, several are usually ready.
+  OVERLAPPED_ENTRY entries[kMaxCompletions];
+  ULONG count = 0;
+  if (!GetQueuedCompletionStatusEx(ioport_, entries, kMaxCompletions, &count,
+                                   INFINITE, FALSE)) {
+    Win32Fatal("GetQueuedCompletionStatusEx");
   }
 
-  if (!subproc) // A NULL subproc indicates that we were interrupted and is
-                // delivered by NotifyInterrupted above.
-    return true;
+  bool interrupted = false;
+  for (ULONG i = 0; i < count; ++i) {
+    Subprocess* subproc = (Subprocess*)entries[i].lpCompletionKey;
+    if (!subproc) {
+      // A NULL subproc indicates that we were interrupted and is
+      // delivered by NotifyInterrupted above.
+      interrupted = true;
+      continue;
+    }
 
-  subproc->OnPipeReady();
+    if ((void*)subproc == &wake_key_)
+      continue;
 
-  if (subproc->Done()) {
-    vector<Subprocess*>::iterator end =
-        remove(running_.begin(), running_.end(), subproc);
-    if (running_.end() != end) {
-      finished_.push(subproc);
-      running_.resize(end - running_.begin());
+    // A broken pipe shows in GetOverlappedResult(), called from here.
+    subproc->OnPipeReady();
+
+    if (subproc->Done()) {
+      vector<Subprocess*>::iterator running =
+          find(running_.begin(), running_.end(), subproc);
+      if (running != running_.end()) {
+        finished_.push(subproc);
+        running_.erase(running);
+      }
     }
   }
 
-  return false;
+  return interrupted;
 }
 
 Subprocess* SubprocessSet::NextFinished() {
@@ -15,10 +15,14 @@
 #ifndef NINJA_SUBPROCESS_H_
 #define NINJA_SUBPROCESS_H_
 
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 #include <queue>
 
+#include <stdio.h>
+
 #ifdef _WIN32
 #include <windows.h>
 #else
@@ -34,6 +38,7 @@
 #endif
 
 #include "exit_status.h"
+#include "resource_usage.h"
 
 /// Subprocess wraps a single async subprocess.  It is entirely
 /// passive: it expects the caller to notify it when its fds are ready
@@ -48,14 +53,39 @@ struct Subprocess {
 
   bool Done() const;
 
+  /// The output kept in memory: all of it, or the first
+  /// SubprocessSet::output_limit_ bytes.
   const std::string& GetOutput() const;
 
+  /// Move the output kept in memory to |output|, and the rest, if any, to
+  /// |overflow|, a temporary file rewound to its start.
+  void TakeOutput(std::string* output, std::shared_ptr<FILE>* overflow);
+
+  /// Move the whole lines of output kept in memory to |lines|, unless some
+  /// output went to a temporary file already.  Returns false if there were
+  /// none to move.
+  bool TakeLines(std::string* lines);
+
+  /// Move what the command wrote to its depfile descriptor (see
+  /// SubprocessSet::Add()) to |depfile|, once Done().
+  void TakeDepfile(std::string* depfile);
+
+  /// The resources the process used, once Finish() returned.
+  const ResourceUsage& usage() const { return usage_; }
+
  private:
-  Subprocess(bool use_console);
-  bool Start(struct SubprocessSet* set, const std::string& command);
+  Subprocess(bool use_console, size_t output_limit);
+  bool Start(struct SubprocessSet* set, const std::string& command,
+             int depfile_fd);
   void OnPipeReady();
+  /// Add |len| bytes of output to buf_, or to overflow_ past output_limit_.
+  void AppendOutput(const char* data, size_t len);
 
   std::string buf_;
+  size_t output_limit_;
+  /// The output past output_limit_, or NULL.
+  FILE* overflow_;
+  ResourceUsage usage_;
 
 #ifdef _WIN32
   /// Set up pipe_ as the parent-side pipe of the subprocess; return the
@@ -65,35 +95,84 @@ struct Subprocess {
   HANDLE child_;
   HANDLE pipe_;
   OVERLAPPED overlapped_;
-  char overlapped_buf_[4 << 10];
+  /// Large enough that a command writing a lot of output takes few
+  /// completions to read it.
+  char overlapped_buf_[64 << 10];
   bool is_reading_;
 #else
   int fd_;
   pid_t pid_;
+  /// The anonymous file the child has as its depfile descriptor, or -1.
+  int depfile_;
+  /// The cgroup made for the child (see SubprocessSet::cgroup_), or "".
+  std::string cgroup_;
+  /// Read the usage of cgroup_ into usage_, then remove it.
+  void FinishCgroup();
+#ifdef USE_EPOLL
+  /// A pidfd for the child, readable once it exited, or -1 if the kernel
+  /// doesn't have pidfds.
+  int pidfd_;
+
+  /// Read the output written so far, without blocking, then stop reading.
+  void OnExited();
+#endif
 #endif
   bool use_console_;
 
   friend struct SubprocessSet;
 };
 
-/// SubprocessSet runs a ppoll/pselect() loop around a set of Subprocesses.
+/// SubprocessSet runs an epoll (on Linux), ppoll/pselect() or I/O
+/// completion port (on Windows) loop around a set of Subprocesses.
 /// DoWork() waits for any state change in subprocesses; finished_
 /// is a queue of subprocesses as they finish.
 struct SubprocessSet {
   SubprocessSet();
   ~SubprocessSet();
 
-  Subprocess* Add(const std::string& command, bool use_console = false);
+  /// Start |command|.  If |depfile_fd| isn't -1, the command has an
+  /// anonymous file open as that descriptor, e.g. for "-MF /dev/fd/3", and
+  /// Subprocess::TakeDepfile() returns what it wrote there; commands
+  /// sharing the console don't.  Not on Windows, where it is ignored.
+  Subprocess* Add(const std::string& command, bool use_console = false,
+                  int depfile_fd = -1);
   bool DoWork();
+  /// Make the DoWork() in progress, or the next one, return without
+  /// waiting for the subprocesses.  Safe to call from any thread.
+  void Wake();
   Subprocess* NextFinished();
   void Clear();
 
   std::vector<Subprocess*> running_;
   std::queue<Subprocess*> finished_;
 
+  /// Run commands that don't need a shell (see SplitSimpleCommand()) by
+  /// spawning the program directly rather than through /bin/sh -c.
+  /// Commands always run without a shell on Windows.
+  bool direct_spawn_;
+
+  /// Keep at most this many bytes of the output of the commands added next
+  /// in memory, and the rest in a temporary file; 0 for no limit.
+  size_t output_limit_;
+
+  /// Run the commands added next on these CPUs only, and the processes
+  /// they start too; empty for any.  Only on Linux, where the system
+  /// allows it.
+  std::vector<int> cpus_;
+
+  /// A cgroup v2 directory delegated to ninja, or "".  The commands added
+  /// next each run in a cgroup of their own made under it, with
+  /// cgroup_settings_ written to its files, e.g. ("memory.max", "4G"),
+  /// which then also measures their usage and that of the processes they
+  /// start.  Only on Linux.
+  std::string cgroup_;
+  std::vector<std::pair<std::string, std::string> > cgroup_settings_;
+
 #ifdef _WIN32
   static BOOL WINAPI NotifyInterrupted(DWORD dwCtrlType);
   static HANDLE ioport_;
+  /// The completion key that Wake() posts to ioport_.
+  static char wake_key_;
 #else
   static void SetInterruptedFlag(int signum);
   static void HandlePendingInterruption();
@@ -107,7 +186,43 @@ struct SubprocessSet {
   struct sigaction old_term_act_;
   struct sigaction old_hup_act_;
   sigset_t old_mask_;
+
+  /// Written to by Wake() and watched by DoWork().  Both ends are
+  /// non-blocking: a full pipe means a wakeup is pending anyway.
+  int wake_pipe_[2];
+  /// Read the pending wakeups.
+  void DrainWakePipe();
+
+  /// Make a cgroup under cgroup_ with cgroup_settings_ for a command,
+  /// returning its path, or "" if that fails.
+  std::string MakeCgroup();
+  /// The cgroups made so far, to name the next.
+  int cgroups_made_;
+  /// The "<cgroup_>/+<controller>" already enabled for the cgroups made.
+  std::vector<std::string> cgroup_controllers_;
+  /// Whether a failure to set up a cgroup was reported, which is only
+  /// done once.
+  bool cgroup_warned_;
+
+#ifdef USE_EPOLL
+  /// The epoll set watching the output pipes and pidfds of running_, or -1
+  /// if epoll couldn't be set up, in which case ppoll/pselect() is used.
+  int epoll_fd_;
+
+  bool DoWorkEpoll();
+#endif
 #endif
 };
 
+#ifndef _WIN32
+/// Split |command| into the arguments /bin/sh would pass to the program it
+/// runs, if the command is a plain program invocation: words made of
+/// characters without special meaning, optionally quoted, where double
+/// quotes hold no expansions or escapes.  Returns false for anything
+/// else (operators, redirections, expansions, globs, reserved words,
+/// builtins, variable assignments), which needs the shell.
+bool SplitSimpleCommand(const std::string& command,
+                        std::vector<std::string>* args);
+#endif
+
 #endif // NINJA_SUBPROCESS_H_
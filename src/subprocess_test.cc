@@ -14,7 +14,11 @@
 
 #include "subprocess.h"
 
+#include <thread>
+
+#include "metrics.h"
 #include "test.h"
+#include "util.h"
 
 #ifndef _WIN32
 // SetWithLots need setrlimit.
@@ -24,6 +28,11 @@
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <sched.h>
+#include <sys/stat.h>
+#endif
+
 using namespace std;
 
 namespace {
@@ -176,6 +185,151 @@ TEST_F(SubprocessTest, SetWithSingle) {
   ASSERT_EQ(1u, subprocs_.finished_.size());
 }
 
+#ifndef _WIN32
+TEST_F(SubprocessTest, ResourceUsage) {
+  // Spin for a while, so that some CPU time is counted.
+  Subprocess* subproc =
+      subprocs_.Add("i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done");
+  ASSERT_NE((Subprocess *) 0, subproc);
+
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_GT(subproc->usage().user_time + subproc->usage().system_time, 0);
+  EXPECT_GT(subproc->usage().peak_rss, 0);
+}
+#endif
+
+#ifndef _WIN32
+TEST_F(SubprocessTest, Depfile) {
+  Subprocess* subproc = subprocs_.Add("printf 'out: in' > /dev/fd/3",
+                                      false, 3);
+  ASSERT_NE((Subprocess *) 0, subproc);
+  // More than a pipe holds, written while nothing reads it.
+  Subprocess* large = subprocs_.Add(
+      "head -c 200000 /dev/zero | tr '\\0' x >&5; echo done", false, 5);
+  ASSERT_NE((Subprocess *) 0, large);
+
+  while (!subproc->Done() || !large->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  ASSERT_EQ(ExitSuccess, large->Finish());
+  string depfile;
+  subproc->TakeDepfile(&depfile);
+  EXPECT_EQ("out: in", depfile);
+  large->TakeDepfile(&depfile);
+  EXPECT_EQ(string(200000, 'x'), depfile);
+  EXPECT_EQ("done\n", large->GetOutput());
+}
+#endif
+
+#ifdef __linux__
+TEST_F(SubprocessTest, Cpus) {
+  cpu_set_t allowed;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+  int cpu = 0;
+  while (!CPU_ISSET(cpu, &allowed))
+    ++cpu;
+
+  subprocs_.cpus_.push_back(cpu);
+  Subprocess* subproc =
+      subprocs_.Add("grep Cpus_allowed_list: /proc/self/status");
+  ASSERT_NE((Subprocess *) 0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("Cpus_allowed_list:\t" + to_string(cpu) + "\n",
+            subproc->GetOutput());
+
+  // Ninja itself still runs anywhere it did.
+  cpu_set_t after;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(after), &after));
+  EXPECT_TRUE(CPU_EQUAL(&allowed, &after));
+}
+
+TEST_F(SubprocessTest, Cgroup) {
+  // The cgroup v2 hierarchy, and the cgroup of this process in it.
+  string mounts, self, err;
+  ASSERT_EQ(0, ReadFile("/proc/self/mounts", &mounts, &err));
+  ASSERT_EQ(0, ReadFile("/proc/self/cgroup", &self, &err));
+  size_t type = mounts.find(" cgroup2 ");
+  size_t line = self.find("0::/");
+  if (type == string::npos || line == string::npos)
+    return;
+  size_t start = mounts.rfind('\n', type);
+  start = start == string::npos ? 0 : start + 1;
+  size_t mount = mounts.find(' ', start) + 1;
+  string hierarchy = mounts.substr(mount, type - mount);
+  string path = self.substr(line + 3, self.find('\n', line) - line - 3);
+  string dir = hierarchy + path + "/ninja_test-" + to_string(getpid());
+  if (mkdir(dir.c_str(), 0755) < 0)
+    return;  // Only where this process may make cgroups.
+
+  subprocs_.cgroup_ = dir;
+  subprocs_.cgroup_settings_.push_back(make_pair("cgroup.max.depth", "0"));
+  Subprocess* subproc = subprocs_.Add(
+      "cat " + hierarchy + "$(sed -n 's/^0:://p' /proc/self/cgroup)"
+      "/cgroup.max.depth");
+  ASSERT_NE((Subprocess *) 0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  EXPECT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("0\n", subproc->GetOutput());
+  // The cgroup of the command is gone.
+  EXPECT_EQ(0, rmdir(dir.c_str()));
+}
+#endif
+
+TEST_F(SubprocessTest, OutputLimit) {
+  subprocs_.output_limit_ = 4;
+#ifdef _WIN32
+  Subprocess* subproc = subprocs_.Add("cmd /c echo 0123456789");
+#else
+  Subprocess* subproc = subprocs_.Add("echo 0123456789");
+#endif
+  ASSERT_NE((Subprocess *) 0, subproc);
+
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("0123", subproc->GetOutput());
+
+  string output;
+  shared_ptr<FILE> overflow;
+  subproc->TakeOutput(&output, &overflow);
+  EXPECT_EQ("0123", output);
+  ASSERT_TRUE(overflow);
+  char buf[32];
+  size_t len = fread(buf, 1, sizeof(buf), overflow.get());
+  EXPECT_EQ(string("456789"), string(buf, len).substr(0, 6));
+}
+
+#ifndef _WIN32
+TEST_F(SubprocessTest, TakeLines) {
+  Subprocess* subproc = subprocs_.Add("printf 'one\\ntwo\\nthr'; sleep 1; "
+                                      "printf 'ee\\n'");
+  ASSERT_NE((Subprocess *) 0, subproc);
+
+  string lines;
+  while (!subproc->TakeLines(&lines)) {
+    ASSERT_FALSE(subproc->Done());
+    subprocs_.DoWork();
+  }
+  EXPECT_EQ("one\ntwo\n", lines);
+
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("three\n", subproc->GetOutput());
+}
+#endif
+
 TEST_F(SubprocessTest, SetWithMulti) {
   Subprocess* processes[3];
   const char* kCommands[3] = {
@@ -261,3 +415,88 @@ TEST_F(SubprocessTest, ReadStdin) {
   ASSERT_EQ(1u, subprocs_.finished_.size());
 }
 #endif  // _WIN32
+
+#ifndef _WIN32
+TEST_F(SubprocessTest, LargeOutput) {
+  Subprocess* subproc = subprocs_.Add("seq 1 100000");
+  ASSERT_NE((Subprocess *) 0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  const string& output = subproc->GetOutput();
+  EXPECT_EQ(588895u, output.size());
+  EXPECT_EQ("99999\n100000\n", output.substr(output.size() - 13));
+}
+
+// Output written before the command exits is not lost, even if a process
+// it left in the background keeps the output open.
+TEST_F(SubprocessTest, BackgroundChild) {
+  Subprocess* subproc = subprocs_.Add("sleep 1 & echo done");
+  ASSERT_NE((Subprocess *) 0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("done\n", subproc->GetOutput());
+}
+// Wake() interrupts a DoWork() waiting on another thread, well before
+// DoWork() would time out.
+TEST_F(SubprocessTest, Wake) {
+  int64_t start = GetTimeMillis();
+  std::thread waker([this]() { subprocs_.Wake(); });
+  EXPECT_FALSE(subprocs_.DoWork());
+  waker.join();
+  EXPECT_LT(GetTimeMillis() - start, 400);
+}
+
+TEST(SplitSimpleCommandTest, Simple) {
+  vector<string> args;
+  EXPECT_TRUE(SplitSimpleCommand("  cc -c  foo.c\t-o foo.o -DX=1 ", &args));
+  ASSERT_EQ(6u, args.size());
+  EXPECT_EQ("cc", args[0]);
+  EXPECT_EQ("foo.c", args[2]);
+  EXPECT_EQ("-DX=1", args[5]);
+
+  EXPECT_TRUE(SplitSimpleCommand("touch 'a b' \"c d\"e ''", &args));
+  ASSERT_EQ(4u, args.size());
+  EXPECT_EQ("a b", args[1]);
+  EXPECT_EQ("c de", args[2]);
+  EXPECT_EQ("", args[3]);
+}
+
+TEST(SplitSimpleCommandTest, NeedsShell) {
+  const char* const kCommands[] = {
+    "", "  ", "a && b", "a; b", "a | b", "a > b", "echo $x", "echo `a`",
+    "echo \"$x\"", "a\\ b", "ls *.c", "cd ~", "a # b", "echo 'a",
+    "echo \"a", "X=1 cc", "exit 1", "if", "cc 'a'\"$b\"", "a\nb", "(a)",
+    // Builtins, which may differ from the programs of the same name.
+    "echo 'a\\tb'", "printf x", "test -f a", "[ -f a ]", "pwd", "kill 1",
+    "umask 022", "cd a", "true", "read x", "command -v cc", "ulimit -n",
+  };
+  for (size_t i = 0; i < sizeof(kCommands) / sizeof(kCommands[0]); ++i) {
+    vector<string> args;
+    EXPECT_FALSE(SplitSimpleCommand(kCommands[i], &args));
+  }
+}
+
+TEST_F(SubprocessTest, DirectSpawn) {
+  subprocs_.direct_spawn_ = true;
+  Subprocess* subproc = subprocs_.Add("env printf '%s|' 'a  b' c");
+  ASSERT_NE((Subprocess *) 0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  ASSERT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("a  b|c|", subproc->GetOutput());
+
+  // A missing program is reported by the shell.
+  subproc = subprocs_.Add("ninja_no_such_command");
+  ASSERT_NE((Subprocess *) 0, subproc);
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+  EXPECT_EQ(ExitFailure, subproc->Finish());
+  EXPECT_NE("", subproc->GetOutput());
+}
+#endif  // _WIN32
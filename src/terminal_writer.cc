@@ -0,0 +1,105 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "terminal_writer.h"
+
+using namespace std;
+
+namespace {
+
+/// Write() waits for the thread beyond this much queued.
+const size_t kMaxPendingBytes = 1 << 20;
+
+}  // anonymous namespace
+
+TerminalWriter::TerminalWriter()
+    : frame_start_(string::npos), writing_(false), stopping_(false),
+      dropped_frames_(0), file_(NULL) {}
+
+TerminalWriter::~TerminalWriter() {
+  Close();
+}
+
+void TerminalWriter::Start(FILE* file) {
+  file_ = file;
+  frame_start_ = string::npos;
+  stopping_ = false;
+  thread_ = std::thread(&TerminalWriter::Run, this);
+}
+
+void TerminalWriter::Write(const string& data) {
+  if (data.empty())
+    return;
+  unique_lock<mutex> lock(mutex_);
+  while (pending_.size() >= kMaxPendingBytes)
+    written_.wait(lock);
+  pending_.append(data);
+  frame_start_ = string::npos;
+  queued_.notify_one();
+}
+
+void TerminalWriter::WriteFrame(const string& frame) {
+  lock_guard<mutex> lock(mutex_);
+  if (frame_start_ != string::npos) {
+    pending_.resize(frame_start_);
+    ++dropped_frames_;
+  }
+  frame_start_ = pending_.size();
+  pending_.append(frame);
+  queued_.notify_one();
+}
+
+void TerminalWriter::Flush() {
+  if (!file_)
+    return;
+  unique_lock<mutex> lock(mutex_);
+  while (!pending_.empty() || writing_)
+    written_.wait(lock);
+}
+
+void TerminalWriter::Close() {
+  if (!file_)
+    return;
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+    queued_.notify_one();
+  }
+  thread_.join();
+  file_ = NULL;
+}
+
+void TerminalWriter::Run() {
+  string batch;
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    while (pending_.empty() && !stopping_)
+      queued_.wait(lock);
+    if (pending_.empty())
+      return;  // Stopping, with everything written.
+
+    // Take all that's queued, and let more queue up meanwhile.
+    batch.swap(pending_);
+    pending_.clear();
+    frame_start_ = string::npos;
+    writing_ = true;
+    lock.unlock();
+    // Like printf(), ignore the errors of the terminal.
+    fwrite(batch.data(), 1, batch.size(), file_);
+    fflush(file_);
+    lock.lock();
+    writing_ = false;
+    written_.notify_all();
+  }
+}
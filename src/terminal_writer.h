@@ -0,0 +1,77 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_TERMINAL_WRITER_H_
+#define NINJA_TERMINAL_WRITER_H_
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// Writes what ninja prints to the terminal on a thread of its own, so
+/// that a slow terminal, e.g. over ssh, or a full pipe doesn't hold up
+/// the build.  Output is written in order and never dropped; only a
+/// status frame still queued when the next one comes, which would have
+/// overwritten it anyway, is.
+struct TerminalWriter {
+  TerminalWriter();
+  ~TerminalWriter();
+
+  /// Start writing to |file|, which stays open.
+  void Start(FILE* file);
+
+  bool started() const { return file_ != NULL; }
+
+  /// Queue |data| to be written.  It only waits when much is queued
+  /// already.
+  void Write(const std::string& data);
+
+  /// Queue |frame|, which overwrites the status line, to be written.  It
+  /// replaces the frame queued last, if nothing was queued after it, and
+  /// never waits.
+  void WriteFrame(const std::string& frame);
+
+  /// Wait until everything queued so far is written.
+  void Flush();
+
+  /// Flush and stop the thread.
+  void Close();
+
+  /// The frames replaced by newer ones before being written.
+  int dropped_frames() const { return dropped_frames_; }
+
+ private:
+  void Run();
+
+  std::mutex mutex_;
+  /// Wakes up the thread.
+  std::condition_variable queued_;
+  /// Wakes up those waiting for the thread.
+  std::condition_variable written_;
+  std::string pending_;
+  /// Where the frame at the end of pending_ starts, or npos if it doesn't
+  /// end with one.
+  size_t frame_start_;
+  /// Whether the thread is writing a batch.
+  bool writing_;
+  bool stopping_;
+  int dropped_frames_;
+  FILE* file_;
+  std::thread thread_;
+};
+
+#endif  // NINJA_TERMINAL_WRITER_H_
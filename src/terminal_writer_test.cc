@@ -0,0 +1,93 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "terminal_writer.h"
+
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+/// Read all that was written to |f|.
+string Contents(FILE* f) {
+  string contents;
+  rewind(f);
+  char buf[4096];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+    contents.append(buf, len);
+  return contents;
+}
+
+TEST(TerminalWriterTest, WritesOutputInOrder) {
+  FILE* f = tmpfile();
+  ASSERT_TRUE(f != NULL);
+  TerminalWriter writer;
+  EXPECT_FALSE(writer.started());
+  writer.Start(f);
+  EXPECT_TRUE(writer.started());
+
+  string expected;
+  for (int i = 0; i < 1000; ++i) {
+    string line = "line " + to_string(i) + "\n";
+    writer.Write(line);
+    expected += line;
+  }
+  writer.Flush();
+  EXPECT_EQ(expected, Contents(f));
+
+  writer.Write("last\n");
+  writer.Close();
+  EXPECT_FALSE(writer.started());
+  EXPECT_EQ(expected + "last\n", Contents(f));
+  fclose(f);
+}
+
+TEST(TerminalWriterTest, DropsOnlySupersededFrames) {
+  FILE* f = tmpfile();
+  ASSERT_TRUE(f != NULL);
+  TerminalWriter writer;
+  writer.Start(f);
+  string frames;
+  for (int i = 0; i < 1000; ++i) {
+    string frame = "\r[" + to_string(i) + "/1000]";
+    writer.WriteFrame(frame);
+    frames += frame;
+  }
+  writer.Write("\noutput\n");
+  writer.WriteFrame("\r[done]");
+  writer.Close();
+
+  // The frames written are those that were not dropped, in order, and
+  // always the last one before the output.
+  string contents = Contents(f);
+  string expected_end = "\r[999/1000]\noutput\n\r[done]";
+  ASSERT_TRUE(contents.size() >= expected_end.size());
+  EXPECT_EQ(expected_end,
+            contents.substr(contents.size() - expected_end.size()));
+  int written_frames = 0;
+  for (size_t i = 0; i < contents.size(); ++i)
+    written_frames += contents[i] == '\r';
+  EXPECT_EQ(1001, written_frames + writer.dropped_frames());
+  fclose(f);
+}
+
+TEST(TerminalWriterTest, CloseWithoutStart) {
+  TerminalWriter writer;
+  writer.Flush();
+  writer.Close();
+}
+
+}  // anonymous namespace
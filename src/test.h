@@ -145,6 +145,7 @@ struct VirtualFileSystem : public DiskInterface {
 
   // DiskInterface
   virtual TimeStamp Stat(const std::string& path, std::string* err) const;
+  virtual bool IsStatThreadSafe() const { return true; }
   virtual bool WriteFile(const std::string& path, const std::string& contents);
   virtual bool MakeDir(const std::string& path);
   virtual Status ReadFile(const std::string& path, std::string* contents,
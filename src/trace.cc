@@ -0,0 +1,147 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "trace.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "metrics.h"
+
+using namespace std;
+
+Tracer* g_tracer = NULL;
+
+Tracer::Tracer()
+    : file_(NULL), first_event_(true), start_(0), threads_(0) {}
+
+Tracer::~Tracer() {
+  Close();
+}
+
+bool Tracer::Open(const string& path, string* err) {
+  file_ = fopen(path.c_str(), "wb");
+  if (!file_) {
+    *err = strerror(errno);
+    return false;
+  }
+  SetCloseOnExec(fileno(file_));
+  fputs("[\n", file_);
+  first_event_ = true;
+  start_ = GetTimeMicros();
+  main_thread_ = this_thread::get_id();
+  threads_ = 1;
+  NameTrack(0, "ninja");
+  return true;
+}
+
+void Tracer::Close() {
+  lock_guard<mutex> lock(mutex_);
+  if (!file_)
+    return;
+  fputs("\n]\n", file_);
+  fclose(file_);
+  file_ = NULL;
+}
+
+int64_t Tracer::Now() const {
+  return GetTimeMicros() - start_;
+}
+
+int Tracer::CurrentThread() {
+  if (this_thread::get_id() == main_thread_)
+    return 0;
+  thread_local const Tracer* owner = NULL;
+  thread_local int track = 0;
+  if (owner != this) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      track = threads_++;
+    }
+    owner = this;
+    NameTrack(track, "ninja worker");
+  }
+  return track;
+}
+
+void Tracer::AddSlice(const string& name, const char* category, int track,
+                      int64_t start, int64_t end, const string& args) {
+  string event = "{\"name\":";
+  AppendJSONString(name, &event);
+  char buf[128];
+  snprintf(buf, sizeof(buf),
+           ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+           "\"ts\":%lld,\"dur\":%lld", category, track, (long long)start,
+           (long long)(end - start));
+  event += buf;
+  if (!args.empty()) {
+    event += ",\"args\":";
+    event += args;
+  }
+  event += "}";
+  WriteEvent(event);
+}
+
+void Tracer::NameTrack(int track, const string& name) {
+  char buf[128];
+  snprintf(buf, sizeof(buf),
+           "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+           "\"args\":{\"name\":", track);
+  string event = buf;
+  AppendJSONString(name, &event);
+  event += "}}";
+  WriteEvent(event);
+}
+
+void Tracer::WriteEvent(const string& event) {
+  lock_guard<mutex> lock(mutex_);
+  if (!file_)
+    return;
+  if (!first_event_)
+    fputs(",\n", file_);
+  first_event_ = false;
+  fwrite(event.data(), 1, event.size(), file_);
+}
+
+// static
+void Tracer::AppendJSONString(const string& str, string* out) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  out->push_back('"');
+  for (string::const_iterator c = str.begin(); c != str.end(); ++c) {
+    unsigned char ch = *c;
+    if (ch == '"' || ch == '\\') {
+      out->push_back('\\');
+      out->push_back(ch);
+    } else if (ch < 0x20) {
+      out->append("\\u00");
+      out->push_back(kHexDigits[ch >> 4]);
+      out->push_back(kHexDigits[ch & 0xf]);
+    } else {
+      out->push_back(ch);
+    }
+  }
+  out->push_back('"');
+}
+
+ScopedTrace::ScopedTrace(const char* name) : name_(name), start_(0) {
+  if (g_tracer)
+    start_ = g_tracer->Now();
+}
+
+ScopedTrace::~ScopedTrace() {
+  if (!g_tracer)
+    return;
+  g_tracer->AddSlice(name_, "ninja", g_tracer->CurrentThread(), start_,
+                     g_tracer->Now(), "");
+}
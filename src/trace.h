@@ -0,0 +1,95 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_TRACE_H_
+#define NINJA_TRACE_H_
+
+#include <stdio.h>
+
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "util.h"  // For int64_t.
+
+/// Tracer writes the profile of '-d trace=FILE': a Chrome trace-event file
+/// (in the JSON array format), which chrome://tracing and Perfetto open.
+/// Each event is a slice on a track: ninja's threads, identified by
+/// CurrentThread(), and the job slots running commands, from
+/// kFirstJobTrack on.  Events may be added from any thread.
+struct Tracer {
+  Tracer();
+  ~Tracer();
+
+  /// Start writing the trace to |path|.  Timestamps count from now.
+  bool Open(const std::string& path, std::string* err);
+
+  /// Terminate the trace and close the file.
+  void Close();
+
+  /// Microseconds since Open().
+  int64_t Now() const;
+
+  /// The track of the calling thread: 0 for the thread that called Open(),
+  /// and then in the order threads first ask.
+  int CurrentThread();
+
+  enum { kFirstJobTrack = 1000 };
+
+  /// Record a slice named |name| on |track|, from |start| to |end| (as
+  /// returned by Now()).  |args|, if not empty, is a JSON object of
+  /// details shown with the slice.
+  void AddSlice(const std::string& name, const char* category, int track,
+                int64_t start, int64_t end, const std::string& args);
+
+  /// Set the name shown for |track|.
+  void NameTrack(int track, const std::string& name);
+
+  /// Append |str| to |out| as a JSON string literal.
+  static void AppendJSONString(const std::string& str, std::string* out);
+
+ private:
+  void WriteEvent(const std::string& event);
+
+  FILE* file_;
+  bool first_event_;
+  int64_t start_;
+  std::thread::id main_thread_;
+  int threads_;
+  std::mutex mutex_;
+
+  // Unimplemented copy ctor and operator= ensure we don't close twice.
+  Tracer(const Tracer& other);          // DO NOT IMPLEMENT
+  void operator=(const Tracer& other);  // DO NOT IMPLEMENT
+};
+
+/// A scoped object recording a slice across the body of a function on the
+/// calling thread's track.  Used by the TRACE_RECORD macro.
+struct ScopedTrace {
+  explicit ScopedTrace(const char* name);
+  ~ScopedTrace();
+
+ private:
+  const char* name_;
+  int64_t start_;
+};
+
+/// Use TRACE_RECORD("foobar") at the top of a function to show each call of
+/// the function as a slice in the -d trace profile.  Meant for the coarse
+/// phases of a build; short, frequent calls should stick to METRIC_RECORD.
+#define TRACE_RECORD(name) ScopedTrace trace_h_scoped(name)
+
+extern Tracer* g_tracer;
+
+#endif  // NINJA_TRACE_H_
@@ -0,0 +1,63 @@
+// Copyright 2026 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "trace.h"
+
+#include <thread>
+
+#include "disk_interface.h"
+#include "test.h"
+
+using namespace std;
+
+TEST(TracerTest, AppendJSONString) {
+  string out;
+  Tracer::AppendJSONString("a \"b\" c\\d\n\x01", &out);
+  EXPECT_EQ("\"a \\\"b\\\" c\\\\d\\u000a\\u0001\"", out);
+}
+
+TEST(TracerTest, WritesEvents) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("TracerTest-WritesEvents");
+  string err;
+  {
+    Tracer tracer;
+    ASSERT_TRUE(tracer.Open("trace.json", &err));
+    EXPECT_EQ(0, tracer.CurrentThread());
+    int worker_track = -1;
+    thread worker([&]() { worker_track = tracer.CurrentThread(); });
+    worker.join();
+    EXPECT_EQ(1, worker_track);
+    tracer.AddSlice("cc foo.o", "edge", Tracer::kFirstJobTrack, 10, 25,
+                    "{\"pool\":\"\"}");
+    tracer.Close();
+    // Events after closing are dropped.
+    tracer.AddSlice("late", "edge", 0, 30, 40, "");
+  }
+
+  RealDiskInterface disk_interface;
+  string contents;
+  ASSERT_EQ(DiskInterface::Okay,
+            disk_interface.ReadFile("trace.json", &contents, &err));
+  EXPECT_EQ(0u, contents.find("[\n"));
+  EXPECT_EQ(contents.size() - 3, contents.rfind("\n]\n"));
+  EXPECT_NE(string::npos, contents.find(
+      "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+      "\"args\":{\"name\":\"ninja worker\"}}"));
+  EXPECT_NE(string::npos, contents.find(
+      "{\"name\":\"cc foo.o\",\"cat\":\"edge\",\"ph\":\"X\",\"pid\":1,"
+      "\"tid\":1000,\"ts\":10,\"dur\":15,\"args\":{\"pool\":\"\"}}"));
+  EXPECT_EQ(string::npos, contents.find("late"));
+  temp_dir.Cleanup();
+}
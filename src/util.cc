@@ -38,8 +38,22 @@
 #include <sys/time.h>
 #endif
 
+#include <algorithm>
 #include <vector>
 
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>  // _umul128
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NINJA_SIMD_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NINJA_SIMD_NEON
+#endif
+
 #if defined(__APPLE__) || defined(__FreeBSD__)
 #include <sys/sysctl.h>
 #elif defined(__SVR4) && defined(__sun)
@@ -116,11 +130,87 @@ static bool IsPathSeparator(char c) {
 #endif
 }
 
+/// Whether CanonicalizePathScalar() would leave |path| as it is and clear
+/// the slash bits: no "." or ".." components but leading ".."s, no empty
+/// component, no backslash on Windows, and few enough components.  May
+/// return false for some such paths, e.g. those with a component starting
+/// with '.', which then take the slow path.
+static bool IsCanonicalPath(const char* path, size_t len) {
+  // The scalar loop allows at most 60 components, which takes at least 121
+  // characters; let it report the error.
+  if (len > 120 && std::count(path, path + len, '/') >= 60)
+    return false;
+
+  size_t i = 0;
+  while (len - i > 3 && path[i] == '.' && path[i + 1] == '.' &&
+         path[i + 2] == '/')
+    i += 3;
+  if (path[i] == '.' || path[len - 1] == '/')
+    return false;
+  // Start at the separator ending the leading ".."s, if any.
+  if (i > 0)
+    --i;
+
+  // Look for a '/' followed by '/' or '.' (or any '\\' on Windows),
+  // comparing each block of bytes with the block one byte further.
+#if defined(NINJA_SIMD_SSE2)
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i dot = _mm_set1_epi8('.');
+#ifdef _WIN32
+  const __m128i backslash = _mm_set1_epi8('\\');
+#endif
+  for (; i + 17 <= len; i += 16) {
+    __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(path + i));
+    __m128i next =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(path + i + 1));
+    __m128i bad = _mm_and_si128(
+        _mm_cmpeq_epi8(cur, slash),
+        _mm_or_si128(_mm_cmpeq_epi8(next, slash), _mm_cmpeq_epi8(next, dot)));
+#ifdef _WIN32
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(cur, backslash));
+#endif
+    if (_mm_movemask_epi8(bad))
+      return false;
+  }
+#elif defined(NINJA_SIMD_NEON)
+  const uint8x16_t slash = vdupq_n_u8('/');
+  const uint8x16_t dot = vdupq_n_u8('.');
+  for (; i + 17 <= len; i += 16) {
+    uint8x16_t cur = vld1q_u8(reinterpret_cast<const uint8_t*>(path + i));
+    uint8x16_t next = vld1q_u8(reinterpret_cast<const uint8_t*>(path + i + 1));
+    uint8x16_t bad = vandq_u8(
+        vceqq_u8(cur, slash), vorrq_u8(vceqq_u8(next, slash),
+                                      vceqq_u8(next, dot)));
+    if (vmaxvq_u8(bad))
+      return false;
+  }
+#endif
+  for (; i < len; ++i) {
+#ifdef _WIN32
+    if (path[i] == '\\')
+      return false;
+#endif
+    if (path[i] == '/' && i + 1 < len &&
+        (path[i + 1] == '/' || path[i + 1] == '.'))
+      return false;
+  }
+  return true;
+}
+
 bool CanonicalizePath(char* path, size_t* len, uint64_t* slash_bits,
                       string* err) {
   // WARNING: this function is performance-critical; please benchmark
   // any changes you make to it.
   METRIC_RECORD("canonicalize path");
+  if (*len != 0 && IsCanonicalPath(path, *len)) {
+    *slash_bits = 0;
+    return true;
+  }
+  return CanonicalizePathScalar(path, len, slash_bits, err);
+}
+
+bool CanonicalizePathScalar(char* path, size_t* len, uint64_t* slash_bits,
+                            string* err) {
   if (*len == 0) {
     *err = "empty path";
     return false;
@@ -216,21 +306,94 @@ bool CanonicalizePath(char* path, size_t* len, uint64_t* slash_bits,
   return true;
 }
 
-static inline bool IsKnownShellSafeCharacter(char ch) {
-  if ('A' <= ch && ch <= 'Z') return true;
-  if ('a' <= ch && ch <= 'z') return true;
-  if ('0' <= ch && ch <= '9') return true;
+const char* SkipBlocksWithout(const char* p, const char* end,
+                              const char* stops, int stop_count) {
+  assert(stop_count <= 8);
+#if defined(NINJA_SIMD_SSE2)
+  __m128i sets[8];
+  for (int i = 0; i < stop_count; ++i)
+    sets[i] = _mm_set1_epi8(stops[i]);
+  for (; end - p >= 16; p += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i found = _mm_setzero_si128();
+    for (int i = 0; i < stop_count; ++i)
+      found = _mm_or_si128(found, _mm_cmpeq_epi8(block, sets[i]));
+    if (_mm_movemask_epi8(found))
+      break;
+  }
+#elif defined(NINJA_SIMD_NEON)
+  uint8x16_t sets[8];
+  for (int i = 0; i < stop_count; ++i)
+    sets[i] = vdupq_n_u8(stops[i]);
+  for (; end - p >= 16; p += 16) {
+    uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    uint8x16_t found = vdupq_n_u8(0);
+    for (int i = 0; i < stop_count; ++i)
+      found = vorrq_u8(found, vceqq_u8(block, sets[i]));
+    if (vmaxvq_u8(found))
+      break;
+  }
+#endif
+  return p;
+}
 
-  switch (ch) {
-    case '_':
-    case '+':
-    case '-':
-    case '.':
-    case '/':
-      return true;
-    default:
-      return false;
+#if defined(NINJA_SIMD_SSE2)
+/// Which bytes of |c| are within [lo, hi], compared as unsigned.
+static inline __m128i InRange(__m128i c, unsigned char lo, unsigned char hi) {
+  // SSE2 only compares signed bytes; shift c - lo by 128.
+  __m128i shifted = _mm_xor_si128(_mm_sub_epi8(c, _mm_set1_epi8((char)lo)),
+                                  _mm_set1_epi8((char)0x80));
+  return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)((hi - lo + 1) ^ 0x80)));
+}
+#endif
+
+const char* SkipPathCharBlocks(const char* p, const char* end) {
+#if defined(NINJA_SIMD_SSE2)
+  for (; end - p >= 16; p += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i ok = _mm_or_si128(
+        InRange(block, '+', ':'),  // +,-./0-9:
+        InRange(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 'z'));
+    ok = _mm_or_si128(ok, _mm_cmpeq_epi8(block, _mm_set1_epi8('_')));
+    ok = _mm_or_si128(ok, _mm_cmplt_epi8(block, _mm_setzero_si128()));
+    if (_mm_movemask_epi8(ok) != 0xffff)
+      break;
+  }
+#elif defined(NINJA_SIMD_NEON)
+  for (; end - p >= 16; p += 16) {
+    uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    uint8x16_t lower = vorrq_u8(block, vdupq_n_u8(0x20));
+    uint8x16_t ok = vandq_u8(vcgeq_u8(block, vdupq_n_u8('+')),
+                             vcleq_u8(block, vdupq_n_u8(':')));
+    ok = vorrq_u8(ok, vandq_u8(vcgeq_u8(lower, vdupq_n_u8('a')),
+                               vcleq_u8(lower, vdupq_n_u8('z'))));
+    ok = vorrq_u8(ok, vceqq_u8(block, vdupq_n_u8('_')));
+    ok = vorrq_u8(ok, vcgeq_u8(block, vdupq_n_u8(0x80)));
+    if (vminvq_u8(ok) == 0)
+      break;
   }
+#endif
+  return p;
+}
+
+namespace {
+
+/// Whether each byte is known to be safe in a shell word, unquoted.
+struct ShellSafeCharacters {
+  ShellSafeCharacters() {
+    for (int ch = 0; ch < 256; ++ch) {
+      safe[ch] = ('A' <= ch && ch <= 'Z') || ('a' <= ch && ch <= 'z') ||
+                 ('0' <= ch && ch <= '9') || ch == '_' || ch == '+' ||
+                 ch == '-' || ch == '.' || ch == '/';
+    }
+  }
+  bool safe[256];
+} const kShellSafeCharacters;
+
+}  // anonymous namespace
+
+static inline bool IsKnownShellSafeCharacter(char ch) {
+  return kShellSafeCharacters.safe[static_cast<unsigned char>(ch)];
 }
 
 static inline bool IsKnownWin32SafeCharacter(char ch) {
@@ -319,6 +482,40 @@ void GetWin32EscapedString(const string& input, string* result) {
   result->push_back(kQuote);
 }
 
+/// Whether any byte of |word| is a quote or a backslash.
+static inline bool WordNeedsJSONEscaping(uint64_t word) {
+  const uint64_t kOnes = 0x0101010101010101ull;
+  const uint64_t kHighBits = 0x8080808080808080ull;
+  uint64_t quotes = word ^ (kOnes * '"');
+  uint64_t backslashes = word ^ (kOnes * '\\');
+  // A byte of these is zero where |word| has the character.
+  return (((quotes - kOnes) & ~quotes) |
+          ((backslashes - kOnes) & ~backslashes)) & kHighBits;
+}
+
+void GetJSONEscapedString(const string& input, string* result) {
+  assert(result);
+  const char* begin = input.data();
+  const char* end = begin + input.size();
+  const char* span_begin = begin;
+  const char* it = begin;
+  while (it != end) {
+    // Skip eight characters at a time while there's nothing to escape.
+    uint64_t word;
+    if (end - it >= 8 && (memcpy(&word, it, 8), !WordNeedsJSONEscaping(word))) {
+      it += 8;
+      continue;
+    }
+    if (*it == '"' || *it == '\\') {
+      result->append(span_begin, it);
+      result->push_back('\\');
+      span_begin = it;
+    }
+    ++it;
+  }
+  result->append(span_begin, end);
+}
+
 int ReadFile(const string& path, string* contents, string* err) {
 #ifdef _WIN32
   // This makes a ninja run on a set of 1500 manifest files about 4% faster
@@ -464,25 +661,37 @@ bool islatinalpha(int c) {
 
 string StripAnsiEscapeCodes(const string& in) {
   string stripped;
-  stripped.reserve(in.size());
-
-  for (size_t i = 0; i < in.size(); ++i) {
-    if (in[i] != '\33') {
-      // Not an escape code.
-      stripped.push_back(in[i]);
-      continue;
-    }
+  return StripAnsiEscapeCodes(in, &stripped);
+}
 
+const string& StripAnsiEscapeCodes(const string& in, string* stripped) {
+  // memchr() finds the escapes many bytes at a time, and the text between
+  // them is copied as a whole.
+  const char* end = in.data() + in.size();
+  const char* escape =
+      static_cast<const char*>(memchr(in.data(), '\33', in.size()));
+  if (!escape)
+    return in;
+
+  stripped->clear();
+  stripped->reserve(in.size());
+  const char* run = in.data();
+  while (escape) {
+    stripped->append(run, escape);
+    run = escape + 1;
     // Only strip CSIs for now.
-    if (i + 1 >= in.size()) break;
-    if (in[i + 1] != '[') continue;  // Not a CSI.
-    i += 2;
-
-    // Skip everything up to and including the next [a-zA-Z].
-    while (i < in.size() && !islatinalpha(in[i]))
-      ++i;
+    if (run != end && *run == '[') {
+      // Skip everything up to and including the next [a-zA-Z].
+      ++run;
+      while (run != end && !islatinalpha(*run))
+        ++run;
+      if (run != end)
+        ++run;
+    }
+    escape = static_cast<const char*>(memchr(run, '\33', end - run));
   }
-  return stripped;
+  stripped->append(run, end);
+  return *stripped;
 }
 
 int GetProcessorCount() {
@@ -608,6 +817,129 @@ double GetLoadAverage() {
 }
 #endif // _WIN32
 
+bool GetCpuTimes(CpuTimes* times) {
+#if defined(_WIN32) || defined(__CYGWIN__)
+  FILETIME idle_time, kernel_time, user_time;
+  if (!GetSystemTimes(&idle_time, &kernel_time, &user_time))
+    return false;
+  // The kernel time includes the idle time.
+  times->total = FileTimeToTickCount(kernel_time) +
+                 FileTimeToTickCount(user_time);
+  times->idle = FileTimeToTickCount(idle_time);
+  times->iowait = 0;
+  return true;
+#elif defined(__linux__)
+  FILE* f = fopen("/proc/stat", "r");
+  if (!f)
+    return false;
+  unsigned long long user = 0, nice = 0, system = 0, idle = 0, iowait = 0,
+                     irq = 0, softirq = 0, steal = 0;
+  int fields = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &user,
+                      &nice, &system, &idle, &iowait, &irq, &softirq, &steal);
+  fclose(f);
+  if (fields < 4)
+    return false;
+  times->total = user + nice + system + idle + iowait + irq + softirq + steal;
+  times->idle = idle + iowait;
+  times->iowait = iowait;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool ParseCpuList(const string& list, vector<int>* cpus) {
+  cpus->clear();
+  const char* p = list.c_str();
+  while (*p != '\0' && *p != '\n') {
+    char* end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p || first < 0)
+      return false;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1 || last < first)
+        return false;
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; ++cpu)
+      cpus->push_back((int)cpu);
+    if (*p == ',')
+      ++p;
+    else if (*p != '\0' && *p != '\n')
+      return false;
+  }
+  return !cpus->empty();
+}
+
+vector<vector<int> > GetNumaNodeCpus() {
+  vector<vector<int> > nodes;
+#ifdef __linux__
+  string list, err;
+  vector<int> online;
+  if (ReadFile("/sys/devices/system/node/online", &list, &err) < 0 ||
+      !ParseCpuList(list, &online))
+    return nodes;
+  for (size_t i = 0; i < online.size(); ++i) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             online[i]);
+    vector<int> cpus;
+    list.clear();
+    // Nodes of memory alone have no CPUs.
+    if (ReadFile(path, &list, &err) >= 0 && ParseCpuList(list, &cpus))
+      nodes.push_back(cpus);
+  }
+#endif
+  return nodes;
+}
+
+int64_t GetAvailableMemory() {
+#ifdef _WIN32
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status))
+    return -1;
+  return (int64_t)status.ullAvailPhys;
+#elif defined(__linux__)
+  // MemAvailable counts the page cache that can be dropped, unlike the
+  // free memory of sysinfo().
+  FILE* f = fopen("/proc/meminfo", "r");
+  if (!f)
+    return -1;
+  char line[256];
+  long long kilobytes = -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "MemAvailable: %lld kB", &kilobytes) == 1)
+      break;
+  }
+  fclose(f);
+  return kilobytes < 0 ? -1 : (int64_t)kilobytes << 10;
+#else
+  return -1;
+#endif
+}
+
+double GetMemoryPressure() {
+#ifdef __linux__
+  FILE* f = fopen("/proc/pressure/memory", "r");
+  if (!f)
+    return -1.0;
+  char line[256];
+  double stall = -1.0;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "full avg10=%lf", &stall) == 1)
+      break;
+  }
+  fclose(f);
+  return stall;
+#else
+  return -1.0;
+#endif
+}
+
 string ElideMiddle(const string& str, size_t width) {
   switch (width) {
       case 0: return "";
@@ -643,3 +975,94 @@ bool Truncate(const string& path, size_t size, string* err) {
   }
   return true;
 }
+
+namespace {
+
+/// Multiply |a| and |b| into 128 bits, returning the low half in |a| and the
+/// high half in |b|.
+inline void Multiply128(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = *a;
+  r *= *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  *a = _umul128(*a, *b, b);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32;
+  uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+inline uint64_t Mix(uint64_t a, uint64_t b) {
+  Multiply128(&a, &b);
+  return a ^ b;
+}
+
+inline uint64_t Read64(const unsigned char* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t Read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+}  // anonymous namespace
+
+// After wyhash (final version 4) by Wang Yi, which is in the public domain.
+uint64_t Hash64(const void* key, size_t len) {
+  static const uint64_t kSecret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+  };
+  const unsigned char* p = (const unsigned char*)key;
+  uint64_t seed = 0xDECAFBADDECAFBADull;
+  seed ^= Mix(seed ^ kSecret[0], kSecret[1]);
+  uint64_t a, b;
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (Read32(p) << 32) | Read32(p + ((len >> 3) << 2));
+      b = (Read32(p + len - 4) << 32) | Read32(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t seed1 = seed, seed2 = seed;
+      do {
+        seed = Mix(Read64(p) ^ kSecret[1], Read64(p + 8) ^ seed);
+        seed1 = Mix(Read64(p + 16) ^ kSecret[2], Read64(p + 24) ^ seed1);
+        seed2 = Mix(Read64(p + 32) ^ kSecret[3], Read64(p + 40) ^ seed2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (i > 16) {
+      seed = Mix(Read64(p) ^ kSecret[1], Read64(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = Read64(p + i - 16);
+    b = Read64(p + i - 8);
+  }
+  a ^= kSecret[1];
+  b ^= seed;
+  Multiply128(&a, &b);
+  return Mix(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
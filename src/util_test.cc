@@ -370,6 +370,33 @@ TEST(CanonicalizePath, NotNullTerminated) {
   EXPECT_EQ("file ./file bar/.", string(path));
 }
 
+// The fast path for canonical paths agrees with the scalar loop.
+TEST(CanonicalizePath, MatchesScalar) {
+  const char kChars[] = "ab./\\";
+  unsigned seed = 1;
+  for (int n = 0; n < 100000; ++n) {
+    seed = seed * 1103515245 + 12345;
+    size_t size = 1 + (seed >> 16) % 80;
+    string path;
+    for (size_t i = 0; i < size; ++i) {
+      seed = seed * 1103515245 + 12345;
+      // Mostly letters and slashes, so that some paths are canonical.
+      unsigned r = (seed >> 16) % 16;
+      path.push_back(r < 8 ? 'a' : r < 10 ? '/' : kChars[(r - 10) % 5]);
+    }
+    string fast = path, scalar = path;
+    size_t fast_len = size, scalar_len = size;
+    uint64_t fast_bits = 1, scalar_bits = 2;
+    string err;
+    EXPECT_EQ(CanonicalizePathScalar(&scalar[0], &scalar_len, &scalar_bits,
+                                     &err),
+              CanonicalizePath(&fast[0], &fast_len, &fast_bits, &err));
+    EXPECT_EQ(scalar, fast);
+    EXPECT_EQ(scalar_len, fast_len);
+    EXPECT_EQ(scalar_bits, fast_bits);
+  }
+}
+
 TEST(PathEscaping, TortureTest) {
   string result;
 
@@ -401,6 +428,17 @@ TEST(PathEscaping, SensibleWin32PathsAreNotNeedlesslyEscaped) {
   EXPECT_EQ(path, result);
 }
 
+TEST(PathEscaping, JSONEscape) {
+  string result;
+  GetJSONEscapedString("plain/path/without/anything/to/escape.c", &result);
+  EXPECT_EQ("plain/path/without/anything/to/escape.c", result);
+
+  // Escapes are found within runs of eight characters, and after them.
+  result.clear();
+  GetJSONEscapedString("echo \"a\\b\" && echo longer_than_eight\\", &result);
+  EXPECT_EQ("echo \\\"a\\\\b\\\" && echo longer_than_eight\\\\", result);
+}
+
 TEST(StripAnsiEscapeCodes, EscapeAtEnd) {
   string stripped = StripAnsiEscapeCodes("foo\33");
   EXPECT_EQ("foo", stripped);
@@ -418,6 +456,47 @@ TEST(StripAnsiEscapeCodes, StripColors) {
             stripped);
 }
 
+TEST(StripAnsiEscapeCodes, NoCopyWithoutEscapes) {
+  string input = "plain output\n", stripped;
+  EXPECT_EQ(&input, &StripAnsiEscapeCodes(input, &stripped));
+  EXPECT_EQ("", stripped);
+
+  // Escapes that don't start a CSI lose only the escape character.
+  input = "a\33b\33\33[1mc\33[0m";
+  EXPECT_EQ(&stripped, &StripAnsiEscapeCodes(input, &stripped));
+  EXPECT_EQ("abc", stripped);
+}
+
+TEST(CpuList, Parse) {
+  vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("0-2,8,10-11\n", &cpus));
+  ASSERT_EQ(6u, cpus.size());
+  EXPECT_EQ(0, cpus[0]);
+  EXPECT_EQ(2, cpus[2]);
+  EXPECT_EQ(8, cpus[3]);
+  EXPECT_EQ(11, cpus[5]);
+
+  EXPECT_FALSE(ParseCpuList("", &cpus));
+  EXPECT_FALSE(ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("1;2", &cpus));
+  EXPECT_FALSE(ParseCpuList("-1", &cpus));
+
+  // Each node found has CPUs.
+  vector<vector<int> > nodes = GetNumaNodeCpus();
+  for (size_t i = 0; i < nodes.size(); ++i)
+    EXPECT_FALSE(nodes[i].empty());
+}
+
+TEST(Memory, Available) {
+  int64_t available = GetAvailableMemory();
+#if defined(_WIN32) || defined(__linux__)
+  EXPECT_GT(available, 0);
+#endif
+  // The pressure is a percentage, when known.
+  EXPECT_LE(GetMemoryPressure(), 100.0);
+  (void)available;
+}
+
 TEST(ElideMiddle, NothingToElide) {
   string input = "Nothing to elide in this short string.";
   EXPECT_EQ(input, ElideMiddle(input, 80));